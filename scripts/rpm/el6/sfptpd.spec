@@ -64,7 +64,7 @@ rm -rf $RPM_BUILD_ROOT
 %make_install
 install -m 755 -p -D scripts/rpm/el6/sfptpd.init %{buildroot}/etc/init.d/sfptpd
 mkdir -p %{buildroot}%{_localstatedir}/lib/%{name}
-touch %{buildroot}%{_localstatedir}/lib/%{name}/{config,interfaces,sync-instances,topology,version,ptp-nodes}
+touch %{buildroot}%{_localstatedir}/lib/%{name}/{config,interfaces,sync-instances,startup,topology,version,ptp-nodes}
 
 %files
 %attr(755, root, root) %{_sbindir}/sfptpd
@@ -87,6 +87,7 @@ touch %{buildroot}%{_localstatedir}/lib/%{name}/{config,interfaces,sync-instance
 %ghost %{_localstatedir}/lib/%{name}/config
 %ghost %{_localstatedir}/lib/%{name}/interfaces
 %ghost %{_localstatedir}/lib/%{name}/sync-instances
+%ghost %{_localstatedir}/lib/%{name}/startup
 %ghost %{_localstatedir}/lib/%{name}/topology
 %ghost %{_localstatedir}/lib/%{name}/version
 %ghost %{_localstatedir}/lib/%{name}/ptp-nodes
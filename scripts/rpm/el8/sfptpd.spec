@@ -61,7 +61,7 @@ export INST_OMIT="license"
 export INST_INITS="systemd"
 %make_install
 mkdir -p %{buildroot}%{_localstatedir}/lib/%{name}
-touch %{buildroot}%{_localstatedir}/lib/%{name}/{config,interfaces,sync-instances,topology,version,ptp-nodes}
+touch %{buildroot}%{_localstatedir}/lib/%{name}/{config,interfaces,sync-instances,startup,topology,version,ptp-nodes}
 
 %check
 make fast_test
@@ -94,6 +94,7 @@ make fast_test
 %ghost %{_localstatedir}/lib/%{name}/config
 %ghost %{_localstatedir}/lib/%{name}/interfaces
 %ghost %{_localstatedir}/lib/%{name}/sync-instances
+%ghost %{_localstatedir}/lib/%{name}/startup
 %ghost %{_localstatedir}/lib/%{name}/topology
 %ghost %{_localstatedir}/lib/%{name}/version
 %ghost %{_localstatedir}/lib/%{name}/ptp-nodes
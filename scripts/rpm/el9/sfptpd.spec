@@ -66,7 +66,7 @@ export INST_INITS="systemd"
 install -m 644 -p -D %{SOURCE1} %{buildroot}%{_sysusersdir}/%{name}.conf
 install -m 644 -p -D scripts/udev/55-sfptpd.rules %{buildroot}%{_udevrulesdir}/55-sfptpd.rules
 mkdir -p %{buildroot}%{_localstatedir}/lib/%{name}
-touch %{buildroot}%{_localstatedir}/lib/%{name}/{config,interfaces,sync-instances,topology,version,ptp-nodes}
+touch %{buildroot}%{_localstatedir}/lib/%{name}/{config,interfaces,sync-instances,startup,topology,version,ptp-nodes}
 
 %check
 make fast_test
@@ -104,6 +104,7 @@ make fast_test
 %ghost %attr(-,sfptpd,sfptpd) %{_localstatedir}/lib/%{name}/config
 %ghost %attr(-,sfptpd,sfptpd) %{_localstatedir}/lib/%{name}/interfaces
 %ghost %attr(-,sfptpd,sfptpd) %{_localstatedir}/lib/%{name}/sync-instances
+%ghost %attr(-,sfptpd,sfptpd) %{_localstatedir}/lib/%{name}/startup
 %ghost %attr(-,sfptpd,sfptpd) %{_localstatedir}/lib/%{name}/topology
 %ghost %attr(-,sfptpd,sfptpd) %{_localstatedir}/lib/%{name}/version
 %ghost %attr(-,sfptpd,sfptpd) %{_localstatedir}/lib/%{name}/ptp-nodes
@@ -6,7 +6,7 @@
 include mk/pushd.mk
 
 
-LIB_SRCS_$(d) := sfptpd_crny_module.c
+LIB_SRCS_$(d) := sfptpd_crny_module.c sfptpd_crny_refclock.c
 
 LIB_$(d) := crny
 
@@ -56,6 +56,13 @@
 #define DBG_L5(x, ...)  TRACE(SFPTPD_COMPONENT_ID_NTP, 5, x, ##__VA_ARGS__)
 #define DBG_L6(x, ...)  TRACE(SFPTPD_COMPONENT_ID_NTP, 6, x, ##__VA_ARGS__)
 
+/* Maximum number of requests in a status refresh: tracking, source count
+ * and one at a time for each source */
+#define CRNY_MAX_QUERIES (SFPTPD_NTP_PEERS_MAX + 2)
+
+/* Maximum number of requests to have in flight to chronyd at once */
+#define CRNY_MAX_REQUESTS_IN_FLIGHT (8)
+
 
 /****************************************************************************
  * Types
@@ -66,10 +73,7 @@ enum ntp_query_state {
 	NTP_QUERY_STATE_SLEEP_CONNECTED,
 	NTP_QUERY_STATE_CONNECT,
 	NTP_QUERY_STATE_CONNECT_WAIT,
-	NTP_QUERY_STATE_SYS_INFO,
-	NTP_QUERY_STATE_SOURCE_COUNT,
-	NTP_QUERY_STATE_SOURCE_DATUM,
-	NTP_QUERY_STATE_NTP_DATUM,
+	NTP_QUERY_STATE_REFRESH,
 };
 
 enum ntp_query_event {
@@ -83,7 +87,17 @@ enum ntp_query_event {
 
 enum ntp_stats_ids {
 	NTP_STATS_ID_OFFSET,
-	NTP_STATS_ID_SYNCHRONIZED
+	NTP_STATS_ID_SYNCHRONIZED,
+	NTP_STATS_ID_REFRESH_TIME,
+};
+
+/* Kinds of request made to chronyd during a status refresh */
+enum crny_query_type {
+	CRNY_QUERY_NONE,
+	CRNY_QUERY_SYS_INFO,
+	CRNY_QUERY_SOURCE_COUNT,
+	CRNY_QUERY_SOURCE_DATUM,
+	CRNY_QUERY_NTP_DATUM,
 };
 
 
@@ -152,10 +166,35 @@ struct ntp_state {
 };
 
 
-struct crny_comm {
+/* A chrony command request, matched to its reply by sequence number */
+struct crny_query {
+	/* Kind of request or CRNY_QUERY_NONE if the slot is free */
+	enum crny_query_type type;
+
+	/* Index of the source the request is about */
+	int src_idx;
+
+	/* Whether the request has been sent */
+	bool sent;
 
 	/* Chrony command request */
 	struct crny_cmd_request req;
+};
+
+
+struct crny_comm {
+
+	/* Chrony command requests for the current status refresh */
+	struct crny_query queries[CRNY_MAX_QUERIES];
+
+	/* Number of requests queued, including those in flight */
+	int num_queued;
+
+	/* Number of requests sent and awaiting a reply */
+	int num_in_flight;
+
+	/* Sequence number for the next request */
+	uint32_t next_seq;
 
 	/* Chrony command response */
 	struct crny_cmd_response resp;
@@ -186,11 +225,13 @@ typedef struct sfptpd_crny_module {
 
 	/* NTP daemon query state. */
 	enum ntp_query_state query_state;
-	int query_src_idx;
 
 	/* Time for next poll of the NTP daemon */
 	struct sfptpd_timespec next_poll_time;
 
+	/* Time at which the current status refresh started */
+	struct sfptpd_timespec refresh_start_time;
+
 	/* Time for control reply timeout */
 	struct sfptpd_timespec reply_expiry_time;
 
@@ -235,7 +276,8 @@ typedef struct sfptpd_crny_module {
 static const struct sfptpd_stats_collection_defn ntp_stats_defns[] =
 {
 	{NTP_STATS_ID_OFFSET,       SFPTPD_STATS_TYPE_RANGE, "offset-from-peer", "ns", 0},
-	{NTP_STATS_ID_SYNCHRONIZED, SFPTPD_STATS_TYPE_COUNT, "synchronized"}
+	{NTP_STATS_ID_SYNCHRONIZED, SFPTPD_STATS_TYPE_COUNT, "synchronized"},
+	{NTP_STATS_ID_REFRESH_TIME, SFPTPD_STATS_TYPE_RANGE, "refresh-time", "us", 0},
 };
 
 static const char *query_state_names[] = {
@@ -243,10 +285,7 @@ static const char *query_state_names[] = {
 	"SLEEP_CONNECTED",
 	"CONNECT",
 	"CONNECT_WAIT",
-	"SYS_INFO",
-	"SOURCE_COUNT",
-	"SOURCE_DATUM",
-	"NTP_DATUM",
+	"REFRESH",
 };
 
 static const char *query_event_names[] = {
@@ -622,7 +661,6 @@ static void chrony_req_initialize(struct crny_cmd_request* req, uint16_t cmd)
 {
 	memset(req, '\0', sizeof *req);
 	*req = CMD_REQ_DEFAULT;
-	req->randoms = rand();
 	req->cmd1 = htons(cmd);
 }
 
@@ -635,6 +673,9 @@ int crny_stats_init(crny_module_t *ntp)
 	rc = sfptpd_stats_collection_create(&ntp->stats, "ntp",
 					    sizeof(ntp_stats_defns)/sizeof(ntp_stats_defns[0]),
 					    ntp_stats_defns);
+	if (rc == 0)
+		sfptpd_stats_collection_persist(&ntp->stats, NULL,
+						SFPTPD_CONFIG_GET_NAME(ntp->config));
 	return rc;
 }
 
@@ -926,31 +967,82 @@ int crny_configure_ntpd(crny_module_t *ntp)
 }
 
 
-static int issue_request(crny_module_t *ntp)
+static void crny_reset_queries(crny_module_t *ntp)
 {
-	int rc;
 	struct crny_comm *comm = &ntp->crny_comm;
-	struct crny_cmd_request *req = &comm->req;
+	int i;
+
+	for (i = 0; i < CRNY_MAX_QUERIES; i++)
+		comm->queries[i].type = CRNY_QUERY_NONE;
+	comm->num_queued = 0;
+	comm->num_in_flight = 0;
+}
+
+
+/* Queue a request for the current status refresh. Returns the request to
+ * be filled in or NULL if there is no space. */
+static struct crny_cmd_request *queue_request(crny_module_t *ntp,
+					      enum crny_query_type type,
+					      int src_idx, uint16_t cmd)
+{
+	struct crny_comm *comm = &ntp->crny_comm;
+	struct crny_query *query;
+	int i;
+
+	for (i = 0; i < CRNY_MAX_QUERIES; i++) {
+		query = comm->queries + i;
+		if (query->type == CRNY_QUERY_NONE) {
+			query->type = type;
+			query->src_idx = src_idx;
+			query->sent = false;
+			chrony_req_initialize(&query->req, cmd);
+			comm->num_queued++;
+			return &query->req;
+		}
+	}
+
+	ERROR("crny: no space to queue request %d\n", cmd);
+	return NULL;
+}
+
+
+/* Determine the timeout for the outstanding requests */
+static void set_reply_expiry_time(crny_module_t *ntp)
+{
 	const struct sfptpd_timespec timeout = { .sec = REPLY_TIMEOUT / 1000000000L,
 						 .nsec = REPLY_TIMEOUT % 1000000000L };
 
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &ntp->reply_expiry_time);
+	sfptpd_time_add(&ntp->reply_expiry_time, &ntp->reply_expiry_time, &timeout);
+}
+
+
+static int issue_request(crny_module_t *ntp, struct crny_query *query)
+{
+	int rc;
+	struct crny_comm *comm = &ntp->crny_comm;
+	struct crny_cmd_request *req = &query->req;
+
 	assert(ntp != NULL);
 
 	if (comm->sock < 0) {
 		return ENOTCONN;
 	}
 
+	/* The sequence number is echoed in the reply, which is how replies
+	 * are matched to requests when several are in flight */
+	req->randoms = comm->next_seq++;
+
 	DBG_L6("crny: req(ver=%d, pkt=%d, cmd=%d, attempt=%d, seq=%d)\n",
 	       req->header[0], req->header[1],
 	       ntohs(req->cmd1), ntohs(req->ignore), req->randoms);
 
-	/* Determine the timeout for this request */
-	(void)sfclock_gettime(CLOCK_MONOTONIC, &ntp->reply_expiry_time);
-	sfptpd_time_add(&ntp->reply_expiry_time, &ntp->reply_expiry_time, &timeout);
-
 	rc = send(comm->sock, req, sizeof(*req), 0);
 	if (rc == -1) {
-		if (errno == ENOTCONN || errno == ECONNREFUSED) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			DBG_L6("crny: chronyd socket full, deferring request\n");
+			return EAGAIN;
+		} else if (errno == ENOTCONN || errno == ECONNREFUSED) {
 			ERROR("crny: control connection disconnected, %s\n",
 			      strerror(errno));
 			crny_close_socket(ntp);
@@ -962,6 +1054,40 @@ static int issue_request(crny_module_t *ntp)
 		}
 	}
 
+	set_reply_expiry_time(ntp);
+
+	return 0;
+}
+
+
+/* Send queued requests, keeping no more than CRNY_MAX_REQUESTS_IN_FLIGHT
+ * outstanding so as not to overflow the chronyd socket queue. Requests
+ * that cannot be sent yet are retried when replies arrive or on the next
+ * tick. */
+static int send_requests(crny_module_t *ntp)
+{
+	struct crny_comm *comm = &ntp->crny_comm;
+	struct crny_query *query;
+	int rc;
+	int i;
+
+	for (i = 0;
+	     i < CRNY_MAX_QUERIES && comm->num_in_flight < CRNY_MAX_REQUESTS_IN_FLIGHT;
+	     i++) {
+		query = comm->queries + i;
+		if (query->type == CRNY_QUERY_NONE || query->sent)
+			continue;
+
+		rc = issue_request(ntp, query);
+		if (rc == EAGAIN)
+			break;
+		else if (rc != 0)
+			return rc;
+
+		query->sent = true;
+		comm->num_in_flight++;
+	}
+
 	return 0;
 }
 
@@ -1008,32 +1134,38 @@ static int check_reply(struct crny_cmd_request *request,
 }
 
 
-static int issue_get_sys_info(crny_module_t *ntp)
+/* Start a status refresh. The tracking and source count requests do not
+ * depend on each other so both are sent straight away. */
+static int crny_start_refresh(crny_module_t *ntp)
 {
 	int rc;
 
 	/* Start from previous state */
 	ntp->next_state = ntp->state;
 
-	/* Generate tracking request */
-	chrony_req_initialize(&ntp->crny_comm.req, CRNY_REQ_TRACKING_STATE);
+	crny_reset_queries(ntp);
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &ntp->refresh_start_time);
+	set_reply_expiry_time(ntp);
 
-	/* Allocate space for receiving reply */
-	rc = issue_request(ntp);
+	if (queue_request(ntp, CRNY_QUERY_SYS_INFO, 0, CRNY_REQ_TRACKING_STATE) == NULL ||
+	    queue_request(ntp, CRNY_QUERY_SOURCE_COUNT, 0, CRNY_REQ_GET_NUM_SOURCES) == NULL)
+		return ENOSPC;
+
+	rc = send_requests(ntp);
 	if (rc != 0) {
-		DBG_L6("crny: get-sys-info: chrony_send_recv failed, %s\n",
-		       strerror(errno));
+		DBG_L6("crny: start-refresh: sending requests failed, %s\n",
+		       strerror(rc));
 	}
 
 	return rc;
 }
 
 
-static int handle_get_sys_info(crny_module_t *ntp)
+static int handle_get_sys_info(crny_module_t *ntp, struct crny_query *query)
 {
 	int rc;
 	struct crny_comm *comm = &ntp->crny_comm;
-	struct crny_cmd_request *req = &comm->req;
+	struct crny_cmd_request *req = &query->req;
 	struct crny_cmd_response *reply = &comm->resp;
 	struct sfptpd_ntpclient_sys_info sys_info;
 	struct ntp_state *next_state = &ntp->next_state;
@@ -1088,17 +1220,11 @@ static int handle_get_sys_info(crny_module_t *ntp)
 	return 0;
 }
 
-int issue_get_source_count(crny_module_t *ntp)
-{
-	chrony_req_initialize(&ntp->crny_comm.req, CRNY_REQ_GET_NUM_SOURCES);
-	return issue_request(ntp);
-}
-
-int handle_get_source_count(crny_module_t *ntp)
+int handle_get_source_count(crny_module_t *ntp, struct crny_query *query)
 {
 	int rc;
 	struct crny_comm *comm = &ntp->crny_comm;
-	struct crny_cmd_request *req = &comm->req;
+	struct crny_cmd_request *req = &query->req;
 	struct crny_cmd_response *reply = &comm->resp;
 	struct ntp_state *next_state = &ntp->next_state;
 
@@ -1122,31 +1248,34 @@ int handle_get_source_count(crny_module_t *ntp)
 	return 0;
 }
 
-int issue_get_source_datum(crny_module_t *ntp)
+int issue_get_source_datum(crny_module_t *ntp, int src_idx)
 {
-	struct sfptpd_ntpclient_peer *peer = &ntp->next_state.peer_info.peers[ntp->query_src_idx];
+	struct sfptpd_ntpclient_peer *peer = &ntp->next_state.peer_info.peers[src_idx];
+	struct crny_cmd_request *req;
 
 	memset(peer, '\0', sizeof *peer);
-	chrony_req_initialize(&ntp->crny_comm.req, CRNY_REQ_SOURCE_DATA_ITEM);
-	*((int32_t *) &ntp->crny_comm.req.cmd2) = htonl(ntp->query_src_idx);
+	req = queue_request(ntp, CRNY_QUERY_SOURCE_DATUM, src_idx, CRNY_REQ_SOURCE_DATA_ITEM);
+	if (req == NULL)
+		return ENOSPC;
+	*((int32_t *) &req->cmd2) = htonl(src_idx);
 
-	return issue_request(ntp);
+	return 0;
 }
 
-int handle_get_source_datum(crny_module_t *ntp)
+int handle_get_source_datum(crny_module_t *ntp, struct crny_query *query)
 {
 	int rc;
 	struct crny_addr *ip_addr;
 	struct crny_comm *comm = &ntp->crny_comm;
-	struct crny_cmd_request *req = &comm->req;
+	struct crny_cmd_request *req = &query->req;
 	struct crny_cmd_response *reply = &comm->resp;
 	struct ntp_state *next_state = &ntp->next_state;
-	struct sfptpd_ntpclient_peer *peer = &next_state->peer_info.peers[ntp->query_src_idx];
+	struct sfptpd_ntpclient_peer *peer = &next_state->peer_info.peers[query->src_idx];
 
 	rc = check_reply(req, reply, CRNY_RESP_SOURCE_DATA_ITEM);
 	if (rc != 0) {
 		DBG_L6("crny: get-peer%d-info: invalid reply, %s\n",
-		       ntp->query_src_idx, strerror(errno));
+		       query->src_idx, strerror(errno));
 		return ENOENT;
 	}
 
@@ -1156,54 +1285,50 @@ int handle_get_source_datum(crny_module_t *ntp)
 	enum crny_src_mode_code mode = ntohs(src_data->mode);
 
 	DBG_L6("crny: get-peer%d-info: mode %d state %d\n",
-	       ntp->query_src_idx, mode, state);
+	       query->src_idx, mode, state);
 
 	peer->selected = (state == CRNY_STATE_SYSPEER);
 	peer->shortlist = (state == CRNY_STATE_CANDIDATE);
 	peer->self = (mode == CRNY_SRC_MODE_REF);
 
 	if (mode == CRNY_SRC_MODE_REF) {
-		DBG_L6("crny: get-peer%d-info: source is a reference clock\n", ntp->query_src_idx);
+		DBG_L6("crny: get-peer%d-info: source is a reference clock\n", query->src_idx);
 		/* No peer information will be avaliable via NTPDATA request */
 		return ENOENT;
 	}
 
-	/* Go straight on to populate following NTPDATA request */
-	chrony_req_initialize(&ntp->crny_comm.req, CRNY_REQ_NTP_DATA);
-
 	/* Specify which record we want ntpdata to fetch by giving it
-	   the ip address of the peer.
-	   Copy directly from reply into request. */
+	   the ip address of the peer. */
 	ip_addr = &src_data->ip_addr;
 	if (ip_addr->addr_family == 0) {
-		DBG_L6("crny: get-peer%d-info: address family unspecified in tracking reply.\n", ntp->query_src_idx);
+		DBG_L6("crny: get-peer%d-info: address family unspecified in tracking reply.\n", query->src_idx);
 		return ENOENT;
 	}
-	memcpy(&ntp->crny_comm.req.cmd2, ip_addr, sizeof(*ip_addr));
 
-	return 0;
-}
+	/* Go straight on to queue following NTPDATA request, copying the
+	   address directly from reply into request. */
+	req = queue_request(ntp, CRNY_QUERY_NTP_DATUM, query->src_idx, CRNY_REQ_NTP_DATA);
+	if (req == NULL)
+		return ENOSPC;
+	memcpy(&req->cmd2, ip_addr, sizeof(*ip_addr));
 
-int issue_get_ntp_datum(crny_module_t *ntp)
-{
-	/* Request already populated when source request handled */
-	return issue_request(ntp);
+	return 0;
 }
 
-int handle_get_ntp_datum(crny_module_t *ntp)
+int handle_get_ntp_datum(crny_module_t *ntp, struct crny_query *query)
 {
 	int rc;
 	struct crny_comm *comm = &ntp->crny_comm;
-	struct crny_cmd_request *req = &comm->req;
+	struct crny_cmd_request *req = &query->req;
 	struct crny_cmd_response *reply = &comm->resp;
 	struct ntp_state *next_state = &ntp->next_state;
-	struct sfptpd_ntpclient_peer *peer = &next_state->peer_info.peers[ntp->query_src_idx];
+	struct sfptpd_ntpclient_peer *peer = &next_state->peer_info.peers[query->src_idx];
 
 	struct crny_ntpdata *answer = (struct crny_ntpdata *)(&reply->data);
 	rc = check_reply(req, reply, CRNY_RESP_NTP_DATA);
 	if (rc != 0) {
 		DBG_L6("crny: get-chrony-peer%d-info: invalid reply, %s\n",
-		       ntp->query_src_idx, strerror(errno));
+		       query->src_idx, strerror(errno));
 	} else {
 		sfptpd_crny_addr_to_sockaddr(&peer->remote_address,
 					     &peer->remote_address_len,
@@ -1224,6 +1349,96 @@ int handle_get_ntp_datum(crny_module_t *ntp)
 }
 
 
+/* Match the reply just received to its request by sequence number, handle
+ * it and send any requests that follow on from it. Replies to requests
+ * from an earlier refresh that timed out are discarded. */
+static int crny_handle_reply(crny_module_t *ntp)
+{
+	struct crny_comm *comm = &ntp->crny_comm;
+	struct ntp_state *next_state = &ntp->next_state;
+	struct crny_query query;
+	int rc = 0;
+	int i;
+
+	for (i = 0; i < CRNY_MAX_QUERIES; i++) {
+		if (comm->queries[i].type != CRNY_QUERY_NONE &&
+		    comm->queries[i].sent &&
+		    comm->queries[i].req.randoms == comm->resp.seq_id)
+			break;
+	}
+
+	if (i == CRNY_MAX_QUERIES) {
+		DBG_L4("crny: discarding reply with unexpected sequence number %x\n",
+		       comm->resp.seq_id);
+		return 0;
+	}
+
+	/* Release the slot before handling the reply so that it can be used
+	 * for a follow-on request */
+	query = comm->queries[i];
+	comm->queries[i].type = CRNY_QUERY_NONE;
+	comm->num_queued--;
+	comm->num_in_flight--;
+
+	switch (query.type) {
+	case CRNY_QUERY_SYS_INFO:
+		(void)handle_get_sys_info(ntp, &query);
+		break;
+
+	case CRNY_QUERY_SOURCE_COUNT:
+		(void)handle_get_source_count(ntp, &query);
+		for (i = 0; i < next_state->peer_info.num_peers && rc == 0; i++)
+			rc = issue_get_source_datum(ntp, i);
+		break;
+
+	case CRNY_QUERY_SOURCE_DATUM:
+		if (handle_get_source_datum(ntp, &query) == ENOSPC)
+			rc = ENOSPC;
+		break;
+
+	case CRNY_QUERY_NTP_DATUM:
+		(void)handle_get_ntp_datum(ntp, &query);
+		break;
+
+	default:
+		assert(false);
+		break;
+	}
+
+	if (rc == 0)
+		rc = send_requests(ntp);
+
+	return rc;
+}
+
+
+/* Called when all the replies for a status refresh have been received */
+static bool crny_end_refresh(crny_module_t *ntp)
+{
+	struct ntp_state *next_state = &ntp->next_state;
+	struct sfptpd_timespec now;
+	struct sfptpd_timespec latency;
+
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &now);
+	sfptpd_time_subtract(&latency, &now, &ntp->refresh_start_time);
+	DBG_L6("crny: refresh of %d sources took %0.3Lfms\n",
+	       next_state->peer_info.num_peers,
+	       sfptpd_time_timespec_to_float_ns(&latency) / 1.0E6);
+
+	sfptpd_clock_get_time(sfptpd_clock_get_system_clock(), &now);
+	sfptpd_stats_collection_update_range(&ntp->stats, NTP_STATS_ID_REFRESH_TIME,
+					     sfptpd_time_timespec_to_float_ns(&latency) / 1.0E3,
+					     now, true);
+
+	if (next_state->peer_info.num_peers == 0)
+		return false;
+
+	crny_parse_state(next_state, 0, next_state->offset_unsafe);
+	sfptpd_ntpclient_print_peers(&next_state->peer_info, MODULE);
+	return true;
+}
+
+
 static int crny_resolve(crny_module_t *ntp)
 {
 	assert(ntp);
@@ -1265,6 +1480,7 @@ static int crny_connect(crny_module_t *ntp)
 			strerror(rc = errno));
 		return rc;
 	}
+	comm->next_seq = rand();
 
 	int flags = fcntl(comm->sock, F_GETFD);
 	if (flags == -1) {
@@ -1365,10 +1581,10 @@ static bool crny_state_machine(crny_module_t *ntp,
 	case NTP_QUERY_STATE_CONNECT:
 		rc = crny_connect(ntp);
 		if (rc == 0) {
-			if (issue_get_sys_info(ntp) != 0)
+			if (crny_start_refresh(ntp) != 0)
 				disconnect = true;
 			else
-				next_query_state = NTP_QUERY_STATE_SYS_INFO;
+				next_query_state = NTP_QUERY_STATE_REFRESH;
 		} else if (rc == EINPROGRESS) {
 			next_query_state = NTP_QUERY_STATE_CONNECT_WAIT;
 		} else {
@@ -1383,78 +1599,27 @@ static bool crny_state_machine(crny_module_t *ntp,
 			socklen_t sz = sizeof val;
 
 			rc = getsockopt(ntp->crny_comm.sock, SOL_SOCKET, SO_ERROR, &val, &sz);
-			if (rc != 0 || val != 0 || issue_get_sys_info(ntp) != 0)
+			if (rc != 0 || val != 0 || crny_start_refresh(ntp) != 0)
 				disconnect = true;
 			else
-				next_query_state = NTP_QUERY_STATE_SYS_INFO;
+				next_query_state = NTP_QUERY_STATE_REFRESH;
 		} else if (event == NTP_QUERY_EVENT_REPLY_TIMEOUT) {
 			next_query_state = NTP_QUERY_STATE_SLEEP_CONNECTED;
 		}
 		break;
 
-	case NTP_QUERY_STATE_SYS_INFO:
+	case NTP_QUERY_STATE_REFRESH:
 		if (event == NTP_QUERY_EVENT_TRAFFIC) {
-			rc = handle_get_sys_info(ntp);
-			if (issue_get_source_count(ntp) != 0)
+			if (crny_handle_reply(ntp) != 0) {
 				disconnect = true;
-			else
-				next_query_state = NTP_QUERY_STATE_SOURCE_COUNT;
-		} else if (event == NTP_QUERY_EVENT_REPLY_TIMEOUT) {
-			next_query_state = NTP_QUERY_STATE_SLEEP_CONNECTED;
-		}
-		break;
-
-	case NTP_QUERY_STATE_SOURCE_COUNT:
-		if (event == NTP_QUERY_EVENT_TRAFFIC) {
-			rc = handle_get_source_count(ntp);
-			if (next_state->peer_info.num_peers > 0) {
-				ntp->query_src_idx = 0;
-				if (issue_get_source_datum(ntp) != 0)
-					disconnect = true;
-				else
-					next_query_state = NTP_QUERY_STATE_SOURCE_DATUM;
-			} else {
+			} else if (ntp->crny_comm.num_queued == 0) {
+				update = crny_end_refresh(ntp);
 				next_query_state = NTP_QUERY_STATE_SLEEP_CONNECTED;
 			}
-		} else if (event == NTP_QUERY_EVENT_REPLY_TIMEOUT) {
-			next_query_state = NTP_QUERY_STATE_SLEEP_CONNECTED;
-		}
-		break;
-
-	case NTP_QUERY_STATE_SOURCE_DATUM:
-		if (event ==  NTP_QUERY_EVENT_TRAFFIC) {
-			rc = handle_get_source_datum(ntp);
-			if (rc == ENOENT) {
-				if (++ntp->query_src_idx == next_state->peer_info.num_peers) {
-					crny_parse_state(next_state, 0, next_state->offset_unsafe);
-					update = true;
-					sfptpd_ntpclient_print_peers(&next_state->peer_info, MODULE);
-					next_query_state = NTP_QUERY_STATE_SLEEP_CONNECTED;
-				} else if (issue_get_source_datum(ntp) != 0)
-					disconnect = true;
-			} else if (issue_get_ntp_datum(ntp) != 0)
+		} else if (event == NTP_QUERY_EVENT_TICK) {
+			/* Retry any requests that could not be sent before */
+			if (send_requests(ntp) != 0)
 				disconnect = true;
-			else
-				next_query_state = NTP_QUERY_STATE_NTP_DATUM;
-		} else if (event == NTP_QUERY_EVENT_REPLY_TIMEOUT) {
-			next_query_state = NTP_QUERY_STATE_SLEEP_CONNECTED;
-		}
-		break;
-
-	case NTP_QUERY_STATE_NTP_DATUM:
-		if (event == NTP_QUERY_EVENT_TRAFFIC) {
-			rc = handle_get_ntp_datum(ntp);
-			if (++ntp->query_src_idx == next_state->peer_info.num_peers) {
-				crny_parse_state(next_state, 0, next_state->offset_unsafe);
-				update = true;
-				sfptpd_ntpclient_print_peers(&next_state->peer_info, MODULE);
-				next_query_state = NTP_QUERY_STATE_SLEEP_CONNECTED;
-			} else {
-				if (issue_get_source_datum(ntp) != 0)
-					disconnect = true;
-				else
-					next_query_state = NTP_QUERY_STATE_SOURCE_DATUM;
-			}
 		} else if (event == NTP_QUERY_EVENT_REPLY_TIMEOUT) {
 			next_query_state = NTP_QUERY_STATE_SLEEP_CONNECTED;
 		}
@@ -1478,10 +1643,10 @@ static bool crny_state_machine(crny_module_t *ntp,
 		(void)sfclock_gettime(CLOCK_MONOTONIC, &time_now);
 		sfptpd_time_subtract(&time_left, &ntp->next_poll_time, &time_now);
 		if (time_left.sec < 0) {
-			if (issue_get_sys_info(ntp) != 0) {
+			if (crny_start_refresh(ntp) != 0) {
 				disconnect = true;
 			} else {
-				next_query_state = NTP_QUERY_STATE_SYS_INFO;
+				next_query_state = NTP_QUERY_STATE_REFRESH;
 				ntp->next_poll_time.sec += ntp->config->poll_interval;
 			}
 		}
@@ -2310,6 +2475,16 @@ static void ntp_on_shutdown(void *context)
 }
 
 
+static void ntp_on_startup_failed(void *context)
+{
+	crny_module_t *ntp = (crny_module_t *)context;
+	assert(ntp != NULL);
+
+	/* Delete the sync module context */
+	free(ntp);
+}
+
+
 static void ntp_on_message(void *context, struct sfptpd_msg_hdr *hdr)
 {
 	crny_module_t *ntp = (crny_module_t *)context;
@@ -2377,34 +2552,44 @@ static void ntp_on_message(void *context, struct sfptpd_msg_hdr *hdr)
 
 static void crny_do_io(crny_module_t *ntp)
 {
-	enum ntp_query_event event = NTP_QUERY_EVENT_NO_EVENT;
+	enum ntp_query_event event;
 	int rc;
 	struct crny_comm *comm = &ntp->crny_comm;
+	bool update = false;
 
 	assert(ntp != NULL);
 
-	rc = recv(comm->sock, &comm->resp, sizeof(comm->resp), 0);
-	if (rc < 0)
-		rc = -errno;
-
-	if (rc >= 8) {
-		DBG_L6("crny: resp(ver=%d, pkt=%d, cmd=%d, seq=%d)\n",
-		       comm->resp.header[0], comm->resp.header[1],
-		       ntohs(comm->resp.cmd), comm->resp.seq_id);
-		event = NTP_QUERY_EVENT_TRAFFIC;
-	} else if (rc >= 0) {
-		ERROR("crny: useless reply received from chronyd\n");
-	} else if (rc == -EAGAIN || rc == -EINTR) {
-		/* Ignore wakeup */
-		DBG_L6("crny: fd woken up, %s\n", strerror(rc));
-	} else {
-		ERROR("crny: chrony: error receiving reply from chronyd, %s\n",
-		      strerror(rc));
-		event = NTP_QUERY_EVENT_CONN_LOST;
-	}
+	/* With several requests in flight there may be more than one reply
+	 * waiting so handle all of them before updating the state */
+	do {
+		event = NTP_QUERY_EVENT_NO_EVENT;
+
+		rc = recv(comm->sock, &comm->resp, sizeof(comm->resp), 0);
+		if (rc < 0)
+			rc = -errno;
+
+		if (rc >= 8) {
+			DBG_L6("crny: resp(ver=%d, pkt=%d, cmd=%d, seq=%d)\n",
+			       comm->resp.header[0], comm->resp.header[1],
+			       ntohs(comm->resp.cmd), comm->resp.seq_id);
+			event = NTP_QUERY_EVENT_TRAFFIC;
+		} else if (rc >= 0) {
+			ERROR("crny: useless reply received from chronyd\n");
+		} else if (rc == -EAGAIN || rc == -EINTR) {
+			/* Ignore wakeup */
+			DBG_L6("crny: fd woken up, %s\n", strerror(rc));
+		} else {
+			ERROR("crny: chrony: error receiving reply from chronyd, %s\n",
+			      strerror(rc));
+			event = NTP_QUERY_EVENT_CONN_LOST;
+		}
 
-	/* Progress the NTP state machine. */
-	if (crny_state_machine(ntp, event))
+		/* Progress the NTP state machine. */
+		if (crny_state_machine(ntp, event))
+			update = true;
+	} while (event == NTP_QUERY_EVENT_TRAFFIC && comm->sock != -1);
+
+	if (update)
 		update_state(ntp);
 }
 
@@ -2430,7 +2615,8 @@ static const struct sfptpd_thread_ops ntp_thread_ops =
 	ntp_on_startup,
 	ntp_on_shutdown,
 	ntp_on_message,
-	ntp_on_user_fds
+	ntp_on_user_fds,
+	ntp_on_startup_failed
 };
 
 
@@ -2579,7 +2765,7 @@ int sfptpd_crny_module_create(struct sfptpd_config *config,
 	 * carry out the rest of the initialisation. */
 	rc = sfptpd_thread_create("crny", &ntp_thread_ops, ntp, sync_module);
 	if (rc != 0) {
-		free(ntp);
+		ntp_on_startup_failed(ntp);
 		return rc;
 	}
 
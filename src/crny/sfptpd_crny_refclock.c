@@ -0,0 +1,268 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_crny_refclock.c
+ * @brief  Output of samples to a chrony SOCK refclock
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "sfptpd_logging.h"
+#include "sfptpd_general_config.h"
+#include "sfptpd_sync_module.h"
+#include "sfptpd_clockfeed.h"
+#include "sfptpd_clock.h"
+#include "sfptpd_time.h"
+#include "sfptpd_misc.h"
+
+#include "sfptpd_crny_refclock.h"
+
+
+/****************************************************************************
+ * Macros
+ ****************************************************************************/
+
+/* NTP component specific trace */
+#define DBG_L1(x, ...)  TRACE(SFPTPD_COMPONENT_ID_NTP, 1, x, ##__VA_ARGS__)
+#define DBG_L3(x, ...)  TRACE(SFPTPD_COMPONENT_ID_NTP, 3, x, ##__VA_ARGS__)
+#define DBG_L6(x, ...)  TRACE(SFPTPD_COMPONENT_ID_NTP, 6, x, ##__VA_ARGS__)
+
+/* Proportion of the sample interval that must have elapsed since the last
+ * sample, allowing for jitter in the timing of servo updates */
+#define CRNY_REFCLOCK_INTERVAL_TOLERANCE (0.95)
+
+
+/****************************************************************************
+ * Types
+ ****************************************************************************/
+
+struct sfptpd_crny_refclock {
+	/* Configuration of the output */
+	struct sfptpd_config_chrony_refclock config;
+
+	/* Clock feed subscription following the instance's clock */
+	struct sfptpd_clockfeed_follower feed;
+
+	/* Socket and address of the chrony refclock */
+	int fd;
+	struct sockaddr_un addr;
+	socklen_t addr_len;
+
+	/* Minimum interval between samples */
+	struct sfptpd_timespec interval;
+
+	/* Monotonic time of the last sample sent */
+	struct sfptpd_timespec last_sent;
+
+	/* Whether the last attempt to send failed */
+	bool send_failed;
+
+	/* Number of samples sent */
+	unsigned long samples;
+};
+
+
+/****************************************************************************
+ * Local Functions
+ ****************************************************************************/
+
+static int crny_refclock_leap(const struct sfptpd_config_chrony_refclock *config,
+			      enum sfptpd_leap_second_type leap_second)
+{
+	if (config->leap == SFPTPD_CHRONY_REFCLOCK_LEAP_NONE)
+		return SFPTPD_CRNY_SOCK_LEAP_NORMAL;
+
+	switch (leap_second) {
+	case SFPTPD_LEAP_SECOND_61:
+		return SFPTPD_CRNY_SOCK_LEAP_INSERT;
+	case SFPTPD_LEAP_SECOND_59:
+		return SFPTPD_CRNY_SOCK_LEAP_DELETE;
+	default:
+		return SFPTPD_CRNY_SOCK_LEAP_NORMAL;
+	}
+}
+
+
+static void crny_refclock_send(struct sfptpd_crny_refclock *refclock,
+			       struct sfptpd_crny_sock_sample *sample)
+{
+	ssize_t sent;
+
+	sent = sendto(refclock->fd, sample, sizeof *sample, 0,
+		      (struct sockaddr *) &refclock->addr, refclock->addr_len);
+	if (sent == sizeof *sample) {
+		if (refclock->send_failed)
+			NOTICE("chrony refclock %s: sending samples to %s\n",
+			       refclock->config.instance, refclock->config.path);
+		refclock->send_failed = false;
+		refclock->samples++;
+		return;
+	}
+
+	/* A full socket means chronyd is behind; it will catch up */
+	if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		DBG_L3("chrony refclock %s: socket full, sample dropped\n",
+		       refclock->config.instance);
+		return;
+	}
+
+	/* Otherwise chronyd is probably not running so warn only once */
+	if (!refclock->send_failed)
+		WARNING("chrony refclock %s: failed to send sample to %s, %s\n",
+			refclock->config.instance, refclock->config.path,
+			sent < 0 ? strerror(errno) : "short write");
+	refclock->send_failed = true;
+}
+
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int sfptpd_crny_refclock_create(const struct sfptpd_config_chrony_refclock *config,
+				struct sfptpd_clockfeed *clockfeed,
+				struct sfptpd_crny_refclock **refclock)
+{
+	struct sfptpd_crny_refclock *new;
+	int rc;
+
+	assert(config != NULL);
+	assert(clockfeed != NULL);
+	assert(refclock != NULL);
+
+	new = calloc(1, sizeof *new);
+	if (new == NULL)
+		return ENOMEM;
+
+	new->config = *config;
+	sfptpd_clockfeed_follower_init(&new->feed, clockfeed);
+
+	new->addr.sun_family = AF_UNIX;
+	sfptpd_strncpy(new->addr.sun_path, config->path, sizeof new->addr.sun_path);
+	new->addr_len = sizeof new->addr;
+
+	if (config->rate > 0.0)
+		sfptpd_time_float_s_to_timespec(CRNY_REFCLOCK_INTERVAL_TOLERANCE / config->rate,
+						&new->interval);
+
+	/* Samples are sent without blocking the engine; chronyd need not be
+	 * running yet */
+	new->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (new->fd < 0) {
+		rc = errno;
+		ERROR("chrony refclock %s: failed to create socket, %s\n",
+		      config->instance, strerror(rc));
+		free(new);
+		return rc;
+	}
+
+	INFO("chrony refclock %s: sending samples to %s\n",
+	     config->instance, config->path);
+
+	*refclock = new;
+	return 0;
+}
+
+
+void sfptpd_crny_refclock_destroy(struct sfptpd_crny_refclock *refclock)
+{
+	if (refclock == NULL)
+		return;
+
+	sfptpd_clockfeed_follower_release(&refclock->feed);
+	close(refclock->fd);
+
+	DBG_L1("chrony refclock %s: sent %lu samples\n",
+	       refclock->config.instance, refclock->samples);
+	free(refclock);
+}
+
+
+void sfptpd_crny_refclock_sample(const struct sfptpd_config_chrony_refclock *config,
+				 const struct sfptpd_timespec *diff,
+				 const struct sfptpd_timespec *t_sys,
+				 const struct sfptpd_timespec *offset_from_master,
+				 enum sfptpd_leap_second_type leap_second,
+				 struct sfptpd_crny_sock_sample *sample)
+{
+	struct sfptpd_timespec offset;
+
+	assert(config != NULL);
+	assert(diff != NULL);
+	assert(t_sys != NULL);
+	assert(offset_from_master != NULL);
+	assert(sample != NULL);
+
+	/* The offset of the reference from the system clock, where the
+	 * reference is either the instance's clock or its master. The
+	 * offset holds at the system time whether or not that time is
+	 * truncated to the microsecond resolution of the sample. */
+	offset = *diff;
+	if (config->offset == SFPTPD_CHRONY_REFCLOCK_OFFSET_MASTER)
+		sfptpd_time_subtract(&offset, &offset, offset_from_master);
+
+	memset(sample, 0, sizeof *sample);
+	sample->tv.tv_sec = t_sys->sec;
+	sample->tv.tv_usec = t_sys->nsec / 1000;
+	sample->offset = (double) sfptpd_time_timespec_to_float_s(&offset);
+	sample->pulse = 0;
+	sample->leap = crny_refclock_leap(config, leap_second);
+	sample->magic = SFPTPD_CRNY_SOCK_MAGIC;
+}
+
+
+void sfptpd_crny_refclock_update(struct sfptpd_crny_refclock *refclock,
+				 const struct sfptpd_sync_instance_status *status,
+				 enum sfptpd_leap_second_type leap_second,
+				 const struct sfptpd_timespec *mono)
+{
+	struct sfptpd_timespec diff, t_sys, elapsed;
+	struct sfptpd_crny_sock_sample sample;
+	int rc;
+
+	assert(refclock != NULL);
+	assert(status != NULL);
+	assert(mono != NULL);
+
+	if (status->state != SYNC_MODULE_STATE_SLAVE || status->clock == NULL)
+		return;
+
+	/* Apply the configured rate */
+	if (!sfptpd_time_is_zero(&refclock->last_sent) &&
+	    !sfptpd_time_is_zero(&refclock->interval)) {
+		sfptpd_time_subtract(&elapsed, mono, &refclock->last_sent);
+		if (sfptpd_time_cmp(&elapsed, &refclock->interval) < 0)
+			return;
+	}
+
+	/* Send each new comparison of the instance's clock with the system
+	 * clock once */
+	rc = sfptpd_clockfeed_follower_compare(&refclock->feed, status->clock,
+					       &diff, &t_sys);
+	if (rc != 0) {
+		if (rc != EALREADY)
+			DBG_L6("chrony refclock %s: no clock feed comparison, %s\n",
+			       refclock->config.instance, strerror(rc));
+		return;
+	}
+
+	sfptpd_crny_refclock_sample(&refclock->config, &diff, &t_sys,
+				    &status->offset_from_master, leap_second,
+				    &sample);
+
+	DBG_L6("chrony refclock %s: offset %0.9f leap %d\n",
+	       refclock->config.instance, sample.offset, sample.leap);
+
+	crny_refclock_send(refclock, &sample);
+	refclock->last_sent = *mono;
+}
+
+
+/* fin */
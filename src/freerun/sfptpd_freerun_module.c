@@ -623,6 +623,17 @@ static void freerun_on_shutdown(void *context)
 }
 
 
+static void freerun_on_startup_failed(void *context)
+{
+	freerun_module_t *fr = (freerun_module_t *)context;
+	assert(fr != NULL);
+
+	/* Free the copy of the link table and the sync module memory */
+	sfptpd_link_table_free_copy(&fr->link_table);
+	free(fr);
+}
+
+
 static void freerun_on_message(void *context, struct sfptpd_msg_hdr *hdr)
 {
 	freerun_module_t *fr = (freerun_module_t *)context;
@@ -702,7 +713,8 @@ static const struct sfptpd_thread_ops freerun_thread_ops =
 	freerun_on_startup,
 	freerun_on_shutdown,
 	freerun_on_message,
-	freerun_on_user_fds
+	freerun_on_user_fds,
+	freerun_on_startup_failed
 };
 
 
@@ -392,6 +392,9 @@ static int gps_stats_init(struct gps_instance *gps)
 	rc = sfptpd_stats_collection_create(&gps->stats, "gps",
 					    sizeof(gps_stats_defns)/sizeof(gps_stats_defns[0]),
 					    gps_stats_defns);
+	if (rc == 0)
+		sfptpd_stats_collection_persist(&gps->stats, NULL,
+						SFPTPD_CONFIG_GET_NAME(gps->config));
 	return rc;
 }
 
@@ -1022,6 +1025,16 @@ static void gps_on_shutdown(void *context)
 }
 
 
+static void gps_on_startup_failed(void *context)
+{
+	struct gps_module *gps = (struct gps_module *)context;
+	assert(gps != NULL);
+
+	/* Delete the sync module context */
+	free(gps);
+}
+
+
 static void gps_on_message(void *context, struct sfptpd_msg_hdr *hdr)
 {
 	struct gps_module *gps = (struct gps_module *)context;
@@ -1213,7 +1226,8 @@ static const struct sfptpd_thread_ops gps_thread_ops =
 	gps_on_startup,
 	gps_on_shutdown,
 	gps_on_message,
-	gps_on_user_fds
+	gps_on_user_fds,
+	gps_on_startup_failed
 };
 
 
@@ -1390,7 +1404,7 @@ int sfptpd_gps_module_create(struct sfptpd_config *config,
 	 * carry out the rest of the initialisation. */
 	rc = sfptpd_thread_create("gps", &gps_thread_ops, gps, sync_module);
 	if (rc != 0) {
-		free(gps);
+		gps_on_startup_failed(gps);
 		return rc;
 	}
 
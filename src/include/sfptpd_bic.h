@@ -91,4 +91,28 @@ void sfptpd_bic_select_instance(struct sync_instance_record *instance_records,
 				int num_instances,
 				struct sync_instance_record *selected_instance);
 
+/* Ranking of sync instances under a selection policy, kept in order as
+ * the status of individual instances changes. Each instance carries a
+ * rank key packed from its status so that reordering it does not need
+ * the rules to be evaluated against the other instances. */
+struct sfptpd_bic_ranking;
+
+struct sfptpd_bic_ranking *sfptpd_bic_ranking_create(const struct sfptpd_selection_policy *policy,
+						     struct sync_instance_record *instance_records,
+						     int num_instances);
+
+void sfptpd_bic_ranking_free(struct sfptpd_bic_ranking *ranking);
+
+/* Re-rank an instance after its status has changed */
+void sfptpd_bic_ranking_update(struct sfptpd_bic_ranking *ranking,
+			       struct sync_instance_record *record);
+
+/* Re-rank all instances, e.g. after a manual selection */
+void sfptpd_bic_ranking_update_all(struct sfptpd_bic_ranking *ranking);
+
+/* Return the best instance, reporting the ranking if it differs from
+ * the old candidate */
+struct sync_instance_record *sfptpd_bic_ranking_choose(struct sfptpd_bic_ranking *ranking,
+						       struct sync_instance_record *old_candidate);
+
 #endif /* _SFPTPD_BIC_H */
@@ -101,6 +101,7 @@ extern const struct sfptpd_clock_id SFPTPD_CLOCK_ID_UNINITIALISED;
 /** Forward declaration of structures */
 struct sfptpd_clock;
 struct sfptpd_config;
+struct sfptpd_json_buf;
 
 
 /****************************************************************************
@@ -272,6 +273,16 @@ void sfptpd_clock_stats_end_period(struct sfptpd_clock *clock,
 				   struct sfptpd_timespec *time);
 
 
+/** Write the statistics of a set of clocks as OpenMetrics families.
+ * @param buf Text buffer to write to
+ * @param clocks Array of clock instances
+ * @param num_clocks Number of clocks
+ */
+void sfptpd_clock_stats_write_metrics(struct sfptpd_json_buf *buf,
+				      struct sfptpd_clock **clocks,
+				      unsigned int num_clocks);
+
+
 /** Get the short name of a clock instance - this is just the clock name
  * @param clock  Pointer to clock instance
  * @return The name of the clock or NULL in the case of an error.
@@ -351,6 +362,23 @@ bool sfptpd_clock_get_discipline(struct sfptpd_clock *clock);
  */
 int sfptpd_clock_adjust_time(struct sfptpd_clock *clock, struct sfptpd_timespec *offset);
 
+/** Adjust several clock instances by the specified offsets at the same
+ * instant. Each clock is stepped by its own thread at a common deadline
+ * and the spread between the first and last steps is logged.
+ * @param clocks  Array of pointers to clock instances
+ * @param offsets Offset to be applied to each clock
+ * @param results Where to store the errno status code for each clock
+ * @param num_clocks Number of clocks
+ * @param spread  Where to store the spread achieved, or NULL
+ * @return 0 for success otherwise the errno status code of the first
+ * clock that could not be stepped.
+ */
+int sfptpd_clock_adjust_time_multi(struct sfptpd_clock **clocks,
+				   struct sfptpd_timespec *offsets,
+				   int *results,
+				   int num_clocks,
+				   struct sfptpd_timespec *spread);
+
 /** Adjust the clock instance by the specified frequency
  * @param clock  Pointer to clock instance
  * @param freq_adj_ppb Frequency adjustment to be applied in parts per billion
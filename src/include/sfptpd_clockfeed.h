@@ -34,6 +34,20 @@ struct sfptpd_clockfeed_sample {
 	int rc;
 };
 
+/* A clock feed subscription that follows whichever clock its user is
+ * interested in, e.g. the clock of a sync instance, for comparison with the
+ * system clock. This structure is expected to be used via the helper
+ * functions. */
+struct sfptpd_clockfeed_follower {
+	struct sfptpd_clockfeed *clockfeed;
+	struct sfptpd_clockfeed_sub *sub;
+	struct sfptpd_clock *clock;
+	struct sfptpd_timespec last_mono;
+	/* The clock to which subscription last failed, so that repeated
+	 * failures are only reported once */
+	struct sfptpd_clock *failed_clock;
+};
+
 
 /****************************************************************************
  * Function Prototypes
@@ -122,6 +136,34 @@ void sfptpd_clockfeed_set_max_age(struct sfptpd_clockfeed_sub *sub,
 void sfptpd_clockfeed_set_max_age_diff(struct sfptpd_clockfeed_sub *sub,
 				       const struct sfptpd_timespec *max_age_diff);
 
+/* Initialise a clock feed follower, which does not follow any clock until
+ * the first comparison.
+ * @param follower The follower.
+ * @param clockfeed Handle to the clock feed state.
+ */
+void sfptpd_clockfeed_follower_init(struct sfptpd_clockfeed_follower *follower,
+				    struct sfptpd_clockfeed *clockfeed);
+
+/* Release the subscription held by a clock feed follower.
+ * @param follower The follower.
+ */
+void sfptpd_clockfeed_follower_release(struct sfptpd_clockfeed_follower *follower);
+
+/* Compare a clock with the system clock using the latest clock feed sample,
+ * subscribing to the clock's feed first if it is not the clock last
+ * compared. The system clock has no feed so is read now. A comparison
+ * already returned is not returned again.
+ * @param follower The follower.
+ * @param clock The clock to compare.
+ * @param diff Where to store the clock difference.
+ * @param t_sys Where to store the timestamp of the system clock.
+ * @return 0 on success, EALREADY if there is no new comparison, else errno.
+ */
+int sfptpd_clockfeed_follower_compare(struct sfptpd_clockfeed_follower *follower,
+				      struct sfptpd_clock *clock,
+				      struct sfptpd_timespec *diff,
+				      struct sfptpd_timespec *t_sys);
+
 /* Handle the end of a stats collection period.
  * @param module Opaque handle to the clock feed state.
  * @paran time The time corresponding to this period.
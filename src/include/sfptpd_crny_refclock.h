@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+#ifndef _SFPTPD_CRNY_REFCLOCK_H
+#define _SFPTPD_CRNY_REFCLOCK_H
+
+#include <sys/time.h>
+
+#include "sfptpd_general_config.h"
+#include "sfptpd_sync_module.h"
+#include "sfptpd_clockfeed.h"
+#include "sfptpd_clock.h"
+#include "sfptpd_time.h"
+
+
+/****************************************************************************
+ * Structures and Types
+ ****************************************************************************/
+
+/* Magic number identifying a chrony SOCK refclock sample */
+#define SFPTPD_CRNY_SOCK_MAGIC (0x534f434b)
+
+/* Opaque declaration of a chrony SOCK refclock output */
+struct sfptpd_crny_refclock;
+
+/* Sample format read by the chrony SOCK refclock driver. The offset is
+ * that of the reference from the system clock at the time given. */
+struct sfptpd_crny_sock_sample {
+	struct timeval tv;
+	double offset;
+	int pulse;
+	int leap;
+	int _pad;
+	int magic;
+};
+
+/* Leap indications understood by chrony */
+enum sfptpd_crny_sock_leap {
+	SFPTPD_CRNY_SOCK_LEAP_NORMAL = 0,
+	SFPTPD_CRNY_SOCK_LEAP_INSERT = 1,
+	SFPTPD_CRNY_SOCK_LEAP_DELETE = 2,
+};
+
+
+/****************************************************************************
+ * Function Prototypes
+ ****************************************************************************/
+
+/** Create an output that sends samples from a sync instance to a chrony
+ * SOCK refclock. Nothing is sent until the first update.
+ * @param config Configuration of the output
+ * @param clockfeed Clock feed from which to take clock comparisons
+ * @param refclock Where to store the handle of the output
+ * @return 0 on success or an errno otherwise
+ */
+int sfptpd_crny_refclock_create(const struct sfptpd_config_chrony_refclock *config,
+				struct sfptpd_clockfeed *clockfeed,
+				struct sfptpd_crny_refclock **refclock);
+
+/** Destroy a chrony SOCK refclock output.
+ * @param refclock The output or NULL
+ */
+void sfptpd_crny_refclock_destroy(struct sfptpd_crny_refclock *refclock);
+
+/** Build the sample for a comparison of the sync instance's local
+ * reference clock with the system clock. The offset of the master is
+ * found by subtracting the instance's last reported offset from its master
+ * from the comparison. That offset may predate the comparison, so any
+ * correction the servo has made to the clock since it was measured is
+ * counted twice.
+ * @param config Configuration of the output
+ * @param diff Difference of the local reference clock from the system clock
+ * @param t_sys System time of the comparison
+ * @param offset_from_master Offset of the local reference clock from master
+ * @param leap_second Leap second currently scheduled
+ * @param sample Where to build the sample
+ */
+void sfptpd_crny_refclock_sample(const struct sfptpd_config_chrony_refclock *config,
+				 const struct sfptpd_timespec *diff,
+				 const struct sfptpd_timespec *t_sys,
+				 const struct sfptpd_timespec *offset_from_master,
+				 enum sfptpd_leap_second_type leap_second,
+				 struct sfptpd_crny_sock_sample *sample);
+
+/** Send a sample from the latest clock feed comparison of the sync
+ * instance's local reference clock with the system clock, if the instance
+ * is in the slave state and the configured rate allows. Called after each
+ * servo update.
+ * @param refclock The output
+ * @param status Latest status of the sync instance
+ * @param leap_second Leap second currently scheduled
+ * @param mono Monotonic time of the servo update
+ */
+void sfptpd_crny_refclock_update(struct sfptpd_crny_refclock *refclock,
+				 const struct sfptpd_sync_instance_status *status,
+				 enum sfptpd_leap_second_type leap_second,
+				 const struct sfptpd_timespec *mono);
+
+
+#endif /* _SFPTPD_CRNY_REFCLOCK_H */
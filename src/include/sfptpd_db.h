@@ -18,8 +18,19 @@
  * - A user-supplied descriptor defines the table structure.
  * - The records are fixed size.
  * - Any number of keys can be defined to enable searching and sorting.
- * - One form of store is available - a linked list.
- * - There are no indexes. Filtering and sorting are performed at query time.
+ * - Two forms of store are available - a linked list and an array.
+ * - Fields can be indexed with a hash table, for finding records by equal
+ *   keys, or a sorted array, for finding records and listing them in order.
+ *   Indexes are maintained on insert, delete and update. A query uses the
+ *   index of the first indexed search key, or else the ordered index of the
+ *   first sort key, and otherwise filters and sorts at query time.
+ * - Cursors iterate over matching records in place. A cursor only allocates
+ *   when no index gives the requested order, to sort the matching records
+ *   once as it is opened. While any cursor is open on a table, memory that
+ *   a writer replaces or frees is kept until the last cursor is closed, so
+ *   writers never wait for readers and open cursors stay valid as the table
+ *   changes. Only the count of open cursors and the memory awaiting release
+ *   are locked.
  *
  ****************************************************************************/
 
@@ -32,12 +43,20 @@
 #define SFPTPD_DB_SEL_ORDER_BY -2
 #define SFPTPD_DB_SEL_NOT -3
 
+#define SFPTPD_DB_MAX_FIELDS 10
+
 enum sfptpd_db_store_type {
 	STORE_LINKED_LIST,
 	STORE_ARRAY,
 	STORE_DEFAULT = STORE_ARRAY,
 };
 
+enum sfptpd_db_index_type {
+	SFPTPD_DB_INDEX_NONE,
+	SFPTPD_DB_INDEX_HASH,
+	SFPTPD_DB_INDEX_ORDERED,
+};
+
 /* Macros for building a 'sort' function out of a 'search' function. An
  * expression is supplied for dereferencing the key from a record. */
 #define SFPTPD_DB_SORT_FN_NAME(search_fn) search_fn ## _sort
@@ -48,9 +67,29 @@ enum sfptpd_db_store_type {
 		return search_fn(expr, raw_b);				\
 	}
 
+/* Macros for building the hash functions for a hashed field out of an
+ * expression for dereferencing the key from a record and the size of the
+ * key. Keys that compare equal must have identical bytes. */
+#define SFPTPD_DB_HASH_KEY_FN_NAME(search_fn) search_fn ## _hash_key
+#define SFPTPD_DB_HASH_RECORD_FN_NAME(search_fn) search_fn ## _hash_record
+
+#define SFPTPD_DB_HASH_FN(search_fn, rec_type, rec, expr, size)		\
+	static uint32_t SFPTPD_DB_HASH_KEY_FN_NAME(search_fn)(const void *key) { \
+		return sfptpd_db_hash(key, size);				\
+	}								\
+	static uint32_t SFPTPD_DB_HASH_RECORD_FN_NAME(search_fn)(const void *raw_rec) { \
+		const rec_type *rec = (rec_type *) raw_rec;			\
+		return sfptpd_db_hash(expr, size);				\
+	}
+
 /* Macro for building a key field definition */
 #define SFPTPD_DB_FIELD(name, enumeration, search_fn, print_fn) [enumeration] = { name, search_fn, SFPTPD_DB_SORT_FN_NAME(search_fn), print_fn },
 
+/* Macros for building the definition of a key field with a hash index, for
+ * which hash functions must be defined, or an ordered index */
+#define SFPTPD_DB_FIELD_HASHED(name, enumeration, search_fn, print_fn) [enumeration] = { name, search_fn, SFPTPD_DB_SORT_FN_NAME(search_fn), print_fn, SFPTPD_DB_INDEX_HASH, SFPTPD_DB_HASH_KEY_FN_NAME(search_fn), SFPTPD_DB_HASH_RECORD_FN_NAME(search_fn) },
+#define SFPTPD_DB_FIELD_ORDERED(name, enumeration, search_fn, print_fn) [enumeration] = { name, search_fn, SFPTPD_DB_SORT_FN_NAME(search_fn), print_fn, SFPTPD_DB_INDEX_ORDERED },
+
 /****************************************************************************
  * Structures and Types
  ****************************************************************************/
@@ -71,6 +110,15 @@ struct sfptpd_db_field {
 
 	/* An optional function used to print a field value for diagnostic purposes */
 	int (*snprint)(char *str, size_t size, int width, const void *record);
+
+	/* The type of index to maintain for the field. An ordered index
+	   requires the comparison functions to define a total order. */
+	enum sfptpd_db_index_type index;
+
+	/* Functions to hash a key value and the key of a record, which must
+	   give the same result for equal keys; required for a hash index */
+	uint32_t (*hash_key)(const void *key_value);
+	uint32_t (*hash_record)(const void *record);
 };
 
 /* Defines the structure of a table. */
@@ -96,6 +144,46 @@ struct sfptpd_db_record_ref {
 	bool valid;
 };
 
+/* Search and sort criteria built from a list of key-value pairs */
+struct sfptpd_db_selection {
+	/* Parameters for filtering records (WHERE) */
+	int filter_count;
+	int filter_fields[SFPTPD_DB_MAX_FIELDS];
+	void *filter_values[SFPTPD_DB_MAX_FIELDS];
+	bool filter_invert[SFPTPD_DB_MAX_FIELDS];
+
+	/* Parameters for sorting result (ORDER BY) */
+	int sort_count;
+	int sort_fields[SFPTPD_DB_MAX_FIELDS];
+};
+
+/* A cursor over the records matching a selection. It is normally declared
+ * on the stack and holds all the state of the iteration, so opening and
+ * iterating a cursor does not allocate memory. The fields are private to
+ * the database module. */
+struct sfptpd_db_cursor {
+	struct sfptpd_db_table *table;
+	struct sfptpd_db_selection selection;
+
+	/* Source of candidate records: the store or an index */
+	int source;
+	bool sort;
+	bool started;
+	bool done;
+	const void *slots;
+	void **elements;
+	uint32_t hash;
+	size_t mask;
+	size_t begin;
+	size_t end;
+	size_t pos;
+	void *store_pos;
+
+	/* The record last returned */
+	void *store_element;
+	void *record;
+};
+
 /* The result of a query including a list of pointers to matching records
  * in the chosen order. The object should be freed by the caller using
  * the function pointer provided. */
@@ -119,6 +207,13 @@ struct sfptpd_db_query_result_refs {
  * Function Prototypes
  ****************************************************************************/
 
+/** Hash a key for a hash index
+ * @param key The key
+ * @param size The size of the key in bytes
+ * @return The hash value
+ */
+uint32_t sfptpd_db_hash(const void *key, size_t size);
+
 /** Create a database table
  * @param def The definition of the table structure
  * @param store_type The type of data structure to use to store records
@@ -170,7 +265,7 @@ struct sfptpd_db_record_ref sfptpd_db_table_find_impl(struct sfptpd_db_table *ta
  * @param ... key-value pairs terminated by a key of SFPTPD_DB_SEL_END.
  * @return the count of matching records.
  */
-int sfptpd_db_table_count(struct sfptpd_db_table *table, ...);
+int sfptpd_db_table_count_impl(struct sfptpd_db_table *table, ...);
 
 /* Safe version of the above with automatic parameter termination */
 #define sfptpd_db_table_count(...) sfptpd_db_table_count_impl(__VA_ARGS__, SFPTPD_DB_SEL_END)
@@ -202,6 +297,48 @@ void sfptpd_db_table_foreach_impl(struct sfptpd_db_table *table,
 #define sfptpd_db_table_foreach(...) sfptpd_db_table_foreach_impl(__VA_ARGS__, SFPTPD_DB_SEL_END)
 
 
+/** Open a cursor over the records in a database table matching given
+ * search and sort criteria. Records are visited in order through an ordered
+ * index where one gives the requested order; otherwise the matching records
+ * are sorted when the cursor is opened. Records inserted, updated or deleted
+ * while the cursor is open may or may not be visited. Cursors may be opened
+ * and closed on any thread without blocking changes to the table. Reading
+ * the records is not synchronised with changes made on other threads, so
+ * the caller must serialise these as for any other access to the records.
+ * The cursor must be closed after use.
+ * @param cursor The cursor to initialise
+ * @param table The table
+ * @param ... key-value pairs optionally followed by a key value of SFPTPD_DB_SEL_ORDER_BY
+ * and a list of sort keys and finally terminated by a key value of SFPTPD_DB_SEL_END.
+ */
+void sfptpd_db_cursor_open_impl(struct sfptpd_db_cursor *cursor,
+				struct sfptpd_db_table *table, ...);
+
+/* Safe version of the above with automatic parameter termination */
+#define sfptpd_db_cursor_open(...) sfptpd_db_cursor_open_impl(__VA_ARGS__, SFPTPD_DB_SEL_END)
+
+/** Advance a cursor to the next matching record.
+ * @param cursor The cursor
+ * @return a pointer to the record, valid until the cursor is closed, or
+ * NULL if there are no more records.
+ */
+void *sfptpd_db_cursor_next(struct sfptpd_db_cursor *cursor);
+
+/** Get a reference to the record last returned by a cursor, e.g. to
+ * update it.
+ * @param cursor The cursor
+ * @return a record reference, which is invalid if there is no current record.
+ */
+struct sfptpd_db_record_ref sfptpd_db_cursor_ref(const struct sfptpd_db_cursor *cursor);
+
+/** Close a cursor, releasing any memory retired by writers while it was
+ * open if it is the last open cursor on the table. Closing a closed
+ * cursor has no effect.
+ * @param cursor The cursor
+ */
+void sfptpd_db_cursor_close(struct sfptpd_db_cursor *cursor);
+
+
 /** Diagnostic function to dump the known fields in a record.
  * Not to be used for user output.
  * @param trace_level The trace level to use
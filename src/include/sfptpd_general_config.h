@@ -20,7 +20,9 @@
 
 /** Default configuration values */
 #define SFPTPD_DEFAULT_MESSAGE_LOG                 (SFPTPD_MSG_LOG_TO_STDERR)
+#define SFPTPD_DEFAULT_MESSAGE_LOG_ASYNC           (true)
 #define SFPTPD_DEFAULT_STATS_LOG                   (SFPTPD_STATS_LOG_OFF)
+#define SFPTPD_DEFAULT_PERSISTENT_STATS            (false)
 #define SFPTPD_DEFAULT_STATE_PATH                  SFPTPD_STATE_PATH
 #define SFPTPD_DEFAULT_CONTROL_PATH                SFPTPD_CONTROL_SOCKET_PATH
 #define SFPTPD_DEFAULT_TRACE_LEVEL                 (0)
@@ -66,6 +68,13 @@
 #define SFPTPD_MAX_SYNC_INTERVAL       3
 #define SFPTPD_MIN_SYNC_INTERVAL       -5
 
+/** Maximum number of chrony SOCK refclock outputs */
+#define SFPTPD_CHRONY_REFCLOCKS_MAX    (8)
+
+/** Maximum number and highest unit number of NTP SHM refclock segments */
+#define SFPTPD_NTP_SHM_UNITS_MAX       (4)
+#define SFPTPD_NTP_SHM_UNIT_MAX        (255)
+
 /** Message logging options */
 enum sfptpd_msg_log_config {
 	SFPTPD_MSG_LOG_TO_SYSLOG,
@@ -97,6 +106,18 @@ enum sfptpd_epoch_guard_config {
 	SFPTPD_EPOCH_GUARD_CORRECT_CLOCK
 };
 
+/** Leap second indication given in chrony refclock samples */
+enum sfptpd_chrony_refclock_leap {
+	SFPTPD_CHRONY_REFCLOCK_LEAP_AUTO,
+	SFPTPD_CHRONY_REFCLOCK_LEAP_NONE,
+};
+
+/** Source of the offsets given in chrony refclock samples */
+enum sfptpd_chrony_refclock_offset {
+	SFPTPD_CHRONY_REFCLOCK_OFFSET_MASTER,
+	SFPTPD_CHRONY_REFCLOCK_OFFSET_CLOCK,
+};
+
 enum clock_config_state {
 	CLOCK_OPTION_NOT_APPLIED = 0,
 	CLOCK_OPTION_APPLIED,
@@ -158,13 +179,31 @@ typedef struct sfptpd_config_timestamping {
 	char interfaces[SFPTPD_CONFIG_TOKENS_MAX][SFPTPD_CONFIG_MAC_STRING_MAX];
 } sfptpd_config_timestamping_t;
 
+/** struct sfptpd_config_chrony_refclock - chrony SOCK refclock output
+ * @instance: Name of the sync instance providing the samples
+ * @path: Path of the chrony SOCK refclock socket
+ * @rate: Maximum samples per second or zero for every servo update
+ * @leap: Leap second indication to give
+ * @offset: Whether to give the offset of the master or of the instance's
+ * local reference clock
+ */
+typedef struct sfptpd_config_chrony_refclock {
+	char instance[SFPTPD_CONFIG_SECTION_NAME_MAX];
+	char path[PATH_MAX];
+	float rate;
+	enum sfptpd_chrony_refclock_leap leap;
+	enum sfptpd_chrony_refclock_offset offset;
+} sfptpd_config_chrony_refclock_t;
+
 /** struct sfptpd_config_general - sfptpd general configuration
  * @hdr: Configuration section common header
  * @config_filename: Path of configuration file
  * @message_log: Target for logged messages
  * @message_log_filename: Path of log file for message logging
+ * @message_log_async: Write messages from a background thread
  * @stats_log: Target for logged statistics
  * @stats_log_filename: Path of log file for statistics logging
+ * @persistent_stats: Keep statistics history in the state directory
  * @trace_level: Debug trace level
  * @clocks: Clock configuration
  * @non_sfc_nics: Use non-Solarflare adapters
@@ -184,6 +223,11 @@ typedef struct sfptpd_config_timestamping {
  * @netlink_rescan_interval: Interval between rescanning interface with netlink
  * @pid_filter.kp: Secondary servo PID filter proportional term coefficient
  * @pid_filter.ki: Secondary servo PID filter integral term coefficient
+ * @openmetrics_socket: Address on which to serve OpenMetrics or empty
+ * @num_chrony_refclocks: Number of chrony SOCK refclock outputs
+ * @chrony_refclocks: Chrony SOCK refclock outputs
+ * @num_ntp_shm_units: Number of NTP SHM refclock segments to write
+ * @ntp_shm_units: NTP SHM refclock segment unit numbers
  * rely on a signal from an external entity via sfptpdctl.
  */
 typedef struct sfptpd_config_general {
@@ -191,8 +235,10 @@ typedef struct sfptpd_config_general {
 	char config_filename[PATH_MAX];
 	enum sfptpd_msg_log_config message_log;
 	char message_log_filename[PATH_MAX];
+	bool message_log_async;
 	enum sfptpd_stats_log_config stats_log;
 	char stats_log_filename[PATH_MAX];
+	bool persistent_stats;
 	unsigned int trace_level;
 	unsigned int threading_trace_level;
 	unsigned int bic_trace_level;
@@ -233,6 +279,11 @@ typedef struct sfptpd_config_general {
 	sfptpd_phc_pps_method_t phc_pps_method[SFPTPD_PPS_METHOD_MAX + 1];
 	char json_stats_filename[PATH_MAX];
 	char json_remote_monitor_filename[PATH_MAX];
+	char openmetrics_socket[PATH_MAX];
+	unsigned int num_chrony_refclocks;
+	sfptpd_config_chrony_refclock_t chrony_refclocks[SFPTPD_CHRONY_REFCLOCKS_MAX];
+	unsigned int num_ntp_shm_units;
+	int ntp_shm_units[SFPTPD_NTP_SHM_UNITS_MAX];
 	enum sfptpd_epoch_guard_config epoch_guard;
 	enum sfptpd_clustering_mode clustering_mode;
 	enum sfptpd_phc_diff_method phc_diff_methods[SFPTPD_DIFF_METHOD_MAX+1];
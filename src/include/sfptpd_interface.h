@@ -230,16 +230,20 @@ int sfptpd_interface_hotplug_insert(const struct sfptpd_link *link);
  */
 int sfptpd_interface_hotplug_remove(const struct sfptpd_link *link);
 
-/** Take a snapshot of an index over the interfaces list.
- * The copied index is an array of pointers to interface objects.
- * The user must call the corresponding free function when the snapshot is finished with.
- * @param type the index type
- * @param dest a structure that will be updated with a pointer to the newly-allocated
- * copy of the index and the size of the index.
- * @return 0 for success otherwise an errno status code.
+/** Open a cursor over the interfaces list, ordered by NIC ID, link type
+ * and MAC address. The user must close the cursor with
+ * sfptpd_db_cursor_close() when finished with.
+ * The 'active PTP' variant visits only live interfaces with a NIC ID.
+ * @param cursor the cursor to open
+ */
+void sfptpd_interface_cursor_open_all(struct sfptpd_db_cursor *cursor);
+void sfptpd_interface_cursor_open_active_ptp(struct sfptpd_db_cursor *cursor);
+
+/** Get the next interface from a cursor over the interfaces list.
+ * @param cursor the cursor
+ * @return the interface object or NULL when there are no more.
  */
-struct sfptpd_db_query_result sfptpd_interface_get_all_snapshot(void);
-struct sfptpd_db_query_result sfptpd_interface_get_active_ptp_snapshot(void);
+struct sfptpd_interface *sfptpd_interface_cursor_next(struct sfptpd_db_cursor *cursor);
 
 
 /** Get whether the interface object passed in has been 'deleted', e.g.
@@ -295,7 +299,8 @@ bool sfptpd_check_clock_interfaces(const int phc_index, const char* cfg_name);
 bool sfptpd_interface_get_sysfs_max_freq_adj(struct sfptpd_interface *interface,
 					     int *max_freq_adj);
 
-/** Read driver stats for an interface.
+/** Read driver stats for an interface. Counters are relative to the last
+ * reset. A sample taken for another consumer shortly before may be returned.
  * If an error occurs trying to read any of the statistics, other statistics
  * may be updated, resulting in a partial update of the given array.
  * @param interface Pointer to interface instance
@@ -305,7 +310,8 @@ bool sfptpd_interface_get_sysfs_max_freq_adj(struct sfptpd_interface *interface,
 int sfptpd_interface_driver_stats_read(struct sfptpd_interface *interface,
 				       uint64_t stats[SFPTPD_DRVSTAT_MAX]);
 
-/** Reset driver stats for an interface.
+/** Reset driver stats for an interface. The counters are sampled afresh
+ * for a reset that cannot be made in the driver.
  * @param interface Pointer to interface instance
  * @return 0 on success, otherwise errno.
  */
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+#ifndef _SFPTPD_INTERFACE_INDEX_H
+#define _SFPTPD_INTERFACE_INDEX_H
+
+#include <stdbool.h>
+#include <net/if.h>
+
+#include "sfptpd_interface.h"
+
+
+/****************************************************************************
+ * Structures and Types
+ ****************************************************************************/
+
+/** Keys by which an interface is looked up. The index keeps its own copy
+ * of the keys so that lookups never read the interface itself.
+ * @interface: The interface
+ * @if_index: OS interface index or -1
+ * @phc_index: PHC index or -1
+ * @nic_id: NIC ID or -1
+ * @deleted: Whether the interface has been deleted
+ * @mac_addr: Permanent hardware address
+ * @name: Interface name, empty if the name has passed to another interface
+ */
+struct sfptpd_interface_keys {
+	struct sfptpd_interface *interface;
+	int if_index;
+	int phc_index;
+	int nic_id;
+	bool deleted;
+	sfptpd_mac_addr_t mac_addr;
+	char name[IF_NAMESIZE];
+};
+
+/* Opaque declaration of an immutable lookup index */
+struct sfptpd_interface_index;
+
+/** A published lookup index. Readers take the current index without
+ * locking. Indexes replaced while there may have been readers are freed
+ * when a later publication finds no readers. Zero-initialise before use.
+ * @current: The current index or NULL if none could be built
+ * @retired: Replaced indexes that may still be in use
+ * @readers: Number of readers
+ */
+struct sfptpd_interface_index_set {
+	struct sfptpd_interface_index *current;
+	struct sfptpd_interface_index *retired;
+	int readers;
+};
+
+
+/****************************************************************************
+ * Function Prototypes
+ ****************************************************************************/
+
+/** Build and publish an index over interfaces with the given keys, unless
+ * they are the same as those of the current index. Publications must be
+ * serialised by the caller. Where several interfaces match a key, a live
+ * interface is preferred to a deleted one.
+ * @param set The published index
+ * @param keys Keys of each interface, allocated with malloc(). Ownership
+ * passes to the index.
+ * @param count Number of interfaces
+ * @return 0 if published, EALREADY if the keys are unchanged or ENOMEM if
+ * the index could not be built, in which case no index is published and
+ * readers must search for interfaces by other means.
+ */
+int sfptpd_interface_index_publish(struct sfptpd_interface_index_set *set,
+				   struct sfptpd_interface_keys *keys,
+				   int count);
+
+/** Free the published and retired indexes. There must be no readers.
+ * @param set The published index
+ */
+void sfptpd_interface_index_release(struct sfptpd_interface_index_set *set);
+
+/** Take the current index for reading. Must be paired with
+ * sfptpd_interface_index_put(), even if no index is returned.
+ * @param set The published index
+ * @return The current index or NULL if there is none
+ */
+const struct sfptpd_interface_index *sfptpd_interface_index_get(struct sfptpd_interface_index_set *set);
+
+/** Finish reading an index taken with sfptpd_interface_index_get().
+ * @param set The published index
+ */
+void sfptpd_interface_index_put(struct sfptpd_interface_index_set *set);
+
+/** Look up an interface by OS interface index.
+ * @param index The index
+ * @param if_index OS interface index
+ * @return The interface or NULL if not found
+ */
+struct sfptpd_interface *sfptpd_interface_index_find_by_if_index(const struct sfptpd_interface_index *index,
+								 int if_index);
+
+/** Look up an interface by name.
+ * @param index The index
+ * @param name Interface name
+ * @return The interface or NULL if not found
+ */
+struct sfptpd_interface *sfptpd_interface_index_find_by_name(const struct sfptpd_interface_index *index,
+							     const char *name);
+
+/** Look up the interface of a NIC with the lowest hardware address.
+ * @param index The index
+ * @param nic_id NIC ID
+ * @return The interface or NULL if not found
+ */
+struct sfptpd_interface *sfptpd_interface_index_find_first_by_nic(const struct sfptpd_interface_index *index,
+								  int nic_id);
+
+/** Check whether an interface with the given name has the given PHC.
+ * @param index The index
+ * @param phc_index PHC index
+ * @param name Interface name
+ * @return true if there is such an interface
+ */
+bool sfptpd_interface_index_phc_has_name(const struct sfptpd_interface_index *index,
+					 int phc_index, const char *name);
+
+
+#endif /* _SFPTPD_INTERFACE_INDEX_H */
@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+#ifndef _SFPTPD_JSON_H
+#define _SFPTPD_JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+/****************************************************************************
+ * Structures, Types, Defines
+ ****************************************************************************/
+
+/** Append-only buffer for building JSON text without stdio.
+ * @data: Storage for the text
+ * @size: Size of the storage
+ * @len: Number of characters appended
+ * @overflow: Set if an append did not fit; the content is then incomplete
+ */
+struct sfptpd_json_buf {
+	char *data;
+	size_t size;
+	size_t len;
+	bool overflow;
+};
+
+
+/****************************************************************************
+ * Function Prototypes
+ ****************************************************************************/
+
+/** Initialise a JSON buffer over caller-supplied storage
+ * @param buf The buffer
+ * @param data Storage
+ * @param size Size of storage
+ */
+void sfptpd_json_init(struct sfptpd_json_buf *buf, char *data, size_t size);
+
+/** Empty a JSON buffer */
+static inline void sfptpd_json_reset(struct sfptpd_json_buf *buf)
+{
+	buf->len = 0;
+	buf->overflow = false;
+}
+
+/** Get the remaining space in a JSON buffer */
+static inline size_t sfptpd_json_headroom(const struct sfptpd_json_buf *buf)
+{
+	return buf->size - buf->len;
+}
+
+/** Append raw text of known length
+ * @param buf The buffer
+ * @param text The text
+ * @param len Length of the text
+ */
+static inline void sfptpd_json_raw(struct sfptpd_json_buf *buf,
+				   const char *text, size_t len)
+{
+	if (len > buf->size - buf->len) {
+		buf->overflow = true;
+		return;
+	}
+	memcpy(buf->data + buf->len, text, len);
+	buf->len += len;
+}
+
+/** Append a string literal or other constant text */
+#define sfptpd_json_lit(buf, literal) \
+	sfptpd_json_raw(buf, literal, sizeof(literal) - 1)
+
+/** Append raw text */
+static inline void sfptpd_json_text(struct sfptpd_json_buf *buf,
+				    const char *text)
+{
+	sfptpd_json_raw(buf, text, strlen(text));
+}
+
+/** Append a quoted string, escaping characters as required
+ * @param buf The buffer
+ * @param str The unquoted string
+ */
+void sfptpd_json_string(struct sfptpd_json_buf *buf, const char *str);
+
+/** Append a signed integer in decimal */
+void sfptpd_json_int(struct sfptpd_json_buf *buf, int64_t value);
+
+/** Append an unsigned integer in decimal, zero-padded to a minimum width
+ * @param buf The buffer
+ * @param value The value
+ * @param width Minimum number of digits
+ */
+void sfptpd_json_uint(struct sfptpd_json_buf *buf, uint64_t value,
+		      unsigned int width);
+
+/** Append a floating point value with a fixed number of decimal places.
+ * This produces the same output as the "%.*Lf" printf format.
+ * @param buf The buffer
+ * @param value The value
+ * @param decimals Number of decimal places, at most 9
+ */
+void sfptpd_json_float(struct sfptpd_json_buf *buf, long double value,
+		       unsigned int decimals);
+
+/** Append bytes as pairs of lowercase hex digits, with an optional
+ * separator after every group of bytes.
+ * @param buf The buffer
+ * @param bytes The bytes
+ * @param len Number of bytes
+ * @param group Number of bytes between separators
+ * @param sep Separator character or '\0' for none
+ */
+void sfptpd_json_hex(struct sfptpd_json_buf *buf, const uint8_t *bytes,
+		     size_t len, size_t group, char sep);
+
+#endif /* _SFPTPD_JSON_H */
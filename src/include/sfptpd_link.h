@@ -9,6 +9,8 @@
 #include <net/if.h>
 #include <linux/ethtool.h>
 
+#include "sfptpd_time.h"
+
 /****************************************************************************
  * Structures, Types, Defines
  ****************************************************************************/
@@ -40,6 +42,19 @@ enum sfptpd_link_event {
 	SFPTPD_LINK_CHANGE,
 };
 
+/* Attributes of a link that changed, reported with SFPTPD_LINK_CHANGE */
+#define SFPTPD_LINK_CHANGED_TYPE         (1 << 0)
+#define SFPTPD_LINK_CHANGED_IF_TYPE      (1 << 1)
+#define SFPTPD_LINK_CHANGED_FAMILY       (1 << 2)
+#define SFPTPD_LINK_CHANGED_FLAGS        (1 << 3)
+#define SFPTPD_LINK_CHANGED_MASTER       (1 << 4)
+#define SFPTPD_LINK_CHANGED_BOND_MODE    (1 << 5)
+#define SFPTPD_LINK_CHANGED_ACTIVE_SLAVE (1 << 6)
+#define SFPTPD_LINK_CHANGED_IS_SLAVE     (1 << 7)
+#define SFPTPD_LINK_CHANGED_VLAN         (1 << 8)
+#define SFPTPD_LINK_CHANGED_NAME         (1 << 9)
+#define SFPTPD_LINK_CHANGED_TS_INFO      (1 << 10)
+
 enum sfptpd_bond_mode {
 	SFPTPD_BOND_MODE_NONE,
 	SFPTPD_BOND_MODE_ACTIVE_BACKUP,
@@ -64,6 +79,7 @@ struct sfptpd_l2addr {
 struct sfptpd_link {
 	enum sfptpd_link_type type;
 	enum sfptpd_link_event event;
+	uint32_t changes;
 
 	int if_index;
 	int if_type;
@@ -99,6 +115,32 @@ struct sfptpd_link_table {
 	struct sfptpd_link *rows;
 	int count;
 	int version;
+
+	/* Monotonic time at which the first change in this version was
+	 * received, or zero if not known */
+	struct sfptpd_timespec time;
+};
+
+/* A difference between consecutive versions of the link table.
+ * @event: SFPTPD_LINK_UP if added, SFPTPD_LINK_DOWN if removed or
+ *         SFPTPD_LINK_CHANGE if changed
+ * @link: The link in the new table or NULL if removed
+ * @old_link: The link in the old table or NULL if added
+ * @changes: Mask of SFPTPD_LINK_CHANGED_ flags if changed
+ */
+struct sfptpd_link_delta {
+	enum sfptpd_link_event event;
+	const struct sfptpd_link *link;
+	const struct sfptpd_link *old_link;
+	uint32_t changes;
+};
+
+/* Iterator over the differences between link tables */
+struct sfptpd_link_delta_iter {
+	const struct sfptpd_link_table *old_table;
+	const struct sfptpd_link_table *table;
+	int row;
+	int old_row;
 };
 
 
@@ -122,4 +164,24 @@ int sfptpd_link_table_copy(const struct sfptpd_link_table *src,
 
 void sfptpd_link_table_free_copy(struct sfptpd_link_table *copy);
 
+/* Start iterating over the differences between two link tables in a
+ * single pass. Both tables are ordered by if_index, as provided by the
+ * netlink layer, and the new table must be the version following the old
+ * one as the changes recorded in its rows are reported.
+ * @param iter The iterator
+ * @param old_table The previous version of the link table, or NULL
+ * @param table The current version of the link table
+ */
+void sfptpd_link_delta_start(struct sfptpd_link_delta_iter *iter,
+			     const struct sfptpd_link_table *old_table,
+			     const struct sfptpd_link_table *table);
+
+/* Get the next difference between two link tables.
+ * @param iter The iterator
+ * @param delta Where to store the difference
+ * @return true if a difference was found or false at the end
+ */
+bool sfptpd_link_delta_next(struct sfptpd_link_delta_iter *iter,
+			    struct sfptpd_link_delta *delta);
+
 #endif
@@ -41,9 +41,30 @@ typedef enum sfptpd_component_id {
 	SFPTPD_COMPONENT_ID_MAX
 } sfptpd_component_id_e;
 
+/** Highest trace level compiled in. Trace points above this level are removed
+ * at build time, e.g. with 'make TRACE_MAX_LEVEL=3'. */
+#ifndef SFPTPD_TRACE_MAX_LEVEL
+#define SFPTPD_TRACE_MAX_LEVEL (255)
+#endif
+
+/** Current trace levels by component. Use sfptpd_log_set_trace_level() to
+ * modify. */
+extern unsigned int sfptpd_trace_levels[SFPTPD_COMPONENT_ID_MAX];
+
+/** Check whether a trace level is enabled for a component. This is inlined
+ * into trace points so that disabled traces cost a single load and branch
+ * and their arguments are not evaluated. */
+#define SFPTPD_TRACE_ENABLED(c, l) \
+	((unsigned int) (l) <= SFPTPD_TRACE_MAX_LEVEL && \
+	 (unsigned int) (l) <= sfptpd_trace_levels[c])
+
 /** For debugging a trace macro is defined. The higher the level, the more verbose
  * the trace information. Valid values for the level are >= 1. */
-#define TRACE(c, l, x, ...)  sfptpd_log_trace(c, l, x, ##__VA_ARGS__)
+#define TRACE(c, l, x, ...) \
+	do { \
+		if (__builtin_expect(SFPTPD_TRACE_ENABLED(c, l), 0)) \
+			sfptpd_log_trace(c, l, x, ##__VA_ARGS__); \
+	} while (0)
 
 /** Trace macros by increasing verbosity */
 #define TRACE_L1(x, ...)  TRACE(SFPTPD_COMPONENT_ID_SFPTPD, 1, x, ##__VA_ARGS__)
@@ -100,6 +121,7 @@ typedef enum sfptpd_component_id {
 /** Forward structure declarations */
 struct sfptpd_config;
 struct sfptpd_clock;
+struct sfptpd_json_buf;
 struct sfptpd_stats_range;
 
 /** Opaque public structure declaration for structure used to store
@@ -144,6 +166,29 @@ int sfptpd_log_open(struct sfptpd_config *config);
  */
 void sfptpd_log_close(void);
 
+/** Start the asynchronous message writer, if configured. This must be
+ * called after any fork so that the writer thread survives.
+ * @return 0 on success or an errno otherwise.
+ */
+int sfptpd_log_async_start(void);
+
+/** Stop the asynchronous message writer, writing out any queued messages.
+ * Subsequent messages are written synchronously.
+ */
+void sfptpd_log_async_stop(void);
+
+/** Start the state file writer thread. Until this is called, state files
+ * are written synchronously when closed. This must be called after any
+ * fork so that the writer thread survives.
+ * @return 0 on success or an errno otherwise.
+ */
+int sfptpd_log_file_writer_start(void);
+
+/** Stop the state file writer thread, writing out any queued state files.
+ * Subsequent state files are written synchronously.
+ */
+void sfptpd_log_file_writer_stop(void);
+
 /** Set trace level. Can be used to modify the trace level at runtime
  * @param component Component for which level is being set
  * @param level Trace level - 0 is off
@@ -286,6 +331,13 @@ struct sfptpd_log *sfptpd_log_open_ptp_nodes(void);
  */
 struct sfptpd_log *sfptpd_log_open_sync_instances(void);
 
+/** Open startup file for writing. It is the responsibility of the caller
+ * to close the file once the information has been written using
+ * sfptpd_log_file_close().
+ * @return A file handle on success or NULL on error
+ */
+struct sfptpd_log *sfptpd_log_open_startup(void);
+
 /** Appends a new row to a table. Used to create interfaces and ptp-nodes files
  * @param stream Stream to write to
  * @param draw_line Output a horizontal line after this row
@@ -317,6 +369,27 @@ struct sfptpd_log *sfptpd_log_open_statistics(struct sfptpd_clock *clock,
 struct sfptpd_log *sfptpd_log_open_statistics_json(struct sfptpd_clock *clock,
 					      const char *entity_name);
 
+/** Get the path of the file in which the history of a statistics collection
+ * is kept across restarts, if persistent statistics are enabled.
+ * @param clock Instance of clock to which stats apply
+ * @param entity_name Name of the sync module instance that produced the
+ * stats or NULL if the stats have been produced by a local clock
+ * synchronization process.
+ * @param path Buffer for the path
+ * @param space Size of the buffer
+ * @return 0 on success, ENOTSUP if persistent statistics are disabled or
+ * ENAMETOOLONG if the path does not fit
+ */
+int sfptpd_log_get_stats_history_path(struct sfptpd_clock *clock,
+				      const char *entity_name,
+				      char *path, size_t space);
+
+/** Give a stats history file the configured ownership, as for the other
+ * files written by the daemon.
+ * @param fd File descriptor of the open history file
+ */
+void sfptpd_log_set_stats_history_owner(int fd);
+
 /** Open remote monitoring file for writing. It is the responsibility of the
  * caller to close the file once the information has been written using
  * sfptpd_log_file_close().
@@ -337,7 +410,9 @@ struct sfptpd_log *sfptpd_log_open_remote_monitor_json(void);
  */
 FILE *sfptpd_log_file_get_stream(struct sfptpd_log *log);
 
-/** Close a log file
+/** Close a log file. The content is written out to the file in the
+ * background, once the state file writer has been started, unless it is
+ * unchanged since the file was last written.
  * @param log The opaque log file state.
  * return 0 on success or an errno otherwise.
  */
@@ -348,17 +423,22 @@ int sfptpd_log_file_close(struct sfptpd_log *log);
  */
 void sfptpd_log_get_time(struct sfptpd_log_time *time);
 
-/** Gets the output stream for realtime stats. Don't open/close this.
- * @return Stream pointer. May be NULL if realtime stats are disabled.
+/** Starts a realtime stats record. The record is appended to the returned
+ * buffer and completed with sfptpd_log_rt_stats_end().
+ * @return JSON buffer. NULL if realtime stats are disabled.
+ */
+struct sfptpd_json_buf *sfptpd_log_rt_stats_begin(void);
+
+/** Completes a realtime stats record.
+ * @param flush Whether to write out buffered records regardless.
+ * @return 0 on success or ENOSPC if the record did not fit, in which case
+ * it has been discarded and the buffer emptied so it can be retried.
  */
-FILE* sfptpd_log_get_rt_stats_out_stream(void);
+int sfptpd_log_rt_stats_end(bool flush);
 
-/** Records number of characters of RT stats written.
- * @param chars The number of characters written.
- * @param flush Whether to flush the buffer regardless.
- * @return Whether the buffer was flushed.
+/** Writes out buffered realtime stats records.
  */
-bool sfptpd_log_rt_stats_written(size_t chars, bool flush);
+void sfptpd_log_rt_stats_flush(void);
 
 /** Gets the output stream for remote monitoring. Don't open/close this.
  * @return Stream pointer. May be NULL if remote monitoring is disabled.
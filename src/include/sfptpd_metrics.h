@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+#ifndef _SFPTPD_METRICS_H
+#define _SFPTPD_METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include "sfptpd_config.h"
+
+
+/****************************************************************************
+ * Constants
+ ****************************************************************************/
+
+/* Prefix for all metric family names */
+#define SFPTPD_METRICS_PREFIX "sfptpd"
+
+/* Maximum length of a metric family name */
+#define SFPTPD_METRICS_NAME_MAX (128)
+
+/* Maximum length of a preformatted label set */
+#define SFPTPD_METRICS_LABELS_MAX (256)
+
+
+/****************************************************************************
+ * Structures and Types
+ ****************************************************************************/
+
+/* Opaque declaration of metrics service state */
+struct sfptpd_metrics;
+
+/* Opaque declaration of a source of metrics. Each source is owned by a
+ * single thread which periodically renders its metrics into a private
+ * buffer and publishes it as the snapshot served to scrapers. */
+struct sfptpd_metrics_source;
+
+struct sfptpd_json_buf;
+struct sfptpd_thread;
+
+/* OpenMetrics metric family types */
+enum sfptpd_metrics_type {
+	SFPTPD_METRICS_TYPE_GAUGE,
+	SFPTPD_METRICS_TYPE_COUNTER,
+	SFPTPD_METRICS_TYPE_HISTOGRAM,
+	SFPTPD_METRICS_TYPE_SUMMARY,
+	SFPTPD_METRICS_TYPE_MAX
+};
+
+/** Function to render a source's metric families.
+ * @param buf The text buffer to render into
+ * @param context Context supplied on publication
+ */
+typedef void (*sfptpd_metrics_render_fn)(struct sfptpd_json_buf *buf,
+					 void *context);
+
+
+/****************************************************************************
+ * Function Prototypes
+ ****************************************************************************/
+
+/** Parse a metrics socket address specification of the form PATH for
+ * a Unix domain socket or [ADDRESS:]PORT for a TCP socket.
+ * @param spec The address specification
+ * @param addr Returned socket address
+ * @param len Returned socket address length
+ * @return 0 on success or an errno otherwise
+ */
+int sfptpd_metrics_parse_address(const char *spec,
+				 struct sockaddr_storage *addr,
+				 socklen_t *len);
+
+/** Create the metrics service, which serves OpenMetrics text on the
+ * socket specified by the general configuration.
+ * @param config Pointer to the configuration
+ * @param threadret Returned pointer to created thread
+ * @return metrics service on success else NULL with errno set.
+ */
+struct sfptpd_metrics *sfptpd_metrics_create(struct sfptpd_config *config,
+					     struct sfptpd_thread **threadret);
+
+/** Report whether the metrics service is running.
+ * @return true if metrics should be published.
+ */
+bool sfptpd_metrics_enabled(void);
+
+/** Render and publish the metrics for a source, replacing its previous
+ * snapshot. The source is created on first use. This does nothing if the
+ * metrics service is not running.
+ * @param source Pointer to the caller's source handle, initially NULL
+ * @param name Name of the source
+ * @param render Function to render the metric families
+ * @param context Context passed to the render function
+ */
+void sfptpd_metrics_publish(struct sfptpd_metrics_source **source,
+			    const char *name,
+			    sfptpd_metrics_render_fn render,
+			    void *context);
+
+/** Withdraw and free a source.
+ * @param source The source, which may be NULL
+ */
+void sfptpd_metrics_source_free(struct sfptpd_metrics_source *source);
+
+/** Write the metadata for a metric family and return its name.
+ * @param buf The text buffer
+ * @param name Returned metric family name
+ * @param prefix Family name prefix
+ * @param metric Metric name, converted to a valid metric name
+ * @param units Units appended to the name or NULL
+ * @param type Metric family type
+ * @param help Help text or NULL
+ */
+void sfptpd_metrics_family(struct sfptpd_json_buf *buf,
+			   char name[SFPTPD_METRICS_NAME_MAX],
+			   const char *prefix, const char *metric,
+			   const char *units, enum sfptpd_metrics_type type,
+			   const char *help);
+
+/** Format a set of labels for use in samples.
+ * @param labels Buffer for the formatted labels
+ * @param size Size of the buffer
+ * @param ... Pairs of label names and values terminated by NULL
+ * @return Length of the formatted labels
+ */
+size_t sfptpd_metrics_labels(char *labels, size_t size, ...)
+	__attribute__((sentinel));
+
+/** Write a sample of a metric family.
+ * @param buf The text buffer
+ * @param name Metric family name
+ * @param suffix Sample name suffix, e.g. "_total", or NULL
+ * @param labels Formatted labels or NULL
+ * @param value Sample value
+ * @param decimals Number of decimal places to write
+ */
+void sfptpd_metrics_sample(struct sfptpd_json_buf *buf, const char *name,
+			   const char *suffix, const char *labels,
+			   long double value, unsigned int decimals);
+
+#endif /* _SFPTPD_METRICS_H */
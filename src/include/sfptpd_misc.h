@@ -46,15 +46,14 @@ struct sfptpd_hash_table;
 
 
 /** struct sfptpd_ht_entry
- * Hash table entry
- * @magic: Magic number used to validate entry
- * @next: Pointer to next hash_entry item in linked list. NULL if at end of list
- * @user: Pointer to struct containing set specific info about entry
+ * Hash table slot
+ * @hash: Hash of the entry's key
+ * @user: Pointer to struct containing set specific info about entry or
+ * NULL if the slot is empty
  */
 typedef struct sfptpd_ht_entry
 {
-	uint32_t magic;
-	struct sfptpd_ht_entry *next;
+	uint32_t hash;
 	void *user;
 } sfptpd_ht_entry_t;
 
@@ -78,8 +77,8 @@ typedef struct sfptpd_ht_ops
 /** struct sfptpd_hash_table_iter
  * Hash table iterator
  * @table Pointer to hash table being iterated through
- * @index Current index in hash table
- * @entry Current entry in hash table
+ * @index Current position in hash table
+ * @entry Current slot in hash table or NULL before the first
  */
 typedef struct sfptpd_ht_iter
 {
@@ -146,9 +145,10 @@ bool sfptpd_is_program_running(const char *program_name);
 void sfptpd_local_strftime(char *s, size_t max, const char *format, const sfptpd_secs_t *timep);
 
 
-/** Create a hash table
- * @param hash_size Size of the hash values to be used
- * @param table_size Size of the hash table to allocate
+/** Create a hash table. The table grows as entries are added.
+ * @param ops Operations on the entries
+ * @param table_size Initial number of slots to allocate
+ * @param max_num_entries Maximum number of entries
  * @return A pointer to the hash table or null if memory allocation failed
  */
 struct sfptpd_hash_table *sfptpd_ht_alloc(const struct sfptpd_ht_ops *ops,
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+#ifndef _SFPTPD_NTP_SHM_H
+#define _SFPTPD_NTP_SHM_H
+
+#include "sfptpd_sync_module.h"
+#include "sfptpd_clockfeed.h"
+#include "sfptpd_clock.h"
+
+
+/****************************************************************************
+ * Structures and Types
+ ****************************************************************************/
+
+/* Opaque declaration of the NTP SHM refclock export */
+struct sfptpd_ntp_shm;
+
+
+/****************************************************************************
+ * Function Prototypes
+ ****************************************************************************/
+
+/** Create an export of time to NTP SHM refclock segments, as read by the
+ * ntpd SHM driver and compatible consumers. The segments are created if
+ * they do not already exist.
+ * @param units Array of SHM unit numbers to write
+ * @param num_units Number of units
+ * @param clockfeed Clock feed from which to take clock comparisons
+ * @param shm Where to store the handle of the export
+ * @return 0 on success or an errno otherwise
+ */
+int sfptpd_ntp_shm_create(const int *units, int num_units,
+			  struct sfptpd_clockfeed *clockfeed,
+			  struct sfptpd_ntp_shm **shm);
+
+/** Destroy an NTP SHM refclock export, detaching from the segments.
+ * @param shm The export or NULL
+ */
+void sfptpd_ntp_shm_destroy(struct sfptpd_ntp_shm *shm);
+
+/** Publish the time of the master of a sync instance to the SHM segments
+ * using the latest clock feed comparison of the instance's local reference
+ * clock with the system clock, if the instance is in the slave state and
+ * the comparison has not already been published.
+ * @param shm The export
+ * @param status Latest status of the sync instance
+ * @param leap_second Leap second currently scheduled
+ */
+void sfptpd_ntp_shm_update(struct sfptpd_ntp_shm *shm,
+			   const struct sfptpd_sync_instance_status *status,
+			   enum sfptpd_leap_second_type leap_second);
+
+
+#endif /* _SFPTPD_NTP_SHM_H */
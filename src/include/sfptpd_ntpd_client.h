@@ -35,11 +35,17 @@ struct sfptpd_ntpclient_protocol {
  * @mode6: NTP Mode 6 protocol client
  * @mode7: NTP Mode 7 protocol client
  * @selected: selected protocol client = mode6/7, or NULL for unselected
+ * @polling: protocol client with a poll in progress, or NULL
+ * @poll_sys_info: where the poll in progress writes the system info
+ * @poll_peer_info: where the poll in progress writes the peer info
  */
 struct sfptpd_ntpclient {
 	struct sfptpd_ntpclient_protocol mode6;
 	struct sfptpd_ntpclient_protocol mode7;
 	struct sfptpd_ntpclient_protocol *selected;
+	struct sfptpd_ntpclient_protocol *polling;
+	struct sfptpd_ntpclient_sys_info *poll_sys_info;
+	struct sfptpd_ntpclient_peer_info *poll_peer_info;
 };
 
 /** Structure to return information about the state of the NTP daemon.
@@ -138,7 +144,8 @@ int sfptpd_ntpclient_create(struct sfptpd_ntpclient **container,
 void sfptpd_ntpclient_destroy(struct sfptpd_ntpclient **container);
 
 /** Get system info from NTP daemon. This function sends a request and to
- * the NTP daemon and waits for a response.
+ * the NTP daemon and waits for a response. Any poll in progress is
+ * abandoned.
  * @param container: NTP client container 
  * @param sys_info Returned system info
  * @return 0 - success
@@ -150,7 +157,8 @@ int sfptpd_ntpclient_get_sys_info(struct sfptpd_ntpclient *container,
 				  struct sfptpd_ntpclient_sys_info *sys_info);
 
 /** Get peer info from NTP daemon. This function sends a request and to
- * the NTP daemon and waits for a response.
+ * the NTP daemon and waits for a response. Any poll in progress is
+ * abandoned.
  * @param container: NTP client container 
  * @param peer_info Returned peer info
  * @return 0 - success
@@ -161,9 +169,59 @@ int sfptpd_ntpclient_get_sys_info(struct sfptpd_ntpclient *container,
 int sfptpd_ntpclient_get_peer_info(struct sfptpd_ntpclient *container,
 				   struct sfptpd_ntpclient_peer_info *peer_info);
 
+/** Get the sockets used to communicate with the NTP daemon. The caller
+ * should call sfptpd_ntpclient_poll_io() when any of them are readable.
+ * @param container: NTP client container
+ * @param fds Array in which to return the sockets
+ * @param max_fds Size of the array, which must be at least 2
+ * @return The number of sockets returned
+ */
+int sfptpd_ntpclient_get_fds(struct sfptpd_ntpclient *container,
+			     int *fds, int max_fds);
+
+/** Start polling the NTP daemon for system and peer info without blocking.
+ * The requests are sent now and the responses processed as they arrive by
+ * sfptpd_ntpclient_poll_io(). The info structures are written as the
+ * responses arrive and must remain valid until the poll completes or is
+ * cancelled. Only one poll may be in progress at a time.
+ * @param container: NTP client container
+ * @param sys_info Where to write the system info, or NULL
+ * @param peer_info Where to write the peer info, or NULL
+ * @return 0 - poll in progress
+ *         ENOPROTOOPT - no protocols available (likely ntpd is not active)
+ *         EIO - communications error
+ */
+int sfptpd_ntpclient_poll_start(struct sfptpd_ntpclient *container,
+				struct sfptpd_ntpclient_sys_info *sys_info,
+				struct sfptpd_ntpclient_peer_info *peer_info);
+
+/** Process the responses from the NTP daemon waiting on the sockets.
+ * @param container: NTP client container
+ * @param complete Set to true if the poll in progress completed
+ * @return If the poll completed, its result as for
+ *         sfptpd_ntpclient_get_sys_info(); otherwise 0
+ */
+int sfptpd_ntpclient_poll_io(struct sfptpd_ntpclient *container,
+			     bool *complete);
+
+/** Check whether the poll in progress has timed out waiting for the NTP
+ * daemon. Should be called periodically while a poll is in progress.
+ * @param container: NTP client container
+ * @param complete Set to true if the poll in progress completed
+ * @return If the poll completed, its result as for
+ *         sfptpd_ntpclient_get_sys_info(); otherwise 0
+ */
+int sfptpd_ntpclient_poll_check(struct sfptpd_ntpclient *container,
+				bool *complete);
+
+/** Abandon the poll in progress, if any.
+ * @param container: NTP client container
+ */
+void sfptpd_ntpclient_poll_cancel(struct sfptpd_ntpclient *container);
+
 /** Enable or disable clock control. This function sends a request to the NTP
  * daemon to modify its system control flags and either enable or disable
- * disciplining of the system clock.
+ * disciplining of the system clock. Any poll in progress is abandoned.
  * @param container: NTP client container 
  * @param enable Boolean indicating whether to enable or disable
  * @return 0 - success
@@ -18,17 +18,28 @@
 /* Maximum NTP key value - longer than strictly necessary */
 #define SFPTPD_NTP_KEY_MAX (32)
 
-/* Functions each client protocol implmentation must contain */
+/* Functions each client protocol implmentation must contain.
+ * Information is collected by polls which send requests and process the
+ * responses as they arrive without blocking:
+ * @poll_start: send the requests for the system info and/or peer info,
+ * either of which may be NULL
+ * @poll_io: process the responses waiting on the socket
+ * @poll_check: fail requests whose responses have not arrived in time
+ * @poll_cancel: abandon the poll in progress
+ * poll_io and poll_check return EINPROGRESS until the poll completes and
+ * then the result of the poll. */
 struct sfptpd_ntpclient_fns {
 	void (*destroy)(struct sfptpd_ntpclient_state **state);
-	int (*get_sys_info)(struct sfptpd_ntpclient_state *state,
-			    struct sfptpd_ntpclient_sys_info *sys_info);
-	int (*get_peer_info)(struct sfptpd_ntpclient_state *state,
-			     struct sfptpd_ntpclient_peer_info *peer_info);
+	int (*get_fd)(struct sfptpd_ntpclient_state *state);
+	int (*poll_start)(struct sfptpd_ntpclient_state *state,
+			  struct sfptpd_ntpclient_sys_info *sys_info,
+			  struct sfptpd_ntpclient_peer_info *peer_info);
+	int (*poll_io)(struct sfptpd_ntpclient_state *state);
+	int (*poll_check)(struct sfptpd_ntpclient_state *state);
+	void (*poll_cancel)(struct sfptpd_ntpclient_state *state);
 	int (*clock_control)(struct sfptpd_ntpclient_state *state, bool enable);
 	struct sfptpd_ntpclient_feature_flags *
 	(*get_features)(struct sfptpd_ntpclient_state *state);
-	int (*test_connection)(struct sfptpd_ntpclient_state *state);
 };
 
 /* Protocol implementations interfaces, used by the client wrapper */
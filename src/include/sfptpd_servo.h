@@ -140,6 +140,18 @@ void sfptpd_servo_set_clocks(struct sfptpd_servo *servo, struct sfptpd_clock *ma
  */
 int sfptpd_servo_step_clock(struct sfptpd_servo *servo, struct sfptpd_timespec *offset);
 
+/** Perform a clock step operation on the slave clocks of several servos
+ * together so that the clocks are stepped at the same instant. Step each
+ * clock by the corresponding offset and reset the servos' filters.
+ * @param servos     Array of servo instances
+ * @param offsets    Amount to step each clock
+ * @param num_servos Number of servos
+ * @return 0 for success or the first errno if an operation failed.
+ */
+int sfptpd_servo_step_clocks(struct sfptpd_servo **servos,
+			     struct sfptpd_timespec *offsets,
+			     int num_servos);
+
 /** Perform a sync operation using the servo. This will perform a single
  * synchronization operation on the slave clock. In order to synchronise the
  * slave clock to the master and keep it in sync, this function should be called
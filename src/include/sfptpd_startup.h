@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+#ifndef _SFPTPD_STARTUP_H
+#define _SFPTPD_STARTUP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "sfptpd_time.h"
+#include "sfptpd_json.h"
+
+
+/****************************************************************************
+ * Structures, Types, Defines
+ ****************************************************************************/
+
+/** Milestones in the startup of the daemon, in the order that they are
+ * normally reached. Each is recorded the first time it is reached. */
+enum sfptpd_startup_phase {
+	SFPTPD_STARTUP_PROCESS_START,
+	SFPTPD_STARTUP_CONFIG_PARSED,
+	SFPTPD_STARTUP_NETLINK_SCANNED,
+	SFPTPD_STARTUP_CLOCKS_INITIALISED,
+	SFPTPD_STARTUP_INTERFACES_INITIALISED,
+	SFPTPD_STARTUP_SYNC_MODULES_CREATED,
+	SFPTPD_STARTUP_RUNNING,
+	SFPTPD_STARTUP_FIRST_CLOCKFEED_SAMPLE,
+	SFPTPD_STARTUP_FIRST_SERVO_ADJUSTMENT,
+	SFPTPD_STARTUP_FIRST_PTP_SYNC,
+	SFPTPD_STARTUP_CONVERGED,
+	SFPTPD_STARTUP_PHASE_MAX
+};
+
+
+/****************************************************************************
+ * Function Prototypes
+ ****************************************************************************/
+
+/** Record that a startup phase has been reached, if it has not been
+ * already. This is cheap once the phase has been recorded and may be
+ * called from any thread.
+ * @param phase The phase reached
+ */
+void sfptpd_startup_mark(enum sfptpd_startup_phase phase);
+
+/** Get the time after process start at which a phase was reached.
+ * @param phase The phase
+ * @param elapsed Where to store the time elapsed since process start
+ * @return true if the phase has been reached, otherwise false
+ */
+bool sfptpd_startup_get(enum sfptpd_startup_phase phase,
+			struct sfptpd_timespec *elapsed);
+
+/** Get the number of phases recorded so far. This can be used to decide
+ * whether the startup timeline needs to be written out again.
+ * @return The number of phases recorded
+ */
+int sfptpd_startup_count(void);
+
+/** Get the name of a startup phase.
+ * @param phase The phase
+ * @return The name of the phase
+ */
+const char *sfptpd_startup_phase_name(enum sfptpd_startup_phase phase);
+
+/** Write the startup timeline as a table.
+ * @param stream The stream to write to
+ */
+void sfptpd_startup_write_table(FILE *stream);
+
+/** Write the startup timeline as a JSON object, with the elapsed time in
+ * seconds of each phase reached so far.
+ * @param buf The buffer to write to
+ */
+void sfptpd_startup_write_json(struct sfptpd_json_buf *buf);
+
+
+#endif /* _SFPTPD_STARTUP_H */
@@ -170,6 +170,52 @@ typedef struct sfptpd_stats_count
 } sfptpd_stats_count_t;
 
 
+/** Resolution of the quantile sketch. Each power of two is divided into
+ * 2^SFPTPD_STATS_QUANTILE_SUB_BUCKETS_LOG2 linear buckets, which bounds the
+ * relative error of an estimate to half a bucket, about 3%. */
+#define SFPTPD_STATS_QUANTILE_SUB_BUCKETS_LOG2 (4)
+#define SFPTPD_STATS_QUANTILE_SUB_BUCKETS (1 << SFPTPD_STATS_QUANTILE_SUB_BUCKETS_LOG2)
+
+/** Range of the quantile sketch. Magnitudes below 1 unit share a single
+ * bucket and magnitudes of 2^SFPTPD_STATS_QUANTILE_OCTAVES units or more
+ * share the outermost buckets, e.g. 1ns to 68s for offsets in ns. */
+#define SFPTPD_STATS_QUANTILE_OCTAVES (36)
+
+/** Number of buckets in the quantile sketch, covering both signs */
+#define SFPTPD_STATS_QUANTILE_BUCKETS \
+	(2 * SFPTPD_STATS_QUANTILE_OCTAVES * SFPTPD_STATS_QUANTILE_SUB_BUCKETS + 1)
+
+/** Number of quantiles reported for quantile statistics */
+#define SFPTPD_STATS_NUM_QUANTILES (4)
+
+/** The quantiles reported for quantile statistics */
+extern const long double sfptpd_stats_quantiles[SFPTPD_STATS_NUM_QUANTILES];
+
+/** struct sfptpd_stats_quantile
+ * Mergeable sketch of the distribution of a value over a period of time.
+ * Samples are counted in log-linear buckets so that sketches for short
+ * periods can be added together exactly to give sketches for longer periods.
+ * @valid: Indicates that the structure has been initialised
+ * @qualified: A flag that indicates that a qualification criterion
+ * for the data applied continuously across the window.
+ * @num_samples: Total samples taken during the period
+ * @total: Sum total of all samples taken during the period
+ * @min: Minimum value recorded during the period
+ * @max: Maximum value recorded during the period
+ * @buckets: Count of samples in each bucket, ordered by value
+ */
+typedef struct sfptpd_stats_quantile
+{
+	bool valid;
+	bool qualified;
+	unsigned long num_samples;
+	long double total;
+	long double min;
+	long double max;
+	uint32_t buckets[SFPTPD_STATS_QUANTILE_BUCKETS];
+} sfptpd_stats_quantile_t;
+
+
 /** enum sfptpd_stats_type
  * Enum of different statistics measures used to identify members of
  * a statistics collection
@@ -178,6 +224,7 @@ enum sfptpd_stats_type
 {
 	SFPTPD_STATS_TYPE_RANGE,
 	SFPTPD_STATS_TYPE_COUNT,
+	SFPTPD_STATS_TYPE_QUANTILE,
 	SFPTPD_STATS_TYPE_MAX
 };
 
@@ -213,7 +260,6 @@ enum sfptpd_stats_history_index
 /** struct sfptpd_stats_item_ops
  * Abstracted interface to allow statistical measures to be handled in a
  * generic way.
- * @free: Free the resources associated with the statistics item
  * @update: Update the statistic. The argument list contains the new sample. The
  * format is specific to the statistics type being updated
  * @end_period: The end of the current stats period
@@ -223,11 +269,16 @@ enum sfptpd_stats_history_index
  * @write_json_data: Write a JSON-formatted entry to the stream provided
  * @write_json_closing: Write the JSON closing to the stream provided
  * @get: Get a historical statistic entry
+ * @write_metrics: Write OpenMetrics families for the last complete minute
+ * of an array of items of the same type, one per labelled collection
+ * @period_size: Get the size of the history kept for a time period
+ * @alloc_period: Allocate the history for a time period if that has not
+ * already been done, returning false on failure
  */
 struct sfptpd_stats_item;
+struct sfptpd_json_buf;
 typedef struct sfptpd_stats_item_ops
 {
-	void (*free)(struct sfptpd_stats_item *item);
 	void (*update)(struct sfptpd_stats_item *item, va_list args);
 	void (*end_period)(struct sfptpd_stats_item *item,
 			   enum sfptpd_stats_time_period period);
@@ -247,6 +298,12 @@ typedef struct sfptpd_stats_item_ops
 		   enum sfptpd_stats_time_period period,
 		   enum sfptpd_stats_history_index index,
 		   va_list args);
+	void (*write_metrics)(struct sfptpd_stats_item **items,
+			      const char *const *labels, unsigned int num,
+			      struct sfptpd_json_buf *buf, const char *prefix);
+	size_t (*period_size)(enum sfptpd_stats_time_period period);
+	bool (*alloc_period)(struct sfptpd_stats_item *item,
+			     enum sfptpd_stats_time_period period);
 } sfptpd_stats_item_ops_t;
 
 
@@ -257,7 +314,9 @@ typedef struct sfptpd_stats_item_ops
  * @units: Units of data item or NULL if none
  * @decimal_places: Number of decimal places that should be displayed
  * @ops: Structure of function pointers providing interface to derived classes
+ * @arena: Memory arena of the collection, from which history is allocated
  */
+struct sfptpd_stats_arena;
 typedef struct sfptpd_stats_item
 {
 	enum sfptpd_stats_type type;
@@ -265,6 +324,7 @@ typedef struct sfptpd_stats_item
 	const char *units;
 	unsigned int decimal_places;
 	const struct sfptpd_stats_item_ops *ops;
+	struct sfptpd_stats_arena *arena;
 } sfptpd_stats_item_t;
 
 
@@ -301,6 +361,9 @@ typedef struct sfptpd_stats_time_interval
  * is discarded.
  * @capacity: Current size of the stats items array
  * @items: Array of pointers to stats items
+ * @arena: Memory arena holding the stats items and their history, which
+ * is allocated for each time period when it is first needed or, if the
+ * collection is persistent, from a file mapped into memory
  */
 typedef struct sfptpd_stats_collection
 {
@@ -309,6 +372,7 @@ typedef struct sfptpd_stats_collection
 	sfptpd_stats_time_interval_t intervals[SFPTPD_STATS_PERIOD_MAX][SFPTPD_STATS_HISTORY_MAX];	
 	unsigned int capacity;
 	struct sfptpd_stats_item **items;
+	struct sfptpd_stats_arena *arena;
 } sfptpd_stats_collection_t;
 
 
@@ -479,6 +543,38 @@ void sfptpd_stats_count_add(struct sfptpd_stats_count *dst,
 			    struct sfptpd_stats_count *src);
 
 
+/** Initialise statistics quantile measure
+ * @param quantile Pointer to object to be initialised
+ */
+void sfptpd_stats_quantile_init(struct sfptpd_stats_quantile *quantile);
+
+/** Update statistics quantile measure
+ * @param quantile Pointer to measure
+ * @param sample Data sample
+ * @param qualified Whether an underlying qualification condition
+ * was true when the sample was collected
+ */
+void sfptpd_stats_quantile_update(struct sfptpd_stats_quantile *quantile,
+				  long double sample,
+				  bool qualified);
+
+/** Add one set of quantile statistics to another. Used to accummulate
+ * statistics from short periods into stats for a longer period.
+ * @param dst Pointer to destination measure
+ * @param src Pointer to source measure
+ */
+void sfptpd_stats_quantile_add(struct sfptpd_stats_quantile *dst,
+			       const struct sfptpd_stats_quantile *src);
+
+/** Estimate a quantile of the recorded samples
+ * @param quantile Pointer to measure
+ * @param q The quantile to estimate, between 0 and 1
+ * @return The estimate or NAN if there are no samples
+ */
+long double sfptpd_stats_quantile_get(const struct sfptpd_stats_quantile *quantile,
+				      long double q);
+
+
 /** Allocate a statistics collection
  * @param stats Pointer to collection object to be initialised
  * @param name Name for the stats collection
@@ -559,6 +655,42 @@ int sfptpd_stats_collection_update_count_samples(struct sfptpd_stats_collection
 					 unsigned long sample,
 					 unsigned long num_samples);
 
+/** Update a quantile statistical measure with a new data sample
+ * @param stats Pointer to collection
+ * @param index Index of statistics entry to update
+ * @param sample New data sample
+ * @param qualified Whether this sample is qualified
+ * @return 0 on success or an errno on failure
+ */
+int sfptpd_stats_collection_update_quantile(struct sfptpd_stats_collection *stats,
+					    unsigned int index,
+					    long double sample,
+					    bool qualified);
+
+/** Keep the history of a statistics collection in a file so that it
+ * persists across restarts. If the file holds history saved by a collection
+ * with the same definition then that history is restored. Otherwise the file
+ * is initialised. This must be called after all the items have been added
+ * and before the end of the first period.
+ * @param stats Pointer to collection
+ * @param path Path of the file
+ * @return 0 on success or an errno on failure, in which case the history
+ * is kept in memory
+ */
+int sfptpd_stats_collection_map(struct sfptpd_stats_collection *stats,
+				const char *path);
+
+/** Keep the history of a statistics collection in the state directory if
+ * persistent statistics are enabled. The file is named after the clock or
+ * sync instance in the same way as the statistics log.
+ * @param stats Pointer to collection
+ * @param clock Handle of instance clock, used as a backup for the file name
+ * @param sync_instance_name Used for the file name, may be null
+ */
+void sfptpd_stats_collection_persist(struct sfptpd_stats_collection *stats,
+				     struct sfptpd_clock *clock,
+				     const char *sync_instance_name);
+
 /** Indicate the end of a statistics period and update the history of each
  * stats item accordingly.
  * @param stats Pointer to collection
@@ -567,6 +699,20 @@ int sfptpd_stats_collection_update_count_samples(struct sfptpd_stats_collection
 void sfptpd_stats_collection_end_period(struct sfptpd_stats_collection *stats,
 				        struct sfptpd_timespec *end_time);
 
+/** Write the statistics of a set of collections with the same definition
+ * as OpenMetrics metric families, one labelled series per collection.
+ * @param collections Array of pointers to collections
+ * @param labels Formatted labels identifying each collection
+ * @param num Number of collections
+ * @param buf Text buffer to write to
+ * @param prefix Prefix for the metric family names
+ */
+void sfptpd_stats_collections_write_metrics(struct sfptpd_stats_collection *const *collections,
+					    const char *const *labels,
+					    unsigned int num,
+					    struct sfptpd_json_buf *buf,
+					    const char *prefix);
+
 /** Write all the statistics to the appropriate log file.
  * @param stats Pointer to collection
  * @param clock Handle of instance clock, used as a backup for log file name
@@ -622,6 +768,25 @@ int sfptpd_stats_collection_get_count(struct sfptpd_stats_collection *stats,
 				      unsigned long *count);
 
 
+/** Read the quantiles of a statistic history
+ * @param stats Pointer to collection
+ * @param index Index of statistical item of interest
+ * @param period Stats period of interest
+ * @param instance Stats history index of interest
+ * @param values Array of SFPTPD_STATS_NUM_QUANTILES returned estimates of
+ * the quantiles in sfptpd_stats_quantiles
+ * @param num_samples Pointer to returned number of samples or NULL if not
+ * required
+ * @return 0 on success or ENOENT if no valid entry for specified period
+ * and instance
+ */
+int sfptpd_stats_collection_get_quantiles(struct sfptpd_stats_collection *stats,
+					  unsigned int index,
+					  enum sfptpd_stats_time_period period,
+					  enum sfptpd_stats_history_index instance,
+					  long double *values,
+					  unsigned long *num_samples);
+
 /** Read metadata for a statistic
  * @param stats Pointer to collection
  * @param period Stats period of interest
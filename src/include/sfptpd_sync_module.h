@@ -51,6 +51,7 @@ struct sfptpd_clock;
 struct sfptpd_engine;
 struct sfptpd_log_time;
 struct sfptpd_timespec;
+struct sfptpd_json_buf;
 
 /** Flag indicating that the sync module instance is selected */
 #define SYNC_MODULE_SELECTED               (1<<0)
@@ -275,6 +276,14 @@ void sfptpd_sync_module_ctrl_flags_text(sfptpd_sync_module_ctrl_flags_t flags,
 size_t sfptpd_sync_module_alarms_stream(FILE *stream,
 	sfptpd_sync_module_alarms_t alarms, const char *separator);
 
+/** Appends a set of alarms to a JSON buffer as quoted strings.
+ * @param buf JSON buffer.
+ * @param alarm Bitmask of alarms.
+ * @param separator Separator appended between each alarm text (if >1).
+ */
+void sfptpd_sync_module_alarms_json(struct sfptpd_json_buf *buf,
+	sfptpd_sync_module_alarms_t alarms, const char *separator);
+
 /** Convert a set of alarms into a textual string
  * @param alarms  Bitmask of alarms
  * @param buffer  Pointer to buffer to store textual representation
@@ -126,6 +126,12 @@ int sfptpd_test_bic(void);
 int sfptpd_test_fmds(void);
 int sfptpd_test_link(void);
 int sfptpd_test_time(void);
+int sfptpd_test_logging(void);
+int sfptpd_test_json(void);
+int sfptpd_test_db(void);
+int sfptpd_test_crny(void);
+int sfptpd_test_metrics(void);
+int sfptpd_test_interface(void);
 
 
 #endif /* _SFPTPD_TEST_H */
@@ -60,6 +60,13 @@ typedef int (*sfptpd_thread_on_startup_fn)(void *user_context);
  */
 typedef void (*sfptpd_thread_on_shutdown_fn)(void *user_context);
 
+/** Typedef for the handler releasing the context of a thread whose deferred
+ * startup failed. This is called on the parent thread and should free what
+ * the creator would have freed had sfptpd_thread_create() failed.
+ * @param user_context Thread user context supplied when thread was created
+ */
+typedef void (*sfptpd_thread_on_startup_failed_fn)(void *user_context);
+
 /** Typedef for user signal handler
  * @param user_context Thread user context supplied when thread was created
  * @param signal_num Signal that has occurred
@@ -92,6 +99,7 @@ typedef void (*sfptpd_thread_on_user_fds_fn)(void *user_context,
  * @on_shutdown: Function to call when a thread is shutdown
  * @on_message: Function to call when a message is received
  * @on_user_fd: Function to call when a user file descriptor becomes ready
+ * @on_startup_failed: Optional function to call when a deferred startup fails
  */
 struct sfptpd_thread_ops
 {
@@ -99,6 +107,7 @@ struct sfptpd_thread_ops
 	sfptpd_thread_on_shutdown_fn on_shutdown;
 	sfptpd_thread_on_message_fn on_message;
 	sfptpd_thread_on_user_fds_fn on_user_fds;
+	sfptpd_thread_on_startup_failed_fn on_startup_failed;
 };
 
 
@@ -156,6 +165,23 @@ int sfptpd_thread_main(const struct sfptpd_thread_ops *ops,
 int sfptpd_thread_create(const char *name, const struct sfptpd_thread_ops *ops,
 			 void *user_context, struct sfptpd_thread **thread);
 
+/** Start deferring the startup of child threads. Until
+ * sfptpd_thread_await_startup() is called, sfptpd_thread_create() returns
+ * as soon as each child thread has been started, so that the startup
+ * handlers of several children can run concurrently.
+ */
+void sfptpd_thread_defer_startup(void);
+
+/** Wait for all child threads created since sfptpd_thread_defer_startup()
+ * to complete their startup handlers and stop deferring startup. Children
+ * that failed to start up are not destroyed: that is the responsibility of
+ * the caller in the same way as for successfully started threads. Their
+ * user contexts are released with the on_startup_failed handler.
+ * @return 0 if all children started successfully or else the error
+ * code of the first failure observed
+ */
+int sfptpd_thread_await_startup(void);
+
 /** Destroy another thread. Send an exit message to a thread, wait for it to
  * exit and then destroy the resources associated with it.
  * @param thread Pointer to thread to destroy
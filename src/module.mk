@@ -35,8 +35,8 @@ LIB_SRCS_$(d) := sfptpd_logging.c sfptpd_config.c sfptpd_engine.c \
 	sfptpd_bic.c sfptpd_control.c \
 	sfptpd_netlink.c sfptpd_phc.c sfptpd_db.c \
 	sfptpd_app.c sfptpd_link.c \
-	sfptpd_clockfeed.c \
-	sfptpd_multicast.c
+	sfptpd_clockfeed.c sfptpd_json.c sfptpd_metrics.c \
+	sfptpd_multicast.c sfptpd_startup.c sfptpd_interface_index.c
 
 LIB_$(d) := common
 
@@ -8,7 +8,7 @@ include mk/pushd.mk
 
 LIB_SRCS_$(d) := sfptpd_ntp_module.c \
 	sfptpd_ntpd_client_mode6.c sfptpd_ntpd_client_mode7.c \
-	sfptpd_ntpd_client.c
+	sfptpd_ntpd_client.c sfptpd_ntp_shm.c
 
 LIB_$(d) := ntp
 
@@ -67,8 +67,8 @@ enum ntp_mode {
 };
 
 enum ntp_query_state {
-	NTP_QUERY_STATE_SYS_INFO,
-	NTP_QUERY_STATE_PEER_INFO,
+	NTP_QUERY_STATE_START,
+	NTP_QUERY_STATE_WAIT,
 	NTP_QUERY_STATE_SLEEP
 };
 
@@ -155,6 +155,11 @@ typedef struct sfptpd_ntp_module {
 	/* NTP client container */
 	struct sfptpd_ntpclient *client;
 
+	/* NTP daemon system and peer info being collected by the poll in
+	 * progress */
+	struct sfptpd_ntpclient_sys_info poll_sys_info;
+	struct sfptpd_ntpclient_peer_info poll_peer_info;
+
 	/* Boolean indicating whether we consider the slave clock to be
 	 * synchonized to the master */
 	bool synchronized;
@@ -432,6 +437,9 @@ int ntp_stats_init(ntp_module_t *ntp)
 	rc = sfptpd_stats_collection_create(&ntp->stats, "ntp",
 					    sizeof(ntp_stats_defns)/sizeof(ntp_stats_defns[0]),
 					    ntp_stats_defns);
+	if (rc == 0)
+		sfptpd_stats_collection_persist(&ntp->stats, NULL,
+						SFPTPD_CONFIG_GET_NAME(ntp->config));
 	return rc;
 }
 
@@ -797,10 +805,38 @@ fail:
 	return rc;
 }
 
+static bool ntp_poll_complete(ntp_module_t *ntp, struct ntp_state *new_state, int rc)
+{
+	assert(ntp != NULL);
+	assert(new_state != NULL);
+
+	/* Take the info collected by the poll and move to the sleep state.
+	 * Signal to the caller that the state may have changed */
+	new_state->sys_info = ntp->poll_sys_info;
+	new_state->peer_info = ntp->poll_peer_info;
+	ntp_parse_state(new_state, rc, ntp->offset_unsafe);
+	ntp->query_state = NTP_QUERY_STATE_SLEEP;
+	return true;
+}
+
+
+static void ntp_poll_cancel(ntp_module_t *ntp)
+{
+	assert(ntp != NULL);
+
+	/* Abandon the poll in progress and start another at the next tick */
+	if (ntp->query_state == NTP_QUERY_STATE_WAIT) {
+		sfptpd_ntpclient_poll_cancel(ntp->client);
+		ntp->query_state = NTP_QUERY_STATE_START;
+	}
+}
+
+
 bool ntp_state_machine(ntp_module_t *ntp, struct ntp_state *new_state)
 {
 	int rc;
 	bool update;
+	bool complete;
 	struct sfptpd_timespec time_now, time_left;
 	assert(ntp != NULL);
 	assert(new_state != NULL);
@@ -808,22 +844,26 @@ bool ntp_state_machine(ntp_module_t *ntp, struct ntp_state *new_state)
 	update = false;
 
 	switch (ntp->query_state) {
-	case NTP_QUERY_STATE_SYS_INFO:
-		/* Get the system info, then move to the get peer state.
-		 * Signal to the caller that the state may have changed */
-		rc = sfptpd_ntpclient_get_sys_info(ntp->client, &new_state->sys_info);
-		ntp_parse_state(new_state, rc, ntp->offset_unsafe);
-		update = true;
-		ntp->query_state = NTP_QUERY_STATE_PEER_INFO;
+	case NTP_QUERY_STATE_START:
+		/* Send the requests for the system and peer info, starting
+		 * from the current info. The responses are processed as they
+		 * arrive. */
+		ntp->poll_sys_info = ntp->state.sys_info;
+		ntp->poll_peer_info = ntp->state.peer_info;
+		rc = sfptpd_ntpclient_poll_start(ntp->client,
+						 &ntp->poll_sys_info,
+						 &ntp->poll_peer_info);
+		if (rc == 0)
+			ntp->query_state = NTP_QUERY_STATE_WAIT;
+		else
+			update = ntp_poll_complete(ntp, new_state, rc);
 		break;
 
-	case NTP_QUERY_STATE_PEER_INFO:
-		/* Get the peer info and move to the sleep state. Signal to the
-		 * caller that the state may have changed */
-		rc = sfptpd_ntpclient_get_peer_info(ntp->client, &new_state->peer_info);
-		ntp_parse_state(new_state, rc, ntp->offset_unsafe);
-		update = true;
-		ntp->query_state = NTP_QUERY_STATE_SLEEP;
+	case NTP_QUERY_STATE_WAIT:
+		/* Check whether the NTP daemon has failed to respond */
+		rc = sfptpd_ntpclient_poll_check(ntp->client, &complete);
+		if (complete)
+			update = ntp_poll_complete(ntp, new_state, rc);
 		break;
 
 	case NTP_QUERY_STATE_SLEEP:
@@ -831,11 +871,9 @@ bool ntp_state_machine(ntp_module_t *ntp, struct ntp_state *new_state)
 		(void)sfclock_gettime(CLOCK_MONOTONIC, &time_now);
 		sfptpd_time_subtract(&time_left, &ntp->next_poll_time, &time_now);
 		if (time_left.sec < 0) {
-			ntp->query_state = NTP_QUERY_STATE_SYS_INFO;
+			ntp->query_state = NTP_QUERY_STATE_START;
 			ntp->next_poll_time.sec += ntp->config->poll_interval;
 		}
-		/* This state always succeeds */
-		rc = 0;
 		break;
 		
 	default:
@@ -1034,6 +1072,10 @@ static void ntp_on_control(ntp_module_t *ntp, sfptpd_sync_module_msg_t *msg)
 	/* For the NTP sync module, only the clock control flag has meaning. */
 	if ((flags ^ ntp->ctrl_flags) & SYNC_MODULE_CLOCK_CTRL) {
 		bool clock_control = ((flags & SYNC_MODULE_CLOCK_CTRL) != 0);
+
+		/* Responses to a poll in progress predate the change */
+		ntp_poll_cancel(ntp);
+
 		rc = sfptpd_ntpclient_clock_control(ntp->client, clock_control);
 		if (rc == 0) {
 			ntp->state.sys_info.clock_control_enabled = clock_control;
@@ -1271,7 +1313,7 @@ static void ntp_on_run(ntp_module_t *ntp)
 
 	/* Determine the time when we should next poll the NTP daemon */
 	(void)sfclock_gettime(CLOCK_MONOTONIC, &ntp->next_poll_time);
-	ntp->query_state = NTP_QUERY_STATE_SYS_INFO;
+	ntp->query_state = NTP_QUERY_STATE_START;
 	ntp->offset_unsafe = false;
 
 	/* Send initial status */
@@ -1283,6 +1325,32 @@ static void ntp_on_run(ntp_module_t *ntp)
 }
 
 
+static void ntp_on_update(ntp_module_t *ntp, struct ntp_state *new_state)
+{
+	assert(ntp != NULL);
+	assert(new_state != NULL);
+
+	if (new_state->sys_info.clock_control_enabled !=
+	    ntp->state.sys_info.clock_control_enabled)
+		ntp_on_clock_control_change(ntp, new_state);
+
+	if (!offset_ids_equal(new_state, &ntp->state))
+		ntp_on_offset_id_change(ntp, new_state);
+
+	/* Handle changes in the state */
+	ntp_handle_state_change(ntp, new_state);
+	
+	/* Store the new state */
+	ntp->state = *new_state;
+
+	/* Update the convergence criteria */
+	ntp_convergence_update(ntp);
+
+	/* Update historical stats */
+	ntp_stats_update(ntp);
+}
+
+
 static void ntp_on_timer(void *user_context, unsigned int id)
 {
 	ntp_module_t *ntp = (ntp_module_t *)user_context;
@@ -1298,26 +1366,8 @@ static void ntp_on_timer(void *user_context, unsigned int id)
 	new_state = ntp->state;
 	update = ntp_state_machine(ntp, &new_state);
 
-	if (update) {
-		if (new_state.sys_info.clock_control_enabled !=
-		    ntp->state.sys_info.clock_control_enabled)
-			ntp_on_clock_control_change(ntp, &new_state);
-
-		if (!offset_ids_equal(&new_state, &ntp->state))
-			ntp_on_offset_id_change(ntp, &new_state);
-
-		/* Handle changes in the state */
-		ntp_handle_state_change(ntp, &new_state);
-		
-		/* Store the new state */
-		ntp->state = new_state;
-
-		/* Update the convergence criteria */
-		ntp_convergence_update(ntp);
-
-		/* Update historical stats */
-		ntp_stats_update(ntp);
-	}
+	if (update)
+		ntp_on_update(ntp, &new_state);
 
 	sfptpd_time_from_ns(&interval, NTP_POLL_INTERVAL);
 	rc = sfptpd_thread_timer_start(NTP_POLL_TIMER_ID,
@@ -1332,7 +1382,10 @@ static void ntp_on_timer(void *user_context, unsigned int id)
 static int ntp_on_startup(void *context)
 {
 	ntp_module_t *ntp = (ntp_module_t *)context;
+	int fds[2];
+	int num_fds;
 	int rc;
+	int i;
 
 	assert(ntp != NULL);
 
@@ -1362,6 +1415,17 @@ static int ntp_on_startup(void *context)
 		goto fail;
 	}
 
+	/* Responses from the NTP daemon are handled as they arrive */
+	num_fds = sfptpd_ntpclient_get_fds(ntp->client, fds, sizeof fds / sizeof *fds);
+	for (i = 0; i < num_fds; i++) {
+		rc = sfptpd_thread_user_fd_add(fds[i], true, false);
+		if (rc != 0) {
+			CRITICAL("ntp: failed to add ntpd client socket to epoll, %s\n",
+				 strerror(rc));
+			goto fail;
+		}
+	}
+
 	return 0;
 
 fail:
@@ -1375,8 +1439,16 @@ fail:
 static void ntp_on_shutdown(void *context)
 {
 	ntp_module_t *ntp = (ntp_module_t *)context;
+	int fds[2];
+	int num_fds;
+	int i;
+
 	assert(ntp != NULL);
 
+	num_fds = sfptpd_ntpclient_get_fds(ntp->client, fds, sizeof fds / sizeof *fds);
+	for (i = 0; i < num_fds; i++)
+		sfptpd_thread_user_fd_remove(fds[i]);
+
 	sfptpd_ntpclient_destroy(&(ntp->client));
 
 	sfptpd_stats_collection_free(&ntp->stats);
@@ -1386,6 +1458,16 @@ static void ntp_on_shutdown(void *context)
 }
 
 
+static void ntp_on_startup_failed(void *context)
+{
+	ntp_module_t *ntp = (ntp_module_t *)context;
+	assert(ntp != NULL);
+
+	/* Delete the sync module context */
+	free(ntp);
+}
+
+
 static void ntp_on_message(void *context, struct sfptpd_msg_hdr *hdr)
 {
 	ntp_module_t *ntp = (ntp_module_t *)context;
@@ -1454,7 +1536,21 @@ static void ntp_on_message(void *context, struct sfptpd_msg_hdr *hdr)
 static void ntp_on_user_fds(void *context, unsigned int num_fds,
 			    struct sfptpd_thread_event events[])
 {
-	/* The NTP module doesn't use user file descriptors */
+	ntp_module_t *ntp = (ntp_module_t *)context;
+	struct ntp_state new_state;
+	bool complete;
+	int rc;
+
+	assert(ntp != NULL);
+
+	/* Process the responses from the NTP daemon on all of the sockets
+	 * and update the state if they complete the poll in progress */
+	rc = sfptpd_ntpclient_poll_io(ntp->client, &complete);
+	if (complete && (ntp->query_state == NTP_QUERY_STATE_WAIT)) {
+		new_state = ntp->state;
+		if (ntp_poll_complete(ntp, &new_state, rc))
+			ntp_on_update(ntp, &new_state);
+	}
 }
 
 
@@ -1463,7 +1559,8 @@ static const struct sfptpd_thread_ops ntp_thread_ops =
 	ntp_on_startup,
 	ntp_on_shutdown,
 	ntp_on_message,
-	ntp_on_user_fds
+	ntp_on_user_fds,
+	ntp_on_startup_failed
 };
 
 
@@ -1606,7 +1703,7 @@ int sfptpd_ntp_module_create(struct sfptpd_config *config,
 	 * carry out the rest of the initialisation. */
 	rc = sfptpd_thread_create("ntp", &ntp_thread_ops, ntp, sync_module);
 	if (rc != 0) {
-		free(ntp);
+		ntp_on_startup_failed(ntp);
 		return rc;
 	}
 
@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_ntp_shm.c
+ * @brief  Export of time to NTP SHM refclock segments
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "sfptpd_logging.h"
+#include "sfptpd_sync_module.h"
+#include "sfptpd_clockfeed.h"
+#include "sfptpd_clock.h"
+#include "sfptpd_time.h"
+
+#include "sfptpd_ntp_shm.h"
+
+
+/****************************************************************************
+ * Macros
+ ****************************************************************************/
+
+/* NTP component specific trace */
+#define DBG_L1(x, ...)  TRACE(SFPTPD_COMPONENT_ID_NTP, 1, x, ##__VA_ARGS__)
+#define DBG_L6(x, ...)  TRACE(SFPTPD_COMPONENT_ID_NTP, 6, x, ##__VA_ARGS__)
+
+/* SHM key of unit 0; units are numbered consecutively from here */
+#define NTP_SHM_KEY_BASE (0x4e545030)
+
+/* Units above this are accessible to non-root consumers */
+#define NTP_SHM_MAX_PRIVATE_UNIT (1)
+
+/* Mode in which readers check the count either side of reading */
+#define NTP_SHM_MODE_COUNT (1)
+
+/* Precision of the samples given as a power of two seconds, around a
+ * microsecond */
+#define NTP_SHM_PRECISION (-20)
+
+
+/****************************************************************************
+ * Types
+ ****************************************************************************/
+
+/* Layout of an NTP SHM refclock segment */
+struct ntp_shm_time {
+	int mode;
+	volatile int count;
+	time_t clock_sec;
+	int clock_usec;
+	time_t receive_sec;
+	int receive_usec;
+	int leap;
+	int precision;
+	int nsamples;
+	volatile int valid;
+	unsigned clock_nsec;
+	unsigned receive_nsec;
+	int dummy[8];
+};
+
+/* Leap indications understood by ntpd */
+enum ntp_shm_leap {
+	NTP_SHM_LEAP_NOWARNING = 0,
+	NTP_SHM_LEAP_ADDSECOND = 1,
+	NTP_SHM_LEAP_DELSECOND = 2,
+};
+
+struct ntp_shm_unit {
+	int unit;
+	struct ntp_shm_time *seg;
+};
+
+struct sfptpd_ntp_shm {
+	/* Clock feed subscription following the selected instance's clock */
+	struct sfptpd_clockfeed_follower feed;
+
+	/* Number of samples published */
+	unsigned long samples;
+
+	/* Attached segments */
+	int num_units;
+	struct ntp_shm_unit units[];
+};
+
+
+/****************************************************************************
+ * Local Functions
+ ****************************************************************************/
+
+static struct ntp_shm_time *ntp_shm_attach(int unit)
+{
+	struct ntp_shm_time *seg;
+	int perms = (unit <= NTP_SHM_MAX_PRIVATE_UNIT) ? 0600 : 0666;
+	int id;
+
+	id = shmget(NTP_SHM_KEY_BASE + unit, sizeof *seg, IPC_CREAT | perms);
+	if (id < 0)
+		return NULL;
+
+	seg = shmat(id, NULL, 0);
+	if (seg == (void *) -1)
+		return NULL;
+
+	return seg;
+}
+
+
+/* Write a sample following the count and valid protocol of the SHM driver
+ * so that readers never use a partially written sample. */
+static void ntp_shm_write(struct ntp_shm_time *seg,
+			  const struct sfptpd_timespec *clock_time,
+			  const struct sfptpd_timespec *receive_time,
+			  int leap)
+{
+	seg->valid = 0;
+	seg->count++;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	seg->mode = NTP_SHM_MODE_COUNT;
+	seg->clock_sec = clock_time->sec;
+	seg->clock_usec = clock_time->nsec / 1000;
+	seg->clock_nsec = clock_time->nsec;
+	seg->receive_sec = receive_time->sec;
+	seg->receive_usec = receive_time->nsec / 1000;
+	seg->receive_nsec = receive_time->nsec;
+	seg->leap = leap;
+	seg->precision = NTP_SHM_PRECISION;
+	seg->nsamples = 0;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	seg->count++;
+	seg->valid = 1;
+}
+
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int sfptpd_ntp_shm_create(const int *units, int num_units,
+			  struct sfptpd_clockfeed *clockfeed,
+			  struct sfptpd_ntp_shm **shm)
+{
+	struct sfptpd_ntp_shm *new;
+	int rc;
+	int i;
+
+	assert(units != NULL);
+	assert(clockfeed != NULL);
+	assert(shm != NULL);
+
+	new = calloc(1, sizeof *new + num_units * sizeof *new->units);
+	if (new == NULL)
+		return ENOMEM;
+
+	sfptpd_clockfeed_follower_init(&new->feed, clockfeed);
+
+	for (i = 0; i < num_units; i++) {
+		new->units[i].unit = units[i];
+		new->units[i].seg = ntp_shm_attach(units[i]);
+		if (new->units[i].seg == NULL) {
+			rc = errno;
+			ERROR("ntp shm: failed to attach to unit %d, %s\n",
+			      units[i], strerror(rc));
+			sfptpd_ntp_shm_destroy(new);
+			return rc;
+		}
+		new->num_units++;
+		INFO("ntp shm: publishing time to unit %d\n", units[i]);
+	}
+
+	*shm = new;
+	return 0;
+}
+
+
+void sfptpd_ntp_shm_destroy(struct sfptpd_ntp_shm *shm)
+{
+	int i;
+
+	if (shm == NULL)
+		return;
+
+	sfptpd_clockfeed_follower_release(&shm->feed);
+
+	/* Leave the segments for the readers but mark them stale */
+	for (i = 0; i < shm->num_units; i++) {
+		shm->units[i].seg->valid = 0;
+		shmdt(shm->units[i].seg);
+	}
+
+	DBG_L1("ntp shm: published %lu samples\n", shm->samples);
+	free(shm);
+}
+
+
+void sfptpd_ntp_shm_update(struct sfptpd_ntp_shm *shm,
+			   const struct sfptpd_sync_instance_status *status,
+			   enum sfptpd_leap_second_type leap_second)
+{
+	struct sfptpd_timespec diff, t_sys, clock_time;
+	int leap;
+	int rc;
+	int i;
+
+	assert(shm != NULL);
+	assert(status != NULL);
+
+	if (status->state != SYNC_MODULE_STATE_SLAVE || status->clock == NULL)
+		return;
+
+	/* Take the comparison with the system clock unless already
+	 * published */
+	rc = sfptpd_clockfeed_follower_compare(&shm->feed, status->clock,
+					       &diff, &t_sys);
+	if (rc != 0) {
+		if (rc != EALREADY)
+			DBG_L6("ntp shm: no clock feed comparison, %s\n",
+			       strerror(rc));
+		return;
+	}
+
+	/* The time of the master when the system clock read t_sys */
+	sfptpd_time_add(&clock_time, &t_sys, &diff);
+	sfptpd_time_subtract(&clock_time, &clock_time, &status->offset_from_master);
+
+	switch (leap_second) {
+	case SFPTPD_LEAP_SECOND_61:
+		leap = NTP_SHM_LEAP_ADDSECOND;
+		break;
+	case SFPTPD_LEAP_SECOND_59:
+		leap = NTP_SHM_LEAP_DELSECOND;
+		break;
+	default:
+		leap = NTP_SHM_LEAP_NOWARNING;
+		break;
+	}
+
+	for (i = 0; i < shm->num_units; i++)
+		ntp_shm_write(shm->units[i].seg, &clock_time, &t_sys, leap);
+	shm->samples++;
+}
+
+
+/* fin */
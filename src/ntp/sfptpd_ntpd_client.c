@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <netdb.h>
 
 #include "sfptpd_logging.h"
@@ -32,29 +33,91 @@
 #define DBG_L6(x, ...)  TRACE(SFPTPD_COMPONENT_ID_NTP, 6, x, ##__VA_ARGS__)
 
 
+/* Interval at which blocking calls check for timeouts while waiting */
+#define NTPCLIENT_WAIT_INTERVAL_NS (50000000)
+
+
 /****************************************************************************
  * Local Functions
  ****************************************************************************/
 
-static int select_protocol(struct sfptpd_ntpclient *container)
+/* Handle the completion of a poll of the protocol being polled. If no
+ * protocol has yet been selected, the poll tests each protocol in turn and
+ * the first to succeed is selected. Returns EINPROGRESS if the poll has
+ * moved on to the next protocol. */
+static int ntpclient_poll_finished(struct sfptpd_ntpclient *container, int rc)
 {
-	/* Scenarios:
+	struct sfptpd_ntpclient_protocol *client = container->polling;
+
+	/* Scenarios for selecting a protocol:
 	 * 	- protocol instances have just been created
 	 * 	- ntp daemon was off and has now started
 	 */
-	if (container->selected == NULL)
-	{
-		if (container->mode7.fns->test_connection(container->mode7.state) == 0) {
-			container->selected = &(container->mode7);
-			DBG_L3("ntpclient: selected NTP Mode 7 Protocol\n");
-		} else if (container->mode6.fns->test_connection(container->mode6.state) == 0) {
-			container->selected = &(container->mode6);
-			DBG_L3("ntpclient: selected NTP Mode 6 Protocol\n");
+	container->polling = NULL;
+	if (container->selected == NULL) {
+		if (rc == 0) {
+			container->selected = client;
+			DBG_L3("ntpclient: selected NTP Mode %d Protocol\n",
+			       client == &container->mode7 ? 7 : 6);
+		} else if (client == &container->mode7) {
+			container->polling = &container->mode6;
+			rc = container->mode6.fns->poll_start(container->mode6.state,
+							      container->poll_sys_info,
+							      container->poll_peer_info);
+			if (rc == 0)
+				return EINPROGRESS;
+			container->polling = NULL;
+			rc = ENOPROTOOPT;
 		} else {
 			/* No NTP protocol available */
-			return ENOPROTOOPT;
+			rc = ENOPROTOOPT;
+		}
+	}
+
+	if (rc == 0 && container->poll_peer_info != NULL)
+		sfptpd_ntpclient_print_peers(container->poll_peer_info, "ntp");
+	return rc;
+}
+
+/* Wait for the poll in progress to complete */
+static int ntpclient_poll_wait(struct sfptpd_ntpclient *container)
+{
+	struct timespec timeout;
+	fd_set fds;
+	bool complete;
+	int fd, rc;
+
+	while (true) {
+		rc = sfptpd_ntpclient_poll_check(container, &complete);
+		if (complete)
+			return rc;
+
+		fd = container->polling->fns->get_fd(container->polling->state);
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = NTPCLIENT_WAIT_INTERVAL_NS;
+		rc = pselect(fd + 1, &fds, NULL, NULL, &timeout, NULL);
+		if (rc < 0 && errno != EINTR) {
+			rc = errno;
+			ERROR("ntpclient: error waiting on socket, %s\n",
+			      strerror(rc));
+			sfptpd_ntpclient_poll_cancel(container);
+			return rc;
 		}
+
+		rc = sfptpd_ntpclient_poll_io(container, &complete);
+		if (complete)
+			return rc;
 	}
+}
+
+static int select_protocol(struct sfptpd_ntpclient *container)
+{
+	struct sfptpd_ntpclient_sys_info sys_info = {};
+
+	if (container->selected == NULL)
+		return sfptpd_ntpclient_get_sys_info(container, &sys_info);
 	return 0;
 }
 
@@ -183,43 +246,34 @@ void sfptpd_ntpclient_destroy(struct sfptpd_ntpclient **container)
 int sfptpd_ntpclient_get_sys_info(struct sfptpd_ntpclient *container,
 				  struct sfptpd_ntpclient_sys_info *sys_info)
 {
-	struct sfptpd_ntpclient_protocol *client;
 	int rc;
 
-	/* Select the best available protocol */
-	rc = select_protocol(container);
+	sfptpd_ntpclient_poll_cancel(container);
+
+	rc = sfptpd_ntpclient_poll_start(container, sys_info, NULL);
 	if (rc != 0)
 		return rc;
 
-	client = (container->selected);
-
-	/* Get sys info through whichever protocol we are currently using */
-	rc = ENOPROTOOPT;
-	if (client->state != NULL)
-		rc = client->fns->get_sys_info(client->state, sys_info);
-	return rc;
+	return ntpclient_poll_wait(container);
 }
 
 int sfptpd_ntpclient_get_peer_info(struct sfptpd_ntpclient *container,
 				   struct sfptpd_ntpclient_peer_info *peer_info)
 {
-	struct sfptpd_ntpclient_protocol *client;
 	int rc;
 
+	sfptpd_ntpclient_poll_cancel(container);
+
 	/* Select the best available protocol */
 	rc = select_protocol(container);
 	if (rc != 0)
 		return rc;
 
-	client = (container->selected);
+	rc = sfptpd_ntpclient_poll_start(container, NULL, peer_info);
+	if (rc != 0)
+		return rc;
 
-	/* Get peer info through whichever protocol we are currently using */
-	rc = ENOPROTOOPT;
-	if (client->state != NULL)
-		rc = client->fns->get_peer_info(client->state, peer_info);
-	if (rc == 0)
-		sfptpd_ntpclient_print_peers(peer_info, "ntp");
-	return rc;
+	return ntpclient_poll_wait(container);
 }
 
 int sfptpd_ntpclient_clock_control(struct sfptpd_ntpclient *container,
@@ -228,6 +282,8 @@ int sfptpd_ntpclient_clock_control(struct sfptpd_ntpclient *container,
 	struct sfptpd_ntpclient_protocol *client;
 	int rc;
 
+	sfptpd_ntpclient_poll_cancel(container);
+
 	/* Select the best available protocol */
 	rc = select_protocol(container);
 	if (rc != 0)
@@ -258,5 +314,115 @@ sfptpd_ntpclient_get_features(struct sfptpd_ntpclient *container)
 	}
 }
 
+int sfptpd_ntpclient_get_fds(struct sfptpd_ntpclient *container,
+			     int *fds, int max_fds)
+{
+	assert(container != NULL);
+	assert(fds != NULL);
+	assert(max_fds >= 2);
+
+	fds[0] = container->mode7.fns->get_fd(container->mode7.state);
+	fds[1] = container->mode6.fns->get_fd(container->mode6.state);
+	return 2;
+}
+
+int sfptpd_ntpclient_poll_start(struct sfptpd_ntpclient *container,
+				struct sfptpd_ntpclient_sys_info *sys_info,
+				struct sfptpd_ntpclient_peer_info *peer_info)
+{
+	int rc;
+
+	assert(container != NULL);
+	assert(container->polling == NULL);
+
+	container->poll_sys_info = sys_info;
+	container->poll_peer_info = peer_info;
+
+	/* Poll through whichever protocol we are currently using or start
+	 * by testing the best one */
+	container->polling = container->selected;
+	if (container->polling == NULL)
+		container->polling = &container->mode7;
+
+	rc = container->polling->fns->poll_start(container->polling->state,
+						 sys_info, peer_info);
+	if (rc != 0) {
+		rc = ntpclient_poll_finished(container, rc);
+		if (rc == EINPROGRESS)
+			rc = 0;
+	}
+	return rc;
+}
+
+int sfptpd_ntpclient_poll_io(struct sfptpd_ntpclient *container,
+			     bool *complete)
+{
+	struct sfptpd_ntpclient_protocol *protocols[] = {
+		&container->mode7, &container->mode6
+	};
+	struct sfptpd_ntpclient_protocol *client;
+	int i, rc = 0;
+
+	assert(container != NULL);
+	assert(complete != NULL);
+
+	*complete = false;
+
+	for (i = 0; i < sizeof protocols / sizeof *protocols; i++) {
+		client = protocols[i];
+
+		/* Anything arriving for a protocol not being polled is
+		 * stale and is discarded */
+		rc = client->fns->poll_io(client->state);
+		if (client != container->polling || rc == EINPROGRESS)
+			continue;
+
+		rc = ntpclient_poll_finished(container, rc);
+		if (rc != EINPROGRESS) {
+			*complete = true;
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+int sfptpd_ntpclient_poll_check(struct sfptpd_ntpclient *container,
+				bool *complete)
+{
+	struct sfptpd_ntpclient_protocol *client;
+	int rc;
+
+	assert(container != NULL);
+	assert(complete != NULL);
+
+	*complete = false;
+
+	client = container->polling;
+	if (client == NULL)
+		return 0;
+
+	rc = client->fns->poll_check(client->state);
+	if (rc == EINPROGRESS)
+		return 0;
+
+	rc = ntpclient_poll_finished(container, rc);
+	if (rc == EINPROGRESS)
+		return 0;
+
+	*complete = true;
+	return rc;
+}
+
+void sfptpd_ntpclient_poll_cancel(struct sfptpd_ntpclient *container)
+{
+	assert(container != NULL);
+
+	if (container->polling != NULL) {
+		container->polling->fns->poll_cancel(container->polling->state);
+		container->polling = NULL;
+	}
+}
+
 
 /* fin */
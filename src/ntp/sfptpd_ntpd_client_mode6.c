@@ -204,12 +204,6 @@ struct ntp_mode6_packet {
 #define	PKT_VERSION(li_vn_mode)	((u_char)(((li_vn_mode) >> 3) & 0x7))
 #define	PKT_LEAP(li_vn_mode)	((u_char)(((li_vn_mode) >> 6) & 0x3))
 
-/*
- * Sequence number used for requests.  It is incremented before
- * it is used.
- */
-uint16_t sequence;
-
 static inline int size2int_sat(size_t v)
 {
 	return (v > INT_MAX) ? INT_MAX : (int)v;
@@ -410,12 +404,97 @@ STATIC_ASSERT(sizeof(struct association) == 4);
 
 /* End fo NTP defitions borrowed/modified from NTPD source code */
 
-/* Mode 6 requires two buffers of the same size, the size is defined here.
- * The buffers hold query responses while collecting the peer_info data.
- * The data is copied from one generic buffer to the other association buffer,
- * so the buffers must have the same size. */
+/* Size of the buffer holding the reassembled response to a request */
 #define NTPCLIENT_BUFFER_SIZE	0x1000
 
+/* Maximum number of requests in flight: the variables of each peer, the
+ * system variables and association list for a poll and a blocking query */
+#define MODE6_REQUESTS_MAX	(SFPTPD_NTP_PEERS_MAX + 3)
+
+/* Number of refreshes of the peer info after which the variables of an
+ * association are read again even if its status word has not changed. The
+ * event counter in the status word saturates so cannot be relied upon to
+ * reveal every change. */
+#define MODE6_ASSOC_MAX_AGE	(16)
+
+/* What the response to a request is used for */
+enum mode6_purpose {
+	MODE6_PURPOSE_QUERY,
+	MODE6_PURPOSE_SYS_INFO,
+	MODE6_PURPOSE_ASSOCS,
+	MODE6_PURPOSE_PEER,
+};
+
+/* A request in flight to the NTP daemon. Responses are matched to requests
+ * by sequence number so any number may be in flight at once.
+ * @in_use: The request slot is in use
+ * @sequence: Sequence number of the request
+ * @opcode: Request opcode
+ * @associd: Association ID the request is for
+ * @purpose: What the response is used for
+ * @peer_idx: Index of the peer whose variables are being read
+ * @deadline: Time by which the next fragment of the response is due
+ * @offsets: Offsets of the fragments received, in order
+ * @counts: Octet counts of the fragments received
+ * @num_frags: Number of fragments received
+ * @seen_last_frag: The final fragment has been received
+ * @complete: A blocking query has completed
+ * @rc: Result of a blocking query
+ * @resp_size: Size of the reassembled response
+ * @buffer: Reassembled response
+ */
+struct mode6_request {
+	bool in_use;
+	uint16_t sequence;
+	int opcode;
+	associd_t associd;
+	enum mode6_purpose purpose;
+	int peer_idx;
+	struct sfptpd_timespec deadline;
+	u_short offsets[MAXFRAGS+1];
+	u_short counts[MAXFRAGS+1];
+	size_t num_frags;
+	bool seen_last_frag;
+	bool complete;
+	int rc;
+	size_t resp_size;
+	unsigned char buffer[NTPCLIENT_BUFFER_SIZE];
+};
+
+/* Variables of an association as last read from the NTP daemon
+ * @associd: Association ID
+ * @status: Association status word when the variables were read
+ * @valid: The variables have been read successfully
+ * @age: Number of refreshes since the variables were read
+ * @peer: Peer info from the variables
+ */
+struct mode6_assoc {
+	associd_t associd;
+	uint16_t status;
+	bool valid;
+	unsigned int age;
+	struct sfptpd_ntpclient_peer peer;
+};
+
+/* Poll of the NTP daemon in progress
+ * @active: A poll has been started and its result not yet collected
+ * @complete: All of the requests for the poll have completed
+ * @refresh: The poll refreshes the peer info
+ * @rc: Result of the poll
+ * @outstanding: Number of requests for the poll in flight
+ * @sys_info: Where to write the system info or NULL
+ * @peer_info: Where to write the peer info or NULL
+ */
+struct mode6_poll {
+	bool active;
+	bool complete;
+	bool refresh;
+	int rc;
+	unsigned int outstanding;
+	struct sfptpd_ntpclient_sys_info *sys_info;
+	struct sfptpd_ntpclient_peer_info *peer_info;
+};
+
 /* NTP client state
  * @sock: Socket for communications with NTP daemon
  * @timeout: Timeout for communication with NTP daemon
@@ -425,8 +504,15 @@ STATIC_ASSERT(sizeof(struct association) == 4);
  * size in use.
  * @request_pkt_size: Request packet size in use. Used to try to be compatible
  * with older implementations of NTPD
- * @buffer: Buffer for responses from the NTP daemon
- * @assoc_cache: Cache for association list received from the NTP daemon
+ * @sequence: Sequence number of the last request sent
+ * @buffer: Response to the last blocking query
+ * @requests: Requests in flight
+ * @poll: Poll in progress
+ * @assocs: Associations found by the last refresh of the peer info
+ * @num_assocs: Number of associations found by the last refresh
+ * @refresh_peer_address: Selected peer address at the last refresh
+ * @refresh_peer_address_len: Length of the selected peer address
+ * @sys_only_next: The next poll need only read the system variables
  * @features: Array of feature flags, describes which abilities this protocol
  * does and doesn't have
  */
@@ -437,8 +523,15 @@ struct sfptpd_ntpclient_state {
 	char key_value[SFPTPD_NTP_KEY_MAX];
 	unsigned int legacy_mode;
 	unsigned int request_pkt_size;
+	uint16_t sequence;
 	unsigned char buffer[NTPCLIENT_BUFFER_SIZE];
-	struct association assoc_cache[NTPCLIENT_BUFFER_SIZE];
+	struct mode6_request requests[MODE6_REQUESTS_MAX];
+	struct mode6_poll poll;
+	struct mode6_assoc assocs[SFPTPD_NTP_PEERS_MAX];
+	int num_assocs;
+	struct sockaddr_storage refresh_peer_address;
+	socklen_t refresh_peer_address_len;
+	bool sys_only_next;
 	struct sfptpd_ntpclient_feature_flags features;
 };
 
@@ -446,6 +539,9 @@ struct sfptpd_ntpclient_state {
  * Local Functions
  ****************************************************************************/
 
+static void mode6_request_done(struct sfptpd_ntpclient_state *ntpclient,
+			       struct mode6_request *req, int rc);
+
 static int mode6_send(struct sfptpd_ntpclient_state *ntpclient,
 		      void *buf, size_t length)
 {
@@ -463,10 +559,10 @@ static int mode6_send(struct sfptpd_ntpclient_state *ntpclient,
 }
 
 static int mode6_request(struct sfptpd_ntpclient_state *ntpclient,
-			 int request_code,
+			 int request_code, uint16_t seq,
 			 associd_t associd, bool authenticate,
 			 unsigned int num_items, size_t item_size,
-			 void *data)
+			 const void *data)
 {
 	/* - num_items - will always be zero or one. we either just send
 	 * the request_code/opcode, or we send the code and ONE packet
@@ -492,7 +588,7 @@ static int mode6_request(struct sfptpd_ntpclient_state *ntpclient,
 	memset(&pkt, 0, sizeof(pkt));
 	pkt.li_vn_mode = PKT_LI_VN_MODE(0, NTP_VERSION, MODE_CONTROL);
 	pkt.r_e_m_op = (uint8_t)(request_code & CTL_OP_MASK);
-	pkt.sequence = htons(sequence); /* sequence number to id this query */
+	pkt.sequence = htons(seq);	/* sequence number to id this query */
 	pkt.status = htons(0);	       	/* only set in response */
 	pkt.associd = htons(associd); 	/* requests are always to ntpd, id = 0 */
 	pkt.offset = htons(0);		/* requests are single messages */
@@ -544,8 +640,7 @@ static int mode6_request(struct sfptpd_ntpclient_state *ntpclient,
 
 
 static int mode6_validate_response_packet(struct ntp_mode6_packet *pkt,
-					  unsigned int len,
-					  int expected_request_code)
+					  unsigned int len)
 {
 	assert(pkt != NULL);
 
@@ -572,52 +667,49 @@ static int mode6_validate_response_packet(struct ntp_mode6_packet *pkt,
 		return EAGAIN;
 	}
 
-	/* Check opcode and sequence number for match incase this is old data
-	   and not a response to our request */
+	return 0;
+}
 
-	if (ntohs(pkt->sequence) != sequence) {
-		DBG_L3("ntpclient: mode6: received sequence number %d, wanted %d\n",
-		       pkt-sequence, sequence);
-		return EAGAIN;
-	}
 
-	if (CTL_OP(pkt->r_e_m_op) != expected_request_code) {
-		DBG_L3("ntpclient: mode6: received opcode %d, wanted %d (sequence number"
-		       " correct)\n", CTL_OP(pkt->r_e_m_op),
-		       expected_request_code);
-		return EAGAIN;
+static struct mode6_request *mode6_find_request(struct sfptpd_ntpclient_state *ntpclient,
+						struct ntp_mode6_packet *pkt)
+{
+	struct mode6_request *req;
+	uint16_t seq = ntohs(pkt->sequence);
+	int i;
+
+	/* Check opcode and sequence number for match in case this is old data
+	   and not a response to one of our requests */
+	for (i = 0; i < MODE6_REQUESTS_MAX; i++) {
+		req = &ntpclient->requests[i];
+		if (!req->in_use || req->complete || req->sequence != seq)
+			continue;
+
+		if (CTL_OP(pkt->r_e_m_op) != req->opcode) {
+			DBG_L3("ntpclient: mode6: received opcode %d, wanted %d (sequence number"
+			       " correct)\n", CTL_OP(pkt->r_e_m_op), req->opcode);
+			return NULL;
+		}
+		return req;
 	}
 
-	return 0;
+	DBG_L3("ntpclient: mode6: received unexpected sequence number %d\n", seq);
+	return NULL;
 }
 
 
-static int mode6_response(struct sfptpd_ntpclient_state *ntpclient,
-			  int request_code,
-			  associd_t associd,
-			  unsigned int *resp_status,
-			  size_t *resp_item_size,
-			  void **resp_data)
+/* Collect a fragment of the response to a request. Returns 0 when the
+ * response is complete, EAGAIN if more fragments are needed or an errno if
+ * the request has failed. */
+static int mode6_reassemble(struct sfptpd_ntpclient_state *ntpclient,
+			    struct mode6_request *req,
+			    struct ntp_mode6_packet *pkt, int len)
 {
-	struct ntp_mode6_packet pkt;
-	fd_set fds;
-	int rc, len;
-	struct sfptpd_timespec end_time, time_now, timeout;
-	u_short offsets[MAXFRAGS+1];
-	u_short counts[MAXFRAGS+1];
 	uint16_t offset;
 	uint16_t count;
 	int err_code;
 	int should_be_size;
-	int seen_last_frag;
-	size_t num_frags;
 	size_t frag_idx;
-	unsigned char *read_ptr;
-
-	assert(ntpclient != NULL);
-	assert(resp_status != NULL);
-	assert(resp_item_size != NULL);
-	assert(resp_data != NULL);
 
 	/* The algorithm is fairly complicated because the response may be
 	 * split into a series of packets with an increasing offset.
@@ -625,245 +717,318 @@ static int mode6_response(struct sfptpd_ntpclient_state *ntpclient,
 	 * with a specific offset. In addition, we don't know how many packets
 	 * there will be in the sequence until we get the packet with the end
 	 * marker, and the packets may not arrive in order. */
-		
-	/* Set response variables initial values */
-	*resp_item_size = 0;
-	if (resp_status)
-		*resp_status = 0;
-
-	/* Set response fragment variables initial values */
-	num_frags = 0;
-	seen_last_frag = 0;
-
-	/* Set time end to now + timeout duration */
-	(void)sfclock_gettime(CLOCK_MONOTONIC, &end_time);
-	sfptpd_time_add(&end_time, &end_time, &ntpclient->timeout);
-
-	/* Prepare file descriptor set */
-	FD_ZERO(&fds);
-	FD_SET(ntpclient->sock, &fds);
-
-	/* Loop until we have an error or a complete response.  Nearly all
-	 * code paths to loop again use continue. */
-	while (1) {
-		struct timespec boring_timeout;
-
-		/* Work out how much time we have left. If we've run out of
-		 * time, return now. */
-		(void)sfclock_gettime(CLOCK_MONOTONIC, &time_now);
-		sfptpd_time_subtract(&timeout, &end_time, &time_now);
-		sfptpd_time_to_std_floor(&boring_timeout, &timeout);
-		if (timeout.sec < 0)
-			return ETIMEDOUT;
 
-		/* Wait on the sockets for the specified period of time */
-		rc = pselect(ntpclient->sock+1, &fds, NULL, NULL, &boring_timeout, NULL);
-		if (rc < 0) {
-			ERROR("ntpclient: mode6: error waiting on socket, %s\n",
-			      strerror(errno));
-			return errno;
+	/* Check the error code returned in the response. If not
+	 * success then return an error */
+	if (CTL_ISERROR(pkt->r_e_m_op)) {
+		err_code = (ntohs(pkt->status) >> 8) & 0xff;
+		if (CTL_ISMORE(pkt->r_e_m_op))
+			DBG_L3("ntpclient: mode6: error code %d received on"
+			       " non-final packet\n", pkt->r_e_m_op);
+		return err_code < CERR_MAX ? ntp_cerr2errno[err_code] : EIO;
+	}
+
+	/* Check the association ID to make sure it matches what we
+	 * sent */
+	if (ntohs(pkt->associd) != req->associd) {
+		DBG_L3("ntpclient: mode6: Association ID %d doesn't match "
+		       "expected %d\n", ntohs(pkt->associd), req->associd);
+	}
+
+	/* Collect offset and count. Make sure they make sense. */
+	offset = ntohs(pkt->offset);
+	count = ntohs(pkt->count);
+
+	/* Validate received payload size is padded to next 32-bit
+	 * boundary and no smaller than claimed by pkt.count */
+	if (len & 0x3) {
+		DBG_L3("ntpclient: mode6: Response packet not padded, "
+		       "size = %d\n", len);
+		return EAGAIN;
+	}
+
+	should_be_size = (CTL_HEADER_LEN + count + 3) & ~3;
+
+	if (len < should_be_size) {
+		DBG_L3("ntpclient: mode6: Response packet claims %u octets payload,"
+		       "above %ld received\n", count,
+		       (long)len - CTL_HEADER_LEN);
+		return EPROTO;
+	}
+
+	/* Packet fragment checks */
+	/* fragment larger than stated in packet header */
+	if (count > (len - CTL_HEADER_LEN)) {
+		DBG_L3("ntpclient: mode6: Received count of %u octets, data in packet is"
+		       " %ld\n", count, (long)len - CTL_HEADER_LEN);
+		return EAGAIN;
+	}
+	/* count is zero but there are more packets to come */
+	if (count == 0 && CTL_ISMORE(pkt->r_e_m_op)) {
+		DBG_L3("ntpclient: mode6: Received count of 0 in non-final fragment\n");
+		return EAGAIN;
+	}
+	/* check packet fragment fits in buffer */
+	if (offset + count > sizeof(req->buffer)) {
+		WARNING("ntpclient: mode6: response larger than buffer %zd\n",
+			sizeof(req->buffer));
+		return ENOSPC;
+	}
+	/* check if we've received duplicate 'last' fragments */
+	if (req->seen_last_frag && !CTL_ISMORE(pkt->r_e_m_op)) {
+		DBG_L3("ntpclient: mode6: Received second last fragment packet\n");
+		return EAGAIN;
+	}
+
+	/* Checks so far indicate packet is good */
+	
+	/* Record fragment, making sure it doesn't overlap anything */
+	if (req->num_frags > (MAXFRAGS - 1)) {
+		DBG_L3("ntpclient: mode6: Number of fragments exceeds maximum"
+		       " %d\n", (MAXFRAGS - 1));
+		return EFBIG;
+	}
+	
+	/* Find position of this fragment relative to others received
+	 * by comparing packet offsets */
+	for (frag_idx = 0;
+	     (frag_idx < req->num_frags) && (req->offsets[frag_idx] < offset);
+	     frag_idx++) {
+		/* empty body */ ;
+	}
+	/* Fragment validation checks... */
+	if (frag_idx < req->num_frags && offset == req->offsets[frag_idx]) {
+		DBG_L3("ntpclient: mode6: duplicate %u octets at %u ignored, prior %u"
+		        " at %u\n", count, offset, req->counts[frag_idx],
+		        req->offsets[frag_idx]);
+		return EAGAIN;
+	}
+	if (frag_idx > 0 &&
+	    (req->offsets[frag_idx-1] + req->counts[frag_idx-1]) > offset) {
+		DBG_L3("ntpclient: mode6: received frag at %u overlaps with %u octet"
+		        " frag at %u\n", offset, req->counts[frag_idx-1],
+		        req->offsets[frag_idx-1]);
+		return EAGAIN;
+	}
+	if (frag_idx < req->num_frags && (offset + count) > req->offsets[frag_idx]) {
+		DBG_L3("ntpclient: mode6: received %u octet frag at %u overlaps with"
+		        " frag at %u\n", count, offset, req->offsets[frag_idx]);
+		return EAGAIN;
+	}
+	/* Move all later fragments +1 index to make room for new fragment */
+	for (int i = req->num_frags; i > frag_idx; i--) {
+		req->offsets[i] = req->offsets[i-1];
+		req->counts[i] = req->counts[i-1];
+	}
+	/* Insert the values of this frament into the fragment array */
+	req->offsets[frag_idx] = offset;
+	req->counts[frag_idx] = count;
+	req->num_frags++;
+
+	/* For last fragment */
+	if (!CTL_ISMORE(pkt->r_e_m_op)) {
+		req->seen_last_frag = true;
+	}
+
+	/* Copy data into data buffer using packet fragment octet count
+	 * and packet fragment offset of total message */
+	memcpy(req->buffer + offset, pkt->u.data, count);
+
+	/* Reset timer for next packet */
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &req->deadline);
+	sfptpd_time_add(&req->deadline, &req->deadline, &ntpclient->timeout);
+
+	/* If last fragment was seen, look for missing fragments in
+	 * sequence. If none exist, end. */
+	if (req->seen_last_frag && req->offsets[0] == 0) {
+		for (frag_idx = 1; frag_idx < req->num_frags; frag_idx++)
+			if (req->offsets[frag_idx-1] + req->counts[frag_idx-1] !=
+			    req->offsets[frag_idx])
+				break;
+		if (frag_idx == req->num_frags) {
+			req->resp_size = req->offsets[frag_idx-1] + req->counts[frag_idx-1];
+			return 0;
 		}
+	}
+
+	return EAGAIN;
+}
+
+
+/* Send a request, recording it as in flight */
+static int mode6_send_request(struct sfptpd_ntpclient_state *ntpclient,
+			      enum mode6_purpose purpose,
+			      int request_code,
+			      associd_t associd,
+			      bool authenticate,
+			      unsigned int req_num_items,
+			      size_t req_item_size,
+			      const void *req_data,
+			      struct mode6_request **request)
+{
+	struct mode6_request *req = NULL;
+	int rc, i;
+
+	for (i = 0; i < MODE6_REQUESTS_MAX; i++) {
+		if (!ntpclient->requests[i].in_use) {
+			req = &ntpclient->requests[i];
+			break;
+		}
+	}
+	if (req == NULL) {
+		WARNING("ntpclient: mode6: too many requests in flight\n");
+		return ENOBUFS;
+	}
+
+	/* Each request has its own sequence number so that the responses
+	 * to concurrent requests and stale responses can be told apart */
+	memset(req, 0, offsetof(struct mode6_request, buffer));
+	req->sequence = ++ntpclient->sequence;
+	req->opcode = request_code;
+	req->associd = associd;
+	req->purpose = purpose;
+
+	rc = mode6_request(ntpclient, request_code, req->sequence, associd,
+			   authenticate, req_num_items, req_item_size, req_data);
+	if (rc != 0)
+		return rc;
+
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &req->deadline);
+	sfptpd_time_add(&req->deadline, &req->deadline, &ntpclient->timeout);
+	req->in_use = true;
+	if (purpose != MODE6_PURPOSE_QUERY)
+		ntpclient->poll.outstanding++;
+
+	if (request != NULL)
+		*request = req;
+	return 0;
+}
+
 
-		/* Return immediately if we timed out */
-		if (rc == 0)
-			return ETIMEDOUT;
+/* Process all of the responses waiting on the socket */
+static void mode6_receive(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct ntp_mode6_packet pkt;
+	struct mode6_request *req;
+	int rc, len, i;
 
-		/* Copy data on socket into pkt struture */
-		len = recv(ntpclient->sock, &pkt, sizeof(pkt), 0);
+	while (true) {
+		len = recv(ntpclient->sock, &pkt, sizeof(pkt), MSG_DONTWAIT);
 		if (len < 0) {
-			if (errno != ECONNREFUSED) {
+			rc = errno;
+			if (rc == EAGAIN || rc == EWOULDBLOCK || rc == EINTR)
+				return;
+
+			if (rc != ECONNREFUSED) {
 				DBG_L3("ntpclient: mode6: error reading from socket,"
-				       " %s\n", strerror(errno));
+				       " %s\n", strerror(rc));
 			}
-			return errno;
+
+			/* Errors on the socket apply to every request */
+			for (i = 0; i < MODE6_REQUESTS_MAX; i++) {
+				req = &ntpclient->requests[i];
+				if (req->in_use && !req->complete)
+					mode6_request_done(ntpclient, req, rc);
+			}
+			return;
 		}
 
 		/* Perform various checks for possible problems. If any of the
 		 * checks fail, stop processing the packet and wait for the
 		 * next one. */
-		if (mode6_validate_response_packet(&pkt, len, request_code) != 0)
+		if (mode6_validate_response_packet(&pkt, len) != 0)
 			continue;
 
-		/* Passed the first checks. At this point we know that the
-		 * packet structure is good and is part of the response to our
-		 * request. */
-
-		/* Check the error code returned in the response. If not
-		 * success then return an error */
-		if (CTL_ISERROR(pkt.r_e_m_op)) {
-			err_code = (ntohs(pkt.status) >> 8) & 0xff;
-			if (CTL_ISMORE(pkt.r_e_m_op))
-				DBG_L3("ntpclient: mode6: error code %d received on"
-				       " non-final packet\n", pkt.r_e_m_op);
-			return ntp_cerr2errno[err_code];	
-		}
-
-		/* Check the association ID to make sure it matches what we
-		 * sent */
-		if (ntohs(pkt.associd) != associd) {
-			DBG_L3("ntpclient: mode6: Association ID %d doesn't match "
-			       "expected %d\n", ntohs(pkt.associd), associd);
-		}
-
-		/* Collect offset and count. Make sure they make sense. */
-		offset = ntohs(pkt.offset);
-		count = ntohs(pkt.count);
-
-		/* Validate received payload size is padded to next 32-bit
-		 * boundary and no smaller than claimed by pkt.count */
-		if (len & 0x3) {
-			DBG_L3("ntpclient: mode6: Response packet not padded, "
-			       "size = %d\n", len);
+		req = mode6_find_request(ntpclient, &pkt);
+		if (req == NULL)
 			continue;
-		}
 
-		should_be_size = (CTL_HEADER_LEN + count + 3) & ~3;
+		rc = mode6_reassemble(ntpclient, req, &pkt, len);
+		if (rc != EAGAIN)
+			mode6_request_done(ntpclient, req, rc);
+	}
+}
 
-		if (len < should_be_size) {
-			printf("ntpclient: mode6: Response packet claims %u octets payload,"
-			       "above %ld received\n", count,
-			       (long)len - CTL_HEADER_LEN);
-			return EPROTO;
-		}
 
-		/* Packet fragment checks */
-		/* fragment larger than stated in packet header */
-		if (count > (len - CTL_HEADER_LEN)) {
-			DBG_L3("ntpclient: mode6: Received count of %u octets, data in packet is"
-			       " %ld\n", count, (long)len - CTL_HEADER_LEN);
-			continue;
-		}
-		/* count is zero but there are more packets to come */
-		if (count == 0 && CTL_ISMORE(pkt.r_e_m_op)) {
-			DBG_L3("ntpclient: mode6: Received count of 0 in non-final fragment\n");
-			continue;
-		}
-		/* check packet fragment fits in buffer */
-		if (offset + count > sizeof(ntpclient->buffer)) {
-			DBG_L3("ntpclient: mode6: Offset %u, count %u, too big for buffer\n",
-			        offset, count);
-			return ENOSPC;
-		}
-		/* check if we've received duplicate 'last' fragments */
-		if (seen_last_frag && !CTL_ISMORE(pkt.r_e_m_op)) {
-			DBG_L3("ntpclient: mode6: Received second last fragment packet\n");
-			continue;
-		}
+/* Fail requests whose responses have not arrived in time */
+static void mode6_expire(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct sfptpd_timespec time_now;
+	struct mode6_request *req;
+	int i;
 
-		/* Checks so far indicate packet is good */
-		
-		/* Record fragment, making sure it doesn't overlap anything */
-		if (num_frags > (MAXFRAGS - 1)) {
-			DBG_L3("ntpclient: mode6: Number of fragments exceeds maximum"
-			       " %d\n", (MAXFRAGS - 1));
-			return EFBIG;
-		}
-		
-		/* Find position of this fragment relative to others received
-		 * by comparing packet offsets */
-		/* Find position of this frament in fragment array */
-		for (frag_idx = 0;
-		     (frag_idx < num_frags) && (offsets[frag_idx] < offset);
-		     frag_idx++) {
-			/* empty body */ ;
-		}
-		/* Fragment validation checks... */
-		if (frag_idx < num_frags && offset == offsets[frag_idx]) {
-			DBG_L3("ntpclient: mode6: duplicate %u octets at %u ignored, prior %u"
-			        " at %u\n", count, offset, counts[frag_idx],
-			        offsets[frag_idx]);
-			continue;
-		}
-		if (frag_idx > 0 && (offsets[frag_idx-1] + counts[frag_idx-1]) > offset) {
-			DBG_L3("ntpclient: mode6: received frag at %u overlaps with %u octet"
-			        " frag at %u\n", offset, counts[frag_idx-1],
-			        offsets[frag_idx-1]);
-			continue;
-		}
-		if (frag_idx < num_frags && (offset + count) > offsets[frag_idx]) {
-			DBG_L3("ntpclient: mode6: received %u octet frag at %u overlaps with"
-			        " frag at %u\n", count, offset, offsets[frag_idx]);
-			continue;
-		}
-		/* Move all later fragments +1 index to make room for new fragment */
-		for (int i = num_frags; i > frag_idx; i--) {
-			offsets[i] = offsets[i-1];
-			counts[i] = counts[i-1];
-		}
-		/* Insert the values of this frament into the fragment array */
-		offsets[frag_idx] = offset;
-		counts[frag_idx] = count;
-		num_frags++;
-
-		/* For last fragment */
-		if (!CTL_ISMORE(pkt.r_e_m_op)) {
-			seen_last_frag = 1;
-		}
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &time_now);
 
-		/* Check that there is enough space in the output buffer for
-		 * this chunk of data */
-		if (offset + count > sizeof(ntpclient->buffer)) {
-			WARNING("ntpclient: mode6: response larger than buffer %zd\n",
-				sizeof(ntpclient->buffer));
-			return ENOSPC;
-		}
-    
-		/* Copy data into data buffer using packet fragment octet count
-		 * and packet fragment offset of total message */
-		read_ptr = pkt.u.data;
-		memcpy(ntpclient->buffer + offset, read_ptr, count);
-    
-		/* Reset timer for next packet */
-		(void)sfclock_gettime(CLOCK_MONOTONIC, &end_time);
-		sfptpd_time_add(&end_time, &end_time, &ntpclient->timeout);
-
-		/* If last fragment was seen, look for missing fragments in
-		 * sequence. If none exist, end. */
-		if (seen_last_frag && offsets[0] == 0) {
-			for (frag_idx = 1; frag_idx < num_frags; frag_idx++)
-				if (offsets[frag_idx-1] + counts[frag_idx-1] !=
-				    offsets[frag_idx])
-					break;
-			if (frag_idx == num_frags) {
-				*resp_item_size = offsets[frag_idx-1] + counts[frag_idx-1];
-				*resp_data = (void *)&(ntpclient->buffer);
-				return 0;
-			}
-		}
+	for (i = 0; i < MODE6_REQUESTS_MAX; i++) {
+		req = &ntpclient->requests[i];
+		if (req->in_use && !req->complete &&
+		    sfptpd_time_cmp(&time_now, &req->deadline) > 0)
+			mode6_request_done(ntpclient, req, ETIMEDOUT);
 	}
 }
 
+
 static int mode6_query(struct sfptpd_ntpclient_state *ntpclient,
 		       int request_code,
 		       associd_t associd,
 		       bool authenticate,
 		       unsigned int req_num_items,
 		       size_t req_item_size,
-		       void *req_data,
-		       unsigned int *resp_status,
+		       const void *req_data,
 		       size_t *resp_size,
 		       void **resp_data)
 {
+	struct mode6_request *req;
+	struct sfptpd_timespec time_now, timeout;
+	struct timespec boring_timeout;
+	fd_set fds;
 	int rc;
-	char junk[512];
 
 	assert(ntpclient != NULL);
 	assert((req_data != NULL) || ((req_num_items == 0) && (req_item_size == 0)));
-
-	/* Before starting the query, make sure the socket is empty */
-	while (recv(ntpclient->sock, junk, sizeof(junk), MSG_DONTWAIT) > 0);
-
-	sequence++;
+	assert(resp_size != NULL);
+	assert(resp_data != NULL);
 
 	/* Send the request */
-	rc = mode6_request(ntpclient, request_code, associd, authenticate,
-			   req_num_items, req_item_size, req_data);
+	rc = mode6_send_request(ntpclient, MODE6_PURPOSE_QUERY, request_code,
+				associd, authenticate, req_num_items,
+				req_item_size, req_data, &req);
 	if (rc != 0)
 		return rc;
 
-	/* Wait for the response */
-	rc = mode6_response(ntpclient, request_code, associd, resp_status,
-			    resp_size, resp_data);
+	/* Wait for the response. Responses to the requests of a poll in
+	 * progress are processed as they arrive. */
+	while (!req->complete) {
+		(void)sfclock_gettime(CLOCK_MONOTONIC, &time_now);
+		sfptpd_time_subtract(&timeout, &req->deadline, &time_now);
+		if (timeout.sec < 0) {
+			req->rc = ETIMEDOUT;
+			break;
+		}
+		sfptpd_time_to_std_floor(&boring_timeout, &timeout);
+
+		FD_ZERO(&fds);
+		FD_SET(ntpclient->sock, &fds);
+		rc = pselect(ntpclient->sock+1, &fds, NULL, NULL, &boring_timeout, NULL);
+		if (rc < 0 && errno != EINTR) {
+			ERROR("ntpclient: mode6: error waiting on socket, %s\n",
+			      strerror(errno));
+			req->rc = errno;
+			break;
+		}
+
+		mode6_receive(ntpclient);
+		mode6_expire(ntpclient);
+	}
+
+	rc = req->rc;
+	*resp_size = 0;
+	if (rc == 0) {
+		memcpy(ntpclient->buffer, req->buffer, req->resp_size);
+		*resp_size = req->resp_size;
+		*resp_data = ntpclient->buffer;
+	}
+	req->in_use = false;
 
 	/* Note: Unlike mode 7, this function doesn't accommodate old ntpd
 	 * versions which use legacy packet length limits. This shouldn't be an
@@ -871,7 +1036,6 @@ static int mode6_query(struct sfptpd_ntpclient_state *ntpclient,
 	 * mode 7 is disabled by default */
 	
 	return rc;
-	
 }
 
 /****************************************************************************
@@ -1136,6 +1300,356 @@ static long double parse_float_string(char **double_string)
 	return converted_double;
 }
 
+/* Interpret the response to a request for the system variables */
+static int mode6_parse_sys_info(struct mode6_request *req, int rc,
+				struct sfptpd_ntpclient_sys_info *sys_info)
+{
+	int gai_rc;
+	const char *resp_data;
+	size_t resp_size;
+	char *name;
+	char *value;
+	char host[NI_MAXHOST];
+
+	assert(req != NULL);
+	assert(sys_info != NULL);
+
+	/* Note: sys_info->clock_control_enabled is not modified as we have no
+	 * way of collecting this information from the daemon in mode 6. Instead,
+	 * we assume the state will not changed unless we change it. The NTP
+	 * sync module is responsible for changing this value when a clock
+	 * control command is sent successfully to the daemon */
+
+	/* Populate sys_info object */
+	if (rc == 0) {
+		resp_data = (const char *) req->buffer;
+		resp_size = req->resp_size;
+
+		/* get peer address */
+		rc = ENOENT;
+		while (next_var(&resp_size, &resp_data, &name, &value)) {
+			if (strcmp("peeradr", name) == 0) {
+				rc = parse_addr_string(&sys_info->peer_address,
+						       &sys_info->peer_address_len,
+						       value, MAXVALLEN);
+				break;
+			}
+		}
+
+		/* Turn the address back into a string for presentation. We could
+		 * use the string from the protocol but this will be a canonically-
+		 * formatted representation. */
+		if (rc == 0) {
+			gai_rc = getnameinfo((struct sockaddr *) &sys_info->peer_address,
+					     sys_info->peer_address_len,
+					     host, sizeof host,
+					     NULL, 0, NI_NUMERICHOST);
+			if (gai_rc != 0) {
+				DBG_L4("ntpclient: mode6: getnameinfo: %s\n",
+				       gai_strerror(gai_rc));
+			} else {
+				DBG_L6("ntp-sys-info: selected-peer-address %s\n", host);
+			}
+		}
+	}
+
+	/* Overall error handling */
+	if (rc == ENOENT) {
+		/* In cases where mode 7 is not available and the 'peeradr' variable
+		 * does not exist, we output a WARNING. */
+		WARNING("ntpclient: mode6: mode 6 is being used but there is no support for "
+			"the peeradr variable. %s\n",
+			 strerror(rc));
+	} else if (rc != 0 && rc != ECONNREFUSED) {
+		/* this may be because peeradr is not implemented in this
+		 * instance of ntpd, as I found with rhel 7.1 */
+		DBG_L3("ntpclient: mode6: failed to get system info from NTP daemon, %s\n",
+			strerror(abs(rc)));
+		rc = ENOENT;
+	}
+
+	return rc;
+}
+
+/* Copy the peer info from the associations found by the last refresh */
+static void mode6_fill_peer_info(struct sfptpd_ntpclient_state *ntpclient,
+				 struct sfptpd_ntpclient_peer_info *peer_info)
+{
+	int i;
+
+	for (i = 0; i < ntpclient->num_assocs; i++)
+		peer_info->peers[i] = ntpclient->assocs[i].peer;
+	peer_info->num_peers = ntpclient->num_assocs;
+}
+
+/* Interpret the list of associations and send requests for the variables
+ * of each peer whose status word has changed since they were last read,
+ * all of which are then in flight together. The system peer's variables
+ * are always read as its offset is reported on every refresh. */
+static void mode6_parse_assocs(struct sfptpd_ntpclient_state *ntpclient,
+			       struct mode6_request *req, int rc)
+{
+	char req_data[CTL_MAX_DATA_LEN];
+	size_t req_datalen = CTL_MAX_DATA_LEN;
+	struct sfptpd_ntpclient_peer_info *peer_info = ntpclient->poll.peer_info;
+	struct mode6_assoc old_assocs[SFPTPD_NTP_PEERS_MAX];
+	int num_old_assocs;
+	struct association *assoc_ptr;
+	struct mode6_request *peer_req;
+	struct mode6_assoc *assoc;
+	uint16_t status;
+	u_char statval;
+	int num_associations;
+	int num_reused;
+	int i, j;
+
+	assert(peer_info != NULL);
+
+	/* If the list can't be retrieved the peer info is left as it was
+	 * and the next poll refreshes it again */
+	if (rc != 0) {
+		ntpclient->sys_only_next = false;
+		return;
+	}
+
+	if (req->resp_size & 0x3) {
+		ERROR("ntpclient: mode6: Server returned %zu octets, should be multiple of 4\n",
+		      req->resp_size);
+		ntpclient->sys_only_next = false;
+		return;
+	}
+
+	if (req->resp_size == 0)
+		DBG_L5("ntpclient: mode6: ntpd did not return any peers\n");
+
+	/* Create list of variables to ask for in the request (peervarlist -> data) */
+	make_query_data(peervarlist, &req_datalen, req_data);
+
+	/* Rebuild the list of associations, keeping the variables of those
+	 * that have not changed */
+	num_old_assocs = ntpclient->num_assocs;
+	memcpy(old_assocs, ntpclient->assocs, num_old_assocs * sizeof *old_assocs);
+	ntpclient->num_assocs = 0;
+	peer_info->num_peers = 0;
+	num_reused = 0;
+
+	num_associations = req->resp_size / sizeof(struct association);
+	for (i = 0; i < num_associations; i++)
+	{
+		assoc_ptr = ((struct association *) req->buffer) + i;
+		status = ntohs(assoc_ptr->status);
+		statval = CTL_PEER_STATVAL(status);
+
+		/* Skip this association if status flags show that host is not
+		   reachable or is not a peristent association */
+		if (!(statval & (CTL_PST_CONFIG | CTL_PST_REACH)))
+			continue;
+
+		if (ntpclient->num_assocs == SFPTPD_NTP_PEERS_MAX) {
+			WARNING("ntpclient: mode6: too many peers - limited to %d peers\n",
+				SFPTPD_NTP_PEERS_MAX);
+			break;
+		}
+
+		assoc = &ntpclient->assocs[ntpclient->num_assocs];
+
+		for (j = 0; j < num_old_assocs; j++)
+			if (old_assocs[j].associd == ntohs(assoc_ptr->assid))
+				break;
+
+		if ((j < num_old_assocs) && old_assocs[j].valid &&
+		    (old_assocs[j].status == status) &&
+		    (old_assocs[j].age < MODE6_ASSOC_MAX_AGE) &&
+		    ((statval & 0x7) != CTL_PST_SEL_SYSPEER)) {
+			/* Nothing has happened to the association */
+			*assoc = old_assocs[j];
+			assoc->age++;
+			num_reused++;
+		} else {
+			memset(assoc, 0, sizeof *assoc);
+			assoc->associd = ntohs(assoc_ptr->assid);
+			assoc->status = status;
+
+			/* Parse peer status word */
+			/* * System peer */
+			assoc->peer.selected = ((statval & 0x7) == CTL_PST_SEL_SYSPEER);
+			/* # Backup */
+			assoc->peer.shortlist = ((statval & 0x7) == CTL_PST_SEL_EXCESS);
+
+			/* Send request to collect variables */
+			rc = mode6_send_request(ntpclient, MODE6_PURPOSE_PEER,
+						CTL_OP_READVAR, assoc->associd,
+						false, 1, req_datalen, req_data,
+						&peer_req);
+			if (rc != 0)
+				continue;
+			peer_req->peer_idx = ntpclient->num_assocs;
+		}
+
+		peer_info->peers[ntpclient->num_assocs] = assoc->peer;
+		ntpclient->num_assocs++;
+	}
+
+	peer_info->num_peers = ntpclient->num_assocs;
+
+	DBG_L6("ntpclient: mode6: %d associations, %d unchanged\n",
+	       ntpclient->num_assocs, num_reused);
+}
+
+/* Interpret the variables of a peer */
+static void mode6_parse_peer(struct sfptpd_ntpclient_state *ntpclient,
+			     struct mode6_request *req, int rc)
+{
+	struct sfptpd_ntpclient_peer *peer;
+	const char *resp_var_data;
+	size_t resp_size;
+	char *name;
+	char *value;
+
+	assert(ntpclient->poll.peer_info != NULL);
+	assert(req->peer_idx < ntpclient->num_assocs);
+
+	if (rc != 0) {
+		DBG_L3("ntpclient: mode6: failed to get variables of association %d, %s\n",
+		       req->associd, strerror(rc));
+		return;
+	}
+
+	peer = &ntpclient->assocs[req->peer_idx].peer;
+	resp_var_data = (const char *) req->buffer;
+	resp_size = req->resp_size;
+
+	/* Parse text-based packet payload of requested peer variables */
+	while (next_var(&resp_size, &resp_var_data, &name, &value))
+	{
+		if (strcmp("srcadr", name) == 0)
+			parse_addr_string(&peer->remote_address,
+					  &peer->remote_address_len,
+					  value, MAXVALLEN);
+		else if (strcmp("dstadr", name) == 0)
+			parse_addr_string(&peer->local_address,
+					  &peer->local_address_len,
+					  value, MAXVALLEN);
+		else if (strcmp("stratum", name) == 0)
+			peer->stratum = parse_u32_string(&value);
+		else if (strcmp("hmode", name) == 0)
+			peer->candidate = (parse_u32_string(&value) == MODE_CLIENT);
+		else if (strcmp("offset", name) == 0)
+		{
+			long double offset = parse_float_string(&value);
+			/* Convert from RMS milliseconds to nanoseconds
+			 * and invert the offset */
+			offset *= -1.0e6;
+			peer->offset = offset;
+		}
+		else if (strcmp("rootdisp", name) == 0) {
+			/* Convert from milliseconds to nanoseconds */
+			peer->root_dispersion = parse_float_string(&value) * 1.0e6;
+		} else if (strcmp("sent", name) == 0)
+			peer->pkts_sent = parse_u32_string(&value);
+		else if (strcmp("received", name) == 0)
+			peer->pkts_received = parse_u32_string(&value);
+		else if (strcmp("refid", name) == 0)
+		{
+			/* NTPDC sets refid depending on if the 'peer' is
+			 * a peer or a reference clock.
+			 *   Reference clock: refid = <=4 char identifier
+			 *   Peer: refid = IP address of reference clock
+			 * See NTPD source code:
+			 *   ntp_control.c:ctl_putpeer
+			 */
+			if (strlen(value) <= 4)
+				peer->self = true;
+			peer->self = false;
+		}
+	}
+
+	ntpclient->assocs[req->peer_idx].valid = true;
+	ntpclient->poll.peer_info->peers[req->peer_idx] = *peer;
+}
+
+/* Check the selected peer reported by a poll that reads only the system
+ * variables and refresh the peer info as part of the poll if it has
+ * changed since the last refresh */
+static void mode6_check_sys_peer(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct sfptpd_ntpclient_sys_info *sys_info = ntpclient->poll.sys_info;
+	int rc;
+
+	if ((sys_info->peer_address_len == ntpclient->refresh_peer_address_len) &&
+	    (memcmp(&sys_info->peer_address, &ntpclient->refresh_peer_address,
+		    sys_info->peer_address_len) == 0))
+		return;
+
+	DBG_L5("ntpclient: mode6: selected peer changed, refreshing peer info\n");
+
+	ntpclient->poll.refresh = true;
+	ntpclient->refresh_peer_address = sys_info->peer_address;
+	ntpclient->refresh_peer_address_len = sys_info->peer_address_len;
+	rc = mode6_send_request(ntpclient, MODE6_PURPOSE_ASSOCS,
+				CTL_OP_READSTAT, 0, false,
+				0, 0, NULL, NULL);
+	ntpclient->sys_only_next = (rc == 0);
+}
+
+/* Handle the completion of a request */
+static void mode6_request_done(struct sfptpd_ntpclient_state *ntpclient,
+			       struct mode6_request *req, int rc)
+{
+	struct mode6_poll *poll = &ntpclient->poll;
+
+	assert(req->in_use);
+
+	/* Blocking queries collect their own result */
+	if (req->purpose == MODE6_PURPOSE_QUERY) {
+		req->rc = rc;
+		req->complete = true;
+		return;
+	}
+
+	switch (req->purpose) {
+	case MODE6_PURPOSE_SYS_INFO:
+		/* The result of the poll is that of the system info request.
+		 * Failures to read peers leave the peer info incomplete. */
+		poll->rc = mode6_parse_sys_info(req, rc, poll->sys_info);
+		if (poll->rc != 0) {
+			ntpclient->sys_only_next = false;
+		} else if (poll->refresh) {
+			ntpclient->refresh_peer_address = poll->sys_info->peer_address;
+			ntpclient->refresh_peer_address_len = poll->sys_info->peer_address_len;
+		} else if (poll->peer_info != NULL) {
+			mode6_check_sys_peer(ntpclient);
+		}
+		break;
+	case MODE6_PURPOSE_ASSOCS:
+		mode6_parse_assocs(ntpclient, req, rc);
+		break;
+	case MODE6_PURPOSE_PEER:
+		mode6_parse_peer(ntpclient, req, rc);
+		break;
+	default:
+		assert(false);
+	}
+
+	req->in_use = false;
+	assert(poll->outstanding > 0);
+	if (--poll->outstanding == 0)
+		poll->complete = true;
+}
+
+static int mode6_poll_result(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct mode6_poll *poll = &ntpclient->poll;
+
+	if (!poll->active)
+		return 0;
+	if (!poll->complete)
+		return EINPROGRESS;
+
+	poll->active = false;
+	return poll->rc;
+}
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
@@ -1226,227 +1740,103 @@ static void mode6_destroy(struct sfptpd_ntpclient_state **ntpclient)
 	}
 }
 
-static int mode6_get_sys_info(struct sfptpd_ntpclient_state *ntpclient,
-			      struct sfptpd_ntpclient_sys_info *sys_info)
+static int mode6_get_fd(struct sfptpd_ntpclient_state *ntpclient)
 {
-	int rc;
-	int gai_rc;
-	void *req_data;
-	size_t req_datalen;
-	const char *resp_data;
-	size_t resp_size;
-	unsigned int resp_status;
-	char *name;
-	char *value;
-	char host[NI_MAXHOST];
-
 	assert(ntpclient != NULL);
-	assert(sys_info != NULL);
-
-	/* Note: sys_info->clock_control_enabled is not modified as we have no
-	 * way of collecting this information from the daemon in mode 6. Instead,
-	 * we assume the state will not changed unless we change it. The NTP
-	 * sync module is responsible for changing this value when a clock
-	 * control command is sent successfully to the daemon */
-	
-	/* Create request */
-	/* The 'peeradr' variable was added to ntpd after 4.2.6p5 (mode 7
-	 * enabled by default) and exists in 4.2.8 (mode 7 enabled by default).
-	 * It is assumed that when using mode 6, the 'peeradr' variable will
-	 * exist. */
-        /* Note: It is possible to get the selected peer address by iterating
-	 * through the assoc cache, which would require many more packets to
-	 * be sent and processed, but would be safer if the above assumption
-	 * turned out to be false */
-	req_data = "peeradr";	
-	req_datalen = strlen(req_data);
-	
-	/* Send request to collect system address */
-	rc = mode6_query(ntpclient, CTL_OP_READVAR, 0, false,
-			 1, req_datalen, req_data,
-			 &resp_status, &resp_size, (void **)&resp_data);
+	return ntpclient->sock;
+}
 
-	/* Populate sys_info object */
-	if (rc == 0) {
+static void mode6_poll_cancel(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct mode6_request *req;
+	int i;
 
-		/* get peer address */
-		rc = ENOENT;
-		while (next_var(&resp_size, &resp_data, &name, &value)) {
-			if (strcmp("peeradr", name) == 0) {
-				rc = parse_addr_string(&sys_info->peer_address,
-						       &sys_info->peer_address_len,
-						       value, MAXVALLEN);
-				goto finish;
-			}
-		}
+	assert(ntpclient != NULL);
 
-		/* Turn the address back into a string for presentation. We could
-		 * use the string from the protocol but this will be a canonically-
-		 * formatted representation. */
-		gai_rc = getnameinfo((struct sockaddr *) &sys_info->peer_address,
-				    sys_info->peer_address_len,
-				    host, sizeof host,
-				    NULL, 0, NI_NUMERICHOST);
-		if (gai_rc != 0) {
-			DBG_L4("ntpclient: mode6: getnameinfo: %s\n", gai_strerror(gai_rc));
-			rc = ENOENT;
-		} else {
-			DBG_L6("ntp-sys-info: selected-peer-address %s\n", host);
-		}
+	/* Forget the requests of the poll; late responses will not match */
+	for (i = 0; i < MODE6_REQUESTS_MAX; i++) {
+		req = &ntpclient->requests[i];
+		if (req->in_use && req->purpose != MODE6_PURPOSE_QUERY)
+			req->in_use = false;
 	}
 
-finish:
-	/* Overall error handling */
-	if (rc == ENOENT) {
-		/* In cases where mode 7 is not available and the 'peeradr' variable
-		 * does not exist, we output a WARNING. */
-		WARNING("ntpclient: mode6: mode 6 is being used but there is no support for "
-			"the peeradr variable. %s\n",
-			 strerror(rc));
-	} else if (rc != 0 && rc != ECONNREFUSED) {
-		/* this may be because peeradr is not implemented in this
-		 * instance of ntpd, as I found with rhel 7.1 */
-		DBG_L3("ntpclient: mode6: failed to get system info from NTP daemon, %s\n",
-			strerror(abs(rc)));
-		rc = ENOENT;
-	}
+	memset(&ntpclient->poll, 0, sizeof ntpclient->poll);
 
-	return rc;
+	/* The peer info may not have been refreshed */
+	ntpclient->sys_only_next = false;
 }
 
-static int mode6_get_peer_info(struct sfptpd_ntpclient_state *ntpclient,
-			       struct sfptpd_ntpclient_peer_info *peer_info)
-{	
-	int rc, i;
-	char req_data[CTL_MAX_DATA_LEN];
-	size_t req_datalen = CTL_MAX_DATA_LEN;
-	unsigned int resp_status;
-	size_t resp_size;
-	struct association *resp_stat_data;
-	const char *resp_var_data;
-	struct association *assoc_ptr;
-	struct sfptpd_ntpclient_peer *peer;
-	char *name;
-	char *value;
-	u_char statval;
+static int mode6_poll_start(struct sfptpd_ntpclient_state *ntpclient,
+			    struct sfptpd_ntpclient_sys_info *sys_info,
+			    struct sfptpd_ntpclient_peer_info *peer_info)
+{
+	struct mode6_poll *poll = &ntpclient->poll;
+	const char *req_data;
+	int rc = 0;
 
 	assert(ntpclient != NULL);
-	assert(peer_info != NULL);
-
-	/* First, get a list of associations */
-	
-	rc = mode6_query(ntpclient, CTL_OP_READSTAT, 0, 0,
-			 0, 0, NULL,
-			 &resp_status, &resp_size, (void **)&resp_stat_data);
-	if (rc != 0)
-		return 0;
-
-	if (resp_size == 0) {
-		DBG_L5("ntpclient: mode6: ntpd did not return any peers\n");
-		return 0;
-	}
-
-	if (resp_size & 0x3) {
-		ERROR("ntpclient: mode6: Server returned %zu octets, should be multiple of 4\n",
-		      resp_size);
-		return 0;
+	assert((sys_info != NULL) || (peer_info != NULL));
+
+	if (poll->active)
+		return EBUSY;
+
+	memset(poll, 0, sizeof *poll);
+	poll->active = true;
+	poll->sys_info = sys_info;
+	poll->peer_info = peer_info;
+
+	/* Polls that refresh the peer info alternate with polls that read
+	 * only the system variables and report the peer info from the last
+	 * refresh. Only a refresh that includes the system variables records
+	 * the selected peer against which the following poll is checked. */
+	if (peer_info != NULL) {
+		mode6_fill_peer_info(ntpclient, peer_info);
+		poll->refresh = !ntpclient->sys_only_next || (sys_info == NULL);
+		ntpclient->sys_only_next = poll->refresh && (sys_info != NULL);
 	}
 
-	if (resp_size > NTPCLIENT_BUFFER_SIZE) {
-		ERROR("ntpclient: mode6: Server returned %zu octets, which does not fit in"
-		      "maximum buffer size", resp_size);
-		return ENOMEM;
+	/* The system variables and association list are requested together;
+	 * the variables of each peer are requested as soon as the list
+	 * arrives. */
+	if (sys_info != NULL) {
+		/* The 'peeradr' variable was added to ntpd after 4.2.6p5 (mode 7
+		 * enabled by default) and exists in 4.2.8 (mode 7 enabled by default).
+		 * It is assumed that when using mode 6, the 'peeradr' variable will
+		 * exist. */
+		/* Note: It is possible to get the selected peer address by iterating
+		 * through the assoc cache, which would require many more packets to
+		 * be sent and processed, but would be safer if the above assumption
+		 * turned out to be false */
+		req_data = "peeradr";
+		rc = mode6_send_request(ntpclient, MODE6_PURPOSE_SYS_INFO,
+					CTL_OP_READVAR, 0, false,
+					1, strlen(req_data), req_data, NULL);
 	}
 
-	/* copy associations from general ntpclient buffer to ntpclient assoc cache */
-	memcpy(ntpclient->assoc_cache, ntpclient->buffer, resp_size);
+	if (rc == 0 && poll->refresh)
+		rc = mode6_send_request(ntpclient, MODE6_PURPOSE_ASSOCS,
+					CTL_OP_READSTAT, 0, false,
+					0, 0, NULL, NULL);
 
-	/* we don't know yet whether any of the peers are accessable */
-	peer_info->num_peers = 0;
-	
-	/* Run through the associations and fill peer stat info for each */
-	int num_assocations = resp_size/sizeof(struct association);
-	for (i = 0; i < num_assocations; i++)
-	{
-		/* Set assoc ptr to point to next unread assocation in buffer */
-		assoc_ptr = ntpclient->assoc_cache + i;
-
-		/* Skip this association if status flags show that host is not
-		   reachable or is not a peristent association */
-		if (!(CTL_PEER_STATVAL(ntohs(assoc_ptr->status)) &
-		      (CTL_PST_CONFIG | CTL_PST_REACH)))
-			continue;
-
-		/* Increment peers count */
-		peer_info->num_peers++;
-
-		/* Create list of variables to ask for in the request (peervarlist -> data) */
-		make_query_data(peervarlist, &req_datalen, req_data);
-		
-		/* Send request to collect variables */
-		rc = mode6_query(ntpclient, CTL_OP_READVAR, ntohs(assoc_ptr->assid), false,
-				 1, req_datalen, (void *)req_data,
-				 &resp_status, &resp_size, (void **)&resp_var_data);
+	if (rc != 0)
+		mode6_poll_cancel(ntpclient);
+	return rc;
+}
 
-		/* Set up our peer object to fill with information */
-		peer = &peer_info->peers[i];
+static int mode6_poll_io(struct sfptpd_ntpclient_state *ntpclient)
+{
+	assert(ntpclient != NULL);
 
-		/* Populate peer object */
+	mode6_receive(ntpclient);
+	return mode6_poll_result(ntpclient);
+}
 
-		/* Parse text-based packet payload of requested peer variables */
-		while (next_var(&resp_size, &resp_var_data, &name, &value))
-		{
-			if (strcmp("srcadr", name) == 0)
-				parse_addr_string(&peer->remote_address,
-						  &peer->remote_address_len,
-						  value, MAXVALLEN);
-			else if (strcmp("dstadr", name) == 0)
-				parse_addr_string(&peer->local_address,
-						  &peer->local_address_len,
-						  value, MAXVALLEN);
-			else if (strcmp("stratum", name) == 0)
-				peer->stratum = parse_u32_string(&value);
-			else if (strcmp("hmode", name) == 0)
-				peer->candidate = (parse_u32_string(&value) == MODE_CLIENT);
-			else if (strcmp("offset", name) == 0)
-			{
-				long double offset = parse_float_string(&value);
-				/* Convert from RMS milliseconds to nanoseconds
-				 * and invert the offset */
-				offset *= -1.0e6;
-				peer->offset = offset;
-			}
-			else if (strcmp("rootdisp", name) == 0) {
-				/* Convert from milliseconds to nanoseconds */
-				peer->root_dispersion = parse_float_string(&value) * 1.0e6;
-			} else if (strcmp("sent", name) == 0)
-				peer->pkts_sent = parse_u32_string(&value);
-			else if (strcmp("received", name) == 0)
-				peer->pkts_received = parse_u32_string(&value);
-			else if (strcmp("refid", name) == 0)
-			{
-				/* NTPDC sets refid depending on if the 'peer' is
-				 * a peer or a reference clock.
-				 *   Reference clock: refid = <=4 char identifier
-				 *   Peer: refid = IP address of reference clock
-				 * See NTPD source code:
-				 *   ntp_control.c:ctl_putpeer
-				 */
-				if (strlen(value) <= 4)
-					peer->self = true;
-				peer->self = false;
-			}
-		}
-		/* Parse peer status word */
-		statval = CTL_PEER_STATVAL(ntohs(assoc_ptr->status));
-		/* * System peer */
-		peer->selected = ((statval & 0x7) == CTL_PST_SEL_SYSPEER); 
-		/* # Backup */
-		peer->shortlist = ((statval & 0x7) == CTL_PST_SEL_EXCESS); 
+static int mode6_poll_check(struct sfptpd_ntpclient_state *ntpclient)
+{
+	assert(ntpclient != NULL);
 
-	}
-	
-	return rc;
+	mode6_expire(ntpclient);
+	return mode6_poll_result(ntpclient);
 }
 
 static int mode6_clock_control(struct sfptpd_ntpclient_state *ntpclient,
@@ -1456,7 +1846,6 @@ static int mode6_clock_control(struct sfptpd_ntpclient_state *ntpclient,
 	const char *cfgcmd;
 	const char *resp_data;
 	size_t resp_size;
-	unsigned int resp_status;
 
 	assert(ntpclient != NULL);
 
@@ -1474,8 +1863,8 @@ static int mode6_clock_control(struct sfptpd_ntpclient_state *ntpclient,
 		cfgcmd = "disable ntp kernel";
 			
 	rc = mode6_query(ntpclient, CTL_OP_CONFIGURE, 0, true, /* auth required */
-			 1, strlen(cfgcmd), (void *)cfgcmd,
-			 &resp_status, &resp_size, (void **)&resp_data);
+			 1, strlen(cfgcmd), cfgcmd,
+			 &resp_size, (void **)&resp_data);
 	if (rc != 0) {
 		WARNING("ntpclient: mode6: failed to set NTP daemon system flags, %s\n",
 			strerror(rc));
@@ -1504,13 +1893,6 @@ static int mode6_clock_control(struct sfptpd_ntpclient_state *ntpclient,
 	return rc;
 }
 
-static int mode6_test_connection(struct sfptpd_ntpclient_state *ntpclient)
-{
-	/* currently this function is just a wrapper for get_sys_info */
-	struct sfptpd_ntpclient_sys_info sys_info = {};
-	return mode6_get_sys_info(ntpclient, &sys_info);
-}
-
 static struct sfptpd_ntpclient_feature_flags *
 mode6_get_features(struct sfptpd_ntpclient_state *ntpclient)
 {
@@ -1521,10 +1903,12 @@ mode6_get_features(struct sfptpd_ntpclient_state *ntpclient)
 /* Define protocol function struct */
 const struct sfptpd_ntpclient_fns sfptpd_ntpclient_mode6_fns = {
 	.destroy		= mode6_destroy,
-	.get_sys_info		= mode6_get_sys_info,
-	.get_peer_info		= mode6_get_peer_info,
+	.get_fd			= mode6_get_fd,
+	.poll_start		= mode6_poll_start,
+	.poll_io		= mode6_poll_io,
+	.poll_check		= mode6_poll_check,
+	.poll_cancel		= mode6_poll_cancel,
 	.clock_control		= mode6_clock_control,
-	.test_connection	= mode6_test_connection,
 	.get_features		= mode6_get_features,
 };
 
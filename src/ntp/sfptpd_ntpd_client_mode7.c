@@ -700,6 +700,71 @@ struct ntp_sys_flags {
 	uint32_t flags;
 };
 
+/* Stages of a poll, each of which has one request in flight */
+enum mode7_poll_stage {
+	MODE7_POLL_SYS_INFO,
+	MODE7_POLL_PEER_LIST,
+	MODE7_POLL_PEER_STATS,
+	MODE7_POLL_PEER_INFO,
+};
+
+/* The request in flight to the NTP daemon. Mode 7 responses carry no
+ * identifier of the request so only one request can be in flight at once.
+ * @active: A response is awaited
+ * @for_poll: The request is part of a poll rather than a blocking query
+ * @complete: A blocking query has completed
+ * @rc: Result of a blocking query
+ * @request_code: Request code
+ * @authenticate: The request is authenticated
+ * @num_items: Number of items in the request
+ * @item_size: Size of the request items
+ * @data: Request items, kept for retries with a legacy packet size
+ * @resp_item_size: Size to which response items are padded
+ * @deadline: Time by which the next packet of the response is due
+ * @pkts_received: Number of packets of the response received
+ * @last_seq_num: Sequence number of the final packet of the response
+ * @have_seq: Which packets of the response have been received
+ * @total_items: Number of items received
+ * @write_len: Length of the response collected in the buffer
+ */
+struct mode7_request {
+	bool active;
+	bool for_poll;
+	bool complete;
+	int rc;
+	int request_code;
+	bool authenticate;
+	unsigned int num_items;
+	unsigned int item_size;
+	uint8_t data[sizeof(struct ntp_info_peer_list)];
+	unsigned int resp_item_size;
+	struct sfptpd_timespec deadline;
+	unsigned int pkts_received;
+	unsigned int last_seq_num;
+	bool have_seq[MAXSEQ + 1];
+	unsigned int total_items;
+	size_t write_len;
+};
+
+/* Poll of the NTP daemon in progress
+ * @active: A poll has been started and its result not yet collected
+ * @complete: The poll has completed
+ * @rc: Result of the poll
+ * @stage: Stage of the poll
+ * @peer_idx: Index of the peer being queried
+ * @sys_info: Where to write the system info or NULL
+ * @peer_info: Where to write the peer info or NULL
+ */
+struct mode7_poll {
+	bool active;
+	bool complete;
+	int rc;
+	enum mode7_poll_stage stage;
+	unsigned int peer_idx;
+	struct sfptpd_ntpclient_sys_info *sys_info;
+	struct sfptpd_ntpclient_peer_info *peer_info;
+};
+
 /* NTP client state
  * @sock: Socket for communications with NTP daemon
  * @timeout: Timeout for communication with NTP daemon
@@ -710,6 +775,8 @@ struct ntp_sys_flags {
  * @request_pkt_size: Request packet size in use. Used to try to be compatible
  * with older implementations of NTPD
  * @buffer: Buffer for responses from the NTP daemon
+ * @request: Request in flight
+ * @poll: Poll in progress
  */
 struct sfptpd_ntpclient_state {
 	int sock;
@@ -719,6 +786,8 @@ struct sfptpd_ntpclient_state {
 	unsigned int legacy_mode;
 	unsigned int request_pkt_size;
 	unsigned char buffer[0x1000];
+	struct mode7_request request;
+	struct mode7_poll poll;
 	struct sfptpd_ntpclient_feature_flags features;
 };
 
@@ -989,179 +1058,238 @@ static int mode7_check_response_part1(struct sfptpd_ntpclient_state *ntpclient,
 }
 
 
-static int mode7_response(struct sfptpd_ntpclient_state *ntpclient,
-			  int request_code,
-			  unsigned int *total_items, int required_item_size,
-			  void **response)
+static void mode7_request_done(struct sfptpd_ntpclient_state *ntpclient, int rc);
+
+
+/* Collect a packet of the response to the request in flight. Returns 0
+ * when the response is complete, EAGAIN if more packets are needed or an
+ * errno if the request has failed. */
+static int mode7_reassemble(struct sfptpd_ntpclient_state *ntpclient,
+			    struct ntp_response_pkt *pkt, int len)
 {
-	struct ntp_response_pkt pkt;
-	fd_set fds;
-	int rc, i, len;
+	struct mode7_request *req = &ntpclient->request;
+	int i;
 	unsigned int num_items, item_size, pad_size;
-	unsigned int seq_num, last_seq_num;
+	unsigned int seq_num;
 	unsigned int error_code;
-	struct sfptpd_timespec end_time, time_now, timeout;
-	unsigned int pkts_received;
-	bool have_seq[MAXSEQ + 1];
 	unsigned char *write_ptr, *read_ptr;
 
-	assert(ntpclient != NULL);
-	assert((total_items != NULL) || (required_item_size == 0));
-	assert((response != NULL) || (required_item_size == 0));
-	
-	/* Default return values */
-	if (total_items != NULL)
-		*total_items = 0;
-	if (response != NULL)
-		*response = NULL;
-
-	/* Initialise the receive state */
-	pkts_received = 0;
-	item_size = 0;
-	last_seq_num = INT_MAX;
-	memset(have_seq, 0, sizeof(have_seq));
-	write_ptr = ntpclient->buffer;
-
-	/* Prepare file descriptor set */
-	FD_ZERO(&fds);
-	FD_SET(ntpclient->sock, &fds);
-
-	(void)sfclock_gettime(CLOCK_MONOTONIC, &end_time);
-	sfptpd_time_add(&end_time, &end_time, &ntpclient->timeout);
-
 	/* The algorithm is fairly conplicated because the response may be
 	 * split into a series of packets with an increasing sequence number.
 	 * As each packet is received, we collect it into a contiguous block.
 	 * In addition, we don't know how many packets there will be in the
 	 * sequence until we get the packet with the end marker. */
-	while (pkts_received <= last_seq_num) {
-		struct timespec boring_timeout;
 
-		/* Work out how much time we have left. If we've run out of
-		 * time, return now. */
-		(void)sfclock_gettime(CLOCK_MONOTONIC, &time_now);
-		sfptpd_time_subtract(&timeout, &end_time, &time_now);
-		sfptpd_time_to_std_floor(&boring_timeout, &timeout);
-		if (timeout.sec < 0)
-			return ETIMEDOUT;
+	/* Perform various checks for possible problems. If any of the
+	 * checks fail, stop processing the packet and wait for the
+	 * next one. */
+	if (mode7_check_response_part1(ntpclient, pkt, len, req->request_code) != 0)
+		return EAGAIN;
 
-		/* Wait on the sockets for the specified period of time */
-		rc = pselect(ntpclient->sock+1, &fds, NULL, NULL, &boring_timeout, NULL);
-		if (rc < 0) {
-			ERROR("ntpclient: mode7: error waiting on socket, %s\n",
-			      strerror(errno));
-			return errno;
-		}
+	/* Passed the first checks. At this point we know that the
+	 * packet is good and is part of the response to our request. */
+
+	/* Check the error code returned in the response. If not
+	 * success then return an error */
+	error_code = INFO_ERR(pkt->err_nitems);
+	if (error_code != INFO_OKAY) {
+		if (error_code != INFO_ERR_NODATA)
+			DBG_L3("ntpclient: mode7: ntpd error code %d received on non-final packet, %s\n",
+			       INFO_ERR(pkt->err_nitems),
+			       strerror(mode7_error_to_errno[error_code]));
+		if (error_code < INFO_ERR_MAX)
+			return mode7_error_to_errno[error_code];
+		else
+			return EIO;
+	}
 
-		/* Return immediately if we timed out */
-		if (rc == 0)
-			return ETIMEDOUT;
+	/* More checks now that we know the packet is for us... */
 
-		len = recv(ntpclient->sock, &pkt, sizeof(pkt), 0);
-		if (len < 0) {
-			if (errno != ECONNREFUSED) {
-				DBG_L3("ntpclient: mode7: error reading from socket, %s\n",
-				       strerror(errno));
-			}
-			return errno;
-		}
+	/* Check that the indicated items fit in the packet */
+	num_items = INFO_NITEMS(pkt->err_nitems);
+	item_size = INFO_ITEMSIZE(pkt->mbz_itemsize);
+	if (num_items * item_size > len - RESP_HEADER_SIZE) {
+		DBG_L3("ntpclient: mode7: received items %d, size %d too large for pkt %zd\n",
+		       num_items, item_size, len - RESP_HEADER_SIZE);
+		return EAGAIN;
+	}
 
-		/* Perform various checks for possible problems. If any of the
-		 * checks fail, stop processing the packet and wait for the
-		 * next one. */
-		if (mode7_check_response_part1(ntpclient, &pkt, len, request_code) != 0)
-			continue;
+	/* If this isn't our first packet, make sure the size isn't
+	 * too large */
+	if ((req->pkts_received != 0) && (item_size > req->resp_item_size)) {
+		DBG_L3("ntpclient: mode7: received itemsize %d, previous %d\n",
+		       item_size, req->resp_item_size);
+		return EAGAIN;
+	}
 
-		/* Passed the first checks. At this point we know that the
-		 * packet is good and is part of the response to our request. */
-
-		/* Check the error code returned in the response. If not
-		 * success then return an error */
-		error_code = INFO_ERR(pkt.err_nitems);
-		if (error_code != INFO_OKAY) {
-			if (error_code != INFO_ERR_NODATA)
-				DBG_L3("ntpclient: mode7: ntpd error code %d received on non-final packet, %s\n",
-				       INFO_ERR(pkt.err_nitems),
-				       strerror(mode7_error_to_errno[error_code]));
-			if (error_code < INFO_ERR_MAX)
-				return mode7_error_to_errno[error_code];
-			else
-				return EIO;
-		}
+	/* Get the sequence number and discard the packet if we have
+	 * already seen it */
+	seq_num = INFO_SEQ(pkt->auth_seq);
+	if (req->have_seq[seq_num]) {
+		DBG_L3("ntpclient: mode7: received duplicate seq num %d\n", seq_num);
+		return EAGAIN;
+	}
 
-		/* More checks now that we know the packet is for us... */
+	/* Check if this is the last in the sequence */
+	if (!ISMORE(pkt->rm_vn_mode) && (req->last_seq_num <= MAXSEQ)) {
+		DBG_L3("ntpclient: mode7: received second end sequence packet\n");
+		return EAGAIN;
+	}
 
-		/* Check that the indicated items fit in the packet */
-		num_items = INFO_NITEMS(pkt.err_nitems);
-		item_size = INFO_ITEMSIZE(pkt.mbz_itemsize);
-		if (num_items * item_size > len - RESP_HEADER_SIZE) {
-			DBG_L3("ntpclient: mode7: received items %d, size %d too large for pkt %zd\n",
-			       num_items, item_size, len - RESP_HEADER_SIZE);
-			continue;
-		}
+	if (!ISMORE(pkt->rm_vn_mode))
+		req->last_seq_num = seq_num;
+
+	/* Work out whether we have to pad the data */
+	if (req->resp_item_size > item_size)
+		pad_size = req->resp_item_size - item_size;
+	else
+		pad_size = 0;
+
+	/* Check that ther is enough space in the output buffer for
+	 * this chunk of data */
+	if (req->write_len + (num_items * (item_size + pad_size)) >
+	    sizeof(ntpclient->buffer)) {
+		WARNING("ntpclient: mode7: response larger than buffer %zd\n",
+			sizeof(ntpclient->buffer));
+		return ENOSPC;
+	}
 
-		/* If this isn't our first packet, make sure the size isn't
-		 * too large */
-		if ((pkts_received != 0) && (item_size > required_item_size)) {
-			DBG_L3("ntpclient: mode7: received itemsize %d, previous %d\n",
-			       item_size, required_item_size);
-			continue;
-		}
+	/* Copy the data into the output buffer */
+	write_ptr = ntpclient->buffer + req->write_len;
+	read_ptr = pkt->data;
+	for (i = 0; i < num_items; i++) {
+		memcpy(write_ptr, read_ptr, item_size);
+		write_ptr += item_size;
+		read_ptr += item_size;
+		
+		memset(write_ptr, 0, pad_size);
+		write_ptr += pad_size;
+	}
+	req->write_len = write_ptr - ntpclient->buffer;
 
-		/* Get the sequence number and discard the packet if we have
-		 * already seen it */
-		seq_num = INFO_SEQ(pkt.auth_seq);
-		if (have_seq[seq_num]) {
-			DBG_L3("ntpclient: mode7: received duplicate seq num %d\n", seq_num);
-			continue;
-		}
+	/* Update the total number of items received */
+	req->total_items += num_items;
+	req->have_seq[seq_num] = true;
+	req->pkts_received++;
 
-		/* Check if this is the last in the sequence */
-		if (!ISMORE(pkt.rm_vn_mode) && (last_seq_num <= MAXSEQ)) {
-			DBG_L3("ntpclient: mode7: received second end sequence packet\n");
-			continue;
-		}
+	/* Reset timer for next packet */
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &req->deadline);
+	sfptpd_time_add(&req->deadline, &req->deadline, &ntpclient->timeout);
+
+	return (req->pkts_received > req->last_seq_num) ? 0 : EAGAIN;
+}
 
-		if (!ISMORE(pkt.rm_vn_mode))
-			last_seq_num = seq_num;
 
-		/* Work out whether we have to pad the data */
-		if (required_item_size > item_size)
-			pad_size = required_item_size - item_size;
-		else
-			pad_size = 0;
-
-		/* Check that ther is enough space in the output buffer for
-		 * this chunk of data */
-		if (write_ptr + (num_items * (item_size + pad_size)) >
-		    ntpclient->buffer + sizeof(ntpclient->buffer)) {
-			WARNING("ntpclient: mode7: response larger than buffer %zd\n",
-				sizeof(ntpclient->buffer));
-			return ENOSPC;
-		}
+/* Send the request in flight, afresh or again */
+static int mode7_send_request(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct mode7_request *req = &ntpclient->request;
+	char junk[512];
+	int rc;
+
+	/* Before sending the request, make sure the socket is empty. With
+	 * only one request in flight, anything waiting is stale. */
+	while (recv(ntpclient->sock, junk, sizeof(junk), MSG_DONTWAIT) > 0);
+
+	req->pkts_received = 0;
+	req->last_seq_num = INT_MAX;
+	memset(req->have_seq, 0, sizeof(req->have_seq));
+	req->total_items = 0;
+	req->write_len = 0;
+
+	rc = mode7_request(ntpclient, req->request_code, req->authenticate,
+			   req->num_items, req->item_size,
+			   req->num_items == 0 ? NULL : req->data);
+	if (rc != 0)
+		return rc;
+
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &req->deadline);
+	sfptpd_time_add(&req->deadline, &req->deadline, &ntpclient->timeout);
+	req->active = true;
+	return 0;
+}
+
+
+static int mode7_start_request(struct sfptpd_ntpclient_state *ntpclient,
+			       bool for_poll,
+			       int request_code,
+			       bool authenticate,
+			       unsigned int req_num_items,
+			       unsigned int req_item_size,
+			       const void *req_data,
+			       unsigned int resp_item_size)
+{
+	struct mode7_request *req = &ntpclient->request;
+
+	assert(ntpclient != NULL);
+	assert((req_data != NULL) || ((req_num_items == 0) && (req_item_size == 0)));
+	assert(req_num_items * req_item_size <= sizeof(req->data));
+
+	memset(req, 0, sizeof *req);
+	req->for_poll = for_poll;
+	req->request_code = request_code;
+	req->authenticate = authenticate;
+	req->num_items = req_num_items;
+	req->item_size = req_item_size;
+	if (req_num_items != 0)
+		memcpy(req->data, req_data, req_num_items * req_item_size);
+	req->resp_item_size = resp_item_size;
+
+	return mode7_send_request(ntpclient);
+}
+
+
+/* Process all of the responses waiting on the socket */
+static void mode7_receive(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct ntp_response_pkt pkt;
+	int rc, len;
+
+	while (true) {
+		len = recv(ntpclient->sock, &pkt, sizeof(pkt), MSG_DONTWAIT);
+		if (len < 0) {
+			rc = errno;
+			if (rc == EAGAIN || rc == EWOULDBLOCK || rc == EINTR)
+				return;
 
-		/* Copy the data into the output buffer */
-		read_ptr = pkt.data;
-		for (i = 0; i < num_items; i++) {
-			memcpy(write_ptr, read_ptr, item_size);
-			write_ptr += item_size;
-			read_ptr += item_size;
-			
-			memset(write_ptr, 0, pad_size);
-			write_ptr += pad_size;
+			if (rc != ECONNREFUSED) {
+				DBG_L3("ntpclient: mode7: error reading from socket, %s\n",
+				       strerror(rc));
+			}
+			if (ntpclient->request.active)
+				mode7_request_done(ntpclient, rc);
+			return;
 		}
 
-		/* Update the total number of items received */
-		if (total_items != NULL)
-			*total_items += num_items;
+		/* Nothing is expected without a request in flight */
+		if (!ntpclient->request.active)
+			continue;
 
-		pkts_received++;
+		rc = mode7_reassemble(ntpclient, &pkt, len);
+		if (rc != EAGAIN)
+			mode7_request_done(ntpclient, rc);
 	}
+}
 
-	/* Return a pointer to the data received. */
-	if (response != NULL)
-		*response = ntpclient->buffer;
-	return 0;
+
+/* Fail the request in flight if its response has not arrived in time */
+static void mode7_expire(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct sfptpd_timespec time_now;
+
+	if (!ntpclient->request.active)
+		return;
+
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &time_now);
+	if (sfptpd_time_cmp(&time_now, &ntpclient->request.deadline) > 0)
+		mode7_request_done(ntpclient, ETIMEDOUT);
+}
+
+
+static void mode7_poll_finish(struct sfptpd_ntpclient_state *ntpclient, int rc)
+{
+	ntpclient->poll.complete = true;
+	ntpclient->poll.rc = rc;
 }
 
 
@@ -1175,37 +1303,372 @@ static int mode7_query(struct sfptpd_ntpclient_state *ntpclient,
 		       unsigned int resp_item_size,
 		       void **resp_data)
 {
+	struct mode7_request *req = &ntpclient->request;
+	struct sfptpd_timespec time_now, timeout;
+	struct timespec boring_timeout;
+	fd_set fds;
 	int rc;
-	char junk[512];
 
 	assert(ntpclient != NULL);
-	assert((req_data != NULL) || ((req_num_items == 0) && (req_item_size == 0)));
 	assert((resp_num_items != NULL) || (resp_item_size == 0));
 	assert((resp_data != NULL) || (resp_item_size == 0));
 
-legacy_mode_retry:
-	/* Before starting the query, make sure the socket is empty */
-	while (recv(ntpclient->sock, junk, sizeof(junk), MSG_DONTWAIT) > 0);
+	/* The socket can't be shared with a poll in progress */
+	if (ntpclient->poll.active && !ntpclient->poll.complete) {
+		DBG_L3("ntpclient: mode7: abandoning poll for query\n");
+		mode7_poll_finish(ntpclient, ECANCELED);
+	}
 
 	/* Send the request */
-	rc = mode7_request(ntpclient, request_code, authenticate,
-			   req_num_items, req_item_size, req_data);
+	rc = mode7_start_request(ntpclient, false, request_code, authenticate,
+				 req_num_items, req_item_size, req_data,
+				 resp_item_size);
 	if (rc != 0)
 		return rc;
 
 	/* Wait for the response */
-	rc = mode7_response(ntpclient, request_code, resp_num_items,
-			    resp_item_size, resp_data);
+	while (!req->complete) {
+		(void)sfclock_gettime(CLOCK_MONOTONIC, &time_now);
+		sfptpd_time_subtract(&timeout, &req->deadline, &time_now);
+		if (timeout.sec < 0) {
+			req->active = false;
+			req->rc = ETIMEDOUT;
+			break;
+		}
+		sfptpd_time_to_std_floor(&boring_timeout, &timeout);
+
+		FD_ZERO(&fds);
+		FD_SET(ntpclient->sock, &fds);
+		rc = pselect(ntpclient->sock+1, &fds, NULL, NULL, &boring_timeout, NULL);
+		if (rc < 0 && errno != EINTR) {
+			ERROR("ntpclient: mode7: error waiting on socket, %s\n",
+			      strerror(errno));
+			req->active = false;
+			req->rc = errno;
+			break;
+		}
+
+		mode7_receive(ntpclient);
+	}
+
+	/* Return a pointer to the data received. */
+	if (resp_num_items != NULL)
+		*resp_num_items = req->total_items;
+	if (resp_data != NULL)
+		*resp_data = ntpclient->buffer;
+	return req->rc;
+}
+
+
+/****************************************************************************
+ * Poll Functions
+ ****************************************************************************/
+
+static int mode7_parse_sys_info(struct sfptpd_ntpclient_state *ntpclient, int rc,
+				struct sfptpd_ntpclient_sys_info *sys_info)
+{
+	struct ntp_info_sys *info = (struct ntp_info_sys *) ntpclient->buffer;
+	const uint8_t clock_flags_mask = INFO_FLAG_NTP | INFO_FLAG_KERNEL;
+	char host[NI_MAXHOST];
+	
+	assert(sys_info != NULL);
+
+	if (rc == 0) {
+		write_address(&sys_info->peer_address, &sys_info->peer_address_len,
+			      info->v6_flag, info->peer, &info->peer6);
+		sys_info->clock_control_enabled = ((info->flags & clock_flags_mask) != 0);
+
+		rc = getnameinfo((struct sockaddr *) &sys_info->peer_address,
+				 sys_info->peer_address_len,
+				 host, sizeof host,
+				 NULL, 0, NI_NUMERICHOST);
+		if (rc != 0) {
+			DBG_L4("ntpclient: mode7: getnameinfo: %s\n", gai_strerror(rc));
+		}
+		
+		DBG_L6("ntp-sys-info: selected-peer-address %s "
+		       "leap-flags 0x%hhx, stratum 0x%hhx, flags 0x%hhx, "
+		       "clock-control %sabled\n",
+		       host,
+		       info->leap, info->stratum, info->flags,
+		       sys_info->clock_control_enabled? "en": "dis");
+		rc = 0;
+	} else if (rc != ECONNREFUSED) {
+		DBG_L3("ntpclient: mode7: failed to get system info from NTP daemon, %s\n",
+		       strerror(rc));
+	}
+
+	return rc;
+}
+
+
+static int mode7_parse_peer_list(struct sfptpd_ntpclient_state *ntpclient, int rc,
+				 struct sfptpd_ntpclient_peer_info *peer_info)
+{
+	struct ntp_info_peer_summary *summary = (struct ntp_info_peer_summary *) ntpclient->buffer;
+	unsigned int num_items = ntpclient->request.total_items;
+	struct sfptpd_ntpclient_peer *peer;
+	long double offset;
+	int32_t seconds;
+	uint32_t fraction;
+	int i;
+
+	/* If NTPd has no peers configured then it will return ENODATA when
+	 * queried. This can also happen when NTPd is starting if it is queried
+	 * before having completed the DNS lookup of the configured peers. */
+	if (rc == ENODATA) {
+		DBG_L5("ntpclient: mode7: ntpd did not return any peers\n");
+		num_items = 0;
+		rc = 0;
+	} else if (rc != 0) {
+		if (rc != ECONNREFUSED) {
+			DBG_L3("ntpclient: mode7: failed to get peer summary from NTP daemon, %s\n",
+			       strerror(rc));
+		}
+		return rc;
+	}
+
+	if (num_items > SFPTPD_NTP_PEERS_MAX) {
+		num_items = SFPTPD_NTP_PEERS_MAX;
+		WARNING("ntpclient: mode7: too many peers - summary limited to %d peers\n",
+			num_items);
+	}
+
+	peer_info->num_peers = num_items;
+
+	for (i = 0; i < num_items; i++) {
+		peer = &peer_info->peers[i];
+		seconds = ntohl(summary[i].offset.l_i);
+		fraction = ntohl(summary[i].offset.l_uf);
+		offset = (long double)seconds + ((long double)fraction / FRAC);
+		/* Convert to nanoseconds and invert the offset */
+		offset *= -1.0e9;
+
+		write_address(&peer->remote_address, &peer->remote_address_len,
+			      summary[i].v6_flag, summary[i].srcadr, &summary[i].srcadr6);
+		write_address(&peer->local_address, &peer->local_address_len,
+			      summary[i].v6_flag, summary[i].dstadr, &summary[i].dstadr6);
+		peer->pkts_sent = 0;
+		peer->pkts_received = 0;
+		peer->stratum = summary[i].stratum;
+		peer->selected = ((summary[i].flags & INFO_FLAG_SYSPEER) != 0);
+		peer->shortlist = ((summary[i].flags & INFO_FLAG_SHORTLIST) != 0);
+		peer->candidate = (summary[i].hmode == MODE_CLIENT);
+		peer->self = ((summary[i].flags & INFO_FLAG_REFCLOCK) != 0);
+		peer->offset = offset;
+	}
+
+	return 0;
+}
+
+
+static int mode7_parse_peer_stats(struct sfptpd_ntpclient_state *ntpclient, int rc,
+				  struct sfptpd_ntpclient_peer *peer)
+{
+	struct ntp_info_peer_stats *stats = (struct ntp_info_peer_stats *) ntpclient->buffer;
+	unsigned int num_items = ntpclient->request.total_items;
+
+	if (rc != 0) {
+		if (rc != ECONNREFUSED && rc != ENODATA) {
+			DBG_L3("ntpclient: mode7: failed to get peer stats from NTP daemon, %s\n",
+			       strerror(rc));
+		}
+		return rc;
+	}
+
+	if (num_items > 1) {
+		WARNING("ntpclient: mode7: expected 1 set of peer stats, got %d\n",
+		num_items);
+	}
+
+	if (cmp_host_address(&peer->remote_address,
+			     stats->v6_flag, stats->srcadr, &stats->srcadr6) != 0) {
+		ERROR("ntpclient: mode7: got peer stats for wrong peer\n");
+		return EIO;
+	}
+
+	peer->pkts_sent = ntohl(stats->sent);
+	peer->pkts_received = ntohl(stats->processed);
+	return 0;
+}
+
+
+static int mode7_parse_peer_info(struct sfptpd_ntpclient_state *ntpclient, int rc,
+				 struct sfptpd_ntpclient_peer *peer)
+{
+	struct ntp_info_peer *info = (struct ntp_info_peer *) ntpclient->buffer;
+	unsigned int num_items = ntpclient->request.total_items;
+	char remote_host[NI_MAXHOST];
+
+	if (rc != 0) {
+		if (rc != ECONNREFUSED) {
+			DBG_L3("ntpclient: mode7: failed to get peer info from NTP daemon, %s\n",
+			       strerror(rc));
+		}
+		return rc;
+	}
+
+	if (num_items > 1) {
+		WARNING("ntpclient: mode7: expected 1 set of peer stats, got %d\n",
+		num_items);
+	}
+
+	rc = getnameinfo((struct sockaddr *) &peer->remote_address,
+			 peer->remote_address_len,
+			 remote_host, sizeof remote_host,
+			 NULL, 0, NI_NUMERICHOST);
+	if (rc != 0)
+		strcpy(remote_host, "<invalid>");
+	
+	if (peer->remote_address.ss_family == AF_INET &&
+	    cmp_host_address(&peer->remote_address,
+			     info->v6_flag, info->srcadr, &info->srcadr6) != 0) {
+		/* NB the src address doesn't get populated for v6: possible ntpd bug */
+		ERROR("ntpclient: mode7: got peer info for wrong peer (expected %s)\n",
+		      remote_host);
+		return EIO;
+	}
+
+	peer->root_dispersion
+		= (long double)((uint32_t)ntohl(info->rootdispersion))
+		* 1.0e9 / 65536.0;
+	return 0;
+}
+
+
+/* Send a request about the current peer of a poll */
+static int mode7_poll_peer_request(struct sfptpd_ntpclient_state *ntpclient,
+				   int request_code, unsigned int resp_item_size)
+{
+	struct sfptpd_ntpclient_peer *peer;
+	struct ntp_info_peer_list list = {};
+
+	peer = &ntpclient->poll.peer_info->peers[ntpclient->poll.peer_idx];
+
+	read_address(&peer->remote_address,
+		     &list.v6_flag, &list.addr, &list.addr6);
+	list.port = htons(NTP_PORT);
+	list.hmode = 0;
+	list.flags = 0;
+
+	return mode7_start_request(ntpclient, true, request_code, false,
+				   1, sizeof(list), &list, resp_item_size);
+}
+
+
+/* Request the stats of the next peer or finish the poll */
+static int mode7_poll_next_peer(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct mode7_poll *poll = &ntpclient->poll;
+
+	if (poll->peer_idx >= poll->peer_info->num_peers) {
+		mode7_poll_finish(ntpclient, 0);
+		return 0;
+	}
+
+	poll->stage = MODE7_POLL_PEER_STATS;
+	return mode7_poll_peer_request(ntpclient, REQ_PEER_STATS,
+				       sizeof(struct ntp_info_peer_stats));
+}
+
+
+/* Handle the response to a request of a poll and send the next request */
+static void mode7_poll_step(struct sfptpd_ntpclient_state *ntpclient, int rc)
+{
+	struct mode7_poll *poll = &ntpclient->poll;
+	struct sfptpd_ntpclient_peer *peer;
+
+	switch (poll->stage) {
+	case MODE7_POLL_SYS_INFO:
+		rc = mode7_parse_sys_info(ntpclient, rc, poll->sys_info);
+		if (rc == 0 && poll->peer_info != NULL) {
+			poll->stage = MODE7_POLL_PEER_LIST;
+			rc = mode7_start_request(ntpclient, true, REQ_PEER_LIST_SUM, false,
+						 0, 0, NULL,
+						 sizeof(struct ntp_info_peer_summary));
+		} else {
+			mode7_poll_finish(ntpclient, rc);
+			return;
+		}
+		break;
+
+	case MODE7_POLL_PEER_LIST:
+		rc = mode7_parse_peer_list(ntpclient, rc, poll->peer_info);
+		if (rc == 0) {
+			poll->peer_idx = 0;
+			rc = mode7_poll_next_peer(ntpclient);
+		}
+		break;
+
+	case MODE7_POLL_PEER_STATS:
+		peer = &poll->peer_info->peers[poll->peer_idx];
+		rc = mode7_parse_peer_stats(ntpclient, rc, peer);
+		if (rc == ENODATA) {
+			TRACE_L5("ntpclient: mode7: no data available from peer\n");
+			poll->peer_idx++;
+			rc = mode7_poll_next_peer(ntpclient);
+		} else if (rc == 0) {
+			poll->stage = MODE7_POLL_PEER_INFO;
+			rc = mode7_poll_peer_request(ntpclient, REQ_PEER_INFO,
+						     sizeof(struct ntp_info_peer));
+		}
+		break;
+
+	case MODE7_POLL_PEER_INFO:
+		peer = &poll->peer_info->peers[poll->peer_idx];
+		rc = mode7_parse_peer_info(ntpclient, rc, peer);
+		if (rc == 0) {
+			poll->peer_idx++;
+			rc = mode7_poll_next_peer(ntpclient);
+		}
+		break;
+
+	default:
+		assert(false);
+	}
+
+	if (rc != 0)
+		mode7_poll_finish(ntpclient, rc);
+}
+
+
+/* Handle the completion of the request in flight */
+static void mode7_request_done(struct sfptpd_ntpclient_state *ntpclient, int rc)
+{
+	struct mode7_request *req = &ntpclient->request;
+
+	req->active = false;
 
 	/* Check whether we failed because we are talking to an old version of
 	 * the NTPD daemon. Try again with a smaller message size */
 	if ((rc == EMSGSIZE) && (ntpclient->legacy_mode < NTP_LEGACY_MODE_MAX)) {
 		ntpclient->legacy_mode++;
 		ntpclient->request_pkt_size = ntp_legacy_pkt_sizes[ntpclient->legacy_mode];
-		goto legacy_mode_retry;
+		rc = mode7_send_request(ntpclient);
+		if (rc == 0)
+			return;
 	}
 
-	return rc;
+	if (req->for_poll) {
+		mode7_poll_step(ntpclient, rc);
+	} else {
+		req->rc = rc;
+		req->complete = true;
+	}
+}
+
+
+static int mode7_poll_result(struct sfptpd_ntpclient_state *ntpclient)
+{
+	struct mode7_poll *poll = &ntpclient->poll;
+
+	if (!poll->active)
+		return 0;
+	if (!poll->complete)
+		return EINPROGRESS;
+
+	poll->active = false;
+	return poll->rc;
 }
 
 
@@ -1299,205 +1762,71 @@ static void mode7_destroy(struct sfptpd_ntpclient_state **ntpclient)
 	}
 }
 
-static int mode7_get_sys_info(struct sfptpd_ntpclient_state *ntpclient,
-			      struct sfptpd_ntpclient_sys_info *sys_info)
+static int mode7_get_fd(struct sfptpd_ntpclient_state *ntpclient)
 {
-	int rc;
-	unsigned int num_items;
-	struct ntp_info_sys *info;
-	const uint8_t clock_flags_mask = INFO_FLAG_NTP | INFO_FLAG_KERNEL;
-	char host[NI_MAXHOST];
-	
 	assert(ntpclient != NULL);
-	assert(sys_info != NULL);
-
-	rc = mode7_query(ntpclient, REQ_SYS_INFO, false,
-			 0, 0, NULL,
-			 &num_items, sizeof(*info), (void **)&info);
-	if (rc == 0) {
-		write_address(&sys_info->peer_address, &sys_info->peer_address_len,
-			      info->v6_flag, info->peer, &info->peer6);
-		sys_info->clock_control_enabled = ((info->flags & clock_flags_mask) != 0);
-
-		rc = getnameinfo((struct sockaddr *) &sys_info->peer_address,
-				 sys_info->peer_address_len,
-				 host, sizeof host,
-				 NULL, 0, NI_NUMERICHOST);
-		if (rc != 0) {
-			DBG_L4("ntpclient: mode7: getnameinfo: %s\n", gai_strerror(rc));
-		}
-		
-		DBG_L6("ntp-sys-info: selected-peer-address %s "
-		       "leap-flags 0x%hhx, stratum 0x%hhx, flags 0x%hhx, "
-		       "clock-control %sabled\n",
-		       host,
-		       info->leap, info->stratum, info->flags,
-		       sys_info->clock_control_enabled? "en": "dis");
-	} else if (rc != ECONNREFUSED) {
-		DBG_L3("ntpclient: mode7: failed to get system info from NTP daemon, %s\n",
-		       strerror(rc));
-	}
-
-	return rc;
+	return ntpclient->sock;
 }
 
-
-static int mode7_get_peer_info(struct sfptpd_ntpclient_state *ntpclient,
-			       struct sfptpd_ntpclient_peer_info *peer_info)
+static void mode7_poll_cancel(struct sfptpd_ntpclient_state *ntpclient)
 {
-	int rc, i;
-	unsigned int num_items;
-	struct ntp_info_peer_summary *summary;
-	struct ntp_info_peer_stats *stats;
-	struct ntp_info_peer *info;
-	struct ntp_info_peer_list list = {};
-	struct sfptpd_ntpclient_peer *peer;
-	long double offset;
-	int32_t seconds;
-	uint32_t fraction;
-
 	assert(ntpclient != NULL);
-	assert(peer_info != NULL);
-
-	/* First get the peer list summary */
-	rc = mode7_query(ntpclient, REQ_PEER_LIST_SUM, false,
-			 0, 0, NULL,
-			 &num_items, sizeof(*summary), (void **)&summary);
-
-	/* If NTPd has no peers configured then it will return ENODATA when
-	 * queried. This can also happen when NTPd is starting if it is queried
-	 * before having completed the DNS lookup of the configured peers. */
-	if (rc == ENODATA) {
-		DBG_L5("ntpclient: mode7: ntpd did not return any peers\n");
-		num_items = 0;
-		rc = 0;
-	} else if (rc != 0) {
-		if (rc != ECONNREFUSED) {
-			DBG_L3("ntpclient: mode7: failed to get peer summary from NTP daemon, %s\n",
-			       strerror(rc));
-		}
-		return rc;
-	}
-
-	if (num_items > SFPTPD_NTP_PEERS_MAX) {
-		num_items = SFPTPD_NTP_PEERS_MAX;
-		WARNING("ntpclient: mode7: too many peers - summary limited to %d peers\n",
-			num_items);
-	}
 
-	peer_info->num_peers = num_items;
+	if (ntpclient->request.for_poll)
+		ntpclient->request.active = false;
+	memset(&ntpclient->poll, 0, sizeof ntpclient->poll);
+}
 
-	for (i = 0; i < num_items; i++) {
-		peer = &peer_info->peers[i];
-		seconds = ntohl(summary[i].offset.l_i);
-		fraction = ntohl(summary[i].offset.l_uf);
-		offset = (long double)seconds + ((long double)fraction / FRAC);
-		/* Convert to nanoseconds and invert the offset */
-		offset *= -1.0e9;
+static int mode7_poll_start(struct sfptpd_ntpclient_state *ntpclient,
+			    struct sfptpd_ntpclient_sys_info *sys_info,
+			    struct sfptpd_ntpclient_peer_info *peer_info)
+{
+	struct mode7_poll *poll = &ntpclient->poll;
+	int rc;
 
-		write_address(&peer->remote_address, &peer->remote_address_len,
-			      summary[i].v6_flag, summary[i].srcadr, &summary[i].srcadr6);
-		write_address(&peer->local_address, &peer->local_address_len,
-			      summary[i].v6_flag, summary[i].dstadr, &summary[i].dstadr6);
-		peer->pkts_sent = 0;
-		peer->pkts_received = 0;
-		peer->stratum = summary[i].stratum;
-		peer->selected = ((summary[i].flags & INFO_FLAG_SYSPEER) != 0);
-		peer->shortlist = ((summary[i].flags & INFO_FLAG_SHORTLIST) != 0);
-		peer->candidate = (summary[i].hmode == MODE_CLIENT);
-		peer->self = ((summary[i].flags & INFO_FLAG_REFCLOCK) != 0);
-		peer->offset = offset;
+	assert(ntpclient != NULL);
+	assert((sys_info != NULL) || (peer_info != NULL));
+
+	if (poll->active || ntpclient->request.active)
+		return EBUSY;
+
+	memset(poll, 0, sizeof *poll);
+	poll->active = true;
+	poll->sys_info = sys_info;
+	poll->peer_info = peer_info;
+
+	/* Each request is sent when the response to the previous one has
+	 * been processed */
+	if (sys_info != NULL) {
+		poll->stage = MODE7_POLL_SYS_INFO;
+		rc = mode7_start_request(ntpclient, true, REQ_SYS_INFO, false,
+					 0, 0, NULL, sizeof(struct ntp_info_sys));
+	} else {
+		poll->stage = MODE7_POLL_PEER_LIST;
+		rc = mode7_start_request(ntpclient, true, REQ_PEER_LIST_SUM, false,
+					 0, 0, NULL,
+					 sizeof(struct ntp_info_peer_summary));
 	}
 
-	/* For each peer, get the peer stats and info */
-	for (i = 0; i < peer_info->num_peers; i++) {
-		char remote_host[NI_MAXHOST];
-		char local_host[NI_MAXHOST];
-
-		peer = &peer_info->peers[i];
-
-		/* Get the peer stats */
-		read_address(&peer->remote_address,
-			     &list.v6_flag, &list.addr, &list.addr6);
-		list.port = htons(NTP_PORT);
-		list.hmode = 0;
-		list.flags = 0;
-
-		rc = mode7_query(ntpclient, REQ_PEER_STATS, false,
-				 1, sizeof(list), &list,
-				 &num_items, sizeof(*stats), (void **)&stats);
-		if (rc != 0) {
-			if (rc == ENODATA) {
-				TRACE_L5("ntpclient: mode7: no data available from peer\n");
-				rc = 0;
-				continue;
-			}
-			if (rc != ECONNREFUSED) {
-				DBG_L3("ntpclient: mode7: failed to get peer stats from NTP daemon, %s\n",
-				       strerror(rc));
-			}
-
-			return rc;
-		}
-
-		if (num_items > 1) {
-			WARNING("ntpclient: mode7: expected 1 set of peer stats, got %d\n",
-			num_items);
-		}
-
-		if (cmp_host_address(&peer->remote_address,
-				     stats->v6_flag, stats->srcadr, &stats->srcadr6) != 0) {
-			ERROR("ntpclient: mode7: got peer stats for wrong peer\n");
-			return EIO;
-		}
-
-		peer->pkts_sent = ntohl(stats->sent);
-		peer->pkts_received = ntohl(stats->processed);
-
-		/* Get the peer info */
-		read_address(&peer->remote_address,
-			     &list.v6_flag, &list.addr, &list.addr6);
-		list.port = htons(NTP_PORT);
-		list.hmode = 0;
-		list.flags = 0;
-
-		rc = mode7_query(ntpclient, REQ_PEER_INFO, false,
-				 1, sizeof(list), &list,
-				 &num_items, sizeof(*info), (void **)&info);
-		if (rc != 0) {
-			if (rc != ECONNREFUSED) {
-				DBG_L3("ntpclient: mode7: failed to get peer info from NTP daemon, %s\n",
-				       strerror(rc));
-			}
-
-			return rc;
-		}
+	if (rc != 0)
+		mode7_poll_cancel(ntpclient);
+	return rc;
+}
 
-		if (num_items > 1) {
-			WARNING("ntpclient: mode7: expected 1 set of peer stats, got %d\n",
-			num_items);
-		}
+static int mode7_poll_io(struct sfptpd_ntpclient_state *ntpclient)
+{
+	assert(ntpclient != NULL);
 
-		rc = getnameinfo((struct sockaddr *) &peer->remote_address,
-				 peer->remote_address_len,
-				 remote_host, sizeof remote_host,
-				 NULL, 0, NI_NUMERICHOST);
-		
-		if (peer->remote_address.ss_family == AF_INET &&
-		    cmp_host_address(&peer->remote_address,
-				     info->v6_flag, info->srcadr, &info->srcadr6) != 0) {
-			/* NB the src address doesn't get populated for v6: possible ntpd bug */
-			ERROR("ntpclient: mode7: got peer info for wrong peer (expected %s)\n",
-			      remote_host, local_host);
-			return EIO;
-		}
+	mode7_receive(ntpclient);
+	return mode7_poll_result(ntpclient);
+}
 
-		peer->root_dispersion
-			= (long double)((uint32_t)ntohl(info->rootdispersion))
-			* 1.0e9 / 65536.0;
-	}
+static int mode7_poll_check(struct sfptpd_ntpclient_state *ntpclient)
+{
+	assert(ntpclient != NULL);
 
-	return rc;
+	mode7_expire(ntpclient);
+	return mode7_poll_result(ntpclient);
 }
 
 
@@ -1533,13 +1862,6 @@ static int mode7_clock_control(struct sfptpd_ntpclient_state *ntpclient,
 	return rc;
 }
 
-static int mode7_test_connection(struct sfptpd_ntpclient_state *ntpclient)
-{
-	/* currently this function is just a wrapper for get_sys_info */
-	struct sfptpd_ntpclient_sys_info sys_info = {};
-	return mode7_get_sys_info(ntpclient, &sys_info);
-}
-
 static struct sfptpd_ntpclient_feature_flags *
 mode7_get_features(struct sfptpd_ntpclient_state *ntpclient)
 {
@@ -1550,10 +1872,12 @@ mode7_get_features(struct sfptpd_ntpclient_state *ntpclient)
 /* Define protocol function struct */
 const struct sfptpd_ntpclient_fns sfptpd_ntpclient_mode7_fns = {
 	.destroy		= mode7_destroy,
-	.get_sys_info		= mode7_get_sys_info,
-	.get_peer_info		= mode7_get_peer_info,
+	.get_fd			= mode7_get_fd,
+	.poll_start		= mode7_poll_start,
+	.poll_io		= mode7_poll_io,
+	.poll_check		= mode7_poll_check,
+	.poll_cancel		= mode7_poll_cancel,
 	.clock_control		= mode7_clock_control,
-	.test_connection	= mode7_test_connection,
 	.get_features		= mode7_get_features,
 };
 
@@ -1248,6 +1248,9 @@ static int pps_stats_init(pps_module_t *pps,
 	rc = sfptpd_stats_collection_create(&instance->stats, "pps",
 					    sizeof(pps_stats_defns)/sizeof(pps_stats_defns[0]),
 					    pps_stats_defns);
+	if (rc == 0)
+		sfptpd_stats_collection_persist(&instance->stats, NULL,
+						SFPTPD_CONFIG_GET_NAME(instance->config));
 	return rc;
 }
 
@@ -2353,6 +2356,16 @@ static void pps_on_shutdown(void *context)
 }
 
 
+static void pps_on_startup_failed(void *context)
+{
+	pps_module_t *pps = (pps_module_t *)context;
+	assert(pps != NULL);
+
+	/* Delete the sync module instance */
+	free(pps);
+}
+
+
 static void pps_on_message(void *context, struct sfptpd_msg_hdr *hdr)
 {
 	pps_module_t *pps = (pps_module_t *)context;
@@ -2426,7 +2439,8 @@ static const struct sfptpd_thread_ops pps_thread_ops =
 	pps_on_startup,
 	pps_on_shutdown,
 	pps_on_message,
-	pps_on_user_fds
+	pps_on_user_fds,
+	pps_on_startup_failed
 };
 
 
@@ -2601,7 +2615,7 @@ int sfptpd_pps_module_create(struct sfptpd_config *config,
 	 * carry out the rest of the initialisation. */
 	rc = sfptpd_thread_create("pps", &pps_thread_ops, pps, sync_module);
 	if (rc != 0) {
-		free(pps);
+		pps_on_startup_failed(pps);
 		return rc;
 	}
 
@@ -715,6 +715,7 @@ struct sfptpd_ts_stats {
 	struct sfptpd_timespec start;
 	struct sfptpd_timespec quantile_bounds[TS_QUANTILES];
 	unsigned int resolved_quantile[TS_QUANTILES];
+	struct sfptpd_timespec resolved_sum; /* cumulative stats only */
 	unsigned int pending_quantile[TS_QUANTILES];
 	unsigned int evicted;
 	unsigned int total;
@@ -738,6 +739,9 @@ struct sfptpd_ts_cache {
 
 	/* On-demand statistics */
 	struct sfptpd_ts_stats stats_adhoc;
+
+	/* Statistics since startup */
+	struct sfptpd_ts_stats stats_cumulative;
 };
 
 /**
@@ -1039,6 +1039,9 @@ struct sfptpd_ts_ticket netMatchPacketToTsCache(struct sfptpd_ts_cache *ts_cache
 				if (!sfptpd_time_is_greater_or_equal(&elapsed, &ts_cache->stats_periodic.quantile_bounds[quantile])) {
 					ts_cache->stats_periodic.resolved_quantile[quantile]++;
 					ts_cache->stats_adhoc.resolved_quantile[quantile]++;
+					ts_cache->stats_cumulative.resolved_quantile[quantile]++;
+					sfptpd_time_add(&ts_cache->stats_cumulative.resolved_sum,
+							&ts_cache->stats_cumulative.resolved_sum, &elapsed);
 					break;
 				}
 			}
@@ -1583,6 +1586,7 @@ static void sfptpd_ts_cache_init(struct sfptpd_ts_cache *cache)
 	/* Initialise short term stats */
 	sfptpd_ts_stats_init(&cache->stats_periodic);
 	sfptpd_ts_stats_init(&cache->stats_adhoc);
+	sfptpd_ts_stats_init(&cache->stats_cumulative);
 };
 
 /**
@@ -2050,6 +2054,7 @@ struct sfptpd_ts_ticket netExpectTimestamp(struct sfptpd_ts_cache *cache,
 		cache->free_bitmap |= ~((unsigned int) INT_MAX) >> oldest_slot;
 		cache->stats_periodic.evicted++;
 		cache->stats_adhoc.evicted++;
+		cache->stats_cumulative.evicted++;
 	}
 
 	/* Find first free slot */
@@ -2074,6 +2079,7 @@ struct sfptpd_ts_ticket netExpectTimestamp(struct sfptpd_ts_cache *cache,
 	cache->free_bitmap &= ~(1 << bit);
 	cache->stats_periodic.total++;
 	cache->stats_adhoc.total++;
+	cache->stats_cumulative.total++;
 
 	DBGV("ptpd: timestamp %" PRIu64 " request in slot %d\n", pkt->seq, slot);
 
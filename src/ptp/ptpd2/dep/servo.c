@@ -60,6 +60,7 @@
 
 #include "../ptpd.h"
 #include "sfptpd_engine.h"
+#include "sfptpd_startup.h"
 
 #define SERVO_MAGIC	(0x53525630)	/* SRV0 */
 
@@ -591,10 +592,12 @@ static void warn_operator_slow_slewing(ptp_servo_t *servo)
 static void servo_adjust_frequency(ptp_servo_t *servo, LongDouble adj)
 {
 	assert(servo != NULL);
-	if (sfptpd_clock_adjust_frequency(servo->clock, adj) != 0)
+	if (sfptpd_clock_adjust_frequency(servo->clock, adj) != 0) {
 		SYNC_MODULE_ALARM_SET(servo->alarms, CLOCK_CTRL_FAILURE);
-	else
+	} else {
 		SYNC_MODULE_ALARM_CLEAR(servo->alarms, CLOCK_CTRL_FAILURE);
+		sfptpd_startup_mark(SFPTPD_STARTUP_FIRST_SERVO_ADJUSTMENT);
+	}
 
 	warn_operator_fast_slewing(servo, adj);
 }
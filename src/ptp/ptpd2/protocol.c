@@ -61,6 +61,7 @@
 #include "ptpd.h"
 #include "ptpd_lib.h"
 #include "sfptpd_time.h"
+#include "sfptpd_startup.h"
 
 static void handleAnnounce(MsgHeader*, ssize_t, RunTimeOpts*, PtpClock*);
 static void handleSync(const MsgHeader*, ssize_t, struct sfptpd_timespec*, Boolean, UInteger32, RunTimeOpts*, PtpClock*);
@@ -1861,6 +1862,7 @@ handleSync(const MsgHeader *header, ssize_t length,
 			if (ptpClock->waiting_for_first_sync) {
 				ptpClock->waiting_for_first_sync = FALSE;
 				INFO("ptp %s: received first Sync from Master\n", rtOpts->name);
+				sfptpd_startup_mark(SFPTPD_STARTUP_FIRST_PTP_SYNC);
 
 				if (ptpClock->delayMechanism == PTPD_DELAY_MECHANISM_E2E) {
 					timerStart(DELAYREQ_INTERVAL_TIMER, 
@@ -37,6 +37,8 @@
 #include "sfptpd_pps_module.h"
 #include "sfptpd_link.h"
 #include "sfptpd_multicast.h"
+#include "sfptpd_json.h"
+#include "sfptpd_metrics.h"
 
 #include "ptpd_lib.h"
 
@@ -82,7 +84,10 @@ enum ptp_stats_ids {
 	PTP_STATS_ID_RX_PKT_NO_TIMESTAMP,
 	PTP_STATS_ID_PPS_OFFSET,
 	PTP_STATS_ID_PPS_PERIOD,
-	PTP_STATS_ID_NUM_PTP_NODES
+	PTP_STATS_ID_NUM_PTP_NODES,
+	PTP_STATS_ID_OFFSET_QUANTILES,
+	PTP_STATS_ID_ONE_WAY_DELAY_QUANTILES,
+	PTP_STATS_ID_MAX
 };
 
 typedef struct sfptpd_ptp_module sfptpd_ptp_module_t;
@@ -160,6 +165,9 @@ struct sfptpd_ptp_instance {
 	/* Stats collected in sync module */
 	struct sfptpd_stats_collection stats;
 
+	/* Running totals of the counts recorded in the stats collection */
+	uint64_t stats_totals[PTP_STATS_ID_MAX];
+
 	/* SWPTP-906: external clock discriminator for BMCA */
 	enum { DISC_NONE, DISC_SYNC_INSTANCE, DISC_CLOCK } discriminator_type;
 	union {
@@ -284,6 +292,9 @@ struct sfptpd_ptp_module {
 
 	/* Copy of current link table */
 	struct sfptpd_link_table link_table;
+
+	/* Metrics published by the module */
+	struct sfptpd_metrics_source *metrics_source;
 };
 
 struct sfptpd_ptp_accuracy_map {
@@ -322,7 +333,9 @@ static const struct sfptpd_stats_collection_defn ptp_stats_defns[] =
 	{PTP_STATS_ID_OUTLIERS,                SFPTPD_STATS_TYPE_COUNT, "adaptive-outlier-filter-discards"},
 	{PTP_STATS_ID_TX_PKT_NO_TIMESTAMP,     SFPTPD_STATS_TYPE_COUNT, "tx-pkt-no-timestamp"},
 	{PTP_STATS_ID_RX_PKT_NO_TIMESTAMP,     SFPTPD_STATS_TYPE_COUNT, "rx-pkt-no-timestamp"},
-	{PTP_STATS_ID_NUM_PTP_NODES,           SFPTPD_STATS_TYPE_RANGE, "num-ptp-nodes", NULL, 0}
+	{PTP_STATS_ID_NUM_PTP_NODES,           SFPTPD_STATS_TYPE_RANGE, "num-ptp-nodes", NULL, 0},
+	{PTP_STATS_ID_OFFSET_QUANTILES,        SFPTPD_STATS_TYPE_QUANTILE, "offset-quantiles", "ns", 0},
+	{PTP_STATS_ID_ONE_WAY_DELAY_QUANTILES, SFPTPD_STATS_TYPE_QUANTILE, "one-way-delay-quantiles", "ns", 0}
 };
 
 /* Note that this table must be in order of increasing values for the translations
@@ -704,6 +717,10 @@ static int ptp_stats_init(sfptpd_ptp_instance_t *instance)
 							 "pps-period", "ns", 0);
 	}
 
+	if (rc == 0)
+		sfptpd_stats_collection_persist(&instance->stats, NULL,
+						SFPTPD_CONFIG_GET_NAME(instance->config));
+
 	return rc;
 }
 
@@ -762,6 +779,18 @@ static void ptp_critical_stats_update(struct ptpd_critical_stats_logger *logger,
 					     critical_stats.sync_time, critical_stats.valid);
 	sfptpd_stats_collection_update_range(stats, PTP_STATS_ID_ONE_WAY_DELAY, critical_stats.owd_ns,
 					     critical_stats.sync_time, critical_stats.valid);
+	sfptpd_stats_collection_update_quantile(stats, PTP_STATS_ID_OFFSET_QUANTILES,
+						critical_stats.ofm_ns, critical_stats.valid);
+	sfptpd_stats_collection_update_quantile(stats, PTP_STATS_ID_ONE_WAY_DELAY_QUANTILES,
+						critical_stats.owd_ns, critical_stats.valid);
+}
+
+
+static void ptp_stats_count(sfptpd_ptp_instance_t *instance,
+			    enum ptp_stats_ids id, unsigned long count)
+{
+	sfptpd_stats_collection_update_count(&instance->stats, id, count);
+	instance->stats_totals[id] += count;
 }
 
 
@@ -790,6 +819,8 @@ static void ptp_stats_update(sfptpd_ptp_instance_t *instance)
 		sync_time = ptpd_port_snapshot->current.last_offset_time;
 		sfptpd_stats_collection_update_range(stats, PTP_STATS_ID_OFFSET, NAN, sync_time, false);
 		sfptpd_stats_collection_update_range(stats, PTP_STATS_ID_ONE_WAY_DELAY, NAN, sync_time, false);
+		sfptpd_stats_collection_update_quantile(stats, PTP_STATS_ID_OFFSET_QUANTILES, NAN, false);
+		sfptpd_stats_collection_update_quantile(stats, PTP_STATS_ID_ONE_WAY_DELAY_QUANTILES, NAN, false);
 	}
 
 	sfptpd_stats_collection_update_range(stats, PTP_STATS_ID_FREQ_ADJ, ptpd_port_snapshot->current.frequency_adjustment, sync_time, true);
@@ -804,28 +835,29 @@ static void ptp_stats_update(sfptpd_ptp_instance_t *instance)
 	}
 	
 	/* Packet counts */
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_ANNOUNCE_TXED, ptpd_counters.announceMessagesSent);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_ANNOUNCE_RXED, ptpd_counters.announceMessagesReceived);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_ANNOUNCE_TIMEOUTS, ptpd_counters.announceTimeouts);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_SYNC_PKT_TXED, ptpd_counters.syncMessagesSent);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_SYNC_PKT_RXED, ptpd_counters.syncMessagesReceived);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_SYNC_PKT_TIMEOUTS, ptpd_counters.syncTimeouts);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_FOLLOW_UP_TXED, ptpd_counters.followUpMessagesSent);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_FOLLOW_UP_RXED, ptpd_counters.followUpMessagesReceived);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_FOLLOW_UP_TIMEOUTS, ptpd_counters.followUpTimeouts);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_OUT_OF_ORDER_FOLLOW_UPS, ptpd_counters.outOfOrderFollowUps);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_DELAY_REQ_TXED, ptpd_counters.delayReqMessagesSent);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_DELAY_REQ_RXED, ptpd_counters.delayReqMessagesReceived);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_DELAY_RESP_TXED, ptpd_counters.delayRespMessagesSent);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_DELAY_RESP_RXED, ptpd_counters.delayRespMessagesReceived);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_DELAY_RESP_TIMEOUTS, ptpd_counters.delayRespTimeouts);
+	ptp_stats_count(instance, PTP_STATS_ID_ANNOUNCE_TXED, ptpd_counters.announceMessagesSent);
+	ptp_stats_count(instance, PTP_STATS_ID_ANNOUNCE_RXED, ptpd_counters.announceMessagesReceived);
+	ptp_stats_count(instance, PTP_STATS_ID_ANNOUNCE_TIMEOUTS, ptpd_counters.announceTimeouts);
+	ptp_stats_count(instance, PTP_STATS_ID_SYNC_PKT_TXED, ptpd_counters.syncMessagesSent);
+	ptp_stats_count(instance, PTP_STATS_ID_SYNC_PKT_RXED, ptpd_counters.syncMessagesReceived);
+	ptp_stats_count(instance, PTP_STATS_ID_SYNC_PKT_TIMEOUTS, ptpd_counters.syncTimeouts);
+	ptp_stats_count(instance, PTP_STATS_ID_FOLLOW_UP_TXED, ptpd_counters.followUpMessagesSent);
+	ptp_stats_count(instance, PTP_STATS_ID_FOLLOW_UP_RXED, ptpd_counters.followUpMessagesReceived);
+	ptp_stats_count(instance, PTP_STATS_ID_FOLLOW_UP_TIMEOUTS, ptpd_counters.followUpTimeouts);
+	ptp_stats_count(instance, PTP_STATS_ID_OUT_OF_ORDER_FOLLOW_UPS, ptpd_counters.outOfOrderFollowUps);
+	ptp_stats_count(instance, PTP_STATS_ID_DELAY_REQ_TXED, ptpd_counters.delayReqMessagesSent);
+	ptp_stats_count(instance, PTP_STATS_ID_DELAY_REQ_RXED, ptpd_counters.delayReqMessagesReceived);
+	ptp_stats_count(instance, PTP_STATS_ID_DELAY_RESP_TXED, ptpd_counters.delayRespMessagesSent);
+	ptp_stats_count(instance, PTP_STATS_ID_DELAY_RESP_RXED, ptpd_counters.delayRespMessagesReceived);
+	ptp_stats_count(instance, PTP_STATS_ID_DELAY_RESP_TIMEOUTS, ptpd_counters.delayRespTimeouts);
 
 	/* Miscellaneous */
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_DELAY_MODE_MISMATCH, ptpd_counters.delayModeMismatchErrors);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_CLOCK_STEPS, ptpd_counters.clockSteps);
+	ptp_stats_count(instance, PTP_STATS_ID_DELAY_MODE_MISMATCH, ptpd_counters.delayModeMismatchErrors);
+	ptp_stats_count(instance, PTP_STATS_ID_CLOCK_STEPS, ptpd_counters.clockSteps);
 	sfptpd_stats_collection_update_count_samples(stats, PTP_STATS_ID_OUTLIERS, ptpd_counters.outliers, ptpd_counters.outliersNumSamples);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_TX_PKT_NO_TIMESTAMP, ptpd_counters.txPktNoTimestamp);
-	sfptpd_stats_collection_update_count(stats, PTP_STATS_ID_RX_PKT_NO_TIMESTAMP, ptpd_counters.rxPktNoTimestamp);
+	instance->stats_totals[PTP_STATS_ID_OUTLIERS] += ptpd_counters.outliers;
+	ptp_stats_count(instance, PTP_STATS_ID_TX_PKT_NO_TIMESTAMP, ptpd_counters.txPktNoTimestamp);
+	ptp_stats_count(instance, PTP_STATS_ID_RX_PKT_NO_TIMESTAMP, ptpd_counters.rxPktNoTimestamp);
 	sfptpd_stats_collection_update_range(stats, PTP_STATS_ID_OUTLIER_THRESHOLD, ptpd_port_snapshot->current.servo_outlier_threshold, sync_time, true);
 	sfptpd_stats_collection_update_range(stats, PTP_STATS_ID_NUM_PTP_NODES, sfptpd_ht_get_num_entries(instance->ptpd_port_private->interface->nodeSet),
 					     sync_time, port_state != PTPD_INITIALIZING && port_state >= PTPD_LISTENING);
@@ -2517,12 +2549,123 @@ static void ptp_on_step_clock(sfptpd_ptp_module_t *ptp, sfptpd_sync_module_msg_t
 }
 
 
+static void ptp_write_metrics(struct sfptpd_json_buf *buf, void *context)
+{
+	sfptpd_ptp_module_t *ptp = (sfptpd_ptp_module_t *) context;
+	struct sfptpd_ptp_intf *interface;
+	sfptpd_ptp_instance_t *instance;
+	struct sfptpd_stats_collection **collections;
+	sfptpd_ptp_instance_t **instances;
+	char (*instance_labels)[SFPTPD_METRICS_LABELS_MAX];
+	const char **label_ptrs;
+	char name[SFPTPD_METRICS_NAME_MAX];
+	char labels[SFPTPD_METRICS_LABELS_MAX];
+	char bound[32];
+	unsigned int num_instances = 0;
+	unsigned int i, d, q;
+
+	for (interface = ptp->intf_list; interface; interface = interface->next)
+		for (instance = interface->instance_list; instance; instance = instance->next)
+			num_instances++;
+
+	collections = calloc(num_instances, sizeof *collections);
+	instances = calloc(num_instances, sizeof *instances);
+	instance_labels = calloc(num_instances, sizeof *instance_labels);
+	label_ptrs = calloc(num_instances, sizeof *label_ptrs);
+
+	if (num_instances != 0 && collections != NULL && instances != NULL &&
+	    instance_labels != NULL && label_ptrs != NULL) {
+		i = 0;
+		for (interface = ptp->intf_list; interface; interface = interface->next) {
+			for (instance = interface->instance_list; instance; instance = instance->next) {
+				instances[i] = instance;
+				collections[i] = &instance->stats;
+				sfptpd_metrics_labels(instance_labels[i], sizeof instance_labels[i],
+						      "instance", SFPTPD_CONFIG_GET_NAME(instance->config),
+						      NULL);
+				label_ptrs[i] = instance_labels[i];
+				i++;
+			}
+		}
+
+		/* Statistics for the last complete minute */
+		sfptpd_stats_collections_write_metrics(collections, label_ptrs,
+						       num_instances, buf,
+						       SFPTPD_METRICS_PREFIX "_ptp");
+
+		/* Running totals of protocol counters */
+		for (d = 0; d < sizeof ptp_stats_defns / sizeof *ptp_stats_defns; d++) {
+			if (ptp_stats_defns[d].type != SFPTPD_STATS_TYPE_COUNT ||
+			    ptp_stats_defns[d].id == PTP_STATS_ID_SYNCHRONIZED)
+				continue;
+			sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX "_ptp",
+					      ptp_stats_defns[d].name, NULL,
+					      SFPTPD_METRICS_TYPE_COUNTER, NULL);
+			for (i = 0; i < num_instances; i++)
+				sfptpd_metrics_sample(buf, name, "_total", label_ptrs[i],
+						      instances[i]->stats_totals[ptp_stats_defns[d].id], 0);
+		}
+	}
+
+	free(label_ptrs);
+	free(instance_labels);
+	free(instances);
+	free(collections);
+
+	/* Transmit timestamp latency for each interface since startup */
+	sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX "_ptp",
+			      "tx_timestamp_latency", "seconds",
+			      SFPTPD_METRICS_TYPE_HISTOGRAM,
+			      "Time taken to retrieve transmit timestamps");
+	for (interface = ptp->intf_list; interface; interface = interface->next) {
+		struct sfptpd_ts_stats *stats;
+		unsigned long long count = 0;
+
+		if (!interface->start_successful)
+			continue;
+
+		stats = &interface->ptpd_intf_private->ts_cache.stats_cumulative;
+		for (q = 0; q < TS_QUANTILES; q++) {
+			count += stats->resolved_quantile[q];
+			if (q == TS_QUANTILES - 1)
+				strcpy(bound, "+Inf");
+			else
+				snprintf(bound, sizeof bound, "%Lg",
+					 powl(10.0L, TS_QUANTILE_E10_MIN + q));
+			sfptpd_metrics_labels(labels, sizeof labels,
+					      "interface", interface->defined_name,
+					      "le", bound, NULL);
+			sfptpd_metrics_sample(buf, name, "_bucket", labels, count, 0);
+		}
+		sfptpd_metrics_labels(labels, sizeof labels,
+				      "interface", interface->defined_name, NULL);
+		sfptpd_metrics_sample(buf, name, "_count", labels, count, 0);
+		sfptpd_metrics_sample(buf, name, "_sum", labels,
+				      sfptpd_time_timespec_to_float_s(&stats->resolved_sum), 9);
+	}
+
+	sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX "_ptp",
+			      "tx_timestamp_evictions", NULL,
+			      SFPTPD_METRICS_TYPE_COUNTER,
+			      "Packets evicted from the transmit timestamp cache");
+	for (interface = ptp->intf_list; interface; interface = interface->next) {
+		if (!interface->start_successful)
+			continue;
+		sfptpd_metrics_labels(labels, sizeof labels,
+				      "interface", interface->defined_name, NULL);
+		sfptpd_metrics_sample(buf, name, "_total", labels,
+				      interface->ptpd_intf_private->ts_cache.stats_cumulative.evicted, 0);
+	}
+}
+
 static void ptp_on_log_stats(sfptpd_ptp_module_t *ptp, sfptpd_sync_module_msg_t *msg)
 {
 	assert(ptp != NULL);
 	assert(msg != NULL);
 
 	ptp_send_rt_stats_update(ptp, msg->u.log_stats_req.time);
+	sfptpd_metrics_publish(&ptp->metrics_source, "ptp",
+			       ptp_write_metrics, ptp);
 
 	SFPTPD_MSG_FREE(msg);
 }
@@ -3269,9 +3412,23 @@ static void ptp_on_link_table(sfptpd_ptp_module_t *ptp, sfptpd_sync_module_msg_t
 			return;
 		}
 
-		/* Set the flag to be picked up by the timer tick */
-		if (!interface->bond_changed && bond_changed) {
+		/* Apply the change now rather than waiting for the timer
+		 * tick so that failover to the new active interface is not
+		 * delayed. */
+		if (bond_changed) {
 			interface->bond_changed = true;
+			ptp_update_interface_state(interface);
+
+			if (!sfptpd_time_is_zero(&link_table->time)) {
+				struct sfptpd_timespec now;
+				struct sfptpd_timespec latency;
+
+				(void)sfclock_gettime(CLOCK_MONOTONIC, &now);
+				sfptpd_time_subtract(&latency, &now, &link_table->time);
+				INFO("ptp: interface %s switched %0.3Lfms after link change\n",
+				     interface->bond_info.bond_if,
+				     sfptpd_time_timespec_to_float_ns(&latency) / 1.0E6);
+			}
 		}
 	}
 
@@ -4032,6 +4189,8 @@ static void ptp_on_shutdown(void *context)
 	sfptpd_multicast_unsubscribe(SFPTPD_APP_MSG_DUMP_TABLES);
 	sfptpd_multicast_unsubscribe(SFPTPD_SERVO_MSG_PID_ADJUST);
 
+	sfptpd_metrics_source_free(ptp->metrics_source);
+
 	ptp_destroy_instances(ptp);
 
 	/* Delete the monitor */
@@ -4051,6 +4210,18 @@ static void ptp_on_shutdown(void *context)
 }
 
 
+static void ptp_on_startup_failed(void *context)
+{
+	sfptpd_ptp_module_t *ptp = (sfptpd_ptp_module_t *)context;
+	assert(ptp != NULL);
+
+	/* Delete what was created along with the sync module */
+	ptp_destroy_instances(ptp);
+	sfptpd_link_table_free_copy(&ptp->link_table);
+	free(ptp);
+}
+
+
 static void ptp_on_message(void *context, struct sfptpd_msg_hdr *hdr)
 {
 	sfptpd_ptp_module_t *ptp = (sfptpd_ptp_module_t *)context;
@@ -4168,7 +4339,8 @@ static const struct sfptpd_thread_ops ptp_thread_ops =
 	ptp_on_startup,
 	ptp_on_shutdown,
 	ptp_on_message,
-	ptp_on_user_fds
+	ptp_on_user_fds,
+	ptp_on_startup_failed
 };
 
 
@@ -132,13 +132,14 @@ static int node_compare_port_id(const void *key, const void *record)
 }
 
 SFPTPD_DB_SORT_FN(node_compare_port_id, struct sfptpd_ptp_monitor_node, rec, &rec->port_id)
+SFPTPD_DB_HASH_FN(node_compare_port_id, struct sfptpd_ptp_monitor_node, rec, &rec->port_id, sizeof(PortIdentity))
 
 enum sfptpd_db_node_fields {
 	NODE_FIELD_PORT_ID,
 };
 
 struct sfptpd_db_field node_fields[] = {
-	SFPTPD_DB_FIELD("port-id", NODE_FIELD_PORT_ID, node_compare_port_id, NULL)
+	SFPTPD_DB_FIELD_HASHED("port-id", NODE_FIELD_PORT_ID, node_compare_port_id, NULL)
 };
 
 struct sfptpd_db_table_def node_table_def = {
@@ -194,6 +195,8 @@ SFPTPD_DB_SORT_FN(common_compare_ref_port_id, struct monitor_record_common, rec,
 SFPTPD_DB_SORT_FN(common_compare_event_seq_id, struct monitor_record_common, rec, &rec->event_seq_id)
 SFPTPD_DB_SORT_FN(common_compare_monitor_seq_id, struct monitor_record_common, rec, &rec->monitor_seq_id)
 SFPTPD_DB_SORT_FN(common_compare_monitor_timestamp, struct monitor_record_common, rec, &rec->monitor_timestamp)
+SFPTPD_DB_HASH_FN(common_compare_port_id, struct monitor_record_common, rec, &rec->port_id, sizeof(PortIdentity))
+SFPTPD_DB_HASH_FN(common_compare_event_seq_id, struct monitor_record_common, rec, &rec->event_seq_id, sizeof(uint16_t))
 
 enum common_fields {
 	COMMON_FIELD_PORT_ID = 0,
@@ -209,8 +212,8 @@ enum common_fields {
 struct sfptpd_db_field rx_event_fields[] = {
 	SFPTPD_DB_FIELD("port-id", COMMON_FIELD_PORT_ID, common_compare_port_id, NULL)
 	SFPTPD_DB_FIELD("ref-port-id", COMMON_FIELD_REF_PORT_ID, common_compare_ref_port_id, NULL)
-	SFPTPD_DB_FIELD("sync-seq", COMMON_FIELD_EVENT_SEQ_ID, common_compare_event_seq_id, common_snprint_event_seq_id)
-	SFPTPD_DB_FIELD("monitor-seq-id", COMMON_FIELD_MONITOR_SEQ_ID, common_compare_monitor_seq_id, common_snprint_monitor_seq_id)
+	SFPTPD_DB_FIELD_HASHED("sync-seq", COMMON_FIELD_EVENT_SEQ_ID, common_compare_event_seq_id, common_snprint_event_seq_id)
+	SFPTPD_DB_FIELD_ORDERED("monitor-seq-id", COMMON_FIELD_MONITOR_SEQ_ID, common_compare_monitor_seq_id, common_snprint_monitor_seq_id)
 	SFPTPD_DB_FIELD("monitor-timestamp", COMMON_FIELD_MONITOR_TIMESTAMP, common_compare_monitor_timestamp, NULL)
 };
 
@@ -225,7 +228,7 @@ struct sfptpd_db_table_def rx_event_table_def = {
 
 struct sfptpd_db_field tx_event_fields[] = {
 	SFPTPD_DB_FIELD("port-id", COMMON_FIELD_PORT_ID, common_compare_port_id, NULL)
-	SFPTPD_DB_FIELD("monitor-seq-id", COMMON_FIELD_MONITOR_SEQ_ID, common_compare_monitor_seq_id, common_snprint_monitor_seq_id)
+	SFPTPD_DB_FIELD_ORDERED("monitor-seq-id", COMMON_FIELD_MONITOR_SEQ_ID, common_compare_monitor_seq_id, common_snprint_monitor_seq_id)
 	SFPTPD_DB_FIELD("monitor-timestamp", COMMON_FIELD_MONITOR_TIMESTAMP, common_compare_monitor_timestamp, NULL)
 };
 
@@ -239,8 +242,8 @@ struct sfptpd_db_table_def tx_event_table_def = {
 /* Slave Status table */
 
 struct sfptpd_db_field slave_status_fields[] = {
-	SFPTPD_DB_FIELD("port-id", COMMON_FIELD_PORT_ID, common_compare_port_id, NULL)
-	SFPTPD_DB_FIELD("monitor-seq-id", COMMON_FIELD_MONITOR_SEQ_ID, common_compare_monitor_seq_id, common_snprint_monitor_seq_id)
+	SFPTPD_DB_FIELD_HASHED("port-id", COMMON_FIELD_PORT_ID, common_compare_port_id, NULL)
+	SFPTPD_DB_FIELD_ORDERED("monitor-seq-id", COMMON_FIELD_MONITOR_SEQ_ID, common_compare_monitor_seq_id, common_snprint_monitor_seq_id)
 	SFPTPD_DB_FIELD("monitor-timestamp", COMMON_FIELD_MONITOR_TIMESTAMP, common_compare_monitor_timestamp, NULL)
 };
 
@@ -519,8 +522,8 @@ static void monitor_output_slave_status_text(FILE *stream,
 					     struct sfptpd_ptp_monitor *monitor,
 					     struct sfptpd_db_table *table)
 {
-	struct sfptpd_db_query_result status_result;
-	int i;
+	struct sfptpd_ptp_monitor_slave_status *status, *next;
+	struct sfptpd_db_cursor cursor;
 	const char *format_status_string = "| %25s | %13s | %8s | %6s | %4s | %5s | %4s | %19s |\n";
 	const char *format_status_data = "| " PORT_ID_FORMAT " | %13s |  %c%c%c%c%c%c%c |  %c%c%c%c%c | %4s | %5d | %4d | " CLOCK_ID_FORMAT " |\n";
 
@@ -535,13 +538,16 @@ static void monitor_output_slave_status_text(FILE *stream,
 			     "sync",
 			     "gm-id");
 
-	status_result = sfptpd_db_table_query(table,
-					      SFPTPD_DB_SEL_ORDER_BY,
-					      COMMON_FIELD_MONITOR_SEQ_ID);
+	sfptpd_db_cursor_open(&cursor, table,
+			      SFPTPD_DB_SEL_ORDER_BY,
+			      COMMON_FIELD_MONITOR_SEQ_ID);
 
-	for (i = 0; i < status_result.num_records; i++) {
-		struct sfptpd_ptp_monitor_slave_status *status = status_result.record_ptrs[i];
+	/* Look one record ahead to know which row is the last */
+	next = sfptpd_db_cursor_next(&cursor);
+	while ((status = next) != NULL) {
 		SlaveStatus *s = &status->slave_status;
+
+		next = sfptpd_db_cursor_next(&cursor);
 		const char *state = portState_getName(s->portState);
 
 		/* Remove 'PTP_' prefix from state names */
@@ -551,7 +557,7 @@ static void monitor_output_slave_status_text(FILE *stream,
 			state = "INVALID";
 		}
 
-		sfptpd_log_table_row(stream, i + 1 == status_result.num_records,
+		sfptpd_log_table_row(stream, next == NULL,
 				     format_status_data,
 				     PORT_ID_CONTENT(status->common.port_id),
 				     state,
@@ -573,7 +579,7 @@ static void monitor_output_slave_status_text(FILE *stream,
 				     CLOCK_ID_CONTENT(s->grandmasterIdentity));
 	}
 
-	status_result.free(&status_result);
+	sfptpd_db_cursor_close(&cursor);
 }
 
 
@@ -605,8 +611,8 @@ static void monitor_output_text(struct sfptpd_ptp_monitor *monitor)
 	FILE *stream;
 	struct sfptpd_ptp_monitor_node *node;
 	struct sfptpd_db_query_result nodes_result;
-	struct sfptpd_db_query_result events_result;
-	int i, j;
+	struct sfptpd_db_cursor events_cursor;
+	int i;
 
 	log = sfptpd_log_open_remote_monitor();
 
@@ -665,18 +671,20 @@ static void monitor_output_text(struct sfptpd_ptp_monitor *monitor)
 				     //				     "cumulative-scaled-rate-offset",
 				     "ingress-timestamp");
 
-		events_result = sfptpd_db_table_query(monitor->rx_event_table,
-						      COMMON_FIELD_PORT_ID, &node->port_id,
-						      SFPTPD_DB_SEL_ORDER_BY,
-						      COMMON_FIELD_MONITOR_SEQ_ID);
+		sfptpd_db_cursor_open(&events_cursor, monitor->rx_event_table,
+				      COMMON_FIELD_PORT_ID, &node->port_id,
+				      SFPTPD_DB_SEL_ORDER_BY,
+				      COMMON_FIELD_MONITOR_SEQ_ID);
+
+		struct sfptpd_ptp_monitor_rx_event *rx_event, *next_rx_event;
 
-		for (j = 0; j < events_result.num_records; j++) {
-			struct sfptpd_ptp_monitor_rx_event *rx_event;
+		next_rx_event = sfptpd_db_cursor_next(&events_cursor);
+		while ((rx_event = next_rx_event) != NULL) {
 			sfptpd_time_t offset = NAN;
 			sfptpd_time_t mpd = NAN;
 			struct sfptpd_timespec ts = {};
 
-			rx_event = events_result.record_ptrs[j];
+			next_rx_event = sfptpd_db_cursor_next(&events_cursor);
 			if (rx_event->computed_data_present) {
 				offset = sfptpd_time_scaled_ns_to_float_ns(rx_event->computed_data.offsetFromMaster);
 				mpd = sfptpd_time_scaled_ns_to_float_ns(rx_event->computed_data.meanPathDelay);
@@ -684,7 +692,7 @@ static void monitor_output_text(struct sfptpd_ptp_monitor *monitor)
 			if (rx_event->timing_data_present) {
 				toInternalTime(&ts, &rx_event->timing_data.syncEventIngressTimestamp);
 			}
-			sfptpd_log_table_row(stream, j + 1 == events_result.num_records,
+			sfptpd_log_table_row(stream, next_rx_event == NULL,
 					     format_rx_event_data,
 					     PORT_ID_CONTENT(rx_event->common.ref_port_id),
 					     rx_event->common.event_seq_id,
@@ -692,7 +700,7 @@ static void monitor_output_text(struct sfptpd_ptp_monitor *monitor)
 					     mpd,
 					     ts.sec, ts.nsec);
 		}
-		events_result.free(&events_result);
+		sfptpd_db_cursor_close(&events_cursor);
 
 		fprintf(stream,
 			"\nlog of recent tx events on monitored slave port "
@@ -709,28 +717,30 @@ static void monitor_output_text(struct sfptpd_ptp_monitor *monitor)
 				     "seq",
 				     "egress-timestamp");
 
-		events_result = sfptpd_db_table_query(monitor->tx_event_table,
-						      COMMON_FIELD_PORT_ID, &node->port_id,
-						      SFPTPD_DB_SEL_ORDER_BY,
-						      COMMON_FIELD_MONITOR_SEQ_ID);
+		sfptpd_db_cursor_open(&events_cursor, monitor->tx_event_table,
+				      COMMON_FIELD_PORT_ID, &node->port_id,
+				      SFPTPD_DB_SEL_ORDER_BY,
+				      COMMON_FIELD_MONITOR_SEQ_ID);
+
+		struct sfptpd_ptp_monitor_tx_event *tx_event, *next_tx_event;
 
-		for (j = 0; j < events_result.num_records; j++) {
-			struct sfptpd_ptp_monitor_tx_event *tx_event;
+		next_tx_event = sfptpd_db_cursor_next(&events_cursor);
+		while ((tx_event = next_tx_event) != NULL) {
 			struct sfptpd_timespec ts = {};
 			const char *mtype;
 
-			tx_event = events_result.record_ptrs[j];
+			next_tx_event = sfptpd_db_cursor_next(&events_cursor);
 			toInternalTime(&ts, &tx_event->timestamp.eventEgressTimestamp);
 			mtype = outgoing_event_msg_name(tx_event->message_type);
 
-			sfptpd_log_table_row(stream, j + 1 == events_result.num_records,
+			sfptpd_log_table_row(stream, next_tx_event == NULL,
 					     format_tx_event_data,
 					     PORT_ID_CONTENT(tx_event->common.ref_port_id),
 					     mtype,
 					     tx_event->common.event_seq_id,
 					     ts.sec, ts.nsec);
 		}
-		events_result.free(&events_result);
+		sfptpd_db_cursor_close(&events_cursor);
 	}
 	nodes_result.free(&nodes_result);
 
@@ -11,6 +11,7 @@
 #include <stddef.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <signal.h>
 #include <math.h>
@@ -44,6 +45,33 @@ struct ordered_instance {
 	int decisive_rule_index;
 };
 
+/* Number of key words per selection rule */
+#define KEY_WORDS_PER_RULE (2)
+
+/* Maximum number of words in a rank key */
+#define KEY_WORDS_MAX (KEY_WORDS_PER_RULE * SELECTION_RULE_MAX)
+
+/* An instance in an incremental ranking.
+ * @record: The sync instance record
+ * @position: Index of this instance in the ranking order
+ * @key: Rank key packed from the instance's status under the policy,
+ * compared word by word with lower values ranking higher
+ */
+struct ranked_instance {
+	struct sync_instance_record *record;
+	int position;
+	uint64_t key[KEY_WORDS_MAX];
+};
+
+struct sfptpd_bic_ranking {
+	const struct sfptpd_selection_policy *policy;
+	struct sync_instance_record *records;
+	int num_instances;
+	int key_words;
+	struct ranked_instance *instances;
+	struct ranked_instance **order;
+};
+
 
 /****************************************************************************
  * Constants
@@ -337,6 +365,158 @@ static struct sync_instance_record *sfptpd_bic_select(const struct sfptpd_select
 }
 
 
+/* Pack a signed integer into a rank key, lower values ranking higher */
+static void key_from_int(uint64_t *key, int64_t value)
+{
+	key[0] = (uint64_t) value ^ (1ULL << 63);
+	key[1] = 0;
+}
+
+
+/* Pack a floating point value into a rank key, lower values ranking higher.
+ * The exponent and 64 bits of mantissa are kept so the order matches
+ * comparison of the values themselves; NaN ranks last. */
+static void key_from_float(uint64_t *key, long double value)
+{
+	uint64_t exponent, mantissa;
+	int exp;
+
+	if (isnan(value)) {
+		key[0] = key[1] = UINT64_MAX;
+		return;
+	}
+
+	if (value == 0.0L) {
+		exponent = mantissa = 0;
+	} else if (isinf(value)) {
+		exponent = 1ULL << 21;
+		mantissa = 0;
+	} else {
+		mantissa = (uint64_t) ldexpl(frexpl(fabsl(value), &exp), 64);
+		exponent = (uint64_t) (exp + (1 << 20));
+	}
+
+	if (value >= 0.0L) {
+		key[0] = (1ULL << 62) + exponent;
+		key[1] = mantissa;
+	} else {
+		key[0] = (1ULL << 62) - 1 - exponent;
+		key[1] = ~mantissa;
+	}
+}
+
+
+/* Compute the rank key of an instance under a policy, one pair of words
+ * per rule in the order of the policy and ending with the tie-break. */
+static void rank_key(const struct sfptpd_bic_ranking *ranking,
+		     const struct sync_instance_record *record,
+		     uint64_t *key)
+{
+	const struct sfptpd_sync_instance_status *status = &record->status;
+	const struct sfptpd_selection_policy *policy = ranking->policy;
+	double total_accuracy;
+	int rule_idx;
+
+	assert(status->state < SYNC_MODULE_STATE_MAX);
+
+	for (rule_idx = 0; ; rule_idx++, key += KEY_WORDS_PER_RULE) {
+		switch (policy->rules[rule_idx]) {
+		case SELECTION_RULE_MANUAL:
+			key_from_int(key, record->selected ? 0 : 1);
+			break;
+		case SELECTION_RULE_EXT_CONSTRAINTS:
+			key_from_int(key, ext_constraint_priority(status->constraints));
+			break;
+		case SELECTION_RULE_STATE:
+			key_from_int(key, sfptpd_state_priorities[status->state]);
+			break;
+		case SELECTION_RULE_NO_ALARMS:
+			key_from_int(key, status->alarms == 0 ? 0 : 1);
+			break;
+		case SELECTION_RULE_USER_PRIORITY:
+			key_from_int(key, status->user_priority);
+			break;
+		case SELECTION_RULE_CLUSTERING:
+			/* Higher scores are preferred */
+			key_from_int(key, -(int64_t) status->clustering_score);
+			break;
+		case SELECTION_RULE_CLOCK_CLASS:
+			key_from_int(key, status->master.clock_class);
+			break;
+		case SELECTION_RULE_TOTAL_ACCURACY:
+			total_accuracy = status->master.accuracy + status->local_accuracy;
+			key_from_float(key, total_accuracy);
+			break;
+		case SELECTION_RULE_ALLAN_VARIANCE:
+			key_from_float(key, status->master.allan_variance);
+			break;
+		case SELECTION_RULE_STEPS_REMOVED:
+			key_from_int(key, status->master.steps_removed);
+			break;
+		case SELECTION_RULE_TIE_BREAK:
+			/* The lowest record pointer is chosen */
+			key_from_int(key, record - ranking->records);
+			return;
+		default:
+			assert(!"Invalid selection rule in policy");
+		}
+	}
+}
+
+
+static int rank_key_compare(const struct sfptpd_bic_ranking *ranking,
+			    const uint64_t *a, const uint64_t *b)
+{
+	int i;
+
+	for (i = 0; i < ranking->key_words; i++) {
+		if (a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+
+/* Find the position at which an instance belongs among the others */
+static int rank_search(const struct sfptpd_bic_ranking *ranking,
+		       const struct ranked_instance *instance)
+{
+	int lo = 0;
+	int hi = ranking->num_instances;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (rank_key_compare(ranking, ranking->order[mid]->key,
+				     instance->key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+
+/* Update the positions and diagnostic ranks of part of the order */
+static void rank_renumber(struct sfptpd_bic_ranking *ranking, int from, int to)
+{
+	for (; from <= to; from++) {
+		ranking->order[from]->position = from;
+		ranking->order[from]->record->rank = from + 1;
+	}
+}
+
+
+static int ranked_instance_compar(const void *a, const void *b, void *context)
+{
+	const struct sfptpd_bic_ranking *ranking = context;
+	const struct ranked_instance *aa = *(const struct ranked_instance **) a;
+	const struct ranked_instance *bb = *(const struct ranked_instance **) b;
+
+	return rank_key_compare(ranking, aa->key, bb->key);
+}
+
+
 static int ordered_instance_compar(const void *a, const void *b, void *context) {
 	const struct sfptpd_selection_policy *policy = (struct sfptpd_selection_policy *) context;
 
@@ -415,6 +595,152 @@ struct sync_instance_record *sfptpd_bic_choose(const struct sfptpd_selection_pol
 	return result;
 }
 
+struct sfptpd_bic_ranking *sfptpd_bic_ranking_create(const struct sfptpd_selection_policy *policy,
+						     struct sync_instance_record *instance_records,
+						     int num_instances)
+{
+	struct sfptpd_bic_ranking *ranking;
+	int rule_idx;
+
+	assert(policy != NULL);
+	assert(num_instances > 0);
+
+	ranking = calloc(1, sizeof *ranking);
+	if (ranking == NULL)
+		return NULL;
+
+	ranking->instances = calloc(num_instances, sizeof *ranking->instances);
+	ranking->order = calloc(num_instances, sizeof *ranking->order);
+	if (ranking->instances == NULL || ranking->order == NULL) {
+		sfptpd_bic_ranking_free(ranking);
+		return NULL;
+	}
+
+	for (rule_idx = 0; policy->rules[rule_idx] != SELECTION_RULE_END; rule_idx++);
+
+	ranking->policy = policy;
+	ranking->records = instance_records;
+	ranking->num_instances = num_instances;
+	ranking->key_words = (rule_idx + 1) * KEY_WORDS_PER_RULE;
+	assert(ranking->key_words <= KEY_WORDS_MAX);
+
+	sfptpd_bic_ranking_update_all(ranking);
+
+	return ranking;
+}
+
+
+void sfptpd_bic_ranking_free(struct sfptpd_bic_ranking *ranking)
+{
+	if (ranking != NULL) {
+		free(ranking->instances);
+		free(ranking->order);
+		free(ranking);
+	}
+}
+
+
+void sfptpd_bic_ranking_update(struct sfptpd_bic_ranking *ranking,
+			       struct sync_instance_record *record)
+{
+	struct ranked_instance *instance;
+	uint64_t key[KEY_WORDS_MAX];
+	int old_pos, new_pos;
+
+	assert(ranking != NULL);
+	assert(record >= ranking->records &&
+	       record < ranking->records + ranking->num_instances);
+
+	instance = &ranking->instances[record - ranking->records];
+
+	rank_key(ranking, record, key);
+	if (rank_key_compare(ranking, key, instance->key) == 0)
+		return;
+
+	/* Take the instance out of the order and put it back in its new
+	 * place, moving only the instances in between */
+	old_pos = instance->position;
+	memmove(&ranking->order[old_pos], &ranking->order[old_pos + 1],
+		(ranking->num_instances - old_pos - 1) * sizeof *ranking->order);
+	ranking->num_instances--;
+
+	memcpy(instance->key, key, sizeof key);
+	new_pos = rank_search(ranking, instance);
+
+	memmove(&ranking->order[new_pos + 1], &ranking->order[new_pos],
+		(ranking->num_instances - new_pos) * sizeof *ranking->order);
+	ranking->order[new_pos] = instance;
+	ranking->num_instances++;
+
+	if (new_pos < old_pos)
+		rank_renumber(ranking, new_pos, old_pos);
+	else
+		rank_renumber(ranking, old_pos, new_pos);
+
+	DBG_L3("selection: %s moved from rank %d to %d\n",
+	       record->info.name, old_pos + 1, new_pos + 1);
+}
+
+
+void sfptpd_bic_ranking_update_all(struct sfptpd_bic_ranking *ranking)
+{
+	struct ranked_instance *instance;
+	int i;
+
+	assert(ranking != NULL);
+
+	for (i = 0; i < ranking->num_instances; i++) {
+		instance = &ranking->instances[i];
+		instance->record = &ranking->records[i];
+		rank_key(ranking, instance->record, instance->key);
+		ranking->order[i] = instance;
+	}
+
+	qsort_r(ranking->order, ranking->num_instances, sizeof *ranking->order,
+		ranked_instance_compar, ranking);
+
+	rank_renumber(ranking, 0, ranking->num_instances - 1);
+}
+
+
+struct sync_instance_record *sfptpd_bic_ranking_choose(struct sfptpd_bic_ranking *ranking,
+						       struct sync_instance_record *old_candidate)
+{
+	const struct sfptpd_selection_policy *policy;
+	struct sync_instance_record *best;
+	int decisive_rule_index;
+	int i;
+
+	assert(ranking != NULL);
+
+	policy = ranking->policy;
+	best = ranking->order[0]->record;
+
+	if (ranking->num_instances == 1 || best == old_candidate)
+		return best;
+
+	/* Report the ranking and the rule deciding each place */
+	for (i = 0; i < ranking->num_instances - 1; i++) {
+		sfptpd_bic_select(policy, ranking->order[i]->record,
+				  ranking->order[i + 1]->record,
+				  &decisive_rule_index,
+				  "(checking-decisive-rule)");
+
+		INFO("selection: rank %i: %s by rule %s (%d)%s\n",
+		     i + 1,
+		     ranking->order[i]->record->info.name,
+		     get_selection_rule_name(policy->rules[decisive_rule_index]),
+		     decisive_rule_index,
+		     i == 0 ? " <- BEST" : "");
+	}
+	INFO("selection: rank %i: %s <- WORST\n",
+	     ranking->num_instances,
+	     ranking->order[ranking->num_instances - 1]->record->info.name);
+
+	return best;
+}
+
+
 void sfptpd_bic_select_instance(struct sync_instance_record *instance_records,
 				int num_instances,
 				struct sync_instance_record *selected_instance)
@@ -28,6 +28,7 @@
 #include <linux/sockios.h>
 #include <linux/socket.h>
 #include <linux/if_ether.h>
+#include <pthread.h>
 
 #include "efx_ioctl.h"
 #include "sfptpd_logging.h"
@@ -37,6 +38,7 @@
 #include "sfptpd_constants.h"
 #include "sfptpd_statistics.h"
 #include "sfptpd_time.h"
+#include "sfptpd_metrics.h"
 #include "sfptpd_interface.h"
 #include "sfptpd_misc.h"
 #include "sfptpd_thread.h"
@@ -111,6 +113,10 @@ static const struct sfptpd_clock_spec sfptpd_clock_specifications[] =
 /* Threshold for reporting failed clock comparisons */
 #define CLOCK_BAD_COMPARE_WARN_THRESHOLD (16)
 
+/* Time allowed for the workers in a coordinated step to start before the
+ * common deadline at which they step their clocks */
+#define CLOCK_STEP_LEAD_TIME_NS (2000000)
+
 /* Stats ids */
 enum clock_stats_ids {
 	CLOCK_STATS_ID_OFFSET,
@@ -119,6 +125,7 @@ enum clock_stats_ids {
 	CLOCK_STATS_ID_SYNC_FAIL,
 	CLOCK_STATS_ID_NEAR_EPOCH,
 	CLOCK_STATS_ID_CLUSTERING,
+	CLOCK_STATS_ID_OFFSET_QUANTILES,
 };
 
 
@@ -242,6 +249,18 @@ struct sfptpd_clock {
 };
 
 
+/* One clock's share of a coordinated step */
+struct clock_step_work {
+	struct sfptpd_clock *clock;
+	struct timex t;
+	struct sfptpd_timespec deadline;
+	struct sfptpd_timespec done;
+	bool threaded;
+	pthread_t thread;
+	int rc;
+};
+
+
 /****************************************************************************
  * Static data
  ****************************************************************************/
@@ -262,6 +281,7 @@ static const struct sfptpd_stats_collection_defn clock_stats_defns[] =
 	{CLOCK_STATS_ID_SYNC_FAIL,    SFPTPD_STATS_TYPE_COUNT, "sync-failures"},
 	{CLOCK_STATS_ID_NEAR_EPOCH,   SFPTPD_STATS_TYPE_COUNT, "epoch-alarms"},
 	{CLOCK_STATS_ID_CLUSTERING,   SFPTPD_STATS_TYPE_COUNT, "clustering-alarms"},
+	{CLOCK_STATS_ID_OFFSET_QUANTILES, SFPTPD_STATS_TYPE_QUANTILE, "offset-quantiles", "ns", 3},
 };
 
 /* Define the uninitialised clock identity.
@@ -643,6 +663,7 @@ static int new_system_clock(struct sfptpd_config_general *config,
 
 	configure_new_clock(new, config);
 	sfptpd_clock_correct_new(new);
+	sfptpd_stats_collection_persist(&new->stats, new, NULL);
 
 	*clock = new;
 	return 0;
@@ -731,10 +752,10 @@ static int clock_compare_using_efx(void *context, struct sfptpd_timespec *diff)
 
 static int renew_clock(struct sfptpd_clock *clock)
 {
-	struct sfptpd_db_query_result interface_index_snapshot;
+	struct sfptpd_db_cursor interface_cursor;
 	struct sfptpd_config_general *general_config;
 	struct sfptpd_interface *interface, *primary;
-	int i, nic_id;
+	int nic_id;
 	int phc_idx;
 	bool supports_phc = false;
 	bool supports_efx;
@@ -753,19 +774,16 @@ static int renew_clock(struct sfptpd_clock *clock)
 
 	general_config = sfptpd_general_config_get(sfptpd_clock_config);
 
-	/* Get an index of the active PTP capable interfaces. Note that the
-	 * index is ordered by NIC ID and then by increasing MAC address.
+	/* Iterate over the active PTP capable interfaces. Note that the
+	 * cursor is ordered by NIC ID and then by increasing MAC address.
 	 * This hugely reduces the pain of initialising the clock. */
-	interface_index_snapshot = sfptpd_interface_get_active_ptp_snapshot();
+	sfptpd_interface_cursor_open_active_ptp(&interface_cursor);
 
 	/* Find the primary interface associated with the clock. This will be the
 	 * first interface we come to with the matching NIC ID. */
 	primary = NULL;
-	for (i = 0; (i < interface_index_snapshot.num_records) &&
-		    ((primary == NULL) || !supports_phc); i++) {
-		struct sfptpd_interface **intfp = interface_index_snapshot.record_ptrs[i];
-		interface = *intfp;
-
+	while (((primary == NULL) || !supports_phc) &&
+	       (interface = sfptpd_interface_cursor_next(&interface_cursor)) != NULL) {
 		nic_id = sfptpd_interface_get_nic_id(interface);
 		if (nic_id == clock->u.nic.nic_id) {
 			primary = interface;
@@ -814,6 +832,7 @@ static int renew_clock(struct sfptpd_clock *clock)
 				      strerror(errno));
 				clock->u.nic.device_idx = -1;
 				clock->posix_id = POSIX_ID_NULL;
+				sfptpd_db_cursor_close(&interface_cursor);
 				return errno;
 			}
 			clock->posix_id = sfptpd_phc_get_clock_id(clock->u.nic.phc);
@@ -834,9 +853,7 @@ static int renew_clock(struct sfptpd_clock *clock)
 		name_len = snprintf(clock->intfs_list, sizeof(clock->intfs_list),
 				    "%s", sfptpd_interface_get_name(clock->u.nic.primary_if));
 		if (name_len > sizeof(clock->intfs_list)) name_len = sizeof(clock->intfs_list);
-		for ( ; i < interface_index_snapshot.num_records; i++) {
-			struct sfptpd_interface **intfp = interface_index_snapshot.record_ptrs[i];
-			interface = *intfp;
+		while ((interface = sfptpd_interface_cursor_next(&interface_cursor)) != NULL) {
 			nic_id = sfptpd_interface_get_nic_id(interface);
 			if (nic_id == clock->u.nic.nic_id) {
 				name_len += snprintf(clock->intfs_list + name_len,
@@ -923,7 +940,7 @@ static int renew_clock(struct sfptpd_clock *clock)
 		TRACE_L4("clock %s: is deleted\n", clock->short_name);
 	}
 
-	interface_index_snapshot.free(&interface_index_snapshot);
+	sfptpd_db_cursor_close(&interface_cursor);
 
 	return rc;
 }
@@ -968,6 +985,9 @@ static int new_nic_clock(int nic_id, sfptpd_clock_type_t type,
 		goto finish;
 	}
 
+	/* The clock's file name is now known */
+	sfptpd_stats_collection_persist(&new->stats, new, NULL);
+
 	*clock = new;
 
 finish:
@@ -1152,18 +1172,16 @@ int sfptpd_clock_initialise(struct sfptpd_config *config, pthread_mutex_t *hardw
 
 void sfptpd_clock_rescan_interfaces(void) {
 	struct sfptpd_clock *clock;
-	struct sfptpd_db_query_result interface_index_snapshot;
-	int i;
+	struct sfptpd_db_cursor interface_cursor;
+	struct sfptpd_interface *intf;
 
 	clock_lock();
-	interface_index_snapshot = sfptpd_interface_get_active_ptp_snapshot();
+	sfptpd_interface_cursor_open_active_ptp(&interface_cursor);
 
 	/* Iterate over the interfaces, find the clock associated with each
 	 * interface and link the two. Where a clock doesn't exist, create it.
 	 */
-	for (i = 0; i < interface_index_snapshot.num_records; i++) {
-		struct sfptpd_interface **intfp = interface_index_snapshot.record_ptrs[i];
-		struct sfptpd_interface *intf = *intfp;
+	while ((intf = sfptpd_interface_cursor_next(&interface_cursor)) != NULL) {
 		int nic_id = sfptpd_interface_get_nic_id(intf);
 
 		assert(!sfptpd_interface_is_deleted(intf));
@@ -1181,7 +1199,7 @@ void sfptpd_clock_rescan_interfaces(void) {
 		(void)renew_clock(clock);
 	}
 
-	interface_index_snapshot.free(&interface_index_snapshot);
+	sfptpd_db_cursor_close(&interface_cursor);
 
 	clock_dump_list("all", sfptpd_clock_list_head, 4);
 	clock_unlock();
@@ -1567,6 +1585,8 @@ void sfptpd_clock_stats_record_offset(struct sfptpd_clock *clock,
 	sfclock_gettime(CLOCK_REALTIME, &now);
 	sfptpd_stats_collection_update_range(stats, CLOCK_STATS_ID_OFFSET,
 					     offset, now, true);
+	sfptpd_stats_collection_update_quantile(stats, CLOCK_STATS_ID_OFFSET_QUANTILES,
+						offset, true);
 	sfptpd_stats_collection_update_count(stats, CLOCK_STATS_ID_SYNCHRONIZED,
 					     synchronized? 1: 0);
 	clock_unlock();
@@ -1628,6 +1648,50 @@ void sfptpd_clock_stats_end_period(struct sfptpd_clock *clock,
 }
 
 
+void sfptpd_clock_stats_write_metrics(struct sfptpd_json_buf *buf,
+				      struct sfptpd_clock **clocks,
+				      unsigned int num_clocks)
+{
+	struct sfptpd_stats_collection **collections;
+	char (*labels)[SFPTPD_METRICS_LABELS_MAX];
+	const char **label_ptrs;
+	int i;
+
+	assert(buf != NULL);
+	assert(clocks != NULL || num_clocks == 0);
+
+	if (num_clocks == 0)
+		return;
+
+	collections = calloc(num_clocks, sizeof *collections);
+	labels = calloc(num_clocks, sizeof *labels);
+	label_ptrs = calloc(num_clocks, sizeof *label_ptrs);
+	if (collections == NULL || labels == NULL || label_ptrs == NULL)
+		goto finish;
+
+	clock_lock();
+
+	for (i = 0; i < num_clocks; i++) {
+		assert(clocks[i]->magic == SFPTPD_CLOCK_MAGIC);
+		collections[i] = &clocks[i]->stats;
+		sfptpd_metrics_labels(labels[i], sizeof labels[i],
+				      "clock", clocks[i]->short_name, NULL);
+		label_ptrs[i] = labels[i];
+	}
+
+	sfptpd_stats_collections_write_metrics(collections, label_ptrs,
+					       num_clocks, buf,
+					       SFPTPD_METRICS_PREFIX "_clock");
+
+	clock_unlock();
+
+finish:
+	free(label_ptrs);
+	free(labels);
+	free(collections);
+}
+
+
 /****************************************************************************/
 
 /* Not locked because it is an atomic operation. */
@@ -1745,50 +1809,91 @@ long double sfptpd_clock_get_max_frequency_adjustment(struct sfptpd_clock *clock
 
 /****************************************************************************/
 
-int sfptpd_clock_adjust_time(struct sfptpd_clock *clock, struct sfptpd_timespec *offset)
+/* Check whether a clock may be stepped. Called with the lock held.
+ * Returns false if the clock is not to be stepped, with *rc set to an
+ * errno if this is an error rather than the step being blocked. */
+static bool clock_step_allowed(struct sfptpd_clock *clock, int *rc)
 {
-	int rc = 0;
-	struct timex t;
-
-	clock_lock();
-
 	assert(clock != NULL);
 	assert(clock->magic == SFPTPD_CLOCK_MAGIC);
-	assert(offset != NULL);
+
+	*rc = 0;
 
 	if (clock->type != SFPTPD_CLOCK_TYPE_SYSTEM &&
 	    clock->u.nic.phc == NULL) {
 		ERROR("clock %s: unable to step clock - no phc device\n",
 		      clock->long_name);
-		rc = ENODEV;
-		goto finish;
+		*rc = ENODEV;
+		return false;
 	}
 
 	if (clock->read_only) {
 		NOTICE("clock %s: adjust time blocked by \"clock-control no-adjust\" or \"clock-readonly\"\n",
 		       clock->long_name);
-		goto finish;
+		return false;
 	}
 
 	if (clock->blocked_count > 0) {
 		NOTICE("clock %s: adjust time temporarily blocked\n",
 		       clock->long_name);
-		goto finish;
+		return false;
 	}
 
+	return true;
+}
+
+
+/* Fill in the timex structure to step a clock. Called with the lock held. */
+static void clock_step_timex(struct sfptpd_clock *clock,
+			     const struct sfptpd_timespec *offset,
+			     struct timex *t)
+{
 	INFO("clock %s: applying offset %0.9Lf seconds\n",
 	     clock->short_name, sfptpd_time_timespec_to_float_s(offset));
 
-	memset(&t, 0, sizeof(t));
-	t.modes = ADJ_SETOFFSET | ADJ_NANO;
-	t.time.tv_sec  = offset->sec;
-	t.time.tv_usec = offset->nsec;
+	memset(t, 0, sizeof(*t));
+	t->modes = ADJ_SETOFFSET | ADJ_NANO;
+	t->time.tv_sec  = offset->sec;
+	t->time.tv_usec = offset->nsec;
 
 	if (clock->type == SFPTPD_CLOCK_TYPE_SYSTEM &&
 	    clock->cfg_rtc_adjust) {
-		t.modes |= ADJ_STATUS;
-		t.status = clock->u.system.kernel_status;
+		t->modes |= ADJ_STATUS;
+		t->status = clock->u.system.kernel_status;
 	}
+}
+
+
+/* Wait for the common deadline and then step one clock */
+static void *clock_step_thread(void *context)
+{
+	struct clock_step_work *work = (struct clock_step_work *) context;
+
+	while (sfclock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				 &work->deadline, NULL) == EINTR);
+
+	work->rc = (clock_adjtime(work->clock->posix_id, &work->t) < 0) ? errno : 0;
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &work->done);
+
+	return NULL;
+}
+
+
+int sfptpd_clock_adjust_time(struct sfptpd_clock *clock, struct sfptpd_timespec *offset)
+{
+	int rc = 0;
+	struct timex t;
+
+	clock_lock();
+
+	assert(clock != NULL);
+	assert(clock->magic == SFPTPD_CLOCK_MAGIC);
+	assert(offset != NULL);
+
+	if (!clock_step_allowed(clock, &rc))
+		goto finish;
+
+	clock_step_timex(clock, offset, &t);
 
 	rc = clock_adjtime(clock->posix_id, &t);
 	if (rc < 0) {
@@ -1809,6 +1914,117 @@ finish:
 }
 
 
+int sfptpd_clock_adjust_time_multi(struct sfptpd_clock **clocks,
+				   struct sfptpd_timespec *offsets,
+				   int *results,
+				   int num_clocks,
+				   struct sfptpd_timespec *spread)
+{
+	struct clock_step_work *work;
+	struct sfptpd_timespec deadline;
+	struct sfptpd_timespec first, last;
+	int num_work;
+	int rc = 0;
+	int i, j;
+
+	assert(clocks != NULL || num_clocks == 0);
+	assert(offsets != NULL || num_clocks == 0);
+	assert(results != NULL || num_clocks == 0);
+
+	if (spread != NULL)
+		sfptpd_time_zero(spread);
+
+	if (num_clocks == 0)
+		return 0;
+
+	work = calloc(num_clocks, sizeof *work);
+	if (work == NULL)
+		return errno;
+
+	clock_lock();
+
+	/* Work out all the steps up front so that the workers need only
+	 * make the system call */
+	num_work = 0;
+	for (i = 0; i < num_clocks; i++) {
+		if (!clock_step_allowed(clocks[i], &results[i]))
+			continue;
+		work[num_work].clock = clocks[i];
+		clock_step_timex(clocks[i], &offsets[i], &work[num_work].t);
+		num_work++;
+	}
+
+	/* Each clock is stepped by its own thread at a common deadline so
+	 * that they are all stepped as close to the same instant as possible.
+	 * The calling thread takes the first clock. */
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &deadline);
+	if (num_work > 1) {
+		struct sfptpd_timespec lead;
+
+		sfptpd_time_from_ns(&lead, CLOCK_STEP_LEAD_TIME_NS);
+		sfptpd_time_add(&deadline, &deadline, &lead);
+	}
+
+	for (i = 0; i < num_work; i++) {
+		work[i].deadline = deadline;
+		if (i == 0)
+			continue;
+		j = pthread_create(&work[i].thread, NULL, clock_step_thread, &work[i]);
+		if (j == 0)
+			work[i].threaded = true;
+		else
+			WARNING("clock: could not create step thread, %s\n",
+				strerror(j));
+	}
+
+	/* Step our own clock and any the workers could not be created for */
+	for (i = 0; i < num_work; i++)
+		if (!work[i].threaded)
+			clock_step_thread(&work[i]);
+
+	for (i = 0; i < num_work; i++) {
+		if (work[i].threaded)
+			pthread_join(work[i].thread, NULL);
+
+		if (i == 0 || sfptpd_time_is_greater_or_equal(&first, &work[i].done))
+			first = work[i].done;
+		if (i == 0 || sfptpd_time_is_greater_or_equal(&work[i].done, &last))
+			last = work[i].done;
+	}
+
+	/* Copy out the results in the order of the clocks passed in */
+	for (i = 0, j = 0; i < num_clocks && j < num_work; i++) {
+		if (clocks[i] != work[j].clock)
+			continue;
+		results[i] = work[j].rc;
+		if (work[j].rc != 0)
+			WARNING("clock %s: failed to step clock using clock_adjtime(), %s\n",
+				clocks[i]->long_name, strerror(work[j].rc));
+		j++;
+	}
+
+	for (i = 0; i < num_clocks; i++)
+		if (rc == 0)
+			rc = results[i];
+
+	if (num_work > 0) {
+		/* Record step for all PHC clocks to avoid stale comparisons */
+		clock_record_step();
+
+		sfptpd_time_subtract(&last, &last, &first);
+		if (num_work > 1)
+			INFO("clock: stepped %d clocks together, spread %0.3Lf us\n",
+			     num_work, sfptpd_time_timespec_to_float_ns(&last) / 1000.0);
+		if (spread != NULL)
+			*spread = last;
+	}
+
+	clock_unlock();
+	free(work);
+	return rc;
+}
+
+
 int sfptpd_clock_adjust_frequency(struct sfptpd_clock *clock, long double freq_adj_ppb)
 {
 	int rc = 0;
@@ -1975,7 +2191,11 @@ int sfptpd_clock_schedule_leap_second(enum sfptpd_leap_second_type type)
 int sfptpd_clock_leap_second_now(enum sfptpd_leap_second_type type)
 {
 	struct sfptpd_clock *clock;
-	struct sfptpd_timespec step;
+	struct sfptpd_clock **clocks;
+	struct sfptpd_timespec *steps;
+	int *results;
+	int num_clocks;
+	int rc;
 
 	struct sfptpd_config_general *config = sfptpd_general_config_get(sfptpd_clock_config);
 
@@ -1984,22 +2204,48 @@ int sfptpd_clock_leap_second_now(enum sfptpd_leap_second_type type)
 		return EINVAL;
 	}
 
-	sfptpd_time_from_s(&step, (type == SFPTPD_LEAP_SECOND_59)? 1: -1);
-
 	/* No action is required for the system clock as it supports leap
 	 * second scheduling rather than manually stepping the clock at
 	 * midnight */
 	clock_lock();
+	num_clocks = 0;
+	for (clock = sfptpd_clock_list_head; clock != NULL; clock = clock->next)
+		num_clocks++;
+
+	clocks = calloc(num_clocks, sizeof *clocks);
+	steps = calloc(num_clocks, sizeof *steps);
+	results = calloc(num_clocks, sizeof *results);
+	if (num_clocks != 0 && (clocks == NULL || steps == NULL || results == NULL)) {
+		rc = errno;
+		ERROR("clock: could not allocate leap second step, %s\n",
+		      strerror(rc));
+		goto finish;
+	}
+
+	num_clocks = 0;
 	for (clock = sfptpd_clock_list_head; clock != NULL; clock = clock->next) {
 		if ((clock->type == SFPTPD_CLOCK_TYPE_SFC) ||
 		    (clock->type == SFPTPD_CLOCK_TYPE_XNET) ||
 		    (clock->type == SFPTPD_CLOCK_TYPE_NON_SFC && config->non_sfc_nics)) {
-			sfptpd_clock_adjust_time(clock, &step);
+			clocks[num_clocks] = clock;
+			sfptpd_time_from_s(&steps[num_clocks],
+					   (type == SFPTPD_LEAP_SECOND_59)? 1: -1);
+			num_clocks++;
 		}
 	}
-	clock_unlock();
 
-	return 0;
+	/* Step the NIC clocks together so that they do not disagree by a
+	 * second while the leap is being applied */
+	(void)sfptpd_clock_adjust_time_multi(clocks, steps, results,
+					     num_clocks, NULL);
+	rc = 0;
+
+finish:
+	clock_unlock();
+	free(clocks);
+	free(steps);
+	free(results);
+	return rc;
 }
 
 
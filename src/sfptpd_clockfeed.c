@@ -36,6 +36,8 @@
 #include "sfptpd_engine.h"
 #include "sfptpd_sync_module.h"
 #include "sfptpd_multicast.h"
+#include "sfptpd_metrics.h"
+#include "sfptpd_startup.h"
 
 #include "sfptpd_clockfeed.h"
 
@@ -237,6 +239,10 @@ struct sfptpd_clockfeed {
 
 	/* Clock feed statistics */
 	struct sfptpd_stats_collection stats;
+
+	/* Metrics published by the clock feed, about once per second */
+	struct sfptpd_metrics_source *metrics_source;
+	uint64_t metrics_cycles;
 };
 
 
@@ -319,6 +325,53 @@ static void clockfeed_reap_zombies(struct sfptpd_clockfeed *module,
 	}
 }
 
+static void clockfeed_write_metrics(struct sfptpd_json_buf *buf, void *context)
+{
+	struct sfptpd_clockfeed *clockfeed = (struct sfptpd_clockfeed *) context;
+	struct sfptpd_stats_collection *collection = &clockfeed->stats;
+	const char *collection_labels = "";
+	const uint32_t index_mask = (1 << MAX_CLOCK_SAMPLES_LOG2) - 1;
+	char labels[SFPTPD_METRICS_LABELS_MAX];
+	char name[SFPTPD_METRICS_NAME_MAX];
+	struct clockfeed_source *source;
+	struct sfptpd_clockfeed_sample *record;
+
+	sfptpd_stats_collections_write_metrics(&collection, &collection_labels, 1,
+					       buf, SFPTPD_METRICS_PREFIX "_clockfeed");
+
+	sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX "_clockfeed",
+			      "samples", NULL, SFPTPD_METRICS_TYPE_COUNTER,
+			      "Number of clock comparisons made");
+	for (source = clockfeed->active; source; source = source->next) {
+		sfptpd_metrics_labels(labels, sizeof labels, "clock",
+				      sfptpd_clock_get_short_name(source->clock), NULL);
+		sfptpd_metrics_sample(buf, name, "_total", labels,
+				      source->shm.write_counter, 0);
+	}
+
+	sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX "_clockfeed",
+			      "poll_period", "seconds", SFPTPD_METRICS_TYPE_GAUGE,
+			      "Interval between clock comparisons");
+	for (source = clockfeed->active; source; source = source->next) {
+		sfptpd_metrics_labels(labels, sizeof labels, "clock",
+				      sfptpd_clock_get_short_name(source->clock), NULL);
+		sfptpd_metrics_sample(buf, name, NULL, labels,
+				      ldexpl(1.0L, source->poll_period_log2), 9);
+	}
+
+	sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX "_clockfeed",
+			      "last_error", NULL, SFPTPD_METRICS_TYPE_GAUGE,
+			      "Error code of the latest clock comparison");
+	for (source = clockfeed->active; source; source = source->next) {
+		if (source->shm.write_counter == 0)
+			continue;
+		record = &source->shm.samples[(source->shm.write_counter - 1) & index_mask];
+		sfptpd_metrics_labels(labels, sizeof labels, "clock",
+				      sfptpd_clock_get_short_name(source->clock), NULL);
+		sfptpd_metrics_sample(buf, name, NULL, labels, record->rc, 0);
+	}
+}
+
 /* This is the key function of the clock feed component. Periodically sample
  * all clock differences (against the system clock) for all interesting clocks.
  * These may have different cadences configured (internally - this is not used
@@ -360,11 +413,12 @@ static void clockfeed_on_timer(void *user_context, unsigned int id)
 			sfclock_gettime(CLOCK_REALTIME, &realtime);
 			record->system = realtime;
 
-			if (record->rc == 0)
+			if (record->rc == 0) {
 				sfptpd_time_add(&record->snapshot,
 						&record->system,
 						&diff);
-			else
+				sfptpd_startup_mark(SFPTPD_STARTUP_FIRST_CLOCKFEED_SAMPLE);
+			} else
 				sfptpd_time_zero(&record->snapshot);
 
 			DBG_L6("%s: %llu: %llu: %d: "
@@ -388,6 +442,13 @@ static void clockfeed_on_timer(void *user_context, unsigned int id)
 					     sources_count, realtime, true);
 
 	clockfeed_send_sync_event(clockfeed);
+
+	/* Publish metrics roughly once per second */
+	if (clockfeed->poll_period_log2 >= 0 ||
+	    (clockfeed->metrics_cycles & ((1 << -clockfeed->poll_period_log2) - 1)) == 0)
+		sfptpd_metrics_publish(&clockfeed->metrics_source, "clockfeed",
+				       clockfeed_write_metrics, clockfeed);
+	clockfeed->metrics_cycles++;
 }
 
 static int clockfeed_on_startup(void *context)
@@ -645,6 +706,7 @@ static void clockfeed_on_shutdown(void *context)
 		WARNING("clockfeed: clock source subscribers remaining on shutdown\n");
 
 	clockfeed_dump_state(module, module->inactive ? 0 : 5);
+	sfptpd_metrics_source_free(module->metrics_source);
 	sfptpd_stats_collection_free(&module->stats);
 
 	module->magic = CLOCKFEED_DELETED_MAGIC;
@@ -762,6 +824,7 @@ struct sfptpd_clockfeed *sfptpd_clockfeed_create(struct sfptpd_thread **threadre
 		errno = rc;
 		goto fail;
 	}
+	sfptpd_stats_collection_persist(&clockfeed->stats, NULL, "clocks");
 
 	/* Create the service thread - the thread start up routine will
 	 * carry out the rest of the initialisation. */
@@ -1073,6 +1136,79 @@ void sfptpd_clockfeed_set_max_age_diff(struct sfptpd_clockfeed_sub *sub,
 	sub->max_age_diff = *max_age_diff;
 }
 
+void sfptpd_clockfeed_follower_init(struct sfptpd_clockfeed_follower *follower,
+				    struct sfptpd_clockfeed *clockfeed)
+{
+	assert(follower != NULL);
+	assert(clockfeed != NULL);
+
+	memset(follower, 0, sizeof *follower);
+	follower->clockfeed = clockfeed;
+}
+
+void sfptpd_clockfeed_follower_release(struct sfptpd_clockfeed_follower *follower)
+{
+	assert(follower != NULL);
+
+	if (follower->sub != NULL)
+		sfptpd_clockfeed_unsubscribe(follower->clockfeed, follower->sub);
+	follower->sub = NULL;
+	follower->clock = NULL;
+	sfptpd_time_zero(&follower->last_mono);
+}
+
+int sfptpd_clockfeed_follower_compare(struct sfptpd_clockfeed_follower *follower,
+				      struct sfptpd_clock *clock,
+				      struct sfptpd_timespec *diff,
+				      struct sfptpd_timespec *t_sys)
+{
+	struct sfptpd_timespec t_clock, mono;
+	int rc;
+
+	assert(follower != NULL);
+	assert(clock != NULL);
+	assert(diff != NULL);
+	assert(t_sys != NULL);
+
+	if (follower->clock != clock) {
+		sfptpd_clockfeed_follower_release(follower);
+
+		rc = sfptpd_clockfeed_subscribe(follower->clockfeed, clock,
+						&follower->sub);
+		if (rc != 0) {
+			if (follower->failed_clock != clock)
+				ERROR(PREFIX "failed to subscribe to %s clock feed, %s\n",
+				      sfptpd_clock_get_short_name(clock), strerror(rc));
+			else
+				DBG_L3("still failing to subscribe to %s clock feed, %s\n",
+				       sfptpd_clock_get_short_name(clock), strerror(rc));
+			follower->failed_clock = clock;
+			return rc;
+		}
+		if (follower->failed_clock == clock)
+			NOTICE(PREFIX "subscribed to %s clock feed\n",
+			       sfptpd_clock_get_short_name(clock));
+		follower->failed_clock = NULL;
+		follower->clock = clock;
+	}
+
+	if (follower->sub == NULL) {
+		sfptpd_time_zero(diff);
+		(void)sfclock_gettime(CLOCK_REALTIME, t_sys);
+		return 0;
+	}
+
+	rc = sfptpd_clockfeed_compare(follower->sub, NULL, diff,
+				      &t_clock, t_sys, &mono);
+	if (rc != 0)
+		return rc;
+
+	if (sfptpd_time_cmp(&mono, &follower->last_mono) == 0)
+		return EALREADY;
+	follower->last_mono = mono;
+	return 0;
+}
+
 void sfptpd_clockfeed_stats_end_period(struct sfptpd_clockfeed *module,
 				       struct sfptpd_timespec *time)
 {
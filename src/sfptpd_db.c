@@ -42,11 +42,14 @@
  * Constants
  ****************************************************************************/
 
-#define MAX_FIELDS 10
+#define MAX_FIELDS SFPTPD_DB_MAX_FIELDS
 #define ARRAY_INITIAL_SIZE_BYTES 4096
+#define HASH_INDEX_MIN_CAPACITY 16
+#define ORDERED_INDEX_MIN_CAPACITY 16
 
 const static uint32_t MAGIC_TABLE = 0xf74931e2;
 const static uint32_t MAGIC_LL_HDR = 0x40e84c00;
+const static uint32_t MAGIC_LL_DEAD = 0x40e84cde;
 const static uint32_t MAGIC_AR_HDR = 0x40e84c01;
 
 
@@ -57,27 +60,16 @@ const static uint32_t MAGIC_AR_HDR = 0x40e84c01;
 struct store;
 struct linked_list_header;
 
-struct selection {
-	/* Parameters for filtering records (WHERE) */
-	int filter_count;
-	int filter_fields [MAX_FIELDS];
-	void *filter_values [MAX_FIELDS];
-	bool filter_invert [MAX_FIELDS];
-
-	/* Parameters for sorting result (ORDER BY) */
-	int sort_count;
-	int sort_fields[MAX_FIELDS];
-};
-
 struct store_ops {
 	struct sfptpd_db_record_ref (*insert)(struct sfptpd_db_table *table, const void *record);
 	void (*delete)(struct sfptpd_db_record_ref *record_ref);
 	void (*free)(struct store *store);
-	struct sfptpd_db_record_ref (*find)(struct sfptpd_db_table *table, struct selection *selection);
 	void *(*get_data)(struct sfptpd_db_record_ref *ref);
 	void (*foreach)(struct sfptpd_db_table *table,
 			void (*fn)(struct sfptpd_db_record_ref record_ref, void *context),
 			void *context);
+	bool (*next)(struct sfptpd_db_table *table, void **store_element, bool first);
+	bool (*live)(struct sfptpd_db_table *table, void *store_element);
 };
 
 struct store {
@@ -89,8 +81,63 @@ struct sfptpd_db_table {
 	uint32_t magic;
 	struct sfptpd_db_table_def *def;
 	struct store *store;
+	struct index *indexes;
+	int num_indexes;
+	pthread_mutex_t lock;     /*!< Serialises the fields below and changes */
+	int readers;              /*!< Number of open cursors */
+	uint64_t epoch;           /*!< Incremented when a cursor is opened */
+	struct retired *retired;  /*!< Memory to reclaim when readers finish */
+};
+
+/* Memory or a store element that may be referred to by an open cursor,
+ * to be reclaimed when the last cursor on the table is closed */
+struct retired {
+	struct retired *next;
+	void (*reclaim)(struct sfptpd_db_table *table, void *ptr);
+	void *ptr;
+};
+
+enum hash_slot_state {
+	HASH_SLOT_EMPTY,
+	HASH_SLOT_USED,
+	HASH_SLOT_DELETED,
+};
+
+struct hash_slot {
+	uint32_t hash;
+	enum hash_slot_state state;
+	void *store_element;
+};
+
+/* An index on one field. A hash index is an open addressing table with
+ * linear probing, holding the hash of each record's key. An ordered index
+ * is an array of records sorted by the key, with records of equal keys in
+ * the order in which they were indexed. Records are identified by their
+ * store element, which does not change while the record exists. The
+ * elements of an ordered index are copied before being modified while a
+ * cursor opened since the last copy may be walking them. */
+struct index {
+	enum sfptpd_db_index_type type;
+	int field;
+	size_t capacity;          /*!< Number of slots or elements allocated */
+	size_t count;             /*!< Number of records indexed */
+	size_t used;              /*!< Hash slots used, including deleted ones */
+	struct hash_slot *slots;
+	void **elements;
+	uint64_t epoch;           /*!< Table epoch when elements were copied */
+};
+
+/* Sources of candidate records for a cursor */
+enum cursor_source {
+	CURSOR_SOURCE_STORE,
+	CURSOR_SOURCE_HASH,
+	CURSOR_SOURCE_ORDERED,
+	CURSOR_SOURCE_SNAPSHOT,
 };
 
+/* Callback for each record visited by a selection. Returns false to stop. */
+typedef bool (*select_fn_t)(struct sfptpd_db_record_ref ref, void *record, void *context);
+
 struct linked_list_header {
 	uint32_t magic;
 	struct linked_list_header *next;
@@ -113,6 +160,7 @@ struct array {
 	size_t hwm;               /*!< High Water Mark of elements used */
 	size_t count;             /*!< Number of elements currently populated */
 	uintptr_t first_freed;    /*!< Index of first freed element to reuse */
+	size_t retired;           /*!< Deleted elements awaiting release */
 	size_t stride;            /*!< Bytes between start of adjacent elements */
 	void *data;               /*!< Array of capacity*stride bytes */
 };
@@ -133,15 +181,17 @@ static void linked_list_delete(struct sfptpd_db_record_ref *record_ref);
 
 static void linked_list_free(struct store *store);
 
-static struct sfptpd_db_record_ref linked_list_find(struct sfptpd_db_table *table,
-						    struct selection *selection);
-
 static void *linked_list_get_data(struct sfptpd_db_record_ref *ref);
 
 static void linked_list_foreach(struct sfptpd_db_table *table,
 				void (*fn)(struct sfptpd_db_record_ref record, void *context),
 				void *context);
 
+static bool linked_list_next(struct sfptpd_db_table *table,
+			     void **store_element, bool first);
+
+static bool linked_list_live(struct sfptpd_db_table *table, void *store_element);
+
 
 /* The array store is an array with the following properties:
  *  - each element is a header followed by the client-supplied record
@@ -150,6 +200,7 @@ static void linked_list_foreach(struct sfptpd_db_table *table,
  *  - indexes are used to refer to elements
  *  - there is a linked list of freed elements
  *  - counts indicate if linked list is empty so there is no terminator
+ *  - deleted elements are not reused while a cursor is open
  */
 
 static struct sfptpd_db_record_ref array_insert(struct sfptpd_db_table *table,
@@ -159,15 +210,17 @@ static void array_delete(struct sfptpd_db_record_ref *record_ref);
 
 static void array_free(struct store *store);
 
-static struct sfptpd_db_record_ref array_find(struct sfptpd_db_table *table,
-					      struct selection *selection);
-
 static void *array_get_data(struct sfptpd_db_record_ref *ref);
 
 static void array_foreach(struct sfptpd_db_table *table,
 			  void (*fn)(struct sfptpd_db_record_ref record, void *context),
 			  void *context);
 
+static bool array_next(struct sfptpd_db_table *table,
+		       void **store_element, bool first);
+
+static bool array_live(struct sfptpd_db_table *table, void *store_element);
+
 
 /****************************************************************************
  * Constants
@@ -177,9 +230,10 @@ struct store_ops linked_list_ops = {
 	.insert = linked_list_insert,
 	.delete = linked_list_delete,
 	.free = linked_list_free,
-	.find = linked_list_find,
 	.get_data = linked_list_get_data,
 	.foreach = linked_list_foreach,
+	.next = linked_list_next,
+	.live = linked_list_live,
 };
 
 
@@ -187,9 +241,10 @@ struct store_ops array_ops = {
 	.insert = array_insert,
 	.delete = array_delete,
 	.free = array_free,
-	.find = array_find,
 	.get_data = array_get_data,
 	.foreach = array_foreach,
+	.next = array_next,
+	.live = array_live,
 };
 
 
@@ -199,7 +254,7 @@ struct store_ops array_ops = {
 
 
 static bool check_selection_matches(struct sfptpd_db_table *table,
-				    struct selection *selection,
+				    struct sfptpd_db_selection *selection,
 				    void *record)
 {
 	int key;
@@ -224,7 +279,7 @@ static bool check_selection_matches(struct sfptpd_db_table *table,
 }
 
 
-static void build_selection_params(struct selection *selection, va_list ap)
+static void build_selection_params(struct sfptpd_db_selection *selection, va_list ap)
 {
 	int key;
 	int filter_index;
@@ -277,6 +332,83 @@ static void query_result_refs_free(struct sfptpd_db_query_result_refs *query_res
 }
 
 
+/* Implementation of deferred reclamation. Cursors may be opened and closed
+ * on any thread, so the count of open cursors, the list of retired memory
+ * and changes to the table, which retire memory and consult the count, are
+ * serialised by the table lock. The lock is recursive as changes open
+ * cursors to select the records to change. */
+
+static void table_lock(struct sfptpd_db_table *table)
+{
+	int rc = pthread_mutex_lock(&table->lock);
+	assert(rc == 0);
+	(void)rc;
+}
+
+
+static void table_unlock(struct sfptpd_db_table *table)
+{
+	int rc = pthread_mutex_unlock(&table->lock);
+	assert(rc == 0);
+	(void)rc;
+}
+
+
+static void reclaim_free(struct sfptpd_db_table *table, void *ptr)
+{
+	free(ptr);
+}
+
+
+/* Reclaim memory or a store element now if there are no open cursors on
+ * the table, otherwise when the last one is closed. Called with the table
+ * lock held. */
+static void table_retire(struct sfptpd_db_table *table,
+			 void (*reclaim)(struct sfptpd_db_table *table, void *ptr),
+			 void *ptr)
+{
+	struct retired *retired;
+
+	if (table->readers == 0) {
+		reclaim(table, ptr);
+		return;
+	}
+
+	retired = malloc(sizeof *retired);
+	assert(retired != NULL);
+	retired->next = table->retired;
+	retired->reclaim = reclaim;
+	retired->ptr = ptr;
+	table->retired = retired;
+}
+
+
+static void table_read_begin(struct sfptpd_db_table *table)
+{
+	table_lock(table);
+	table->readers++;
+	table->epoch++;
+	table_unlock(table);
+}
+
+
+static void table_read_end(struct sfptpd_db_table *table)
+{
+	struct retired *retired;
+
+	table_lock(table);
+	assert(table->readers > 0);
+	if (--table->readers == 0) {
+		while ((retired = table->retired) != NULL) {
+			table->retired = retired->next;
+			retired->reclaim(table, retired->ptr);
+			free(retired);
+		}
+	}
+	table_unlock(table);
+}
+
+
 /* Implementation of linked-list store */
 
 static struct store *linked_list_create(void)
@@ -333,10 +465,11 @@ static void linked_list_delete(struct sfptpd_db_record_ref *record)
 			break;
 	}
 
-	/* Delete the record */
+	/* Delete the record, leaving its link intact for any cursor on it */
 	assert(*ptr != NULL);
 	*ptr = (*ptr)->next;
-	free(record->store_element);
+	((struct linked_list_header *) record->store_element)->magic = MAGIC_LL_DEAD;
+	table_retire(record->table, reclaim_free, record->store_element);
 }
 
 
@@ -386,37 +519,28 @@ static void linked_list_foreach(struct sfptpd_db_table *table,
 }
 
 
-static struct sfptpd_db_record_ref linked_list_find(struct sfptpd_db_table *table,
-						    struct selection *selection)
+static bool linked_list_next(struct sfptpd_db_table *table,
+			     void **store_element, bool first)
 {
-	struct linked_list *ll;
-	struct linked_list_header *ptr;
-	struct sfptpd_db_record_ref ref = {
-		.table = table
-	};
+	struct linked_list *ll = (struct linked_list *) table->store;
+	struct linked_list_header *header;
 
-	assert(table != NULL);
-	assert(selection != NULL);
-	assert(table->magic == MAGIC_TABLE);
+	if (first)
+		header = ll->head;
+	else
+		header = ((struct linked_list_header *) *store_element)->next;
 
-	ll = (struct linked_list *) table->store;
+	if (header == NULL)
+		return false;
 
-	/* Iterate through linked list */
-	for (ptr = ll->head; ptr != NULL; ptr = ptr->next) {
-		assert(ptr->magic == MAGIC_LL_HDR);
-		if (check_selection_matches(table, selection, ptr + 1))
-			break;
-	}
+	*store_element = header;
+	return true;
+}
 
-	if (ptr == NULL) {
-		ref.valid = false;
-		ref.store_element = NULL;
-	} else {
-		ref.valid = true;
-		ref.store_element = ptr;
-	}
 
-	return ref;
+static bool linked_list_live(struct sfptpd_db_table *table, void *store_element)
+{
+	return ((struct linked_list_header *) store_element)->magic == MAGIC_LL_HDR;
 }
 
 
@@ -473,11 +597,20 @@ static struct sfptpd_db_record_ref array_insert(struct sfptpd_db_table *table,
 	assert(table->magic == MAGIC_TABLE);
 	assert(ar->hwm <= ar->capacity);
 
-	if (ar->count == ar->hwm) {
-		if (ar->count == ar->capacity) {
+	if (ar->count + ar->retired == ar->hwm) {
+		if (ar->hwm == ar->capacity) {
 			ar->capacity *= 2;
-			ar->data = realloc(ar->data, ar->capacity * ar->stride);
-			assert(ar->data != NULL);
+			if (table->readers == 0) {
+				ar->data = realloc(ar->data, ar->capacity * ar->stride);
+				assert(ar->data != NULL);
+			} else {
+				/* Keep the records in place for open cursors */
+				void *data = malloc(ar->capacity * ar->stride);
+				assert(data != NULL);
+				memcpy(data, ar->data, ar->hwm * ar->stride);
+				table_retire(table, reclaim_free, ar->data);
+				ar->data = data;
+			}
 		}
 		index = ar->hwm++;
 		header = get_array_header(ar, index, true);
@@ -496,6 +629,30 @@ static struct sfptpd_db_record_ref array_insert(struct sfptpd_db_table *table,
 }
 
 
+/* Make a deleted element available for reuse */
+static void array_release(struct sfptpd_db_table *table, void *store_element)
+{
+	struct array *ar = (struct array *) table->store;
+	struct array_header *hdr;
+	uintptr_t index;
+
+	index = (uintptr_t) store_element;
+	hdr = get_array_header(ar, index, false);
+	assert(!hdr->populated);
+	assert(ar->retired > 0);
+	ar->retired--;
+
+	if (ar->count == 0 && ar->retired == 0) {
+		ar->hwm = 0;
+	} else if (index + 1 == ar->hwm) {
+		ar->hwm--;
+	} else {
+		hdr->next_freed = ar->first_freed;
+		ar->first_freed = index;
+	}
+}
+
+
 static void array_delete(struct sfptpd_db_record_ref *record)
 {
 	struct array *ar;
@@ -519,15 +676,9 @@ static void array_delete(struct sfptpd_db_record_ref *record)
 	assert(hdr != NULL);
 	hdr->populated = false;
 	ar->count--;
+	ar->retired++;
 
-	if (ar->count == 0) {
-		ar->hwm = 0;
-	} else if (index + 1 == ar->hwm) {
-		ar->hwm--;
-	} else {
-		hdr->next_freed = ar->first_freed;
-		ar->first_freed = index;
-	}
+	table_retire(record->table, array_release, record->store_element);
 }
 
 
@@ -587,42 +738,588 @@ static void array_foreach(struct sfptpd_db_table *table,
 }
 
 
-static struct sfptpd_db_record_ref array_find(struct sfptpd_db_table *table,
-					      struct selection *selection)
+static bool array_next(struct sfptpd_db_table *table,
+		       void **store_element, bool first)
+{
+	struct array *ar = (struct array *) table->store;
+	uintptr_t index;
+
+	index = first ? 0 : (uintptr_t) *store_element + 1;
+	for (; index < ar->hwm; index++) {
+		if (get_array_header(ar, index, false)->populated) {
+			*store_element = (void *) index;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+static bool array_live(struct sfptpd_db_table *table, void *store_element)
+{
+	struct array *ar = (struct array *) table->store;
+	uintptr_t index = (uintptr_t) store_element;
+
+	return index < ar->hwm && get_array_header(ar, index, false)->populated;
+}
+
+
+/* Implementation of indexes */
+
+static void *element_data(struct sfptpd_db_table *table, void *store_element)
 {
-	struct array *ar;
-	struct array_header *hdr = NULL;
 	struct sfptpd_db_record_ref ref = {
-		.table = table
+		.table = table,
+		.store_element = store_element,
+		.valid = true,
 	};
-	uintptr_t index;
 
-	assert(table != NULL);
-	assert(selection != NULL);
-	assert(table->magic == MAGIC_TABLE);
+	return table->store->ops->get_data(&ref);
+}
 
-	ar = (struct array *) table->store;
 
-	assert(ar->hwm <= ar->capacity);
+static struct index *field_index(struct sfptpd_db_table *table, int field)
+{
+	int i;
 
-	/* Iterate across array */
-	for (index = 0; index < ar->hwm; index++) {
-		hdr = get_array_header(ar, index, false);
-		if (hdr->populated &&
-		    check_selection_matches(table, selection, hdr + 1))
-			break;
-		hdr = NULL;
+	for (i = 0; i < table->num_indexes; i++)
+		if (table->indexes[i].field == field)
+			return &table->indexes[i];
+	return NULL;
+}
+
+
+static void hash_index_add_slot(struct index *index, uint32_t hash,
+				void *store_element)
+{
+	size_t mask = index->capacity - 1;
+	size_t i;
+
+	for (i = hash & mask; index->slots[i].state == HASH_SLOT_USED; i = (i + 1) & mask);
+
+	if (index->slots[i].state == HASH_SLOT_EMPTY)
+		index->used++;
+	index->slots[i].hash = hash;
+	index->slots[i].state = HASH_SLOT_USED;
+	index->slots[i].store_element = store_element;
+	index->count++;
+}
+
+
+/* Resize the table to keep it under three-quarters full, which also clears
+ * out deleted slots. */
+static void hash_index_resize(struct sfptpd_db_table *table, struct index *index)
+{
+	struct hash_slot *old_slots = index->slots;
+	size_t old_capacity = index->capacity;
+	size_t capacity = HASH_INDEX_MIN_CAPACITY;
+	size_t i;
+
+	while (capacity * 3 <= (index->count + 1) * 4 * 2)
+		capacity *= 2;
+
+	index->slots = calloc(capacity, sizeof *index->slots);
+	assert(index->slots != NULL);
+	index->capacity = capacity;
+	index->count = 0;
+	index->used = 0;
+
+	for (i = 0; i < old_capacity; i++)
+		if (old_slots[i].state == HASH_SLOT_USED)
+			hash_index_add_slot(index, old_slots[i].hash,
+					    old_slots[i].store_element);
+	table_retire(table, reclaim_free, old_slots);
+}
+
+
+static void hash_index_add(struct sfptpd_db_table *table, struct index *index,
+			   void *store_element, const void *record)
+{
+	if ((index->used + 1) * 4 > index->capacity * 3)
+		hash_index_resize(table, index);
+
+	hash_index_add_slot(index,
+			    table->def->fields[index->field].hash_record(record),
+			    store_element);
+}
+
+
+static void hash_index_remove(struct sfptpd_db_table *table, struct index *index,
+			      void *store_element, const void *record)
+{
+	uint32_t hash = table->def->fields[index->field].hash_record(record);
+	size_t mask = index->capacity - 1;
+	size_t i;
+
+	for (i = hash & mask; index->slots[i].state != HASH_SLOT_EMPTY; i = (i + 1) & mask) {
+		if (index->slots[i].state == HASH_SLOT_USED &&
+		    index->slots[i].store_element == store_element) {
+			index->slots[i].state = HASH_SLOT_DELETED;
+			index->count--;
+			return;
+		}
 	}
+	assert(!"record missing from hash index");
+}
 
-	if (hdr == NULL) {
-		ref.valid = false;
-		ref.store_element = 0;
-	} else {
-		ref.valid = true;
-		ref.store_element = (void *) index;
+
+/* Find the position after the last record ordered before or with a record
+ * (upper) or the first record ordered with or after it (lower) */
+static size_t ordered_index_bound(struct sfptpd_db_table *table, struct index *index,
+				  const void *record, bool upper)
+{
+	struct sfptpd_db_field *field = &table->def->fields[index->field];
+	size_t lo = 0, hi = index->count, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = field->compare_record(element_data(table, index->elements[mid]), record);
+		if (upper ? cmp <= 0 : cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	return lo;
+}
 
-	return ref;
+
+/* Whether a cursor opened since the elements of an ordered index were last
+ * copied may be walking them */
+static bool ordered_index_shared(struct sfptpd_db_table *table, struct index *index)
+{
+	return table->readers != 0 && index->epoch != table->epoch &&
+	       index->elements != NULL;
+}
+
+
+/* Copy the elements of an ordered index before they are modified if an
+ * open cursor may be walking them */
+static void ordered_index_unshare(struct sfptpd_db_table *table, struct index *index)
+{
+	void **elements;
+
+	if (!ordered_index_shared(table, index))
+		return;
+
+	elements = malloc(index->capacity * sizeof *elements);
+	assert(elements != NULL);
+	memcpy(elements, index->elements, index->count * sizeof *elements);
+	table_retire(table, reclaim_free, index->elements);
+	index->elements = elements;
+	index->epoch = table->epoch;
+}
+
+
+static void ordered_index_add(struct sfptpd_db_table *table, struct index *index,
+			      void *store_element, const void *record)
+{
+	size_t pos;
+
+	ordered_index_unshare(table, index);
+
+	if (index->count == index->capacity) {
+		index->capacity = index->capacity ? index->capacity * 2 : ORDERED_INDEX_MIN_CAPACITY;
+		index->elements = realloc(index->elements,
+					  index->capacity * sizeof *index->elements);
+		assert(index->elements != NULL);
+	}
+
+	/* Appending in order is the common case */
+	if (index->count == 0 ||
+	    table->def->fields[index->field].compare_record(element_data(table, index->elements[index->count - 1]),
+							    record) <= 0)
+		pos = index->count;
+	else
+		pos = ordered_index_bound(table, index, record, true);
+
+	memmove(&index->elements[pos + 1], &index->elements[pos],
+		(index->count - pos) * sizeof *index->elements);
+	index->elements[pos] = store_element;
+	index->count++;
+}
+
+
+static void ordered_index_remove(struct sfptpd_db_table *table, struct index *index,
+				 void *store_element, const void *record)
+{
+	size_t pos;
+
+	ordered_index_unshare(table, index);
+
+	for (pos = ordered_index_bound(table, index, record, false);
+	     pos < index->count && index->elements[pos] != store_element;
+	     pos++);
+	assert(pos < index->count);
+
+	index->count--;
+	memmove(&index->elements[pos], &index->elements[pos + 1],
+		(index->count - pos) * sizeof *index->elements);
+}
+
+
+/* Find the position after the last record ordered before or with a key
+ * (upper) or the first record ordered with or after it (lower) */
+static size_t ordered_index_key_bound(struct sfptpd_db_table *table, struct index *index,
+				      const void *key, bool upper)
+{
+	struct sfptpd_db_field *field = &table->def->fields[index->field];
+	size_t lo = 0, hi = index->count, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = field->compare_key(key, element_data(table, index->elements[mid]));
+		if (upper ? cmp >= 0 : cmp > 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+
+static void index_add(struct sfptpd_db_table *table, struct index *index,
+		      void *store_element, const void *record)
+{
+	if (index->type == SFPTPD_DB_INDEX_HASH)
+		hash_index_add(table, index, store_element, record);
+	else
+		ordered_index_add(table, index, store_element, record);
+}
+
+
+static void index_remove(struct sfptpd_db_table *table, struct index *index,
+			 void *store_element, const void *record)
+{
+	if (index->type == SFPTPD_DB_INDEX_HASH)
+		hash_index_remove(table, index, store_element, record);
+	else
+		ordered_index_remove(table, index, store_element, record);
+}
+
+
+static void index_clear(struct sfptpd_db_table *table, struct index *index)
+{
+	if (index->type == SFPTPD_DB_INDEX_HASH && index->slots != NULL)
+		memset(index->slots, 0, index->capacity * sizeof *index->slots);
+	if (ordered_index_shared(table, index)) {
+		table_retire(table, reclaim_free, index->elements);
+		index->elements = NULL;
+		index->capacity = 0;
+	}
+	index->count = 0;
+	index->used = 0;
+}
+
+
+static void indexes_create(struct sfptpd_db_table *table)
+{
+	struct sfptpd_db_field *field;
+	struct index *index;
+	int i;
+
+	for (i = 0; i < table->def->num_fields; i++)
+		if (table->def->fields[i].index != SFPTPD_DB_INDEX_NONE)
+			table->num_indexes++;
+
+	if (table->num_indexes == 0)
+		return;
+
+	table->indexes = calloc(table->num_indexes, sizeof *table->indexes);
+	assert(table->indexes != NULL);
+
+	for (i = 0, index = table->indexes; i < table->def->num_fields; i++) {
+		field = &table->def->fields[i];
+		if (field->index == SFPTPD_DB_INDEX_NONE)
+			continue;
+
+		index->type = field->index;
+		index->field = i;
+		if (index->type == SFPTPD_DB_INDEX_HASH) {
+			assert(field->hash_key != NULL);
+			assert(field->hash_record != NULL);
+			index->capacity = HASH_INDEX_MIN_CAPACITY;
+			index->slots = calloc(index->capacity, sizeof *index->slots);
+			assert(index->slots != NULL);
+		}
+		index++;
+	}
+}
+
+
+static void indexes_free(struct sfptpd_db_table *table)
+{
+	int i;
+
+	for (i = 0; i < table->num_indexes; i++) {
+		free(table->indexes[i].slots);
+		free(table->indexes[i].elements);
+	}
+	free(table->indexes);
+}
+
+
+/* Choose the source of candidate records for a cursor. An index is used
+ * for the first search key that has one; otherwise an ordered index on the
+ * first sort key is used to visit the records in order.
+ * @return true if the source gives the records in the order of the selection */
+static bool cursor_plan(struct sfptpd_db_cursor *cursor)
+{
+	struct sfptpd_db_table *table = cursor->table;
+	struct sfptpd_db_selection *selection = &cursor->selection;
+	struct index *index;
+	const void *key;
+	int i;
+
+	cursor->source = CURSOR_SOURCE_STORE;
+
+	for (i = 0; i < selection->filter_count; i++) {
+		if (selection->filter_invert[i])
+			continue;
+		index = field_index(table, selection->filter_fields[i]);
+		if (index == NULL)
+			continue;
+
+		key = selection->filter_values[i];
+		if (index->type == SFPTPD_DB_INDEX_HASH) {
+			cursor->source = CURSOR_SOURCE_HASH;
+			cursor->slots = index->slots;
+			cursor->mask = index->capacity - 1;
+			cursor->hash = table->def->fields[index->field].hash_key(key);
+			cursor->begin = cursor->hash & cursor->mask;
+			return selection->sort_count == 0;
+		}
+
+		/* The matching records have equal keys so are also in
+		 * order of this field */
+		cursor->source = CURSOR_SOURCE_ORDERED;
+		cursor->elements = index->elements;
+		cursor->begin = ordered_index_key_bound(table, index, key, false);
+		cursor->end = ordered_index_key_bound(table, index, key, true);
+		return selection->sort_count == 0 ||
+		       (selection->sort_count == 1 &&
+			selection->sort_fields[0] == index->field);
+	}
+
+	if (selection->sort_count != 0) {
+		index = field_index(table, selection->sort_fields[0]);
+		if (index != NULL && index->type == SFPTPD_DB_INDEX_ORDERED) {
+			cursor->source = CURSOR_SOURCE_ORDERED;
+			cursor->elements = index->elements;
+			cursor->begin = 0;
+			cursor->end = index->count;
+			return selection->sort_count == 1;
+		}
+	}
+
+	return selection->sort_count == 0;
+}
+
+
+static void cursor_rewind(struct sfptpd_db_cursor *cursor)
+{
+	cursor->pos = cursor->begin;
+	cursor->started = false;
+}
+
+
+/* Get the next candidate store element from the source of a cursor */
+static bool cursor_source_next(struct sfptpd_db_cursor *cursor, void **store_element)
+{
+	struct sfptpd_db_table *table = cursor->table;
+	const struct hash_slot *slots = cursor->slots;
+	const struct hash_slot *slot;
+
+	switch (cursor->source) {
+	case CURSOR_SOURCE_HASH:
+		while (slots[cursor->pos].state != HASH_SLOT_EMPTY) {
+			slot = &slots[cursor->pos];
+			cursor->pos = (cursor->pos + 1) & cursor->mask;
+			if (slot->state == HASH_SLOT_USED && slot->hash == cursor->hash) {
+				*store_element = slot->store_element;
+				return true;
+			}
+		}
+		return false;
+
+	case CURSOR_SOURCE_ORDERED:
+	case CURSOR_SOURCE_SNAPSHOT:
+		if (cursor->pos >= cursor->end)
+			return false;
+		*store_element = cursor->elements[cursor->pos++];
+		return true;
+
+	default:
+		if (!table->store->ops->next(table, &cursor->store_pos, !cursor->started))
+			return false;
+		cursor->started = true;
+		*store_element = cursor->store_pos;
+		return true;
+	}
+}
+
+
+/* Get the next record from the source of a cursor that matches the filter */
+static void *cursor_source_record(struct sfptpd_db_cursor *cursor, void **store_element)
+{
+	struct sfptpd_db_table *table = cursor->table;
+	void *record;
+
+	while (cursor_source_next(cursor, store_element)) {
+		/* Indexes may still refer to records deleted since the
+		 * cursor was opened */
+		if (!table->store->ops->live(table, *store_element))
+			continue;
+		record = element_data(table, *store_element);
+		if (check_selection_matches(table, &cursor->selection, record))
+			return record;
+	}
+	return NULL;
+}
+
+
+/* Compare two records by the sort keys of a selection and then by store
+ * element to give a total order */
+static int cursor_compare(struct sfptpd_db_cursor *cursor,
+			  const void *rec_a, void *element_a,
+			  const void *rec_b, void *element_b)
+{
+	struct sfptpd_db_field *fields = cursor->table->def->fields;
+	int key;
+	int cmp;
+
+	for (key = 0; key < cursor->selection.sort_count; key++) {
+		cmp = fields[cursor->selection.sort_fields[key]].compare_record(rec_a, rec_b);
+		if (cmp != 0)
+			return cmp;
+	}
+
+	if ((uintptr_t) element_a == (uintptr_t) element_b)
+		return 0;
+	return (uintptr_t) element_a < (uintptr_t) element_b ? -1 : 1;
+}
+
+
+/* Store element comparison function for qsort_r */
+static int cursor_compare_elements(const void *raw_a, const void *raw_b, void *raw_cursor)
+{
+	struct sfptpd_db_cursor *cursor = raw_cursor;
+	void *element_a = *(void * const *) raw_a;
+	void *element_b = *(void * const *) raw_b;
+
+	return cursor_compare(cursor,
+			      element_data(cursor->table, element_a), element_a,
+			      element_data(cursor->table, element_b), element_b);
+}
+
+
+/* Take the matching records from the source and sort them so that the
+ * cursor can then visit them in order.
+ * @return false if there was not enough memory */
+static bool cursor_sort_snapshot(struct sfptpd_db_cursor *cursor)
+{
+	void **elements = NULL;
+	void **grown;
+	size_t capacity = 0;
+	size_t count = 0;
+	void *element;
+
+	while (cursor_source_record(cursor, &element) != NULL) {
+		if (count == capacity) {
+			capacity = capacity == 0 ? 16 : capacity * 2;
+			grown = realloc(elements, capacity * sizeof *elements);
+			if (grown == NULL) {
+				free(elements);
+				cursor_rewind(cursor);
+				return false;
+			}
+			elements = grown;
+		}
+		elements[count++] = element;
+	}
+
+	qsort_r(elements, count, sizeof *elements, cursor_compare_elements, cursor);
+
+	cursor->source = CURSOR_SOURCE_SNAPSHOT;
+	cursor->elements = elements;
+	cursor->begin = 0;
+	cursor->end = count;
+	cursor_rewind(cursor);
+	return true;
+}
+
+
+/* Find the next record in order by scanning the source for the least record
+ * ordered after the one last returned. This is only used if there is not
+ * enough memory to sort the records when the cursor is opened. */
+static void *cursor_next_sorted(struct sfptpd_db_cursor *cursor)
+{
+	void *best_record = NULL;
+	void *best_element = NULL;
+	void *record;
+	void *element;
+
+	cursor_rewind(cursor);
+	while ((record = cursor_source_record(cursor, &element)) != NULL) {
+		if (cursor->record != NULL &&
+		    cursor_compare(cursor, record, element,
+				   cursor->record, cursor->store_element) <= 0)
+			continue;
+		if (best_record == NULL ||
+		    cursor_compare(cursor, record, element,
+				   best_record, best_element) < 0) {
+			best_record = record;
+			best_element = element;
+		}
+	}
+
+	cursor->store_element = best_element;
+	return best_record;
+}
+
+
+/* Open a cursor with the selection already set.
+ * @param sort Whether to return the records in order if the source does not
+ * @return true if the source gives the records in the order of the selection */
+static bool cursor_open(struct sfptpd_db_cursor *cursor,
+			struct sfptpd_db_table *table, bool sort)
+{
+	bool ordered;
+
+	table_read_begin(table);
+
+	cursor->table = table;
+	cursor->done = false;
+	cursor->store_element = NULL;
+	cursor->record = NULL;
+
+	ordered = cursor_plan(cursor);
+	cursor_rewind(cursor);
+	cursor->sort = sort && !ordered && !cursor_sort_snapshot(cursor);
+
+	return ordered;
+}
+
+
+/* Visit each record matching the filter of a selection.
+ * @return true if the records were visited in the order of the selection */
+static bool table_select(struct sfptpd_db_table *table,
+			 struct sfptpd_db_selection *selection,
+			 select_fn_t fn, void *context)
+{
+	struct sfptpd_db_cursor cursor;
+	bool ordered;
+	void *record;
+
+	cursor.selection = *selection;
+	ordered = cursor_open(&cursor, table, false);
+
+	while ((record = sfptpd_db_cursor_next(&cursor)) != NULL &&
+	       fn(sfptpd_db_cursor_ref(&cursor), record, context));
+
+	sfptpd_db_cursor_close(&cursor);
+	return ordered;
 }
 
 
@@ -630,10 +1327,25 @@ static struct sfptpd_db_record_ref array_find(struct sfptpd_db_table *table,
  * Public Functions
  ****************************************************************************/
 
+uint32_t sfptpd_db_hash(const void *key, size_t size)
+{
+	const uint8_t *bytes = key;
+	uint32_t hash = 0x811c9dc5;
+
+	/* 32-bit FNV-1a */
+	while (size-- != 0) {
+		hash ^= *bytes++;
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+
 struct sfptpd_db_table *sfptpd_db_table_new(struct sfptpd_db_table_def *def,
 					    enum sfptpd_db_store_type type)
 {
 	struct sfptpd_db_table *new;
+	pthread_mutexattr_t attr;
 
 	assert(def != NULL);
 
@@ -642,6 +1354,11 @@ struct sfptpd_db_table *sfptpd_db_table_new(struct sfptpd_db_table_def *def,
 	new->def = def;
 	new->magic = MAGIC_TABLE;
 
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&new->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
 	switch (type) {
 	case STORE_LINKED_LIST:
 		new->store = linked_list_create();
@@ -655,6 +1372,8 @@ struct sfptpd_db_table *sfptpd_db_table_new(struct sfptpd_db_table_def *def,
 
 	new->store->record_size = def->record_size;
 
+	indexes_create(new);
+
 	return new;
 }
 
@@ -663,75 +1382,96 @@ void sfptpd_db_table_free(struct sfptpd_db_table *table)
 	assert(table != NULL);
 	assert(table->magic == MAGIC_TABLE);
 
+	assert(table->readers == 0);
+
 	sfptpd_db_table_delete(table);
 
 	table->store->ops->free(table->store);
 
+	indexes_free(table);
+	pthread_mutex_destroy(&table->lock);
 	free(table);
 }
 
 struct sfptpd_db_record_ref sfptpd_db_table_insert(struct sfptpd_db_table *table,
 						   const void *record)
 {
+	struct sfptpd_db_record_ref ref;
+	int i;
+
 	assert(table != NULL);
 	assert(record != NULL);
 	assert(table->magic == MAGIC_TABLE);
 
-	return table->store->ops->insert(table, record);
+	table_lock(table);
+	ref = table->store->ops->insert(table, record);
+
+	for (i = 0; i < table->num_indexes; i++)
+		index_add(table, &table->indexes[i], ref.store_element, record);
+	table_unlock(table);
+
+	return ref;
+}
+
+
+/* Executed per selected record, keeping the first one */
+static bool find_fn(struct sfptpd_db_record_ref ref, void *record, void *context)
+{
+	*((struct sfptpd_db_record_ref *) context) = ref;
+	return false;
 }
 
 
 struct sfptpd_db_record_ref sfptpd_db_table_find_impl(struct sfptpd_db_table *table, ...)
 {
 	va_list ap;
-	struct selection selection;
+	struct sfptpd_db_selection selection;
 
 	assert(table != NULL);
 	assert(table->magic == MAGIC_TABLE);
 
+	struct sfptpd_db_record_ref ref = {
+		.table = table,
+		.store_element = NULL,
+		.valid = false,
+	};
+
 	/* Count the number of keys */
 	va_start(ap, table);
 	build_selection_params(&selection, ap);
 	va_end(ap);
 
-	return table->store->ops->find(table, &selection);
-}
-/* Context for the callback functions used in the count operation */
-struct count_fn_context {
-	struct sfptpd_db_table *table;
-	int count;
-	struct selection selection;
-};
+	/* Order is irrelevant when finding any matching record */
+	selection.sort_count = 0;
+	table_select(table, &selection, find_fn, &ref);
 
-/* Executed per record, incrementing a count of each record that matches criteria */
-static void count_fn(void *record, void *context) {
-	struct count_fn_context *counter = context;
+	return ref;
+}
 
-	if (check_selection_matches(counter->table,
-				    &counter->selection,
-				    record))
-		counter->count++;
+/* Executed per selected record, incrementing a count */
+static bool count_fn(struct sfptpd_db_record_ref ref, void *record, void *context) {
+	(*((int *) context))++;
+	return true;
 }
 
 int sfptpd_db_table_count_impl(struct sfptpd_db_table *table, ...)
 {
-	struct count_fn_context counter;
+	struct sfptpd_db_selection selection;
 	va_list ap;
+	int count = 0;
 
 	assert(table != NULL);
 	assert(table->magic == MAGIC_TABLE);
 
 	/* Build up the key-value list */
 	va_start(ap, table);
-	build_selection_params(&counter.selection, ap);
+	build_selection_params(&selection, ap);
 	va_end(ap);
 
-	counter.table = table;
-	counter.count = 0;
-
-	sfptpd_db_table_foreach(table, count_fn, &counter);
+	selection.sort_count = 0;
+	table_select(table, &selection, count_fn, &count);
 
-	return counter.count;
+	return count;
 }
 
 
@@ -740,28 +1480,16 @@ struct query_fn_context {
 	struct sfptpd_db_table *table;
 	struct sfptpd_db_query_result result;
 	struct sfptpd_db_query_result_refs result_refs;
-	struct selection selection;
+	struct sfptpd_db_selection selection;
 	int i;
 };
 
-/* Executed per record, incrementing a count of each record that matches criteria */
-static void query_count_fn(void *record, void *raw_context) {
+/* Executed per selected record, copying pointers to each record */
+static bool query_select_fn(struct sfptpd_db_record_ref ref, void *record, void *raw_context) {
 	struct query_fn_context *context = raw_context;
 
-	if (check_selection_matches(context->table,
-				    &context->selection,
-				    record))
-		context->result.num_records++;
-}
-
-/* Executed per record, copying pointers to each record that matches criteria */
-static void query_select_fn(void *record, void *raw_context) {
-	struct query_fn_context *context = raw_context;
-
-	if (check_selection_matches(context->table,
-				    &context->selection,
-				    record))
-		context->result.record_ptrs[context->i++] = record;
+	context->result.record_ptrs[context->i++] = record;
+	return true;
 }
 
 /* Record comparison function for qsort_r */
@@ -786,9 +1514,11 @@ static int query_compare_fn(const void *raw_rec_a, const void *raw_rec_b, void *
  * @param table The table
  * @param selection The selection parameters */
 static struct sfptpd_db_query_result table_query(struct sfptpd_db_table *table,
-						 struct selection *selection)
+						 struct sfptpd_db_selection *selection)
 {
 	struct query_fn_context fn_context;
+	struct sfptpd_db_selection count_selection;
+	bool ordered;
 
 	assert(table != NULL);
 	assert(table->magic == MAGIC_TABLE);
@@ -798,7 +1528,9 @@ static struct sfptpd_db_query_result table_query(struct sfptpd_db_table *table,
 	fn_context.selection = *selection;
 
 	/* Count the number of matching records */
-	sfptpd_db_table_foreach(table, query_count_fn, &fn_context);
+	count_selection = *selection;
+	count_selection.sort_count = 0;
+	table_select(table, &count_selection, count_fn, &fn_context.result.num_records);
 
 	/* Allocate space for the result */
 	fn_context.i = 0;
@@ -807,10 +1539,11 @@ static struct sfptpd_db_query_result table_query(struct sfptpd_db_table *table,
 					       sizeof *fn_context.result.record_ptrs);
 
 	/* Create a list of matching record pointers */
-	sfptpd_db_table_foreach(table, query_select_fn, &fn_context);
+	ordered = table_select(table, &fn_context.selection, query_select_fn, &fn_context);
+	assert(fn_context.i == fn_context.result.num_records);
 
-	/* Sort the result */
-	if (fn_context.selection.sort_count != 0) {
+	/* Sort the result unless it was taken from an index in order */
+	if (!ordered) {
 		qsort_r(fn_context.result.record_ptrs,
 			fn_context.result.num_records,
 			sizeof *fn_context.result.record_ptrs,
@@ -825,7 +1558,7 @@ static struct sfptpd_db_query_result table_query(struct sfptpd_db_table *table,
 struct sfptpd_db_query_result sfptpd_db_table_query_impl(struct sfptpd_db_table *table, ...)
 {
 	va_list ap;
-	struct selection selection;
+	struct sfptpd_db_selection selection;
 
 	assert(table != NULL);
 	assert(table->magic == MAGIC_TABLE);
@@ -862,7 +1595,7 @@ void sfptpd_db_table_foreach_impl(struct sfptpd_db_table *table,
 				  void *context, ...) {
 
 	va_list ap;
-	struct selection selection;
+	struct sfptpd_db_selection selection;
 
 	assert(table != NULL);
 	assert(table->magic == MAGIC_TABLE);
@@ -882,27 +1615,38 @@ void sfptpd_db_table_foreach_impl(struct sfptpd_db_table *table,
 
 		table->store->ops->foreach(table, deref_fn, &deref_context);
 	} else {
-		/* With search or sort constraints we call the query function first
-		 * and operate directly on record pointers */
-		struct sfptpd_db_query_result result = table_query(table, &selection);
+		/* With search constraints, or sort constraints met by an index,
+		 * we walk a cursor */
+		struct sfptpd_db_cursor cursor;
+		void *record;
+
+		cursor.selection = selection;
+		if (cursor_open(&cursor, table, false) || selection.sort_count == 0) {
+			while ((record = sfptpd_db_cursor_next(&cursor)) != NULL)
+				fn(record, context);
+			sfptpd_db_cursor_close(&cursor);
+		} else {
+			/* Otherwise we call the query function first and
+			 * operate directly on record pointers */
+			sfptpd_db_cursor_close(&cursor);
+
+			struct sfptpd_db_query_result result = table_query(table, &selection);
 
-		for (int i = 0; i < result.num_records; i++)
-			fn(result.record_ptrs[i], context);
+			for (int i = 0; i < result.num_records; i++)
+				fn(result.record_ptrs[i], context);
 
-		result.free(&result);
+			result.free(&result);
+		}
 	}
 }
 
 
-/* Executed per record, copying pointers to each record that matches criteria */
-static void query_refs_select_fn(struct sfptpd_db_record_ref ref, void *raw_context) {
+/* Executed per selected record, copying references to each record */
+static bool query_refs_select_fn(struct sfptpd_db_record_ref ref, void *record, void *raw_context) {
 	struct query_fn_context *context = raw_context;
-	void *record = ref.table->store->ops->get_data(&ref);
 
-	if (check_selection_matches(context->table,
-				    &context->selection,
-				    record))
-		context->result_refs.record_refs[context->i++] = ref;
+	context->result_refs.record_refs[context->i++] = ref;
+	return true;
 }
 
 
@@ -911,7 +1655,7 @@ static void query_refs_select_fn(struct sfptpd_db_record_ref ref, void *raw_cont
  * @param table The table
  * @param selection The selection parameters */
 static struct sfptpd_db_query_result_refs table_query_refs(struct sfptpd_db_table *table,
-							   struct selection *selection)
+							   struct sfptpd_db_selection *selection)
 {
 	struct query_fn_context fn_context;
 
@@ -924,7 +1668,8 @@ static struct sfptpd_db_query_result_refs table_query_refs(struct sfptpd_db_tabl
 	fn_context.selection = *selection;
 
 	/* Count the number of matching records */
-	sfptpd_db_table_foreach(table, query_count_fn, &fn_context);
+	fn_context.selection.sort_count = 0;
+	table_select(table, &fn_context.selection, count_fn, &fn_context.result.num_records);
 	fn_context.result_refs.num_records = fn_context.result.num_records;
 
 	/* Allocate space for the result */
@@ -933,27 +1678,18 @@ static struct sfptpd_db_query_result_refs table_query_refs(struct sfptpd_db_tabl
 	fn_context.result_refs.record_refs = calloc(fn_context.result_refs.num_records,
 						    sizeof *fn_context.result_refs.record_refs);
 
-	/* Create a list of matching record pointers */
-	table->store->ops->foreach(table, query_refs_select_fn, &fn_context);
-
-	/* Sort the result */
-	if (fn_context.selection.sort_count != 0) {
-		qsort_r(fn_context.result.record_ptrs,
-			fn_context.result.num_records,
-			sizeof *fn_context.result.record_ptrs,
-			query_compare_fn,
-			&fn_context);
-	}
+	/* Create a list of matching record references */
+	table_select(table, &fn_context.selection, query_refs_select_fn, &fn_context);
 
 	/* TODO: sorting of the resulting refs not currently supported */
-	assert (fn_context.selection.sort_count == 0);
+	assert (selection->sort_count == 0);
 
 	return fn_context.result_refs;
 }
 
 
 static void table_delete(struct sfptpd_db_table *table,
-			 struct selection *selection)
+			 struct sfptpd_db_selection *selection)
 {
 	struct sfptpd_db_query_result_refs result;
 	int i;
@@ -962,13 +1698,29 @@ static void table_delete(struct sfptpd_db_table *table,
 	assert(table->magic == MAGIC_TABLE);
 	assert(selection != NULL);
 
+	table_lock(table);
 	result = table_query_refs(table, selection);
 
+	/* Clear the indexes at once when deleting every record */
+	if (selection->filter_count == 0) {
+		for (i = 0; i < table->num_indexes; i++)
+			index_clear(table, &table->indexes[i]);
+	}
+
 	for (i = 0; i < result.num_records; i++) {
 		struct sfptpd_db_record_ref *ref = &result.record_refs[i];
+		int j;
+
+		if (selection->filter_count != 0) {
+			void *record = ref->table->store->ops->get_data(ref);
 
+			for (j = 0; j < table->num_indexes; j++)
+				index_remove(table, &table->indexes[j],
+					     ref->store_element, record);
+		}
 		ref->table->store->ops->delete(ref);
 	}
+	table_unlock(table);
 
 	result.free(&result);
 }
@@ -977,7 +1729,7 @@ static void table_delete(struct sfptpd_db_table *table,
 void sfptpd_db_table_delete_impl(struct sfptpd_db_table *table, ...)
 {
 	va_list ap;
-	struct selection selection;
+	struct sfptpd_db_selection selection;
 
 	assert(table != NULL);
 	assert(table->magic == MAGIC_TABLE);
@@ -998,7 +1750,7 @@ void sfptpd_db_table_dump_impl(int trace_level,
 {
 	struct sfptpd_db_query_result result;
 	va_list ap;
-	struct selection selection;
+	struct sfptpd_db_selection selection;
 	int num_cols;
 	int row;
 	int key;
@@ -1145,6 +1897,71 @@ void sfptpd_db_table_dump_impl(int trace_level,
 }
 
 
+void sfptpd_db_cursor_open_impl(struct sfptpd_db_cursor *cursor,
+				struct sfptpd_db_table *table, ...)
+{
+	va_list ap;
+
+	assert(cursor != NULL);
+	assert(table != NULL);
+	assert(table->magic == MAGIC_TABLE);
+
+	/* Build up the key-value list */
+	va_start(ap, table);
+	build_selection_params(&cursor->selection, ap);
+	va_end(ap);
+
+	cursor_open(cursor, table, true);
+}
+
+
+void *sfptpd_db_cursor_next(struct sfptpd_db_cursor *cursor)
+{
+	assert(cursor != NULL);
+	assert(cursor->table != NULL);
+
+	if (cursor->done)
+		return NULL;
+
+	if (cursor->sort)
+		cursor->record = cursor_next_sorted(cursor);
+	else
+		cursor->record = cursor_source_record(cursor, &cursor->store_element);
+
+	if (cursor->record == NULL)
+		cursor->done = true;
+
+	return cursor->record;
+}
+
+
+struct sfptpd_db_record_ref sfptpd_db_cursor_ref(const struct sfptpd_db_cursor *cursor)
+{
+	assert(cursor != NULL);
+
+	return (struct sfptpd_db_record_ref) {
+		.table = cursor->table,
+		.store_element = cursor->store_element,
+		.valid = cursor->record != NULL,
+	};
+}
+
+
+void sfptpd_db_cursor_close(struct sfptpd_db_cursor *cursor)
+{
+	assert(cursor != NULL);
+
+	if (cursor->table == NULL)
+		return;
+
+	if (cursor->source == CURSOR_SOURCE_SNAPSHOT)
+		free(cursor->elements);
+
+	table_read_end(cursor->table);
+	cursor->table = NULL;
+}
+
+
 bool sfptpd_db_record_exists(struct sfptpd_db_record_ref *ref)
 {
 	return ref->valid;
@@ -1167,13 +1984,37 @@ void sfptpd_db_record_get_data(struct sfptpd_db_record_ref *ref, void *dest, siz
 void sfptpd_db_record_update(struct sfptpd_db_record_ref *record_ref,
 			     const void *updated_values)
 {
+	struct sfptpd_db_table *table;
+	struct sfptpd_db_field *field;
+	struct index *index;
+	bool moved[MAX_FIELDS];
 	void *data;
+	int i;
 
 	assert(record_ref->valid);
 
-	data = record_ref->table->store->ops->get_data(record_ref);
+	table = record_ref->table;
+	table_lock(table);
+	data = table->store->ops->get_data(record_ref);
+
+	/* Take the record out of the indexes in which its key changes */
+	assert(table->num_indexes <= MAX_FIELDS);
+	for (i = 0; i < table->num_indexes; i++) {
+		index = &table->indexes[i];
+		field = &table->def->fields[index->field];
+		moved[i] = field->compare_record(data, updated_values) != 0;
+		if (moved[i])
+			index_remove(table, index, record_ref->store_element, data);
+	}
 
-	memcpy(data, updated_values, record_ref->table->def->record_size);
+	memcpy(data, updated_values, table->def->record_size);
+
+	for (i = 0; i < table->num_indexes; i++) {
+		if (moved[i])
+			index_add(table, &table->indexes[i],
+				  record_ref->store_element, data);
+	}
+	table_unlock(table);
 }
 
 
@@ -41,9 +41,14 @@
 #include "sfptpd_pps_module.h"
 #include "sfptpd_freerun_module.h"
 #include "sfptpd_crny_module.h"
+#include "sfptpd_crny_refclock.h"
+#include "sfptpd_ntp_shm.h"
 #include "sfptpd_netlink.h"
 #include "sfptpd_multicast.h"
 #include "sfptpd_clockfeed.h"
+#include "sfptpd_json.h"
+#include "sfptpd_metrics.h"
+#include "sfptpd_startup.h"
 
 
 /****************************************************************************
@@ -187,6 +192,42 @@ enum leap_second_state {
 	LEAP_SECOND_STATE_TEST
 };
 
+/* Number of clocks for which realtime stats JSON fragments are cached */
+#define RT_STATS_CLOCK_CACHE_SIZE (16)
+
+/* Cached JSON fragments describing a clock in realtime stats output.
+ * The name member is followed by the primary interface member, if any. */
+struct rt_stats_clock_json {
+	const struct sfptpd_clock *clock;
+	size_t name_len;
+	size_t len;
+	char text[2 * SFPTPD_CLOCK_FULL_NAME_SIZE + 64];
+};
+
+/* Maximum age of the clock feed samples behind a cached clustering
+ * comparison, beyond which instances get the default clustering score */
+#define CLUSTERING_MAX_SAMPLE_AGE_S (4)
+
+/* Cached comparison of a sync instance's local reference clock with that
+ * of the clustering discriminator. The clock feed subscription is only
+ * touched by the engine thread; the other members are read by sync module
+ * threads under the clustering lock.
+ * @feed: Clock feed subscription for the instance's clock
+ * @feed_clock: Clock to which the subscription refers
+ * @clock: Clock for which the cached comparison was made
+ * @valid: Whether the cached comparison is usable
+ * @discrim_to_instance_lrc: (d_lrc - i_lrc) - (d_lrc - d_gm)
+ * @mono: Monotonic time of the older clock feed sample compared
+ */
+struct clustering_entry {
+	struct sfptpd_clockfeed_sub *feed;
+	struct sfptpd_clock *feed_clock;
+	struct sfptpd_clock *clock;
+	bool valid;
+	struct sfptpd_timespec discrim_to_instance_lrc;
+	struct sfptpd_timespec mono;
+};
+
 /* Reasons for netlink flow control */
 #define NL_XOFF_SPACE (1 << 1)
 #define NL_XOFF_COALESCE (1 << 2)
@@ -203,6 +244,11 @@ struct sfptpd_engine {
 	struct sfptpd_clockfeed *clockfeed;
 	struct sfptpd_thread *clockfeed_thread;
 
+	/* OpenMetrics exporter service and the engine's metrics */
+	struct sfptpd_metrics *metrics;
+	struct sfptpd_thread *metrics_thread;
+	struct sfptpd_metrics_source *metrics_source;
+
 	/* Leap second data */
 	struct {
 		/* Leap second state */
@@ -226,6 +272,9 @@ struct sfptpd_engine {
 	struct sync_instance_record *sync_instances;
 	int num_sync_instances;
 
+	/* Ranking of the sync instances under the selection policy */
+	struct sfptpd_bic_ranking *ranking;
+
 	/* Current candidate sync instance for selection */
 	struct sync_instance_record *candidate;
 
@@ -235,6 +284,25 @@ struct sfptpd_engine {
 	/* Discriminator sync instance for clustering */
 	struct sync_instance_record *clustering_discriminator;
 
+	/* Clustering comparisons, evaluated for all sync instances in one
+	 * pass per discriminator input and consulted by sync modules */
+	struct {
+		pthread_mutex_t lock;
+		struct clustering_entry *entries;
+		struct sfptpd_clockfeed_sub *discrim_feed;
+		struct sfptpd_clock *discrim_clock;
+		unsigned long passes;
+		long double last_pass_s;
+	} clustering;
+
+	/* Chrony SOCK refclock outputs and the sync instances feeding them */
+	struct sfptpd_crny_refclock *refclocks[SFPTPD_CHRONY_REFCLOCKS_MAX];
+	struct sync_instance_record *refclock_instances[SFPTPD_CHRONY_REFCLOCKS_MAX];
+	int num_refclocks;
+
+	/* NTP SHM refclock export of the selected sync instance */
+	struct sfptpd_ntp_shm *ntp_shm;
+
 	/* Time instance last changed */
 	struct sfptpd_timespec last_instance_change;
 
@@ -255,6 +323,19 @@ struct sfptpd_engine {
 	const struct sfptpd_link_table *link_table;
 	int link_subscribers;
 	int netlink_xoff;
+
+	/* Cached realtime stats strings, invalidated on interface changes */
+	struct {
+		struct rt_stats_clock_json clocks[RT_STATS_CLOCK_CACHE_SIZE];
+		unsigned int num_clocks;
+		unsigned int next_victim;
+		sfptpd_secs_t time_secs;
+		size_t time_len;
+		char time[24];
+	} rt_json_cache;
+
+	/* Number of startup phases last written out */
+	int startup_phases_written;
 };
 
 
@@ -755,6 +836,37 @@ static void write_sync_instances(struct sfptpd_engine *engine)
 }
 
 
+static void write_startup(struct sfptpd_engine *engine)
+{
+	struct sfptpd_json_buf *buf;
+	struct sfptpd_log *log;
+	int phases;
+
+	assert(engine != NULL);
+
+	/* Only write out the timeline when new phases have been reached */
+	phases = sfptpd_startup_count();
+	if (phases == engine->startup_phases_written)
+		return;
+	engine->startup_phases_written = phases;
+
+	log = sfptpd_log_open_startup();
+	if (log != NULL) {
+		sfptpd_startup_write_table(sfptpd_log_file_get_stream(log));
+		sfptpd_log_file_close(log);
+	}
+
+	buf = sfptpd_log_rt_stats_begin();
+	if (buf != NULL) {
+		sfptpd_json_lit(buf, "{\"startup\":");
+		sfptpd_startup_write_json(buf);
+		sfptpd_json_lit(buf, "}\n");
+		if (sfptpd_log_rt_stats_end(true) != 0)
+			TRACE_L4("engine: startup record too long\n");
+	}
+}
+
+
 static void write_interfaces(void)
 {
 	const char *format_interface_string = "| %16s | %8s | %21s | %17s |\n";
@@ -762,10 +874,9 @@ static void write_interfaces(void)
 	const char *ts_caps[4] = {"-", "sw", "hw", "hw & sw"};
 	struct sfptpd_log *log;
 	FILE *stream;
-	struct sfptpd_interface *interface;
-	struct sfptpd_db_query_result query_result;
+	struct sfptpd_interface *interface, *next;
+	struct sfptpd_db_cursor cursor;
 	const char *ptp_caps, *rx_ts_caps;
-	int i;
 
 	log = sfptpd_log_open_interfaces();
 	if (log == NULL)
@@ -778,11 +889,12 @@ static void write_interfaces(void)
 			     "pkt-timestamping-caps",
 			     "mac-address");
 
-	query_result = sfptpd_interface_get_all_snapshot();
+	sfptpd_interface_cursor_open_all(&cursor);
 
-	for (i = 0; i < query_result.num_records; i++) {
-		struct sfptpd_interface **intfp = query_result.record_ptrs[i];
-		interface = *intfp;
+	/* Look one interface ahead to know which row is the last */
+	next = sfptpd_interface_cursor_next(&cursor);
+	while ((interface = next) != NULL) {
+		next = sfptpd_interface_cursor_next(&cursor);
 
 		/* This is slightly naughty. It's safe in the sense that it
 		 * can't cause a crash/corruption etc but might no longer be
@@ -791,14 +903,14 @@ static void write_interfaces(void)
 		rx_ts_caps = ts_caps[sfptpd_interface_rx_ts_caps(interface) & SFPTPD_INTERFACE_TS_CAPS_ALL];
 
 		sfptpd_log_table_row(stream,
-				     (i + 1 == query_result.num_records),
+				     next == NULL,
 				     format_interface_data,
 				     sfptpd_interface_get_name(interface),
 				     ptp_caps, rx_ts_caps,
 				     sfptpd_interface_get_mac_string(interface));
 	}
 
-	query_result.free(&query_result);
+	sfptpd_db_cursor_close(&cursor);
 
 	sfptpd_log_file_close(log);
 }
@@ -996,96 +1108,183 @@ static void write_rt_stats_log(struct sfptpd_log_time *time,
 }
 
 
-static void write_rt_stats_json(FILE* json_stats_fp,
-				struct sfptpd_sync_instance_rt_stats_entry *entry)
+static const struct rt_stats_clock_json *
+rt_stats_clock_json(struct sfptpd_engine *engine,
+		    const struct sfptpd_clock *clock)
 {
-	char* comma = "";
-	char ftime[24];
-	size_t len = 0;
+	struct rt_stats_clock_json *entry;
+	struct sfptpd_json_buf buf;
+	unsigned int i;
 
-	assert(json_stats_fp != NULL);
-	assert(entry != NULL);
+	for (i = 0; i < engine->rt_json_cache.num_clocks; i++) {
+		entry = &engine->rt_json_cache.clocks[i];
+		if (entry->clock == clock)
+			return entry;
+	}
 
-	#define LPRINTF(...) { \
-		int _ret = fprintf(__VA_ARGS__); \
-		if (_ret < 0) { \
-			 TRACE_L4("error writing json stats, %s\n", \
-				  strerror(errno)); \
-			 return; \
-		} \
-		len += _ret; \
+	if (engine->rt_json_cache.num_clocks < RT_STATS_CLOCK_CACHE_SIZE) {
+		entry = &engine->rt_json_cache.clocks[engine->rt_json_cache.num_clocks++];
+	} else {
+		entry = &engine->rt_json_cache.clocks[engine->rt_json_cache.next_victim];
+		engine->rt_json_cache.next_victim =
+			(engine->rt_json_cache.next_victim + 1) % RT_STATS_CLOCK_CACHE_SIZE;
 	}
 
-	LPRINTF(json_stats_fp, "{\"instance\":\"%s\",\"time\":\"%s\","
-		"\"clock-master\":{\"name\":\"%s\"",
-		entry->instance_name ? entry->instance_name : "",
-		entry->time.time, entry->clock_master ?
-			sfptpd_clock_get_long_name(entry->clock_master) : entry->source);
+	sfptpd_json_init(&buf, entry->text, sizeof entry->text);
+	sfptpd_json_lit(&buf, "\"name\":");
+	sfptpd_json_string(&buf, sfptpd_clock_get_long_name(clock));
+	entry->name_len = buf.len;
+
+	/* Extra info about clock interface, mostly useful when using bonds */
+	if (clock != sfptpd_clock_get_system_clock()) {
+		sfptpd_json_lit(&buf, ",\"primary-interface\":");
+		sfptpd_json_string(&buf, sfptpd_interface_get_name(
+			sfptpd_clock_get_primary_interface(clock)));
+	}
+	entry->len = buf.len;
+
+	/* Entries that do not fit are never matched */
+	entry->clock = buf.overflow ? NULL : clock;
+	if (buf.overflow)
+		entry->name_len = entry->len = 0;
+
+	return entry;
+}
 
-	/* Add clock time */
-	if (entry->clock_master != NULL) {
-		if (entry->has_m_time) {
-			sfptpd_secs_t secs = entry->time_master.sec;
-			sfptpd_local_strftime(ftime, (sizeof ftime) - 1, "%Y-%m-%d %H:%M:%S", &secs);
-			LPRINTF(json_stats_fp, ",\"time\":\"%s.%09" PRIu32 "\"",
-				ftime, entry->time_master.nsec);
-		}
 
-		/* Extra info about clock interface, mostly useful when using bonds */
-		if (entry->clock_master != sfptpd_clock_get_system_clock())
-			LPRINTF(json_stats_fp, ",\"primary-interface\":\"%s\"",
-				sfptpd_interface_get_name(
-					sfptpd_clock_get_primary_interface(entry->clock_master)));
+static void rt_stats_clock_json_invalidate(struct sfptpd_engine *engine)
+{
+	engine->rt_json_cache.num_clocks = 0;
+	engine->rt_json_cache.next_victim = 0;
+}
+
+
+static void rt_stats_json_time(struct sfptpd_engine *engine,
+			       struct sfptpd_json_buf *buf,
+			       const struct sfptpd_timespec *time)
+{
+	/* Consecutive records almost always fall in the same second */
+	if (engine->rt_json_cache.time_len == 0 ||
+	    engine->rt_json_cache.time_secs != time->sec) {
+		sfptpd_secs_t secs = time->sec;
+		sfptpd_local_strftime(engine->rt_json_cache.time,
+				      (sizeof engine->rt_json_cache.time) - 1,
+				      "%Y-%m-%d %H:%M:%S", &secs);
+		engine->rt_json_cache.time_secs = secs;
+		engine->rt_json_cache.time_len = strlen(engine->rt_json_cache.time);
 	}
 
-	/* Slave clock info */
-	LPRINTF(json_stats_fp, "},\"clock-slave\":{\"name\":\"%s\"",
-		sfptpd_clock_get_long_name(entry->clock_slave));
-	if (entry->has_s_time) {
-		sfptpd_secs_t secs = entry->time_slave.sec;
-		sfptpd_local_strftime(ftime, (sizeof ftime) - 1, "%Y-%m-%d %H:%M:%S", &secs);
-		LPRINTF(json_stats_fp, ",\"time\":\"%s.%09" PRIu32 "\"",
-			ftime, entry->time_slave.nsec);
+	sfptpd_json_lit(buf, ",\"time\":\"");
+	sfptpd_json_raw(buf, engine->rt_json_cache.time,
+			engine->rt_json_cache.time_len);
+	sfptpd_json_lit(buf, ".");
+	sfptpd_json_uint(buf, time->nsec, 9);
+	sfptpd_json_lit(buf, "\"");
+}
+
+
+static void rt_stats_json_clock(struct sfptpd_engine *engine,
+				struct sfptpd_json_buf *buf,
+				const struct sfptpd_clock *clock,
+				const struct sfptpd_timespec *time)
+{
+	const struct rt_stats_clock_json *cached;
+
+	cached = rt_stats_clock_json(engine, clock);
+	if (cached->clock == NULL) {
+		sfptpd_json_lit(buf, "\"name\":");
+		sfptpd_json_string(buf, sfptpd_clock_get_long_name(clock));
+		if (time != NULL)
+			rt_stats_json_time(engine, buf, time);
+		if (clock != sfptpd_clock_get_system_clock()) {
+			sfptpd_json_lit(buf, ",\"primary-interface\":");
+			sfptpd_json_string(buf, sfptpd_interface_get_name(
+				sfptpd_clock_get_primary_interface(clock)));
+		}
+		return;
 	}
 
-	/* Extra info about clock interface, mostly useful when using bonds */
-	if (entry->clock_slave != sfptpd_clock_get_system_clock())
-		 LPRINTF(json_stats_fp, ",\"primary-interface\":\"%s\"",
-				 sfptpd_interface_get_name(
-					 sfptpd_clock_get_primary_interface(entry->clock_slave)));
+	sfptpd_json_raw(buf, cached->text, cached->name_len);
+	if (time != NULL)
+		rt_stats_json_time(engine, buf, time);
+	sfptpd_json_raw(buf, cached->text + cached->name_len,
+			cached->len - cached->name_len);
+}
 
-	LPRINTF(json_stats_fp, "},\"is-disciplining\":%s,\"in-sync\":%s,"
-			       "\"alarms\":[",
-			entry->is_disciplining ? "true" : "false",
-			entry->is_in_sync ? "true" : "false");
 
-	/* Alarms */
-	len += sfptpd_sync_module_alarms_stream(json_stats_fp, entry->alarms, ",");
+static void write_rt_stats_json(struct sfptpd_engine *engine,
+				struct sfptpd_json_buf *buf,
+				struct sfptpd_sync_instance_rt_stats_entry *entry)
+{
+	bool comma = false;
+
+	assert(buf != NULL);
+	assert(entry != NULL);
+
+	sfptpd_json_lit(buf, "{\"instance\":");
+	sfptpd_json_string(buf, entry->instance_name ? entry->instance_name : "");
+	sfptpd_json_lit(buf, ",\"time\":");
+	sfptpd_json_string(buf, entry->time.time);
+	sfptpd_json_lit(buf, ",\"clock-master\":{");
+
+	if (entry->clock_master != NULL) {
+		rt_stats_json_clock(engine, buf, entry->clock_master,
+				    entry->has_m_time ? &entry->time_master : NULL);
+	} else {
+		sfptpd_json_lit(buf, "\"name\":");
+		sfptpd_json_string(buf, entry->source);
+	}
+
+	/* Slave clock info */
+	sfptpd_json_lit(buf, "},\"clock-slave\":{");
+	rt_stats_json_clock(engine, buf, entry->clock_slave,
+			    entry->has_s_time ? &entry->time_slave : NULL);
 
-	LPRINTF(json_stats_fp, "],\"stats\":{");
+	sfptpd_json_lit(buf, "},\"is-disciplining\":");
+	if (entry->is_disciplining)
+		sfptpd_json_lit(buf, "true");
+	else
+		sfptpd_json_lit(buf, "false");
+	sfptpd_json_lit(buf, ",\"in-sync\":");
+	if (entry->is_in_sync)
+		sfptpd_json_lit(buf, "true");
+	else
+		sfptpd_json_lit(buf, "false");
+
+	/* Alarms */
+	sfptpd_json_lit(buf, ",\"alarms\":[");
+	sfptpd_sync_module_alarms_json(buf, entry->alarms, ",");
+	sfptpd_json_lit(buf, "],\"stats\":{");
 
 	/* Print those stats which are present */
+	#define JSON_KEY(k) \
+		if (comma) \
+			sfptpd_json_lit(buf, ","); \
+		sfptpd_json_lit(buf, "\""); \
+		sfptpd_json_text(buf, RT_STATS_KEY_NAMES[k]); \
+		sfptpd_json_lit(buf, "\":"); \
+		comma = true;
 	#define FLOAT_JSON_OUT(k, v) \
 		if (entry->stat_present & (1 << k)) { \
-			LPRINTF(json_stats_fp, "%s\"%s\":%Lf", comma, RT_STATS_KEY_NAMES[k], v); \
-			comma = ","; \
+			JSON_KEY(k); \
+			sfptpd_json_float(buf, v, 6); \
 		}
 	#define INT_JSON_OUT(k, v) \
 		if (entry->stat_present & (1 << k)) { \
-			LPRINTF(json_stats_fp, "%s\"%s\":%d", comma, RT_STATS_KEY_NAMES[k], v); \
-			comma = ","; \
+			JSON_KEY(k); \
+			sfptpd_json_int(buf, v); \
 		}
 	#define STRING_JSON_OUT(k, v) \
 		if (entry->stat_present & (1 << k)) { \
-			LPRINTF(json_stats_fp, "%s\"%s\":\"%s\"", comma, RT_STATS_KEY_NAMES[k], v); \
-			comma = ","; \
+			JSON_KEY(k); \
+			sfptpd_json_string(buf, v); \
 		}
 	#define EUI64_JSON_OUT(k, v) \
 		if (entry->stat_present & (1 << k)) { \
-			LPRINTF(json_stats_fp, "%s\"%s\":\"" SFPTPD_FORMAT_EUI64 "\"", \
-					comma, RT_STATS_KEY_NAMES[k], \
-					v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]); \
-			comma = ","; \
+			JSON_KEY(k); \
+			sfptpd_json_lit(buf, "\""); \
+			sfptpd_json_hex(buf, v, 8, 2, ':'); \
+			sfptpd_json_lit(buf, "\""); \
 		}
 
 	FLOAT_JSON_OUT(STATS_KEY_OFFSET, entry->offset);
@@ -1101,17 +1300,14 @@ static void write_rt_stats_json(FILE* json_stats_fp,
 	FLOAT_JSON_OUT(STATS_KEY_P_TERM, entry->p_term);
 	FLOAT_JSON_OUT(STATS_KEY_I_TERM, entry->i_term);
 
+	#undef JSON_KEY
 	#undef FLOAT_JSON_OUT
 	#undef INT_JSON_OUT
 	#undef STRING_JSON_OUT
 	#undef EUI64_JSON_OUT
 
-	/* Close json object and flush stream */
-	LPRINTF(json_stats_fp, "}}\n");
-
-	#undef LPRINTF
-
-	sfptpd_log_rt_stats_written(len, entry->alarms != 0);
+	/* Close json object */
+	sfptpd_json_lit(buf, "}}\n");
 }
 
 
@@ -1465,6 +1661,8 @@ static void engine_handle_new_link_table(struct sfptpd_engine *engine, int versi
 {
 	struct sfptpd_clock **clocks_before;
 	struct sfptpd_clock **clocks_after;
+	struct sfptpd_link_delta_iter delta_iter;
+	struct sfptpd_link_delta delta;
 	size_t num_clocks_before;
 	size_t num_clocks_after;
 
@@ -1489,14 +1687,13 @@ static void engine_handle_new_link_table(struct sfptpd_engine *engine, int versi
 			return;
 		}
 
-		for (i = 0; i < engine->link_table->count; i++) {
-			const struct sfptpd_link *link = engine->link_table->rows + i;
-
-			assert(link->event != SFPTPD_LINK_DOWN);
-
-			if (link->event == SFPTPD_LINK_UP ||
-			    link->event == SFPTPD_LINK_CHANGE) {
-				rc = sfptpd_interface_hotplug_insert(link);
+		/* Handle insertions and changes before removals */
+		sfptpd_link_delta_start(&delta_iter, engine->link_table_prev,
+					engine->link_table);
+		while (sfptpd_link_delta_next(&delta_iter, &delta)) {
+			if (delta.event == SFPTPD_LINK_UP ||
+			    delta.event == SFPTPD_LINK_CHANGE) {
+				rc = sfptpd_interface_hotplug_insert(delta.link);
 
 				if (rc == 0) {
 					reconfigure = true;
@@ -1504,17 +1701,11 @@ static void engine_handle_new_link_table(struct sfptpd_engine *engine, int versi
 			}
 		}
 
-		for (i = 0; engine->link_table_prev &&
-		            i < engine->link_table_prev->count; i++) {
-			const struct sfptpd_link *link = engine->link_table_prev->rows + i;
-			int intf_i = link->if_index;
-			for (j = 0; j < engine->link_table->count; j++) {
-				int intf_j = engine->link_table->rows[j].if_index;
-				if (intf_i == intf_j)
-					break;
-			}
-			if (j == engine->link_table->count) {
-				rc = sfptpd_interface_hotplug_remove(link);
+		sfptpd_link_delta_start(&delta_iter, engine->link_table_prev,
+					engine->link_table);
+		while (sfptpd_link_delta_next(&delta_iter, &delta)) {
+			if (delta.event == SFPTPD_LINK_DOWN) {
+				rc = sfptpd_interface_hotplug_remove(delta.old_link);
 
 				if (rc == 0) {
 					reconfigure = true;
@@ -1567,6 +1758,9 @@ static void engine_handle_new_link_table(struct sfptpd_engine *engine, int versi
 	}
 
 	if (new_link_table) {
+		/* Clock names and primary interfaces may have changed */
+		rt_stats_clock_json_invalidate(engine);
+
 		/* Send new link table to subscribing sync modules */
 		for (i = 0; i < engine->link_subscribers; i++) {
 			assert(i < SFPTPD_CONFIG_CATEGORY_MAX);
@@ -1696,6 +1890,25 @@ static void on_synchronize(void *user_context)
 				engine->servo_prev_alarms[i] = alarms;
 			}
 		}
+
+		/* Feed chronyd and SHM refclock readers with samples from the
+		 * sync instances */
+		if (engine->num_refclocks != 0 || engine->ntp_shm != NULL) {
+			enum sfptpd_leap_second_type leap_second = SFPTPD_LEAP_SECOND_NONE;
+
+			if (engine->leap_second.state == LEAP_SECOND_STATE_SCHEDULED)
+				leap_second = engine->leap_second.type;
+
+			for (i = 0; i < engine->num_refclocks; i++)
+				sfptpd_crny_refclock_update(engine->refclocks[i],
+							    &engine->refclock_instances[i]->status,
+							    leap_second, &time);
+
+			if (engine->ntp_shm != NULL && engine->selected != NULL)
+				sfptpd_ntp_shm_update(engine->ntp_shm,
+						      &engine->selected->status,
+						      leap_second);
+		}
 	}
 }
 
@@ -1719,6 +1932,125 @@ void sfptpd_engine_post_rt_stats_simple(struct sfptpd_engine *engine, struct sfp
 					STATS_KEY_END);
 }
 
+static void write_metrics(struct sfptpd_json_buf *buf, void *context)
+{
+	struct sfptpd_engine *engine = (struct sfptpd_engine *) context;
+	struct sync_instance_record *instance;
+	struct sfptpd_servo_stats stats;
+	char labels[SFPTPD_METRICS_LABELS_MAX];
+	char name[SFPTPD_METRICS_NAME_MAX];
+	struct sfptpd_clock **clocks;
+	size_t num_clocks;
+	int i;
+
+	/* Sync instances */
+	sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX, "instance_state",
+			      NULL, SFPTPD_METRICS_TYPE_GAUGE,
+			      "Sync instance state, with value 1");
+	for (i = 0; i < engine->num_sync_instances; i++) {
+		instance = &engine->sync_instances[i];
+		if (instance->status.state >= SYNC_MODULE_STATE_MAX)
+			continue;
+		sfptpd_metrics_labels(labels, sizeof labels,
+				      "instance", instance->info.name,
+				      "state", sync_module_state_text[instance->status.state],
+				      NULL);
+		sfptpd_metrics_sample(buf, name, NULL, labels, 1, 0);
+	}
+
+	sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX, "instance_selected",
+			      NULL, SFPTPD_METRICS_TYPE_GAUGE,
+			      "Whether the sync instance is selected");
+	for (i = 0; i < engine->num_sync_instances; i++) {
+		instance = &engine->sync_instances[i];
+		sfptpd_metrics_labels(labels, sizeof labels,
+				      "instance", instance->info.name, NULL);
+		sfptpd_metrics_sample(buf, name, NULL, labels,
+				      instance == engine->selected, 0);
+	}
+
+	sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX, "instance_alarms",
+			      NULL, SFPTPD_METRICS_TYPE_GAUGE,
+			      "Number of alarms raised by the sync instance");
+	for (i = 0; i < engine->num_sync_instances; i++) {
+		instance = &engine->sync_instances[i];
+		sfptpd_metrics_labels(labels, sizeof labels,
+				      "instance", instance->info.name, NULL);
+		sfptpd_metrics_sample(buf, name, NULL, labels,
+				      __builtin_popcount(instance->status.alarms), 0);
+	}
+
+	sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX, "instance_offset",
+			      "seconds", SFPTPD_METRICS_TYPE_GAUGE,
+			      "Offset of the sync instance from its master");
+	for (i = 0; i < engine->num_sync_instances; i++) {
+		instance = &engine->sync_instances[i];
+		if (instance->latest_rt_stats.instance_name == NULL ||
+		    !(instance->latest_rt_stats.stat_present & (1 << STATS_KEY_OFFSET)))
+			continue;
+		sfptpd_metrics_labels(labels, sizeof labels,
+				      "instance", instance->info.name, NULL);
+		sfptpd_metrics_sample(buf, name, NULL, labels,
+				      instance->latest_rt_stats.offset / 1.0E9L, 9);
+	}
+
+	/* Local clock servos */
+#define SERVO_METRIC(metric, units, help, value, decimals)		\
+	do {								\
+		sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX,	\
+				      "servo_" metric, units,		\
+				      SFPTPD_METRICS_TYPE_GAUGE, help);	\
+		for (i = 0; i < engine->active_servos; i++) {		\
+			stats = sfptpd_servo_get_stats(engine->servos[i]); \
+			sfptpd_metrics_labels(labels, sizeof labels,	\
+				"servo", stats.servo_name,		\
+				"master", sfptpd_clock_get_short_name(stats.clock_master), \
+				"slave", sfptpd_clock_get_short_name(stats.clock_slave), \
+				NULL);					\
+			sfptpd_metrics_sample(buf, name, NULL, labels,	\
+					      (value), decimals);	\
+		}							\
+	} while (0)
+
+	SERVO_METRIC("offset", "seconds", "Offset of the slave clock from the master clock",
+		     stats.offset / 1.0E9L, 9);
+	SERVO_METRIC("freq_adj", "ppb", "Frequency adjustment of the slave clock",
+		     stats.freq_adj, 3);
+	SERVO_METRIC("in_sync", NULL, "Whether the slave clock is in sync",
+		     stats.in_sync, 0);
+	SERVO_METRIC("disciplining", NULL, "Whether the servo is disciplining the slave clock",
+		     stats.disciplining, 0);
+	SERVO_METRIC("p_term", NULL, "Current value of the PID filter P term",
+		     stats.p_term, 3);
+	SERVO_METRIC("i_term", NULL, "Current value of the PID filter I term",
+		     stats.i_term, 3);
+
+#undef SERVO_METRIC
+
+	/* Clustering evaluation */
+	if (engine->clustering.entries != NULL) {
+		sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX,
+				      "clustering_evaluations", NULL,
+				      SFPTPD_METRICS_TYPE_COUNTER,
+				      "Number of clustering evaluation passes made");
+		sfptpd_metrics_sample(buf, name, "_total", NULL,
+				      engine->clustering.passes, 0);
+		sfptpd_metrics_family(buf, name, SFPTPD_METRICS_PREFIX,
+				      "clustering_last_evaluation_duration", "seconds",
+				      SFPTPD_METRICS_TYPE_GAUGE,
+				      "Time taken by the previous clustering evaluation pass");
+		sfptpd_metrics_sample(buf, name, NULL, NULL,
+				      engine->clustering.last_pass_s, 9);
+	}
+
+	/* Clock statistics for the last complete minute */
+	clocks = sfptpd_clock_get_active_snapshot(&num_clocks);
+	if (clocks != NULL) {
+		sfptpd_clock_stats_write_metrics(buf, clocks, num_clocks);
+		sfptpd_clock_free_active_snapshot(clocks);
+	}
+}
+
 static void on_log_stats(void *user_context, unsigned int timer_id)
 {
 	struct sfptpd_engine *engine = (struct sfptpd_engine *)user_context;
@@ -1769,7 +2101,10 @@ static void on_log_stats(void *user_context, unsigned int timer_id)
 
 	write_topology(engine);
 	write_sync_instances(engine);
-	sfptpd_log_rt_stats_written(0, true);
+	sfptpd_log_rt_stats_flush();
+
+	sfptpd_metrics_publish(&engine->metrics_source, "engine",
+			       write_metrics, engine);
 }
 
 
@@ -1778,6 +2113,7 @@ static void on_save_state(void *user_context, unsigned int timer_id)
 	struct sfptpd_engine *engine = (struct sfptpd_engine *)user_context;
 	assert(engine != NULL);
 	write_state(engine);
+	write_startup(engine);
 }
 
 
@@ -1844,8 +2180,10 @@ static void on_step_clocks(struct sfptpd_engine *engine)
 	struct sync_instance_record *sync_instance;
 	struct sfptpd_sync_instance *handle;
 	struct sfptpd_sync_instance_status status;
-	struct sfptpd_timespec servo_offset;
+	struct sfptpd_servo **servos;
+	struct sfptpd_timespec *servo_offsets;
 	struct sfptpd_timespec zero = sfptpd_time_null();
+	int num_servos;
 	int rc, i;
 
 	assert(engine != NULL);
@@ -1874,8 +2212,12 @@ static void on_step_clocks(struct sfptpd_engine *engine)
 					      &status.offset_from_master);
 
 		/* For each of the servos, get the servo offset and add it to
-		 * the sync module offset. Then step the servo by this amount */
-		for (i = 0; i < engine->active_servos; i++) {
+		 * the sync module offset. Then step the servos by these
+		 * amounts together. */
+		servos = calloc(engine->active_servos, sizeof *servos);
+		servo_offsets = calloc(engine->active_servos, sizeof *servo_offsets);
+		num_servos = 0;
+		for (i = 0; i < engine->active_servos && servos && servo_offsets; i++) {
 			struct sfptpd_servo_stats stats = sfptpd_servo_get_stats(engine->servos[i]);
 			if (SYNC_MODULE_ALARM_TEST(stats.alarms, CLOCK_NEAR_EPOCH)) {
 				WARNING("%s slave clock %s not stepped because master clock %s is near epoch.\n",
@@ -1885,14 +2227,24 @@ static void on_step_clocks(struct sfptpd_engine *engine)
 			}
 
 			sfptpd_servo_get_offset_from_master(engine->servos[i],
-							    &servo_offset);
+							    &servo_offsets[num_servos]);
 
-			sfptpd_time_add(&servo_offset, &servo_offset,
+			sfptpd_time_add(&servo_offsets[num_servos],
+					&servo_offsets[num_servos],
 					&status.offset_from_master);
 
-			(void)sfptpd_servo_step_clock(engine->servos[i], &servo_offset);
+			servos[num_servos++] = engine->servos[i];
 		}
 
+		if (engine->active_servos != 0 && (servos == NULL || servo_offsets == NULL))
+			ERROR("engine: could not allocate servo steps, %s\n",
+			      strerror(errno));
+		else
+			(void)sfptpd_servo_step_clocks(servos, servo_offsets, num_servos);
+
+		free(servos);
+		free(servo_offsets);
+
 		/* We also need to tell NTP sync modules that the clock has
 		 * been stepped so that they ignore the NTP offset until the
 		 * next reading from the NTP daemon. Note that the actual
@@ -1973,10 +2325,9 @@ static void on_sync_instance_state_changed(struct sfptpd_engine *engine,
 	/* Update the status of this sync instance and then re-evaluate the best
 	 * instance */
 	instance_record->status = *status;
-	new_candidate = sfptpd_bic_choose(&engine->general_config->selection_policy,
-					  engine->sync_instances,
-					  engine->num_sync_instances,
-					  engine->candidate == NULL ? engine->selected : engine->candidate);
+	sfptpd_bic_ranking_update(engine->ranking, instance_record);
+	new_candidate = sfptpd_bic_ranking_choose(engine->ranking,
+						  engine->candidate == NULL ? engine->selected : engine->candidate);
 	assert (NULL != new_candidate);
 
 	/* If we have no current candidate and proposed candidate is the
@@ -2056,6 +2407,7 @@ static void on_select_instance(struct sfptpd_engine *engine,
 		sfptpd_bic_select_instance(engine->sync_instances,
 					   engine->num_sync_instances,
 					   selected_instance);
+		sfptpd_bic_ranking_update_all(engine->ranking);
 
 		/* Select the instance */
 		(void)select_sync_instance(engine, selected_instance);
@@ -2131,10 +2483,20 @@ static void on_rt_stats_entry(struct sfptpd_engine *engine,
 	else /* This will happen for servos */
 		write_rt_stats_log(&msg->stats.time, &msg->stats);
 
-	/* Write to json_stats */
-	FILE* stream = sfptpd_log_get_rt_stats_out_stream();
-	if (stream != NULL)
-		write_rt_stats_json(stream, &msg->stats);
+	if (record != NULL && record == engine->selected && msg->stats.is_in_sync)
+		sfptpd_startup_mark(SFPTPD_STARTUP_CONVERGED);
+
+	/* Write to json_stats, retrying once if the buffer had to be emptied */
+	struct sfptpd_json_buf *buf = sfptpd_log_rt_stats_begin();
+	if (buf != NULL) {
+		write_rt_stats_json(engine, buf, &msg->stats);
+		if (sfptpd_log_rt_stats_end(msg->stats.alarms != 0) == ENOSPC) {
+			buf = sfptpd_log_rt_stats_begin();
+			write_rt_stats_json(engine, buf, &msg->stats);
+			if (sfptpd_log_rt_stats_end(msg->stats.alarms != 0) != 0)
+				TRACE_L4("engine: realtime stats record too long\n");
+		}
+	}
 }
 
 
@@ -2146,6 +2508,125 @@ static void on_log_rotate(struct sfptpd_engine *engine)
 }
 
 
+/* Point a clock feed subscription at a clock, if it has changed */
+static void clustering_follow_clock(struct sfptpd_engine *engine,
+				    struct sfptpd_clockfeed_sub **feed,
+				    struct sfptpd_clock **feed_clock,
+				    struct sfptpd_clock *clock)
+{
+	int rc;
+
+	if (*feed_clock == clock)
+		return;
+
+	if (*feed != NULL)
+		sfptpd_clockfeed_unsubscribe(engine->clockfeed, *feed);
+	*feed = NULL;
+	*feed_clock = NULL;
+
+	if (clock != NULL) {
+		rc = sfptpd_clockfeed_subscribe(engine->clockfeed, clock, feed);
+		if (rc != 0) {
+			ERROR("clustering: failed to subscribe to %s clock feed, %s\n",
+			      sfptpd_clock_get_short_name(clock), strerror(rc));
+			return;
+		}
+		*feed_clock = clock;
+	}
+}
+
+
+/* Compare the local reference clock of every sync instance with that of
+ * the discriminator using the latest clock feed samples, caching the
+ * results for sync modules to evaluate clustering scores without reading
+ * the clocks themselves. */
+static void evaluate_clustering(struct sfptpd_engine *engine)
+{
+	struct sfptpd_clustering_input *input;
+	struct clustering_entry *entry;
+	struct sfptpd_timespec start, end, lrc_diff, discriminator_ofm;
+	int i, rc;
+
+	assert(engine->clustering_discriminator != NULL);
+	assert(engine->clustering.entries != NULL);
+
+	input = &engine->clustering_discriminator->latest_clustering_input;
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Follow changes in the clocks being compared */
+	clustering_follow_clock(engine, &engine->clustering.discrim_feed,
+				&engine->clustering.discrim_clock, input->clock);
+	for (i = 0; i < engine->num_sync_instances; i++) {
+		entry = &engine->clustering.entries[i];
+		clustering_follow_clock(engine, &entry->feed, &entry->feed_clock,
+					engine->sync_instances[i].status.clock);
+	}
+
+	sfptpd_time_float_ns_to_timespec(input->offset_from_master,
+					 &discriminator_ofm);
+
+	pthread_mutex_lock(&engine->clustering.lock);
+	for (i = 0; i < engine->num_sync_instances; i++) {
+		entry = &engine->clustering.entries[i];
+		entry->clock = entry->feed_clock;
+		entry->valid = false;
+
+		if (!input->offset_valid || entry->clock == NULL ||
+		    engine->clustering.discrim_clock != input->clock)
+			continue;
+
+		/* The system clock has no feed so start from the present */
+		entry->mono = start;
+
+		/* First calculate (d_lrc - i_lrc) */
+		rc = sfptpd_clockfeed_compare(engine->clustering.discrim_feed,
+					      entry->feed, &lrc_diff,
+					      NULL, NULL, &entry->mono);
+		if (rc != 0) {
+			TRACE_L6("clustering: no comparison for %s, %s\n",
+				 engine->sync_instances[i].info.name, strerror(rc));
+			continue;
+		}
+
+		/* Now calculate (d_lrc - i_lrc) - (d_lrc - d_gm) */
+		sfptpd_time_subtract(&entry->discrim_to_instance_lrc,
+				     &lrc_diff, &discriminator_ofm);
+		entry->valid = true;
+	}
+	pthread_mutex_unlock(&engine->clustering.lock);
+
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &end);
+	sfptpd_time_subtract(&end, &end, &start);
+	engine->clustering.last_pass_s = sfptpd_time_timespec_to_float_s(&end);
+	engine->clustering.passes++;
+}
+
+
+static void clustering_free(struct sfptpd_engine *engine)
+{
+	struct clustering_entry *entry;
+	int i;
+
+	if (engine->clustering.entries == NULL)
+		return;
+
+	pthread_mutex_lock(&engine->clustering.lock);
+	for (i = 0; i < engine->num_sync_instances; i++) {
+		entry = &engine->clustering.entries[i];
+		if (entry->feed != NULL)
+			sfptpd_clockfeed_unsubscribe(engine->clockfeed, entry->feed);
+	}
+	if (engine->clustering.discrim_feed != NULL)
+		sfptpd_clockfeed_unsubscribe(engine->clockfeed,
+					     engine->clustering.discrim_feed);
+	free(engine->clustering.entries);
+	engine->clustering.entries = NULL;
+	engine->clustering.discrim_feed = NULL;
+	engine->clustering.discrim_clock = NULL;
+	pthread_mutex_unlock(&engine->clustering.lock);
+}
+
+
 static void on_clustering_input(struct sfptpd_engine *engine,
 				engine_msg_t *msg)
 {
@@ -2158,6 +2639,10 @@ static void on_clustering_input(struct sfptpd_engine *engine,
 	record = get_sync_instance_record_by_name(engine, msg->u.clustering_input.instance_name);
 	if (record != NULL)
 		record->latest_clustering_input = msg->u.clustering_input;
+
+	if (record != NULL && record == engine->clustering_discriminator &&
+	    engine->clustering.entries != NULL)
+		evaluate_clustering(engine);
 }
 
 
@@ -2214,6 +2699,7 @@ static void engine_on_shutdown(void *context)
 	struct sfptpd_clock **clocks;
 	size_t num_clocks;
 	int module;
+	int i;
 
 	assert(engine != NULL);
 
@@ -2233,6 +2719,14 @@ static void engine_on_shutdown(void *context)
 			engine->sync_modules[module] = NULL;
 		}
 	}
+	clustering_free(engine);
+	for (i = 0; i < engine->num_refclocks; i++)
+		sfptpd_crny_refclock_destroy(engine->refclocks[i]);
+	engine->num_refclocks = 0;
+	sfptpd_ntp_shm_destroy(engine->ntp_shm);
+	engine->ntp_shm = NULL;
+	sfptpd_bic_ranking_free(engine->ranking);
+	engine->ranking = NULL;
 	if (engine->sync_instances != NULL) {
 		free(engine->sync_instances);
 		engine->sync_instances = NULL;
@@ -2245,6 +2739,14 @@ static void engine_on_shutdown(void *context)
 		engine->clockfeed_thread = NULL;
 	}
 
+	sfptpd_metrics_source_free(engine->metrics_source);
+	engine->metrics_source = NULL;
+	if (engine->metrics_thread != NULL) {
+		sfptpd_thread_destroy(engine->metrics_thread);
+		engine->metrics_thread = NULL;
+		engine->metrics = NULL;
+	}
+
 	/* Ownership of netlink state reverts to main */
 }
 
@@ -2336,6 +2838,15 @@ static int engine_on_startup(void *context)
 
 	config = engine->config;
 
+	if (engine->general_config->openmetrics_socket[0] != '\0') {
+		engine->metrics = sfptpd_metrics_create(config, &engine->metrics_thread);
+		if (engine->metrics == NULL) {
+			rc = errno;
+			CRITICAL("could not start metrics service, %s\n", strerror(rc));
+			goto fail;
+		}
+	}
+
 	engine->clockfeed = sfptpd_clockfeed_create(&engine->clockfeed_thread,
 						    engine->general_config->clocks.sync_interval);
 	if (engine->clockfeed == NULL) {
@@ -2374,7 +2885,9 @@ static int engine_on_startup(void *context)
 		goto fail;
 	}
 
-	/* Create all the sync module types */
+	/* Create all the sync module types. The sync modules do not depend on
+	 * each other so let their threads start up concurrently. */
+	sfptpd_thread_defer_startup();
 	all_instances = 0;
 	for (type = 0; type < SFPTPD_CONFIG_CATEGORY_MAX; type++) {
 		int instances = sfptpd_config_category_count_instances(config, type);
@@ -2383,11 +2896,20 @@ static int engine_on_startup(void *context)
 		if ((instances != 0) || (type == SFPTPD_CONFIG_CATEGORY_NTP)) {
 			rc = create_sync_module(engine, config, type, all_instances);
 			if (rc != 0)
-				goto fail;
+				break;
 		}
 		all_instances += instances;
 	}
 
+	/* Wait for the sync modules that were created to start up */
+	if (sfptpd_thread_await_startup() != 0 && rc == 0) {
+		CRITICAL("failed to start sync modules\n");
+		rc = EREPORTED;
+	}
+	if (rc != 0)
+		goto fail;
+	sfptpd_startup_mark(SFPTPD_STARTUP_SYNC_MODULES_CREATED);
+
 	/* Now we have all the selectable sync instances */
 	engine->num_sync_instances = all_instances;
 	if (all_instances == 0) {
@@ -2457,6 +2979,57 @@ static int engine_on_startup(void *context)
 			/* Ensure discriminator instance defaults to a good clustering
 			   score to avoid pathological outcomes. */
 			engine->clustering_discriminator->status.clustering_score = 1;
+
+			if (engine->general_config->clustering_mode == SFPTPD_CLUSTERING_MODE_DISCRIMINATOR) {
+				struct clustering_entry *entries;
+
+				entries = calloc(engine->num_sync_instances, sizeof *entries);
+				if (entries == NULL) {
+					CRITICAL("failed to allocate clustering state\n");
+					rc = ENOMEM;
+					goto fail;
+				}
+				pthread_mutex_lock(&engine->clustering.lock);
+				engine->clustering.entries = entries;
+				pthread_mutex_unlock(&engine->clustering.lock);
+			}
+		}
+	}
+
+	/* Create the chrony SOCK refclock outputs */
+	for (i = 0; i < engine->general_config->num_chrony_refclocks; i++) {
+		const struct sfptpd_config_chrony_refclock *refclock_config =
+			&engine->general_config->chrony_refclocks[i];
+		struct sync_instance_record *refclock_instance;
+
+		refclock_instance = get_sync_instance_record_by_name(engine,
+								     refclock_config->instance);
+		if (refclock_instance == NULL) {
+			CRITICAL("can't find sync instance '%s' for chrony refclock\n",
+				 refclock_config->instance);
+			rc = ENOENT;
+			goto fail;
+		}
+
+		rc = sfptpd_crny_refclock_create(refclock_config, engine->clockfeed,
+						 &engine->refclocks[engine->num_refclocks]);
+		if (rc != 0) {
+			CRITICAL("failed to create chrony refclock for %s, %s\n",
+				 refclock_config->instance, strerror(rc));
+			goto fail;
+		}
+		engine->refclock_instances[engine->num_refclocks++] = refclock_instance;
+	}
+
+	/* Create the NTP SHM refclock export */
+	if (engine->general_config->num_ntp_shm_units != 0) {
+		rc = sfptpd_ntp_shm_create(engine->general_config->ntp_shm_units,
+					   engine->general_config->num_ntp_shm_units,
+					   engine->clockfeed, &engine->ntp_shm);
+		if (rc != 0) {
+			CRITICAL("failed to create NTP SHM refclock export, %s\n",
+				 strerror(rc));
+			goto fail;
 		}
 	}
 
@@ -2464,8 +3037,15 @@ static int engine_on_startup(void *context)
 	 * Must do this after gathering initial status since BIC requires a valid
 	 * status.
 	 */
-	bic_instance = sfptpd_bic_choose(&engine->general_config->selection_policy,
-					 engine->sync_instances, engine->num_sync_instances, NULL);
+	engine->ranking = sfptpd_bic_ranking_create(&engine->general_config->selection_policy,
+						    engine->sync_instances,
+						    engine->num_sync_instances);
+	if (engine->ranking == NULL) {
+		CRITICAL("failed to allocate sync instance ranking\n");
+		rc = ENOMEM;
+		goto fail;
+	}
+	bic_instance = sfptpd_bic_ranking_choose(engine->ranking, NULL);
 	assert (NULL != bic_instance);
 
 	if (engine->general_config->selection_policy.strategy == SFPTPD_SELECTION_STRATEGY_AUTOMATIC) {
@@ -2491,6 +3071,7 @@ static int engine_on_startup(void *context)
 		/* In manual mode, we want to tell the BIC that the instance is manually selected */
 		if (engine->general_config->selection_policy.strategy == SFPTPD_SELECTION_STRATEGY_MANUAL) {
 			sfptpd_bic_select_instance(engine->sync_instances, engine->num_sync_instances, initial_instance);
+			sfptpd_bic_ranking_update_all(engine->ranking);
 		}
 
 		/* In both manual modes, we initially select the user-supplied instance */
@@ -2558,6 +3139,9 @@ static void on_run(struct sfptpd_engine *engine)
 		}
 	}
 
+	sfptpd_startup_mark(SFPTPD_STARTUP_RUNNING);
+	write_startup(engine);
+
 fail:
 	if (rc != 0)
 		sfptpd_thread_exit(rc);
@@ -2692,6 +3276,7 @@ int sfptpd_engine_create(struct sfptpd_config *config,
 	new->general_config = sfptpd_general_config_get(config);
 	new->netlink_state = netlink;
 	new->link_table = initial_link_table;
+	pthread_mutex_init(&new->clustering.lock, NULL);
 
 	rc = sfptpd_thread_create("engine", &engine_thread_ops, new, &new->thread);
 	if (rc != 0) {
@@ -2709,6 +3294,7 @@ int sfptpd_engine_create(struct sfptpd_config *config,
 	return 0;
 
 fail1:
+	pthread_mutex_destroy(&new->clustering.lock);
 	free(new);
 	*engine = NULL;
 	return rc;
@@ -2725,8 +3311,10 @@ void sfptpd_engine_destroy(struct sfptpd_engine *engine)
 		/* Finally free the memory. Note that this is done after
 		 * deleting the thread as the reference to the thread is inside
 		 * the engine data. */
-		if (rc == 0)
+		if (rc == 0) {
+			pthread_mutex_destroy(&engine->clustering.lock);
 			free(engine);
+		}
 	}
 }
 
@@ -2829,22 +3417,28 @@ static bool offset_valid(const struct sfptpd_timespec *offset_from_master)
 /*
 	For discriminator option:
 		Return clustering_score_without_discriminator if discriminator 
-                	OR sync instance offset is invalid.
+                	OR sync instance offset is invalid OR no comparison of
+			their clocks within CLUSTERING_MAX_SAMPLE_AGE_S is cached.
 		Return 1 if both discriminator AND sync instance have time AND
 			sync instance is within threshold of discriminator.
 		Return 1 if the candidate is also the discriminator reference.
 		Return 0 if sync instance is outside discriminator threshold. 
 		Return 0 if discriminator mode clustering is not used.
+	The clocks are not read here: the comparison is taken from the
+	engine's latest clustering evaluation pass.
 */
 int sfptpd_engine_calculate_clustering_score(struct sfptpd_clustering_evaluator *evaluator,
 					       sfptpd_time_t offset_from_master,
 					       struct sfptpd_clock *instance_clock)
 {	
 	struct sfptpd_engine *engine;
-	struct sfptpd_clustering_input *discriminator;
+	struct sync_instance_record *record;
+	struct clustering_entry *entry;
 	int default_score;
 	struct sfptpd_timespec instance_ofm;
-	struct sfptpd_timespec discriminator_ofm;
+	struct sfptpd_timespec discrim_to_instance;
+	struct sfptpd_timespec now, age;
+	bool valid;
 
 	assert(evaluator);
 	assert(evaluator->private);
@@ -2859,11 +3453,8 @@ int sfptpd_engine_calculate_clustering_score(struct sfptpd_clustering_evaluator
 		return 1;
 
 	default_score = engine->general_config->clustering_score_without_discriminator;
-	discriminator = &engine->clustering_discriminator->latest_clustering_input;
 
-	sfptpd_time_float_ns_to_timespec(discriminator->offset_from_master,
-					 &discriminator_ofm);
-	if (!discriminator->offset_valid) {
+	if (!engine->clustering_discriminator->latest_clustering_input.offset_valid) {
 		TRACE_L5("clustering: offset invalid for clustering determinant %s: using default clustering score %d\n",
 		         engine->clustering_discriminator->info.name,
 			 default_score);
@@ -2879,27 +3470,35 @@ int sfptpd_engine_calculate_clustering_score(struct sfptpd_clustering_evaluator
 		return default_score;
 	}
 
-	/* clock valid and discriminator valid */
-	/* compare clock against discriminator */
-	struct sfptpd_timespec discrim_lrc_to_instance_lrc;
-	struct sfptpd_timespec discrim_to_instance_lrc;
-	struct sfptpd_timespec discrim_to_instance;
+	record = get_sync_instance_record_by_name(engine, evaluator->instance_name);
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &now);
 
-	/* First calculate (d_lrc - i_lrc) */
-	sfptpd_clock_compare(discriminator->clock,
-			     instance_clock,
-			     &discrim_lrc_to_instance_lrc);
+	/* Take the cached (d_lrc - i_lrc) - (d_lrc - d_gm) if fresh */
+	pthread_mutex_lock(&engine->clustering.lock);
+	valid = false;
+	if (record != NULL && engine->clustering.entries != NULL) {
+		entry = &engine->clustering.entries[record - engine->sync_instances];
+		sfptpd_time_subtract(&age, &now, &entry->mono);
+		if (entry->valid && entry->clock == instance_clock &&
+		    age.sec < CLUSTERING_MAX_SAMPLE_AGE_S) {
+			discrim_to_instance = entry->discrim_to_instance_lrc;
+			valid = true;
+		}
+	}
+	pthread_mutex_unlock(&engine->clustering.lock);
 
-	/* Now calculate (d_lrc - i_lrc) - (d_lrc - d_gm) */
-	sfptpd_time_subtract(&discrim_to_instance_lrc,
-			     &discrim_lrc_to_instance_lrc,
-			     &discriminator_ofm);
+	if (!valid) {
+		TRACE_L6("clustering: no recent clock comparison for clustering candidate %s: using default clustering score %d\n",
+			 evaluator->instance_name,
+			 default_score);
+		return default_score;
+	}
 
 	/* Now calculate (d_lrc - i_lrc) - (d_lrc - d_gm) + (i_lrc - i_gm) */
 	/* = d_lrc - i_lrc - d_lrc + d_gm + i_lrc - i_gm */
 	/* = d_gm - i_gm */
 	sfptpd_time_add(&discrim_to_instance,
-			&discrim_to_instance_lrc,
+			&discrim_to_instance,
 			&instance_ofm);
 
 	sfptpd_time_t diff_i = sfptpd_time_timespec_to_float_ns(&discrim_to_instance);
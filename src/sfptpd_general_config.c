@@ -17,6 +17,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/un.h>
 #include <pwd.h>
 #include <grp.h>
 
@@ -29,6 +30,7 @@
 #include "sfptpd_statistics.h"
 #include "sfptpd_phc.h"
 #include "sfptpd_crny_module.h"
+#include "sfptpd_metrics.h"
 
 
 /****************************************************************************
@@ -99,6 +101,12 @@ static int parse_json_stats(struct sfptpd_config_section *section, const char *o
 
 static int parse_json_remote_monitor(struct sfptpd_config_section *section, const char *option,
 				     unsigned int num_params, const char * const params[]);
+static int parse_openmetrics_socket(struct sfptpd_config_section *section, const char *option,
+				    unsigned int num_params, const char * const params[]);
+static int parse_chrony_refclock(struct sfptpd_config_section *section, const char *option,
+				 unsigned int num_params, const char * const params[]);
+static int parse_ntp_shm(struct sfptpd_config_section *section, const char *option,
+			 unsigned int num_params, const char * const params[]);
 static int parse_hotplug_detection_mode(struct sfptpd_config_section *section, const char *option,
 					unsigned int num_params, const char * const params[]);
 static int parse_reporting_intervals(struct sfptpd_config_section *section, const char *option,
@@ -119,6 +127,10 @@ static int parse_ignore_critical(struct sfptpd_config_section *section, const ch
 				 unsigned int num_params, const char * const params[]);
 static int parse_rtc_adjust(struct sfptpd_config_section *section, const char *option,
 			    unsigned int num_params, const char * const params[]);
+static int parse_message_log_async(struct sfptpd_config_section *section, const char *option,
+				   unsigned int num_params, const char * const params[]);
+static int parse_persistent_stats(struct sfptpd_config_section *section, const char *option,
+				  unsigned int num_params, const char * const params[]);
 static int parse_clock_display_fmts(struct sfptpd_config_section *section, const char *option,
 				    unsigned int num_params, const char * const params[]);
 static int parse_unique_clockid_bits(struct sfptpd_config_section *section, const char *option,
@@ -158,10 +170,21 @@ static const sfptpd_config_option_t config_general_options[] =
 		"Specifies where to send messages generated by the application. By default messages are sent to stderr",
 		1, SFPTPD_CONFIG_SCOPE_GLOBAL,
 		parse_message_log},
+	{"message_log_async", "<off | on>",
+		"Specifies whether messages are queued without blocking and "
+		"written out by a background thread. Enabled by default",
+		1, SFPTPD_CONFIG_SCOPE_GLOBAL,
+		parse_message_log_async},
 	{"stats_log", "<off | stdout | filename>",
 		"Specifies if and where to log statistics generated by the application. By default statistics logging is disabled",
 		1, SFPTPD_CONFIG_SCOPE_GLOBAL,
 		parse_stats_log},
+	{"persistent_stats", "<off | on>",
+		"Specifies whether the history of statistics is kept in a file "
+		"in the state directory so that it survives a restart. "
+		"Disabled by default",
+		1, SFPTPD_CONFIG_SCOPE_GLOBAL,
+		parse_persistent_stats},
 	{"user", "USER [GROUP]",
 		"Drop to the user and group named USER and GROUP retaining "
 		"essential capabilities. Group defaults to USER's if not "
@@ -287,6 +310,30 @@ static const sfptpd_config_option_t config_general_options[] =
 		"JSON-lines format to this file (http://jsonlines.org). "
 		"Disabled by default. DEPRECATED since v3.7.0.",
 		1, SFPTPD_CONFIG_SCOPE_GLOBAL, parse_json_remote_monitor},
+	{"openmetrics_socket", "<off | PATH | [ADDRESS:]PORT>",
+		"Serve statistics in OpenMetrics text format over HTTP on a Unix "
+		"domain socket at PATH or a TCP socket on PORT. TCP sockets are "
+		"bound to the loopback address unless ADDRESS is given. "
+		"Disabled by default.",
+		1, SFPTPD_CONFIG_SCOPE_GLOBAL, parse_openmetrics_socket},
+	{"chrony_refclock", "<instance> <PATH> [rate HZ] [leap <auto | none>] [offset <clock | master>]",
+		"Send samples from a sync instance to a chrony SOCK refclock "
+		"at PATH after each servo update, at most rate HZ times a second "
+		"if given. The offset given is that of the instance's local "
+		"reference clock (default) or of its master. The master offset "
+		"is the last one measured by the instance so may include "
+		"corrections the servo has since made. Scheduled leap "
+		"seconds are indicated unless leap is none. May be repeated for "
+		"up to " STRINGIFY(SFPTPD_CHRONY_REFCLOCKS_MAX) " instances. "
+		"Disabled by default.",
+		~2, SFPTPD_CONFIG_SCOPE_GLOBAL, parse_chrony_refclock},
+	{"ntp_shm", "<off | UNIT*>",
+		"Publish the time of the selected sync instance's master to "
+		"the NTP SHM refclock segments with these unit numbers, as read "
+		"by the ntpd SHM driver. Units 0 and 1 are only accessible to "
+		"root. Up to " STRINGIFY(SFPTPD_NTP_SHM_UNITS_MAX) " units may "
+		"be given. Disabled by default.",
+		~1, SFPTPD_CONFIG_SCOPE_GLOBAL, parse_ntp_shm},
 	{"hotplug_detection_mode", "<netlink | auto>",
 		"Deprecated option to configure how the daemon should detect "
 		"hotplug insertion and removal of interfaces and bond changes. "
@@ -644,6 +691,42 @@ static int parse_message_log(struct sfptpd_config_section *section, const char *
 }
 
 
+static int parse_message_log_async(struct sfptpd_config_section *section, const char *option,
+				   unsigned int num_params, const char * const params[])
+{
+	sfptpd_config_general_t *general = (sfptpd_config_general_t *)section;
+	assert(num_params == 1);
+
+	if (strcmp(params[0], "off") == 0) {
+		general->message_log_async = false;
+	} else if (strcmp(params[0], "on") == 0) {
+		general->message_log_async = true;
+	} else {
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+
+static int parse_persistent_stats(struct sfptpd_config_section *section, const char *option,
+				  unsigned int num_params, const char * const params[])
+{
+	sfptpd_config_general_t *general = (sfptpd_config_general_t *)section;
+	assert(num_params == 1);
+
+	if (strcmp(params[0], "off") == 0) {
+		general->persistent_stats = false;
+	} else if (strcmp(params[0], "on") == 0) {
+		general->persistent_stats = true;
+	} else {
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+
 static int parse_stats_log(struct sfptpd_config_section *section, const char *option,
 			   unsigned int num_params, const char * const params[])
 {
@@ -1290,6 +1373,133 @@ static int parse_json_remote_monitor(struct sfptpd_config_section *section, cons
 }
 
 
+static int parse_openmetrics_socket(struct sfptpd_config_section *section, const char *option,
+				    unsigned int num_params, const char * const params[])
+{
+	sfptpd_config_general_t *general = (sfptpd_config_general_t *)section;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	assert(general != NULL);
+	assert(num_params == 1);
+
+	if (strcmp(params[0], "off") == 0) {
+		general->openmetrics_socket[0] = '\0';
+		return 0;
+	}
+
+	if (sfptpd_metrics_parse_address(params[0], &addr, &addr_len) != 0) {
+		CFG_ERROR(section, "invalid socket address %s\n", params[0]);
+		return EINVAL;
+	}
+	sfptpd_strncpy(general->openmetrics_socket, params[0],
+		       sizeof general->openmetrics_socket);
+	return 0;
+}
+
+
+static int parse_chrony_refclock(struct sfptpd_config_section *section, const char *option,
+				 unsigned int num_params, const char * const params[])
+{
+	sfptpd_config_general_t *general = (sfptpd_config_general_t *)section;
+	sfptpd_config_chrony_refclock_t *refclock;
+	struct sockaddr_un addr;
+	int tokens;
+	int i;
+
+	assert(general != NULL);
+	assert(num_params >= 2);
+
+	if ((num_params & 1) != 0)
+		return EINVAL;
+
+	if (general->num_chrony_refclocks >= SFPTPD_CHRONY_REFCLOCKS_MAX) {
+		CFG_ERROR(section, "too many %s outputs, maximum %d\n",
+			  option, SFPTPD_CHRONY_REFCLOCKS_MAX);
+		return ENOSPC;
+	}
+	refclock = &general->chrony_refclocks[general->num_chrony_refclocks];
+
+	if (strlen(params[0]) >= sizeof refclock->instance) {
+		CFG_ERROR(section, "instance name %s too long\n", params[0]);
+		return EINVAL;
+	}
+	if (strlen(params[1]) >= sizeof addr.sun_path) {
+		CFG_ERROR(section, "socket path %s too long\n", params[1]);
+		return EINVAL;
+	}
+
+	sfptpd_strncpy(refclock->instance, params[0], sizeof refclock->instance);
+	sfptpd_strncpy(refclock->path, params[1], sizeof refclock->path);
+	refclock->rate = 0.0;
+	refclock->leap = SFPTPD_CHRONY_REFCLOCK_LEAP_AUTO;
+	refclock->offset = SFPTPD_CHRONY_REFCLOCK_OFFSET_CLOCK;
+
+	for (i = 2; i < num_params; i += 2) {
+		const char *key = params[i];
+		const char *value = params[i + 1];
+
+		if (!strcmp(key, "rate")) {
+			tokens = sscanf(value, "%f", &refclock->rate);
+			if (tokens != 1 || refclock->rate < 0.0) {
+				CFG_ERROR(section, "invalid %s rate %s\n",
+					  option, value);
+				return ERANGE;
+			}
+		} else if (!strcmp(key, "leap") && !strcmp(value, "auto")) {
+			refclock->leap = SFPTPD_CHRONY_REFCLOCK_LEAP_AUTO;
+		} else if (!strcmp(key, "leap") && !strcmp(value, "none")) {
+			refclock->leap = SFPTPD_CHRONY_REFCLOCK_LEAP_NONE;
+		} else if (!strcmp(key, "offset") && !strcmp(value, "master")) {
+			refclock->offset = SFPTPD_CHRONY_REFCLOCK_OFFSET_MASTER;
+		} else if (!strcmp(key, "offset") && !strcmp(value, "clock")) {
+			refclock->offset = SFPTPD_CHRONY_REFCLOCK_OFFSET_CLOCK;
+		} else {
+			CFG_ERROR(section, "invalid %s setting: %s %s\n",
+				  option, key, value);
+			return EINVAL;
+		}
+	}
+
+	general->num_chrony_refclocks++;
+	return 0;
+}
+
+
+static int parse_ntp_shm(struct sfptpd_config_section *section, const char *option,
+			 unsigned int num_params, const char * const params[])
+{
+	sfptpd_config_general_t *general = (sfptpd_config_general_t *)section;
+	int tokens, unit;
+	int i;
+
+	assert(general != NULL);
+	assert(num_params >= 1);
+
+	general->num_ntp_shm_units = 0;
+
+	if (num_params == 1 && strcmp(params[0], "off") == 0)
+		return 0;
+
+	if (num_params > SFPTPD_NTP_SHM_UNITS_MAX) {
+		CFG_ERROR(section, "too many %s units, maximum %d\n",
+			  option, SFPTPD_NTP_SHM_UNITS_MAX);
+		return ENOSPC;
+	}
+
+	for (i = 0; i < num_params; i++) {
+		tokens = sscanf(params[i], "%i", &unit);
+		if (tokens != 1 || unit < 0 || unit > SFPTPD_NTP_SHM_UNIT_MAX) {
+			CFG_ERROR(section, "invalid %s unit %s\n",
+				  option, params[i]);
+			return ERANGE;
+		}
+		general->ntp_shm_units[general->num_ntp_shm_units++] = unit;
+	}
+
+	return 0;
+}
+
+
 static int parse_hotplug_detection_mode(struct sfptpd_config_section *section, const char *option,
 					unsigned int num_params, const char * const params[])
 {
@@ -1663,8 +1873,10 @@ static struct sfptpd_config_section *general_config_create(const char *name,
 	} else {
 		new->config_filename[0] = '\0';
 		new->message_log = SFPTPD_DEFAULT_MESSAGE_LOG;
+		new->message_log_async = SFPTPD_DEFAULT_MESSAGE_LOG_ASYNC;
 		new->stats_log = SFPTPD_DEFAULT_STATS_LOG;
 		new->stats_log_filename[0] = '\0';
+		new->persistent_stats = SFPTPD_DEFAULT_PERSISTENT_STATS;
 		new->trace_level = SFPTPD_DEFAULT_TRACE_LEVEL;
 		sfptpd_strncpy(new->state_path, SFPTPD_DEFAULT_STATE_PATH, sizeof(new->state_path));
 		sfptpd_strncpy(new->control_path, SFPTPD_DEFAULT_CONTROL_PATH, sizeof(new->control_path));
@@ -1704,6 +1916,9 @@ static struct sfptpd_config_section *general_config_create(const char *name,
 
 		new->json_stats_filename[0] = '\0';
 		new->json_remote_monitor_filename[0] = '\0';
+		new->openmetrics_socket[0] = '\0';
+		new->num_chrony_refclocks = 0;
+		new->num_ntp_shm_units = 0;
 
 		new->clustering_mode = SFPTPD_DEFAULT_CLUSTERING_MODE;
                 new->clustering_guard_enabled = SFPTPD_DEFAULT_CLUSTERING_GUARD;
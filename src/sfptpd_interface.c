@@ -34,6 +34,7 @@
 #include <linux/pci.h>
 #include <arpa/inet.h>
 #include <regex.h>
+#include <pthread.h>
 
 #include "efx_ioctl.h"
 #include "sfptpd_logging.h"
@@ -44,6 +45,7 @@
 #include "sfptpd_statistics.h"
 #include "sfptpd_time.h"
 #include "sfptpd_interface.h"
+#include "sfptpd_interface_index.h"
 #include "sfptpd_misc.h"
 #include "sfptpd_db.h"
 
@@ -58,6 +60,19 @@
 #define SFPTPD_PROC_VLAN_PATH "/proc/net/vlan/"
 #define SFPTPD_SYSFS_VIRTUAL_NET_PATH "/sys/devices/virtual/net/"
 
+/* Link changes that require the interface to be probed again */
+#define SFPTPD_INTERFACE_REPROBE_CHANGES (SFPTPD_LINK_CHANGED_TYPE | \
+					  SFPTPD_LINK_CHANGED_IF_TYPE | \
+					  SFPTPD_LINK_CHANGED_NAME | \
+					  SFPTPD_LINK_CHANGED_TS_INFO)
+
+/* Maximum number of threads used to probe interfaces at startup */
+#define SFPTPD_INTERFACE_PROBE_THREADS (8)
+
+/* Driver stats sampled within this time are shared between consumers
+ * rather than read from the driver again */
+#define SFPTPD_INTERFACE_DRV_STATS_MAX_AGE_NS (100000000)
+
 #define VPD_TAG_RO (0x90)
 #define VPD_TAG_STR (0x82)
 #define VPD_TAG_END (0x78)
@@ -188,6 +203,14 @@ struct sfptpd_interface {
 	/* Raw driver stats buffer */
 	struct ethtool_stats *ethtool_stats;
 
+	/* Open sysfs attribute files for driver stats or -1 */
+	int drv_stat_fd[SFPTPD_DRVSTAT_MAX];
+
+	/* Last sample of the driver stats and when it was taken */
+	uint64_t drv_stats_sample[SFPTPD_DRVSTAT_MAX];
+	struct sfptpd_timespec drv_stats_sample_time;
+	bool drv_stats_sample_valid;
+
 	/* Zero adjustment for driver counters */
 	int64_t stat_zero_adjustment[SFPTPD_DRVSTAT_MAX];
 
@@ -195,6 +218,27 @@ struct sfptpd_interface {
 	struct sfptpd_link link;
 };
 
+/* The outcome of probing one row of the link table at startup */
+struct interface_probe_result {
+	/* The new interface or NULL if not suitable */
+	struct sfptpd_interface *interface;
+
+	/* Class determined by the suitability check */
+	sfptpd_interface_class_t class;
+
+	/* Result of allocating and probing the interface */
+	int rc;
+};
+
+/* Probing work shared between threads at startup */
+struct interface_probe_work {
+	const struct sfptpd_link_table *link_table;
+	struct interface_probe_result *results;
+
+	/* Next row of the link table to be claimed by a thread */
+	int next_row;
+};
+
 
 /****************************************************************************
  * Constants
@@ -261,8 +305,11 @@ static const struct drv_stat_type drv_stats[SFPTPD_DRVSTAT_MAX] = {
  *
  * The searching and sorting capabilities are provided in the database module
  * as a convenience and to separate responsibilities; they are not efficient.
- * If needed, they could be optimised by the database module maintaininng
- * indexes.
+ * The table is not indexed by the database module because its records point
+ * to interface objects that are modified in place, which would leave the
+ * indexes stale. Instead, the public lookup functions use the lookup index
+ * of sfptpd_interface_index.c, which is rebuilt from the table when the
+ * keys of the interfaces change.
  *
  ****************************************************************************/
 
@@ -270,11 +317,13 @@ static const struct drv_stat_type drv_stats[SFPTPD_DRVSTAT_MAX] = {
 #define FIND_ANY(...) interface_find_any(sfptpd_db_table_find(sfptpd_interface_table, \
 							      __VA_ARGS__))
 
-/* Macro to find the first match for the given key in the interface index of a given type */
-#define FIND_FIRST(sort_key, ...) interface_find_first(sfptpd_db_table_query(sfptpd_interface_table, \
-									     __VA_ARGS__, \
-									     SFPTPD_DB_SEL_ORDER_BY, \
-									     sort_key))
+/* Macro to find the first match for the given key in the interface index of
+ * a given type, using the supplied cursor */
+#define FIND_FIRST(cursor, sort_key, ...) (sfptpd_db_cursor_open(cursor, sfptpd_interface_table, \
+								 __VA_ARGS__, \
+								 SFPTPD_DB_SEL_ORDER_BY, \
+								 sort_key), \
+					   interface_find_first(cursor))
 
 /* Macro to generate an interface comparison function suitable for qsort */
 #define SORT_COMPAR_FN(name, intf, expr)				\
@@ -386,6 +435,9 @@ static int sfptpd_next_nic_id = 0;
 /* Shared with the clocks module */
 static pthread_mutex_t *sfptpd_interface_lock;
 
+/* Lookup index over the interface table */
+static struct sfptpd_interface_index_set interface_index;
+
 static struct utsname sysinfo = { .release = "uname-failed" };
 
 /****************************************************************************
@@ -428,24 +480,72 @@ static struct sfptpd_interface *interface_find_any(struct sfptpd_db_record_ref r
 }
 
 
-static struct sfptpd_interface *interface_find_first(struct sfptpd_db_query_result query_result)
+static struct sfptpd_interface *interface_find_first(struct sfptpd_db_cursor *cursor)
 {
-	struct sfptpd_interface *intf = NULL;
+	struct sfptpd_interface *intf = sfptpd_interface_cursor_next(cursor);
 
-	if (query_result.num_records != 0) {
-		intf = *((struct sfptpd_interface **) query_result.record_ptrs[0]);
-		assert(intf->magic == SFPTPD_INTERFACE_MAGIC);
-	}
-	query_result.free(&query_result);
+	sfptpd_db_cursor_close(cursor);
 
 	return intf;
 }
 
+
+/****************************************************************************
+ * Lookup Index
+ ****************************************************************************/
+
+/* Rebuild and publish the lookup index if the keys of any interface have
+ * changed. Called with the interface lock held after any change to the
+ * interface table or the keys of an interface. If the index cannot be
+ * built, none is published and readers fall back to searching the table. */
+static void interface_index_publish(void)
+{
+	struct sfptpd_interface_keys *keys;
+	struct sfptpd_interface *intf;
+	struct sfptpd_db_cursor cursor;
+	int count = 0;
+
+	keys = calloc(sfptpd_db_table_count(sfptpd_interface_table) + 1,
+		      sizeof *keys);
+	if (keys != NULL) {
+		sfptpd_db_cursor_open(&cursor, sfptpd_interface_table);
+		while ((intf = sfptpd_interface_cursor_next(&cursor)) != NULL) {
+			keys[count].interface = intf;
+			keys[count].if_index = intf->if_index;
+			keys[count].phc_index = intf->ts_info.phc_index;
+			keys[count].nic_id = intf->nic_id;
+			keys[count].deleted = intf->deleted;
+			keys[count].mac_addr = intf->mac_addr;
+			sfptpd_strncpy(keys[count].name, intf->name,
+				       sizeof keys[count].name);
+			count++;
+		}
+		sfptpd_db_cursor_close(&cursor);
+	}
+
+	if (sfptpd_interface_index_publish(&interface_index, keys, count) == ENOMEM)
+		WARNING("interface: could not build lookup index\n");
+}
+
+
 bool sfptpd_check_clock_interfaces(const int phc_index, const char* cfg_name)
 {
-        return FIND_ANY(INTF_KEY_CLOCK, &phc_index,
-                INTF_KEY_NAME, cfg_name,
-                SFPTPD_DB_SEL_END) != NULL;
+	const struct sfptpd_interface_index *index;
+	bool found = false;
+
+	index = sfptpd_interface_index_get(&interface_index);
+	if (index == NULL) {
+		interface_lock();
+		found = FIND_ANY(INTF_KEY_CLOCK, &phc_index,
+				 INTF_KEY_NAME, cfg_name,
+				 SFPTPD_DB_SEL_END) != NULL;
+		interface_unlock();
+	} else {
+		found = sfptpd_interface_index_phc_has_name(index, phc_index, cfg_name);
+	}
+	sfptpd_interface_index_put(&interface_index);
+
+	return found;
 }
 
 static bool sysfs_file_exists(const char *base, const char *interface,
@@ -500,6 +600,29 @@ static bool sysfs_read_int(const char *base, const char *interface,
 }
 
 
+/* Issue a read-only ioctl while probing an interface. This does not take
+ * the hardware state lock, so that interfaces can be probed in parallel,
+ * and is only safe for interface objects that are not yet shared or while
+ * the caller holds the lock. */
+static int interface_probe_ioctl(struct sfptpd_interface *interface,
+				 int request, void *data)
+{
+	struct ifreq ifr;
+
+	assert(interface != NULL);
+	assert(data != NULL);
+
+	memset(&ifr, 0, sizeof(ifr));
+	sfptpd_strncpy(ifr.ifr_name, interface->name, sizeof ifr.ifr_name);
+	ifr.ifr_data = data;
+
+	if (ioctl(sfptpd_interface_socket, request, &ifr) < 0)
+		return errno;
+
+	return 0;
+}
+
+
 static bool interface_check_suitability(const struct sfptpd_link *link,
 					const char *sysfs_dir,
 					sfptpd_interface_class_t *class)
@@ -654,7 +777,7 @@ static int interface_get_hw_address(struct sfptpd_interface *interface)
 		memset(buf, 0, sizeof(buf));
 		req->cmd = ETHTOOL_GPERMADDR;
 		req->size = ETH_ALEN;
-		rc = sfptpd_interface_ioctl(interface, SIOCETHTOOL, req);
+		rc = interface_probe_ioctl(interface, SIOCETHTOOL, req);
 		if (rc != 0) {
 			TRACE_L3("interface %s: failed to get permanent hardware address, %s\n",
 				 interface->name, strerror(rc));
@@ -724,7 +847,7 @@ static int interface_get_versions(struct sfptpd_interface *interface)
 		memset(&drv_info, 0, sizeof(drv_info));
 		drv_info.cmd = ETHTOOL_GDRVINFO;
 
-		rc = sfptpd_interface_ioctl(interface, SIOCETHTOOL, &drv_info);
+		rc = interface_probe_ioctl(interface, SIOCETHTOOL, &drv_info);
 
 		sfptpd_strncpy(interface->driver_version, drv_info.version,
 			       sizeof(interface->driver_version));
@@ -777,7 +900,7 @@ static void interface_get_ts_info(struct sfptpd_interface *interface)
 		memset(&interface->ts_info, 0, sizeof(interface->ts_info));
 		interface->ts_info.cmd = ETHTOOL_GET_TS_INFO;
 
-		rc = sfptpd_interface_ioctl(interface, SIOCETHTOOL, &interface->ts_info);
+		rc = interface_probe_ioctl(interface, SIOCETHTOOL, &interface->ts_info);
 	}
 
 	if (rc == 0) {
@@ -806,7 +929,7 @@ static void interface_check_efx_support(struct sfptpd_interface *interface)
 		req.cmd = EFX_TS_SETTIME;
 		req.u.ts_settime.iswrite = 0;
 
-		rc = sfptpd_interface_ioctl(interface, SIOCEFX, &req);
+		rc = interface_probe_ioctl(interface, SIOCEFX, &req);
 		if (rc != EOPNOTSUPP) {
 			interface->driver_supports_efx = true;
 		}
@@ -814,6 +937,26 @@ static void interface_check_efx_support(struct sfptpd_interface *interface)
 }
 
 
+static void interface_driver_stats_free(struct sfptpd_interface *interface)
+{
+	int i;
+
+	assert(interface != NULL);
+
+	for (i = 0; i < SFPTPD_DRVSTAT_MAX; i++) {
+		if (interface->drv_stat_fd[i] != -1)
+			close(interface->drv_stat_fd[i]);
+		interface->drv_stat_fd[i] = -1;
+		interface->drv_stat_method[i] = DRV_STAT_NOT_AVAILABLE;
+	}
+	interface->drv_stat_methods = 0;
+	interface->drv_stats_sample_valid = false;
+
+	free(interface->ethtool_stats);
+	interface->ethtool_stats = NULL;
+}
+
+
 /* Must be called after interface_get_versions to populate driver info */
 static void interface_driver_stats_init(struct sfptpd_interface *interface)
 {
@@ -826,6 +969,9 @@ static void interface_driver_stats_init(struct sfptpd_interface *interface)
 	TRACE_L4("interface %s: initialising driver stats-getting\n",
 		 interface->name);
 
+	/* Discard any methods found when previously probed */
+	interface_driver_stats_free(interface);
+
 	/* Method 1. Get strings from ethtool netlink */
 	if (interface->link.drv_stats_ids_state == QRY_POPULATED) {
 		for (found = 0, i = 0; i < SFPTPD_DRVSTAT_MAX; i++) {
@@ -853,7 +999,7 @@ static void interface_driver_stats_init(struct sfptpd_interface *interface)
 	gstrings->string_set = ETH_SS_STATS;
 	gstrings->len = interface->n_stats;
 
-	rc = sfptpd_interface_ioctl(interface, SIOCETHTOOL, gstrings);
+	rc = interface_probe_ioctl(interface, SIOCETHTOOL, gstrings);
 	if (rc != 0) {
 		TRACE_L3("interface %s: failed to obtain ethtool stat strings, %s\n",
 			 interface->name, strerror(errno));
@@ -881,7 +1027,8 @@ static void interface_driver_stats_init(struct sfptpd_interface *interface)
 		 interface->name, found, SFPTPD_DRVSTAT_MAX);
 
 skip_ioctl:
-	/* Method 3. Use sysfs for stats */
+	/* Method 3. Use sysfs for stats. The attribute files are kept open
+	 * and re-read from the start to take each sample. */
 	for (found = 0, j = 0; j < SFPTPD_DRVSTAT_MAX; j++) {
 		if (interface->drv_stat_method[j] == DRV_STAT_NOT_AVAILABLE) {
 
@@ -889,7 +1036,8 @@ skip_ioctl:
 				      interface->name, drv_stats[j].sysfs_name);
 			assert(rc > 0 && rc < sizeof path);
 
-			if (!access(path, R_OK)) {
+			interface->drv_stat_fd[j] = open(path, O_RDONLY | O_CLOEXEC);
+			if (interface->drv_stat_fd[j] != -1) {
 				interface->drv_stat_method[j] = DRV_STAT_SYSFS;
 				interface->drv_stat_methods |= 1 << DRV_STAT_SYSFS;
 				found++;
@@ -919,6 +1067,7 @@ skip_ioctl:
 
 static int rescan_interfaces(void)
 {
+	interface_index_publish();
 	sfptpd_interface_diagnostics(4);
 	sfptpd_clock_rescan_interfaces();
 
@@ -1046,14 +1195,15 @@ static int interface_assign_nic_id(struct sfptpd_interface *interface)
 	return 0;
 }
 
-static int interface_init(const struct sfptpd_link *link, const char *sysfs_dir,
-			  struct sfptpd_interface *interface,
-			  sfptpd_interface_class_t class)
+/* Probe the properties of an interface. This only touches the interface
+ * object so may be run concurrently for different interfaces. */
+static int interface_probe(const struct sfptpd_link *link, const char *sysfs_dir,
+			   struct sfptpd_interface *interface,
+			   sfptpd_interface_class_t class)
 {
 	int ret = 0;
 	int rc;
 	const char *name;
-	char phc_num[16] = "";
 	int if_index;
 
 	assert(link != NULL);
@@ -1098,6 +1248,19 @@ static int interface_init(const struct sfptpd_link *link, const char *sysfs_dir,
 
 	/* Check whether the device supports PHC */
 	(void) interface_is_ptp_capable(interface->name, &interface->ts_info);
+
+	/* Initialise stat-getting capability */
+	interface_driver_stats_init(interface);
+
+	return ret;
+}
+
+/* Complete the initialisation of a probed interface in the context of the
+ * other interfaces. */
+static void interface_init_complete(struct sfptpd_interface *interface)
+{
+	char phc_num[16] = "";
+
 	snprintf(phc_num, sizeof phc_num, "(%d)", interface->ts_info.phc_index);
 
 	TRACE_L3("interface %s: hw %s, flags%s%s%s\n",
@@ -1123,11 +1286,18 @@ static int interface_init(const struct sfptpd_link *link, const char *sysfs_dir,
 
 	/* Assign NIC ID */
 	interface_assign_nic_id(interface);
+}
 
-	/* Initialise stat-getting capability */
-	interface_driver_stats_init(interface);
+static int interface_init(const struct sfptpd_link *link, const char *sysfs_dir,
+			  struct sfptpd_interface *interface,
+			  sfptpd_interface_class_t class)
+{
+	int rc;
 
-	return ret;
+	rc = interface_probe(link, sysfs_dir, interface, class);
+	interface_init_complete(interface);
+
+	return rc;
 }
 
 static void interface_delete(struct sfptpd_interface *interface,
@@ -1150,6 +1320,7 @@ static void interface_delete(struct sfptpd_interface *interface,
 static int interface_alloc(struct sfptpd_interface **interface)
 {
 	struct sfptpd_interface *new;
+	int i;
 
 	assert(interface != NULL);
 
@@ -1164,6 +1335,8 @@ static int interface_alloc(struct sfptpd_interface **interface)
 	new->deleted = true;
 	new->if_index = -1;
 	new->nic_id = -1;
+	for (i = 0; i < SFPTPD_DRVSTAT_MAX; i++)
+		new->drv_stat_fd[i] = -1;
 
 	*interface = new;
 	return 0;
@@ -1180,6 +1353,79 @@ static void interface_free(struct sfptpd_interface *interface)
 }
 
 
+static void *interface_probe_thread(void *context)
+{
+	struct interface_probe_work *work = (struct interface_probe_work *) context;
+	struct interface_probe_result *result;
+	const struct sfptpd_link *link;
+	int row;
+
+	while ((row = __atomic_fetch_add(&work->next_row, 1, __ATOMIC_RELAXED)) <
+	       work->link_table->count) {
+		link = work->link_table->rows + row;
+		result = work->results + row;
+
+		/* Check that the interface is suitable i.e. an ethernet device
+		 * that isn't wireless or a bridge or virtual etc */
+		if (!interface_check_suitability(link, SFPTPD_SYSFS_NET_PATH,
+						 &result->class))
+			continue;
+
+		result->rc = interface_alloc(&result->interface);
+		if (result->rc == 0)
+			result->rc = interface_probe(link, SFPTPD_SYSFS_NET_PATH,
+						     result->interface,
+						     result->class);
+	}
+
+	return NULL;
+}
+
+/* Probe the interfaces in a link table using a pool of threads. The
+ * results are stored by row so that they can be merged into the interface
+ * table in a deterministic order. */
+static void interface_probe_all(const struct sfptpd_link_table *link_table,
+				struct interface_probe_result *results)
+{
+	pthread_t threads[SFPTPD_INTERFACE_PROBE_THREADS];
+	struct interface_probe_work work = {
+		.link_table = link_table,
+		.results = results,
+		.next_row = 0,
+	};
+	struct sfptpd_timespec start, end;
+	int num_threads;
+	int i, rc;
+
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &start);
+
+	num_threads = link_table->count;
+	if (num_threads > SFPTPD_INTERFACE_PROBE_THREADS)
+		num_threads = SFPTPD_INTERFACE_PROBE_THREADS;
+
+	/* The calling thread does its share of the work too */
+	for (i = 1; i < num_threads; i++) {
+		rc = pthread_create(&threads[i], NULL, interface_probe_thread, &work);
+		if (rc != 0) {
+			WARNING("interface: could not create probe thread, %s\n",
+				strerror(rc));
+			break;
+		}
+	}
+	num_threads = i;
+
+	interface_probe_thread(&work);
+
+	for (i = 1; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &end);
+	sfptpd_time_subtract(&end, &end, &start);
+	INFO("interface: probed %d links with %d threads in %0.3Lfs\n",
+	     link_table->count, num_threads, sfptpd_time_timespec_to_float_s(&end));
+}
+
+
 /* Updates the passed variable with the canonical interface object.
    Acquires the lock if found.
    Returns false if no interface was specified or it was deleted,
@@ -1219,20 +1465,23 @@ static struct sfptpd_interface *interface_find_by_name(const char *name)
 
 struct sfptpd_interface *sfptpd_interface_find_first_by_nic(int nic_id)
 {
+	const struct sfptpd_interface_index *index;
+	struct sfptpd_db_cursor cursor;
 	struct sfptpd_interface *intf;
 
-	interface_lock();
-
-	intf = FIND_FIRST(INTF_KEY_MAC, INTF_KEY_NIC, &nic_id);
+	index = sfptpd_interface_index_get(&interface_index);
+	if (index == NULL) {
+		interface_lock();
+		intf = FIND_FIRST(&cursor, INTF_KEY_MAC, INTF_KEY_NIC, &nic_id);
+		interface_unlock();
+	} else {
+		intf = sfptpd_interface_index_find_first_by_nic(index, nic_id);
+	}
+	sfptpd_interface_index_put(&interface_index);
 
 	if (interface_get_canonical_with_lock(&intf))
 		interface_unlock();
 
-	/* N.B. a second unlock is needed because it is a recursive mutex,
-	   the canonicalising function acquires the lock if a live interface
-	   is found and we need to pair up the locking and unlocking. */
-	interface_unlock();
-
 	return intf;
 }
 
@@ -1259,10 +1508,11 @@ int sfptpd_interface_initialise(struct sfptpd_config *config,
 				pthread_mutex_t *hardware_state_lock,
 				const struct sfptpd_link_table *link_table)
 {
-	struct sfptpd_interface *new, *interface;
+	struct interface_probe_result *results;
+	struct interface_probe_result *result;
+	struct sfptpd_interface *interface;
 	int rc, i, flags;
 	sfptpd_config_timestamping_t *ts;
-	sfptpd_interface_class_t class;
 	int row;
 	const struct sfptpd_link *link;
 
@@ -1292,43 +1542,60 @@ int sfptpd_interface_initialise(struct sfptpd_config *config,
 		return errno;
 	}
 
-	/* Iterate through the interfaces in the system */
+	results = calloc(link_table->count, sizeof *results);
+	if (link_table->count != 0 && results == NULL) {
+		CRITICAL("failed to allocate interface probe results, %s\n",
+			 strerror(errno));
+		return errno;
+	}
+
+	/* Probe the interfaces in the system concurrently */
+	interface_probe_all(link_table, results);
+
+	/* Add the probed interfaces in link table order */
+	rc = 0;
 	for (row = 0; row < link_table->count; row++) {
 		link = link_table->rows + row;
+		result = results + row;
 
-		/* Check that the interface is suitable i.e. an ethernet device
-		 * that isn't wireless or a bridge or virtual etc */
-		if (!interface_check_suitability(link, SFPTPD_SYSFS_NET_PATH, &class))
+		if (result->interface == NULL) {
+			if (result->rc != 0 && rc == 0) {
+				ERROR("failed to allocate interface object for %s, %s\n",
+				      link->if_name, strerror(result->rc));
+				rc = result->rc;
+			}
 			continue;
-
-		/* Create a new interface */
-		rc = interface_alloc(&new);
-		if (rc != 0) {
-			ERROR("failed to allocate interface object for %s, %s\n",
-			      link->if_name, strerror(rc));
-			return rc;
 		}
 
-		rc = interface_init(link, SFPTPD_SYSFS_NET_PATH, new, class);
-		if (rc != 0) {
-			if (rc == ENOTSUP || rc == EOPNOTSUPP) {
+		if (rc == 0 && result->rc != 0) {
+			if (result->rc == ENOTSUP || result->rc == EOPNOTSUPP) {
 				WARNING("skipping over insufficiently capable interface %s\n",
 					link->if_name);
-				interface_free(new);
-				continue;
 			} else {
 				ERROR("failed to create interface instance for %s, %s\n",
-				      link->if_name, strerror(rc));
-				return rc;
+				      link->if_name, strerror(result->rc));
+				rc = result->rc;
 			}
 		}
 
+		if (rc != 0 || result->rc != 0) {
+			interface_delete(result->interface, false);
+			interface_free(result->interface);
+			continue;
+		}
+
+		interface_init_complete(result->interface);
+
 		/* Add the interface to the database */
-		sfptpd_db_table_insert(sfptpd_interface_table, &new);
+		sfptpd_db_table_insert(sfptpd_interface_table, &result->interface);
 
 		rescan_interfaces();
 	}
 
+	free(results);
+	if (rc != 0)
+		return rc;
+
 	fixup_readonly_and_clock_lists();
 
 	/* For each interface specified in the config file, enable packet timestamping */
@@ -1400,8 +1667,7 @@ static void interface_record_delete_fn(void *record, void *context) {
 static void interface_record_free_fn(void *record, void *context) {
 	struct sfptpd_interface *interface = *((struct sfptpd_interface **) record);
 	assert(interface->magic == SFPTPD_INTERFACE_MAGIC);
-	if (interface->ethtool_stats)
-		free(interface->ethtool_stats);
+	interface_driver_stats_free(interface);
 	interface_free(interface);
 }
 
@@ -1428,8 +1694,9 @@ void sfptpd_interface_shutdown(struct sfptpd_config *config)
 	/* Free the interfaces */
 	sfptpd_db_table_foreach(sfptpd_interface_table, interface_record_free_fn, NULL);
 
-	/* Free the interface table */
+	/* Free the interface table and lookup index */
 	free_interface_table();
+	sfptpd_interface_index_release(&interface_index);
 
 	if (sfptpd_interface_socket > 0)
 		close(sfptpd_interface_socket);
@@ -1503,6 +1770,16 @@ int sfptpd_interface_hotplug_insert(const struct sfptpd_link *link)
 		}
 	} else if (0 != strcmp(interface->name, if_name)) {
 		rc = interface_handle_rename(interface, if_name);
+	} else if (link->event == SFPTPD_LINK_CHANGE &&
+		   (link->changes & SFPTPD_INTERFACE_REPROBE_CHANGES) == 0 &&
+		   (!interface->deleted || !interface->suitable)) {
+		/* Nothing that was probed or that decided suitability has
+		 * changed so just keep the new link state */
+		TRACE_L3("interface: updating link state: %s (if_index %d)\n",
+			 if_name, if_index);
+		if (!interface->deleted)
+			interface->link = *link;
+		goto finish;
 	} else {
 		INFO("interface: handling detected changes: %s (if_index %d)\n",
 		     if_name, if_index);
@@ -1515,6 +1792,7 @@ int sfptpd_interface_hotplug_insert(const struct sfptpd_link *link)
 		TRACE_L4("interface: ignoring interface %s of irrelevant type\n", if_name);
 		sfptpd_strncpy(interface->name, if_name, sizeof(interface->name));
 		interface->if_index = if_index;
+		interface->suitable = false;
 		interface_delete(interface, false);
 		rescan_interfaces();
 		goto finish;
@@ -1592,9 +1870,18 @@ int sfptpd_interface_hotplug_remove(const struct sfptpd_link *link)
 
 struct sfptpd_interface *sfptpd_interface_find_by_if_index(int if_index)
 {
+	const struct sfptpd_interface_index *index;
 	struct sfptpd_interface *interface;
 
-	interface = interface_find_by_if_index(if_index);
+	index = sfptpd_interface_index_get(&interface_index);
+	if (index == NULL) {
+		interface_lock();
+		interface = interface_find_by_if_index(if_index);
+		interface_unlock();
+	} else {
+		interface = sfptpd_interface_index_find_by_if_index(index, if_index);
+	}
+	sfptpd_interface_index_put(&interface_index);
 
 	return interface;
 }
@@ -1602,11 +1889,20 @@ struct sfptpd_interface *sfptpd_interface_find_by_if_index(int if_index)
 
 struct sfptpd_interface *sfptpd_interface_find_by_name(const char *name)
 {
+	const struct sfptpd_interface_index *index;
 	struct sfptpd_interface *interface;
 
-	interface_lock();
-	interface = interface_find_by_name(name);
-	interface_unlock();
+	assert(name != NULL);
+
+	index = sfptpd_interface_index_get(&interface_index);
+	if (index == NULL) {
+		interface_lock();
+		interface = interface_find_by_name(name);
+		interface_unlock();
+	} else {
+		interface = sfptpd_interface_index_find_by_name(index, name);
+	}
+	sfptpd_interface_index_put(&interface_index);
 
 	return interface;
 }
@@ -1891,25 +2187,40 @@ int sfptpd_interface_is_link_detected(struct sfptpd_interface *interface,
 
 /****************************************************************************/
 
-struct sfptpd_db_query_result sfptpd_interface_get_all_snapshot(void)
+void sfptpd_interface_cursor_open_all(struct sfptpd_db_cursor *cursor)
 {
-	return sfptpd_db_table_query(sfptpd_interface_table,
-				     SFPTPD_DB_SEL_ORDER_BY,
-				     INTF_KEY_NIC,
-				     INTF_KEY_TYPE,
-				     INTF_KEY_MAC);
+	sfptpd_db_cursor_open(cursor, sfptpd_interface_table,
+			      SFPTPD_DB_SEL_ORDER_BY,
+			      INTF_KEY_NIC,
+			      INTF_KEY_TYPE,
+			      INTF_KEY_MAC);
 }
 
 
-struct sfptpd_db_query_result sfptpd_interface_get_active_ptp_snapshot(void)
+void sfptpd_interface_cursor_open_active_ptp(struct sfptpd_db_cursor *cursor)
 {
-	return sfptpd_db_table_query(sfptpd_interface_table,
-				     INTF_KEY_DELETED, &(int){ false },
-				     INTF_KEY_PTP, &(int){ true },
-				     SFPTPD_DB_SEL_ORDER_BY,
-				     INTF_KEY_NIC,
-				     INTF_KEY_TYPE,
-				     INTF_KEY_MAC);
+	static const int not_deleted = false;
+	static const int ptp = true;
+
+	sfptpd_db_cursor_open(cursor, sfptpd_interface_table,
+			      INTF_KEY_DELETED, &not_deleted,
+			      INTF_KEY_PTP, &ptp,
+			      SFPTPD_DB_SEL_ORDER_BY,
+			      INTF_KEY_NIC,
+			      INTF_KEY_TYPE,
+			      INTF_KEY_MAC);
+}
+
+
+struct sfptpd_interface *sfptpd_interface_cursor_next(struct sfptpd_db_cursor *cursor)
+{
+	struct sfptpd_interface **intfp = sfptpd_db_cursor_next(cursor);
+
+	if (intfp == NULL)
+		return NULL;
+
+	assert((*intfp)->magic == SFPTPD_INTERFACE_MAGIC);
+	return *intfp;
 }
 
 
@@ -1937,6 +2248,7 @@ static int interface_check_hotplug_rename(struct sfptpd_interface *interface)
 
 	interface_handle_rename(interface, ifr.ifr_name);
 	sfptpd_strncpy(interface->name, ifr.ifr_name, sizeof(interface->name));
+	interface_index_publish();
 
 	return EAGAIN;
 }
@@ -2095,25 +2407,24 @@ void sfptpd_interface_hw_timestamping_disable(struct sfptpd_interface *interface
 }
 
 
-int sfptpd_interface_driver_stats_read(struct sfptpd_interface *interface,
-				       uint64_t stats[SFPTPD_DRVSTAT_MAX])
+/* Take a new sample of the driver stats. Called with the interface lock
+ * held. */
+static int interface_driver_stats_sample(struct sfptpd_interface *interface)
 {
+	struct ethtool_stats *estats;
+	char text[32];
+	ssize_t len;
+	int value;
 	int rc;
 	int i;
-	char path[PATH_MAX];
-	FILE *file;
-	struct ethtool_stats *estats;
-	int sysfs_stat_value;
 
 	assert(interface != NULL);
 
-	if (interface->drv_stat_methods == 0)
-		return ENODATA;
-
 	estats = interface->ethtool_stats;
 
 	if (interface->drv_stat_methods & (1 << DRV_STAT_ETHTOOL)) {
-		assert(estats != NULL);
+		if (estats == NULL)
+			return ENOMEM;
 
 		estats->cmd = ETHTOOL_GSTATS;
 		estats->n_stats = interface->n_stats;
@@ -2130,39 +2441,86 @@ int sfptpd_interface_driver_stats_read(struct sfptpd_interface *interface,
 		enum drv_stat_method method = interface->drv_stat_method[i];
 		switch (method) {
 		case DRV_STAT_ETHTOOL:
-			stats[i] = estats->data[interface->drv_stat_ethtool_index[i]];
+			interface->drv_stats_sample[i] = estats->data[interface->drv_stat_ethtool_index[i]];
 			break;
 		case DRV_STAT_SYSFS:
-			rc = snprintf(path, sizeof path, "/sys/class/net/%s/device/%s",
-				      interface->name, drv_stats[i].sysfs_name);
-			if (rc < 0 || rc >= sizeof path)
-				return ENAMETOOLONG;
-			file = fopen(path, "r");
-			if (file == NULL) {
-				TRACE_L1("failed to open PPS stats file %s, %s\n",
-					 path, errno);
-				return errno;
+			len = pread(interface->drv_stat_fd[i], text, sizeof text - 1, 0);
+			if (len < 0) {
+				rc = errno;
+				TRACE_L1("interface %s: failed to read PPS stats file %s, %s\n",
+					 interface->name, drv_stats[i].sysfs_name,
+					 strerror(rc));
+				return rc;
 			}
-			if (fscanf(file, "%d", &sysfs_stat_value) != 1) {
-				ERROR("couldn't read statistic from %s\n", path);
-				fclose(file);
+			text[len] = '\0';
+			if (sscanf(text, "%d", &value) != 1) {
+				ERROR("interface %s: couldn't read statistic from %s\n",
+				      interface->name, drv_stats[i].sysfs_name);
 				return EIO;
 			}
-			stats[i] = sysfs_stat_value;
-			fclose(file);
+			interface->drv_stats_sample[i] = value;
 			break;
 		case DRV_STAT_NOT_AVAILABLE:
 			TRACE_L4("no method available to collect %s stat\n",
 				 sfptpd_stats_ethtool_names[i]);
+			interface->drv_stats_sample[i] = 0;
 		}
+	}
+
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &interface->drv_stats_sample_time);
+	interface->drv_stats_sample_valid = true;
+	return 0;
+}
+
+/* Get the driver stats, taking a new sample unless a recent one can be
+ * shared. Called with the interface lock held. */
+static int interface_driver_stats_get(struct sfptpd_interface *interface,
+				      uint64_t stats[SFPTPD_DRVSTAT_MAX])
+{
+	struct sfptpd_timespec now;
+	struct sfptpd_timespec age;
+	int rc;
+	int i;
+
+	assert(interface != NULL);
 
-		/* Adjust for virtual resets */
-		stats[i] += interface->stat_zero_adjustment[i];
+	if (interface->drv_stat_methods == 0)
+		return ENODATA;
+
+	(void)sfclock_gettime(CLOCK_MONOTONIC, &now);
+	sfptpd_time_subtract(&age, &now, &interface->drv_stats_sample_time);
+
+	if (!interface->drv_stats_sample_valid ||
+	    age.sec != 0 || age.nsec >= SFPTPD_INTERFACE_DRV_STATS_MAX_AGE_NS) {
+		rc = interface_driver_stats_sample(interface);
+		if (rc != 0)
+			return rc;
+	} else {
+		TRACE_L6("interface %s: sharing driver stats sampled %uns ago\n",
+			 interface->name, age.nsec);
 	}
 
+	/* Adjust for virtual resets */
+	for (i = 0; i < SFPTPD_DRVSTAT_MAX; i++)
+		stats[i] = interface->drv_stats_sample[i] + interface->stat_zero_adjustment[i];
+
 	return 0;
 }
 
+int sfptpd_interface_driver_stats_read(struct sfptpd_interface *interface,
+				       uint64_t stats[SFPTPD_DRVSTAT_MAX])
+{
+	int rc;
+
+	assert(interface != NULL);
+
+	interface_lock();
+	rc = interface_driver_stats_get(interface, stats);
+	interface_unlock();
+
+	return rc;
+}
+
 static int interface_sysfs_stats_reset(struct sfptpd_interface *interface)
 {
 	char path[128];
@@ -2201,6 +2559,12 @@ int sfptpd_interface_driver_stats_reset(struct sfptpd_interface *interface)
 
 	assert(interface != NULL);
 
+	interface_lock();
+
+	/* Take the baseline for a virtual reset from a fresh sample rather
+	 * than one shared with earlier reads */
+	interface->drv_stats_sample_valid = false;
+
 	for (i = 0; i < SFPTPD_DRVSTAT_MAX; i++) {
 		if (!drv_stats[i].counter)
 			continue;
@@ -2221,6 +2585,7 @@ int sfptpd_interface_driver_stats_reset(struct sfptpd_interface *interface)
 						ret = rc;
 				} else {
 					sysfs_stats_reset = true;
+					interface->drv_stats_sample_valid = false;
 				}
 			}
 			if (sysfs_stats_reset)
@@ -2228,7 +2593,7 @@ int sfptpd_interface_driver_stats_reset(struct sfptpd_interface *interface)
 			/* Fall through to virtual reset */
 		case DRV_STAT_ETHTOOL:
 			if (!stats_sampled && !read_failed) {
-				rc = sfptpd_interface_driver_stats_read(interface, sample);
+				rc = interface_driver_stats_get(interface, sample);
 				if (rc != 0) {
 					read_failed = true;
 					ret = rc;
@@ -2244,6 +2609,8 @@ int sfptpd_interface_driver_stats_reset(struct sfptpd_interface *interface)
 		}
 	}
 
+	interface_unlock();
+
 	return ret;
 }
 
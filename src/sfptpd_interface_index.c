@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_interface_index.c
+ * @brief  Lock-free lookup index over the interface table
+ *
+ * An index is immutable once published. It is rebuilt by the single writer
+ * of the interface table whenever the keys of the interfaces change and
+ * replaces the previous index atomically so that readers can look up
+ * interfaces without taking the interface lock.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "sfptpd_db.h"
+#include "sfptpd_interface_index.h"
+
+
+/****************************************************************************
+ * Types
+ ****************************************************************************/
+
+struct sfptpd_interface_index {
+	/* Keys of all the interfaces */
+	struct sfptpd_interface_keys *keys;
+	int count;
+
+	/* Interfaces directly mapped by OS interface index */
+	int if_index_limit;
+	const struct sfptpd_interface_keys **by_if_index;
+
+	/* Interfaces by name in an open-addressed hash table */
+	uint32_t name_mask;
+	const struct sfptpd_interface_keys **by_name;
+
+	/* Interfaces by PHC index. The interfaces for PHC index p are
+	 * phc_members[phc_start[p]] to phc_members[phc_start[p + 1] - 1]. */
+	int phc_limit;
+	int *phc_start;
+	const struct sfptpd_interface_keys **phc_members;
+
+	/* The first interface of each NIC in order of MAC address */
+	int nic_limit;
+	const struct sfptpd_interface_keys **by_nic;
+
+	struct sfptpd_interface_index *next_retired;
+};
+
+
+/****************************************************************************
+ * Local Functions
+ ****************************************************************************/
+
+static bool index_prefer(const struct sfptpd_interface_keys *current,
+			 const struct sfptpd_interface_keys *candidate)
+{
+	return current == NULL || (current->deleted && !candidate->deleted);
+}
+
+
+static void index_free(struct sfptpd_interface_index *index)
+{
+	if (index == NULL)
+		return;
+
+	free(index->keys);
+	free(index->by_if_index);
+	free(index->by_name);
+	free(index->phc_start);
+	free(index->phc_members);
+	free(index->by_nic);
+	free(index);
+}
+
+
+static const struct sfptpd_interface_keys **index_name_slot(const struct sfptpd_interface_index *index,
+							    const char *name)
+{
+	uint32_t i;
+
+	i = sfptpd_db_hash(name, strlen(name)) & index->name_mask;
+	while (index->by_name[i] != NULL &&
+	       strcmp(index->by_name[i]->name, name) != 0)
+		i = (i + 1) & index->name_mask;
+
+	return &index->by_name[i];
+}
+
+
+/* Build an index over the given keys, taking ownership of them */
+static struct sfptpd_interface_index *index_build(struct sfptpd_interface_keys *keys,
+						  int count)
+{
+	const struct sfptpd_interface_keys **slot;
+	const struct sfptpd_interface_keys *intf;
+	struct sfptpd_interface_index *index;
+	int *phc_fill = NULL;
+	uint32_t name_slots;
+	int i, p;
+
+	index = calloc(1, sizeof *index);
+	if (index == NULL) {
+		free(keys);
+		return NULL;
+	}
+	index->keys = keys;
+	index->count = count;
+
+	/* Size the index */
+	for (i = 0; i < count; i++) {
+		intf = &keys[i];
+		if (intf->if_index >= index->if_index_limit)
+			index->if_index_limit = intf->if_index + 1;
+		if (intf->phc_index >= index->phc_limit)
+			index->phc_limit = intf->phc_index + 1;
+		if (intf->nic_id >= index->nic_limit)
+			index->nic_limit = intf->nic_id + 1;
+	}
+
+	for (name_slots = 8; name_slots < 2 * count; name_slots <<= 1);
+	index->name_mask = name_slots - 1;
+
+	index->by_if_index = calloc(index->if_index_limit + 1, sizeof *index->by_if_index);
+	index->by_name = calloc(name_slots, sizeof *index->by_name);
+	index->phc_start = calloc(index->phc_limit + 1, sizeof *index->phc_start);
+	index->phc_members = calloc(count + 1, sizeof *index->phc_members);
+	index->by_nic = calloc(index->nic_limit + 1, sizeof *index->by_nic);
+	phc_fill = calloc(index->phc_limit + 1, sizeof *phc_fill);
+	if (index->by_if_index == NULL || index->by_name == NULL ||
+	    index->phc_start == NULL || index->phc_members == NULL ||
+	    index->by_nic == NULL || phc_fill == NULL) {
+		index_free(index);
+		free(phc_fill);
+		return NULL;
+	}
+
+	/* Count the interfaces for each PHC */
+	for (i = 0; i < count; i++)
+		if (keys[i].phc_index >= 0)
+			index->phc_start[keys[i].phc_index + 1]++;
+	for (p = 0; p < index->phc_limit; p++) {
+		index->phc_start[p + 1] += index->phc_start[p];
+		phc_fill[p] = index->phc_start[p];
+	}
+
+	/* Populate the index */
+	for (i = 0; i < count; i++) {
+		intf = &keys[i];
+		if (intf->if_index >= 0 &&
+		    index_prefer(index->by_if_index[intf->if_index], intf))
+			index->by_if_index[intf->if_index] = intf;
+
+		if (intf->name[0] != '\0') {
+			slot = index_name_slot(index, intf->name);
+			if (index_prefer(*slot, intf))
+				*slot = intf;
+		}
+
+		if (intf->phc_index >= 0)
+			index->phc_members[phc_fill[intf->phc_index]++] = intf;
+
+		if (intf->nic_id >= 0 &&
+		    (index->by_nic[intf->nic_id] == NULL ||
+		     memcmp(&intf->mac_addr, &index->by_nic[intf->nic_id]->mac_addr,
+			    sizeof intf->mac_addr) < 0))
+			index->by_nic[intf->nic_id] = intf;
+	}
+
+	free(phc_fill);
+	return index;
+}
+
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int sfptpd_interface_index_publish(struct sfptpd_interface_index_set *set,
+				   struct sfptpd_interface_keys *keys,
+				   int count)
+{
+	struct sfptpd_interface_index *index;
+	struct sfptpd_interface_index *old;
+
+	assert(set != NULL);
+	assert(keys != NULL || count == 0);
+
+	/* Only the writer changes the current index so it can be read
+	 * without synchronisation here */
+	old = set->current;
+	if (old != NULL && keys != NULL && old->count == count &&
+	    memcmp(old->keys, keys, count * sizeof *keys) == 0) {
+		free(keys);
+		return EALREADY;
+	}
+
+	index = (keys == NULL) ? NULL : index_build(keys, count);
+
+	old = __atomic_exchange_n(&set->current, index, __ATOMIC_SEQ_CST);
+	if (old != NULL) {
+		old->next_retired = set->retired;
+		set->retired = old;
+	}
+
+	/* A reader arriving after this point sees the new index so once there
+	 * are no readers none can be using a replaced one */
+	if (__atomic_load_n(&set->readers, __ATOMIC_SEQ_CST) == 0) {
+		while ((old = set->retired) != NULL) {
+			set->retired = old->next_retired;
+			index_free(old);
+		}
+	}
+
+	return (index == NULL) ? ENOMEM : 0;
+}
+
+
+void sfptpd_interface_index_release(struct sfptpd_interface_index_set *set)
+{
+	struct sfptpd_interface_index *old;
+
+	assert(set != NULL);
+
+	index_free(__atomic_exchange_n(&set->current, NULL, __ATOMIC_SEQ_CST));
+	while ((old = set->retired) != NULL) {
+		set->retired = old->next_retired;
+		index_free(old);
+	}
+}
+
+
+const struct sfptpd_interface_index *sfptpd_interface_index_get(struct sfptpd_interface_index_set *set)
+{
+	__atomic_fetch_add(&set->readers, 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&set->current, __ATOMIC_SEQ_CST);
+}
+
+
+void sfptpd_interface_index_put(struct sfptpd_interface_index_set *set)
+{
+	__atomic_fetch_sub(&set->readers, 1, __ATOMIC_RELEASE);
+}
+
+
+struct sfptpd_interface *sfptpd_interface_index_find_by_if_index(const struct sfptpd_interface_index *index,
+								 int if_index)
+{
+	assert(index != NULL);
+
+	if (if_index < 0 || if_index >= index->if_index_limit ||
+	    index->by_if_index[if_index] == NULL)
+		return NULL;
+
+	return index->by_if_index[if_index]->interface;
+}
+
+
+struct sfptpd_interface *sfptpd_interface_index_find_by_name(const struct sfptpd_interface_index *index,
+							     const char *name)
+{
+	const struct sfptpd_interface_keys *keys;
+
+	assert(index != NULL);
+	assert(name != NULL);
+
+	keys = *index_name_slot(index, name);
+	return (keys == NULL) ? NULL : keys->interface;
+}
+
+
+struct sfptpd_interface *sfptpd_interface_index_find_first_by_nic(const struct sfptpd_interface_index *index,
+								  int nic_id)
+{
+	assert(index != NULL);
+
+	if (nic_id < 0 || nic_id >= index->nic_limit ||
+	    index->by_nic[nic_id] == NULL)
+		return NULL;
+
+	return index->by_nic[nic_id]->interface;
+}
+
+
+bool sfptpd_interface_index_phc_has_name(const struct sfptpd_interface_index *index,
+					 int phc_index, const char *name)
+{
+	int i;
+
+	assert(index != NULL);
+	assert(name != NULL);
+
+	if (phc_index < 0 || phc_index >= index->phc_limit)
+		return false;
+
+	for (i = index->phc_start[phc_index]; i < index->phc_start[phc_index + 1]; i++)
+		if (strcmp(index->phc_members[i]->name, name) == 0)
+			return true;
+
+	return false;
+}
+
+
+/* fin */
@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_json.c
+ * @brief  Append-only JSON text builder
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+
+#include "sfptpd_json.h"
+
+
+/****************************************************************************
+ * Defines & Constants
+ ****************************************************************************/
+
+/* Values of at least this magnitude are formatted with stdio so that the
+ * scaled value always fits in 64 bits. */
+#define JSON_FLOAT_FAST_LIMIT (1.0E9L)
+
+/* Scaled fractions within this distance of a rounding tie are formatted
+ * with stdio, which rounds the exact binary value. */
+#define JSON_FLOAT_TIE_MARGIN (1.0E-6L)
+
+static const uint64_t json_pow10[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL,
+	1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+static const char json_hex_digits[] = "0123456789abcdef";
+
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+void sfptpd_json_init(struct sfptpd_json_buf *buf, char *data, size_t size)
+{
+	assert(buf != NULL);
+	assert(data != NULL || size == 0);
+
+	buf->data = data;
+	buf->size = size;
+	sfptpd_json_reset(buf);
+}
+
+
+void sfptpd_json_string(struct sfptpd_json_buf *buf, const char *str)
+{
+	const char *run;
+	char esc[6];
+
+	sfptpd_json_lit(buf, "\"");
+	for (run = str; *str != '\0'; str++) {
+		unsigned char c = (unsigned char) *str;
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		sfptpd_json_raw(buf, run, str - run);
+		if (c == '"' || c == '\\') {
+			esc[0] = '\\';
+			esc[1] = c;
+			sfptpd_json_raw(buf, esc, 2);
+		} else {
+			memcpy(esc, "\\u00", 4);
+			esc[4] = json_hex_digits[c >> 4];
+			esc[5] = json_hex_digits[c & 0xf];
+			sfptpd_json_raw(buf, esc, 6);
+		}
+		run = str + 1;
+	}
+	sfptpd_json_raw(buf, run, str - run);
+	sfptpd_json_lit(buf, "\"");
+}
+
+
+void sfptpd_json_uint(struct sfptpd_json_buf *buf, uint64_t value,
+		      unsigned int width)
+{
+	char digits[24];
+	char *p = digits + sizeof digits;
+
+	do {
+		*--p = '0' + (value % 10);
+		value /= 10;
+	} while (value != 0 && p > digits);
+
+	while (digits + sizeof digits - p < width && p > digits)
+		*--p = '0';
+
+	sfptpd_json_raw(buf, p, digits + sizeof digits - p);
+}
+
+
+void sfptpd_json_int(struct sfptpd_json_buf *buf, int64_t value)
+{
+	if (value < 0) {
+		sfptpd_json_lit(buf, "-");
+		sfptpd_json_uint(buf, -(uint64_t) value, 1);
+	} else {
+		sfptpd_json_uint(buf, (uint64_t) value, 1);
+	}
+}
+
+
+void sfptpd_json_float(struct sfptpd_json_buf *buf, long double value,
+		       unsigned int decimals)
+{
+	uint64_t scaled;
+	long double mag, whole, frac, tie;
+	char text[64];
+	int len;
+
+	assert(decimals < sizeof json_pow10 / sizeof *json_pow10);
+
+	mag = fabsl(value);
+	if (!(mag < JSON_FLOAT_FAST_LIMIT)) {
+		/* Large and non-finite values are rare so let stdio deal with
+		 * them. */
+		len = snprintf(text, sizeof text, "%.*Lf", (int) decimals, value);
+		if (len > 0)
+			sfptpd_json_raw(buf, text,
+					len < sizeof text ? len : sizeof text - 1);
+		return;
+	}
+
+	/* Scale the integer and fractional parts separately so that rounding
+	 * error is confined to the fraction, and leave values that are too
+	 * close to a rounding tie for stdio to resolve exactly. */
+	whole = truncl(mag);
+	frac = (mag - whole) * json_pow10[decimals];
+	tie = frac - floorl(frac) - 0.5L;
+	if (tie > -JSON_FLOAT_TIE_MARGIN && tie < JSON_FLOAT_TIE_MARGIN) {
+		len = snprintf(text, sizeof text, "%.*Lf", (int) decimals, value);
+		if (len > 0)
+			sfptpd_json_raw(buf, text,
+					len < sizeof text ? len : sizeof text - 1);
+		return;
+	}
+	scaled = (uint64_t) whole * json_pow10[decimals] + (uint64_t) (frac + 0.5L);
+
+	if (signbit(value))
+		sfptpd_json_lit(buf, "-");
+	sfptpd_json_uint(buf, scaled / json_pow10[decimals], 1);
+	if (decimals != 0) {
+		sfptpd_json_lit(buf, ".");
+		sfptpd_json_uint(buf, scaled % json_pow10[decimals], decimals);
+	}
+}
+
+
+void sfptpd_json_hex(struct sfptpd_json_buf *buf, const uint8_t *bytes,
+		     size_t len, size_t group, char sep)
+{
+	char pair[3];
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (sep != '\0' && group != 0 && i != 0 && i % group == 0) {
+			pair[0] = sep;
+			sfptpd_json_raw(buf, pair, 1);
+		}
+		pair[0] = json_hex_digits[bytes[i] >> 4];
+		pair[1] = json_hex_digits[bytes[i] & 0xf];
+		sfptpd_json_raw(buf, pair, 2);
+	}
+}
+
+
+/* fin */
@@ -158,3 +158,67 @@ void sfptpd_link_table_free_copy(struct sfptpd_link_table *copy)
 	copy->count = 0;
 	copy->version = -1;
 }
+
+
+void sfptpd_link_delta_start(struct sfptpd_link_delta_iter *iter,
+			     const struct sfptpd_link_table *old_table,
+			     const struct sfptpd_link_table *table)
+{
+	static const struct sfptpd_link_table empty_table = { 0 };
+
+	assert(iter != NULL);
+	assert(table != NULL);
+
+	/* No previous table means every link is new */
+	iter->old_table = old_table ? old_table : &empty_table;
+	iter->table = table;
+	iter->row = 0;
+	iter->old_row = 0;
+}
+
+
+bool sfptpd_link_delta_next(struct sfptpd_link_delta_iter *iter,
+			    struct sfptpd_link_delta *delta)
+{
+	const struct sfptpd_link *link;
+	const struct sfptpd_link *old_link;
+
+	assert(iter != NULL);
+	assert(delta != NULL);
+
+	while (iter->row < iter->table->count ||
+	       iter->old_row < iter->old_table->count) {
+		link = iter->row < iter->table->count ?
+			iter->table->rows + iter->row : NULL;
+		old_link = iter->old_row < iter->old_table->count ?
+			iter->old_table->rows + iter->old_row : NULL;
+
+		delta->changes = 0;
+		if (link != NULL &&
+		    (old_link == NULL || link->if_index < old_link->if_index)) {
+			delta->event = SFPTPD_LINK_UP;
+			delta->link = link;
+			delta->old_link = NULL;
+			iter->row++;
+			return true;
+		} else if (link == NULL || old_link->if_index < link->if_index) {
+			delta->event = SFPTPD_LINK_DOWN;
+			delta->link = NULL;
+			delta->old_link = old_link;
+			iter->old_row++;
+			return true;
+		}
+
+		iter->row++;
+		iter->old_row++;
+		if (link->event == SFPTPD_LINK_CHANGE) {
+			delta->event = SFPTPD_LINK_CHANGE;
+			delta->link = link;
+			delta->old_link = old_link;
+			delta->changes = link->changes;
+			return true;
+		}
+	}
+
+	return false;
+}
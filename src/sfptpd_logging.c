@@ -19,6 +19,12 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
 #include <glob.h>
 
 #include "sfptpd_logging.h"
@@ -27,6 +33,7 @@
 #include "sfptpd_clock.h"
 #include "sfptpd_constants.h"
 #include "sfptpd_statistics.h"
+#include "sfptpd_json.h"
 
 
 /****************************************************************************
@@ -36,18 +43,122 @@
 struct sfptpd_log {
 	const char *type;
 	FILE *stream;
+	char *data;
+	size_t size;
 	char final_path[PATH_MAX];
 	char temp_path[PATH_MAX];
 };
 
+/* A state file known to the file writer */
+struct log_file {
+	const char *type;
+	char *final_path;
+	char *temp_path;
+	/* Content waiting to be written, or NULL */
+	char *pending;
+	size_t pending_size;
+	uint64_t pending_hash;
+	/* Identity of the content written or being written, if valid */
+	bool installed;
+	size_t installed_size;
+	uint64_t installed_hash;
+	/* Set while the writer is writing this file */
+	bool writing;
+	struct log_file *next;
+};
+
+enum log_record_type {
+	LOG_RECORD_PAD,
+	LOG_RECORD_MESSAGE,
+};
+
+/* Kinds of argument consumed by a conversion specification */
+enum log_arg_kind {
+	LOG_ARG_NONE,
+	LOG_ARG_INT,
+	LOG_ARG_LONG,
+	LOG_ARG_LLONG,
+	LOG_ARG_INTMAX,
+	LOG_ARG_SIZE,
+	LOG_ARG_PTRDIFF,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_LDOUBLE,
+	LOG_ARG_STRING,
+	LOG_ARG_POINTER,
+	LOG_ARG_ERRNO,
+	LOG_ARG_INVALID,
+};
+
+/* A parsed printf conversion specification */
+struct log_fmt_spec {
+	const char *start;
+	size_t len;
+	bool star_width;
+	bool star_prec;
+	enum log_arg_kind kind;
+};
+
+/* Binary log record as stored in a ring. The packed arguments follow the
+ * header, each in the order consumed by the format string. */
+struct log_record {
+	uint32_t len;
+	uint16_t type;
+	int16_t priority;
+	uint64_t seq;
+	struct timeval time;
+	const char *format;
+	uint8_t args[];
+};
+
+struct log_ring {
+	uint8_t *buf;
+	/* Byte counters; only the producer writes head and only the
+	 * consumer writes tail. */
+	uint64_t head;
+	uint64_t tail;
+	/* Overflow accounting */
+	uint64_t dropped;
+	uint64_t dropped_reported;
+	/* Set when the owning thread has exited */
+	bool orphaned;
+	pid_t tid;
+	struct log_ring *next;
+};
+
 
 /****************************************************************************
  * Defines & Constants
  ****************************************************************************/
 
 #define APPROX_RT_STATS_LENGTH 512
-#define APPROX_RT_SERVOS 2
-#define APPROX_RT_UPDATES 16
+
+/* Realtime stats are preformatted into a large buffer that is written out
+ * when it runs low on space, when an alarm is reported or on the periodic
+ * stats log. */
+#define RT_STATS_BUF_SIZE (64 * 1024)
+#define RT_STATS_FLUSH_HEADROOM (4 * APPROX_RT_STATS_LENGTH)
+
+/* Asynchronous message logging. Each thread that logs a message gets its own
+ * single-producer single-consumer ring of variable-length binary records.
+ * Producers never block: if the ring is full, the message is counted as
+ * dropped. A low-priority writer thread drains the rings, merging them in
+ * order of a global sequence number, and does the formatting and I/O. */
+#define LOG_ASYNC_RING_SIZE (64 * 1024)
+#define LOG_ASYNC_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+#define LOG_ASYNC_MAX_RECORD (LOG_ASYNC_RING_SIZE / 4)
+#define LOG_ASYNC_MAX_STRING (4096)
+#define LOG_ASYNC_MAX_SPEC (32)
+#define LOG_ASYNC_TEXT_MAX (8192)
+#define LOG_ASYNC_WRITER_NICE (10)
+#define LOG_ASYNC_IDLE_TIMEOUT_MS (1000)
+
+/* State files are formatted in memory and handed to a low-priority writer
+ * thread that installs them atomically. Only the newest content of each
+ * file is kept if the writer falls behind and files whose content has not
+ * changed since last written are not rewritten. */
+#define LOG_FILE_WRITER_NICE (10)
+#define LOG_FILE_HASH_OFFSET (0xcbf29ce484222325ULL)
+#define LOG_FILE_HASH_PRIME (0x100000001b3ULL)
 
 
 /* Message logging uses the linux kernel priority level. Define strings for
@@ -59,12 +170,14 @@ const char *sfptpd_state_file_format = "state-%s";
 const char *sfptpd_statistics_file_format = "stats-%s";
 const char *sfptpd_statistics_json_file_format = "stats-%s.json";
 const char *sfptpd_freq_correction_file_format = "freq-correction-%s";
+const char *sfptpd_stats_history_file_format = "history-%s";
 const char *sfptpd_topology_file = "topology";
 const char *sfptpd_interfaces_file = "interfaces";
 const char *sfptpd_nodes_file = "ptp-nodes";
 const char *sfptpd_remote_monitor_file = "remote-monitor";
 const char *sfptpd_config_log_file = "config";
 const char *sfptpd_sync_instances_file = "sync-instances";
+const char *sfptpd_startup_file = "startup";
 
 enum path_format_id {
 	PATH_FMT_HOSTNAME,
@@ -98,6 +211,9 @@ const static struct sfptpd_interpolation path_format_specifiers[] = {
 
 static enum sfptpd_msg_log_config message_log = SFPTPD_MSG_LOG_TO_STDERR;
 static enum sfptpd_stats_log_config stats_log = SFPTPD_STATS_LOG_OFF;
+static bool persistent_stats = false;
+static uid_t stats_history_uid = (uid_t) -1;
+static gid_t stats_history_gid = (gid_t) -1;
 static int message_log_fd = -1;
 static int stats_log_fd = -1;
 static FILE *json_remote_monitor_fp = NULL;
@@ -108,17 +224,44 @@ static char state_next_file_format[PATH_MAX];
 static char sfptpd_config_log_tmpfile[] = "/tmp/sfptpd.conf.lexed.XXXXXX";
 static FILE *config_log_tmp = NULL;
 
-/* JSON stats is block-buffered and we ensure lines get written whole. */
-static FILE *json_stats_fp = NULL;
-static char *json_stats_buf = NULL;
-const static size_t json_stats_bufsz = APPROX_RT_STATS_LENGTH * APPROX_RT_SERVOS * APPROX_RT_UPDATES;
-static int json_stats_ptr = 0;
+/* JSON stats are built in memory and we ensure lines get written whole. */
+static int json_stats_fd = -1;
+static char *json_stats_data = NULL;
+static struct sfptpd_json_buf json_stats_buf;
+static size_t json_stats_record_start = 0;
 
-static unsigned int trace_levels[SFPTPD_COMPONENT_ID_MAX] =
+unsigned int sfptpd_trace_levels[SFPTPD_COMPONENT_ID_MAX]
+	__attribute__((aligned(64))) =
 {
 	SFPTPD_DEFAULT_TRACE_LEVEL, 0
 };
 
+/* Asynchronous logging state */
+static bool log_async_configured = false;
+static bool log_async_active = false;
+static pthread_t log_async_writer;
+static int log_async_wakefd = -1;
+static bool log_async_stop = false;
+static bool log_async_writer_idle = false;
+static uint64_t log_async_seq = 0;
+static uint64_t log_async_next_seq = 0;
+static uint64_t log_async_total_dropped = 0;
+static struct log_ring *log_async_rings = NULL;
+static pthread_key_t log_async_key;
+static __thread struct log_ring *log_thread_ring = NULL;
+
+/* State file writer */
+static pthread_mutex_t log_files_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_files_cond = PTHREAD_COND_INITIALIZER;
+static struct log_file *log_files = NULL;
+static bool log_files_writer_running = false;
+static bool log_files_writer_active = false;
+static bool log_files_writer_stop = false;
+static pthread_t log_files_writer;
+static unsigned int log_files_queued = 0;
+static unsigned int log_files_written = 0;
+static unsigned int log_files_skipped = 0;
+
 
 /****************************************************************************
  * Local Functions
@@ -240,10 +383,10 @@ static struct sfptpd_log *create_log(const char *type,
 		return NULL;
 	}
 
-	log->stream = fopen(log->temp_path, "w");
+	log->stream = open_memstream(&log->data, &log->size);
 	if (log->stream == NULL) {
 		ERROR("failed to open %s log file \"%s\", %s\n",
-		      type, log->temp_path, strerror(errno));
+		      type, log->final_path, strerror(errno));
 		free(log);
 		return NULL;
 	}
@@ -252,7 +395,785 @@ static struct sfptpd_log *create_log(const char *type,
 }
 
 
+static uint64_t log_file_hash(const char *data, size_t size)
+{
+	uint64_t hash = LOG_FILE_HASH_OFFSET;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= (uint8_t) data[i];
+		hash *= LOG_FILE_HASH_PRIME;
+	}
+
+	return hash;
+}
+
+
+/* Find the record of a state file. Called with the file lock held. */
+static struct log_file *log_file_find(const char *final_path)
+{
+	struct log_file *file;
+
+	for (file = log_files; file != NULL; file = file->next)
+		if (strcmp(file->final_path, final_path) == 0)
+			return file;
+
+	return NULL;
+}
+
+
+/* Find or create the record of a state file. Called with the file lock
+ * held. */
+static struct log_file *log_file_get(const struct sfptpd_log *log)
+{
+	struct log_file *file;
+
+	file = log_file_find(log->final_path);
+	if (file != NULL)
+		return file;
+
+	file = calloc(1, sizeof *file);
+	if (file == NULL)
+		return NULL;
+
+	file->type = log->type;
+	file->final_path = strdup(log->final_path);
+	file->temp_path = strdup(log->temp_path);
+	if (file->final_path == NULL || file->temp_path == NULL) {
+		free(file->final_path);
+		free(file->temp_path);
+		free(file);
+		return NULL;
+	}
+
+	file->next = log_files;
+	log_files = file;
+	return file;
+}
+
+
+static void log_files_free(void)
+{
+	struct log_file *file, *next;
+
+	for (file = log_files; file != NULL; file = next) {
+		next = file->next;
+		free(file->pending);
+		free(file->final_path);
+		free(file->temp_path);
+		free(file);
+	}
+	log_files = NULL;
+}
+
+
+/* Write out a state file to a temporary file and rename it over the
+ * previous version so that readers never see a partial file. */
+static int log_file_install(const char *type, const char *temp_path,
+			    const char *final_path,
+			    const char *data, size_t size)
+{
+	ssize_t written;
+	int rc = 0;
+	int fd;
+
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		rc = errno;
+		ERROR("failed to open %s log file \"%s\", %s\n",
+		      type, temp_path, strerror(rc));
+		return rc;
+	}
+
+	while (size > 0) {
+		written = write(fd, data, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			rc = errno;
+			break;
+		}
+		data += written;
+		size -= written;
+	}
+
+	if (close(fd) != 0 && rc == 0)
+		rc = errno;
+
+	if (rc != 0) {
+		ERROR("failed to write %s log file \"%s\", %s\n",
+		      type, temp_path, strerror(rc));
+		unlink(temp_path);
+		return rc;
+	}
+
+	/* Replace the old log file with the newly-constructed one */
+	if (rename(temp_path, final_path) != 0) {
+		rc = errno;
+		ERROR("failed to install %s log file \"%s\", %s\n",
+		      type, final_path, strerror(rc));
+	}
+
+	return rc;
+}
+
+
+static void *log_files_writer_thread(void *arg)
+{
+	struct log_file *file;
+	char *data;
+	size_t size;
+	int rc;
+
+	if (setpriority(PRIO_PROCESS, (pid_t) syscall(SYS_gettid), LOG_FILE_WRITER_NICE) != 0)
+		TRACE_L4("logging: could not lower state file writer priority, %s\n",
+			 strerror(errno));
+
+	pthread_mutex_lock(&log_files_lock);
+	while (true) {
+		for (file = log_files; file != NULL; file = file->next)
+			if (file->pending != NULL)
+				break;
+
+		if (file == NULL) {
+			/* Stop taking state files only once drained so that
+			 * nothing is written synchronously while we write */
+			if (log_files_writer_stop) {
+				log_files_writer_active = false;
+				break;
+			}
+			pthread_cond_wait(&log_files_cond, &log_files_lock);
+			continue;
+		}
+
+		/* Take the newest content. The file is marked as installed
+		 * with this content now so that identical content submitted
+		 * while we are writing is skipped. */
+		data = file->pending;
+		size = file->pending_size;
+		file->pending = NULL;
+		file->installed = true;
+		file->installed_size = size;
+		file->installed_hash = file->pending_hash;
+		file->writing = true;
+		log_files_queued--;
+		pthread_mutex_unlock(&log_files_lock);
+
+		rc = log_file_install(file->type, file->temp_path,
+				      file->final_path, data, size);
+		free(data);
+
+		pthread_mutex_lock(&log_files_lock);
+		file->writing = false;
+		if (rc != 0)
+			file->installed = false;
+		else
+			log_files_written++;
+		pthread_cond_broadcast(&log_files_cond);
+	}
+	pthread_mutex_unlock(&log_files_lock);
+
+	return NULL;
+}
+
+
+/* Forget any content for a state file that is about to be deleted and wait
+ * for any write of it in progress to complete. */
+static void log_file_forget(const char *final_path)
+{
+	struct log_file *file;
+
+	pthread_mutex_lock(&log_files_lock);
+	file = log_file_find(final_path);
+	if (file != NULL) {
+		if (file->pending != NULL) {
+			free(file->pending);
+			file->pending = NULL;
+			log_files_queued--;
+		}
+		while (file->writing)
+			pthread_cond_wait(&log_files_cond, &log_files_lock);
+		file->installed = false;
+	}
+	pthread_mutex_unlock(&log_files_lock);
+}
+
+
+static void log_format_time(struct sfptpd_log_time *time,
+			    const struct timeval *tv)
+{
+	char temp[SFPTPD_LOG_TIME_STR_MAX];
+	sfptpd_secs_t s;
+	int rc;
+
+	s = (sfptpd_secs_t) tv->tv_sec;
+	sfptpd_local_strftime(temp, sizeof(temp), "%Y-%m-%d %X", &s);
+
+	rc = snprintf(time->time, sizeof(time->time), "%s.%06ld", temp, tv->tv_usec);
+	assert(rc < sizeof(time->time));
+}
+
+
 #ifndef SFPTPD_BUILDTIME_CHECKS
+static void log_write_text(int priority, const struct timeval *tv,
+			   const char *text)
+{
+	struct sfptpd_log_time time;
+
+	if (message_log == SFPTPD_MSG_LOG_TO_SYSLOG) {
+		syslog(priority, "%s", text);
+	} else {
+		log_format_time(&time, tv);
+
+		pthread_mutex_lock(&vmsg_mutex);
+		fprintf(stderr, "%s: %s: %s", time.time,
+			sfptpd_log_priority_text[priority], text);
+		pthread_mutex_unlock(&vmsg_mutex);
+	}
+}
+
+
+/* Find the next conversion specification in a format string.
+ * @param fmt The format string to search from
+ * @param spec Returned specification
+ * @return Pointer to the remaining format string or NULL at the end */
+static const char *log_fmt_next_spec(const char *fmt, struct log_fmt_spec *spec)
+{
+	const char *p;
+	int longs = 0;
+	char len_mod = '\0';
+
+	fmt = strchr(fmt, '%');
+	if (fmt == NULL)
+		return NULL;
+
+	spec->start = fmt;
+	spec->star_width = false;
+	spec->star_prec = false;
+	spec->kind = LOG_ARG_INVALID;
+
+	p = fmt + 1;
+	while (*p != '\0' && strchr("-+ #0'I", *p) != NULL)
+		p++;
+	if (*p == '*') {
+		spec->star_width = true;
+		p++;
+	} else {
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->star_prec = true;
+			p++;
+		} else {
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
+	}
+	while (*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+		if (*p == 'l' || *p == 'q')
+			longs += (*p == 'q') ? 2 : 1;
+		else
+			len_mod = *p;
+		p++;
+	}
+
+	switch (*p) {
+	case '%':
+		spec->kind = LOG_ARG_NONE;
+		break;
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+		if (len_mod == 'j')
+			spec->kind = LOG_ARG_INTMAX;
+		else if (len_mod == 'z')
+			spec->kind = LOG_ARG_SIZE;
+		else if (len_mod == 't')
+			spec->kind = LOG_ARG_PTRDIFF;
+		else if (longs >= 2)
+			spec->kind = LOG_ARG_LLONG;
+		else if (longs == 1)
+			spec->kind = LOG_ARG_LONG;
+		else
+			spec->kind = LOG_ARG_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'F':
+	case 'g': case 'G': case 'a': case 'A':
+		spec->kind = (len_mod == 'L') ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+		break;
+	case 's':
+		spec->kind = LOG_ARG_STRING;
+		break;
+	case 'p':
+		spec->kind = LOG_ARG_POINTER;
+		break;
+	case 'm':
+		spec->kind = LOG_ARG_ERRNO;
+		break;
+	default:
+		/* Includes %n, wide characters and truncated specifications */
+		spec->kind = LOG_ARG_INVALID;
+		break;
+	}
+
+	if (*p != '\0')
+		p++;
+	spec->len = p - fmt;
+	if (spec->len >= LOG_ASYNC_MAX_SPEC)
+		spec->kind = LOG_ARG_INVALID;
+
+	return p;
+}
+
+
+static size_t log_arg_size(enum log_arg_kind kind)
+{
+	switch (kind) {
+	case LOG_ARG_INT: return sizeof(int);
+	case LOG_ARG_LONG: return sizeof(long);
+	case LOG_ARG_LLONG: return sizeof(long long);
+	case LOG_ARG_INTMAX: return sizeof(intmax_t);
+	case LOG_ARG_SIZE: return sizeof(size_t);
+	case LOG_ARG_PTRDIFF: return sizeof(ptrdiff_t);
+	case LOG_ARG_DOUBLE: return sizeof(double);
+	case LOG_ARG_LDOUBLE: return sizeof(long double);
+	case LOG_ARG_POINTER: return sizeof(void *);
+	default: return 0;
+	}
+}
+
+
+/* Pack the arguments for a format string into a buffer.
+ * @return The number of bytes packed or -1 if the arguments cannot be
+ * packed, in which case the caller must fall back to preformatting. */
+static ssize_t log_pack_args(uint8_t *buf, size_t space,
+			     const char *format, va_list ap)
+{
+	struct log_fmt_spec spec;
+	const char *fmt = format;
+	const char *str;
+	size_t len = 0;
+	size_t slen;
+	union {
+		int i;
+		long l;
+		long long ll;
+		intmax_t im;
+		size_t sz;
+		ptrdiff_t pd;
+		double d;
+		long double ld;
+		void *p;
+	} arg;
+	int saved_errno = errno;
+
+	while ((fmt = log_fmt_next_spec(fmt, &spec)) != NULL) {
+		if (spec.kind == LOG_ARG_NONE)
+			continue;
+		if (spec.kind == LOG_ARG_INVALID)
+			return -1;
+
+		if (spec.star_width) {
+			arg.i = va_arg(ap, int);
+			if (len + sizeof arg.i > space)
+				return -1;
+			memcpy(buf + len, &arg.i, sizeof arg.i);
+			len += sizeof arg.i;
+		}
+		if (spec.star_prec) {
+			arg.i = va_arg(ap, int);
+			if (len + sizeof arg.i > space)
+				return -1;
+			memcpy(buf + len, &arg.i, sizeof arg.i);
+			len += sizeof arg.i;
+		}
+
+		switch (spec.kind) {
+		case LOG_ARG_INT: arg.i = va_arg(ap, int); break;
+		case LOG_ARG_LONG: arg.l = va_arg(ap, long); break;
+		case LOG_ARG_LLONG: arg.ll = va_arg(ap, long long); break;
+		case LOG_ARG_INTMAX: arg.im = va_arg(ap, intmax_t); break;
+		case LOG_ARG_SIZE: arg.sz = va_arg(ap, size_t); break;
+		case LOG_ARG_PTRDIFF: arg.pd = va_arg(ap, ptrdiff_t); break;
+		case LOG_ARG_DOUBLE: arg.d = va_arg(ap, double); break;
+		case LOG_ARG_LDOUBLE: arg.ld = va_arg(ap, long double); break;
+		case LOG_ARG_POINTER: arg.p = va_arg(ap, void *); break;
+		case LOG_ARG_STRING:
+		case LOG_ARG_ERRNO:
+			if (spec.kind == LOG_ARG_STRING)
+				str = va_arg(ap, const char *);
+			else
+				str = strerror(saved_errno);
+			if (str == NULL)
+				str = "(null)";
+			slen = strnlen(str, LOG_ASYNC_MAX_STRING - 1);
+			if (len + slen + 1 > space)
+				return -1;
+			memcpy(buf + len, str, slen);
+			buf[len + slen] = '\0';
+			len += slen + 1;
+			continue;
+		default:
+			return -1;
+		}
+
+		if (len + log_arg_size(spec.kind) > space)
+			return -1;
+		memcpy(buf + len, &arg, log_arg_size(spec.kind));
+		len += log_arg_size(spec.kind);
+	}
+
+	return len;
+}
+
+
+/* Format a record using its packed arguments */
+static void log_unpack_format(char *out, size_t space,
+			      const char *format, const uint8_t *args)
+{
+	struct log_fmt_spec spec;
+	const char *fmt = format;
+	const char *next;
+	char spec_buf[LOG_ASYNC_MAX_SPEC];
+	size_t used = 0;
+	size_t n;
+	int width = 0, prec = 0;
+	int rc;
+	union {
+		int i;
+		long l;
+		long long ll;
+		intmax_t im;
+		size_t sz;
+		ptrdiff_t pd;
+		double d;
+		long double ld;
+		void *p;
+	} arg;
+
+	assert(space > 0);
+
+#define LOG_EMIT(v) \
+	(spec.star_width ? \
+	 (spec.star_prec ? snprintf(out + used, space - used, spec_buf, width, prec, v) \
+			 : snprintf(out + used, space - used, spec_buf, width, v)) : \
+	 (spec.star_prec ? snprintf(out + used, space - used, spec_buf, prec, v) \
+			 : snprintf(out + used, space - used, spec_buf, v)))
+
+	while (used < space - 1) {
+		next = log_fmt_next_spec(fmt, &spec);
+
+		/* Copy literal text */
+		n = (next == NULL) ? strlen(fmt) : (size_t) (spec.start - fmt);
+		if (n > space - 1 - used)
+			n = space - 1 - used;
+		memcpy(out + used, fmt, n);
+		used += n;
+		if (next == NULL || used >= space - 1)
+			break;
+		fmt = next;
+
+		if (spec.kind == LOG_ARG_NONE) {
+			out[used++] = '%';
+			continue;
+		}
+
+		memcpy(spec_buf, spec.start, spec.len);
+		spec_buf[spec.len] = '\0';
+
+		if (spec.star_width) {
+			memcpy(&width, args, sizeof width);
+			args += sizeof width;
+		}
+		if (spec.star_prec) {
+			memcpy(&prec, args, sizeof prec);
+			args += sizeof prec;
+		}
+
+		if (spec.kind == LOG_ARG_STRING || spec.kind == LOG_ARG_ERRNO) {
+			spec_buf[spec.len - 1] = 's';
+			rc = LOG_EMIT((const char *) args);
+			args += strlen((const char *) args) + 1;
+		} else {
+			memcpy(&arg, args, log_arg_size(spec.kind));
+			args += log_arg_size(spec.kind);
+
+			switch (spec.kind) {
+			case LOG_ARG_INT: rc = LOG_EMIT(arg.i); break;
+			case LOG_ARG_LONG: rc = LOG_EMIT(arg.l); break;
+			case LOG_ARG_LLONG: rc = LOG_EMIT(arg.ll); break;
+			case LOG_ARG_INTMAX: rc = LOG_EMIT(arg.im); break;
+			case LOG_ARG_SIZE: rc = LOG_EMIT(arg.sz); break;
+			case LOG_ARG_PTRDIFF: rc = LOG_EMIT(arg.pd); break;
+			case LOG_ARG_DOUBLE: rc = LOG_EMIT(arg.d); break;
+			case LOG_ARG_LDOUBLE: rc = LOG_EMIT(arg.ld); break;
+			case LOG_ARG_POINTER: rc = LOG_EMIT(arg.p); break;
+			default: rc = 0; break;
+			}
+		}
+		if (rc > 0)
+			used += rc;
+		if (used > space - 1)
+			used = space - 1;
+	}
+#undef LOG_EMIT
+
+	out[used] = '\0';
+}
+
+
+static void log_async_thread_exit(void *context)
+{
+	struct log_ring *ring = (struct log_ring *) context;
+
+	__atomic_store_n(&ring->orphaned, true, __ATOMIC_RELEASE);
+}
+
+
+/* Get the ring for the calling thread, reusing a drained ring of an exited
+ * thread if one is available. */
+static struct log_ring *log_async_get_ring(void)
+{
+	struct log_ring *ring = log_thread_ring;
+	struct log_ring *head;
+	bool expected;
+
+	if (ring != NULL)
+		return ring;
+
+	for (ring = __atomic_load_n(&log_async_rings, __ATOMIC_ACQUIRE);
+	     ring != NULL; ring = ring->next) {
+		expected = true;
+		if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+		    __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) &&
+		    __atomic_compare_exchange_n(&ring->orphaned, &expected, false,
+						false, __ATOMIC_ACQ_REL,
+						__ATOMIC_RELAXED))
+			break;
+	}
+
+	if (ring == NULL) {
+		ring = calloc(1, sizeof *ring);
+		if (ring == NULL)
+			return NULL;
+		ring->buf = malloc(LOG_ASYNC_RING_SIZE);
+		if (ring->buf == NULL) {
+			free(ring);
+			return NULL;
+		}
+
+		head = __atomic_load_n(&log_async_rings, __ATOMIC_ACQUIRE);
+		do {
+			ring->next = head;
+		} while (!__atomic_compare_exchange_n(&log_async_rings, &head, ring,
+						      true, __ATOMIC_RELEASE,
+						      __ATOMIC_ACQUIRE));
+	}
+
+	ring->tid = (pid_t) syscall(SYS_gettid);
+	log_thread_ring = ring;
+	pthread_setspecific(log_async_key, ring);
+	return ring;
+}
+
+
+/* Append a record to the calling thread's ring.
+ * @return true if the record was queued, false if the ring is unavailable
+ * or full. */
+static bool log_async_submit(int priority, const char *format, va_list ap)
+{
+	struct log_ring *ring;
+	struct log_record *rec;
+	uint64_t head, tail;
+	size_t offset, to_end, len;
+	ssize_t args_len;
+	uint8_t *args;
+	char *text;
+	va_list aq;
+
+	ring = log_async_get_ring();
+	if (ring == NULL)
+		return false;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	offset = head & (LOG_ASYNC_RING_SIZE - 1);
+	to_end = LOG_ASYNC_RING_SIZE - offset;
+
+	/* Write the arguments into the ring at the contiguous position where
+	 * the record will be, wrapping if there is not a maximally-sized
+	 * record's room before the end. */
+	if (to_end < LOG_ASYNC_MAX_RECORD) {
+		if (LOG_ASYNC_RING_SIZE - (head - tail) < to_end + LOG_ASYNC_MAX_RECORD)
+			goto overflow;
+		rec = (struct log_record *) (ring->buf + offset);
+		rec->len = to_end;
+		rec->type = LOG_RECORD_PAD;
+		head += to_end;
+		offset = 0;
+	} else if (LOG_ASYNC_RING_SIZE - (head - tail) < LOG_ASYNC_MAX_RECORD) {
+		goto overflow;
+	}
+
+	rec = (struct log_record *) (ring->buf + offset);
+	args = rec->args;
+
+	va_copy(aq, ap);
+	args_len = log_pack_args(args, LOG_ASYNC_MAX_RECORD - sizeof *rec,
+				 format, aq);
+	va_end(aq);
+	if (args_len < 0) {
+		/* Preformat messages whose arguments can't be packed */
+		text = (char *) args;
+		vsnprintf(text, LOG_ASYNC_MAX_RECORD - sizeof *rec, format, ap);
+		args_len = strlen(text) + 1;
+		format = "%s";
+	}
+
+	len = LOG_ASYNC_ALIGN(sizeof *rec + args_len);
+	rec->len = len;
+	rec->type = LOG_RECORD_MESSAGE;
+	rec->priority = priority;
+	rec->format = format;
+	gettimeofday(&rec->time, NULL);
+
+	/* Nothing may fail between taking the sequence number and publishing
+	 * the record: the writer waits for each number in turn. */
+	rec->seq = __atomic_fetch_add(&log_async_seq, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->head, head + len, __ATOMIC_SEQ_CST);
+
+	/* Only make a system call if the writer is waiting */
+	if (__atomic_load_n(&log_async_writer_idle, __ATOMIC_SEQ_CST) &&
+	    __atomic_exchange_n(&log_async_writer_idle, false, __ATOMIC_SEQ_CST)) {
+		uint64_t one = 1;
+		if (write(log_async_wakefd, &one, sizeof one) != sizeof one) {
+			/* Nothing we can usefully do; the writer will time out */
+		}
+	}
+	return true;
+
+overflow:
+	__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+
+/* Get the next message record in a ring, skipping padding.
+ * @return the record or NULL if the ring is empty */
+static struct log_record *log_async_peek(struct log_ring *ring)
+{
+	struct log_record *rec;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	while (ring->tail != head) {
+		rec = (struct log_record *)
+			(ring->buf + (ring->tail & (LOG_ASYNC_RING_SIZE - 1)));
+		if (rec->type == LOG_RECORD_MESSAGE)
+			return rec;
+		__atomic_store_n(&ring->tail, ring->tail + rec->len, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+
+static void log_async_report_dropped(struct log_ring *ring)
+{
+	uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_ACQUIRE);
+	char text[128];
+	struct timeval now;
+
+	if (dropped == ring->dropped_reported)
+		return;
+
+	log_async_total_dropped += dropped - ring->dropped_reported;
+	snprintf(text, sizeof text,
+		 "logging: %" PRIu64 " messages dropped from thread %d\n",
+		 dropped - ring->dropped_reported, (int) ring->tid);
+	ring->dropped_reported = dropped;
+
+	gettimeofday(&now, NULL);
+	log_write_text(LOG_WARNING, &now, text);
+}
+
+
+/* Write out queued records in sequence order. A thread that has taken a
+ * sequence number may not have published its record yet, so unless flushing
+ * stop at a gap in the sequence: the record will be along shortly and the
+ * thread publishing it wakes the writer if it has gone idle.
+ * @param flush Write out all queued records, skipping any gaps
+ * @return the number of records written */
+static int log_async_drain(bool flush)
+{
+	static char text[LOG_ASYNC_TEXT_MAX];
+	struct log_ring *ring, *best_ring;
+	struct log_record *rec, *best;
+	int count = 0;
+
+	do {
+		best = NULL;
+		best_ring = NULL;
+		for (ring = __atomic_load_n(&log_async_rings, __ATOMIC_ACQUIRE);
+		     ring != NULL; ring = ring->next) {
+			log_async_report_dropped(ring);
+			rec = log_async_peek(ring);
+			if (rec != NULL && (best == NULL || rec->seq < best->seq)) {
+				best = rec;
+				best_ring = ring;
+			}
+		}
+
+		if (best != NULL && best->seq > log_async_next_seq && !flush)
+			break;
+
+		if (best != NULL) {
+			if (best->seq >= log_async_next_seq)
+				log_async_next_seq = best->seq + 1;
+			log_unpack_format(text, sizeof text, best->format, best->args);
+			log_write_text(best->priority, &best->time, text);
+			__atomic_store_n(&best_ring->tail, best_ring->tail + best->len,
+					 __ATOMIC_RELEASE);
+			count++;
+		}
+	} while (best != NULL);
+
+	return count;
+}
+
+
+static void *log_async_writer_thread(void *arg)
+{
+	struct pollfd pfd = { .fd = log_async_wakefd, .events = POLLIN };
+	uint64_t events;
+
+	if (setpriority(PRIO_PROCESS, (pid_t) syscall(SYS_gettid), LOG_ASYNC_WRITER_NICE) != 0)
+		TRACE_L4("logging: could not lower message writer priority, %s\n",
+			 strerror(errno));
+
+	while (!__atomic_load_n(&log_async_stop, __ATOMIC_ACQUIRE)) {
+		if (log_async_drain(false) != 0)
+			continue;
+
+		/* Announce that we are about to sleep and then check again
+		 * so that a record published concurrently is not missed. */
+		__atomic_store_n(&log_async_writer_idle, true, __ATOMIC_SEQ_CST);
+		if (log_async_drain(false) != 0) {
+			__atomic_store_n(&log_async_writer_idle, false, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		if (poll(&pfd, 1, LOG_ASYNC_IDLE_TIMEOUT_MS) > 0 &&
+		    read(log_async_wakefd, &events, sizeof events) != sizeof events) {
+			/* Spurious wakeup */
+		}
+		__atomic_store_n(&log_async_writer_idle, false, __ATOMIC_SEQ_CST);
+	}
+
+	log_async_drain(true);
+	return NULL;
+}
+
+
 static void sfptpd_log_vmessage(int priority, const char * format, va_list ap)
 {
 	assert(priority >= 0);
@@ -263,7 +1184,11 @@ static void sfptpd_log_vmessage(int priority, const char * format, va_list ap)
 	 * set in /etc/rsyslog.conf */
 	if(priority > LOG_DEBUG)
 		priority = LOG_DEBUG;
-	
+
+	if (__atomic_load_n(&log_async_active, __ATOMIC_ACQUIRE) &&
+	    log_async_submit(priority, format, ap))
+		return;
+
 	if (message_log == SFPTPD_MSG_LOG_TO_SYSLOG) {
 		vsyslog(priority, format, ap);
 	} else {
@@ -395,19 +1320,23 @@ int sfptpd_log_open(struct sfptpd_config *config)
 	/* Take copies of the message and stats logging targets and the trace level */
 	message_log = general_config->message_log;
 	stats_log = general_config->stats_log;
-	trace_levels[SFPTPD_COMPONENT_ID_SFPTPD] = general_config->trace_level;
-	trace_levels[SFPTPD_COMPONENT_ID_THREADING] = general_config->threading_trace_level;
-	trace_levels[SFPTPD_COMPONENT_ID_BIC] = general_config->bic_trace_level;
-	trace_levels[SFPTPD_COMPONENT_ID_NETLINK] = general_config->netlink_trace_level;
-	trace_levels[SFPTPD_COMPONENT_ID_NTP] = general_config->ntp_trace_level;
-	trace_levels[SFPTPD_COMPONENT_ID_SERVO] = general_config->servo_trace_level;
-	trace_levels[SFPTPD_COMPONENT_ID_CLOCKS] = general_config->clocks_trace_level;
+	persistent_stats = general_config->persistent_stats;
+	stats_history_uid = general_config->uid;
+	stats_history_gid = general_config->gid;
+	log_async_configured = general_config->message_log_async;
+	sfptpd_trace_levels[SFPTPD_COMPONENT_ID_SFPTPD] = general_config->trace_level;
+	sfptpd_trace_levels[SFPTPD_COMPONENT_ID_THREADING] = general_config->threading_trace_level;
+	sfptpd_trace_levels[SFPTPD_COMPONENT_ID_BIC] = general_config->bic_trace_level;
+	sfptpd_trace_levels[SFPTPD_COMPONENT_ID_NETLINK] = general_config->netlink_trace_level;
+	sfptpd_trace_levels[SFPTPD_COMPONENT_ID_NTP] = general_config->ntp_trace_level;
+	sfptpd_trace_levels[SFPTPD_COMPONENT_ID_SERVO] = general_config->servo_trace_level;
+	sfptpd_trace_levels[SFPTPD_COMPONENT_ID_CLOCKS] = general_config->clocks_trace_level;
 
 	/* Ratchet up some component trace levels based on the general level
 	 * where appropriate. */
-	if (trace_levels[SFPTPD_COMPONENT_ID_NETLINK] < 1 &&
-	    trace_levels[SFPTPD_COMPONENT_ID_SFPTPD] >= 1) {
-		trace_levels[SFPTPD_COMPONENT_ID_NETLINK] = 1;
+	if (sfptpd_trace_levels[SFPTPD_COMPONENT_ID_NETLINK] < 1 &&
+	    sfptpd_trace_levels[SFPTPD_COMPONENT_ID_SFPTPD] >= 1) {
+		sfptpd_trace_levels[SFPTPD_COMPONENT_ID_NETLINK] = 1;
 	}
 
 	/* Make sure that the directory for saved clock state exists */
@@ -580,22 +1509,25 @@ int sfptpd_log_rotate(struct sfptpd_config *config)
 	if (strlen(general_config->json_stats_filename) > 0) {
 		char *path = format_path(general_config->json_stats_filename);
 
-		/* Close and then reopen the log file */
-		if(json_stats_fp != NULL)
-			fclose(json_stats_fp);
-		else
-			json_stats_buf = malloc(json_stats_bufsz);
+		/* Write out pending records then close and reopen the log file */
+		if (json_stats_fd != -1) {
+			sfptpd_log_rt_stats_flush();
+			close(json_stats_fd);
+		} else if (json_stats_data == NULL) {
+			json_stats_data = malloc(RT_STATS_BUF_SIZE);
+		}
 
-		json_stats_fp = path ? fopen(path, "a") : NULL;
-		if (json_stats_fp == NULL) {
+		json_stats_fd = (path && json_stats_data) ?
+			open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : -1;
+		if (json_stats_fd == -1) {
 			ERROR("Failed to open json stats file %s, error %s\n",
 			      path ? path : general_config->json_stats_filename, strerror(errno));
-			if (json_stats_buf)
-				free(json_stats_buf);
+			free(json_stats_data);
+			json_stats_data = NULL;
 			/* We don't set rc = errno because this log is non-critical. */
 		} else {
-			setvbuf(json_stats_fp, json_stats_buf, _IOFBF, json_stats_bufsz);
-			json_stats_ptr = 0;
+			sfptpd_json_init(&json_stats_buf, json_stats_data, RT_STATS_BUF_SIZE);
+			json_stats_record_start = 0;
 		}
 		free_path(path);
 	}
@@ -625,20 +1557,30 @@ bool sfptpd_log_isatty(void)
 
 void sfptpd_log_close(void)
 {
+	/* Stop the writers first so that everything they have queued,
+	 * including messages about writing state files, reaches the sinks
+	 * before these are closed. */
+	sfptpd_log_file_writer_stop();
+	sfptpd_log_async_stop();
+
 	if (message_log == SFPTPD_MSG_LOG_TO_SYSLOG)
 		closelog();
 	
 	if (message_log_fd != -1 &&
 	    message_log_fd != stats_log_fd)
 		close(message_log_fd);
+	message_log_fd = -1;
 
 	if (stats_log_fd != -1)
 		close(stats_log_fd);
-
-	if (json_stats_fp != NULL) {
-		fclose(json_stats_fp);
-		json_stats_fp = NULL;
-		free(json_stats_buf);
+	stats_log_fd = -1;
+
+	if (json_stats_fd != -1) {
+		sfptpd_log_rt_stats_flush();
+		close(json_stats_fd);
+		json_stats_fd = -1;
+		free(json_stats_data);
+		json_stats_data = NULL;
 	}
 
 	if (json_remote_monitor_fp != NULL) {
@@ -650,6 +1592,94 @@ void sfptpd_log_close(void)
 }
 
 
+int sfptpd_log_async_start(void)
+{
+	sigset_t all_signals, saved_signals;
+	int rc;
+
+	if (!log_async_configured || log_async_active)
+		return 0;
+
+	rc = pthread_key_create(&log_async_key, log_async_thread_exit);
+	if (rc != 0) {
+		ERROR("logging: failed to create thread key, %s\n", strerror(rc));
+		return rc;
+	}
+
+	log_async_wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (log_async_wakefd < 0) {
+		rc = errno;
+		ERROR("logging: failed to create eventfd, %s\n", strerror(rc));
+		goto fail_key;
+	}
+
+	log_async_stop = false;
+	log_async_writer_idle = false;
+
+	/* The writer thread must not handle any of the signals that the
+	 * application handles synchronously */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_BLOCK, &all_signals, &saved_signals);
+	rc = pthread_create(&log_async_writer, NULL, log_async_writer_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &saved_signals, NULL);
+	if (rc != 0) {
+		ERROR("logging: failed to create writer thread, %s\n", strerror(rc));
+		goto fail_fd;
+	}
+	pthread_setname_np(log_async_writer, "sfptpd-log");
+
+	__atomic_store_n(&log_async_active, true, __ATOMIC_RELEASE);
+	TRACE_L3("logging: started asynchronous message writer\n");
+	return 0;
+
+fail_fd:
+	close(log_async_wakefd);
+	log_async_wakefd = -1;
+fail_key:
+	pthread_key_delete(log_async_key);
+	return rc;
+}
+
+
+void sfptpd_log_async_stop(void)
+{
+	struct log_ring *ring, *next;
+	uint64_t one = 1;
+
+	if (!log_async_active)
+		return;
+
+	/* Subsequent messages are written synchronously */
+	__atomic_store_n(&log_async_active, false, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&log_async_stop, true, __ATOMIC_SEQ_CST);
+	if (write(log_async_wakefd, &one, sizeof one) != sizeof one) {
+		/* The writer will time out */
+	}
+	pthread_join(log_async_writer, NULL);
+
+	/* Catch anything queued while the writer was exiting */
+	log_async_drain(true);
+
+	if (log_async_total_dropped != 0)
+		WARNING("logging: %" PRIu64 " messages dropped in total\n",
+			log_async_total_dropped);
+
+	close(log_async_wakefd);
+	log_async_wakefd = -1;
+	pthread_key_delete(log_async_key);
+
+	/* Other threads have been shut down by this point so only the calling
+	 * thread can still refer to a ring. */
+	for (ring = log_async_rings; ring != NULL; ring = next) {
+		next = ring->next;
+		free(ring->buf);
+		free(ring);
+	}
+	log_async_rings = NULL;
+	log_thread_ring = NULL;
+}
+
+
 FILE *sfptpd_log_file_get_stream(struct sfptpd_log *log)
 {
 	assert(log != NULL);
@@ -660,33 +1690,149 @@ FILE *sfptpd_log_file_get_stream(struct sfptpd_log *log)
 
 int sfptpd_log_file_close(struct sfptpd_log *log)
 {
-	int rc;
+	struct log_file *file;
+	uint64_t hash;
+	int rc = 0;
 
 	assert(log != NULL);
 	assert(log->stream != NULL);
 
-	/* Close the stream */
-	fclose(log->stream);
+	/* Close the stream to complete the content in memory */
+	if (fclose(log->stream) != 0)
+		rc = errno;
+	else if (log->data == NULL)
+		rc = ENOMEM;
+	if (rc != 0) {
+		ERROR("failed to construct %s log file \"%s\", %s\n",
+		      log->type, log->final_path, strerror(rc));
+		free(log->data);
+		free(log);
+		return rc;
+	}
 	log->stream = NULL;
 
-	/* Replace the old log file with the newly-constructed one */
-	rc = rename(log->temp_path, log->final_path);
-	if (rc != 0) {
-		ERROR("failed to install %s log file \"%s\", %s\n",
-		      log->type, log->final_path, strerror(errno));
+	hash = log_file_hash(log->data, log->size);
+
+	/* Once the writer has stopped, state files are no longer tracked */
+	pthread_mutex_lock(&log_files_lock);
+	if (log_files_writer_stop)
+		file = NULL;
+	else
+		file = log_file_get(log);
+
+	if (file != NULL && file->pending != NULL &&
+	    file->pending_size == log->size && file->pending_hash == hash) {
+		/* Already waiting to be written */
+		log_files_skipped++;
+	} else if (file != NULL && file->installed &&
+		   file->installed_size == log->size &&
+		   file->installed_hash == hash) {
+		/* Unchanged; drop any intermediate content not yet written */
+		if (file->pending != NULL) {
+			free(file->pending);
+			file->pending = NULL;
+			log_files_queued--;
+		}
+		log_files_skipped++;
+	} else if (file != NULL && log_files_writer_active) {
+		/* Hand over to the writer, replacing any older content */
+		if (file->pending != NULL)
+			free(file->pending);
+		else
+			log_files_queued++;
+		file->pending = log->data;
+		file->pending_size = log->size;
+		file->pending_hash = hash;
+		log->data = NULL;
+		pthread_cond_broadcast(&log_files_cond);
+	} else {
+		/* Write synchronously */
+		rc = log_file_install(log->type, log->temp_path, log->final_path,
+				      log->data, log->size);
+		if (file != NULL) {
+			file->installed = (rc == 0);
+			file->installed_size = log->size;
+			file->installed_hash = hash;
+		}
+		if (rc == 0)
+			log_files_written++;
 	}
+	pthread_mutex_unlock(&log_files_lock);
 
 	/* Free the log object */
+	free(log->data);
 	free(log);
 
 	return rc;
 }
 
 
+int sfptpd_log_file_writer_start(void)
+{
+	sigset_t all_signals, saved_signals;
+	int rc;
+
+	if (log_files_writer_running)
+		return 0;
+
+	log_files_writer_stop = false;
+
+	/* The writer thread must not handle any of the signals that the
+	 * application handles synchronously */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_BLOCK, &all_signals, &saved_signals);
+	rc = pthread_create(&log_files_writer, NULL, log_files_writer_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &saved_signals, NULL);
+	if (rc != 0) {
+		ERROR("logging: failed to create state file writer thread, %s\n",
+		      strerror(rc));
+		return rc;
+	}
+	pthread_setname_np(log_files_writer, "sfptpd-files");
+
+	log_files_writer_running = true;
+	pthread_mutex_lock(&log_files_lock);
+	log_files_writer_active = true;
+	pthread_mutex_unlock(&log_files_lock);
+
+	TRACE_L3("logging: started state file writer\n");
+	return 0;
+}
+
+
+void sfptpd_log_file_writer_stop(void)
+{
+	unsigned int written, skipped;
+
+	/* The writer writes out anything queued, including state files
+	 * closed while it is stopping, and then hands over to synchronous
+	 * writes before exiting. */
+	pthread_mutex_lock(&log_files_lock);
+	log_files_writer_stop = true;
+	pthread_cond_broadcast(&log_files_cond);
+	pthread_mutex_unlock(&log_files_lock);
+
+	if (log_files_writer_running) {
+		pthread_join(log_files_writer, NULL);
+		log_files_writer_running = false;
+	}
+
+	pthread_mutex_lock(&log_files_lock);
+	assert(log_files_queued == 0);
+	written = log_files_written;
+	skipped = log_files_skipped;
+	log_files_free();
+	pthread_mutex_unlock(&log_files_lock);
+
+	TRACE_L3("logging: state files written %u, unchanged %u\n",
+		 written, skipped);
+}
+
+
 void sfptpd_log_set_trace_level(sfptpd_component_id_e component, int level)
 {
 	assert(component < SFPTPD_COMPONENT_ID_MAX);
-	trace_levels[component] = level;
+	sfptpd_trace_levels[component] = level;
 }
 
 
@@ -705,7 +1851,6 @@ void sfptpd_log_trace(sfptpd_component_id_e component, unsigned int level,
 		      const char *format, ...)
 {
 	va_list ap;
-	va_start(ap, format);
 
 	assert(component < SFPTPD_COMPONENT_ID_MAX);
 	assert(format != NULL);
@@ -713,12 +1858,14 @@ void sfptpd_log_trace(sfptpd_component_id_e component, unsigned int level,
 	/* Permit trace level 0, using it for explicit user requests for
 	 * diagnostics at runtime. */
 
-	/* For trace, we suppress the output if above the current trace level. */
-	if (level > trace_levels[component])
+	/* For trace, we suppress the output if above the current trace level.
+	 * The TRACE() macro has normally checked this already but the
+	 * function may also be called directly. */
+	if (!SFPTPD_TRACE_ENABLED(component, level))
 		return;
 
+	va_start(ap, format);
 	sfptpd_log_vmessage(level + LOG_INFO, format, ap);
-
 	va_end(ap);
 }
 
@@ -737,29 +1884,59 @@ void sfptpd_log_stats(const char *format, ...)
 }
 
 
-FILE *sfptpd_log_get_rt_stats_out_stream(void)
+struct sfptpd_json_buf *sfptpd_log_rt_stats_begin(void)
 {
-	return json_stats_fp;
+	if (json_stats_fd == -1)
+		return NULL;
+
+	json_stats_record_start = json_stats_buf.len;
+	return &json_stats_buf;
 }
 
 
-bool sfptpd_log_rt_stats_written(size_t chars, bool flush)
+int sfptpd_log_rt_stats_end(bool flush)
 {
-	size_t headroom;
-	bool flushed = false;
+	if (json_stats_fd == -1)
+		return 0;
 
-	json_stats_ptr += chars;
-	headroom = json_stats_bufsz - json_stats_ptr;
+	if (json_stats_buf.overflow) {
+		/* Discard the partial record and make room for a retry */
+		json_stats_buf.len = json_stats_record_start;
+		json_stats_buf.overflow = false;
+		sfptpd_log_rt_stats_flush();
+		return ENOSPC;
+	}
 
-	if (flush ||
-	    headroom < APPROX_RT_STATS_LENGTH ||
-	    headroom < chars * 2) {
-		fflush(json_stats_fp);
-		json_stats_ptr = 0;
-		flushed = true;
+	if (flush || sfptpd_json_headroom(&json_stats_buf) < RT_STATS_FLUSH_HEADROOM)
+		sfptpd_log_rt_stats_flush();
+
+	return 0;
+}
+
+
+void sfptpd_log_rt_stats_flush(void)
+{
+	const char *data = json_stats_buf.data;
+	size_t remaining = json_stats_buf.len;
+	ssize_t written;
+
+	if (json_stats_fd == -1)
+		return;
+
+	while (remaining > 0) {
+		written = write(json_stats_fd, data, remaining);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			TRACE_L4("error writing json stats, %s\n", strerror(errno));
+			break;
+		}
+		data += written;
+		remaining -= written;
 	}
 
-	return flushed;
+	sfptpd_json_reset(&json_stats_buf);
+	json_stats_record_start = 0;
 }
 
 
@@ -870,6 +2047,7 @@ void sfptpd_log_delete_freq_correction(struct sfptpd_clock *clock)
 	snprintf(path, sizeof(path), freq_correction_file_format,
 		 sfptpd_clock_get_fname_string(clock));
 
+	log_file_forget(path);
 	unlink(path);
 }
 
@@ -898,6 +2076,12 @@ struct sfptpd_log *sfptpd_log_open_sync_instances(void)
 }
 
 
+struct sfptpd_log *sfptpd_log_open_startup(void)
+{
+	return create_log("startup", sfptpd_startup_file);
+}
+
+
 #ifndef SFPTPD_BUILDTIME_CHECKS
 void sfptpd_log_topology_write_field(FILE *stream, bool new_line,
 				     const char *format, ...)
@@ -1058,6 +2242,51 @@ struct sfptpd_log *sfptpd_log_open_statistics_json(struct sfptpd_clock *clock,
 }
 
 
+int sfptpd_log_get_stats_history_path(struct sfptpd_clock *clock,
+				      const char *entity_name,
+				      char *path, size_t space)
+{
+	const char *name;
+	int len;
+
+	assert(clock || entity_name);
+	assert(path != NULL);
+
+	if (!persistent_stats)
+		return ENOTSUP;
+
+	if (entity_name != NULL)
+		name = entity_name;
+	else
+		name = sfptpd_clock_get_fname_string(clock);
+
+	/* Create the path of the stats history file named after either the
+	 * clock or the sync module instance along the lines of
+	 *      /var/lib/sfptpd/history-system or
+	 *      /var/lib/sfptpd/history-1122:3344:5566:7788 or
+	 *      /var/lib/sfptpd/history-ptp1
+	 * Unlike the other state files these are kept across restarts.
+	 */
+	len = snprintf(path, space, "%s", state_file_format);
+	if (len >= space)
+		return ENAMETOOLONG;
+	len = snprintf(path + len, space - len,
+		       sfptpd_stats_history_file_format, name) + len;
+	if (len >= space)
+		return ENAMETOOLONG;
+
+	return 0;
+}
+
+
+void sfptpd_log_set_stats_history_owner(int fd)
+{
+	if (fchown(fd, stats_history_uid, stats_history_gid))
+		TRACE_L4("could not set stats history file ownership, %s\n",
+			 strerror(errno));
+}
+
+
 struct sfptpd_log *sfptpd_log_open_remote_monitor(void)
 {
 	return create_log("remote-monitor", sfptpd_remote_monitor_file);
@@ -1067,18 +2296,11 @@ struct sfptpd_log *sfptpd_log_open_remote_monitor(void)
 void sfptpd_log_get_time(struct sfptpd_log_time *time)
 {
 	struct timeval now;
-	char temp[SFPTPD_LOG_TIME_STR_MAX];
-	sfptpd_secs_t s;
-	int rc;
-	
+
 	assert(time != NULL);
-	
-	gettimeofday(&now, 0);
-	s = (sfptpd_secs_t) now.tv_sec;
-	sfptpd_local_strftime(temp, sizeof(temp), "%Y-%m-%d %X", &s);
 
-	rc = snprintf(time->time, sizeof(time->time), "%s.%06ld", temp, now.tv_usec);
-	assert(rc < sizeof(time->time));
+	gettimeofday(&now, 0);
+	log_format_time(time, &now);
 }
 
 
@@ -40,6 +40,7 @@
 #include "sfptpd_netlink.h"
 #include "sfptpd_statistics.h"
 #include "sfptpd_multicast.h"
+#include "sfptpd_startup.h"
 
 #ifdef HAVE_CAPS
 #include <sys/capability.h>
@@ -746,6 +747,9 @@ int main(int argc, char **argv)
 	setvbuf(stdout, (char *) NULL, _IOLBF, 0);
 	setvbuf(stderr, (char *) NULL, _IOLBF, 0);
 
+	/* Start the startup timeline */
+	sfptpd_startup_mark(SFPTPD_STARTUP_PROCESS_START);
+
 	INFO("Solarflare Enhanced PTP Daemon, version %s\n",
 	     SFPTPD_VERSION_TEXT);
 
@@ -768,6 +772,7 @@ int main(int argc, char **argv)
 	rc = sfptpd_config_parse_command_line_pass2(config, argc, argv);
 	if (rc != 0)
 		goto fail;
+	sfptpd_startup_mark(SFPTPD_STARTUP_CONFIG_PARSED);
 
 	/* Perform some runtime checks */
 	rc = runtime_checks(config);
@@ -793,6 +798,7 @@ int main(int argc, char **argv)
 	rc = netlink_start();
 	if (rc != 0)
 		goto exit;
+	sfptpd_startup_mark(SFPTPD_STARTUP_NETLINK_SCANNED);
 
 	/* Set up the hardware state lock */
 	rc = hardware_state_lock_init();
@@ -803,12 +809,14 @@ int main(int argc, char **argv)
 	rc = sfptpd_clock_initialise(config, &hardware_state_lock);
 	if (rc != 0)
 		goto exit;
+	sfptpd_startup_mark(SFPTPD_STARTUP_CLOCKS_INITIALISED);
 
 	/* Start interface management */
 	rc = sfptpd_interface_initialise(config, &hardware_state_lock,
 					 initial_link_table);
 	if (rc != 0)
 		goto exit;
+	sfptpd_startup_mark(SFPTPD_STARTUP_INTERFACES_INITIALISED);
 
 #ifdef HAVE_CAPS
 	/* Drop to non-root user/group if so configured */
@@ -828,6 +836,16 @@ int main(int argc, char **argv)
 	if (rc != 0)
 		goto exit;
 
+	/* Start the message writer thread now that we won't fork again */
+	rc = sfptpd_log_async_start();
+	if (rc != 0)
+		goto exit;
+
+	/* Start the state file writer thread */
+	rc = sfptpd_log_file_writer_start();
+	if (rc != 0)
+		goto exit;
+
 	/* Create the set of signals that the application handles */
 	sigemptyset(&signal_set);
 	sigaddset(&signal_set, SIGINT);
@@ -0,0 +1,741 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_metrics.c
+ * @brief  OpenMetrics exporter service
+ *
+ * Threads that own statistics render them as OpenMetrics text into a
+ * private buffer at their own pace and publish the result by swapping it
+ * with the snapshot served to scrapers. Scrapes are answered by the
+ * metrics thread by concatenating the latest snapshots, so they involve
+ * no file I/O and never touch live data structures.
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sfptpd_logging.h"
+#include "sfptpd_general_config.h"
+#include "sfptpd_thread.h"
+#include "sfptpd_json.h"
+#include "sfptpd_time.h"
+#include "sfptpd_metrics.h"
+
+
+/****************************************************************************
+ * Types, Defines and Structures
+ ****************************************************************************/
+
+#define METRICS_MODULE_MAGIC  0x0E7A1C5500000000ULL
+#define METRICS_DELETED_MAGIC 0xD0D00E7A1C550000ULL
+
+#define PREFIX "metrics: "
+
+/* Initial and maximum sizes of a source's render buffers */
+#define METRICS_SOURCE_INITIAL_SIZE (16 * 1024)
+#define METRICS_SOURCE_MAX_SIZE (4 * 1024 * 1024)
+
+/* Maximum size of an HTTP request we are prepared to read */
+#define METRICS_REQUEST_MAX (4096)
+
+/* Socket timeout for a scrape. The metrics thread serves one scrape at a
+ * time so this limits the impact of a stalled client. */
+#define METRICS_SCRAPE_TIMEOUT_MS (1000)
+
+#define METRICS_CONTENT_TYPE \
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct sfptpd_metrics_source {
+	char name[32];
+
+	/* Published snapshot. Protected by metrics_lock. */
+	char *published;
+	size_t published_len;
+	size_t published_size;
+
+	/* Buffer rendered into by the owning thread */
+	char *render;
+	size_t render_size;
+
+	bool overflow_reported;
+
+	struct sfptpd_metrics_source *next;
+};
+
+struct sfptpd_metrics {
+	uint64_t magic;
+
+	/* General configuration */
+	struct sfptpd_config_general *general_config;
+
+	/* Listening socket */
+	int listen_fd;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	/* Response body assembled from source snapshots */
+	char *body;
+	size_t body_size;
+
+	/* Counters */
+	uint64_t scrapes;
+	long double last_scrape_s;
+};
+
+
+/****************************************************************************
+ * Local Data
+ ****************************************************************************/
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sfptpd_metrics_source *metrics_sources = NULL;
+static bool metrics_running = false;
+
+static const char *metrics_type_names[SFPTPD_METRICS_TYPE_MAX] = {
+	[SFPTPD_METRICS_TYPE_GAUGE] = "gauge",
+	[SFPTPD_METRICS_TYPE_COUNTER] = "counter",
+	[SFPTPD_METRICS_TYPE_HISTOGRAM] = "histogram",
+	[SFPTPD_METRICS_TYPE_SUMMARY] = "summary",
+};
+
+
+/****************************************************************************
+ * Internal Functions
+ ****************************************************************************/
+
+static void metrics_escape(struct sfptpd_json_buf *buf, const char *text)
+{
+	const char *run;
+
+	for (run = text; *text != '\0'; text++) {
+		if (*text != '"' && *text != '\\' && *text != '\n')
+			continue;
+
+		sfptpd_json_raw(buf, run, text - run);
+		if (*text == '\n')
+			sfptpd_json_lit(buf, "\\n");
+		else if (*text == '"')
+			sfptpd_json_lit(buf, "\\\"");
+		else
+			sfptpd_json_lit(buf, "\\\\");
+		run = text + 1;
+	}
+	sfptpd_json_raw(buf, run, text - run);
+}
+
+
+static bool metrics_name_append(char *name, size_t *len, const char *text)
+{
+	for (; *text != '\0' && *len < SFPTPD_METRICS_NAME_MAX - 1; text++) {
+		char c = *text;
+
+		if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		      (c >= '0' && c <= '9') || c == '_' || c == ':'))
+			c = '_';
+		name[(*len)++] = c;
+	}
+	name[*len] = '\0';
+	return *text == '\0';
+}
+
+
+/* Remove a stale Unix domain socket, leaving anything else at the path
+ * for bind() to fail on */
+static void metrics_unlink_socket(const char *path)
+{
+	struct stat st;
+
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+}
+
+
+static int metrics_open_socket(struct sfptpd_metrics *metrics)
+{
+	const char *spec = metrics->general_config->openmetrics_socket;
+	int one = 1;
+	int rc;
+
+	rc = sfptpd_metrics_parse_address(spec, &metrics->addr, &metrics->addr_len);
+	if (rc != 0) {
+		ERROR(PREFIX "invalid socket address %s\n", spec);
+		return rc;
+	}
+
+	if (metrics->addr.ss_family == AF_UNIX)
+		metrics_unlink_socket(spec);
+
+	metrics->listen_fd = socket(metrics->addr.ss_family,
+				    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (metrics->listen_fd == -1) {
+		rc = errno;
+		ERROR(PREFIX "couldn't create socket, %s\n", strerror(rc));
+		return rc;
+	}
+
+	if (metrics->addr.ss_family != AF_UNIX)
+		setsockopt(metrics->listen_fd, SOL_SOCKET, SO_REUSEADDR,
+			   &one, sizeof one);
+
+	if (bind(metrics->listen_fd, (struct sockaddr *) &metrics->addr,
+		 metrics->addr_len) != 0 ||
+	    listen(metrics->listen_fd, 8) != 0) {
+		rc = errno;
+		ERROR(PREFIX "couldn't listen on %s, %s\n", spec, strerror(rc));
+		close(metrics->listen_fd);
+		metrics->listen_fd = -1;
+		return rc;
+	}
+
+	/* Set ownership of socket. Defer error to any consequent failure. */
+	if (metrics->addr.ss_family == AF_UNIX &&
+	    chown(spec, metrics->general_config->uid,
+		  metrics->general_config->gid))
+		TRACE_L4(PREFIX "could not set socket ownership, %s\n",
+			 strerror(errno));
+
+	INFO(PREFIX "serving OpenMetrics on %s\n", spec);
+	return 0;
+}
+
+
+/* Assemble the response body from the source snapshots.
+ * @return The length of the body */
+static size_t metrics_collect(struct sfptpd_metrics *metrics)
+{
+	struct sfptpd_metrics_source *source;
+	struct sfptpd_json_buf buf;
+	size_t needed = 1024;
+	char name[SFPTPD_METRICS_NAME_MAX];
+	char *body;
+
+	pthread_mutex_lock(&metrics_lock);
+
+	for (source = metrics_sources; source; source = source->next)
+		needed += source->published_len;
+
+	if (needed > metrics->body_size) {
+		body = realloc(metrics->body, needed);
+		if (body == NULL) {
+			pthread_mutex_unlock(&metrics_lock);
+			return 0;
+		}
+		metrics->body = body;
+		metrics->body_size = needed;
+	}
+
+	sfptpd_json_init(&buf, metrics->body, metrics->body_size);
+	for (source = metrics_sources; source; source = source->next)
+		sfptpd_json_raw(&buf, source->published, source->published_len);
+
+	pthread_mutex_unlock(&metrics_lock);
+
+	sfptpd_metrics_family(&buf, name, SFPTPD_METRICS_PREFIX, "metrics_scrapes",
+			      NULL, SFPTPD_METRICS_TYPE_COUNTER,
+			      "Number of metrics scrapes served");
+	sfptpd_metrics_sample(&buf, name, "_total", NULL, metrics->scrapes, 0);
+	sfptpd_metrics_family(&buf, name, SFPTPD_METRICS_PREFIX,
+			      "metrics_last_scrape_duration", "seconds",
+			      SFPTPD_METRICS_TYPE_GAUGE,
+			      "Time taken to assemble the previous scrape");
+	sfptpd_metrics_sample(&buf, name, NULL, NULL, metrics->last_scrape_s, 9);
+	sfptpd_json_lit(&buf, "# EOF\n");
+
+	assert(!buf.overflow);
+	return buf.len;
+}
+
+
+static int metrics_send(int fd, struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+	ssize_t sent;
+
+	while (msg.msg_iovlen > 0) {
+		sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		while (msg.msg_iovlen > 0 && sent >= msg.msg_iov->iov_len) {
+			sent -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen > 0) {
+			msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + sent;
+			msg.msg_iov->iov_len -= sent;
+		}
+	}
+	return 0;
+}
+
+
+static void metrics_serve(struct sfptpd_metrics *metrics, int fd)
+{
+	struct timeval timeout = {
+		.tv_sec = METRICS_SCRAPE_TIMEOUT_MS / 1000,
+		.tv_usec = (METRICS_SCRAPE_TIMEOUT_MS % 1000) * 1000,
+	};
+	struct sfptpd_timespec start, end, elapsed;
+	char request[METRICS_REQUEST_MAX + 1];
+	char header[256];
+	struct iovec iov[2];
+	size_t len = 0;
+	ssize_t rc;
+	int header_len;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+	/* Read the request headers */
+	do {
+		rc = recv(fd, request + len, METRICS_REQUEST_MAX - len, 0);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			break;
+		len += rc;
+		request[len] = '\0';
+	} while (strstr(request, "\r\n\r\n") == NULL &&
+		 strstr(request, "\n\n") == NULL &&
+		 len < METRICS_REQUEST_MAX);
+
+	if (len == 0)
+		return;
+	request[len] = '\0';
+
+	if (strncmp(request, "GET ", 4) != 0) {
+		header_len = snprintf(header, sizeof header,
+				      "HTTP/1.0 405 Method Not Allowed\r\n"
+				      "Allow: GET\r\n"
+				      "Content-Length: 0\r\n"
+				      "Connection: close\r\n\r\n");
+		iov[0].iov_base = header;
+		iov[0].iov_len = header_len;
+		metrics_send(fd, iov, 1);
+		return;
+	}
+
+	sfclock_gettime(CLOCK_MONOTONIC, &start);
+	len = metrics_collect(metrics);
+	sfclock_gettime(CLOCK_MONOTONIC, &end);
+
+	header_len = snprintf(header, sizeof header,
+			      "HTTP/1.0 %s\r\n"
+			      "Content-Type: " METRICS_CONTENT_TYPE "\r\n"
+			      "Content-Length: %zu\r\n"
+			      "Connection: close\r\n\r\n",
+			      len ? "200 OK" : "503 Service Unavailable", len);
+	iov[0].iov_base = header;
+	iov[0].iov_len = header_len;
+	iov[1].iov_base = metrics->body;
+	iov[1].iov_len = len;
+
+	rc = metrics_send(fd, iov, len ? 2 : 1);
+	if (rc != 0)
+		TRACE_L4(PREFIX "error sending scrape response, %s\n",
+			 strerror(rc));
+
+	sfptpd_time_subtract(&elapsed, &end, &start);
+	metrics->last_scrape_s = sfptpd_time_timespec_to_float_s(&elapsed);
+	metrics->scrapes++;
+}
+
+
+static int metrics_on_startup(void *context)
+{
+	struct sfptpd_metrics *metrics = (struct sfptpd_metrics *) context;
+	int rc;
+
+	assert(metrics != NULL);
+
+	rc = metrics_open_socket(metrics);
+	if (rc != 0)
+		return rc;
+
+	rc = sfptpd_thread_user_fd_add(metrics->listen_fd, true, false);
+	if (rc != 0) {
+		close(metrics->listen_fd);
+		metrics->listen_fd = -1;
+	}
+
+	return rc;
+}
+
+
+static void metrics_on_shutdown(void *context)
+{
+	struct sfptpd_metrics *metrics = (struct sfptpd_metrics *) context;
+
+	assert(metrics != NULL);
+	assert(metrics->magic == METRICS_MODULE_MAGIC);
+
+	__atomic_store_n(&metrics_running, false, __ATOMIC_RELAXED);
+
+	if (metrics->listen_fd != -1) {
+		sfptpd_thread_user_fd_remove(metrics->listen_fd);
+		close(metrics->listen_fd);
+		if (metrics->addr.ss_family == AF_UNIX)
+			metrics_unlink_socket(metrics->general_config->openmetrics_socket);
+	}
+
+	free(metrics->body);
+	metrics->magic = METRICS_DELETED_MAGIC;
+	free(metrics);
+}
+
+
+static void metrics_on_message(void *context, struct sfptpd_msg_hdr *hdr)
+{
+	WARNING(PREFIX "received unexpected message, id %d\n",
+		sfptpd_msg_get_id(hdr));
+	sfptpd_msg_free(hdr);
+}
+
+
+static void metrics_on_user_fds(void *context, unsigned int num_fds,
+				struct sfptpd_thread_event events[])
+{
+	struct sfptpd_metrics *metrics = (struct sfptpd_metrics *) context;
+	int fd;
+
+	assert(metrics != NULL);
+	assert(metrics->magic == METRICS_MODULE_MAGIC);
+
+	while ((fd = accept4(metrics->listen_fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+		metrics_serve(metrics, fd);
+		close(fd);
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		TRACE_L4(PREFIX "accept failed, %s\n", strerror(errno));
+}
+
+
+static const struct sfptpd_thread_ops metrics_thread_ops =
+{
+	metrics_on_startup,
+	metrics_on_shutdown,
+	metrics_on_message,
+	metrics_on_user_fds
+};
+
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int sfptpd_metrics_parse_address(const char *spec,
+				 struct sockaddr_storage *addr,
+				 socklen_t *len)
+{
+	char host[INET6_ADDRSTRLEN + 2];
+	const char *port_text;
+	unsigned long port;
+	char *end;
+
+	assert(spec != NULL);
+	assert(addr != NULL);
+	assert(len != NULL);
+
+	memset(addr, '\0', sizeof *addr);
+
+	if (spec[0] == '/') {
+		struct sockaddr_un *sun = (struct sockaddr_un *) addr;
+
+		if (strlen(spec) >= sizeof sun->sun_path)
+			return ENAMETOOLONG;
+		sun->sun_family = AF_UNIX;
+		sfptpd_strncpy(sun->sun_path, spec, sizeof sun->sun_path);
+		*len = sizeof *sun;
+		return 0;
+	}
+
+	port_text = strrchr(spec, ':');
+	if (port_text == NULL) {
+		port_text = spec;
+		strcpy(host, "127.0.0.1");
+	} else {
+		size_t host_len = port_text - spec;
+
+		if (spec[0] == '[' && host_len >= 2 && spec[host_len - 1] == ']') {
+			spec++;
+			host_len -= 2;
+		}
+		if (host_len == 0 || host_len >= sizeof host)
+			return EINVAL;
+		memcpy(host, spec, host_len);
+		host[host_len] = '\0';
+		port_text++;
+	}
+
+	errno = 0;
+	port = strtoul(port_text, &end, 10);
+	if (errno != 0 || *port_text == '\0' || *end != '\0' ||
+	    port == 0 || port > 65535)
+		return EINVAL;
+
+	if (strchr(host, ':') != NULL) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) addr;
+
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		if (inet_pton(AF_INET6, host, &sin6->sin6_addr) != 1)
+			return EINVAL;
+		*len = sizeof *sin6;
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in *) addr;
+
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		if (inet_pton(AF_INET, host, &sin->sin_addr) != 1)
+			return EINVAL;
+		*len = sizeof *sin;
+	}
+
+	return 0;
+}
+
+
+struct sfptpd_metrics *sfptpd_metrics_create(struct sfptpd_config *config,
+					     struct sfptpd_thread **threadret)
+{
+	struct sfptpd_metrics *metrics;
+	int rc;
+
+	assert(config != NULL);
+	assert(threadret != NULL);
+
+	*threadret = NULL;
+	metrics = (struct sfptpd_metrics *) calloc(1, sizeof *metrics);
+	if (metrics == NULL) {
+		CRITICAL(PREFIX "failed to allocate module memory\n");
+		return NULL;
+	}
+
+	metrics->magic = METRICS_MODULE_MAGIC;
+	metrics->general_config = sfptpd_general_config_get(config);
+	metrics->listen_fd = -1;
+
+	/* Sources may begin publishing as soon as the service exists */
+	__atomic_store_n(&metrics_running, true, __ATOMIC_RELAXED);
+
+	rc = sfptpd_thread_create("metrics", &metrics_thread_ops, metrics, threadret);
+	if (rc != 0) {
+		__atomic_store_n(&metrics_running, false, __ATOMIC_RELAXED);
+		free(metrics);
+		errno = rc;
+		return NULL;
+	}
+
+	return metrics;
+}
+
+
+bool sfptpd_metrics_enabled(void)
+{
+	return __atomic_load_n(&metrics_running, __ATOMIC_RELAXED);
+}
+
+
+void sfptpd_metrics_publish(struct sfptpd_metrics_source **source,
+			    const char *name,
+			    sfptpd_metrics_render_fn render,
+			    void *context)
+{
+	struct sfptpd_metrics_source *s;
+	struct sfptpd_json_buf buf;
+	size_t size;
+	char *data;
+
+	assert(source != NULL);
+	assert(render != NULL);
+
+	if (!sfptpd_metrics_enabled())
+		return;
+
+	s = *source;
+	if (s == NULL) {
+		s = calloc(1, sizeof *s);
+		if (s == NULL)
+			return;
+		sfptpd_strncpy(s->name, name, sizeof s->name);
+
+		pthread_mutex_lock(&metrics_lock);
+		s->next = metrics_sources;
+		metrics_sources = s;
+		pthread_mutex_unlock(&metrics_lock);
+		*source = s;
+	}
+
+	/* Render into the private buffer, growing it if necessary */
+	sfptpd_json_init(&buf, NULL, 0);
+	do {
+		if (s->render == NULL || buf.overflow) {
+			size = s->render_size ? s->render_size * 2 : METRICS_SOURCE_INITIAL_SIZE;
+			if (size > METRICS_SOURCE_MAX_SIZE) {
+				if (!s->overflow_reported)
+					WARNING(PREFIX "%s: metrics too large\n", s->name);
+				s->overflow_reported = true;
+				return;
+			}
+			data = realloc(s->render, size);
+			if (data == NULL)
+				return;
+			s->render = data;
+			s->render_size = size;
+		}
+		sfptpd_json_init(&buf, s->render, s->render_size);
+		render(&buf, context);
+	} while (buf.overflow);
+
+	/* Swap the rendered buffer with the published snapshot */
+	pthread_mutex_lock(&metrics_lock);
+	data = s->published;
+	size = s->published_size;
+	s->published = s->render;
+	s->published_size = s->render_size;
+	s->published_len = buf.len;
+	pthread_mutex_unlock(&metrics_lock);
+	s->render = data;
+	s->render_size = size;
+}
+
+
+void sfptpd_metrics_source_free(struct sfptpd_metrics_source *source)
+{
+	struct sfptpd_metrics_source **link;
+
+	if (source == NULL)
+		return;
+
+	pthread_mutex_lock(&metrics_lock);
+	for (link = &metrics_sources; *link; link = &(*link)->next) {
+		if (*link == source) {
+			*link = source->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&metrics_lock);
+
+	free(source->published);
+	free(source->render);
+	free(source);
+}
+
+
+void sfptpd_metrics_family(struct sfptpd_json_buf *buf,
+			   char name[SFPTPD_METRICS_NAME_MAX],
+			   const char *prefix, const char *metric,
+			   const char *units, enum sfptpd_metrics_type type,
+			   const char *help)
+{
+	size_t len = 0;
+
+	assert(type < SFPTPD_METRICS_TYPE_MAX);
+
+	metrics_name_append(name, &len, prefix);
+	metrics_name_append(name, &len, "_");
+	metrics_name_append(name, &len, metric);
+	if (units != NULL && units[0] != '\0') {
+		metrics_name_append(name, &len, "_");
+		metrics_name_append(name, &len, units);
+	}
+
+	sfptpd_json_lit(buf, "# TYPE ");
+	sfptpd_json_raw(buf, name, len);
+	sfptpd_json_lit(buf, " ");
+	sfptpd_json_text(buf, metrics_type_names[type]);
+	sfptpd_json_lit(buf, "\n");
+	if (units != NULL && units[0] != '\0') {
+		sfptpd_json_lit(buf, "# UNIT ");
+		sfptpd_json_raw(buf, name, len);
+		sfptpd_json_lit(buf, " ");
+		sfptpd_json_raw(buf, name + len - strlen(units), strlen(units));
+		sfptpd_json_lit(buf, "\n");
+	}
+	if (help != NULL) {
+		sfptpd_json_lit(buf, "# HELP ");
+		sfptpd_json_raw(buf, name, len);
+		sfptpd_json_lit(buf, " ");
+		metrics_escape(buf, help);
+		sfptpd_json_lit(buf, "\n");
+	}
+}
+
+
+size_t sfptpd_metrics_labels(char *labels, size_t size, ...)
+{
+	struct sfptpd_json_buf buf;
+	const char *key;
+	const char *value;
+	va_list ap;
+
+	assert(labels != NULL);
+	assert(size > 0);
+
+	sfptpd_json_init(&buf, labels, size - 1);
+
+	va_start(ap, size);
+	while ((key = va_arg(ap, const char *)) != NULL) {
+		value = va_arg(ap, const char *);
+		if (buf.len != 0)
+			sfptpd_json_lit(&buf, ",");
+		sfptpd_json_text(&buf, key);
+		sfptpd_json_lit(&buf, "=\"");
+		metrics_escape(&buf, value ? value : "");
+		sfptpd_json_lit(&buf, "\"");
+	}
+	va_end(ap);
+
+	/* Never leave a partial label */
+	if (buf.overflow)
+		buf.len = 0;
+
+	labels[buf.len] = '\0';
+	return buf.len;
+}
+
+
+void sfptpd_metrics_sample(struct sfptpd_json_buf *buf, const char *name,
+			   const char *suffix, const char *labels,
+			   long double value, unsigned int decimals)
+{
+	sfptpd_json_text(buf, name);
+	if (suffix != NULL)
+		sfptpd_json_text(buf, suffix);
+	if (labels != NULL && labels[0] != '\0') {
+		sfptpd_json_lit(buf, "{");
+		sfptpd_json_text(buf, labels);
+		sfptpd_json_lit(buf, "}");
+	}
+	sfptpd_json_lit(buf, " ");
+	if (isnan(value))
+		sfptpd_json_lit(buf, "NaN");
+	else if (isinf(value))
+		sfptpd_json_text(buf, value > 0 ? "+Inf" : "-Inf");
+	else
+		sfptpd_json_float(buf, value, decimals);
+	sfptpd_json_lit(buf, "\n");
+}
+
+
+/* fin */
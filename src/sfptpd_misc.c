@@ -28,24 +28,44 @@
 
 #define SFPTPD_HT_MAGIC (0xFACE85BE)
 
+/* Smallest number of slots allocated for a hash table */
+#define SFPTPD_HT_MIN_SLOTS (8)
+
+/* Number of slots of the previous array migrated on each addition while
+ * a hash table is being resized */
+#define SFPTPD_HT_MIGRATE_STEP (8)
+
 
 /** struct sfptpd_hash_table
- * Generic hash table
+ * Generic hash table using open addressing with Robin Hood probing. Each
+ * slot stores the hash of its entry's key so that most probes do not need
+ * to fetch keys. The table doubles in size when it becomes seven eighths
+ * full; the entries in the previous array are migrated a few at a time as
+ * further entries are added and the previous array is left intact and
+ * searched until the migration is complete.
+ * @magic: Magic number used to validate table
  * @ops: Pointer to set specific functions
- * @table_size: Size of hash table
+ * @capacity: Number of slots in the current array, a power of two
  * @max_num_entries: Maximum number of entries in hash table
  * @num_entries: Current number of entries in hash table
  * @table_lock: Mutex lock for the table
- * @entries: Array of lists containing hash table contents
+ * @slots: Current array of slots
+ * @old_capacity: Number of slots in the previous array
+ * @old_slots: Previous array of slots or NULL if not resizing
+ * @migrated: Number of slots of the previous array already migrated
  */
 typedef struct sfptpd_hash_table
 {
+	uint32_t magic;
 	const struct sfptpd_ht_ops *ops;
-	unsigned int table_size;
+	unsigned int capacity;
 	unsigned int max_num_entries;
 	unsigned int num_entries;
 	pthread_mutex_t table_lock;
-	struct sfptpd_ht_entry *entries[0];
+	struct sfptpd_ht_entry *slots;
+	unsigned int old_capacity;
+	struct sfptpd_ht_entry *old_slots;
+	unsigned int migrated;
 } sfptpd_hash_table_t;
 
 
@@ -216,41 +236,241 @@ static void sfptpd_ht_release_lock(struct sfptpd_hash_table *table)
 }
 
 
-static unsigned int hash(sfptpd_hash_table_t *table, void *key,
-			 unsigned int key_size)
+/* Multiply and fold, as used by wyhash */
+static inline uint64_t ht_mum(uint64_t a, uint64_t b)
 {
-	assert(table != NULL);
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t) a * b;
+
+	return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+	uint64_t r = a * b;
+
+	return r ^ (r >> 32) ^ ((a ^ b) >> 29);
+#endif
+}
+
+
+static inline uint64_t ht_read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+
+static inline uint64_t ht_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+
+/* A hash function in the style of wyhash, reading the key a word at a
+ * time. It is not resistant to hash flooding but the entries come from
+ * a bounded set of nodes. */
+static uint32_t hash(const void *key, unsigned int key_size)
+{
+	const uint64_t p0 = 0xa0761d6478bd642fULL;
+	const uint64_t p1 = 0xe7037ed1a0b428dbULL;
+	const uint8_t *p = key;
+	uint64_t seed = p0 ^ key_size;
+	uint64_t a, b;
+	unsigned int len = key_size;
+
 	assert(key != NULL);
 
-        int index;
-        unsigned int hashval = 0;
-        for(index = 0; index < key_size; index++) {
-                hashval = ((unsigned char *)key)[index] + (hashval << 5) - hashval;
-        }
-        return hashval % table->table_size;
+	while (len > 16) {
+		seed = ht_mum(ht_read64(p) ^ p1, ht_read64(p + 8) ^ seed);
+		p += 16;
+		len -= 16;
+	}
+
+	if (len > 8) {
+		a = ht_read64(p);
+		b = ht_read64(p + len - 8);
+	} else if (len >= 4) {
+		a = ht_read32(p);
+		b = ht_read32(p + len - 4);
+	} else if (len > 0) {
+		a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+		b = 0;
+	} else {
+		a = b = 0;
+	}
+
+	return (uint32_t) ht_mum(p1 ^ key_size, ht_mum(a ^ p1, b ^ seed));
+}
+
+
+/* Distance of a slot from the home slot of its entry's hash */
+static inline unsigned int probe_distance(uint32_t hashval, unsigned int index,
+					  unsigned int capacity)
+{
+	return (index - hashval) & (capacity - 1);
+}
+
+
+static struct sfptpd_ht_entry *find_in_slots(struct sfptpd_hash_table *table,
+					     struct sfptpd_ht_entry *slots,
+					     unsigned int capacity,
+					     uint32_t hashval,
+					     void *key, unsigned int key_length)
+{
+	struct sfptpd_ht_entry *entry;
+	unsigned int index, dist;
+	void *comp_key;
+	unsigned int comp_key_length;
+
+	for (index = hashval & (capacity - 1), dist = 0; ;
+	     index = (index + 1) & (capacity - 1), dist++) {
+		entry = &slots[index];
+
+		/* An entry closer to its home than we are to ours means the
+		 * key would have displaced it if present */
+		if (entry->user == NULL ||
+		    probe_distance(entry->hash, index, capacity) < dist)
+			return NULL;
+
+		if (entry->hash == hashval) {
+			table->ops->get_key(entry->user, &comp_key, &comp_key_length);
+			if (comp_key_length == key_length &&
+			    memcmp(key, comp_key, key_length) == 0)
+				return entry;
+		}
+	}
 }
 
 
 static struct sfptpd_ht_entry *sfptpd_ht_find(struct sfptpd_hash_table *table,
-		     void *key, unsigned int key_length)
+					      uint32_t hashval,
+					      void *key, unsigned int key_length)
 {
+	struct sfptpd_ht_entry *entry;
+
 	assert(table != NULL);
 	assert(key != NULL);
 
+	entry = find_in_slots(table, table->slots, table->capacity,
+			      hashval, key, key_length);
+
+	/* Entries not yet migrated remain in the previous array */
+	if (entry == NULL && table->old_slots != NULL)
+		entry = find_in_slots(table, table->old_slots, table->old_capacity,
+				      hashval, key, key_length);
+
+	return entry;
+}
+
+
+/* Place an entry known not to be present, displacing entries that are
+ * closer to their home slots */
+static void insert_in_slots(struct sfptpd_ht_entry *slots, unsigned int capacity,
+			    uint32_t hashval, void *user)
+{
+	struct sfptpd_ht_entry carry = { .hash = hashval, .user = user };
+	struct sfptpd_ht_entry tmp;
+	unsigned int index, dist, slot_dist;
+
+	for (index = hashval & (capacity - 1), dist = 0; ;
+	     index = (index + 1) & (capacity - 1), dist++) {
+		if (slots[index].user == NULL) {
+			slots[index] = carry;
+			return;
+		}
+
+		slot_dist = probe_distance(slots[index].hash, index, capacity);
+		if (slot_dist < dist) {
+			tmp = slots[index];
+			slots[index] = carry;
+			carry = tmp;
+			dist = slot_dist;
+		}
+	}
+}
+
+
+/* Migrate up to a given number of slots from the previous array */
+static void migrate(struct sfptpd_hash_table *table, unsigned int max_slots)
+{
 	struct sfptpd_ht_entry *entry;
-	void *comp_key;
-        unsigned int comp_key_length, hashval = hash(table, key, key_length);
 
-        for(entry = table->entries[hashval]; entry != NULL; entry = entry->next) {
-		assert(entry->magic == SFPTPD_HT_MAGIC);
-		table->ops->get_key(entry->user, &comp_key, &comp_key_length);
-		if (comp_key_length == key_length) {
-			if (memcmp(key, comp_key, key_length) == 0) {
-				return entry;
-			}
-                }
-        }
-        return NULL;
+	while (table->old_slots != NULL && max_slots-- != 0) {
+		entry = &table->old_slots[table->migrated];
+		if (entry->user != NULL)
+			insert_in_slots(table->slots, table->capacity,
+					entry->hash, entry->user);
+
+		if (++table->migrated == table->old_capacity) {
+			free(table->old_slots);
+			table->old_slots = NULL;
+			table->old_capacity = 0;
+			table->migrated = 0;
+		}
+	}
+}
+
+
+/* Start doubling the table if adding an entry would make it more than
+ * seven eighths full */
+static int grow(struct sfptpd_hash_table *table)
+{
+	struct sfptpd_ht_entry *slots;
+
+	if ((table->num_entries + 1) * 8 <= table->capacity * 7)
+		return 0;
+
+	/* Finish any previous resize first */
+	migrate(table, UINT_MAX);
+
+	slots = calloc(table->capacity * 2, sizeof *slots);
+	if (slots == NULL)
+		return ENOMEM;
+
+	table->old_slots = table->slots;
+	table->old_capacity = table->capacity;
+	table->migrated = 0;
+	table->slots = slots;
+	table->capacity *= 2;
+
+	return 0;
+}
+
+
+/* Get the slot at an iteration position, covering the current array and
+ * then the slots of the previous array not yet migrated */
+static struct sfptpd_ht_entry *iter_slot(struct sfptpd_hash_table *table,
+					 unsigned int index)
+{
+	if (index < table->capacity)
+		return &table->slots[index];
+
+	index = index - table->capacity + table->migrated;
+	if (table->old_slots != NULL && index < table->old_capacity)
+		return &table->old_slots[index];
+
+	return NULL;
+}
+
+
+static void free_entries(struct sfptpd_hash_table *table)
+{
+	struct sfptpd_ht_entry *entry;
+	unsigned int index;
+
+	for (index = 0; (entry = iter_slot(table, index)) != NULL; index++)
+		if (entry->user != NULL)
+			table->ops->free(entry->user);
+
+	free(table->old_slots);
+	table->old_slots = NULL;
+	table->old_capacity = 0;
+	table->migrated = 0;
+	memset(table->slots, 0, table->capacity * sizeof *table->slots);
+	table->num_entries = 0;
 }
 
 
@@ -262,17 +482,28 @@ struct sfptpd_hash_table *sfptpd_ht_alloc(const struct sfptpd_ht_ops *ops,
 	assert(table_size < SFPTPD_HT_MAX_TABLE_SIZE);
 	assert(max_num_entries < SFPTPD_HT_MAX_TABLE_ENTRIES);
 
-        struct sfptpd_hash_table *new_table;
+	struct sfptpd_hash_table *new_table;
+	unsigned int capacity;
 	int rc;
 
-	new_table = (struct sfptpd_hash_table *)calloc(1, (sizeof(*new_table) + 
-						       sizeof(new_table->entries[0]) * table_size));
+	new_table = (struct sfptpd_hash_table *)calloc(1, sizeof(*new_table));
 	if (new_table == NULL) {
 		ERROR("Insufficient memory to allocate hash table.");
 		return NULL;
 	}
 
-	new_table->table_size = table_size;
+	/* The table size is the initial number of slots */
+	for (capacity = SFPTPD_HT_MIN_SLOTS; capacity < table_size; capacity *= 2);
+
+	new_table->slots = calloc(capacity, sizeof *new_table->slots);
+	if (new_table->slots == NULL) {
+		ERROR("Insufficient memory to allocate hash table.");
+		free(new_table);
+		return NULL;
+	}
+
+	new_table->magic = SFPTPD_HT_MAGIC;
+	new_table->capacity = capacity;
 	new_table->num_entries = 0;
 	new_table->max_num_entries = max_num_entries;
 	new_table->ops = ops;
@@ -280,36 +511,26 @@ struct sfptpd_hash_table *sfptpd_ht_alloc(const struct sfptpd_ht_ops *ops,
 	rc = pthread_mutex_init(&(new_table->table_lock), NULL);
 	if (rc != 0) {
 		CRITICAL("failed to create hash table lock, %s\n", strerror(rc));
+		free(new_table->slots);
 		free(new_table);
 		return NULL;
 	}
 
-        return new_table;
+	return new_table;
 }
 
 
 void sfptpd_ht_free(struct sfptpd_hash_table *table)
 {
-        int ii;
-        sfptpd_ht_entry_t *entry, *copy;
-	const struct sfptpd_ht_ops *ops = table->ops;
-
-        assert(table != NULL);
+	assert(table != NULL);
+	assert(table->magic == SFPTPD_HT_MAGIC);
 
-        for (ii = 0; ii < table->table_size; ii++) {
-                entry = table->entries[ii];
-		while(entry != NULL) {
-			assert(entry->magic == SFPTPD_HT_MAGIC);
-			copy = entry;
-			entry = entry->next;
-			ops->free(copy->user);
-			free(copy);
-                }
-        }
+	free_entries(table);
 
 	(void)pthread_mutex_destroy(&table->table_lock);
 
-        free(table);
+	free(table->slots);
+	free(table);
 }
 
 
@@ -318,25 +539,29 @@ int sfptpd_ht_add(struct sfptpd_hash_table *table,
 {
 	assert(table != NULL);
 	assert(user != NULL);
+	assert(table->magic == SFPTPD_HT_MAGIC);
 
 	const struct sfptpd_ht_ops *ops = table->ops;
-	sfptpd_ht_entry_t *new_entry;
+	struct sfptpd_ht_entry *entry;
 	void *key = NULL;
 	unsigned int key_length;
+	uint32_t hashval;
+	void *new_user;
+	int rc;
 
 	sfptpd_ht_get_lock(table);
 
 	ops->get_key(user, &key, &key_length);
 	assert(key != NULL);
 
-        unsigned int hashval = hash(table, key, key_length);
+	hashval = hash(key, key_length);
 
-        /* Check whether item already exists */
-	new_entry = sfptpd_ht_find(table, key, key_length);
+	/* Check whether item already exists */
+	entry = sfptpd_ht_find(table, hashval, key, key_length);
 
-	if (new_entry != NULL) {
+	if (entry != NULL) {
 		if (update) {
-			ops->copy(new_entry->user, user);
+			ops->copy(entry->user, user);
 			sfptpd_ht_release_lock(table);
 			return 0;
 		} else {
@@ -351,27 +576,18 @@ int sfptpd_ht_add(struct sfptpd_hash_table *table,
 		return ENOSPC;
 	}
 
-	new_entry = (sfptpd_ht_entry_t *)calloc(1, sizeof(*new_entry));
-
-	if (new_entry == NULL) {
+	rc = grow(table);
+	new_user = (rc == 0) ? ops->alloc() : NULL;
+	if (new_user == NULL) {
 		ERROR("Insufficient memory to allocate hash_table entry");
 		sfptpd_ht_release_lock(table);
 		return ENOMEM;
 	}
-	
-	new_entry->user = ops->alloc();
-	ops->copy(new_entry->user, user);
 
-	new_entry->magic = SFPTPD_HT_MAGIC;
-	new_entry->next = NULL;
+	ops->copy(new_user, user);
 
-	/* TODO Entries should be added in an ordered fashion */
-	if (table->entries[hashval] == NULL) {
-		table->entries[hashval] = new_entry;
-	} else {
-		new_entry->next = table->entries[hashval];
-		table->entries[hashval] = new_entry;
-	}
+	migrate(table, SFPTPD_HT_MIGRATE_STEP);
+	insert_in_slots(table->slots, table->capacity, hashval, new_user);
 	table->num_entries++;
 
 	sfptpd_ht_release_lock(table);
@@ -384,51 +600,35 @@ void *sfptpd_ht_first(struct sfptpd_hash_table *table,
 {
 	assert(table != NULL);
 	assert(iter != NULL);
+	assert(table->magic == SFPTPD_HT_MAGIC);
 
 	iter->table = table;
+	iter->index = 0;
 	iter->entry = NULL;
 
 	sfptpd_ht_get_lock(table);
-	for (iter->index = 0; iter->index < table->table_size; iter->index++) {
-		iter->entry = table->entries[iter->index];
-		if (iter->entry != NULL) {
-			assert(iter->entry->magic == SFPTPD_HT_MAGIC);
-			assert(iter->entry->user != NULL);
-			return iter->entry->user;
-		}
-	}
 
-	sfptpd_ht_release_lock(table);
-	return NULL;
+	return sfptpd_ht_next(iter);
 }
 
 
 void *sfptpd_ht_next(struct sfptpd_ht_iter *iter)
 {
-	struct sfptpd_hash_table *table = iter->table;
+	struct sfptpd_hash_table *table;
 
 	assert(iter != NULL);
 	assert(iter->table != NULL);
 
-	if (iter->entry == NULL) {
-		sfptpd_ht_release_lock(table);
-		return NULL;
-	}
+	table = iter->table;
 
-	if (iter->entry->next != NULL) {
-		assert (iter->entry->next != iter->entry);
-		iter->entry = iter->entry->next;
-		assert(iter->entry->user != NULL);
-		return iter->entry->user;
-	}
+	/* Continue after the current entry unless just started */
+	if (iter->entry != NULL)
+		iter->index++;
 
-	for (iter->index++; iter->index < table->table_size; iter->index++) {
-		if (table->entries[iter->index] != NULL) {
-			iter->entry = table->entries[iter->index];
-			assert(iter->entry->magic == SFPTPD_HT_MAGIC);
-			assert(iter->entry->user != NULL);
+	while ((iter->entry = iter_slot(table, iter->index)) != NULL) {
+		if (iter->entry->user != NULL)
 			return iter->entry->user;
-		}
+		iter->index++;
 	}
 
 	sfptpd_ht_release_lock(table);
@@ -439,26 +639,10 @@ void *sfptpd_ht_next(struct sfptpd_ht_iter *iter)
 void sfptpd_ht_clear_entries(struct sfptpd_hash_table *table)
 {
 	assert(table != NULL);
-
-	struct sfptpd_ht_entry *entry, *temp;
-	int index, counter = 0;
-	void *user;
+	assert(table->magic == SFPTPD_HT_MAGIC);
 
 	sfptpd_ht_get_lock(table);
-
-	for (index = 0; index < table->table_size; index++) {
-		entry = table->entries[index];
-		while (entry != NULL) {
-			++counter;
-			temp = entry;
-			entry = temp->next;
-			user = temp->user;
-			free(temp);
-			table->ops->free(user);
-		}
-		table->entries[index] = NULL;
-	}
-	table->num_entries = 0;
+	free_entries(table);
 	sfptpd_ht_release_lock(table);
 }
 
@@ -52,6 +52,7 @@
 #include "sfptpd_interface.h"
 #include "sfptpd_netlink.h"
 #include "sfptpd_thread.h"
+#include "sfptpd_clock.h"
 
 /****************************************************************************
  * Defines & Constants
@@ -1570,6 +1571,33 @@ int sfptpd_netlink_get_fd(struct sfptpd_nl_state *state,
 	}
 }
 
+/* Whether a work-in-progress table changes the active member of any bond
+ * or team. Both tables must be sorted by if_index. */
+static bool netlink_active_slave_changed(const struct link_db *prev,
+					 const struct link_db *cur)
+{
+	int row;
+	int old_row;
+
+	for (row = 0, old_row = 0; row < cur->table.count; row++) {
+		const struct sfptpd_link *b = cur->table.rows + row;
+		const struct sfptpd_link *a;
+
+		while (old_row < prev->table.count &&
+		       prev->table.rows[old_row].if_index < b->if_index)
+			old_row++;
+		if (old_row == prev->table.count)
+			break;
+
+		a = prev->table.rows + old_row;
+		if (a->if_index == b->if_index &&
+		    a->bond.active_slave != b->bond.active_slave)
+			return true;
+	}
+
+	return false;
+}
+
 /* Service ready file descriptors for netlink.
  * Does not need to know which file descriptors are ready, will
  * service all the netlink connections regardless.
@@ -1627,6 +1655,9 @@ int sfptpd_netlink_service_fds(struct sfptpd_nl_state *state,
 
 
 	if (any_data) {
+		if (sfptpd_time_is_zero(&cur->table.time))
+			(void)sfclock_gettime(CLOCK_MONOTONIC, &cur->table.time);
+
 		DBG_L4("new link table (ver %d):\n", cur->table.version);
 		bool ordered = true;
 		int idx = 0;
@@ -1653,24 +1684,32 @@ int sfptpd_netlink_service_fds(struct sfptpd_nl_state *state,
 		return -rc;
 	}
 
+	/* A change of active bond or team member means that PTP is now
+	 * timestamping on the wrong interface, so do not hold it back. */
 	if (coalescing) {
-		DBG_L4("leaving new link table (ver %d) as wip while coalescing\n", cur->table.version);
-		return 0;
+		if (!any_data || !netlink_active_slave_changed(prev, cur)) {
+			DBG_L4("leaving new link table (ver %d) as wip while coalescing\n", cur->table.version);
+			return 0;
+		}
+		DBG_L3("netlink: publishing table ver %d early for active slave change\n",
+		       cur->table.version);
 	}
 
 	/* Rotate history and compare state */
 	DBG_L4("comparing ver %d -> %d\n", prev->table.version, cur->table.version);
 
-	/* Handle changes and additions */
-	for (row = 0; row < cur->table.count; row++) {
+	/* Handle changes and additions, walking both tables in if_index order */
+	for (row = 0, old_row = 0; row < cur->table.count; row++) {
 		enum sfptpd_link_event event = SFPTPD_LINK_NONE;
+		uint32_t changes = 0;
 
 		/* Look for this link in the old table */
-		for (old_row = 0; old_row < prev->table.count &&
-				  cur->table.rows[row].if_index != prev->table.rows[old_row].if_index;
-		     old_row++);
+		while (old_row < prev->table.count &&
+		       prev->table.rows[old_row].if_index < cur->table.rows[row].if_index)
+			old_row++;
 
-		if (old_row == prev->table.count) {
+		if (old_row == prev->table.count ||
+		    prev->table.rows[old_row].if_index != cur->table.rows[row].if_index) {
 			event = SFPTPD_LINK_UP;
 			DBG_L3("added new if_index %d %s\n", cur->table.rows[row].if_index, cur->table.rows[row].if_name);
 		} else {
@@ -1683,15 +1722,15 @@ int sfptpd_netlink_service_fds(struct sfptpd_nl_state *state,
 
 			if (a->type != b->type) {
 				DBG_L2("if_kind changed %d (%s) -> %d (%s)\n", a->type, a->if_kind, b->type, b->if_kind);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_TYPE;
 			}
 			if (a->if_type != b->if_type) {
 				DBG_L2("if_type changed %d -> %d\n", a->if_type, b->if_type);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_IF_TYPE;
 			}
 			if (a->if_family != b->if_family) {
 				DBG_L2("if_family changed %d -> %d\n", a->if_family, b->if_family);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_FAMILY;
 			}
 			if (a->if_flags != b->if_flags) {
 				char flags[256];
@@ -1707,39 +1746,42 @@ int sfptpd_netlink_service_fds(struct sfptpd_nl_state *state,
 					snprint_flags_delta(flags, sizeof flags, sig_a, sig_b);
 
 					DBG_L2("if_flags (significant) changed %x -> %x (%s)\n", sig_a, sig_b, flags);
-					       event = SFPTPD_LINK_CHANGE;
+					changes |= SFPTPD_LINK_CHANGED_FLAGS;
 				}
 			}
 			if (a->bond.if_master != b->bond.if_master) {
 				DBG_L2("if_master changed %d -> %d\n", a->bond.if_master, b->bond.if_master);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_MASTER;
 			}
 			if (a->bond.bond_mode != b->bond.bond_mode) {
 				DBG_L2("bond mode changed %d -> %d\n", a->bond.bond_mode, b->bond.bond_mode);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_BOND_MODE;
 			}
 			if (a->bond.active_slave != b->bond.active_slave) {
 				DBG_L2("active_slave changed %d -> %d\n", a->bond.active_slave, b->bond.active_slave);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_ACTIVE_SLAVE;
 			}
 			if (a->is_slave != b->is_slave) {
 				DBG_L2("is_slave changed %d -> %d\n", a->is_slave, b->is_slave);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_IS_SLAVE;
 			}
 			if (a->vlan_id != b->vlan_id) {
 				DBG_L2("vlan_id changed %d -> %d\n", a->vlan_id, b->vlan_id);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_VLAN;
 			}
 			if (strcmp(a->if_name, b->if_name)) {
 				DBG_L2("if_name changed %s -> %s\n", a->if_name, b->if_name);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_NAME;
 			}
 			if (a->ts_info_state != b->ts_info_state) {
 				DBG_L2("ts_info changed (phc_index: %d -> %d)\n",
 				       a->ts_info.phc_index, b->ts_info.phc_index);
-				event = SFPTPD_LINK_CHANGE;
+				changes |= SFPTPD_LINK_CHANGED_TS_INFO;
 			}
 
+			if (changes != 0)
+				event = SFPTPD_LINK_CHANGE;
+
 			if (event == SFPTPD_LINK_CHANGE) {
 				DBG_L2("^ significant change to %d %s\n", b->if_index, b->if_name);
 			} else if (event == SFPTPD_LINK_NONE && (b->event == SFPTPD_LINK_NONE || b->event == SFPTPD_LINK_UP)) {
@@ -1751,6 +1793,7 @@ int sfptpd_netlink_service_fds(struct sfptpd_nl_state *state,
 			change = true;
 
 		cur->table.rows[row].event = event;
+		cur->table.rows[row].changes = changes;
 	}
 
 	/* Summarise link changes and detect deletions */
@@ -1834,11 +1877,13 @@ int sfptpd_netlink_service_fds(struct sfptpd_nl_state *state,
 		/* Rotate versions */
 		state->db_hist_next = (state->db_hist_next + 1) % MAX_LINK_DB_VERSIONS;
 		next->table.version = state->db_ver_next++;
+		sfptpd_time_zero(&next->table.time);
 		DBG_L4("netlink: table %d, refcnt = %d\n", cur->table.version, cur->refcnt);
 		state->db_hist_count++;
 		return cur->table.version;
 	} else {
 		DBG_L4("abandoning new link table (ver %d) as no significant changes\n", cur->table.version);
+		sfptpd_time_zero(&cur->table.time);
 		return 0;
 	}
 }
@@ -30,6 +30,7 @@
 #include "sfptpd_filter.h"
 #include "sfptpd_sync_module.h"
 #include "sfptpd_engine.h"
+#include "sfptpd_startup.h"
 
 
 /****************************************************************************
@@ -335,20 +336,9 @@ void sfptpd_servo_set_clocks(struct sfptpd_servo *servo, struct sfptpd_clock *ma
 }
 
 
-int sfptpd_servo_step_clock(struct sfptpd_servo *servo, struct sfptpd_timespec *offset)
+/* Update the servo after its slave clock has been stepped */
+static int servo_complete_step(struct sfptpd_servo *servo, int rc)
 {
-	int rc;
-	struct sfptpd_timespec zero = sfptpd_time_null();
-	
-	assert(servo != NULL);
-	assert(servo->slave != NULL);
-	assert(offset != NULL);
-
-	/* We actually need to step the clock backwards by the specified offset */
-	sfptpd_time_subtract(offset, &zero, offset);
-    
-	/* Step the slave clock by the specified offset */
-	rc = sfptpd_clock_adjust_time(servo->slave, offset);
 	if (rc != 0) {
 		SYNC_MODULE_ALARM_SET(servo->alarms, CLOCK_CTRL_FAILURE);
 		WARNING("%s: failed to adjust offset of clock %s, error %s\n",
@@ -377,6 +367,72 @@ int sfptpd_servo_step_clock(struct sfptpd_servo *servo, struct sfptpd_timespec *
 }
 
 
+int sfptpd_servo_step_clock(struct sfptpd_servo *servo, struct sfptpd_timespec *offset)
+{
+	int rc;
+	struct sfptpd_timespec zero = sfptpd_time_null();
+	
+	assert(servo != NULL);
+	assert(servo->slave != NULL);
+	assert(offset != NULL);
+
+	/* We actually need to step the clock backwards by the specified offset */
+	sfptpd_time_subtract(offset, &zero, offset);
+    
+	/* Step the slave clock by the specified offset */
+	rc = sfptpd_clock_adjust_time(servo->slave, offset);
+
+	return servo_complete_step(servo, rc);
+}
+
+
+int sfptpd_servo_step_clocks(struct sfptpd_servo **servos,
+			     struct sfptpd_timespec *offsets,
+			     int num_servos)
+{
+	struct sfptpd_clock **clocks;
+	struct sfptpd_timespec zero = sfptpd_time_null();
+	int *results;
+	int rc = 0;
+	int i;
+
+	assert(servos != NULL || num_servos == 0);
+	assert(offsets != NULL || num_servos == 0);
+
+	if (num_servos == 0)
+		return 0;
+
+	clocks = calloc(num_servos, sizeof *clocks);
+	results = calloc(num_servos, sizeof *results);
+	if (clocks == NULL || results == NULL) {
+		free(clocks);
+		free(results);
+		return errno;
+	}
+
+	/* We actually need to step the clocks backwards by the offsets */
+	for (i = 0; i < num_servos; i++) {
+		assert(servos[i] != NULL);
+		assert(servos[i]->slave != NULL);
+		clocks[i] = servos[i]->slave;
+		sfptpd_time_subtract(&offsets[i], &zero, &offsets[i]);
+	}
+
+	(void)sfptpd_clock_adjust_time_multi(clocks, offsets, results,
+					     num_servos, NULL);
+
+	for (i = 0; i < num_servos; i++) {
+		int servo_rc = servo_complete_step(servos[i], results[i]);
+		if (rc == 0)
+			rc = servo_rc;
+	}
+
+	free(clocks);
+	free(results);
+	return rc;
+}
+
+
 static int do_servo_synchronize(struct sfptpd_engine *engine, struct sfptpd_servo *servo, struct sfptpd_timespec *mono_time)
 {
 	long double mean, diff_ns;
@@ -556,6 +612,7 @@ static int do_servo_synchronize(struct sfptpd_engine *engine, struct sfptpd_serv
 			sfptpd_clock_get_long_name(servo->slave), strerror(rc));
 	} else {
 		SYNC_MODULE_ALARM_CLEAR(servo->alarms, CLOCK_CTRL_FAILURE);
+		sfptpd_startup_mark(SFPTPD_STARTUP_FIRST_SERVO_ADJUSTMENT);
 	}
 
 	/* Update the convergence measure */
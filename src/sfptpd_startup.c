@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_startup.c
+ * @brief  Startup timeline recorder
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "sfptpd_logging.h"
+#include "sfptpd_clock.h"
+#include "sfptpd_time.h"
+#include "sfptpd_json.h"
+#include "sfptpd_startup.h"
+
+
+/****************************************************************************
+ * Types
+ ****************************************************************************/
+
+struct startup_timeline {
+	/* Serialises recording of phases */
+	pthread_mutex_t lock;
+
+	/* Bitmask of the phases recorded */
+	uint32_t recorded;
+
+	/* Number of phases recorded */
+	int count;
+
+	/* Monotonic time at which each phase was reached */
+	struct sfptpd_timespec time[SFPTPD_STARTUP_PHASE_MAX];
+};
+
+
+/****************************************************************************
+ * Constants
+ ****************************************************************************/
+
+static const char *const startup_phase_names[SFPTPD_STARTUP_PHASE_MAX] = {
+	[SFPTPD_STARTUP_PROCESS_START] = "process-start",
+	[SFPTPD_STARTUP_CONFIG_PARSED] = "config-parsed",
+	[SFPTPD_STARTUP_NETLINK_SCANNED] = "netlink-scanned",
+	[SFPTPD_STARTUP_CLOCKS_INITIALISED] = "clocks-initialised",
+	[SFPTPD_STARTUP_INTERFACES_INITIALISED] = "interfaces-initialised",
+	[SFPTPD_STARTUP_SYNC_MODULES_CREATED] = "sync-modules-created",
+	[SFPTPD_STARTUP_RUNNING] = "running",
+	[SFPTPD_STARTUP_FIRST_CLOCKFEED_SAMPLE] = "first-clockfeed-sample",
+	[SFPTPD_STARTUP_FIRST_SERVO_ADJUSTMENT] = "first-servo-adjustment",
+	[SFPTPD_STARTUP_FIRST_PTP_SYNC] = "first-ptp-sync",
+	[SFPTPD_STARTUP_CONVERGED] = "converged",
+};
+
+
+/****************************************************************************
+ * Local Data
+ ****************************************************************************/
+
+static struct startup_timeline startup_timeline = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+void sfptpd_startup_mark(enum sfptpd_startup_phase phase)
+{
+	struct startup_timeline *timeline = &startup_timeline;
+	struct sfptpd_timespec elapsed;
+	const uint32_t bit = 1 << phase;
+
+	assert(phase < SFPTPD_STARTUP_PHASE_MAX);
+
+	/* Fast path for phases already recorded */
+	if (__atomic_load_n(&timeline->recorded, __ATOMIC_ACQUIRE) & bit)
+		return;
+
+	pthread_mutex_lock(&timeline->lock);
+	if ((timeline->recorded & bit) == 0) {
+		(void)sfclock_gettime(CLOCK_MONOTONIC, &timeline->time[phase]);
+		timeline->count++;
+		__atomic_store_n(&timeline->recorded, timeline->recorded | bit,
+				 __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&timeline->lock);
+
+	if (sfptpd_startup_get(phase, &elapsed)) {
+		if (phase == SFPTPD_STARTUP_CONVERGED)
+			INFO("startup: converged %0.3Lfs after process start\n",
+			     sfptpd_time_timespec_to_float_s(&elapsed));
+		else
+			TRACE_L1("startup: %s after %0.3Lfs\n",
+				 startup_phase_names[phase],
+				 sfptpd_time_timespec_to_float_s(&elapsed));
+	}
+}
+
+
+bool sfptpd_startup_get(enum sfptpd_startup_phase phase,
+			struct sfptpd_timespec *elapsed)
+{
+	struct startup_timeline *timeline = &startup_timeline;
+	uint32_t recorded;
+
+	assert(phase < SFPTPD_STARTUP_PHASE_MAX);
+	assert(elapsed != NULL);
+
+	recorded = __atomic_load_n(&timeline->recorded, __ATOMIC_ACQUIRE);
+	if ((recorded & (1 << phase)) == 0)
+		return false;
+
+	if (recorded & (1 << SFPTPD_STARTUP_PROCESS_START))
+		sfptpd_time_subtract(elapsed, &timeline->time[phase],
+				     &timeline->time[SFPTPD_STARTUP_PROCESS_START]);
+	else
+		sfptpd_time_zero(elapsed);
+
+	return true;
+}
+
+
+int sfptpd_startup_count(void)
+{
+	int count;
+
+	pthread_mutex_lock(&startup_timeline.lock);
+	count = startup_timeline.count;
+	pthread_mutex_unlock(&startup_timeline.lock);
+
+	return count;
+}
+
+
+const char *sfptpd_startup_phase_name(enum sfptpd_startup_phase phase)
+{
+	assert(phase < SFPTPD_STARTUP_PHASE_MAX);
+
+	return startup_phase_names[phase];
+}
+
+
+void sfptpd_startup_write_table(FILE *stream)
+{
+	const char *format_header = "| %-22s | %11s |\n";
+	const char *format_record = "| %-22s | %11.6Lf |\n";
+	struct sfptpd_timespec elapsed;
+	enum sfptpd_startup_phase phase;
+
+	assert(stream != NULL);
+
+	sfptpd_log_table_row(stream, true, format_header, "phase", "elapsed (s)");
+
+	for (phase = 0; phase < SFPTPD_STARTUP_PHASE_MAX; phase++) {
+		bool last = (phase == SFPTPD_STARTUP_PHASE_MAX - 1);
+
+		if (sfptpd_startup_get(phase, &elapsed))
+			sfptpd_log_table_row(stream, last, format_record,
+					     startup_phase_names[phase],
+					     sfptpd_time_timespec_to_float_s(&elapsed));
+		else
+			sfptpd_log_table_row(stream, last, format_header,
+					     startup_phase_names[phase], "-");
+	}
+}
+
+
+void sfptpd_startup_write_json(struct sfptpd_json_buf *buf)
+{
+	struct sfptpd_timespec elapsed;
+	enum sfptpd_startup_phase phase;
+	bool comma = false;
+
+	assert(buf != NULL);
+
+	sfptpd_json_lit(buf, "{");
+	for (phase = 0; phase < SFPTPD_STARTUP_PHASE_MAX; phase++) {
+		if (!sfptpd_startup_get(phase, &elapsed))
+			continue;
+
+		if (comma)
+			sfptpd_json_lit(buf, ",");
+		sfptpd_json_lit(buf, "\"");
+		sfptpd_json_text(buf, startup_phase_names[phase]);
+		sfptpd_json_lit(buf, "\":");
+		sfptpd_json_float(buf, sfptpd_time_timespec_to_float_s(&elapsed), 6);
+		comma = true;
+	}
+	sfptpd_json_lit(buf, "}");
+}
+
+
+/* fin */
@@ -13,14 +13,22 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <math.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "sfptpd_constants.h"
 #include "sfptpd_logging.h"
 #include "sfptpd_statistics.h"
 #include "sfptpd_misc.h"
 #include "sfptpd_interface.h"
+#include "sfptpd_metrics.h"
 
 
 /****************************************************************************
@@ -37,6 +45,99 @@ struct sfptpd_stats_period_info
 	unsigned int length;
 };
 
+/* Size of each block of memory allocated for a collection's arena */
+#define STATS_ARENA_BLOCK_SIZE (4096)
+
+/* Alignment of allocations from a collection's arena */
+#define STATS_ARENA_ALIGN (__alignof__(long double))
+
+#define STATS_ARENA_ROUND_UP(size) \
+	(((size) + STATS_ARENA_ALIGN - 1) & ~(STATS_ARENA_ALIGN - 1))
+
+/* Number of completed intervals kept for each time period */
+#define STATS_NUM_COMPLETED (SFPTPD_STATS_HISTORY_MAX - 1)
+
+struct stats_arena_block
+{
+	struct stats_arena_block *next;
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(STATS_ARENA_ALIGN)));
+};
+
+/* The memory for the items of a collection and their history. Nothing is
+ * freed until the whole collection is freed so this is a simple list of
+ * blocks that are allocated from in turn. For a persistent collection the
+ * history is instead carved from a mapped file in a fixed order so that
+ * the layout of the file depends only on the definition of the collection.
+ */
+struct sfptpd_stats_arena
+{
+	struct stats_arena_block *blocks;
+	size_t size;
+
+	/* Mapped file for persistent history, or NULL */
+	char *map;
+	size_t map_size;
+	size_t map_used;
+
+	/* Whether the history in the mapped file was restored */
+	bool restored;
+
+	/* Queue of arenas whose mapped file is waiting to be synced */
+	struct sfptpd_stats_arena *sync_next;
+	bool sync_queued;
+	bool syncing;
+};
+
+/* Magic number and version of the persistent history file format */
+#define STATS_PERSIST_MAGIC   (0x54534653) /* "SFST" */
+#define STATS_PERSIST_VERSION (2)
+
+/* Header at the start of a persistent history file. The definition is a
+ * hash of everything that determines the layout of the file. */
+struct stats_persist_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	uint64_t definition;
+	uint64_t checksum;
+};
+
+/* The state of the collection's time periods, which follows the header.
+ * The checksum is cleared while the history is being updated at the end of
+ * a period so that a file that was being updated when the daemon stopped
+ * is not restored. */
+struct stats_persist_state
+{
+	unsigned int elapsed[SFPTPD_STATS_PERIOD_MAX];
+	struct sfptpd_stats_time_interval intervals[SFPTPD_STATS_PERIOD_MAX][SFPTPD_STATS_HISTORY_MAX];
+	/* Time at which the history was last saved */
+	struct sfptpd_timespec saved_time;
+	uint64_t checksum;
+};
+
+/* Offset of the history in a persistent history file */
+#define STATS_PERSIST_DATA_OFFSET \
+	STATS_ARENA_ROUND_UP(sizeof(struct stats_persist_header) + \
+			     sizeof(struct stats_persist_state))
+
+/* The historical records are more compact than the measures used to
+ * accumulate samples over a minute, as there are many more of them. */
+struct stats_range_record
+{
+	bool valid;
+	bool qualified;
+	uint32_t num_samples;
+	double total;
+	double total_squares;
+	double min;
+	double max;
+	struct sfptpd_timespec min_time;
+	struct sfptpd_timespec max_time;
+};
+
 struct stats_range_history
 {
 	/* Base class member data */
@@ -45,8 +146,13 @@ struct stats_range_history
 	/* Currently active statistics */
 	sfptpd_stats_range_t active;
 
-	/* Historical data for range measure */
-	sfptpd_stats_range_t history[SFPTPD_STATS_PERIOD_MAX][SFPTPD_STATS_HISTORY_MAX];
+	/* Completed intervals of the next shorter time period that fall within
+	 * the current interval of each time period. The entry for the minute
+	 * period is unused as the active statistics serve for it. */
+	struct stats_range_record *current[SFPTPD_STATS_PERIOD_MAX];
+
+	/* Completed intervals for each time period, most recent first */
+	struct stats_range_record *history[SFPTPD_STATS_PERIOD_MAX];
 };
 
 struct stats_count_history
@@ -57,8 +163,43 @@ struct stats_count_history
 	/* Currently active statistics */
 	sfptpd_stats_count_t active;
 
-	/* Historical data for count measure */
-	sfptpd_stats_count_t history[SFPTPD_STATS_PERIOD_MAX][SFPTPD_STATS_HISTORY_MAX];
+	/* Completed intervals of the next shorter time period that fall within
+	 * the current interval of each time period. The entry for the minute
+	 * period is unused as the active statistics serve for it. */
+	sfptpd_stats_count_t *current[SFPTPD_STATS_PERIOD_MAX];
+
+	/* Completed intervals for each time period, most recent first */
+	sfptpd_stats_count_t *history[SFPTPD_STATS_PERIOD_MAX];
+};
+
+struct stats_quantile_summary
+{
+	bool valid;
+	bool qualified;
+	unsigned long num_samples;
+	double mean;
+	double min;
+	double max;
+	double values[SFPTPD_STATS_NUM_QUANTILES];
+};
+
+struct stats_quantile_history
+{
+	/* Base class member data */
+	struct sfptpd_stats_item parent;
+
+	/* Currently active statistics */
+	sfptpd_stats_quantile_t active;
+
+	/* Sketches of the completed intervals of the next shorter time period
+	 * that fall within the current interval of each time period. Only
+	 * these need to be mergeable so completed intervals are kept as
+	 * summaries, which bounds the memory used by each item. The entry for
+	 * the minute period is unused as the active sketch serves for it. */
+	sfptpd_stats_quantile_t *current[SFPTPD_STATS_PERIOD_MAX];
+
+	/* Completed intervals for each time period, most recent first */
+	struct stats_quantile_summary *history[SFPTPD_STATS_PERIOD_MAX];
 };
 
 
@@ -77,6 +218,16 @@ const struct sfptpd_stats_period_info sfptpd_stats_periods[SFPTPD_STATS_PERIOD_M
 
 const struct sfptpd_timespec zero_time = { 0, 0 };
 
+const long double sfptpd_stats_quantiles[SFPTPD_STATS_NUM_QUANTILES] =
+{
+	0.5L, 0.9L, 0.99L, 0.999L
+};
+
+static const char *stats_quantile_names[SFPTPD_STATS_NUM_QUANTILES] =
+{
+	"p50", "p90", "p99", "p99.9"
+};
+
 const char *sfptpd_stats_ethtool_names[SFPTPD_DRVSTAT_MAX] = {
 	[ SFPTPD_DRVSTAT_PPS_OFLOW ]    = "pps_in_oflow",
 	[ SFPTPD_DRVSTAT_PPS_BAD ]      = "pps_in_bad",
@@ -93,18 +244,226 @@ const char *sfptpd_stats_ethtool_names[SFPTPD_DRVSTAT_MAX] = {
 /* Forward declarations */
 static const struct sfptpd_stats_item_ops stats_range_ops;
 static const struct sfptpd_stats_item_ops stats_count_ops;
+static const struct sfptpd_stats_item_ops stats_quantile_ops;
 
 static const char *stats_range_format_string = "%-16s %22s %22s %22s %22s %14s %24s %24s %24s %24s %4s\n";
-static const char *stats_range_format_data   = "%-16s %22.*Lf %22.*Lf %22.*Lf %22.*Lf %14d %24s %24s %24s %24s %4s\n";
+static const char *stats_range_format_data   = "%-16s %22.*Lf %22.*Lf %22.*Lf %22.*Lf %14u %24s %24s %24s %24s %4s\n";
 
 static const char *stats_count_format_string = "%-16s %14s %14s %24s %24s\n";
 static const char *stats_count_format_data   = "%-16s %14d %14d %24s %24s\n";
 
+static const char *stats_quantile_format_string = "%-16s %22s %22s %22s %22s %22s %22s %14s %24s %24s %4s\n";
+static const char *stats_quantile_format_data   = "%-16s %22.*Lf %22.*Lf %22.*Lf %22.*Lf %22.*Lf %22.*Lf %14lu %24s %24s %4s\n";
+
+/* Background thread syncing persistent history files to storage */
+static pthread_mutex_t stats_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stats_sync_cond = PTHREAD_COND_INITIALIZER;
+static struct sfptpd_stats_arena *stats_sync_queue = NULL;
+static bool stats_sync_started = false;
+
 
 /****************************************************************************
  * Local Functions
  ****************************************************************************/
 
+static struct sfptpd_stats_arena *stats_arena_create(void)
+{
+	return calloc(1, sizeof(struct sfptpd_stats_arena));
+}
+
+
+static void *stats_sync_thread(void *arg)
+{
+	struct sfptpd_stats_arena *arena;
+
+	pthread_mutex_lock(&stats_sync_lock);
+	while (true) {
+		while (stats_sync_queue == NULL)
+			pthread_cond_wait(&stats_sync_cond, &stats_sync_lock);
+
+		arena = stats_sync_queue;
+		stats_sync_queue = arena->sync_next;
+		arena->sync_next = NULL;
+		arena->sync_queued = false;
+		arena->syncing = true;
+
+		/* The mapping stays valid while syncing is set */
+		pthread_mutex_unlock(&stats_sync_lock);
+		msync(arena->map, arena->map_size, MS_SYNC);
+		pthread_mutex_lock(&stats_sync_lock);
+
+		arena->syncing = false;
+		pthread_cond_broadcast(&stats_sync_cond);
+	}
+
+	return NULL;
+}
+
+
+/* Ask for the mapped file of an arena to be written to storage. This is
+ * done in the background so as not to block the caller on I/O. */
+static void stats_arena_sync(struct sfptpd_stats_arena *arena)
+{
+	struct sfptpd_stats_arena **tail;
+	sigset_t sigmask, oldmask;
+	pthread_t thread;
+	int rc;
+
+	assert(arena->map != NULL);
+
+	pthread_mutex_lock(&stats_sync_lock);
+
+	if (!stats_sync_started) {
+		/* Block all signals on the new thread */
+		sigfillset(&sigmask);
+		pthread_sigmask(SIG_BLOCK, &sigmask, &oldmask);
+		rc = pthread_create(&thread, NULL, stats_sync_thread, NULL);
+		pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+		if (rc != 0) {
+			pthread_mutex_unlock(&stats_sync_lock);
+			WARNING("stats: failed to start sync thread, %s\n",
+				strerror(rc));
+			msync(arena->map, arena->map_size, MS_ASYNC);
+			return;
+		}
+		pthread_setname_np(thread, "stats-sync");
+		pthread_detach(thread);
+		stats_sync_started = true;
+	}
+
+	if (!arena->sync_queued) {
+		for (tail = &stats_sync_queue; *tail != NULL; tail = &(*tail)->sync_next);
+		*tail = arena;
+		arena->sync_queued = true;
+		pthread_cond_signal(&stats_sync_cond);
+	}
+
+	pthread_mutex_unlock(&stats_sync_lock);
+}
+
+
+/* Withdraw any request to sync an arena and wait for a sync in progress */
+static void stats_arena_sync_cancel(struct sfptpd_stats_arena *arena)
+{
+	struct sfptpd_stats_arena **link;
+
+	pthread_mutex_lock(&stats_sync_lock);
+
+	if (arena->sync_queued) {
+		for (link = &stats_sync_queue; *link != arena; link = &(*link)->sync_next);
+		*link = arena->sync_next;
+		arena->sync_next = NULL;
+		arena->sync_queued = false;
+	}
+
+	while (arena->syncing)
+		pthread_cond_wait(&stats_sync_cond, &stats_sync_lock);
+
+	pthread_mutex_unlock(&stats_sync_lock);
+}
+
+
+static void stats_arena_destroy(struct sfptpd_stats_arena *arena)
+{
+	struct stats_arena_block *block;
+
+	if (arena == NULL)
+		return;
+
+	if (arena->map != NULL) {
+		stats_arena_sync_cancel(arena);
+		munmap(arena->map, arena->map_size);
+	}
+
+	while ((block = arena->blocks) != NULL) {
+		arena->blocks = block->next;
+		free(block);
+	}
+	free(arena);
+}
+
+
+/* Allocate zeroed memory from an arena. Requests that do not fit in the
+ * current block get a new block of their own if they are larger than the
+ * standard block size. */
+static void *stats_arena_alloc(struct sfptpd_stats_arena *arena, size_t size)
+{
+	struct stats_arena_block *block;
+	size_t block_size;
+	void *ptr;
+
+	assert(arena != NULL);
+
+	size = STATS_ARENA_ROUND_UP(size);
+
+	block = arena->blocks;
+	if (block == NULL || block->size - block->used < size) {
+		block_size = sizeof *block + size;
+		if (block_size < STATS_ARENA_BLOCK_SIZE)
+			block_size = STATS_ARENA_BLOCK_SIZE;
+
+		block = calloc(1, block_size);
+		if (block == NULL)
+			return NULL;
+
+		block->size = block_size - sizeof *block;
+		block->used = 0;
+		arena->size += block_size;
+
+		/* Keep allocating from the block with the most space left */
+		if (arena->blocks != NULL &&
+		    arena->blocks->size - arena->blocks->used > block->size - size) {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+			block->used = size;
+			return block->data;
+		}
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+
+/* Allocate memory for history from an arena. For a persistent collection
+ * this comes from the mapped file, which was sized for all the history of
+ * the collection. */
+static void *stats_arena_alloc_history(struct sfptpd_stats_arena *arena,
+				       size_t size)
+{
+	void *ptr;
+
+	assert(arena != NULL);
+
+	if (arena->map == NULL)
+		return stats_arena_alloc(arena, size);
+
+	size = STATS_ARENA_ROUND_UP(size);
+	assert(arena->map_size - arena->map_used >= size);
+
+	ptr = arena->map + arena->map_used;
+	arena->map_used += size;
+	return ptr;
+}
+
+
+/* 64-bit FNV-1a hash, used to check persistent history files */
+#define STATS_PERSIST_HASH_INIT (0xcbf29ce484222325ULL)
+
+static uint64_t stats_persist_hash(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *bytes = data;
+
+	while (len-- != 0) {
+		hash ^= *bytes++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
 
 /****************************************************************************
  * Convergence Measure
@@ -374,21 +733,225 @@ void sfptpd_stats_count_add(struct sfptpd_stats_count *dst,
 }
 
 
+/* Index of the zero bucket in a quantile sketch */
+#define STATS_QUANTILE_ZERO_BUCKET \
+	(SFPTPD_STATS_QUANTILE_OCTAVES * SFPTPD_STATS_QUANTILE_SUB_BUCKETS)
+
+static int stats_quantile_bucket(long double sample)
+{
+	double mag = fabs((double) sample);
+	double frac;
+	int exp, k;
+
+	if (!(mag >= 1.0))
+		return STATS_QUANTILE_ZERO_BUCKET;
+
+	/* mag = frac * 2^exp with frac in [0.5, 1) */
+	frac = frexp(mag, &exp);
+	if (!isfinite(mag) || exp > SFPTPD_STATS_QUANTILE_OCTAVES)
+		k = STATS_QUANTILE_ZERO_BUCKET - 1;
+	else
+		k = (exp - 1) * SFPTPD_STATS_QUANTILE_SUB_BUCKETS +
+		    (int) ((frac * 2.0 - 1.0) * SFPTPD_STATS_QUANTILE_SUB_BUCKETS);
+
+	return sample < 0 ? STATS_QUANTILE_ZERO_BUCKET - 1 - k
+			  : STATS_QUANTILE_ZERO_BUCKET + 1 + k;
+}
+
+
+static long double stats_quantile_bucket_value(int bucket)
+{
+	long double value;
+	int k;
+
+	if (bucket == STATS_QUANTILE_ZERO_BUCKET)
+		return 0.0L;
+
+	/* Use the middle of the bucket */
+	k = abs(bucket - STATS_QUANTILE_ZERO_BUCKET) - 1;
+	value = ldexpl(1.0L + (k % SFPTPD_STATS_QUANTILE_SUB_BUCKETS + 0.5L) /
+			      SFPTPD_STATS_QUANTILE_SUB_BUCKETS,
+		       k / SFPTPD_STATS_QUANTILE_SUB_BUCKETS);
+
+	return bucket < STATS_QUANTILE_ZERO_BUCKET ? -value : value;
+}
+
+
+/* Estimate a set of quantiles, given in ascending order, in one pass */
+static void stats_quantile_estimate(const struct sfptpd_stats_quantile *quantile,
+				    const long double *qs, long double *values,
+				    unsigned int num)
+{
+	unsigned long cumulative = 0;
+	unsigned long target;
+	unsigned int i = 0;
+	int bucket = 0;
+
+	for (i = 0; i < num; i++) {
+		if (quantile->num_samples == 0) {
+			values[i] = NAN;
+			continue;
+		}
+
+		target = (unsigned long) ceill(qs[i] * quantile->num_samples);
+		if (target == 0)
+			target = 1;
+
+		while (bucket < SFPTPD_STATS_QUANTILE_BUCKETS &&
+		       cumulative + quantile->buckets[bucket] < target)
+			cumulative += quantile->buckets[bucket++];
+
+		/* The outermost buckets are unbounded so use the extremes */
+		if (bucket >= SFPTPD_STATS_QUANTILE_BUCKETS - 1)
+			values[i] = quantile->max;
+		else if (bucket == 0)
+			values[i] = quantile->min;
+		else
+			values[i] = stats_quantile_bucket_value(bucket);
+
+		/* The exact extremes are known so never estimate beyond them */
+		if (values[i] < quantile->min)
+			values[i] = quantile->min;
+		if (values[i] > quantile->max)
+			values[i] = quantile->max;
+	}
+}
+
+
+void sfptpd_stats_quantile_init(struct sfptpd_stats_quantile *quantile)
+{
+	assert(quantile != NULL);
+	memset(quantile, '\0', sizeof *quantile);
+	quantile->valid = true;
+	quantile->qualified = true;
+	quantile->min = 1.0e100;
+	quantile->max = -1.0e100;
+}
+
+
+void sfptpd_stats_quantile_update(struct sfptpd_stats_quantile *quantile,
+				  long double sample,
+				  bool qualified)
+{
+	assert(quantile != NULL);
+	if (qualified && !isnan(sample)) {
+		quantile->num_samples++;
+		quantile->total += sample;
+		quantile->buckets[stats_quantile_bucket(sample)]++;
+		if (sample < quantile->min)
+			quantile->min = sample;
+		if (sample > quantile->max)
+			quantile->max = sample;
+	} else if (!qualified) {
+		quantile->qualified = false;
+	}
+}
+
+
+void sfptpd_stats_quantile_add(struct sfptpd_stats_quantile *dst,
+			       const struct sfptpd_stats_quantile *src)
+{
+	int i;
+
+	assert(dst != NULL);
+	assert(src != NULL);
+
+	if (src->num_samples != 0) {
+		for (i = 0; i < SFPTPD_STATS_QUANTILE_BUCKETS; i++)
+			dst->buckets[i] += src->buckets[i];
+		dst->num_samples += src->num_samples;
+		dst->total += src->total;
+		if (src->min < dst->min)
+			dst->min = src->min;
+		if (src->max > dst->max)
+			dst->max = src->max;
+	}
+	if (!src->qualified)
+		dst->qualified = false;
+}
+
+
+long double sfptpd_stats_quantile_get(const struct sfptpd_stats_quantile *quantile,
+				      long double q)
+{
+	long double value;
+
+	assert(quantile != NULL);
+	assert(q >= 0.0L && q <= 1.0L);
+
+	stats_quantile_estimate(quantile, &q, &value, 1);
+	return value;
+}
+
+
 /****************************************************************************
  * Historical records of the range of a measurement augmented with times
  * for extreme events and a continuous qualification flag
  ****************************************************************************/
 
-static sfptpd_stats_item_t *stats_range_history_alloc(const char *name,
+static void stats_range_record_init(struct stats_range_record *record)
+{
+	assert(record != NULL);
+	record->valid = true;
+	record->qualified = true;
+	record->num_samples = 0;
+	record->total = 0.0;
+	record->total_squares = 0.0;
+	record->min = 1.0e100;
+	record->max = -1.0e100;
+	sfptpd_time_zero(&record->min_time);
+	sfptpd_time_zero(&record->max_time);
+}
+
+
+static void stats_range_record_set(struct stats_range_record *record,
+				   const struct sfptpd_stats_range *range)
+{
+	assert(record != NULL);
+	assert(range != NULL);
+	record->valid = range->valid;
+	record->qualified = range->qualified;
+	record->num_samples = range->num_samples;
+	record->total = range->total;
+	record->total_squares = range->total_squares;
+	record->min = range->min;
+	record->max = range->max;
+	record->min_time = range->min_time;
+	record->max_time = range->max_time;
+}
+
+
+static void stats_range_record_add(struct stats_range_record *dst,
+				   const struct stats_range_record *src)
+{
+	assert(dst != NULL);
+	assert(src != NULL);
+	dst->num_samples += src->num_samples;
+	dst->total += src->total;
+	dst->total_squares += src->total_squares;
+	if (src->min < dst->min) {
+		dst->min = src->min;
+		dst->min_time = src->min_time;
+	}
+	if (src->max > dst->max) {
+		dst->max = src->max;
+		dst->max_time = src->max_time;
+	}
+	if (!src->qualified)
+		dst->qualified = false;
+}
+
+
+static sfptpd_stats_item_t *stats_range_history_alloc(struct sfptpd_stats_arena *arena,
+						     const char *name,
 						     const char *units,
 						     unsigned int decimal_places)
 {
 	struct stats_range_history *stat;
-	enum sfptpd_stats_time_period p;
 
 	assert(name != NULL);
 
-	stat = (struct stats_range_history *)calloc(1, sizeof(*stat));
+	stat = (struct stats_range_history *)stats_arena_alloc(arena, sizeof(*stat));
 	if (stat == NULL) {
 		ERROR("stats: failed to allocate memory for range history %s\n",
 		      name);
@@ -400,21 +963,80 @@ static sfptpd_stats_item_t *stats_range_history_alloc(const char *name,
 	stat->parent.units = units;
 	stat->parent.decimal_places = decimal_places;
 	stat->parent.ops = &stats_range_ops;
+	stat->parent.arena = arena;
 
 	sfptpd_stats_range_init(&stat->active);
 
-	/* Initialise the current statistics for each time period */
-	for (p = 0; p < sizeof(stat->history)/sizeof(stat->history[0]); p++)
-		sfptpd_stats_range_init(&stat->history[p][SFPTPD_STATS_HISTORY_CURRENT]);
-
 	return &stat->parent;
 }
 
 
-static void stats_range_history_free(struct sfptpd_stats_item *item)
+static size_t stats_range_history_period_size(enum sfptpd_stats_time_period period)
 {
-	assert(item != NULL);
-	free(item);
+	unsigned int num;
+
+	num = STATS_NUM_COMPLETED;
+	if (period != SFPTPD_STATS_PERIOD_MINUTE)
+		num++;
+
+	return STATS_ARENA_ROUND_UP(num * sizeof(struct stats_range_record));
+}
+
+
+/* Allocate the history for a time period when it is first needed. */
+static bool stats_range_history_alloc_period(struct sfptpd_stats_item *item,
+					     enum sfptpd_stats_time_period period)
+{
+	struct stats_range_history *stat = (struct stats_range_history *)item;
+	struct stats_range_record *records;
+
+	if (stat->history[period] != NULL)
+		return true;
+
+	records = stats_arena_alloc_history(stat->parent.arena,
+					    stats_range_history_period_size(period));
+	if (records == NULL) {
+		ERROR("stats: failed to allocate %s history for %s\n",
+		      sfptpd_stats_periods[period].name, stat->parent.name);
+		return false;
+	}
+
+	stat->history[period] = records;
+	if (period != SFPTPD_STATS_PERIOD_MINUTE) {
+		stat->current[period] = &records[STATS_NUM_COMPLETED];
+		if (!stat->parent.arena->restored)
+			stats_range_record_init(stat->current[period]);
+	}
+	return true;
+}
+
+
+/* Get the record for an interval or NULL if there is none. The record for
+ * the current interval is made up in the supplied storage from the
+ * completed intervals of the shorter time periods. */
+static const struct stats_range_record *
+stats_range_history_entry(struct stats_range_history *stat,
+			  enum sfptpd_stats_time_period period,
+			  enum sfptpd_stats_history_index index,
+			  struct stats_range_record *storage)
+{
+	enum sfptpd_stats_time_period p;
+
+	if (index != SFPTPD_STATS_HISTORY_CURRENT) {
+		if (stat->history[period] == NULL ||
+		    !stat->history[period][index - 1].valid)
+			return NULL;
+		return &stat->history[period][index - 1];
+	}
+
+	/* Add the oldest data first so the earliest of equal extremes is
+	 * reported, as when accumulating */
+	stats_range_record_init(storage);
+	for (p = period; p > SFPTPD_STATS_PERIOD_MINUTE; p--) {
+		if (stat->current[p] != NULL)
+			stats_range_record_add(storage, stat->current[p]);
+	}
+	return storage;
 }
 
 
@@ -439,34 +1061,39 @@ static void stats_range_history_end_period(struct sfptpd_stats_item *item,
 					  enum sfptpd_stats_time_period period)
 {
 	struct stats_range_history *stat = (struct stats_range_history *)item;
-	sfptpd_stats_range_t *entry;
-	enum sfptpd_stats_time_period p;
+	struct stats_range_record completed;
+	struct stats_range_record *history;
 
 	assert(stat != NULL);
 	assert(stat->parent.type == SFPTPD_STATS_TYPE_RANGE);
-	assert(period < sizeof(stat->history)/sizeof(stat->history[0]));
-
-	if (period == 0) {
-		for (p = 0; p < sizeof(stat->history)/sizeof(stat->history[0]); p++) {
-			/* Get a pointer to the current statistics entry for this
-			 * time period and add the active statistics to these */
-			entry = &stat->history[p][SFPTPD_STATS_HISTORY_CURRENT];
-			sfptpd_stats_range_add(entry, &stat->active);
-		}
+	assert(period < SFPTPD_STATS_PERIOD_MAX);
 
-		/* Reset the active stats accumulator */
+	/* Take the statistics for the interval that has ended. Periods end in
+	 * order of length, so any shorter period ending at the same time has
+	 * already been added to the current statistics for this period */
+	if (period == SFPTPD_STATS_PERIOD_MINUTE) {
+		stats_range_record_set(&completed, &stat->active);
 		sfptpd_stats_range_init(&stat->active);
+	} else if (stat->current[period] != NULL) {
+		completed = *stat->current[period];
+		stats_range_record_init(stat->current[period]);
+	} else {
+		memset(&completed, 0, sizeof completed);
 	}
 
-	/* Store the end time of the period that has ended and shift along the
-	 * previous results. This causes us to discard the oldest data for this
-	 * time period */
-	memmove(&stat->history[period][SFPTPD_STATS_HISTORY_1],
-		&stat->history[period][SFPTPD_STATS_HISTORY_CURRENT],
-		sizeof(stat->history[0]) - sizeof(stat->history[0][0]));
-
-	/* Reset the current stats for this period */
-	sfptpd_stats_range_init(&stat->history[period][SFPTPD_STATS_HISTORY_CURRENT]);
+	/* Roll the interval up into the next longer time period */
+	if (period + 1 < SFPTPD_STATS_PERIOD_MAX && completed.valid &&
+	    stats_range_history_alloc_period(item, period + 1))
+		stats_range_record_add(stat->current[period + 1], &completed);
+
+	/* Shift along the previous results. This causes us to discard the
+	 * oldest data for this time period */
+	if (stats_range_history_alloc_period(item, period)) {
+		history = stat->history[period];
+		memmove(&history[1], &history[0],
+			(STATS_NUM_COMPLETED - 1) * sizeof *history);
+		history[0] = completed;
+	}
 }
 
 
@@ -486,7 +1113,8 @@ static void stats_range_history_write_data(struct sfptpd_stats_item *item,
 					   enum sfptpd_stats_history_index index)
 {
 	struct stats_range_history *stat = (struct stats_range_history *)item;
-	sfptpd_stats_range_t *entry;
+	const struct stats_range_record *entry;
+	struct stats_range_record current;
 	char min_time_str[24];
 	char max_time_str[24];
 
@@ -494,9 +1122,9 @@ static void stats_range_history_write_data(struct sfptpd_stats_item *item,
 	assert(stat->parent.type == SFPTPD_STATS_TYPE_RANGE);
 	assert(stream != NULL);
 
-	entry = &stat->history[period][index];
+	entry = stats_range_history_entry(stat, period, index, &current);
 
-	if (!entry->valid)
+	if (entry == NULL)
 		return;
 
 	/* If no data was collected, during the period, output null values and
@@ -507,8 +1135,8 @@ static void stats_range_history_write_data(struct sfptpd_stats_item *item,
 	} else {
 		/* This uses the equivalence that the standard deviation is equal to
 		 * the mean of the squares (of the data) - the square of the means */
-		long double mean = entry->total / entry->num_samples;
-		long double sd_sqr = (entry->total_squares / entry->num_samples)
+		long double mean = (long double) entry->total / entry->num_samples;
+		long double sd_sqr = ((long double) entry->total_squares / entry->num_samples)
 				   - (mean * mean);
 
 		if (entry->min_time.sec == 0) {
@@ -527,8 +1155,8 @@ static void stats_range_history_write_data(struct sfptpd_stats_item *item,
 
 		fprintf(stream, stats_range_format_data, name,
 			stat->parent.decimal_places, mean,
-			stat->parent.decimal_places, entry->min,
-			stat->parent.decimal_places, entry->max,
+			stat->parent.decimal_places, (long double) entry->min,
+			stat->parent.decimal_places, (long double) entry->max,
 			stat->parent.decimal_places, sqrtl(sd_sqr),
 			entry->num_samples, start, end,
 			min_time_str, max_time_str,
@@ -559,35 +1187,36 @@ static void stats_range_history_write_json_data(
 	const char *start, const char *end)
 {
 	struct stats_range_history *stat = (struct stats_range_history *)item;
-	sfptpd_stats_range_t *entry;
+	const struct stats_range_record *entry;
+	struct stats_range_record current;
 	char time_str[24];
 
 	assert(stat != NULL);
-	assert(stat->history != NULL);
 	assert(stat->parent.type == SFPTPD_STATS_TYPE_RANGE);
 	assert(stream != NULL);
 
-	entry = &stat->history[period][index];
+	entry = stats_range_history_entry(stat, period, index, &current);
 
 	fprintf(stream,
-		"{\"period\":\"%s\",\"period-secs\":%d,\"seq-num\":%d,\"samples\":%lu",
-		period_name, period_secs, seq_num, entry->num_samples);
-	if (entry->num_samples == 0){
+		"{\"period\":\"%s\",\"period-secs\":%d,\"seq-num\":%d,\"samples\":%u",
+		period_name, period_secs, seq_num,
+		entry == NULL ? 0 : entry->num_samples);
+	if (entry == NULL || entry->num_samples == 0){
 		fprintf(stream, ",\"end-time\":null}");
 		return;
         }
 
 	/* This uses the equivalence that the standard deviation is equal to
 	 * the mean of the squares (of the data) - the square of the means */
-	long double mean = entry->total / entry->num_samples;
-	long double sd_sqr = (entry->total_squares / entry->num_samples)
+	long double mean = (long double) entry->total / entry->num_samples;
+	long double sd_sqr = ((long double) entry->total_squares / entry->num_samples)
 				- (mean * mean);
 
 	fprintf(stream,
 			",\"mean\":%.*Lf,\"min\":%.*Lf,\"max\":%.*Lf,\"std-dev\":%.*Lf",
 			stat->parent.decimal_places, mean,
-			stat->parent.decimal_places, entry->min,
-			stat->parent.decimal_places, entry->max,
+			stat->parent.decimal_places, (long double) entry->min,
+			stat->parent.decimal_places, (long double) entry->max,
 			stat->parent.decimal_places, sqrtl(sd_sqr));
 
 	fprintf(stream, ",\"start-time\":\"%s\"", start);
@@ -629,6 +1258,8 @@ static int stats_range_history_get(sfptpd_stats_item_t *item,
 				  va_list args)
 {
 	struct stats_range_history *stat = (struct stats_range_history *)item;
+	const struct stats_range_record *entry;
+	struct stats_range_record current;
 	long double *mean, *max, *min;
 	int *qualified;
 	struct sfptpd_timespec *max_time, *min_time;
@@ -638,8 +1269,8 @@ static int stats_range_history_get(sfptpd_stats_item_t *item,
 	assert(period < SFPTPD_STATS_PERIOD_MAX);
 	assert(index < SFPTPD_STATS_HISTORY_MAX);
 
-	sfptpd_stats_range_t *entry = &stat->history[period][index];
-	if (!entry->valid)
+	entry = stats_range_history_entry(stat, period, index, &current);
+	if (entry == NULL)
 		return ENOENT;
 
 	mean = va_arg(args, long double *);
@@ -648,7 +1279,7 @@ static int stats_range_history_get(sfptpd_stats_item_t *item,
 	qualified = va_arg(args, int *);
 	max_time = va_arg(args, struct sfptpd_timespec *);
 	min_time = va_arg(args, struct sfptpd_timespec *);
-	if (mean != NULL) *mean = entry->total / entry->num_samples;
+	if (mean != NULL) *mean = (long double) entry->total / entry->num_samples;
 	if (max != NULL) *max = entry->max;
 	if (min != NULL) *min = entry->min;
 	if (qualified != NULL) *qualified = (int) entry->qualified;
@@ -658,9 +1289,64 @@ static int stats_range_history_get(sfptpd_stats_item_t *item,
 }
 
 
+static void stats_range_history_write_metrics(struct sfptpd_stats_item **items,
+					      const char *const *labels,
+					      unsigned int num,
+					      struct sfptpd_json_buf *buf,
+					      const char *prefix)
+{
+	static const char *const suffixes[] = { "_mean", "_min", "_max" };
+	struct stats_range_history *stat;
+	const struct stats_range_record *entry;
+	char metric[SFPTPD_METRICS_NAME_MAX];
+	char name[SFPTPD_METRICS_NAME_MAX];
+	long double value;
+	int measure;
+	int i;
+
+	assert(items[0] != NULL);
+
+	for (measure = 0; measure < 3; measure++) {
+		snprintf(metric, sizeof metric, "%s%s", items[0]->name, suffixes[measure]);
+		sfptpd_metrics_family(buf, name, prefix, metric, items[0]->units,
+				      SFPTPD_METRICS_TYPE_GAUGE, NULL);
+		for (i = 0; i < num; i++) {
+			stat = (struct stats_range_history *) items[i];
+			if (stat == NULL)
+				continue;
+			entry = stats_range_history_entry(stat, SFPTPD_STATS_PERIOD_MINUTE,
+							  SFPTPD_STATS_HISTORY_1, NULL);
+			if (entry == NULL || entry->num_samples == 0)
+				continue;
+
+			if (measure == 0)
+				value = (long double) entry->total / entry->num_samples;
+			else if (measure == 1)
+				value = entry->min;
+			else
+				value = entry->max;
+			sfptpd_metrics_sample(buf, name, NULL, labels[i], value,
+					      items[0]->decimal_places);
+		}
+	}
+
+	snprintf(metric, sizeof metric, "%s_samples", items[0]->name);
+	sfptpd_metrics_family(buf, name, prefix, metric, NULL,
+			      SFPTPD_METRICS_TYPE_GAUGE, NULL);
+	for (i = 0; i < num; i++) {
+		stat = (struct stats_range_history *) items[i];
+		if (stat == NULL)
+			continue;
+		entry = stats_range_history_entry(stat, SFPTPD_STATS_PERIOD_MINUTE,
+						  SFPTPD_STATS_HISTORY_1, NULL);
+		sfptpd_metrics_sample(buf, name, NULL, labels[i],
+				      entry == NULL ? 0 : entry->num_samples, 0);
+	}
+}
+
+
 static const struct sfptpd_stats_item_ops stats_range_ops =
 {
-	stats_range_history_free,
 	stats_range_history_update,
 	stats_range_history_end_period,
 	stats_range_history_write_headings,
@@ -668,7 +1354,10 @@ static const struct sfptpd_stats_item_ops stats_range_ops =
 	stats_range_history_write_json_opening,
 	stats_range_history_write_json_data,
 	stats_range_history_write_json_closing,
-	stats_range_history_get
+	stats_range_history_get,
+	stats_range_history_write_metrics,
+	stats_range_history_period_size,
+	stats_range_history_alloc_period
 };
 
 
@@ -676,16 +1365,16 @@ static const struct sfptpd_stats_item_ops stats_range_ops =
  * Historical records of the frequency of an event
  ****************************************************************************/
 
-static sfptpd_stats_item_t *stats_count_history_alloc(const char *name,
+static sfptpd_stats_item_t *stats_count_history_alloc(struct sfptpd_stats_arena *arena,
+						      const char *name,
 						      const char *units,
 						      unsigned int decimal_places)
 {
 	struct stats_count_history *stat;
-	enum sfptpd_stats_time_period p;
 
 	assert(name != NULL);
 
-	stat = (struct stats_count_history *)calloc(1, sizeof(*stat));
+	stat = (struct stats_count_history *)stats_arena_alloc(arena, sizeof(*stat));
 	if (stat == NULL) {
 		ERROR("stats: failed to allocate memory for range history %s\n",
 		      name);
@@ -697,70 +1386,131 @@ static sfptpd_stats_item_t *stats_count_history_alloc(const char *name,
 	stat->parent.units = units;
 	stat->parent.decimal_places = decimal_places;
 	stat->parent.ops = &stats_count_ops;
+	stat->parent.arena = arena;
 
 	sfptpd_stats_count_init(&stat->active);
 
-	/* Initialise the active statistics for each time period */
-	for (p = 0; p < sizeof(stat->history)/sizeof(stat->history[0]); p++) {
-		sfptpd_stats_count_init(&stat->history[p][SFPTPD_STATS_HISTORY_CURRENT]);
-	}
-
 	return &stat->parent;
 }
 
 
-static void stats_count_history_free(struct sfptpd_stats_item *item)
+static size_t stats_count_history_period_size(enum sfptpd_stats_time_period period)
 {
-	assert(item != NULL);
-	free(item);
+	unsigned int num;
+
+	num = STATS_NUM_COMPLETED;
+	if (period != SFPTPD_STATS_PERIOD_MINUTE)
+		num++;
+
+	return STATS_ARENA_ROUND_UP(num * sizeof(sfptpd_stats_count_t));
 }
 
 
-static void stats_count_history_update(sfptpd_stats_item_t *item, va_list args)
+/* Allocate the history for a time period when it is first needed. */
+static bool stats_count_history_alloc_period(struct sfptpd_stats_item *item,
+					     enum sfptpd_stats_time_period period)
 {
 	struct stats_count_history *stat = (struct stats_count_history *)item;
-	unsigned long sample;
+	sfptpd_stats_count_t *records;
 
-	assert(stat != NULL);
-	assert(stat->parent.type == SFPTPD_STATS_TYPE_COUNT);
+	if (stat->history[period] != NULL)
+		return true;
 
-	sample = va_arg(args, unsigned long);
-	sfptpd_stats_count_update(&stat->active, sample, 1);
+	records = stats_arena_alloc_history(stat->parent.arena,
+					    stats_count_history_period_size(period));
+	if (records == NULL) {
+		ERROR("stats: failed to allocate %s history for %s\n",
+		      sfptpd_stats_periods[period].name, stat->parent.name);
+		return false;
+	}
+
+	stat->history[period] = records;
+	if (period != SFPTPD_STATS_PERIOD_MINUTE) {
+		stat->current[period] = &records[STATS_NUM_COMPLETED];
+		if (!stat->parent.arena->restored)
+			sfptpd_stats_count_init(stat->current[period]);
+	}
+	return true;
 }
 
 
-static void stats_count_history_end_period(sfptpd_stats_item_t *item,
-					   enum sfptpd_stats_time_period period)
+/* Get the record for an interval or NULL if there is none. The record for
+ * the current interval is made up in the supplied storage from the
+ * completed intervals of the shorter time periods. */
+static const sfptpd_stats_count_t *
+stats_count_history_entry(struct stats_count_history *stat,
+			  enum sfptpd_stats_time_period period,
+			  enum sfptpd_stats_history_index index,
+			  sfptpd_stats_count_t *storage)
 {
-	struct stats_count_history *stat = (struct stats_count_history *)item;
-	sfptpd_stats_count_t *entry;
 	enum sfptpd_stats_time_period p;
 
-	assert(stat != NULL);
-	assert(stat->parent.type == SFPTPD_STATS_TYPE_COUNT);
-	assert(period < sizeof(stat->history)/sizeof(stat->history[0]));
-
-	if (period == 0) {
-		for (p = 0; p < sizeof(stat->history)/sizeof(stat->history[0]); p++) {
-			/* Get a pointer to the current statistics entry for this
-			 * time period and add the active statistics to these */
-			entry = &stat->history[p][SFPTPD_STATS_HISTORY_CURRENT];
-			sfptpd_stats_count_add(entry, &stat->active);
-		}
+	if (index != SFPTPD_STATS_HISTORY_CURRENT) {
+		if (stat->history[period] == NULL ||
+		    !stat->history[period][index - 1].valid)
+			return NULL;
+		return &stat->history[period][index - 1];
+	}
 
-		/* Reset the active stats accumulator */
-		sfptpd_stats_count_init(&stat->active);
+	sfptpd_stats_count_init(storage);
+	for (p = period; p > SFPTPD_STATS_PERIOD_MINUTE; p--) {
+		if (stat->current[p] != NULL)
+			sfptpd_stats_count_add(storage, stat->current[p]);
 	}
+	return storage;
+}
+
+
+static void stats_count_history_update(sfptpd_stats_item_t *item, va_list args)
+{
+	struct stats_count_history *stat = (struct stats_count_history *)item;
+	unsigned long sample;
+
+	assert(stat != NULL);
+	assert(stat->parent.type == SFPTPD_STATS_TYPE_COUNT);
+
+	sample = va_arg(args, unsigned long);
+	sfptpd_stats_count_update(&stat->active, sample, 1);
+}
+
+
+static void stats_count_history_end_period(sfptpd_stats_item_t *item,
+					   enum sfptpd_stats_time_period period)
+{
+	struct stats_count_history *stat = (struct stats_count_history *)item;
+	sfptpd_stats_count_t completed;
+	sfptpd_stats_count_t *history;
+
+	assert(stat != NULL);
+	assert(stat->parent.type == SFPTPD_STATS_TYPE_COUNT);
+	assert(period < SFPTPD_STATS_PERIOD_MAX);
 
-	/* Store the end time of the period that has ended and shift along the
-	 * previous results. This causes us to discard the oldest data for this
-	 * time period */
-	memmove(&stat->history[period][SFPTPD_STATS_HISTORY_1],
-		&stat->history[period][SFPTPD_STATS_HISTORY_CURRENT],
-		sizeof(stat->history[0]) - sizeof(stat->history[0][0]));
+	/* Take the statistics for the interval that has ended. Periods end in
+	 * order of length, so any shorter period ending at the same time has
+	 * already been added to the current statistics for this period */
+	if (period == SFPTPD_STATS_PERIOD_MINUTE) {
+		completed = stat->active;
+		sfptpd_stats_count_init(&stat->active);
+	} else if (stat->current[period] != NULL) {
+		completed = *stat->current[period];
+		sfptpd_stats_count_init(stat->current[period]);
+	} else {
+		memset(&completed, 0, sizeof completed);
+	}
 
-	/* Reset the current stats for this period */
-	sfptpd_stats_count_init(&stat->history[period][SFPTPD_STATS_HISTORY_CURRENT]);
+	/* Roll the interval up into the next longer time period */
+	if (period + 1 < SFPTPD_STATS_PERIOD_MAX && completed.valid &&
+	    stats_count_history_alloc_period(item, period + 1))
+		sfptpd_stats_count_add(stat->current[period + 1], &completed);
+
+	/* Shift along the previous results. This causes us to discard the
+	 * oldest data for this time period */
+	if (stats_count_history_alloc_period(item, period)) {
+		history = stat->history[period];
+		memmove(&history[1], &history[0],
+			(STATS_NUM_COMPLETED - 1) * sizeof *history);
+		history[0] = completed;
+	}
 }
 
 
@@ -780,15 +1530,16 @@ static void stats_count_history_write_data(struct sfptpd_stats_item *item,
 					   enum sfptpd_stats_history_index index)
 {
 	struct stats_count_history *stat = (struct stats_count_history *)item;
-	sfptpd_stats_count_t *entry;
+	const sfptpd_stats_count_t *entry;
+	sfptpd_stats_count_t current;
 
 	assert(stat != NULL);
 	assert(stat->parent.type == SFPTPD_STATS_TYPE_COUNT);
 	assert(stream != NULL);
 
-	entry = &stat->history[period][index];
+	entry = stats_count_history_entry(stat, period, index, &current);
 
-	if (!entry->valid)
+	if (entry == NULL)
 		return;
 
 	fprintf(stream, stats_count_format_data,
@@ -817,15 +1568,16 @@ static void stats_count_history_write_json_data(
 	const char *period_name, int period_secs, int seq_num,
 	const char *start, const char *end)
 {
-	sfptpd_stats_count_t *entry;
+	const sfptpd_stats_count_t *entry;
+	sfptpd_stats_count_t current;
 	struct stats_count_history *stat = (struct stats_count_history *)item;
 
 	assert(stat != NULL);
 	assert(stat->parent.type == SFPTPD_STATS_TYPE_COUNT);
 	assert(stream != NULL);
 
-	entry = &stat->history[period][index];
-	if (!entry->valid)
+	entry = stats_count_history_entry(stat, period, index, &current);
+	if (entry == NULL)
 		return;
 
 	fprintf(stream, "{\"period\":\"%s\",\"period-secs\":%d,\"seq-num\":%d"
@@ -855,6 +1607,8 @@ static int stats_count_history_get(sfptpd_stats_item_t *item,
 				   va_list args)
 {
 	struct stats_count_history *stat = (struct stats_count_history *)item;
+	const sfptpd_stats_count_t *entry;
+	sfptpd_stats_count_t current;
 	unsigned long *count;
 
 	assert(stat != NULL);
@@ -862,8 +1616,8 @@ static int stats_count_history_get(sfptpd_stats_item_t *item,
 	assert(period < SFPTPD_STATS_PERIOD_MAX);
 	assert(index < SFPTPD_STATS_HISTORY_MAX);
 
-	sfptpd_stats_count_t *entry = &stat->history[period][index];
-	if (!entry->valid)
+	entry = stats_count_history_entry(stat, period, index, &current);
+	if (entry == NULL)
 		return ENOENT;
 
 	count = va_arg(args, unsigned long *);
@@ -873,9 +1627,50 @@ static int stats_count_history_get(sfptpd_stats_item_t *item,
 }
 
 
+static void stats_count_history_write_metrics(struct sfptpd_stats_item **items,
+					      const char *const *labels,
+					      unsigned int num,
+					      struct sfptpd_json_buf *buf,
+					      const char *prefix)
+{
+	struct stats_count_history *stat;
+	const sfptpd_stats_count_t *entry;
+	char metric[SFPTPD_METRICS_NAME_MAX];
+	char name[SFPTPD_METRICS_NAME_MAX];
+	int i;
+
+	assert(items[0] != NULL);
+
+	snprintf(metric, sizeof metric, "%s_per_minute", items[0]->name);
+	sfptpd_metrics_family(buf, name, prefix, metric, items[0]->units,
+			      SFPTPD_METRICS_TYPE_GAUGE, NULL);
+	for (i = 0; i < num; i++) {
+		stat = (struct stats_count_history *) items[i];
+		if (stat == NULL)
+			continue;
+		entry = stats_count_history_entry(stat, SFPTPD_STATS_PERIOD_MINUTE,
+						  SFPTPD_STATS_HISTORY_1, NULL);
+		sfptpd_metrics_sample(buf, name, NULL, labels[i],
+				      entry == NULL ? 0 : entry->total, 0);
+	}
+
+	snprintf(metric, sizeof metric, "%s_samples", items[0]->name);
+	sfptpd_metrics_family(buf, name, prefix, metric, NULL,
+			      SFPTPD_METRICS_TYPE_GAUGE, NULL);
+	for (i = 0; i < num; i++) {
+		stat = (struct stats_count_history *) items[i];
+		if (stat == NULL)
+			continue;
+		entry = stats_count_history_entry(stat, SFPTPD_STATS_PERIOD_MINUTE,
+						  SFPTPD_STATS_HISTORY_1, NULL);
+		sfptpd_metrics_sample(buf, name, NULL, labels[i],
+				      entry == NULL ? 0 : entry->num_samples, 0);
+	}
+}
+
+
 static const struct sfptpd_stats_item_ops stats_count_ops =
 {
-	stats_count_history_free,
 	stats_count_history_update,
 	stats_count_history_end_period,
 	stats_count_history_write_headings,
@@ -883,7 +1678,407 @@ static const struct sfptpd_stats_item_ops stats_count_ops =
 	stats_count_history_write_json_opening,
 	stats_count_history_write_json_data,
 	stats_count_history_write_json_closing,
-	stats_count_history_get
+	stats_count_history_get,
+	stats_count_history_write_metrics,
+	stats_count_history_period_size,
+	stats_count_history_alloc_period
+};
+
+
+/****************************************************************************
+ * Historical records of the distribution of a measurement
+ ****************************************************************************/
+
+static sfptpd_stats_item_t *stats_quantile_history_alloc(struct sfptpd_stats_arena *arena,
+							 const char *name,
+							 const char *units,
+							 unsigned int decimal_places)
+{
+	struct stats_quantile_history *stat;
+
+	assert(name != NULL);
+
+	stat = (struct stats_quantile_history *)stats_arena_alloc(arena, sizeof(*stat));
+	if (stat == NULL) {
+		ERROR("stats: failed to allocate memory for quantile history %s\n",
+		      name);
+		return NULL;
+	}
+
+	stat->parent.type = SFPTPD_STATS_TYPE_QUANTILE;
+	stat->parent.name = name;
+	stat->parent.units = units;
+	stat->parent.decimal_places = decimal_places;
+	stat->parent.ops = &stats_quantile_ops;
+	stat->parent.arena = arena;
+
+	sfptpd_stats_quantile_init(&stat->active);
+
+	return &stat->parent;
+}
+
+
+static size_t stats_quantile_history_period_size(enum sfptpd_stats_time_period period)
+{
+	size_t size;
+
+	size = STATS_ARENA_ROUND_UP(STATS_NUM_COMPLETED *
+				    sizeof(struct stats_quantile_summary));
+	if (period != SFPTPD_STATS_PERIOD_MINUTE)
+		size += STATS_ARENA_ROUND_UP(sizeof(sfptpd_stats_quantile_t));
+
+	return size;
+}
+
+
+/* Allocate the history for a time period when it is first needed. The
+ * summaries come first, followed by the sketch for the current interval. */
+static bool stats_quantile_history_alloc_period(struct sfptpd_stats_item *item,
+						enum sfptpd_stats_time_period period)
+{
+	struct stats_quantile_history *stat = (struct stats_quantile_history *)item;
+	struct stats_quantile_summary *summaries;
+	size_t offset;
+
+	if (stat->history[period] != NULL)
+		return true;
+
+	summaries = stats_arena_alloc_history(stat->parent.arena,
+					      stats_quantile_history_period_size(period));
+	if (summaries == NULL) {
+		ERROR("stats: failed to allocate %s history for %s\n",
+		      sfptpd_stats_periods[period].name, stat->parent.name);
+		return false;
+	}
+
+	stat->history[period] = summaries;
+	if (period != SFPTPD_STATS_PERIOD_MINUTE) {
+		offset = STATS_ARENA_ROUND_UP(STATS_NUM_COMPLETED * sizeof *summaries);
+		stat->current[period] = (sfptpd_stats_quantile_t *)((char *)summaries + offset);
+		if (!stat->parent.arena->restored)
+			sfptpd_stats_quantile_init(stat->current[period]);
+	}
+	return true;
+}
+
+
+static void stats_quantile_summarise(struct stats_quantile_summary *summary,
+				     const struct sfptpd_stats_quantile *quantile)
+{
+	long double values[SFPTPD_STATS_NUM_QUANTILES];
+	int q;
+
+	summary->valid = quantile->valid;
+	summary->qualified = quantile->qualified;
+	summary->num_samples = quantile->num_samples;
+	summary->min = quantile->min;
+	summary->max = quantile->max;
+	summary->mean = quantile->num_samples ?
+		quantile->total / quantile->num_samples : NAN;
+	stats_quantile_estimate(quantile, sfptpd_stats_quantiles,
+				values, SFPTPD_STATS_NUM_QUANTILES);
+	for (q = 0; q < SFPTPD_STATS_NUM_QUANTILES; q++)
+		summary->values[q] = values[q];
+}
+
+
+/* Get the summary for an interval or NULL if there is none. The current
+ * interval is summarised into the supplied storage from the sketches of
+ * the completed intervals of the shorter time periods. */
+static const struct stats_quantile_summary *
+stats_quantile_history_entry(struct stats_quantile_history *stat,
+			     enum sfptpd_stats_time_period period,
+			     enum sfptpd_stats_history_index index,
+			     struct stats_quantile_summary *storage)
+{
+	sfptpd_stats_quantile_t sketch;
+	enum sfptpd_stats_time_period p;
+
+	if (index != SFPTPD_STATS_HISTORY_CURRENT) {
+		if (stat->history[period] == NULL ||
+		    !stat->history[period][index - 1].valid)
+			return NULL;
+		return &stat->history[period][index - 1];
+	}
+
+	sfptpd_stats_quantile_init(&sketch);
+	for (p = period; p > SFPTPD_STATS_PERIOD_MINUTE; p--) {
+		if (stat->current[p] != NULL)
+			sfptpd_stats_quantile_add(&sketch, stat->current[p]);
+	}
+	stats_quantile_summarise(storage, &sketch);
+	return storage;
+}
+
+
+static void stats_quantile_history_update(struct sfptpd_stats_item *item, va_list args)
+{
+	struct stats_quantile_history *stat = (struct stats_quantile_history *)item;
+	long double sample;
+	int qualified;
+
+	assert(stat != NULL);
+	assert(stat->parent.type == SFPTPD_STATS_TYPE_QUANTILE);
+
+	sample = va_arg(args, long double);
+	qualified = va_arg(args, int);
+	sfptpd_stats_quantile_update(&stat->active, sample, (bool) qualified);
+}
+
+
+static void stats_quantile_history_end_period(struct sfptpd_stats_item *item,
+					      enum sfptpd_stats_time_period period)
+{
+	struct stats_quantile_history *stat = (struct stats_quantile_history *)item;
+	struct stats_quantile_summary *history;
+	sfptpd_stats_quantile_t *completed;
+
+	assert(stat != NULL);
+	assert(stat->parent.type == SFPTPD_STATS_TYPE_QUANTILE);
+	assert(period < SFPTPD_STATS_PERIOD_MAX);
+
+	/* Take the sketch for the interval that has ended. Periods end in
+	 * order of length, so any shorter period ending at the same time has
+	 * already been added to the current sketch for this period */
+	if (period == SFPTPD_STATS_PERIOD_MINUTE)
+		completed = &stat->active;
+	else
+		completed = stat->current[period];
+
+	/* Roll the interval up into the next longer time period */
+	if (period + 1 < SFPTPD_STATS_PERIOD_MAX && completed != NULL &&
+	    stats_quantile_history_alloc_period(item, period + 1))
+		sfptpd_stats_quantile_add(stat->current[period + 1], completed);
+
+	/* Summarise the period that has ended and shift along the previous
+	 * results. This causes us to discard the oldest data for this time
+	 * period */
+	if (stats_quantile_history_alloc_period(item, period)) {
+		history = stat->history[period];
+		memmove(&history[1], &history[0],
+			(STATS_NUM_COMPLETED - 1) * sizeof *history);
+		if (completed != NULL)
+			stats_quantile_summarise(&history[0], completed);
+		else
+			memset(&history[0], 0, sizeof history[0]);
+	}
+
+	/* Reset the sketch for this period */
+	if (completed != NULL)
+		sfptpd_stats_quantile_init(completed);
+}
+
+
+static void stats_quantile_history_write_headings(struct sfptpd_stats_item *item,
+						  FILE *stream)
+{
+	assert(stream != NULL);
+	fprintf(stream, stats_quantile_format_string,
+		"", stats_quantile_names[0], stats_quantile_names[1],
+		stats_quantile_names[2], stats_quantile_names[3],
+		"min", "max", "samples", "start-time", "end-time", "qual");
+}
+
+
+static void stats_quantile_history_write_data(struct sfptpd_stats_item *item,
+					      FILE *stream, const char *name,
+					      const char *start, const char *end,
+					      enum sfptpd_stats_time_period period,
+					      enum sfptpd_stats_history_index index)
+{
+	struct stats_quantile_history *stat = (struct stats_quantile_history *)item;
+	const struct stats_quantile_summary *entry;
+	struct stats_quantile_summary current;
+	int dp;
+
+	assert(stat != NULL);
+	assert(stat->parent.type == SFPTPD_STATS_TYPE_QUANTILE);
+	assert(stream != NULL);
+
+	entry = stats_quantile_history_entry(stat, period, index, &current);
+
+	if (entry == NULL)
+		return;
+
+	if (entry->num_samples == 0) {
+		fprintf(stream, stats_quantile_format_string,
+			name, "---", "---", "---", "---", "---", "---", "0",
+			start, end, "no");
+	} else {
+		dp = stat->parent.decimal_places;
+		fprintf(stream, stats_quantile_format_data, name,
+			dp, (long double) entry->values[0],
+			dp, (long double) entry->values[1],
+			dp, (long double) entry->values[2],
+			dp, (long double) entry->values[3],
+			dp, (long double) entry->min,
+			dp, (long double) entry->max,
+			entry->num_samples, start, end,
+			entry->qualified ? "yes" : "no");
+	}
+}
+
+
+static void stats_quantile_history_write_json_opening(
+	struct sfptpd_stats_item *item,
+	FILE *stream)
+{
+	assert(item != NULL);
+	assert(item->name != NULL);
+	assert(stream != NULL);
+
+	fprintf(stream, "{\"name\":\"%s\"", item->name);
+	if (item->units != NULL)
+		fprintf(stream, ",\"units\":\"%s\"", item->units);
+	fprintf(stream, ",\"type\":\"quantile\",\"values\":[");
+}
+
+
+static void stats_quantile_history_write_json_data(
+	struct sfptpd_stats_item *item, FILE *stream,
+	enum sfptpd_stats_time_period period, enum sfptpd_stats_history_index index,
+	const char *period_name, int period_secs, int seq_num,
+	const char *start, const char *end)
+{
+	struct stats_quantile_history *stat = (struct stats_quantile_history *)item;
+	const struct stats_quantile_summary *entry;
+	struct stats_quantile_summary current;
+	int dp;
+	int q;
+
+	assert(stat != NULL);
+	assert(stat->parent.type == SFPTPD_STATS_TYPE_QUANTILE);
+	assert(stream != NULL);
+
+	entry = stats_quantile_history_entry(stat, period, index, &current);
+
+	fprintf(stream,
+		"{\"period\":\"%s\",\"period-secs\":%d,\"seq-num\":%d,\"samples\":%lu",
+		period_name, period_secs, seq_num,
+		entry == NULL ? 0 : entry->num_samples);
+	if (entry == NULL || entry->num_samples == 0) {
+		fprintf(stream, ",\"end-time\":null}");
+		return;
+	}
+
+	dp = stat->parent.decimal_places;
+	fprintf(stream, ",\"mean\":%.*f,\"min\":%.*f,\"max\":%.*f",
+		dp, entry->mean, dp, entry->min, dp, entry->max);
+	for (q = 0; q < SFPTPD_STATS_NUM_QUANTILES; q++)
+		fprintf(stream, ",\"%s\":%.*f",
+			stats_quantile_names[q], dp, entry->values[q]);
+
+	fprintf(stream, ",\"start-time\":\"%s\"", start);
+
+	if (strcmp(end, "---") == 0)
+		fprintf(stream, ",\"end-time\":null");
+	else
+		fprintf(stream, ",\"end-time\":\"%s\"", end);
+
+	fprintf(stream, ",\"qualified\":%s}", entry->qualified ? "true" : "false");
+}
+
+
+static void stats_quantile_history_write_json_closing(
+	struct sfptpd_stats_item *item,
+	FILE *stream)
+{
+	fputs("]}", stream);
+}
+
+
+static int stats_quantile_history_get(sfptpd_stats_item_t *item,
+				      enum sfptpd_stats_time_period period,
+				      enum sfptpd_stats_history_index index,
+				      va_list args)
+{
+	struct stats_quantile_history *stat = (struct stats_quantile_history *)item;
+	const struct stats_quantile_summary *entry;
+	struct stats_quantile_summary current;
+	unsigned long *num_samples;
+	long double *values;
+	int q;
+
+	assert(stat != NULL);
+	assert(stat->parent.type == SFPTPD_STATS_TYPE_QUANTILE);
+	assert(period < SFPTPD_STATS_PERIOD_MAX);
+	assert(index < SFPTPD_STATS_HISTORY_MAX);
+
+	entry = stats_quantile_history_entry(stat, period, index, &current);
+	if (entry == NULL)
+		return ENOENT;
+
+	values = va_arg(args, long double *);
+	num_samples = va_arg(args, unsigned long *);
+	if (values != NULL) {
+		for (q = 0; q < SFPTPD_STATS_NUM_QUANTILES; q++)
+			values[q] = entry->values[q];
+	}
+	if (num_samples != NULL)
+		*num_samples = entry->num_samples;
+	return 0;
+}
+
+
+static void stats_quantile_history_write_metrics(struct sfptpd_stats_item **items,
+						 const char *const *labels,
+						 unsigned int num,
+						 struct sfptpd_json_buf *buf,
+						 const char *prefix)
+{
+	struct stats_quantile_history *stat;
+	const struct stats_quantile_summary *entry;
+	char quantile_labels[SFPTPD_METRICS_LABELS_MAX];
+	char name[SFPTPD_METRICS_NAME_MAX];
+	char text[16];
+	int i, q;
+
+	assert(items[0] != NULL);
+
+	sfptpd_metrics_family(buf, name, prefix, items[0]->name, items[0]->units,
+			      SFPTPD_METRICS_TYPE_SUMMARY, NULL);
+	for (i = 0; i < num; i++) {
+		stat = (struct stats_quantile_history *) items[i];
+		if (stat == NULL)
+			continue;
+		entry = stats_quantile_history_entry(stat, SFPTPD_STATS_PERIOD_MINUTE,
+						     SFPTPD_STATS_HISTORY_1, NULL);
+		if (entry == NULL)
+			continue;
+
+		if (entry->num_samples != 0) {
+			for (q = 0; q < SFPTPD_STATS_NUM_QUANTILES; q++) {
+				snprintf(text, sizeof text, "%Lg", sfptpd_stats_quantiles[q]);
+				snprintf(quantile_labels, sizeof quantile_labels,
+					 "%s%squantile=\"%s\"", labels[i],
+					 labels[i][0] != '\0' ? "," : "", text);
+				sfptpd_metrics_sample(buf, name, NULL, quantile_labels,
+						      entry->values[q],
+						      items[0]->decimal_places);
+			}
+			sfptpd_metrics_sample(buf, name, "_sum", labels[i],
+					      entry->mean * entry->num_samples,
+					      items[0]->decimal_places);
+		}
+		sfptpd_metrics_sample(buf, name, "_count", labels[i],
+				      entry->num_samples, 0);
+	}
+}
+
+
+static const struct sfptpd_stats_item_ops stats_quantile_ops =
+{
+	stats_quantile_history_update,
+	stats_quantile_history_end_period,
+	stats_quantile_history_write_headings,
+	stats_quantile_history_write_data,
+	stats_quantile_history_write_json_opening,
+	stats_quantile_history_write_json_data,
+	stats_quantile_history_write_json_closing,
+	stats_quantile_history_get,
+	stats_quantile_history_write_metrics,
+	stats_quantile_history_period_size,
+	stats_quantile_history_alloc_period
 };
 
 
@@ -903,6 +2098,11 @@ int sfptpd_stats_collection_alloc(struct sfptpd_stats_collection *stats,
 	/* We expect the stats collection interval to be 60 seconds */
 	assert(SFPTPD_STATS_COLLECTION_INTERVAL == 60);
 
+	/* Each period is rolled up into the next longer one so they must
+	 * end together */
+	for (p = 1; p < SFPTPD_STATS_PERIOD_MAX; p++)
+		assert(sfptpd_stats_periods[p].length % sfptpd_stats_periods[p - 1].length == 0);
+
 	/* Get the time and initialise the statistics measures */
 	if (sfclock_gettime(CLOCK_REALTIME, &time) < 0) {
 		ERROR("failed to get realtime time, %s\n", strerror(errno));
@@ -921,8 +2121,14 @@ int sfptpd_stats_collection_alloc(struct sfptpd_stats_collection *stats,
 	stats->capacity = 1 /*SFPTPD_STATS_COLLECTION_DEFAULT_SIZE;*/;
 	stats->items = (sfptpd_stats_item_t **)calloc(stats->capacity, sizeof(stats->items));
 
-	if (stats->items == NULL) {
+	stats->arena = stats_arena_create();
+
+	if (stats->items == NULL || stats->arena == NULL) {
 		CRITICAL("stats %s: failed to allocate memory for collection\n", name);
+		free(stats->items);
+		stats_arena_destroy(stats->arena);
+		stats->items = NULL;
+		stats->arena = NULL;
 		return ENOMEM;
 	}
 
@@ -963,25 +2169,19 @@ int sfptpd_stats_collection_create(struct sfptpd_stats_collection *stats,
 
 void sfptpd_stats_collection_free(struct sfptpd_stats_collection *stats)
 {
-	unsigned int i;
-	struct sfptpd_stats_item *item;
-
 	assert(stats != NULL);
 
-	/* Free each item in the collection */
-	if (stats->items != NULL) {
-		for (i = 0; i < stats->capacity; i++) {
-			item = stats->items[i];
-			if (item != NULL)
-				item->ops->free(item);
-		}
+	if (stats->arena != NULL)
+		TRACE_L4("stats %s: freeing %zu bytes of statistics\n",
+			 stats->name, stats->arena->size);
 
-		/* Free the collection memory */
-		free(stats->items);
-	}
+	/* The items and their history are all held in the arena */
+	stats_arena_destroy(stats->arena);
+	free(stats->items);
 
 	stats->capacity = 0;
 	stats->items = NULL;
+	stats->arena = NULL;
 }
 
 
@@ -1033,17 +2233,24 @@ int sfptpd_stats_collection_add(struct sfptpd_stats_collection *stats,
 
 	switch (type) {
 	case SFPTPD_STATS_TYPE_RANGE:
-		item = stats_range_history_alloc(name, units, decimal_places);
+		item = stats_range_history_alloc(stats->arena, name, units, decimal_places);
 		break;
 
 	case SFPTPD_STATS_TYPE_COUNT:
-		item = stats_count_history_alloc(name, units, decimal_places);
+		item = stats_count_history_alloc(stats->arena, name, units, decimal_places);
+		break;
+
+	case SFPTPD_STATS_TYPE_QUANTILE:
+		item = stats_quantile_history_alloc(stats->arena, name, units, decimal_places);
 		break;
 
 	default:
 		assert(false);
 	}
 
+	if (item == NULL)
+		return ENOMEM;
+
 	/* Finally insert the item into the table */
 	stats->items[id] = item;
 	TRACE_L6("stats %s: added item %d, type %d, name %s, units %s\n",
@@ -1144,53 +2351,335 @@ int sfptpd_stats_collection_update_count_samples(struct sfptpd_stats_collection
 }
 
 
+int sfptpd_stats_collection_update_quantile(struct sfptpd_stats_collection *stats,
+					    unsigned int index,
+					    long double sample,
+					    bool qualified)
+{
+	return sfptpd_stats_collection_update(stats, index,
+					      SFPTPD_STATS_TYPE_QUANTILE, sample, (int) qualified);
+}
 
-void sfptpd_stats_collection_end_period(struct sfptpd_stats_collection *stats,
-					struct sfptpd_timespec *time)
+
+
+static struct stats_persist_state *stats_persist_get_state(struct sfptpd_stats_arena *arena)
+{
+	return (struct stats_persist_state *)(arena->map + sizeof(struct stats_persist_header));
+}
+
+
+static uint64_t stats_persist_header_checksum(const struct stats_persist_header *hdr)
 {
+	return stats_persist_hash(STATS_PERSIST_HASH_INIT, hdr,
+				  offsetof(struct stats_persist_header, checksum));
+}
+
+
+static uint64_t stats_persist_state_checksum(const struct stats_persist_state *state)
+{
+	return stats_persist_hash(STATS_PERSIST_HASH_INIT, state,
+				  offsetof(struct stats_persist_state, checksum));
+}
+
+
+/* End the current interval of a time period and start the next one */
+static void stats_collection_end_interval(struct sfptpd_stats_collection *stats,
+					  enum sfptpd_stats_time_period p,
+					  const struct sfptpd_timespec *time)
+{
+	struct sfptpd_stats_time_interval *interval;
+	struct sfptpd_stats_item *item;
+	unsigned int i;
+
+	interval = &stats->intervals[p][SFPTPD_STATS_HISTORY_CURRENT];
+
+	/* Store the end time of the period and mark the period as complete.
+	 * Shift along the previous results for the period. This causes us to
+	 * discard the oldest data for this time period */
+	interval->end_valid = true;
+	interval->end_time = *time;
+
+	/* Free each item in the collection, call end period indicating which
+	 * period has ended */
+	for (i = 0; i < stats->capacity; i++) {
+		item = stats->items[i];
+		if (item != NULL)
+			item->ops->end_period(item, p);
+	}
+
+	memmove(&stats->intervals[p][SFPTPD_STATS_HISTORY_1],
+		&stats->intervals[p][SFPTPD_STATS_HISTORY_CURRENT],
+		sizeof(stats->intervals[0]) - sizeof(stats->intervals[0][0]));
+
+	/* Set up the next period */
+	stats->elapsed[p] = 0;
+	interval->seq_num++;
+	interval->start_valid = true;
+	interval->start_time = *time;
+	interval->end_valid = false;
+	interval->end_time = zero_time;
+}
+
+
+/* Save the state of the time periods to a persistent history file */
+static void stats_persist_save_state(struct sfptpd_stats_collection *stats,
+				     const struct sfptpd_timespec *time)
+{
+	struct stats_persist_state *state = stats_persist_get_state(stats->arena);
+
+	memcpy(state->elapsed, stats->elapsed, sizeof state->elapsed);
+	memcpy(state->intervals, stats->intervals, sizeof state->intervals);
+	state->saved_time = *time;
+	state->checksum = stats_persist_state_checksum(state);
+}
+
+
+/* Get the size of a persistent history file for a collection and a hash of
+ * everything that determines its layout */
+static size_t stats_persist_layout(struct sfptpd_stats_collection *stats,
+				   uint64_t *definition)
+{
+	struct sfptpd_stats_item *item;
 	enum sfptpd_stats_time_period p;
+	uint64_t hash = STATS_PERSIST_HASH_INIT;
+	uint32_t value;
+	size_t period_size;
+	size_t size;
 	unsigned int i;
+
+	value = STATS_PERSIST_VERSION;
+	hash = stats_persist_hash(hash, &value, sizeof value);
+	value = sizeof(struct stats_persist_state);
+	hash = stats_persist_hash(hash, &value, sizeof value);
+	for (p = 0; p < SFPTPD_STATS_PERIOD_MAX; p++) {
+		value = sfptpd_stats_periods[p].length;
+		hash = stats_persist_hash(hash, &value, sizeof value);
+	}
+
+	size = STATS_PERSIST_DATA_OFFSET;
+	for (i = 0; i < stats->capacity; i++) {
+		item = stats->items[i];
+		if (item == NULL)
+			continue;
+
+		value = i;
+		hash = stats_persist_hash(hash, &value, sizeof value);
+		value = item->type;
+		hash = stats_persist_hash(hash, &value, sizeof value);
+		hash = stats_persist_hash(hash, item->name, strlen(item->name) + 1);
+		for (p = 0; p < SFPTPD_STATS_PERIOD_MAX; p++) {
+			period_size = item->ops->period_size(p);
+			hash = stats_persist_hash(hash, &period_size, sizeof period_size);
+			size += period_size;
+		}
+	}
+
+	*definition = hash;
+	return size;
+}
+
+
+/* Check whether a mapped persistent history file holds history that can be
+ * restored into the collection */
+static bool stats_persist_check(struct sfptpd_stats_collection *stats,
+				const char *path, uint64_t definition)
+{
+	const struct stats_persist_header *hdr;
+	const struct stats_persist_state *state;
+	struct sfptpd_timespec now, age;
+
+	hdr = (const struct stats_persist_header *)stats->arena->map;
+	state = stats_persist_get_state(stats->arena);
+
+	if (hdr->magic != STATS_PERSIST_MAGIC ||
+	    hdr->checksum != stats_persist_header_checksum(hdr)) {
+		INFO("stats %s: no saved history in %s\n", stats->name, path);
+		return false;
+	}
+
+	if (hdr->version != STATS_PERSIST_VERSION ||
+	    hdr->size != stats->arena->map_size ||
+	    hdr->definition != definition) {
+		NOTICE("stats %s: discarding saved history from a different definition of the statistics\n",
+		       stats->name);
+		return false;
+	}
+
+	if (state->checksum != stats_persist_state_checksum(state)) {
+		WARNING("stats %s: discarding saved history that was not completely written\n",
+			stats->name);
+		return false;
+	}
+
+	/* Discard history that was last saved more than a stats period ago:
+	 * the gap would leave the current intervals of the time periods
+	 * covering a time when no statistics were collected. */
+	sfclock_gettime(CLOCK_REALTIME, &now);
+	sfptpd_time_subtract(&age, &now, &state->saved_time);
+	if (age.sec < 0 ||
+	    sfptpd_time_timespec_to_float_s(&age) > SFPTPD_STATS_COLLECTION_INTERVAL) {
+		NOTICE("stats %s: discarding saved history that is out of date\n",
+		       stats->name);
+		return false;
+	}
+
+	return true;
+}
+
+
+int sfptpd_stats_collection_map(struct sfptpd_stats_collection *stats,
+				const char *path)
+{
+	struct sfptpd_stats_arena *arena;
+	struct stats_persist_header *hdr;
+	struct stats_persist_state *state;
 	struct sfptpd_stats_item *item;
-	struct sfptpd_stats_time_interval *interval;
+	enum sfptpd_stats_time_period p;
+	uint64_t definition;
+	struct sfptpd_timespec now, saved_time;
+	struct stat st;
+	size_t size;
+	unsigned int i;
+	void *map;
+	int fd;
+	int rc;
+
+	assert(stats != NULL);
+	assert(stats->arena != NULL);
+	assert(path != NULL);
+
+	arena = stats->arena;
+	assert(arena->map == NULL);
+
+	/* No period may have ended yet, so no history has been allocated */
+	assert(stats->intervals[SFPTPD_STATS_PERIOD_MINUTE][SFPTPD_STATS_HISTORY_CURRENT].seq_num == 0);
+
+	size = stats_persist_layout(stats, &definition);
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		rc = errno;
+		goto fail;
+	}
+	sfptpd_log_set_stats_history_owner(fd);
+
+	/* Start afresh with a file of the wrong size so that no stale data
+	 * is left in it */
+	if (fstat(fd, &st) != 0) {
+		rc = errno;
+		goto fail_close;
+	}
+	if (st.st_size != size &&
+	    (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+		rc = errno;
+		goto fail_close;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		rc = errno;
+		goto fail_close;
+	}
+	close(fd);
+
+	arena->map = map;
+	arena->map_size = size;
+	arena->map_used = STATS_PERSIST_DATA_OFFSET;
+	hdr = (struct stats_persist_header *)arena->map;
+	state = stats_persist_get_state(arena);
+
+	arena->restored = stats_persist_check(stats, path, definition);
+	if (!arena->restored) {
+		memset(arena->map, 0, size);
+		hdr->magic = STATS_PERSIST_MAGIC;
+		hdr->version = STATS_PERSIST_VERSION;
+		hdr->size = size;
+		hdr->definition = definition;
+		hdr->checksum = stats_persist_header_checksum(hdr);
+	}
+
+	/* Lay out the history of every item in the file */
+	for (i = 0; i < stats->capacity; i++) {
+		item = stats->items[i];
+		if (item == NULL)
+			continue;
+
+		for (p = 0; p < SFPTPD_STATS_PERIOD_MAX; p++)
+			item->ops->alloc_period(item, p);
+	}
+	assert(arena->map_used == size);
+
+	sfclock_gettime(CLOCK_REALTIME, &now);
+	if (arena->restored) {
+		memcpy(stats->elapsed, state->elapsed, sizeof stats->elapsed);
+		memcpy(stats->intervals, state->intervals, sizeof stats->intervals);
+
+		/* End the intervals that were in progress when the history was
+		 * saved at that time so that the next interval of each time
+		 * period starts now */
+		saved_time = state->saved_time;
+		state->checksum = 0;
+		for (p = 0; p < SFPTPD_STATS_PERIOD_MAX; p++) {
+			if (stats->elapsed[p] != 0)
+				stats_collection_end_interval(stats, p, &saved_time);
+			stats->intervals[p][SFPTPD_STATS_HISTORY_CURRENT].start_time = now;
+		}
+		INFO("stats %s: restored history from %s\n", stats->name, path);
+	}
+
+	stats_persist_save_state(stats, &now);
+	stats_arena_sync(arena);
+
+	return 0;
+
+fail_close:
+	close(fd);
+fail:
+	ERROR("stats %s: failed to map history file %s, %s\n",
+	      stats->name, path, strerror(rc));
+	return rc;
+}
+
+
+void sfptpd_stats_collection_persist(struct sfptpd_stats_collection *stats,
+				     struct sfptpd_clock *clock,
+				     const char *sync_instance_name)
+{
+	char path[PATH_MAX];
+
+	assert(stats != NULL);
+
+	if (sfptpd_log_get_stats_history_path(clock, sync_instance_name,
+					      path, sizeof path) == 0)
+		sfptpd_stats_collection_map(stats, path);
+}
+
+
+void sfptpd_stats_collection_end_period(struct sfptpd_stats_collection *stats,
+					struct sfptpd_timespec *time)
+{
+	enum sfptpd_stats_time_period p;
 
 	assert(stats != NULL);
 	assert(time != NULL);
 
+	/* Mark persistent history as inconsistent while it is updated */
+	if (stats->arena->map != NULL)
+		stats_persist_get_state(stats->arena)->checksum = 0;
+
 	/* For each statistics time period... */
 	for (p = 0; p < sizeof(stats->intervals)/sizeof(stats->intervals[0]); p++) {
-		interval = &stats->intervals[p][SFPTPD_STATS_HISTORY_CURRENT];
-
 		/* Update the seconds elapsed for this time period and check
 		 * whether the time period has finished */
 		stats->elapsed[p] += SFPTPD_STATS_COLLECTION_INTERVAL;
-		if (stats->elapsed[p] >= sfptpd_stats_periods[p].length) {
-			/* Store the end time of the period and mark the period
-			 * as complete. Shift along the previous results for the
-			 * period. This causes us to discard the oldest data
-			 * for this time period */
-			interval->end_valid = true;
-			interval->end_time = *time;
-
-			/* Free each item in the collection, call end period
-			 * indicating which period has ended */
-			for (i = 0; i < stats->capacity; i++) {
-				item = stats->items[i];
-				if (item != NULL)
-					item->ops->end_period(item, p);
-			}
+		if (stats->elapsed[p] >= sfptpd_stats_periods[p].length)
+			stats_collection_end_interval(stats, p, time);
+	}
 
-			memmove(&stats->intervals[p][SFPTPD_STATS_HISTORY_1],
-				&stats->intervals[p][SFPTPD_STATS_HISTORY_CURRENT],
-				sizeof(stats->intervals[0]) - sizeof(stats->intervals[0][0]));
-
-			/* Set up the next period */
-			stats->elapsed[p] = 0;
-			interval->seq_num++;
-			interval->start_valid = true;
-			interval->start_time = *time;
-			interval->end_valid = false;
-			interval->end_time = zero_time;
-		}
+	/* Mark persistent history as consistent again and write it out */
+	if (stats->arena->map != NULL) {
+		stats_persist_save_state(stats, time);
+		stats_arena_sync(stats->arena);
 	}
 }
 
@@ -1256,6 +2745,24 @@ int sfptpd_stats_collection_get_count(struct sfptpd_stats_collection *stats,
 }
 
 
+int sfptpd_stats_collection_get_quantiles(struct sfptpd_stats_collection *stats,
+					  unsigned int index,
+					  enum sfptpd_stats_time_period period,
+					  enum sfptpd_stats_history_index instance,
+					  long double *values,
+					  unsigned long *num_samples)
+{
+	int rc;
+
+	rc = stats_collection_type_check(stats, index, SFPTPD_STATS_TYPE_QUANTILE);
+	if (rc != 0)
+		return rc;
+
+	return sfptpd_stats_collection_get(stats, index, period, instance,
+					   values, num_samples);
+}
+
+
 int sfptpd_stats_collection_get_interval(struct sfptpd_stats_collection *stats,
 					 enum sfptpd_stats_time_period period,
 					 enum sfptpd_stats_history_index instance,
@@ -1275,6 +2782,53 @@ int sfptpd_stats_collection_get_interval(struct sfptpd_stats_collection *stats,
 }
 
 
+void sfptpd_stats_collections_write_metrics(struct sfptpd_stats_collection *const *collections,
+					    const char *const *labels,
+					    unsigned int num,
+					    struct sfptpd_json_buf *buf,
+					    const char *prefix)
+{
+	struct sfptpd_stats_item **items;
+	struct sfptpd_stats_item *first;
+	unsigned int id, i;
+
+	assert(collections != NULL);
+	assert(labels != NULL);
+	assert(buf != NULL);
+
+	if (num == 0)
+		return;
+
+	items = calloc(num, sizeof *items);
+	if (items == NULL)
+		return;
+
+	/* The collections are expected to share a definition but tolerate
+	 * items missing from some of them. */
+	for (id = 0; id < collections[0]->capacity; id++) {
+		first = collections[0]->items[id];
+		if (first == NULL || first->ops->write_metrics == NULL)
+			continue;
+
+		for (i = 0; i < num; i++) {
+			struct sfptpd_stats_item *item = NULL;
+
+			if (id < collections[i]->capacity)
+				item = collections[i]->items[id];
+			if (item != NULL &&
+			    (item->type != first->type ||
+			     strcmp(item->name, first->name) != 0))
+				item = NULL;
+			items[i] = item;
+		}
+
+		first->ops->write_metrics(items, labels, num, buf, prefix);
+	}
+
+	free(items);
+}
+
+
 void sfptpd_stats_collection_dump(struct sfptpd_stats_collection *stats,
 				  struct sfptpd_clock *clock,
 				  const char *sync_instance_name)
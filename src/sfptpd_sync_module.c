@@ -13,6 +13,7 @@
 #include <stdlib.h>
 
 #include "sfptpd_logging.h"
+#include "sfptpd_json.h"
 #include "sfptpd_thread.h"
 #include "sfptpd_message.h"
 #include "sfptpd_config.h"
@@ -263,6 +264,22 @@ size_t sfptpd_sync_module_alarms_stream(FILE *stream,
 }
 
 
+void sfptpd_sync_module_alarms_json(struct sfptpd_json_buf *buf,
+	sfptpd_sync_module_alarms_t alarms, const char *separator)
+{
+	int i;
+	const char *sep = "";
+
+	for (i = 0; i < sizeof(alarm_texts)/sizeof(alarm_texts[0]); i++) {
+		if (alarms & alarm_texts[i].bitmask) {
+			sfptpd_json_text(buf, sep);
+			sfptpd_json_string(buf, alarm_texts[i].text);
+			sep = separator;
+		}
+	}
+}
+
+
 void sfptpd_sync_module_alarms_text(sfptpd_sync_module_alarms_t alarms,
 				    char *buffer, unsigned int buffer_size)
 {
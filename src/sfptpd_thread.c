@@ -184,6 +184,11 @@ struct sfptpd_thread
 
 	/* Timers */
 	struct sfptpd_timer *timer_list;
+
+	/* Whether to return from creating a child thread without waiting
+	 * for it to start up and the number of startups still awaited */
+	bool defer_child_startup;
+	unsigned int child_startups_pending;
 };
 
 
@@ -1632,25 +1637,31 @@ static int thread_create(const char *name, const struct sfptpd_thread_ops *ops,
 			 program_invocation_short_name, name);
 		pthread_setname_np(new->pthread, thread_name);
 
-		/* Wait for the response from the thread to indicate that
-		 * startup is complete. */
-		rc = queue_receive(&self->queue_wait_reply, &hdr, true);
-
-		/* If the response isn't the message we were expecting, something
-		 * is horribly wrong. */
-		assert((void *)hdr == (void *)msg);
-
-		/* Assuming the receive operation worked (likely) then get the
-		 * thread startup code from the reply. If this is non-zero then
-		 * the thread failed during startup - a critical error. */
-		if (rc == 0)
-			rc = msg->status_code;
-
-		if (rc != 0) {
-			DBG_L2("thread %s failed during startup, %s\n",
-			       name, strerror(rc));
-			(void)thread_destroy(new);
-			return rc;
+		if (self->defer_child_startup) {
+			/* The startup status is collected later by
+			 * sfptpd_thread_await_startup() */
+			self->child_startups_pending++;
+		} else {
+			/* Wait for the response from the thread to indicate that
+			 * startup is complete. */
+			rc = queue_receive(&self->queue_wait_reply, &hdr, true);
+
+			/* If the response isn't the message we were expecting, something
+			 * is horribly wrong. */
+			assert((void *)hdr == (void *)msg);
+
+			/* Assuming the receive operation worked (likely) then get the
+			 * thread startup code from the reply. If this is non-zero then
+			 * the thread failed during startup - a critical error. */
+			if (rc == 0)
+				rc = msg->status_code;
+
+			if (rc != 0) {
+				DBG_L2("thread %s failed during startup, %s\n",
+				       name, strerror(rc));
+				(void)thread_destroy(new);
+				return rc;
+			}
 		}
 	}
 
@@ -1813,6 +1824,54 @@ int sfptpd_thread_create(const char *name, const struct sfptpd_thread_ops *ops,
 }
 
 
+void sfptpd_thread_defer_startup(void)
+{
+	struct sfptpd_thread *self = sfptpd_thread_self();
+
+	assert(self->child_startups_pending == 0);
+
+	self->defer_child_startup = true;
+}
+
+
+int sfptpd_thread_await_startup(void)
+{
+	struct sfptpd_thread *self = sfptpd_thread_self();
+	sfptpd_msg_thread_startup_status_t *msg;
+	sfptpd_msg_hdr_t *hdr;
+	int status;
+	int rc = 0;
+
+	self->defer_child_startup = false;
+
+	/* Collect the startup status of each child in whatever order the
+	 * children finish starting up */
+	while (self->child_startups_pending > 0) {
+		status = queue_receive(&self->queue_wait_reply, &hdr, true);
+		if (status == 0) {
+			assert(sfptpd_msg_get_id(hdr) == SFPTPD_MSG_ID_THREAD_STARTUP_STATUS);
+			msg = (sfptpd_msg_thread_startup_status_t *) hdr;
+			status = msg->status_code;
+			if (status != 0) {
+				DBG_L2("thread %s failed during startup, %s\n",
+				       msg->thread->name, strerror(status));
+
+				/* The creator has already returned so cannot
+				 * release the thread's context itself */
+				if (msg->thread->ops.on_startup_failed != NULL)
+					msg->thread->ops.on_startup_failed(msg->thread->user_context);
+			}
+		}
+
+		if (rc == 0)
+			rc = status;
+		self->child_startups_pending--;
+	}
+
+	return rc;
+}
+
+
 int sfptpd_thread_destroy(struct sfptpd_thread *thread)
 {
 	/* Destroy the child thread */
@@ -18,7 +18,10 @@ INCDIRS += -I$(d)/../src/include -I$(d)/../src/ptp/ptpd2  -I$(d)/../src/ptp/ptpd
 EXEC_SRCS_$(d) := sfptpd_test.c sfptpd_test_config.c sfptpd_test_ht.c \
 		  sfptpd_test_stats.c sfptpd_test_filters.c sfptpd_test_threading.c \
 		  sfptpd_test_bic.c sfptpd_test_fmds.c sfptpd_test_link.c \
-		  sfptpd_test_time.c
+		  sfptpd_test_time.c sfptpd_test_logging.c \
+		  sfptpd_test_json.c sfptpd_test_db.c \
+		  sfptpd_test_crny.c sfptpd_test_metrics.c \
+		  sfptpd_test_interface.c
 
 EXEC_$(d) := sfptpd_test
 
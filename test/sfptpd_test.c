@@ -136,6 +136,12 @@ int main(int argc, char **argv)
 	register_unit_test("fmds", sfptpd_test_fmds);
 	register_unit_test("link", sfptpd_test_link);
 	register_unit_test("time", sfptpd_test_time);
+	register_unit_test("logging", sfptpd_test_logging);
+	register_unit_test("json", sfptpd_test_json);
+	register_unit_test("db", sfptpd_test_db);
+	register_unit_test("crny", sfptpd_test_crny);
+	register_unit_test("metrics", sfptpd_test_metrics);
+	register_unit_test("interface", sfptpd_test_interface);
 
 	/* Get default seed */
 	gettimeofday(&tod, NULL);
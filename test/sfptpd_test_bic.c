@@ -7,6 +7,7 @@
  */
 #include <math.h>
 #include <errno.h>
+#include <stdlib.h>
 #include "sfptpd_bic.h"
 
 /****************************************************************************
@@ -19,6 +20,10 @@
 
 #define	ARRAY_SIZE(a)	(sizeof (a) / sizeof (a [0]))
 
+/* Number of instances and status changes in the incremental ranking test */
+#define RANKING_INSTANCES	(12)
+#define RANKING_CHANGES		(5000)
+
 /****************************************************************************
  * Local Data
  ****************************************************************************/
@@ -573,6 +578,96 @@ int test_select (char *name, struct sync_instance_record *statuses, size_t num_t
 	return !passed;
 }
 
+/* Give an instance a random status from small sets of values so that
+   most rules are frequently tied */
+static void random_status (struct sync_instance_record *record)
+{
+	static const long double accuracies [] = { 0.0, 1.0, 1.5, INFINITY };
+	static const long double variances [] = { 1.0E-18, 1.0E-18 + 1.0E-34, 2.0E-18, INFINITY };
+	struct sfptpd_sync_instance_status *status = &record->status;
+
+	status->state = rand () % SYNC_MODULE_STATE_MAX;
+	status->alarms = rand () % 4 == 0 ? SYNC_MODULE_ALARM_PPS_NO_SIGNAL : 0;
+	status->constraints = rand () % SYNC_MODULE_CONSTRAINT_MAX;
+	status->user_priority = rand () % 3;
+	status->clustering_score = rand () % 2;
+	status->master.clock_class = rand () % SFPTPD_CLOCK_CLASS_MAX;
+	status->master.accuracy = accuracies [rand () % ARRAY_SIZE (accuracies)];
+	status->local_accuracy = accuracies [rand () % ARRAY_SIZE (accuracies)];
+	status->master.allan_variance = variances [rand () % ARRAY_SIZE (variances)];
+	status->master.steps_removed = rand () % 3;
+}
+
+/* Check that the incremental ranking agrees with sorting the instances
+   afresh after each status change. The best instance from the ranking is
+   passed as the old candidate so that the ranks are only logged if the
+   two disagree. */
+int test_ranking (void)
+{
+	static char names [RANKING_INSTANCES][8];
+	struct sync_instance_record records [RANKING_INSTANCES] = {};
+	struct sync_instance_record *best = NULL, *expected;
+	struct sfptpd_bic_ranking *ranking;
+	int ranks [RANKING_INSTANCES];
+	int i, change, failures = 0;
+
+	srand (1);
+	for (i = 0; i < RANKING_INSTANCES; i++) {
+		snprintf (names [i], sizeof names [i], "I%d", i);
+		records [i].info.name = names [i];
+		random_status (&records [i]);
+	}
+
+	ranking = sfptpd_bic_ranking_create (&sfptpd_default_selection_policy,
+					     records, RANKING_INSTANCES);
+	if (ranking == NULL)
+		return 1;
+
+	for (change = 0; change < RANKING_CHANGES && failures == 0; change++) {
+		i = rand () % RANKING_INSTANCES;
+		if (rand () % 50 == 0) {
+			sfptpd_bic_select_instance (records, RANKING_INSTANCES,
+						    rand () % 2 ? &records [i] : NULL);
+			sfptpd_bic_ranking_update_all (ranking);
+		} else {
+			random_status (&records [i]);
+			sfptpd_bic_ranking_update (ranking, &records [i]);
+		}
+
+		for (i = 0; i < RANKING_INSTANCES; i++) {
+			ranks [i] = records [i].rank;
+			if (ranks [i] == 1)
+				best = &records [i];
+		}
+
+		if (sfptpd_bic_ranking_choose (ranking, best) != best) {
+			printf ("change %d: ranking did not choose its first instance\n",
+				change);
+			failures++;
+		}
+
+		expected = sfptpd_bic_choose (&sfptpd_default_selection_policy,
+					      records, RANKING_INSTANCES, best);
+		if (best != expected) {
+			printf ("change %d: ranking chose %s, sorting chose %s\n",
+				change, best->info.name, expected->info.name);
+			failures++;
+		}
+		for (i = 0; i < RANKING_INSTANCES; i++) {
+			if (ranks [i] != records [i].rank) {
+				printf ("change %d: ranking put %s at %d, sorting at %d\n",
+					change, records [i].info.name, ranks [i], records [i].rank);
+				failures++;
+			}
+		}
+	}
+
+	sfptpd_bic_ranking_free (ranking);
+
+	printf ("RANKING %s: %d changes\n", failures == 0 ? "PASS" : "FAIL", change);
+	return failures != 0;
+}
+
 /****************************************************************************
  * Entry Point
  ****************************************************************************/
@@ -602,6 +697,8 @@ int sfptpd_test_bic (void)
 
 	rc += test_select ("PTP and NTP", ptp_ntp, ARRAY_SIZE(ptp_ntp), 0);
 
+	rc += test_ranking ();
+
 	return rc == 0 ? 0 : EINVAL;
 }
 
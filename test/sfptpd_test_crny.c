@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_test_crny.c
+ * @brief  Chrony SOCK refclock sample unit test
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "sfptpd_crny_refclock.h"
+#include "sfptpd_test.h"
+
+
+/****************************************************************************
+ * Types and Constants
+ ****************************************************************************/
+
+struct sample_test {
+	const char *desc;
+	enum sfptpd_chrony_refclock_offset offset_source;
+	enum sfptpd_chrony_refclock_leap leap_config;
+	enum sfptpd_leap_second_type leap_second;
+	long long diff_ns;
+	long long offset_from_master_ns;
+	double offset;
+	int leap;
+};
+
+/* System time of each comparison, with a part below a microsecond that
+ * must be truncated without affecting the offset */
+#define T_SYS_SEC (1700000000)
+#define T_SYS_NSEC (123456789)
+
+static const struct sample_test tests[] = {
+	{ "clock ahead of system",
+	  SFPTPD_CHRONY_REFCLOCK_OFFSET_CLOCK, SFPTPD_CHRONY_REFCLOCK_LEAP_AUTO,
+	  SFPTPD_LEAP_SECOND_NONE, 1500, 700, 1.5e-6, SFPTPD_CRNY_SOCK_LEAP_NORMAL },
+	{ "clock behind system",
+	  SFPTPD_CHRONY_REFCLOCK_OFFSET_CLOCK, SFPTPD_CHRONY_REFCLOCK_LEAP_AUTO,
+	  SFPTPD_LEAP_SECOND_NONE, -2000250, 0, -2.00025e-3, SFPTPD_CRNY_SOCK_LEAP_NORMAL },
+	{ "master from clock ahead of master",
+	  SFPTPD_CHRONY_REFCLOCK_OFFSET_MASTER, SFPTPD_CHRONY_REFCLOCK_LEAP_AUTO,
+	  SFPTPD_LEAP_SECOND_NONE, 1500, 700, 8e-7, SFPTPD_CRNY_SOCK_LEAP_NORMAL },
+	{ "master from clock behind master",
+	  SFPTPD_CHRONY_REFCLOCK_OFFSET_MASTER, SFPTPD_CHRONY_REFCLOCK_LEAP_AUTO,
+	  SFPTPD_LEAP_SECOND_NONE, -1000, -3000, 2e-6, SFPTPD_CRNY_SOCK_LEAP_NORMAL },
+	{ "leap second insertion",
+	  SFPTPD_CHRONY_REFCLOCK_OFFSET_CLOCK, SFPTPD_CHRONY_REFCLOCK_LEAP_AUTO,
+	  SFPTPD_LEAP_SECOND_61, 0, 0, 0.0, SFPTPD_CRNY_SOCK_LEAP_INSERT },
+	{ "leap second deletion",
+	  SFPTPD_CHRONY_REFCLOCK_OFFSET_CLOCK, SFPTPD_CHRONY_REFCLOCK_LEAP_AUTO,
+	  SFPTPD_LEAP_SECOND_59, 0, 0, 0.0, SFPTPD_CRNY_SOCK_LEAP_DELETE },
+	{ "leap second not indicated",
+	  SFPTPD_CHRONY_REFCLOCK_OFFSET_CLOCK, SFPTPD_CHRONY_REFCLOCK_LEAP_NONE,
+	  SFPTPD_LEAP_SECOND_61, 0, 0, 0.0, SFPTPD_CRNY_SOCK_LEAP_NORMAL },
+};
+
+
+/****************************************************************************
+ * Local Functions
+ ****************************************************************************/
+
+static bool run_sample_test(const struct sample_test *test)
+{
+	struct sfptpd_config_chrony_refclock config;
+	struct sfptpd_crny_sock_sample sample;
+	struct sfptpd_timespec diff, t_sys, offset_from_master;
+	bool success = true;
+
+	memset(&config, 0, sizeof config);
+	config.offset = test->offset_source;
+	config.leap = test->leap_config;
+
+	sfptpd_time_from_ns(&diff, test->diff_ns);
+	sfptpd_time_from_ns(&offset_from_master, test->offset_from_master_ns);
+	sfptpd_time_init(&t_sys, T_SYS_SEC, T_SYS_NSEC, 0x8000);
+
+	sfptpd_crny_refclock_sample(&config, &diff, &t_sys, &offset_from_master,
+				    test->leap_second, &sample);
+
+	if (sample.tv.tv_sec != T_SYS_SEC || sample.tv.tv_usec != T_SYS_NSEC / 1000) {
+		printf("ERROR: %s: time %ld.%06ld, expected %d.%06d\n",
+		       test->desc, (long) sample.tv.tv_sec, (long) sample.tv.tv_usec,
+		       T_SYS_SEC, T_SYS_NSEC / 1000);
+		success = false;
+	}
+	if (fabs(sample.offset - test->offset) > 1e-12) {
+		printf("ERROR: %s: offset %0.12f, expected %0.12f\n",
+		       test->desc, sample.offset, test->offset);
+		success = false;
+	}
+	if (sample.leap != test->leap) {
+		printf("ERROR: %s: leap %d, expected %d\n",
+		       test->desc, sample.leap, test->leap);
+		success = false;
+	}
+	if (sample.pulse != 0 || sample._pad != 0 ||
+	    sample.magic != SFPTPD_CRNY_SOCK_MAGIC) {
+		printf("ERROR: %s: bad sample framing\n", test->desc);
+		success = false;
+	}
+
+	return success;
+}
+
+
+/****************************************************************************
+ * Entry Point
+ ****************************************************************************/
+
+int sfptpd_test_crny(void)
+{
+	const int n_tests = sizeof tests / sizeof tests[0];
+	int failures = 0;
+	int i;
+
+	for (i = 0; i < n_tests; i++) {
+		if (!run_sample_test(&tests[i]))
+			failures++;
+	}
+
+	if (failures != 0) {
+		printf("chrony refclock samples: %d out of %d unit tests failed\n",
+		       failures, n_tests);
+		return ERANGE;
+	}
+	return 0;
+}
+
+
+/* fin */
@@ -0,0 +1,613 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_test_db.c
+ * @brief  Database unit test and index benchmark
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "sfptpd_db.h"
+#include "sfptpd_test.h"
+
+
+/****************************************************************************
+ * Types and Defines
+ ****************************************************************************/
+
+/* Number of records in the benchmark tables */
+#define BENCH_RECORDS (10000)
+
+/* Number of groups into which the records are divided */
+#define BENCH_GROUPS (100)
+
+/* A prime used to scatter sequence numbers over the records */
+#define BENCH_SCATTER (7919)
+
+/* Number of records in the cursor test tables. Unindexed ordered cursors
+ * scan the table for each record so this is kept small. */
+#define CURSOR_RECORDS (500)
+
+/* Number of reader threads and of records replaced by the writer in the
+ * concurrency test */
+#define CONCURRENT_READERS (4)
+#define CONCURRENT_WRITES (5000)
+
+/* Number of records whose contents each reader checks when closing */
+#define CONCURRENT_CHECKED (8)
+
+struct test_record {
+	int id;
+	int group;
+	int seq;
+};
+
+/* State shared by the threads of the concurrency test. Opening and
+ * advancing cursors is serialised with changes to the table by the walk
+ * lock, held shared by readers, but cursors stay open across changes and
+ * are closed without it. */
+struct concurrent_test {
+	struct sfptpd_db_table *table;
+	pthread_rwlock_t walk_lock;
+	bool writer_done;
+	bool failed;
+	unsigned long walks;
+};
+
+enum test_fields {
+	TEST_FIELD_ID,
+	TEST_FIELD_GROUP,
+	TEST_FIELD_SEQ,
+	TEST_FIELD_MAX
+};
+
+
+/****************************************************************************
+ * Table definitions
+ ****************************************************************************/
+
+static int test_compare_id(const void *key, const void *record)
+{
+	return *((int *) key) - ((struct test_record *) record)->id;
+}
+
+static int test_compare_group(const void *key, const void *record)
+{
+	return *((int *) key) - ((struct test_record *) record)->group;
+}
+
+static int test_compare_seq(const void *key, const void *record)
+{
+	return *((int *) key) - ((struct test_record *) record)->seq;
+}
+
+SFPTPD_DB_SORT_FN(test_compare_id, struct test_record, rec, &rec->id)
+SFPTPD_DB_SORT_FN(test_compare_group, struct test_record, rec, &rec->group)
+SFPTPD_DB_SORT_FN(test_compare_seq, struct test_record, rec, &rec->seq)
+SFPTPD_DB_HASH_FN(test_compare_id, struct test_record, rec, &rec->id, sizeof(int))
+
+static struct sfptpd_db_field indexed_fields[] = {
+	SFPTPD_DB_FIELD_HASHED("id", TEST_FIELD_ID, test_compare_id, NULL)
+	SFPTPD_DB_FIELD("group", TEST_FIELD_GROUP, test_compare_group, NULL)
+	SFPTPD_DB_FIELD_ORDERED("seq", TEST_FIELD_SEQ, test_compare_seq, NULL)
+};
+
+static struct sfptpd_db_field plain_fields[] = {
+	SFPTPD_DB_FIELD("id", TEST_FIELD_ID, test_compare_id, NULL)
+	SFPTPD_DB_FIELD("group", TEST_FIELD_GROUP, test_compare_group, NULL)
+	SFPTPD_DB_FIELD("seq", TEST_FIELD_SEQ, test_compare_seq, NULL)
+};
+
+static struct sfptpd_db_table_def indexed_table_def = {
+	.num_fields = TEST_FIELD_MAX,
+	.fields = indexed_fields,
+	.record_size = sizeof(struct test_record),
+};
+
+static struct sfptpd_db_table_def plain_table_def = {
+	.num_fields = TEST_FIELD_MAX,
+	.fields = plain_fields,
+	.record_size = sizeof(struct test_record),
+};
+
+
+/****************************************************************************
+ * Local Functions
+ ****************************************************************************/
+
+static long double elapsed_ms(const struct timespec *start,
+			      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1.0E3L +
+		(end->tv_nsec - start->tv_nsec) / 1.0E6L;
+}
+
+
+/* Find every record by id, returning false if any is not found correctly */
+static bool find_all(struct sfptpd_db_table *table, long double *ms)
+{
+	struct sfptpd_db_record_ref ref;
+	struct test_record record;
+	struct timespec start, end;
+	bool success = true;
+	int id;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (id = 0; id < BENCH_RECORDS; id++) {
+		ref = sfptpd_db_table_find(table, TEST_FIELD_ID, &id);
+		if (!sfptpd_db_record_exists(&ref)) {
+			success = false;
+			continue;
+		}
+		sfptpd_db_record_get_data(&ref, &record, sizeof record);
+		if (record.id != id)
+			success = false;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*ms = elapsed_ms(&start, &end);
+	return success;
+}
+
+
+/* Compare the results of the same query on two tables */
+static bool results_match(struct sfptpd_db_query_result *a,
+			  struct sfptpd_db_query_result *b,
+			  const char *what)
+{
+	int i;
+
+	if (a->num_records != b->num_records) {
+		printf("ERROR: %s: %d records with indexes, %d without\n",
+		       what, a->num_records, b->num_records);
+		return false;
+	}
+
+	for (i = 0; i < a->num_records; i++) {
+		if (memcmp(a->record_ptrs[i], b->record_ptrs[i],
+			   sizeof(struct test_record)) != 0) {
+			printf("ERROR: %s: record %d differs\n", what, i);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static bool results_ordered(struct sfptpd_db_query_result *result,
+			    const char *what)
+{
+	const struct test_record *prev, *rec;
+	int i;
+
+	for (i = 1; i < result->num_records; i++) {
+		prev = result->record_ptrs[i - 1];
+		rec = result->record_ptrs[i];
+		if (prev->seq > rec->seq) {
+			printf("ERROR: %s: record %d out of order\n", what, i);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/* Populate a table with and a table without indexes, check they give the
+ * same results through inserts, updates and deletes and compare the time
+ * taken to find records */
+static bool test_indexes(void)
+{
+	struct sfptpd_db_table *tables[2];
+	struct sfptpd_db_query_result results[2];
+	struct sfptpd_db_record_ref ref;
+	struct test_record record;
+	struct timespec start, end;
+	long double insert_ms[2], find_ms[2], query_ms[2];
+	bool success = true;
+	int group;
+	int i, t;
+
+	tables[0] = sfptpd_db_table_new(&indexed_table_def, STORE_DEFAULT);
+	tables[1] = sfptpd_db_table_new(&plain_table_def, STORE_DEFAULT);
+
+	/* Insert records with sequence numbers out of order */
+	for (t = 0; t < 2; t++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < BENCH_RECORDS; i++) {
+			record.id = i;
+			record.group = i % BENCH_GROUPS;
+			record.seq = (i * BENCH_SCATTER) % BENCH_RECORDS;
+			sfptpd_db_table_insert(tables[t], &record);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		insert_ms[t] = elapsed_ms(&start, &end);
+	}
+
+	for (t = 0; t < 2; t++) {
+		if (!find_all(tables[t], &find_ms[t])) {
+			printf("ERROR: records not found %s indexes\n",
+			       t == 0 ? "with" : "without");
+			success = false;
+		}
+	}
+
+	for (t = 0; t < 2; t++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		results[t] = sfptpd_db_table_query(tables[t],
+						   SFPTPD_DB_SEL_ORDER_BY,
+						   TEST_FIELD_SEQ);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		query_ms[t] = elapsed_ms(&start, &end);
+	}
+	success &= results_match(&results[0], &results[1], "ordered query");
+	success &= results_ordered(&results[0], "ordered query");
+	for (t = 0; t < 2; t++)
+		results[t].free(&results[t]);
+
+	printf("db: %d records inserted in %0.3Lf ms with indexes, %0.3Lf ms without\n",
+	       BENCH_RECORDS, insert_ms[0], insert_ms[1]);
+	printf("db: %d records found by key in %0.3Lf ms with indexes, %0.3Lf ms without\n",
+	       BENCH_RECORDS, find_ms[0], find_ms[1]);
+	printf("db: %d records queried in order in %0.3Lf ms with indexes, %0.3Lf ms without\n",
+	       BENCH_RECORDS, query_ms[0], query_ms[1]);
+
+	/* Move every tenth record to another group and renumber it */
+	for (t = 0; t < 2; t++) {
+		for (i = 0; i < BENCH_RECORDS; i += 10) {
+			ref = sfptpd_db_table_find(tables[t], TEST_FIELD_ID, &i);
+			sfptpd_db_record_get_data(&ref, &record, sizeof record);
+			record.id = i + BENCH_RECORDS;
+			record.group = (record.group + 1) % BENCH_GROUPS;
+			record.seq = BENCH_RECORDS - record.seq;
+			sfptpd_db_record_update(&ref, &record);
+		}
+	}
+
+	i = 10;
+	ref = sfptpd_db_table_find(tables[0], TEST_FIELD_ID, &i);
+	if (sfptpd_db_record_exists(&ref)) {
+		printf("ERROR: record found by key before update\n");
+		success = false;
+	}
+	i = 10 + BENCH_RECORDS;
+	ref = sfptpd_db_table_find(tables[0], TEST_FIELD_ID, &i);
+	if (!sfptpd_db_record_exists(&ref)) {
+		printf("ERROR: record not found by key after update\n");
+		success = false;
+	}
+
+	/* Delete one group and check the rest */
+	group = 5;
+	for (t = 0; t < 2; t++)
+		sfptpd_db_table_delete(tables[t], TEST_FIELD_GROUP, &group);
+
+	for (group = 0; group < BENCH_GROUPS; group += 7) {
+		for (t = 0; t < 2; t++)
+			results[t] = sfptpd_db_table_query(tables[t],
+							   TEST_FIELD_GROUP, &group,
+							   SFPTPD_DB_SEL_ORDER_BY,
+							   TEST_FIELD_SEQ);
+		success &= results_match(&results[0], &results[1], "group query");
+		success &= results_ordered(&results[0], "group query");
+		if (group == 5 && results[0].num_records != 0) {
+			printf("ERROR: deleted records still present\n");
+			success = false;
+		}
+		for (t = 0; t < 2; t++)
+			results[t].free(&results[t]);
+	}
+
+	for (i = 0; i < 2 * BENCH_RECORDS; i += 997) {
+		if (sfptpd_db_table_count(tables[0], TEST_FIELD_ID, &i) !=
+		    sfptpd_db_table_count(tables[1], TEST_FIELD_ID, &i)) {
+			printf("ERROR: count of id %d differs\n", i);
+			success = false;
+		}
+	}
+
+	for (t = 0; t < 2; t++)
+		sfptpd_db_table_free(tables[t]);
+
+	return success;
+}
+
+
+static void populate(struct sfptpd_db_table *table, int num_records)
+{
+	struct test_record record;
+	int i;
+
+	for (i = 0; i < num_records; i++) {
+		record.id = i;
+		record.group = i % BENCH_GROUPS;
+		record.seq = (i * BENCH_SCATTER) % num_records;
+		sfptpd_db_table_insert(table, &record);
+	}
+}
+
+
+/* Check that cursors visit the same records in the same order through an
+ * index as by scanning, and that a cursor stays valid while the records it
+ * walks are deleted and others inserted */
+static bool test_cursors(enum sfptpd_db_store_type store)
+{
+	struct sfptpd_db_table *indexed, *plain;
+	struct sfptpd_db_cursor cursors[2];
+	struct test_record *records[2];
+	struct test_record copy;
+	bool deleted[CURSOR_RECORDS] = { false };
+	bool visited[CURSOR_RECORDS] = { false };
+	bool success = true;
+	int count;
+	int last;
+	int i;
+
+	indexed = sfptpd_db_table_new(&indexed_table_def, store);
+	plain = sfptpd_db_table_new(&plain_table_def, store);
+	populate(indexed, CURSOR_RECORDS);
+	populate(plain, CURSOR_RECORDS);
+
+	/* Ordered through an index and by scanning */
+	sfptpd_db_cursor_open(&cursors[0], indexed,
+			      SFPTPD_DB_SEL_ORDER_BY, TEST_FIELD_SEQ);
+	sfptpd_db_cursor_open(&cursors[1], plain,
+			      SFPTPD_DB_SEL_ORDER_BY, TEST_FIELD_SEQ);
+	for (count = 0, last = -1; true; count++) {
+		records[0] = sfptpd_db_cursor_next(&cursors[0]);
+		records[1] = sfptpd_db_cursor_next(&cursors[1]);
+		if (records[0] == NULL || records[1] == NULL)
+			break;
+		if (memcmp(records[0], records[1], sizeof *records[0]) != 0 ||
+		    records[0]->seq <= last) {
+			printf("ERROR: cursor record %d differs or out of order\n", count);
+			success = false;
+			break;
+		}
+		last = records[0]->seq;
+	}
+	if (records[0] != NULL || records[1] != NULL || count != CURSOR_RECORDS) {
+		printf("ERROR: cursors visited %d records, expected %d\n",
+		       count, CURSOR_RECORDS);
+		success = false;
+	}
+	sfptpd_db_cursor_close(&cursors[0]);
+	sfptpd_db_cursor_close(&cursors[1]);
+
+	/* Filtered through a hash index */
+	for (i = 0; i < CURSOR_RECORDS; i += 37) {
+		sfptpd_db_cursor_open(&cursors[0], indexed, TEST_FIELD_ID, &i);
+		for (count = 0; (records[0] = sfptpd_db_cursor_next(&cursors[0])) != NULL; count++) {
+			if (records[0]->id != i)
+				success = false;
+		}
+		sfptpd_db_cursor_close(&cursors[0]);
+		if (count != 1) {
+			printf("ERROR: cursor found %d records with id %d\n", count, i);
+			success = false;
+		}
+	}
+
+	/* Replace each record with a new one as it is visited in order */
+	sfptpd_db_cursor_open(&cursors[0], indexed,
+			      SFPTPD_DB_SEL_ORDER_BY, TEST_FIELD_SEQ);
+	for (count = 0, last = -1;
+	     (records[0] = sfptpd_db_cursor_next(&cursors[0])) != NULL;
+	     count++) {
+		if (records[0]->seq <= last || records[0]->id >= CURSOR_RECORDS) {
+			printf("ERROR: cursor visited unexpected record %d\n", records[0]->id);
+			success = false;
+			break;
+		}
+		last = records[0]->seq;
+		copy = *records[0];
+		sfptpd_db_table_delete(indexed, TEST_FIELD_ID, &copy.id);
+		if (memcmp(&copy, records[0], sizeof copy) != 0) {
+			printf("ERROR: deleted record reclaimed while cursor open\n");
+			success = false;
+		}
+		copy.id += CURSOR_RECORDS;
+		copy.seq += CURSOR_RECORDS;
+		sfptpd_db_table_insert(indexed, &copy);
+	}
+	sfptpd_db_cursor_close(&cursors[0]);
+	if (count != CURSOR_RECORDS) {
+		printf("ERROR: modified cursor visited %d records, expected %d\n",
+		       count, CURSOR_RECORDS);
+		success = false;
+	}
+	i = CURSOR_RECORDS - 1;
+	if (sfptpd_db_table_count(indexed) != CURSOR_RECORDS ||
+	    sfptpd_db_table_count(indexed, TEST_FIELD_ID, &i) != 0) {
+		printf("ERROR: records not replaced\n");
+		success = false;
+	}
+
+	/* Delete records ahead of a scan */
+	sfptpd_db_cursor_open(&cursors[1], plain);
+	while ((records[1] = sfptpd_db_cursor_next(&cursors[1])) != NULL) {
+		i = records[1]->id;
+		if (deleted[i]) {
+			printf("ERROR: cursor visited deleted record %d\n", i);
+			success = false;
+		}
+		visited[i] = true;
+		if (++i < CURSOR_RECORDS) {
+			sfptpd_db_table_delete(plain, TEST_FIELD_ID, &i);
+			deleted[i] = true;
+		}
+	}
+	sfptpd_db_cursor_close(&cursors[1]);
+	for (i = 0, count = 0; i < CURSOR_RECORDS; i++) {
+		if (!visited[i] && !deleted[i]) {
+			printf("ERROR: cursor missed record %d\n", i);
+			success = false;
+		}
+		if (!deleted[i])
+			count++;
+	}
+	if (sfptpd_db_table_count(plain) != count) {
+		printf("ERROR: %d records remain, expected %d\n",
+		       sfptpd_db_table_count(plain), count);
+		success = false;
+	}
+
+	sfptpd_db_table_free(indexed);
+	sfptpd_db_table_free(plain);
+
+	return success;
+}
+
+
+static void *concurrent_writer(void *context)
+{
+	struct concurrent_test *test = context;
+	struct test_record record;
+	int i;
+
+	/* Replace the oldest record with a new one */
+	for (i = 0; i < CONCURRENT_WRITES; i++) {
+		pthread_rwlock_wrlock(&test->walk_lock);
+		sfptpd_db_table_delete(test->table, TEST_FIELD_ID, &i);
+		record.id = i + CURSOR_RECORDS;
+		record.group = record.id % BENCH_GROUPS;
+		record.seq = record.id;
+		sfptpd_db_table_insert(test->table, &record);
+		pthread_rwlock_unlock(&test->walk_lock);
+	}
+
+	__atomic_store_n(&test->writer_done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+static void *concurrent_reader(void *context)
+{
+	struct concurrent_test *test = context;
+	struct sfptpd_db_cursor cursor;
+	struct test_record *checked[CONCURRENT_CHECKED];
+	struct test_record copies[CONCURRENT_CHECKED];
+	struct test_record *record;
+	int num_checked;
+	int last;
+	int i;
+
+	while (!__atomic_load_n(&test->writer_done, __ATOMIC_ACQUIRE)) {
+		pthread_rwlock_rdlock(&test->walk_lock);
+		sfptpd_db_cursor_open(&cursor, test->table,
+				      SFPTPD_DB_SEL_ORDER_BY, TEST_FIELD_SEQ);
+		pthread_rwlock_unlock(&test->walk_lock);
+
+		/* Walk a step at a time so that the writer changes the table
+		 * while the cursor is open */
+		num_checked = 0;
+		last = -1;
+		while (true) {
+			pthread_rwlock_rdlock(&test->walk_lock);
+			record = sfptpd_db_cursor_next(&cursor);
+			pthread_rwlock_unlock(&test->walk_lock);
+			if (record == NULL)
+				break;
+			sched_yield();
+
+			if (record->group != record->id % BENCH_GROUPS ||
+			    record->seq <= last) {
+				printf("ERROR: concurrent cursor visited bad record %d\n",
+				       record->id);
+				__atomic_store_n(&test->failed, true, __ATOMIC_RELAXED);
+				break;
+			}
+			last = record->seq;
+
+			if (num_checked < CONCURRENT_CHECKED) {
+				checked[num_checked] = record;
+				copies[num_checked++] = *record;
+			}
+		}
+
+		/* Records returned by a cursor remain valid until it is
+		 * closed, even if deleted */
+		for (i = 0; i < num_checked; i++) {
+			if (memcmp(checked[i], &copies[i], sizeof copies[i]) != 0) {
+				printf("ERROR: record %d reclaimed while cursor open\n",
+				       copies[i].id);
+				__atomic_store_n(&test->failed, true, __ATOMIC_RELAXED);
+			}
+		}
+
+		sfptpd_db_cursor_close(&cursor);
+		__atomic_add_fetch(&test->walks, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+
+/* Check that cursors can be opened and closed on several threads while
+ * another changes the table, with the changes serialised with walking */
+static bool test_concurrent(enum sfptpd_db_store_type store)
+{
+	struct concurrent_test test = { 0 };
+	pthread_t readers[CONCURRENT_READERS];
+	pthread_t writer;
+	int i;
+
+	test.table = sfptpd_db_table_new(&indexed_table_def, store);
+	for (i = 0; i < CURSOR_RECORDS; i++) {
+		struct test_record record = { i, i % BENCH_GROUPS, i };
+
+		sfptpd_db_table_insert(test.table, &record);
+	}
+	pthread_rwlock_init(&test.walk_lock, NULL);
+
+	for (i = 0; i < CONCURRENT_READERS; i++)
+		pthread_create(&readers[i], NULL, concurrent_reader, &test);
+	pthread_create(&writer, NULL, concurrent_writer, &test);
+
+	pthread_join(writer, NULL);
+	for (i = 0; i < CONCURRENT_READERS; i++)
+		pthread_join(readers[i], NULL);
+
+	if (sfptpd_db_table_count(test.table) != CURSOR_RECORDS) {
+		printf("ERROR: %d records after concurrent test, expected %d\n",
+		       sfptpd_db_table_count(test.table), CURSOR_RECORDS);
+		test.failed = true;
+	}
+
+	printf("concurrent cursors: %lu walks during %d writes\n",
+	       test.walks, CONCURRENT_WRITES);
+
+	pthread_rwlock_destroy(&test.walk_lock);
+	sfptpd_db_table_free(test.table);
+
+	return !test.failed;
+}
+
+
+/****************************************************************************
+ * Entry Point
+ ****************************************************************************/
+
+int sfptpd_test_db(void)
+{
+	bool success = true;
+
+	success &= test_indexes();
+	success &= test_cursors(STORE_ARRAY);
+	success &= test_cursors(STORE_LINKED_LIST);
+	success &= test_concurrent(STORE_ARRAY);
+	success &= test_concurrent(STORE_LINKED_LIST);
+
+	return success ? 0 : EINVAL;
+}
+
+
+/* fin */
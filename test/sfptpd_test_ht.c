@@ -3,7 +3,7 @@
 
 /**
  * @file   sfptpd_test_ht.c
- * @brief  Hash table unit test
+ * @brief  Hash table unit test and benchmark
  */
 
 #include <time.h>
@@ -27,6 +27,12 @@
 
 #define TEST_HOST_ADDR_LEN (60)
 
+/* Number of entries added to the benchmark table */
+#define BENCH_ENTRIES (SFPTPD_HT_MAX_TABLE_ENTRIES - 1)
+
+/* Initial size of the benchmark table, as used for statistics sets */
+#define BENCH_TABLE_SIZE (20)
+
 struct test_details {
 	int test_num;
 	int num_nodes;
@@ -257,6 +263,143 @@ bool output_test_result(bool test_success) {
 	return test_success;
 }
 
+struct bench_entry {
+	uint64_t key;
+	int index;
+	int value;
+	bool seen;
+};
+
+static void *bench_alloc(void)
+{
+	return calloc(1, sizeof(struct bench_entry));
+}
+
+static void bench_copy(void *dest, void *src)
+{
+	memcpy(dest, src, sizeof(struct bench_entry));
+}
+
+static void bench_free(void *entry)
+{
+	free(entry);
+}
+
+static void bench_get_key(void *entry, void **key, unsigned int *length)
+{
+	*key = &((struct bench_entry *)entry)->key;
+	*length = sizeof(((struct bench_entry *)entry)->key);
+}
+
+static const struct sfptpd_ht_ops bench_ops = {
+	bench_alloc,
+	bench_copy,
+	bench_free,
+	bench_get_key
+};
+
+static long double elapsed_ms(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000.0L +
+		(end->tv_nsec - start->tv_nsec) / 1000000.0L;
+}
+
+/* Spread the keys so that they do not hash trivially */
+static uint64_t bench_key(int ii)
+{
+	return (uint64_t) ii * 0x9E3779B97F4A7C15ULL;
+}
+
+bool benchmark(void)
+{
+	struct sfptpd_hash_table *table;
+	struct sfptpd_ht_iter iter;
+	struct bench_entry entry = { 0 };
+	struct bench_entry *found;
+	struct timespec start, end;
+	long double add_ms, update_ms, replay_ms;
+	bool success = true;
+	int ii, rc, present = 0;
+
+	table = sfptpd_ht_alloc(&bench_ops, BENCH_TABLE_SIZE, BENCH_ENTRIES);
+	if (table == NULL) {
+		printf("failed to allocate benchmark table\n");
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (ii = 0; ii < BENCH_ENTRIES; ii++) {
+		entry.key = bench_key(ii);
+		entry.index = ii;
+		entry.value = ii;
+		rc = sfptpd_ht_add(table, &entry, false);
+		if (rc != 0) {
+			printf("failed to add entry %d, %s\n", ii, strerror(rc));
+			success = false;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	add_ms = elapsed_ms(&start, &end);
+
+	/* Updating finds each entry and overwrites it */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (ii = 0; ii < BENCH_ENTRIES; ii++) {
+		entry.key = bench_key(ii);
+		entry.index = ii;
+		entry.value = ii * 2;
+		rc = sfptpd_ht_add(table, &entry, true);
+		if (rc != 0) {
+			printf("failed to update entry %d, %s\n", ii, strerror(rc));
+			success = false;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	update_ms = elapsed_ms(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (ii = 0; ii < BENCH_ENTRIES; ii++) {
+		entry.key = bench_key(ii);
+		if (sfptpd_ht_add(table, &entry, false) != EEXIST) {
+			printf("entry %d was unexpectedly not found in table\n", ii);
+			success = false;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	replay_ms = elapsed_ms(&start, &end);
+
+	entry.key = bench_key(BENCH_ENTRIES);
+	if (sfptpd_ht_add(table, &entry, false) != ENOSPC) {
+		printf("incorrect return code on benchmark table overflow\n");
+		success = false;
+	}
+
+	/* Check that every entry is visited exactly once with its update */
+	for (found = sfptpd_ht_first(table, &iter); found != NULL;
+	     found = sfptpd_ht_next(&iter)) {
+		if (found->seen || found->value != found->index * 2 ||
+		    found->key != bench_key(found->index)) {
+			printf("entry with key %llx was visited twice or not updated\n",
+			       (unsigned long long) found->key);
+			success = false;
+		}
+		found->seen = true;
+		present++;
+	}
+
+	if (present != BENCH_ENTRIES ||
+	    sfptpd_ht_get_num_entries(table) != BENCH_ENTRIES) {
+		printf("%d entries found, %d recorded, %d expected\n",
+		       present, sfptpd_ht_get_num_entries(table), BENCH_ENTRIES);
+		success = false;
+	}
+
+	printf("%d entries: add %.3Lfms, update %.3Lfms, replay %.3Lfms\n",
+	       BENCH_ENTRIES, add_ms, update_ms, replay_ms);
+
+	sfptpd_ht_free(table);
+	return success;
+}
+
 int sfptpd_test_ht(void)
 {
 	int ii, rc = 0;
@@ -273,6 +416,9 @@ int sfptpd_test_ht(void)
 
 	sfptpd_ht_free(table);
 
+	printf("Test 7: Benchmarking a large hash table\n");
+	success &= output_test_result(benchmark());
+
 	if (!success) {
 		rc = 1;
 	}
@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_test_interface.c
+ * @brief  Interface lookup index unit test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "sfptpd_interface_index.h"
+#include "sfptpd_test.h"
+
+
+/****************************************************************************
+ * Types and Constants
+ ****************************************************************************/
+
+#define NUM_READERS (4)
+#define NUM_PUBLICATIONS (20000)
+
+/* Stand-ins for interfaces. The index never dereferences them. */
+static char fake_interfaces[8];
+#define FAKE_INTF(n) ((struct sfptpd_interface *) &fake_interfaces[n])
+
+#define KEYS(n, idx, phc, nic, del, mac, nm) \
+	{ FAKE_INTF(n), idx, phc, nic, del, { .len = 6, .addr = { 0, 0, 0, 0, 0, mac } }, nm }
+
+/* Two generations of the interface table. In the second, eth0 has been
+ * deleted and recreated with a new interface index and eth1 has moved to
+ * another PHC. */
+static const struct sfptpd_interface_keys keys_a[] = {
+	KEYS(0, 2, 0, 0, false, 0x11, "eth0"),
+	KEYS(1, 3, 0, 0, false, 0x10, "eth1"),
+	KEYS(2, 4, -1, -1, false, 0x20, "lo"),
+};
+
+static const struct sfptpd_interface_keys keys_b[] = {
+	KEYS(0, 2, 0, 0, true, 0x11, "eth0"),
+	KEYS(1, 3, 1, 1, false, 0x10, "eth1"),
+	KEYS(2, 4, -1, -1, false, 0x20, "lo"),
+	KEYS(3, 5, 0, 0, false, 0x11, "eth0"),
+};
+
+#define NUM_KEYS(k) ((int) (sizeof (k) / sizeof (k)[0]))
+
+struct reader {
+	pthread_t thread;
+	struct sfptpd_interface_index_set *set;
+	bool *stop;
+	int lookups;
+	int errors;
+};
+
+
+/****************************************************************************
+ * Local Functions
+ ****************************************************************************/
+
+static struct sfptpd_interface_keys *copy_keys(const struct sfptpd_interface_keys *keys,
+					       int count)
+{
+	struct sfptpd_interface_keys *copy = calloc(count, sizeof *copy);
+
+	if (copy != NULL)
+		memcpy(copy, keys, count * sizeof *copy);
+	return copy;
+}
+
+
+/* Check that every lookup on an index agrees with the first or second
+ * generation of the table and that the two are never mixed */
+static int check_index(const struct sfptpd_interface_index *index,
+		       bool *is_b)
+{
+	struct sfptpd_interface *eth0 = sfptpd_interface_index_find_by_name(index, "eth0");
+	int errors = 0;
+
+	if (eth0 == FAKE_INTF(0)) {
+		*is_b = false;
+		errors += (sfptpd_interface_index_find_by_if_index(index, 5) != NULL);
+		errors += !sfptpd_interface_index_phc_has_name(index, 0, "eth1");
+		errors += sfptpd_interface_index_phc_has_name(index, 1, "eth1");
+		errors += (sfptpd_interface_index_find_first_by_nic(index, 0) != FAKE_INTF(1));
+		errors += (sfptpd_interface_index_find_first_by_nic(index, 1) != NULL);
+	} else if (eth0 == FAKE_INTF(3)) {
+		*is_b = true;
+		errors += (sfptpd_interface_index_find_by_if_index(index, 5) != FAKE_INTF(3));
+		errors += sfptpd_interface_index_phc_has_name(index, 0, "eth1");
+		errors += !sfptpd_interface_index_phc_has_name(index, 1, "eth1");
+		errors += (sfptpd_interface_index_find_first_by_nic(index, 0) != FAKE_INTF(0));
+		errors += (sfptpd_interface_index_find_first_by_nic(index, 1) != FAKE_INTF(1));
+	} else {
+		return 1;
+	}
+
+	/* Common to both generations */
+	errors += (sfptpd_interface_index_find_by_if_index(index, 2) != FAKE_INTF(0));
+	errors += (sfptpd_interface_index_find_by_if_index(index, 3) != FAKE_INTF(1));
+	errors += (sfptpd_interface_index_find_by_name(index, "eth1") != FAKE_INTF(1));
+	errors += (sfptpd_interface_index_find_by_name(index, "lo") != FAKE_INTF(2));
+	errors += !sfptpd_interface_index_phc_has_name(index, 0, "eth0");
+	errors += sfptpd_interface_index_phc_has_name(index, 0, "lo");
+	errors += (sfptpd_interface_index_find_by_name(index, "eth2") != NULL);
+	errors += (sfptpd_interface_index_find_by_if_index(index, 1) != NULL);
+	errors += (sfptpd_interface_index_find_by_if_index(index, 1000) != NULL);
+	errors += (sfptpd_interface_index_find_by_if_index(index, -1) != NULL);
+	errors += sfptpd_interface_index_phc_has_name(index, -1, "lo");
+	errors += sfptpd_interface_index_phc_has_name(index, 7, "eth0");
+
+	return errors;
+}
+
+
+static void *reader_thread(void *arg)
+{
+	struct reader *reader = (struct reader *) arg;
+	const struct sfptpd_interface_index *index;
+	bool is_b;
+
+	while (!__atomic_load_n(reader->stop, __ATOMIC_RELAXED)) {
+		index = sfptpd_interface_index_get(reader->set);
+		if (index == NULL)
+			reader->errors++;
+		else if (check_index(index, &is_b) != 0)
+			reader->errors++;
+		sfptpd_interface_index_put(reader->set);
+		reader->lookups++;
+	}
+
+	return NULL;
+}
+
+
+static int test_publish(void)
+{
+	struct sfptpd_interface_index_set set;
+	const struct sfptpd_interface_index *index;
+	bool is_b = false;
+	int rc = 0;
+	int errors;
+
+	memset(&set, 0, sizeof set);
+
+	index = sfptpd_interface_index_get(&set);
+	sfptpd_interface_index_put(&set);
+	if (index != NULL) {
+		printf("ERROR: index present before publication\n");
+		return EINVAL;
+	}
+
+	rc = sfptpd_interface_index_publish(&set, copy_keys(keys_a, NUM_KEYS(keys_a)),
+					    NUM_KEYS(keys_a));
+	if (rc != 0) {
+		printf("ERROR: first publication failed, %s\n", strerror(rc));
+		goto finish;
+	}
+
+	index = sfptpd_interface_index_get(&set);
+	errors = check_index(index, &is_b);
+	sfptpd_interface_index_put(&set);
+	if (errors != 0 || is_b) {
+		printf("ERROR: %d incorrect lookups in first index\n", errors);
+		rc = ERANGE;
+		goto finish;
+	}
+
+	rc = sfptpd_interface_index_publish(&set, copy_keys(keys_a, NUM_KEYS(keys_a)),
+					    NUM_KEYS(keys_a));
+	if (rc != EALREADY) {
+		printf("ERROR: republishing unchanged keys returned %s\n", strerror(rc));
+		rc = ERANGE;
+		goto finish;
+	}
+
+	/* The deleted eth0 must give way to the recreated one by name */
+	rc = sfptpd_interface_index_publish(&set, copy_keys(keys_b, NUM_KEYS(keys_b)),
+					    NUM_KEYS(keys_b));
+	if (rc != 0) {
+		printf("ERROR: second publication failed, %s\n", strerror(rc));
+		goto finish;
+	}
+
+	index = sfptpd_interface_index_get(&set);
+	errors = check_index(index, &is_b);
+	sfptpd_interface_index_put(&set);
+	if (errors != 0 || !is_b) {
+		printf("ERROR: %d incorrect lookups in second index\n", errors);
+		rc = ERANGE;
+		goto finish;
+	}
+
+finish:
+	sfptpd_interface_index_release(&set);
+	return rc;
+}
+
+
+static int test_concurrent_lookup(void)
+{
+	struct sfptpd_interface_index_set set;
+	struct reader readers[NUM_READERS];
+	bool stop = false;
+	int num_readers;
+	int lookups = 0;
+	int errors = 0;
+	int rc = 0;
+	int i;
+
+	memset(&set, 0, sizeof set);
+	rc = sfptpd_interface_index_publish(&set, copy_keys(keys_a, NUM_KEYS(keys_a)),
+					    NUM_KEYS(keys_a));
+	if (rc != 0) {
+		printf("ERROR: initial publication failed, %s\n", strerror(rc));
+		return rc;
+	}
+
+	for (num_readers = 0; num_readers < NUM_READERS; num_readers++) {
+		i = num_readers;
+		readers[i].set = &set;
+		readers[i].stop = &stop;
+		readers[i].lookups = 0;
+		readers[i].errors = 0;
+		if (pthread_create(&readers[i].thread, NULL, reader_thread, &readers[i]) != 0) {
+			printf("ERROR: failed to create reader thread\n");
+			__atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+			rc = EINVAL;
+			break;
+		}
+	}
+
+	/* Republish alternate generations while the readers look up */
+	for (i = 0; rc == 0 && i < NUM_PUBLICATIONS; i++) {
+		if (i & 1)
+			rc = sfptpd_interface_index_publish(&set, copy_keys(keys_a, NUM_KEYS(keys_a)),
+							    NUM_KEYS(keys_a));
+		else
+			rc = sfptpd_interface_index_publish(&set, copy_keys(keys_b, NUM_KEYS(keys_b)),
+							    NUM_KEYS(keys_b));
+		if (rc != 0)
+			printf("ERROR: publication %d failed, %s\n", i, strerror(rc));
+	}
+
+	__atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+	for (i = 0; i < num_readers; i++) {
+		pthread_join(readers[i].thread, NULL);
+		lookups += readers[i].lookups;
+		errors += readers[i].errors;
+	}
+
+	sfptpd_interface_index_release(&set);
+
+	if (rc == 0 && errors != 0) {
+		printf("ERROR: %d of %d lookups during republication were incorrect\n",
+		       errors, lookups);
+		rc = ERANGE;
+	}
+	return rc;
+}
+
+
+/****************************************************************************
+ * Entry Point
+ ****************************************************************************/
+
+int sfptpd_test_interface(void)
+{
+	int rc;
+
+	rc = test_publish();
+	if (rc != 0)
+		return rc;
+
+	return test_concurrent_lookup();
+}
+
+
+/* fin */
@@ -0,0 +1,344 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_test_json.c
+ * @brief  JSON builder unit test and realtime stats formatting benchmark
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "sfptpd_logging.h"
+#include "sfptpd_json.h"
+#include "sfptpd_test.h"
+
+
+/****************************************************************************
+ * Types and Defines
+ ****************************************************************************/
+
+/* Number of random values compared against printf */
+#define CHECK_VALUES (100000)
+
+/* Number of records formatted in the benchmark */
+#define BENCH_RECORDS (200000)
+
+/* Number of sync instances and servos emulated in the benchmark */
+#define BENCH_INSTANCES (64)
+
+struct bench_record {
+	const char *instance;
+	const char *master;
+	const char *slave;
+	const char *interface;
+	uint32_t nsec;
+	long double offset;
+	long double freq_adj;
+	long double one_way_delay;
+	uint8_t gm_id[8];
+	long double p_term;
+	long double i_term;
+};
+
+
+/****************************************************************************
+ * Local Functions
+ ****************************************************************************/
+
+static long double elapsed_ns(const struct timespec *start,
+			      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1.0E9L +
+		(end->tv_nsec - start->tv_nsec);
+}
+
+
+static long double random_value(void)
+{
+	long double mag = (long double) random() / RAND_MAX;
+	int scale = random() % 13;
+
+	while (scale-- > 0)
+		mag *= 10.0L;
+
+	return (random() & 1) ? -mag : mag;
+}
+
+
+static bool check_float(long double value, unsigned int decimals)
+{
+	char expected[64];
+	char space[64];
+	struct sfptpd_json_buf buf;
+
+	sfptpd_json_init(&buf, space, sizeof space - 1);
+	snprintf(expected, sizeof expected, "%.*Lf", (int) decimals, value);
+	sfptpd_json_float(&buf, value, decimals);
+	space[buf.len] = '\0';
+
+	if (strcmp(expected, space) != 0) {
+		printf("json: float %.12Lg with %u decimals gave %s, expected %s\n",
+		       value, decimals, space, expected);
+		return false;
+	}
+	return true;
+}
+
+
+static bool test_formatting(void)
+{
+	static const uint8_t eui64[8] = { 0x00, 0x0f, 0x53, 0xff, 0xfe, 0x01, 0xab, 0xcd };
+	char expected[128];
+	char space[128];
+	struct sfptpd_json_buf buf;
+	bool success = true;
+	int64_t ival;
+	int i;
+
+	for (i = 0; i < CHECK_VALUES; i++) {
+		long double value = random_value();
+
+		success &= check_float(value, 6);
+		success &= check_float(value, 3);
+		success &= check_float(value, 0);
+	}
+	success &= check_float(0.0L, 6);
+	success &= check_float(-0.0L, 6);
+	success &= check_float(-0.0000001L, 6);
+	success &= check_float(1.0E15L, 6);
+	success &= check_float(-1.0E300L, 6);
+
+	for (i = 0; i < CHECK_VALUES; i++) {
+		ival = ((int64_t) random() << 32 | random()) >> (random() % 63);
+		if (random() & 1)
+			ival = -ival;
+
+		sfptpd_json_init(&buf, space, sizeof space - 1);
+		sfptpd_json_int(&buf, ival);
+		sfptpd_json_lit(&buf, ",");
+		sfptpd_json_uint(&buf, (uint32_t) ival % 1000000000, 9);
+		space[buf.len] = '\0';
+		snprintf(expected, sizeof expected, "%" PRId64 ",%09" PRIu32,
+			 ival, (uint32_t) ival % 1000000000);
+		if (strcmp(expected, space) != 0) {
+			printf("json: integers gave %s, expected %s\n",
+			       space, expected);
+			success = false;
+		}
+	}
+
+	sfptpd_json_init(&buf, space, sizeof space - 1);
+	sfptpd_json_string(&buf, "a\"b\\c\nd");
+	sfptpd_json_lit(&buf, ",\"");
+	sfptpd_json_hex(&buf, eui64, sizeof eui64, 2, ':');
+	sfptpd_json_lit(&buf, "\"");
+	space[buf.len] = '\0';
+	snprintf(expected, sizeof expected, "%s,\"" SFPTPD_FORMAT_EUI64 "\"",
+		 "\"a\\\"b\\\\c\\u000ad\"",
+		 eui64[0], eui64[1], eui64[2], eui64[3],
+		 eui64[4], eui64[5], eui64[6], eui64[7]);
+	if (strcmp(expected, space) != 0) {
+		printf("json: strings gave %s, expected %s\n", space, expected);
+		success = false;
+	}
+
+	/* An append that does not fit must not be partially applied */
+	sfptpd_json_init(&buf, space, 4);
+	sfptpd_json_lit(&buf, "abc");
+	sfptpd_json_lit(&buf, "de");
+	if (!buf.overflow || buf.len != 3) {
+		printf("json: overflow not detected\n");
+		success = false;
+	}
+
+	return success;
+}
+
+
+/* Format a record in the same way as the realtime stats writer did prior
+ * to the introduction of the JSON builder. */
+static int format_stdio(FILE *stream, const struct bench_record *r)
+{
+	int len;
+
+	len = fprintf(stream, "{\"instance\":\"%s\",\"time\":\"%s\","
+		      "\"clock-master\":{\"name\":\"%s\"",
+		      r->instance, "2024-01-01 00:00:00.000000", r->master);
+	len += fprintf(stream, ",\"primary-interface\":\"%s\"", r->interface);
+	len += fprintf(stream, "},\"clock-slave\":{\"name\":\"%s\"", r->slave);
+	len += fprintf(stream, ",\"time\":\"%s.%09" PRIu32 "\"",
+		       "2024-01-01 00:00:00", r->nsec);
+	len += fprintf(stream, "},\"is-disciplining\":%s,\"in-sync\":%s,"
+		       "\"alarms\":[", "true", "true");
+	len += fprintf(stream, "],\"stats\":{");
+	len += fprintf(stream, "%s\"%s\":%Lf", "", "offset", r->offset);
+	len += fprintf(stream, "%s\"%s\":%Lf", ",", "freq-adj", r->freq_adj);
+	len += fprintf(stream, "%s\"%s\":%Lf", ",", "one-way-delay", r->one_way_delay);
+	len += fprintf(stream, "%s\"%s\":\"" SFPTPD_FORMAT_EUI64 "\"", ",", "gm-id",
+		       r->gm_id[0], r->gm_id[1], r->gm_id[2], r->gm_id[3],
+		       r->gm_id[4], r->gm_id[5], r->gm_id[6], r->gm_id[7]);
+	len += fprintf(stream, "%s\"%s\":%Lf", ",", "p-term", r->p_term);
+	len += fprintf(stream, "%s\"%s\":%Lf", ",", "i-term", r->i_term);
+	len += fprintf(stream, "}}\n");
+
+	return len;
+}
+
+
+/* Format a record as the realtime stats writer does with the builder and
+ * cached clock fragments. */
+static void format_builder(struct sfptpd_json_buf *buf,
+			   const struct bench_record *r,
+			   const char *master_frag, size_t master_len,
+			   const char *slave_frag, size_t slave_len)
+{
+	sfptpd_json_lit(buf, "{\"instance\":");
+	sfptpd_json_string(buf, r->instance);
+	sfptpd_json_lit(buf, ",\"time\":\"2024-01-01 00:00:00.000000\",\"clock-master\":{");
+	sfptpd_json_raw(buf, master_frag, master_len);
+	sfptpd_json_lit(buf, "},\"clock-slave\":{");
+	sfptpd_json_raw(buf, slave_frag, slave_len);
+	sfptpd_json_lit(buf, ",\"time\":\"2024-01-01 00:00:00.");
+	sfptpd_json_uint(buf, r->nsec, 9);
+	sfptpd_json_lit(buf, "\"},\"is-disciplining\":true,\"in-sync\":true,"
+			"\"alarms\":[],\"stats\":{\"offset\":");
+	sfptpd_json_float(buf, r->offset, 6);
+	sfptpd_json_lit(buf, ",\"freq-adj\":");
+	sfptpd_json_float(buf, r->freq_adj, 6);
+	sfptpd_json_lit(buf, ",\"one-way-delay\":");
+	sfptpd_json_float(buf, r->one_way_delay, 6);
+	sfptpd_json_lit(buf, ",\"gm-id\":\"");
+	sfptpd_json_hex(buf, r->gm_id, 8, 2, ':');
+	sfptpd_json_lit(buf, "\",\"p-term\":");
+	sfptpd_json_float(buf, r->p_term, 6);
+	sfptpd_json_lit(buf, ",\"i-term\":");
+	sfptpd_json_float(buf, r->i_term, 6);
+	sfptpd_json_lit(buf, "}}\n");
+}
+
+
+static bool benchmark_records(void)
+{
+	static struct bench_record records[BENCH_INSTANCES];
+	static char data[64 * 1024];
+	char master_frag[128], slave_frag[128];
+	struct sfptpd_json_buf buf, frag;
+	size_t master_len, slave_len;
+	struct timespec t0, t1, t2;
+	long double stdio_ns, builder_ns;
+	char *stdio_out = NULL;
+	size_t stdio_size = 0;
+	FILE *stream;
+	bool success = true;
+	int i, j;
+
+	for (i = 0; i < BENCH_INSTANCES; i++) {
+		records[i].instance = "ptp1";
+		records[i].master = "system";
+		records[i].slave = "phc0(enp1s0f0/enp1s0f1)";
+		records[i].interface = "enp1s0f0";
+		records[i].nsec = random() % 1000000000;
+		records[i].offset = random_value() / 1000.0L;
+		records[i].freq_adj = random_value() / 1000.0L;
+		records[i].one_way_delay = random_value() / 1000.0L;
+		for (j = 0; j < 8; j++)
+			records[i].gm_id[j] = random();
+		records[i].p_term = random_value() / 1.0E9L;
+		records[i].i_term = random_value() / 1.0E9L;
+	}
+
+	sfptpd_json_init(&frag, master_frag, sizeof master_frag);
+	sfptpd_json_lit(&frag, "\"name\":");
+	sfptpd_json_string(&frag, records[0].master);
+	sfptpd_json_lit(&frag, ",\"primary-interface\":");
+	sfptpd_json_string(&frag, records[0].interface);
+	master_len = frag.len;
+	sfptpd_json_init(&frag, slave_frag, sizeof slave_frag);
+	sfptpd_json_lit(&frag, "\"name\":");
+	sfptpd_json_string(&frag, records[0].slave);
+	slave_len = frag.len;
+
+	/* Check the two methods give identical output */
+	stream = open_memstream(&stdio_out, &stdio_size);
+	if (stream == NULL)
+		return false;
+	sfptpd_json_init(&buf, data, sizeof data);
+	for (i = 0; i < BENCH_INSTANCES; i++) {
+		format_stdio(stream, &records[i]);
+		format_builder(&buf, &records[i], master_frag, master_len,
+			       slave_frag, slave_len);
+	}
+	fclose(stream);
+	if (stdio_size != buf.len || memcmp(stdio_out, data, buf.len) != 0) {
+		printf("json: builder output differs from stdio output\n");
+		success = false;
+	}
+	free(stdio_out);
+
+	/* Time formatting into a block-buffered stream vs the builder. The
+	 * I/O itself is excluded by writing to /dev/null. */
+	stream = fopen("/dev/null", "w");
+	if (stream == NULL)
+		return false;
+	setvbuf(stream, NULL, _IOFBF, sizeof data);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < BENCH_RECORDS; i++)
+		format_stdio(stream, &records[i % BENCH_INSTANCES]);
+	fflush(stream);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sfptpd_json_reset(&buf);
+	for (i = 0; i < BENCH_RECORDS; i++) {
+		format_builder(&buf, &records[i % BENCH_INSTANCES],
+			       master_frag, master_len, slave_frag, slave_len);
+		if (sfptpd_json_headroom(&buf) < 2048) {
+			fwrite(buf.data, 1, buf.len, stream);
+			sfptpd_json_reset(&buf);
+		}
+	}
+	fflush(stream);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	fclose(stream);
+
+	stdio_ns = elapsed_ns(&t0, &t1) / BENCH_RECORDS;
+	builder_ns = elapsed_ns(&t1, &t2) / BENCH_RECORDS;
+
+	printf("json stats record cost: stdio %0.0Lf ns (%0.0Lf records/s), "
+	       "builder %0.0Lf ns (%0.0Lf records/s)\n",
+	       stdio_ns, 1.0E9L / stdio_ns, builder_ns, 1.0E9L / builder_ns);
+	printf("json stats CPU for %d instances: "
+	       "1 Hz stdio %0.4Lf%% builder %0.4Lf%%, "
+	       "16 Hz stdio %0.4Lf%% builder %0.4Lf%%\n",
+	       BENCH_INSTANCES,
+	       stdio_ns * BENCH_INSTANCES * 1 / 1.0E7L,
+	       builder_ns * BENCH_INSTANCES * 1 / 1.0E7L,
+	       stdio_ns * BENCH_INSTANCES * 16 / 1.0E7L,
+	       builder_ns * BENCH_INSTANCES * 16 / 1.0E7L);
+
+	return success;
+}
+
+
+/****************************************************************************
+ * Entry Point
+ ****************************************************************************/
+
+int sfptpd_test_json(void)
+{
+	bool success = true;
+
+	success &= test_formatting();
+	success &= benchmark_records();
+
+	return success ? 0 : EINVAL;
+}
+
+
+/* fin */
@@ -27,6 +27,7 @@
 #include "sfptpd_misc.h"
 #include "sfptpd_test.h"
 #include "sfptpd_netlink.h"
+#include "sfptpd_link.h"
 
 
 /****************************************************************************
@@ -50,6 +51,64 @@ static const bool continuous = false;
  * Local Functions
  ****************************************************************************/
 
+static int test_link_delta(void)
+{
+	struct sfptpd_link old_rows[] = {
+		{ .if_index = 1 },
+		{ .if_index = 2 },
+		{ .if_index = 4 },
+		{ .if_index = 7 },
+	};
+	struct sfptpd_link rows[] = {
+		{ .if_index = 1 },
+		{ .if_index = 3, .event = SFPTPD_LINK_UP },
+		{ .if_index = 4, .event = SFPTPD_LINK_CHANGE,
+		  .changes = SFPTPD_LINK_CHANGED_FLAGS },
+		{ .if_index = 8, .event = SFPTPD_LINK_UP },
+	};
+	const struct {
+		enum sfptpd_link_event event;
+		int if_index;
+		uint32_t changes;
+	} expected[] = {
+		{ SFPTPD_LINK_DOWN, 2 },
+		{ SFPTPD_LINK_UP, 3 },
+		{ SFPTPD_LINK_CHANGE, 4, SFPTPD_LINK_CHANGED_FLAGS },
+		{ SFPTPD_LINK_DOWN, 7 },
+		{ SFPTPD_LINK_UP, 8 },
+	};
+	struct sfptpd_link_table old_table = { old_rows, 4, 1 };
+	struct sfptpd_link_table table = { rows, 4, 2 };
+	struct sfptpd_link_delta_iter iter;
+	struct sfptpd_link_delta delta;
+	int n = 0;
+	int rc = 0;
+
+	sfptpd_link_delta_start(&iter, &old_table, &table);
+	while (sfptpd_link_delta_next(&iter, &delta)) {
+		const struct sfptpd_link *link;
+
+		link = delta.event == SFPTPD_LINK_DOWN ? delta.old_link : delta.link;
+		if (n >= sizeof expected / sizeof *expected ||
+		    delta.event != expected[n].event ||
+		    link->if_index != expected[n].if_index ||
+		    delta.changes != expected[n].changes) {
+			ERROR("link: unexpected delta %d: event %d if_index %d changes %x\n",
+			      n, delta.event, link->if_index, delta.changes);
+			rc = 1;
+		}
+		n++;
+	}
+
+	if (n != sizeof expected / sizeof *expected) {
+		ERROR("link: expected %zd deltas, got %d\n",
+		      sizeof expected / sizeof *expected, n);
+		rc = 1;
+	}
+
+	return rc;
+}
+
 static int test_link(void)
 {
 	#define MAX_EVENTS 10
@@ -135,6 +194,10 @@ int sfptpd_test_link(void)
 
 	sfptpd_log_set_trace_level(SFPTPD_COMPONENT_ID_NETLINK, 6);
 
+	rc = test_link_delta();
+	if (rc != 0)
+		return rc;
+
 	rc = test_link();
 
 	return rc;
@@ -0,0 +1,408 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_test_logging.c
+ * @brief  Logging unit test and trace point benchmark
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <glob.h>
+#include <pthread.h>
+
+#include "sfptpd_config.h"
+#include "sfptpd_general_config.h"
+#include "sfptpd_logging.h"
+#include "sfptpd_time.h"
+#include "sfptpd_test.h"
+
+
+/****************************************************************************
+ * Types and Defines
+ ****************************************************************************/
+
+/* Number of emulated packets in the benchmark */
+#define BENCH_PACKETS (2000000)
+
+/* Trace level used for the disabled trace points */
+#define BENCH_LEVEL (5)
+
+/* Expand a trace point as the TRACE() macro did before the inline level
+ * check was introduced, for comparison. */
+#define LEGACY_TRACE(c, l, x, ...) sfptpd_log_trace(c, l, x, ##__VA_ARGS__)
+
+/* Threads and messages per thread logging concurrently */
+#define ORDER_THREADS (4)
+#define ORDER_MESSAGES (20000)
+
+/* Longest string argument kept by an asynchronous message */
+#define ASYNC_MAX_STRING (4095)
+
+struct bench_packet {
+	struct sfptpd_timespec ts;
+	uint16_t seq;
+	int if_index;
+	const char *if_name;
+};
+
+
+/****************************************************************************
+ * Local Data
+ ****************************************************************************/
+
+static unsigned int evaluations;
+
+/* Serialises numbering with logging so that the numbers must be written
+ * in order */
+static pthread_mutex_t order_lock = PTHREAD_MUTEX_INITIALIZER;
+static int order_next;
+
+
+/****************************************************************************
+ * Local Functions
+ ****************************************************************************/
+
+static int count_evaluation(int value)
+{
+	evaluations++;
+	return value;
+}
+
+
+static long double elapsed_ns(const struct timespec *start,
+			      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1.0E9L +
+		(end->tv_nsec - start->tv_nsec);
+}
+
+
+/* Emulate the trace points typically hit per received packet in the PTP
+ * receive path with the given trace expansion. */
+#define BENCH_RX_PATH(trace, pkt) \
+	do { \
+		trace(SFPTPD_COMPONENT_ID_PTPD2, BENCH_LEVEL, \
+		      "rx seq %u on %s (%d)\n", \
+		      (pkt)->seq, (pkt)->if_name, (pkt)->if_index); \
+		trace(SFPTPD_COMPONENT_ID_PTPD2, BENCH_LEVEL + 1, \
+		      "matching ts " SFPTPD_FMT_SFTIMESPEC "\n", \
+		      SFPTPD_ARGS_SFTIMESPEC((pkt)->ts)); \
+		trace(SFPTPD_COMPONENT_ID_PTPD2, BENCH_LEVEL, \
+		      "ts %0.3Lf ns\n", \
+		      sfptpd_time_timespec_to_float_ns(&(pkt)->ts)); \
+		trace(SFPTPD_COMPONENT_ID_PTPD2, BENCH_LEVEL + 1, \
+		      "acl match %s\n", "permit"); \
+	} while (0)
+
+
+static void bench_legacy(struct bench_packet *pkts, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+		BENCH_RX_PATH(LEGACY_TRACE, &pkts[i & 0xff]);
+}
+
+
+static void bench_inline(struct bench_packet *pkts, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+		BENCH_RX_PATH(TRACE, &pkts[i & 0xff]);
+}
+
+
+static bool test_argument_evaluation(void)
+{
+	unsigned int saved = sfptpd_trace_levels[SFPTPD_COMPONENT_ID_SFPTPD];
+	bool success = true;
+
+	sfptpd_log_set_trace_level(SFPTPD_COMPONENT_ID_SFPTPD, 1);
+
+	evaluations = 0;
+	TRACE_L6("disabled trace %d\n", count_evaluation(6));
+	TRACE_L2("disabled trace %d\n", count_evaluation(2));
+	if (evaluations != 0) {
+		printf("disabled trace evaluated arguments %u times\n",
+		       evaluations);
+		success = false;
+	}
+
+	evaluations = 0;
+	TRACE_L1("logging test: enabled trace %d\n", count_evaluation(1));
+	if (evaluations != 1) {
+		printf("enabled trace evaluated arguments %u times\n",
+		       evaluations);
+		success = false;
+	}
+
+	sfptpd_log_set_trace_level(SFPTPD_COMPONENT_ID_SFPTPD, saved);
+	return success;
+}
+
+
+static void benchmark_trace_points(void)
+{
+	static struct bench_packet pkts[256];
+	struct timespec t0, t1, t2;
+	unsigned int saved = sfptpd_trace_levels[SFPTPD_COMPONENT_ID_PTPD2];
+	long double legacy, inlined;
+	int i;
+
+	sfptpd_log_set_trace_level(SFPTPD_COMPONENT_ID_PTPD2, 0);
+
+	for (i = 0; i < 256; i++) {
+		sfptpd_time_from_ns(&pkts[i].ts, (int64_t) i * 1000000007LL);
+		pkts[i].seq = i;
+		pkts[i].if_index = i % 8;
+		pkts[i].if_name = "eth0";
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	bench_legacy(pkts, BENCH_PACKETS);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	bench_inline(pkts, BENCH_PACKETS);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	legacy = elapsed_ns(&t0, &t1) / BENCH_PACKETS;
+	inlined = elapsed_ns(&t1, &t2) / BENCH_PACKETS;
+
+	printf("disabled trace cost per packet (4 trace points): "
+	       "call %0.2Lf ns, inline check %0.2Lf ns, saving %0.2Lf ns\n",
+	       legacy, inlined, legacy - inlined);
+
+	sfptpd_log_set_trace_level(SFPTPD_COMPONENT_ID_PTPD2, saved);
+}
+
+
+static void *order_thread(void *arg)
+{
+	int thread = (int) (intptr_t) arg;
+	int i;
+
+	for (i = 0; i < ORDER_MESSAGES; i++) {
+		pthread_mutex_lock(&order_lock);
+		NOTICE("order %d %d\n", thread, order_next++);
+		pthread_mutex_unlock(&order_lock);
+	}
+	return NULL;
+}
+
+
+/* Find the text of the message with a given prefix in the log */
+static const char *find_message(char **lines, int count, const char *prefix)
+{
+	const char *text;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		text = strstr(lines[i], ": notice: ");
+		if (text != NULL && strncmp(text + 10, prefix, strlen(prefix)) == 0)
+			return text + 10;
+	}
+	return NULL;
+}
+
+
+static bool check_message(char **lines, int count, const char *expected)
+{
+	const char *prefix_end = strchr(expected, '[');
+	char prefix[32];
+	const char *text;
+
+	snprintf(prefix, sizeof prefix, "%.*s",
+		 (int) (prefix_end - expected + 1), expected);
+	text = find_message(lines, count, prefix);
+	if (text == NULL || strcmp(text, expected) != 0) {
+		printf("ERROR: async message \"%.60s\", expected \"%.60s\"\n",
+		       text == NULL ? "(missing)" : text, expected);
+		return false;
+	}
+	return true;
+}
+
+
+/* Check that messages from several threads are written in the order they
+ * were logged, allowing for messages dropped from full rings */
+static bool check_order(char **lines, int count)
+{
+	unsigned long long dropped = 0;
+	unsigned long long n;
+	int received = 0;
+	int last = -1;
+	int thread, seq;
+	const char *text;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if ((text = strstr(lines[i], ": notice: order ")) != NULL &&
+		    sscanf(text, ": notice: order %d %d", &thread, &seq) == 2) {
+			if (seq <= last) {
+				printf("ERROR: message %d from thread %d written after %d\n",
+				       seq, thread, last);
+				return false;
+			}
+			last = seq;
+			received++;
+		} else if (strstr(lines[i], " messages dropped from thread ") != NULL &&
+			   (text = strstr(lines[i], ": logging: ")) != NULL &&
+			   sscanf(text, ": logging: %llu", &n) == 1) {
+			dropped += n;
+		}
+	}
+
+	if (received + dropped != ORDER_THREADS * ORDER_MESSAGES) {
+		printf("ERROR: %d messages written and %llu dropped, expected %d\n",
+		       received, dropped, ORDER_THREADS * ORDER_MESSAGES);
+		return false;
+	}
+	printf("async logging: %d messages written in order, %llu dropped\n",
+	       received, dropped);
+	return true;
+}
+
+
+/* Log through the asynchronous writer to a file and check the messages
+ * written when logging is closed */
+static bool test_async_logging(void)
+{
+	char dir[] = "/tmp/sfptpd-test-logging.XXXXXX";
+	struct sfptpd_config_general *general;
+	struct sfptpd_config *config;
+	pthread_t threads[ORDER_THREADS];
+	char expected[ASYNC_MAX_STRING + 16];
+	char long_string[ASYNC_MAX_STRING + 100];
+	char copied[] = "original";
+	char path[PATH_MAX];
+	char **lines = NULL;
+	size_t line_space = 0;
+	char *line = NULL;
+	size_t line_len = 0;
+	int count = 0;
+	bool success = true;
+	glob_t files;
+	FILE *file;
+	int saved_stderr;
+	int i;
+
+	if (mkdtemp(dir) == NULL || sfptpd_config_create(&config) != 0) {
+		printf("ERROR: could not set up logging test, %s\n", strerror(errno));
+		return false;
+	}
+	general = sfptpd_general_config_get(config);
+	general->message_log = SFPTPD_MSG_LOG_TO_FILE;
+	general->stats_log = SFPTPD_STATS_LOG_OFF;
+	general->message_log_async = true;
+	snprintf(general->state_path, sizeof general->state_path, "%s", dir);
+	snprintf(general->message_log_filename,
+		 sizeof general->message_log_filename, "%s/messages", dir);
+
+	/* Opening the log redirects stderr to the file */
+	saved_stderr = dup(STDERR_FILENO);
+	if (sfptpd_log_open(config) != 0 || sfptpd_log_async_start() != 0) {
+		dup2(saved_stderr, STDERR_FILENO);
+		close(saved_stderr);
+		printf("ERROR: could not open asynchronous log\n");
+		sfptpd_config_destroy(config);
+		return false;
+	}
+
+	/* Strings are copied when logged and long ones truncated */
+	NOTICE("copy [%s]\n", copied);
+	strcpy(copied, "changed");
+	memset(long_string, 'x', sizeof long_string - 1);
+	long_string[sizeof long_string - 1] = '\0';
+	NOTICE("trunc [%s]\n", long_string);
+
+	/* Widths and precisions given as arguments */
+	NOTICE("star [%*d|%-*.*f|%.*s]\n", 6, 42, 10, 3, 3.14159, 3, "abcdef");
+
+	/* The error is that when the message was logged */
+	errno = ENOENT;
+	NOTICE("errno [%m]\n");
+	errno = 0;
+
+	for (i = 0; i < ORDER_THREADS; i++)
+		pthread_create(&threads[i], NULL, order_thread, (void *) (intptr_t) i);
+	for (i = 0; i < ORDER_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Closing writes out everything queued */
+	sfptpd_log_close();
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stderr);
+	sfptpd_config_destroy(config);
+
+	snprintf(path, sizeof path, "%s/messages", dir);
+	file = fopen(path, "r");
+	if (file == NULL) {
+		printf("ERROR: could not read %s, %s\n", path, strerror(errno));
+		success = false;
+	} else {
+		while (getline(&line, &line_len, file) > 0) {
+			if (count == line_space) {
+				line_space = line_space == 0 ? 1024 : line_space * 2;
+				lines = realloc(lines, line_space * sizeof *lines);
+				assert(lines != NULL);
+			}
+			lines[count] = strdup(line);
+			assert(lines[count] != NULL);
+			count++;
+		}
+		free(line);
+		fclose(file);
+
+		success &= check_message(lines, count, "copy [original]\n");
+		snprintf(expected, sizeof expected, "trunc [%.*s]\n",
+			 ASYNC_MAX_STRING, long_string);
+		success &= check_message(lines, count, expected);
+		snprintf(expected, sizeof expected, "star [%*d|%-*.*f|%.*s]\n",
+			 6, 42, 10, 3, 3.14159, 3, "abcdef");
+		success &= check_message(lines, count, expected);
+		snprintf(expected, sizeof expected, "errno [%s]\n", strerror(ENOENT));
+		success &= check_message(lines, count, expected);
+		success &= check_order(lines, count);
+
+		for (i = 0; i < count; i++)
+			free(lines[i]);
+		free(lines);
+	}
+
+	snprintf(path, sizeof path, "%s/*", dir);
+	if (glob(path, 0, NULL, &files) == 0) {
+		for (i = 0; i < files.gl_pathc; i++)
+			unlink(files.gl_pathv[i]);
+		globfree(&files);
+	}
+	rmdir(dir);
+
+	return success;
+}
+
+
+/****************************************************************************
+ * Entry Point
+ ****************************************************************************/
+
+int sfptpd_test_logging(void)
+{
+	bool success = true;
+
+	success &= test_argument_evaluation();
+	success &= test_async_logging();
+	benchmark_trace_points();
+
+	return success ? 0 : EINVAL;
+}
+
+
+/* fin */
@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* (c) Copyright 2024 Advanced Micro Devices, Inc. */
+
+/**
+ * @file   sfptpd_test_metrics.c
+ * @brief  OpenMetrics exporter unit test
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sfptpd_metrics.h"
+#include "sfptpd_test.h"
+
+
+/****************************************************************************
+ * Types and Constants
+ ****************************************************************************/
+
+struct address_test {
+	const char *spec;
+	int rc;
+	int family;
+	const char *host;
+	unsigned int port;
+};
+
+static const struct address_test address_tests[] = {
+	/* Unix domain sockets */
+	{ "/run/sfptpd/metrics.sock", 0, AF_UNIX, "/run/sfptpd/metrics.sock", 0 },
+	{ "/" "0123456789012345678901234567890123456789"
+	  "0123456789012345678901234567890123456789"
+	  "0123456789012345678901234567890123456789", ENAMETOOLONG, 0, NULL, 0 },
+
+	/* IPv4 */
+	{ "9765", 0, AF_INET, "127.0.0.1", 9765 },
+	{ "0.0.0.0:80", 0, AF_INET, "0.0.0.0", 80 },
+	{ "192.168.1.2:65535", 0, AF_INET, "192.168.1.2", 65535 },
+
+	/* IPv6 */
+	{ "[::1]:9765", 0, AF_INET6, "::1", 9765 },
+	{ "[fe80::1:2]:1", 0, AF_INET6, "fe80::1:2", 1 },
+	{ ":::443", 0, AF_INET6, "::", 443 },
+
+	/* Malformed */
+	{ "", EINVAL, 0, NULL, 0 },
+	{ "0", EINVAL, 0, NULL, 0 },
+	{ "65536", EINVAL, 0, NULL, 0 },
+	{ "-1", EINVAL, 0, NULL, 0 },
+	{ "80x", EINVAL, 0, NULL, 0 },
+	{ "metrics.sock", EINVAL, 0, NULL, 0 },
+	{ "127.0.0.1:", EINVAL, 0, NULL, 0 },
+	{ ":9765", EINVAL, 0, NULL, 0 },
+	{ "localhost:9765", EINVAL, 0, NULL, 0 },
+	{ "256.0.0.1:9765", EINVAL, 0, NULL, 0 },
+	{ "[::1]", EINVAL, 0, NULL, 0 },
+	{ "[]:9765", EINVAL, 0, NULL, 0 },
+	{ "[::g]:9765", EINVAL, 0, NULL, 0 },
+};
+
+
+/****************************************************************************
+ * Local Functions
+ ****************************************************************************/
+
+static bool run_address_test(const struct address_test *test)
+{
+	struct sockaddr_storage addr;
+	struct sockaddr_un *sun = (struct sockaddr_un *) &addr;
+	struct sockaddr_in *sin = (struct sockaddr_in *) &addr;
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &addr;
+	char host[INET6_ADDRSTRLEN];
+	unsigned int port = 0;
+	socklen_t len = 0;
+	int rc;
+
+	rc = sfptpd_metrics_parse_address(test->spec, &addr, &len);
+	if (rc != test->rc) {
+		printf("ERROR: \"%s\": returned %s, expected %s\n", test->spec,
+		       strerror(rc), strerror(test->rc));
+		return false;
+	}
+	if (rc != 0)
+		return true;
+
+	if (addr.ss_family != test->family) {
+		printf("ERROR: \"%s\": family %d, expected %d\n", test->spec,
+		       addr.ss_family, test->family);
+		return false;
+	}
+
+	switch (addr.ss_family) {
+	case AF_UNIX:
+		if (len != sizeof *sun || strcmp(sun->sun_path, test->host) != 0) {
+			printf("ERROR: \"%s\": path %s\n", test->spec, sun->sun_path);
+			return false;
+		}
+		return true;
+	case AF_INET:
+		inet_ntop(AF_INET, &sin->sin_addr, host, sizeof host);
+		port = ntohs(sin->sin_port);
+		rc = (len == sizeof *sin) ? 0 : EINVAL;
+		break;
+	case AF_INET6:
+		inet_ntop(AF_INET6, &sin6->sin6_addr, host, sizeof host);
+		port = ntohs(sin6->sin6_port);
+		rc = (len == sizeof *sin6) ? 0 : EINVAL;
+		break;
+	}
+
+	if (rc != 0 || strcmp(host, test->host) != 0 || port != test->port) {
+		printf("ERROR: \"%s\": address %s port %u length %u, expected %s port %u\n",
+		       test->spec, host, port, (unsigned int) len,
+		       test->host, test->port);
+		return false;
+	}
+	return true;
+}
+
+
+/****************************************************************************
+ * Entry Point
+ ****************************************************************************/
+
+int sfptpd_test_metrics(void)
+{
+	const int n_tests = sizeof address_tests / sizeof address_tests[0];
+	int failures = 0;
+	int i;
+
+	for (i = 0; i < n_tests; i++) {
+		if (!run_address_test(&address_tests[i]))
+			failures++;
+	}
+
+	if (failures != 0) {
+		printf("metrics address parsing: %d out of %d unit tests failed\n",
+		       failures, n_tests);
+		return ERANGE;
+	}
+	return 0;
+}
+
+
+/* fin */
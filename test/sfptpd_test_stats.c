@@ -21,11 +21,13 @@
 #include <limits.h>
 #include <math.h>
 #include <float.h>
+#include <malloc.h>
 
 #include "sfptpd_config.h"
 #include "sfptpd_misc.h"
 #include "sfptpd_test.h"
 #include "sfptpd_statistics.h"
+#include "sfptpd_constants.h"
 
 
 /****************************************************************************
@@ -137,6 +139,384 @@ static int test_std_dev(void)
 }
 
 
+static int compare_long_doubles(const void *a, const void *b)
+{
+	long double x = *(const long double *) a;
+	long double y = *(const long double *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+static int test_quantile(void)
+{
+	static struct sfptpd_stats_quantile whole, part[2];
+	static long double data[MAX_SAMPLES];
+	static const long double qs[] = { 0.0L, 0.25L, 0.5L, 0.9L, 0.99L, 0.999L, 1.0L };
+	long double expected, actual, tolerance;
+	unsigned int num_samples, i, s, q;
+	int rc = 0;
+
+	/* 32 Iterations */
+	for (i = 0; i < 32; i++) {
+		do
+			num_samples = rand() % MAX_SAMPLES;
+		while (num_samples == 0);
+
+		sfptpd_stats_quantile_init(&whole);
+		sfptpd_stats_quantile_init(&part[0]);
+		sfptpd_stats_quantile_init(&part[1]);
+
+		/* Signed samples spread over many orders of magnitude */
+		for (s = 0; s < num_samples; s++) {
+			data[s] = ldexpl((long double) rand() / RAND_MAX,
+				       rand() % SFPTPD_STATS_QUANTILE_OCTAVES);
+			if (rand() & 1)
+				data[s] = -data[s];
+			sfptpd_stats_quantile_update(&whole, data[s], true);
+			sfptpd_stats_quantile_update(&part[rand() & 1], data[s], true);
+		}
+
+		/* A sketch accumulated in parts must match the whole */
+		sfptpd_stats_quantile_add(&part[0], &part[1]);
+		if (part[0].num_samples != num_samples ||
+		    memcmp(part[0].buckets, whole.buckets, sizeof whole.buckets) != 0) {
+			printf("ERROR: merged quantile sketch differs\n");
+			rc = EIO;
+		}
+
+		qsort(data, num_samples, sizeof data[0], compare_long_doubles);
+
+		for (q = 0; q < sizeof qs / sizeof qs[0]; q++) {
+			s = (unsigned int) ceill(qs[q] * num_samples);
+			expected = data[s == 0 ? 0 : s - 1];
+			actual = sfptpd_stats_quantile_get(&part[0], qs[q]);
+
+			/* Half a bucket, or the zero bucket */
+			tolerance = fabsl(expected) / (2 * SFPTPD_STATS_QUANTILE_SUB_BUCKETS);
+			if (tolerance < 1.0L)
+				tolerance = 1.0L;
+
+			if (fabsl(actual - expected) > tolerance) {
+				printf("ERROR: quantile %Lg of %u samples actual %Lf, expected %Lf\n",
+				       qs[q], num_samples, actual, expected);
+				rc = EIO;
+			}
+		}
+	}
+
+	/* Samples of a constant are reported exactly */
+	sfptpd_stats_quantile_init(&whole);
+	for (s = 0; s < 100; s++)
+		sfptpd_stats_quantile_update(&whole, 12345.678L, true);
+	if (sfptpd_stats_quantile_get(&whole, 0.99L) != 12345.678L) {
+		printf("ERROR: quantile of constant samples is inexact\n");
+		rc = EIO;
+	}
+
+	/* Empty and unqualified sketches */
+	sfptpd_stats_quantile_init(&whole);
+	sfptpd_stats_quantile_update(&whole, 1.0L, false);
+	if (!isnan(sfptpd_stats_quantile_get(&whole, 0.5L)) || whole.qualified) {
+		printf("ERROR: unqualified quantile sample was recorded\n");
+		rc = EIO;
+	}
+
+	return rc;
+}
+
+
+static int test_quantile_history(void)
+{
+	struct sfptpd_stats_collection stats;
+	struct sfptpd_timespec now = { 0, 0 };
+	long double values[SFPTPD_STATS_NUM_QUANTILES];
+	unsigned long num_samples;
+	int minute, tick, s;
+	int rc;
+
+	rc = sfptpd_stats_collection_alloc(&stats, "test");
+	if (rc == 0)
+		rc = sfptpd_stats_collection_add(&stats, 0, SFPTPD_STATS_TYPE_QUANTILE,
+						 "offset", "ns", 0);
+	if (rc != 0)
+		return rc;
+
+	/* Ten minutes of samples 1..1000 with each minute a tenth of the
+	 * range, so that each quantile lies in a different minute. */
+	for (minute = 0; minute < 10; minute++) {
+		for (tick = 0; tick < 60 / SFPTPD_STATS_COLLECTION_INTERVAL; tick++) {
+			if (tick == 0)
+				for (s = 1; s <= 100; s++)
+					sfptpd_stats_collection_update_quantile(&stats, 0,
+										minute * 100 + s,
+										true);
+			now.sec += SFPTPD_STATS_COLLECTION_INTERVAL;
+			sfptpd_stats_collection_end_period(&stats, &now);
+		}
+	}
+
+	rc = sfptpd_stats_collection_get_quantiles(&stats, 0,
+						   SFPTPD_STATS_PERIOD_TEN_MINUTES,
+						   SFPTPD_STATS_HISTORY_1,
+						   values, &num_samples);
+	if (rc != 0) {
+		printf("ERROR: no ten minute quantiles, %s\n", strerror(rc));
+	} else if (num_samples != 1000 ||
+		   fabsl(values[0] - 500) > 500.0L / SFPTPD_STATS_QUANTILE_SUB_BUCKETS ||
+		   fabsl(values[2] - 990) > 990.0L / SFPTPD_STATS_QUANTILE_SUB_BUCKETS) {
+		printf("ERROR: ten minute quantiles %lu samples, p50 %Lf, p99 %Lf\n",
+		       num_samples, values[0], values[2]);
+		rc = EIO;
+	}
+
+	sfptpd_stats_collection_free(&stats);
+	return rc;
+}
+
+
+/* Report the memory used by a collection shaped like that of a PTP
+ * instance, when created and once every time period has completed, and
+ * check the longest periods are rolled up correctly. */
+static int test_memory(void)
+{
+	struct sfptpd_stats_collection stats;
+	struct sfptpd_timespec now = { 0, 0 };
+	struct mallinfo2 before, created, week;
+	long double values[SFPTPD_STATS_NUM_QUANTILES];
+	long double mean = 0.0L, min = 0.0L, max = 0.0L;
+	unsigned long count = 0;
+	unsigned int id, minute;
+	int rc = 0;
+
+	before = mallinfo2();
+	rc = sfptpd_stats_collection_alloc(&stats, "test");
+	for (id = 0; id < 28 && rc == 0; id++) {
+		rc = sfptpd_stats_collection_add(&stats, id,
+						 id < 5 ? SFPTPD_STATS_TYPE_RANGE :
+						 id < 26 ? SFPTPD_STATS_TYPE_COUNT :
+						 SFPTPD_STATS_TYPE_QUANTILE,
+						 "item", NULL, 0);
+	}
+	if (rc != 0)
+		return rc;
+	created = mallinfo2();
+
+	for (minute = 0; minute < 60 * 24 * 7; minute++) {
+		sfptpd_stats_collection_update_range(&stats, 0, minute, now, true);
+		sfptpd_stats_collection_update_count(&stats, 5, 1);
+		sfptpd_stats_collection_update_quantile(&stats, 26, minute, true);
+		sfptpd_stats_collection_update_quantile(&stats, 27, -1.0L * minute, true);
+		now.sec += SFPTPD_STATS_COLLECTION_INTERVAL;
+		sfptpd_stats_collection_end_period(&stats, &now);
+	}
+	week = mallinfo2();
+
+	printf("stats memory for PTP instance collection: %zu bytes created, %zu bytes after a week\n",
+	       created.uordblks - before.uordblks, week.uordblks - before.uordblks);
+
+	/* Check each period has been rolled up from the minutes */
+	rc = sfptpd_stats_collection_get_count(&stats, 5, SFPTPD_STATS_PERIOD_DAY,
+					       SFPTPD_STATS_HISTORY_1, &count);
+	if (rc != 0 || count != 60 * 24) {
+		printf("ERROR: day count %lu, expected %d\n", count, 60 * 24);
+		rc = EIO;
+	}
+	if (rc == 0)
+		rc = sfptpd_stats_collection_get_range(&stats, 0, SFPTPD_STATS_PERIOD_WEEK,
+						       SFPTPD_STATS_HISTORY_1,
+						       &mean, &min, &max, NULL, NULL, NULL);
+	if (rc != 0 || min != 0.0L || max != minute - 1 || mean != (minute - 1) / 2.0L) {
+		printf("ERROR: week range mean %Lf, min %Lf, max %Lf\n", mean, min, max);
+		rc = EIO;
+	}
+	if (rc == 0)
+		rc = sfptpd_stats_collection_get_quantiles(&stats, 27, SFPTPD_STATS_PERIOD_WEEK,
+							   SFPTPD_STATS_HISTORY_1,
+							   values, &count);
+	if (rc != 0 || count != minute ||
+	    fabsl(values[0] + minute / 2) > minute / 2.0L / SFPTPD_STATS_QUANTILE_SUB_BUCKETS) {
+		printf("ERROR: week quantiles %lu samples, p50 %Lf\n", count, values[0]);
+		rc = EIO;
+	}
+
+	sfptpd_stats_collection_free(&stats);
+	return rc;
+}
+
+
+/* Create a small collection with one item of each type, optionally with
+ * an extra item to change its definition, and keep its history in a file */
+static int persist_collection(struct sfptpd_stats_collection *stats,
+			      const char *path, bool extra)
+{
+	int rc;
+
+	rc = sfptpd_stats_collection_alloc(stats, "test");
+	if (rc == 0)
+		rc = sfptpd_stats_collection_add(stats, 0, SFPTPD_STATS_TYPE_RANGE,
+						 "range", NULL, 0);
+	if (rc == 0)
+		rc = sfptpd_stats_collection_add(stats, 1, SFPTPD_STATS_TYPE_COUNT,
+						 "count", NULL, 0);
+	if (rc == 0)
+		rc = sfptpd_stats_collection_add(stats, 2, SFPTPD_STATS_TYPE_QUANTILE,
+						 "quantile", NULL, 0);
+	if (rc == 0 && extra)
+		rc = sfptpd_stats_collection_add(stats, 3, SFPTPD_STATS_TYPE_COUNT,
+						 "extra", NULL, 0);
+	if (rc == 0)
+		rc = sfptpd_stats_collection_map(stats, path);
+	return rc;
+}
+
+
+/* Check that history kept in a file is restored by a collection with the
+ * same definition and discarded by one with a different definition or that
+ * is out of date */
+static int test_persist(void)
+{
+	struct sfptpd_stats_collection stats;
+	struct sfptpd_stats_time_interval interval;
+	struct sfptpd_timespec now, saved;
+	char path[] = "/tmp/sfptpd_test_stats.XXXXXX";
+	long double values[SFPTPD_STATS_NUM_QUANTILES];
+	long double mean = 0.0L, min = 0.0L, max = 0.0L;
+	unsigned long count = 0;
+	unsigned int minute;
+	int fd;
+	int rc;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return errno;
+	close(fd);
+
+	/* Record 70 minutes of history ending now */
+	sfclock_gettime(CLOCK_REALTIME, &now);
+	now.sec -= 70 * SFPTPD_STATS_COLLECTION_INTERVAL;
+	rc = persist_collection(&stats, path, false);
+	if (rc != 0)
+		goto finish;
+	for (minute = 0; minute < 70; minute++) {
+		sfptpd_stats_collection_update_range(&stats, 0, minute, now, true);
+		sfptpd_stats_collection_update_count(&stats, 1, 1);
+		sfptpd_stats_collection_update_quantile(&stats, 2, minute, true);
+		now.sec += SFPTPD_STATS_COLLECTION_INTERVAL;
+		sfptpd_stats_collection_end_period(&stats, &now);
+	}
+	sfptpd_stats_collection_free(&stats);
+	saved = now;
+
+	/* Restart with the same definition. The interrupted intervals end
+	 * when the history was saved and the current ones start afresh. */
+	rc = persist_collection(&stats, path, false);
+	if (rc != 0)
+		goto finish;
+	rc = sfptpd_stats_collection_get_interval(&stats, SFPTPD_STATS_PERIOD_MINUTE,
+						  SFPTPD_STATS_HISTORY_CURRENT, &interval);
+	if (rc != 0 || interval.seq_num != 70 ||
+	    sfptpd_time_cmp(&interval.start_time, &saved) < 0) {
+		printf("ERROR: restored minute sequence number %lu, expected 70\n",
+		       interval.seq_num);
+		rc = EIO;
+	}
+	if (rc == 0)
+		rc = sfptpd_stats_collection_get_interval(&stats, SFPTPD_STATS_PERIOD_HOUR,
+							  SFPTPD_STATS_HISTORY_1, &interval);
+	if (rc != 0 || !interval.end_valid ||
+	    sfptpd_time_cmp(&interval.end_time, &saved) != 0) {
+		printf("ERROR: interrupted hour not ended when history was saved\n");
+		rc = EIO;
+	}
+	if (rc == 0)
+		rc = sfptpd_stats_collection_get_count(&stats, 1, SFPTPD_STATS_PERIOD_HOUR,
+						       SFPTPD_STATS_HISTORY_1, &count);
+	if (rc != 0 || count != 10) {
+		printf("ERROR: interrupted hour count %lu, expected 10\n", count);
+		rc = EIO;
+	}
+	if (rc == 0)
+		rc = sfptpd_stats_collection_get_count(&stats, 1, SFPTPD_STATS_PERIOD_HOUR,
+						       SFPTPD_STATS_HISTORY_CURRENT, &count);
+	if (rc != 0 || count != 0) {
+		printf("ERROR: restored current hour count %lu, expected 0\n", count);
+		rc = EIO;
+	}
+	if (rc == 0)
+		rc = sfptpd_stats_collection_get_range(&stats, 0, SFPTPD_STATS_PERIOD_HOUR,
+						       SFPTPD_STATS_HISTORY_2,
+						       &mean, &min, &max, NULL, NULL, NULL);
+	if (rc != 0 || min != 0.0L || max != 59.0L || mean != 29.5L) {
+		printf("ERROR: restored hour range mean %Lf, min %Lf, max %Lf\n",
+		       mean, min, max);
+		rc = EIO;
+	}
+	if (rc == 0)
+		rc = sfptpd_stats_collection_get_quantiles(&stats, 2, SFPTPD_STATS_PERIOD_TEN_MINUTES,
+							   SFPTPD_STATS_HISTORY_1,
+							   values, &count);
+	if (rc != 0 || count != 10) {
+		printf("ERROR: restored ten minute quantiles %lu samples, expected 10\n",
+		       count);
+		rc = EIO;
+	}
+
+	/* Carry on recording after the restart */
+	if (rc == 0) {
+		sfptpd_stats_collection_update_count(&stats, 1, 1);
+		now.sec += SFPTPD_STATS_COLLECTION_INTERVAL;
+		sfptpd_stats_collection_end_period(&stats, &now);
+		rc = sfptpd_stats_collection_get_count(&stats, 1, SFPTPD_STATS_PERIOD_HOUR,
+						       SFPTPD_STATS_HISTORY_CURRENT, &count);
+		if (rc != 0 || count != 1) {
+			printf("ERROR: current hour count %lu after restart, expected 1\n",
+			       count);
+			rc = EIO;
+		}
+	}
+	sfptpd_stats_collection_free(&stats);
+	if (rc != 0)
+		goto finish;
+
+	/* Restart with a different definition */
+	rc = persist_collection(&stats, path, true);
+	if (rc != 0)
+		goto finish;
+	if (sfptpd_stats_collection_get_count(&stats, 1, SFPTPD_STATS_PERIOD_HOUR,
+					      SFPTPD_STATS_HISTORY_1, &count) != ENOENT) {
+		printf("ERROR: history restored for a different definition\n");
+		rc = EIO;
+	}
+	sfptpd_stats_collection_free(&stats);
+	if (rc != 0)
+		goto finish;
+
+	/* Restart more than a stats period after the history was saved */
+	sfclock_gettime(CLOCK_REALTIME, &now);
+	now.sec -= 2 * SFPTPD_STATS_COLLECTION_INTERVAL;
+	rc = persist_collection(&stats, path, false);
+	if (rc == 0) {
+		sfptpd_stats_collection_update_count(&stats, 1, 1);
+		sfptpd_stats_collection_end_period(&stats, &now);
+		sfptpd_stats_collection_free(&stats);
+		rc = persist_collection(&stats, path, false);
+	}
+	if (rc != 0)
+		goto finish;
+	if (sfptpd_stats_collection_get_count(&stats, 1, SFPTPD_STATS_PERIOD_MINUTE,
+					      SFPTPD_STATS_HISTORY_1, &count) != ENOENT) {
+		printf("ERROR: out of date history restored\n");
+		rc = EIO;
+	}
+	sfptpd_stats_collection_free(&stats);
+
+finish:
+	unlink(path);
+	return rc;
+}
+
+
 /****************************************************************************
  * Entry Point
  ****************************************************************************/
@@ -146,6 +526,14 @@ int sfptpd_test_stats(void)
 	int rc;
 
 	rc = test_std_dev();
+	if (rc == 0)
+		rc = test_quantile();
+	if (rc == 0)
+		rc = test_quantile_history();
+	if (rc == 0)
+		rc = test_memory();
+	if (rc == 0)
+		rc = test_persist();
 
 	return rc;
 }